@@ -0,0 +1,208 @@
+#include "MinCostAssignment.h"
+
+#include <queue>
+#include <limits>
+
+//---------------------------------------------------------------------------------------------------------------------
+//
+MinCostAssignment::MinCostAssignment(int numLeft, int numRight)
+{
+  this->numLeft = numLeft;
+  this->numRight = numRight;
+  sinkPotential = 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+//
+int MinCostAssignment::addArc(int left, int right, double weight)
+{
+  if(weight <= 0)
+    return -1;
+  arcLeft.push_back(left);
+  arcRight.push_back(right);
+  arcWeight.push_back(weight);
+  return (int)arcRight.size()-1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+//
+double MinCostAssignment::solve(void)
+{
+  int numArcs = (int)arcRight.size();
+
+  // arcs grouped by left node, in the order they were added
+  rowStart.assign(numLeft+1,0);
+  for(int a = 0; a < numArcs; a++)
+    rowStart[arcLeft[a]+1]++;
+  for(int x = 0; x < numLeft; x++)
+    rowStart[x+1] += rowStart[x];
+  rowArcs.resize(numArcs);
+  std::vector<int> fill(rowStart.begin(),rowStart.end()-1);
+  for(int a = 0; a < numArcs; a++)
+    rowArcs[fill[arcLeft[a]]++] = a;
+
+  leftMate.assign(numLeft,-1);
+  rightMate.assign(numRight,-1);
+
+  // with an empty matching the reduced costs (-weight + p[left] - p[right]) of all the arcs,
+  // and those of the arcs to the sink (p[node] - p[sink]), must be non-negative
+  leftPotential.assign(numLeft,0);
+  rightPotential.assign(numRight,0);
+  for(int a = 0; a < numArcs; a++)
+  {
+    if(-arcWeight[a] < rightPotential[arcRight[a]])
+      rightPotential[arcRight[a]] = -arcWeight[a];
+  }
+  sinkPotential = 0;
+  for(int r = 0; r < numRight; r++)
+  {
+    if(rightPotential[r] < sinkPotential)
+      sinkPotential = rightPotential[r];
+  }
+
+  dist.assign(numLeft+numRight,std::numeric_limits<double>::max());
+  predArc.assign(numLeft+numRight,-1);
+  settled.assign(numLeft+numRight,0);
+  touched.clear();
+
+  for(int x = 0; x < numLeft; x++)
+  {
+    if(rowStart[x+1] > rowStart[x])
+      augment(x);
+  }
+
+  double total = 0;
+  for(int r = 0; r < numRight; r++)
+  {
+    if(rightMate[r] >= 0)
+      total += arcWeight[rightMate[r]];
+  }
+  return total;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Shortest path from the free left node u to the sink in the residual graph. The residual arcs are: left to right
+// for the unmatched arcs, right to left for the matched ones, a free right node to the sink, and a left node to the
+// sink (leaving it unmatched).
+// With fractional weights the reduced costs of the tight arcs can come out as -1e-16 instead of 0. They are clamped
+// at 0, and a settled node is never relaxed again: otherwise its predecessor can be overwritten after the nodes
+// behind it were reached through it, and the path from the sink back to u loops forever.
+void MinCostAssignment::augment(int u)
+{
+  const double inf = std::numeric_limits<double>::max();
+  std::priority_queue<HeapItem> heap;
+  HeapItem item;
+
+  dist[u] = 0;
+  touched.push_back(u);
+  item.dist = 0;
+  item.node = u;
+  heap.push(item);
+
+  double sinkDist = inf;
+  int sinkFrom = -1;
+  while(!heap.empty())
+  {
+    item = heap.top();
+    heap.pop();
+    int node = item.node;
+    if(settled[node] || item.dist > dist[node])
+      continue;
+    if(item.dist >= sinkDist)
+      break;
+    settled[node] = 1;
+
+    if(node < numLeft)
+    {
+      int x = node;
+      double d = dist[x] + reducedCost(leftPotential[x] - sinkPotential);
+      if(d < sinkDist)
+      {
+        sinkDist = d;
+        sinkFrom = x;
+      }
+      for(int k = rowStart[x]; k < rowStart[x+1]; k++)
+      {
+        int a = rowArcs[k];
+        if(leftMate[x] == a)
+          continue;
+        int r = arcRight[a];
+        int next = numLeft + r;
+        double nd = dist[x] + reducedCost(-arcWeight[a] + leftPotential[x] - rightPotential[r]);
+        if(!settled[next] && nd < dist[next])
+        {
+          if(dist[next] == inf)
+            touched.push_back(next);
+          dist[next] = nd;
+          predArc[next] = a;
+          item.dist = nd;
+          item.node = next;
+          heap.push(item);
+        }
+      }
+    }
+    else
+    {
+      int r = node - numLeft;
+      if(rightMate[r] < 0)
+      {
+        double d = dist[node] + reducedCost(rightPotential[r] - sinkPotential);
+        if(d < sinkDist)
+        {
+          sinkDist = d;
+          sinkFrom = node;
+        }
+      }
+      else
+      {
+        int a = rightMate[r];
+        int x = arcLeft[a];
+        double nd = dist[node] + reducedCost(arcWeight[a] + rightPotential[r] - leftPotential[x]);
+        if(!settled[x] && nd < dist[x])
+        {
+          if(dist[x] == inf)
+            touched.push_back(x);
+          dist[x] = nd;
+          predArc[x] = a;
+          item.dist = nd;
+          item.node = x;
+          heap.push(item);
+        }
+      }
+    }
+  }
+
+  // flip the arcs along the path, from its end back to u
+  int node = sinkFrom;
+  if(node < numLeft)
+  {
+    leftMate[node] = -1;
+    node = (node == u) ? -1 : numLeft + arcRight[predArc[node]];
+  }
+  while(node >= 0)
+  {
+    int a = predArc[node];
+    int x = arcLeft[a];
+    int previous = predArc[x];
+    rightMate[node - numLeft] = a;
+    leftMate[x] = a;
+    node = (x == u) ? -1 : numLeft + arcRight[previous];
+  }
+
+  // keep the reduced costs non-negative: only the nodes closer than the sink move
+  for(unsigned int i = 0; i < touched.size(); i++)
+  {
+    int n = touched[i];
+    if(settled[n] && dist[n] < sinkDist)
+    {
+      if(n < numLeft)
+        leftPotential[n] -= sinkDist - dist[n];
+      else
+        rightPotential[n-numLeft] -= sinkDist - dist[n];
+    }
+    dist[n] = inf;
+    predArc[n] = -1;
+    settled[n] = 0;
+  }
+  touched.clear();
+}
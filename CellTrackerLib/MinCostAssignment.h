@@ -0,0 +1,60 @@
+#ifndef MINCOSTASSIGNMENT_H
+#define MINCOSTASSIGNMENT_H
+
+#include <vector>
+
+// Maximum weight matching between the out-ports (left nodes) and the in-ports
+// (right nodes) of a tracking graph, solved as a min-cost flow: every left node
+// sends one unit to the sink, either through a right node or through its own
+// zero-cost "unmatched" arc. Left nodes are added one at a time and each gets
+// the shortest augmenting path from a Dijkstra search on reduced costs that
+// stops as soon as the sink is reached, so a search only explores the cells
+// competing for the same successors. The result is the exact optimum.
+class MinCostAssignment
+{
+  public:
+    MinCostAssignment(int numLeft, int numRight);
+
+    // Returns the index of the arc. Arcs with weight <= 0 can never improve a
+    // matching and are not stored (-1 is returned).
+    int addArc(int left, int right, double weight);
+    double solve(void);
+
+    bool isSelected(int arc) const { return arc >= 0 && rightMate[arcRight[arc]] == arc; };
+    int getNumberOfArcs(void) const { return (int)arcRight.size(); };
+
+  private:
+    struct HeapItem
+    {
+      double dist;
+      int node;
+      bool operator<(const HeapItem & other) const { return dist > other.dist; };
+    };
+
+    void augment(int left);
+    // reduced costs are non-negative, up to rounding
+    static double reducedCost(double c) { return c < 0 ? 0 : c; };
+
+    int numLeft;
+    int numRight;
+    // arcs of every left node, in compressed rows built by solve()
+    std::vector<int> arcLeft;
+    std::vector<int> arcRight;
+    std::vector<double> arcWeight;
+    std::vector<int> rowStart;
+    std::vector<int> rowArcs;
+    // matched arc of every node, -1 if free
+    std::vector<int> leftMate;
+    std::vector<int> rightMate;
+    // potentials of the left nodes, the right nodes and the sink
+    std::vector<double> leftPotential;
+    std::vector<double> rightPotential;
+    double sinkPotential;
+    // search state, nodes 0..numLeft-1 are left, numLeft.. are right
+    std::vector<double> dist;
+    std::vector<int> predArc;
+    std::vector<char> settled;
+    std::vector<int> touched;
+};
+
+#endif
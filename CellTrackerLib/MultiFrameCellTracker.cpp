@@ -4,6 +4,11 @@
 // 
 MultiFrameCellTracker::MultiFrameCellTracker()
 {
+#ifdef USE_CPLEX
+  solver = HIGHER_ORDER_ILP;
+#else
+  solver = MIN_COST_FLOW;
+#endif
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -456,9 +461,9 @@ void MultiFrameCellTracker::summarize_tracking(ftk::Image::Pointer rawImg)
   labelreadmode = static_cast<ftk::Image::PtrMode>(2); // deep copy mode (give management to itk)
   rawreadmode = static_cast<ftk::Image::PtrMode>(0); // default
 
-  LabelImageType::Pointer segmented[MAX_TIME][MAX_TAGS]; // FIXME
-  InputImageType::Pointer images[MAX_TIME][MAX_TAGS];
-  std::vector<FeatureType> summaryfvector[MAX_TIME][MAX_TAGS];
+  std::vector<LabelImageType::Pointer> segmented(num_t);
+  std::vector<InputImageType::Pointer> images(num_t);
+  VVF summaryfvector(num_t);
 
   float spac[3];
   spac[0] = fvar.spacing[0] ; 
@@ -467,21 +472,21 @@ void MultiFrameCellTracker::summarize_tracking(ftk::Image::Pointer rawImg)
 
   for(int t = 0; t< num_t ; t++)
   {
-    images[t][c-1]= rawImg->GetItkPtr<helpers::InputPixelType>(t,channel_to_track,rawreadmode);	// channels FIXME
+    images[t]= rawImg->GetItkPtr<helpers::InputPixelType>(t,channel_to_track,rawreadmode);	// channels FIXME
 
   }
   for(int t = 0; t< num_t; t++)
   {
-    segmented[t][c-1] = resultImages->GetItkPtr<helpers::LabelPixelType>(t,0,labelreadmode);
+    segmented[t] = resultImages->GetItkPtr<helpers::LabelPixelType>(t,0,labelreadmode);
   }
 
 
   for(int t = 0; t< num_t; t++)
   {
-    getFeatureVectorsFarsight(segmented[t][c-1],images[t][c-1],summaryfvector[t][c-1],t,c);
+    getFeatureVectorsFarsight(segmented[t],images[t],summaryfvector[t],t,c);
   }
 
-  this->createTrackFeatures(summaryfvector,tfs,c,num_t);
+  this->createTrackFeatures(summaryfvector,tfs,num_t);
   //this->ComputeVertexEntropies();
   AnalyzeTimeFeatures(tfs,spac);
 
@@ -562,33 +567,33 @@ bool CompareFeaturesTime(FeatureType a, FeatureType b)
 
 //---------------------------------------------------------------------------------------------------------------------
 // 
-void MultiFrameCellTracker::createTrackFeatures(std::vector<FeatureType> summaryfvector[MAX_TIME][MAX_TAGS], std::vector<ftk::TrackFeatures> &trfeats, int c,int num_t)
+void MultiFrameCellTracker::createTrackFeatures(VVF &summaryfvector, std::vector<ftk::TrackFeatures> &trfeats, int num_t)
 {
   int max_track_num = 0;
   for(int t = 0; t< num_t; t++)
   {
-    for(unsigned int counter=0; counter< summaryfvector[t][c-1].size(); counter++)
+    for(unsigned int counter=0; counter< summaryfvector[t].size(); counter++)
     {
-      max_track_num = MAX(max_track_num,summaryfvector[t][c-1][counter].num);
+      max_track_num = MAX(max_track_num,summaryfvector[t][counter].num);
     }
   }
 
-  for(int counter=1; counter <= max_track_num; counter++)
+  // one pass over the cells, each goes to the track of its label
+  std::vector<ftk::TrackFeatures> tracks(max_track_num);
+  for(int t = 0; t< num_t;t++)
   {
-    ftk::TrackFeatures trackf;
-    trackf.intrinsic_features.clear();
-    for(int t = 0; t< num_t;t++)
+    for(unsigned int counter1 = 0; counter1 < summaryfvector[t].size(); counter1++)
     {
-      for(unsigned int counter1 = 0; counter1 < summaryfvector[t][c-1].size(); counter1++)
-      {
-        if(summaryfvector[t][c-1][counter1].num == counter)
-        {
-          trackf.intrinsic_features.push_back(summaryfvector[t][c-1][counter1]);
-        }
-      }
+      int num = summaryfvector[t][counter1].num;
+      if(num >= 1)
+        tracks[num-1].intrinsic_features.push_back(summaryfvector[t][counter1]);
     }
-    std::sort(trackf.intrinsic_features.begin(),trackf.intrinsic_features.end(),CompareFeaturesTime);
-    trfeats.push_back(trackf);
+  }
+
+  for(int counter=0; counter < max_track_num; counter++)
+  {
+    std::sort(tracks[counter].intrinsic_features.begin(),tracks[counter].intrinsic_features.end(),CompareFeaturesTime);
+    trfeats.push_back(tracks[counter]);
     //PRINTF("Added %d elements to trfeats\n",counter);
   }
 }
@@ -1062,37 +1067,34 @@ float MultiFrameCellTracker::get_distance( float x1[3],float x2[3])
 int MultiFrameCellTracker::add_disappear_vertices(int t)
 {
   //_ETRACE;
-  using boost::graph_traits;
-  typedef graph_traits<TGraph>::vertex_iterator vertex_iter;
   TGraph::vertex_descriptor v;
   TGraph::edge_descriptor e;
 
-  vertex_iter vi, vend,v_next;
   bool added;
   int ret_count = 0;
-  for(boost::tie(vi,vend) = vertices(g); vi != vend; vi=v_next)
+  // the cells of t-1 only, in the order of their vertices
+  for(unsigned int counter = 0; counter < rmap[t-1].size(); counter++)
   {
-    v_next = vi;
-    ++v_next;
+    TGraph::vertex_descriptor vd = rmap[t-1][counter];
     //printf("hi t = %d\n",t);
-    if(g[*vi].t == t-1)
+    if(TGraph::null_vertex() != vd && g[vd].t == t-1)
     {
       //printf("hi 1\n");
-      if(g[*vi].special == 0)
+      if(g[vd].special == 0)
       {
         //printf("hi 2\n");
-        //if(get_boundary_dist(fvector[t-1][g[*vi].findex].Centroid) < 4.0*sqrt(fvar.distVariance))
+        //if(get_boundary_dist(fvector[t-1][g[vd].findex].Centroid) < 4.0*sqrt(fvar.distVariance))
         {
           v = add_vertex(g);
           g[v].special = 1;
           g[v].t = t;
-          tie(e,added) = add_edge(*vi,v,g);
+          tie(e,added) = add_edge(vd,v,g);
           if(added)
           {
             g[e].coupled = 0;
             g[e].fixed = 0;
             g[e].selected = 0;
-            g[e].utility = compute_boundary_utility(fvector[t-1][g[*vi].findex].Centroid);
+            g[e].utility = compute_boundary_utility(fvector[t-1][g[vd].findex].Centroid);
             ret_count ++;
           }
           else
@@ -1102,9 +1104,9 @@ int MultiFrameCellTracker::add_disappear_vertices(int t)
           }
           float test[3] = { 182,299,6};
           float test1[3] = { 170, 285, 6};
-          if( get_distance(test1,fvector[t-1][g[*vi].findex].Centroid) < 30 && t==20)
+          if( get_distance(test1,fvector[t-1][g[vd].findex].Centroid) < 30 && t==20)
           {
-            printFeatures(fvector[t-1][g[*vi].findex]);
+            printFeatures(fvector[t-1][g[vd].findex]);
             printf("Utility for disappearing = %d\n",g[e].utility);
           }
         }
@@ -1122,35 +1124,34 @@ int MultiFrameCellTracker::add_disappear_vertices(int t)
 int MultiFrameCellTracker::add_appear_vertices(int t)
 {
   //_ETRACE;
-  using boost::graph_traits;
-  typedef graph_traits<TGraph>::vertex_iterator vertex_iter;
   TGraph::vertex_descriptor v;
   TGraph::edge_descriptor e;
 
-  vertex_iter vi, vend;
   bool added;
   int ret_count = 0;
-  for(tie(vi,vend) = vertices(g); vi != vend; ++vi)
+  // the cells of t+1 only, in the order of their vertices
+  for(unsigned int counter = 0; counter < rmap[t+1].size(); counter++)
   {
-    if(g[*vi].t == t+1)
+    TGraph::vertex_descriptor vd = rmap[t+1][counter];
+    if(TGraph::null_vertex() != vd && g[vd].t == t+1)
     {
-      if(g[*vi].special == 0)
+      if(g[vd].special == 0)
       {
-        //printf("findex = %d fvector[%d].size() = %d\n",g[*vi].findex,t,fvector[t].size());
-        //if(get_boundary_dist(fvector[t+1][g[*vi].findex].Centroid) <  4.0*sqrt(fvar.distVariance))
+        //printf("findex = %d fvector[%d].size() = %d\n",g[vd].findex,t,fvector[t].size());
+        //if(get_boundary_dist(fvector[t+1][g[vd].findex].Centroid) <  4.0*sqrt(fvar.distVariance))
         {
           //_TRACE;
           v = add_vertex(g);
           g[v].special = 1;
           g[v].t = t;
 
-          tie(e,added) = add_edge(v,*vi,g);
+          tie(e,added) = add_edge(v,vd,g);
           if(added)
           {
             g[e].coupled = 0;
             g[e].fixed = 0;
             g[e].selected = 0;
-            g[e].utility = compute_boundary_utility(fvector[t+1][g[*vi].findex].Centroid);
+            g[e].utility = compute_boundary_utility(fvector[t+1][g[vd].findex].Centroid);
             ret_count ++;
           }
           else
@@ -1160,9 +1161,9 @@ int MultiFrameCellTracker::add_appear_vertices(int t)
           }
           float test[3] = { 182,299,6};
           float test1[3] = { 170, 285, 6};
-          if( get_distance(test,fvector[t+1][g[*vi].findex].Centroid) < 30 && t==20)
+          if( get_distance(test,fvector[t+1][g[vd].findex].Centroid) < 30 && t==20)
           {
-            printFeatures(fvector[t+1][g[*vi].findex]);
+            printFeatures(fvector[t+1][g[vd].findex]);
             printf("Utility for appearing = %d\n",g[e].utility);
           }
           //_TRACE;
@@ -1186,12 +1187,10 @@ int MultiFrameCellTracker::add_normal_edges(int tmin, int tmax)
   int nec = 0;
   float epsilon = 50;
   int tried1 =0,tried2 = 0 ;
-  printf("in add_normal_edges.\n");
-  printf("in fvector[tmax].size(): %d.\n",fvector[tmax].size());
+  std::vector<int> near;
 
   for(int counter=0; counter < fvector[tmax].size(); counter++)
   {
-    printf("in loop of add_normal_edges.\n");
     // for every vertex, find the correspondences in the previous frames
     TGraph::vertex_descriptor v = rmap[tmax][counter];
     if(TGraph::null_vertex() != v) // do we have a non-null vertex? then ...
@@ -1199,9 +1198,11 @@ int MultiFrameCellTracker::add_normal_edges(int tmin, int tmax)
       tried1++;
       for(int t = tmin; t < tmax; ++t)
       {
-
-        for(int counter1 = 0; counter1 < fvector[t].size(); counter1++)
+        float radius = 4.0*sqrt(fvar.distVariance)*(abs(t-tmax));
+        grids[t].query(fvector[tmax][counter].Centroid,radius,near);	// the cells of t close enough, in increasing order
+        for(unsigned int n = 0; n < near.size(); n++)
         {
+          int counter1 = near[n];
           tried2++;
           float dist = get_distance(fvector[t][counter1].Centroid,fvector[tmax][counter].Centroid);
 
@@ -1229,7 +1230,6 @@ int MultiFrameCellTracker::add_normal_edges(int tmin, int tmax)
 
               g[e].utility = compute_normal_utility(fvector[t][counter1],fvector[tmax][counter]);
               //g[e].utility = compute_normal_utility(fvector[t][counter1],fvector[tmax][counter], counter1, counter);
-              printf("added normal edge.\n");
               if(g[e].utility < 0)
               {
                 printf("utility < 0 = %d\n", g[e].utility);
@@ -1359,10 +1359,15 @@ void  MultiFrameCellTracker::populate_merge_candidates(int t)
   std::vector<MergeCandidate> nullvm;
   nullvm.clear();
   vm.clear();
+  std::vector<int> near;
   for(int counter = 0; counter < fvector[t].size(); counter++)
   {
-    for(int counter1 = counter+1; counter1 < fvector[t].size(); counter1++)
+    grids[t].query(fvector[t][counter].Centroid,4.0*sqrt(fvar.distVariance),near);
+    for(unsigned int n = 0; n < near.size(); n++)
     {
+      int counter1 = near[n];
+      if(counter1 <= counter)
+        continue;
       //if( MIN(fvector[t][counter].ScalarFeatures[FeatureType::BBOX_VOLUME],fvector[t][counter1].ScalarFeatures[FeatureType::BBOX_VOLUME])/overlap(fvector[t][counter].BoundingBox,fvector[t][counter1].BoundingBox)< 4.0*sqrt(fvar.overlapVariance))
       if(get_distance(fvector[t][counter1].Centroid,fvector[t][counter].Centroid)<4.0*sqrt(fvar.distVariance))
       {
@@ -1399,14 +1404,17 @@ int MultiFrameCellTracker::add_merge_split_edges(int tmax)
 
   TGraph::edge_descriptor e1,e2;
   bool added1, added2;
+  std::vector<int> near;
 
   // split loops:
   for(int tcounter = MAX(tmax-K,0);tcounter <=tmax-1; tcounter++)			// loop over three time points
   {
     for(int counter=0; counter< m_cand[tcounter].size(); counter++)		// loop over merge candidates at each time point
     {
-      for(int counter1 = 0; counter1 < fvector[tmax].size(); counter1++)// loop over cells of the last time point
+      grids[tmax].query(fvector[tcounter][m_cand[tcounter][counter].index1].Centroid,4.0*sqrt(fvar.distVariance),near);
+      for(unsigned int n = 0; n < near.size(); n++)// loop over cells of the last time point close to the first candidate
       {
+        int counter1 = near[n];
         int i1 = m_cand[tcounter][counter].index1;
         int i2 = m_cand[tcounter][counter].index2;
 
@@ -1469,8 +1477,10 @@ int MultiFrameCellTracker::add_merge_split_edges(int tmax)
   {
     for(int tcounter = MAX(tmax-K,0);tcounter <=tmax-1; tcounter++) // loop over the two previous time points
     {		
-      for(int counter1 = 0; counter1 < fvector[tcounter].size(); counter1++) // loop over cells of the previous time points
+      grids[tcounter].query(fvector[tmax][m_cand[tmax][counter].index1].Centroid,4.0*sqrt(fvar.distVariance),near);
+      for(unsigned int n = 0; n < near.size(); n++) // loop over cells of the previous time points close to the first candidate
       {
+        int counter1 = near[n];
         int i1 = m_cand[tmax][counter].index1;
         int i2 = m_cand[tmax][counter].index2;
 
@@ -2404,6 +2414,76 @@ bool MultiFrameCellTracker::edge_uniqueness( TGraph::edge_descriptor e1, TGraph:
   return 0;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+// 
+void MultiFrameCellTracker::build_centroid_grids()
+{
+  // bins of the size of the largest distance between a cell and a merge candidate or a cell of the next frame
+  float cellSize = 4.0*sqrt(fvar.distVariance);
+  grids.resize(fvector.size());
+  #pragma omp parallel for
+  for(int t = 0; t < (int)fvector.size(); t++)
+  {
+    grids[t].build(fvector[t],fvar.spacing,cellSize);
+  }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// 
+void MultiFrameCellTracker::solve()
+{
+#ifdef USE_CPLEX
+  if(solver == HIGHER_ORDER_ILP)
+  {
+    solve_higher_order();
+    return;
+  }
+#else
+  if(solver == HIGHER_ORDER_ILP)
+    printf("Built without CPLEX, solving the first order model instead\n");
+#endif
+  solve_min_cost_flow();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// 
+// First order model: each vertex keeps at most one incoming and one outgoing edge, and the total utility of the
+// kept edges is maximized. This is the model of solve_lip without the coupled (merge and split) edges, which a
+// flow cannot represent. With non-negative utilities it is the min cost flow of unit tracks from the appear to
+// the disappear vertices, and it is solved exactly as a matching between the out-edges and the in-edges.
+void MultiFrameCellTracker::solve_min_cost_flow()
+{
+  using boost::graph_traits;
+  graph_traits<TGraph>::edge_iterator ei,eend;
+  boost::property_map<TGraph, boost::vertex_index_t>::type index;
+  index = get(boost::vertex_index,g);
+
+  int num_v = num_vertices(g);
+  MinCostAssignment assignment(num_v,num_v);
+  std::vector<TGraph::edge_descriptor> arc_edge;
+  for(tie(ei,eend) = edges(g); ei != eend; ++ei)
+  {
+    g[*ei].selected = 0;
+    if(g[*ei].coupled == 1)
+      continue;
+    if(assignment.addArc(index[source(*ei,g)],index[target(*ei,g)],g[*ei].utility) >= 0)
+      arc_edge.push_back(*ei);
+  }
+
+  double total = assignment.solve();
+  int num_selected = 0;
+  for(int arc = 0; arc < (int)arc_edge.size(); arc++)
+  {
+    if(assignment.isSelected(arc))
+    {
+      g[arc_edge[arc]].selected = 1;
+      num_selected++;
+    }
+  }
+  printf("min cost flow: %d of %d edges selected, utility = %lf\n",num_selected,(int)arc_edge.size(),total);
+}
+
+#ifdef USE_CPLEX
 //---------------------------------------------------------------------------------------------------------------------
 // 
 void MultiFrameCellTracker::solve_higher_order()
@@ -2739,6 +2819,7 @@ void MultiFrameCellTracker::solve_higher_order()
   }
   env.end();
 }
+#endif
 
 //---------------------------------------------------------------------------------------------------------------------
 // 
@@ -2766,6 +2847,7 @@ std::pair<MultiFrameCellTracker::TGraph::edge_descriptor,bool> MultiFrameCellTra
   return pair1;
 }
 
+#ifdef USE_CPLEX
 //---------------------------------------------------------------------------------------------------------------------
 // 
 void MultiFrameCellTracker::solve_lip()
@@ -2913,6 +2995,7 @@ void MultiFrameCellTracker::solve_lip()
   env.end();
   //scanf("%*d");
 }
+#endif
 
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -4336,6 +4419,7 @@ void MultiFrameCellTracker::resolve_merges_and_splits()
       }
       rmap.push_back(vv);						// Fill rmap with null vertex descriptors
     }
+    build_centroid_grids();
 
     int avc = 0;
     int dvc = 0;
@@ -4425,7 +4509,7 @@ void MultiFrameCellTracker::resolve_merges_and_splits()
     // debugging end
 
     //	print_debug_info();			//Amin: not needed besides causes crashes.
-    solve_higher_order();
+    solve();
     //print_stats();
 
     std::string newxgmloutput = entropyfiledirectory + "\\ch4_new.xgmml";
@@ -4858,6 +4942,7 @@ void MultiFrameCellTracker::resolve_merges_and_splits()
     fclose(fp);
   }
 
+#ifdef USE_CPLEX
   //---------------------------------------------------------------------------------------------------------------------
   // 
   void MultiFrameCellTracker::writeXGMML_secondorder(char *filename, std::vector< MultiFrameCellTracker::LREdge > &lredges,std::vector<int> &utility, IloNumArray& vals )
@@ -4986,6 +5071,7 @@ void MultiFrameCellTracker::resolve_merges_and_splits()
     fprintf(fp,"</graph>\n");
     fclose(fp);
   }
+#endif
 
   //---------------------------------------------------------------------------------------------------------------------
   // 
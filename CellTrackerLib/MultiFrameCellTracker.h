@@ -23,8 +23,13 @@
 #include <boost/property_map/property_map.hpp>
 #include <boost/graph/connected_components.hpp>
 #include "itkRegionOfInterestImageFilter.h"
+#ifdef USE_CPLEX
 #include <ilcplex/ilocplex.h>
 ILOSTLBEGIN
+#else
+using namespace std;
+#endif
+#include "MinCostAssignment.h"
 
 #ifdef USE_KPLS
 #include <PatternAnalysis/embrex/kpls.h>
@@ -58,9 +63,6 @@ using namespace boost;
 #define USE_VNL_HUNGARIAN 
 
 #define CACHE_PREFIX "cache"
-#define MAX_TIME 400
-#define MAX_TAGS 4
-#define MAX_LABEL 10000
 #define VESSEL_CHANNEL 4 // FIXME : make it dynamic based on user input
 #define PAUSE {printf("%d:>",__LINE__);scanf("%*d");}
 
@@ -83,6 +85,12 @@ class MultiFrameCellTracker
     void set_inputs_from_cmd(std::vector< helpers::InputImageType::Pointer > inp_im, std::vector< helpers::LabelImageType::Pointer > lab_img);
     std::vector< helpers::LabelImageType::Pointer > get_ouput_to_cmd(){return this->output_images_;};
 
+    // HIGHER_ORDER_ILP is the second order model solved with CPLEX (only when built with USE_CPLEX),
+    // MIN_COST_FLOW is the first order model (no merges or splits) solved by the bundled MinCostAssignment
+    enum SOLVER_TYPE {HIGHER_ORDER_ILP, MIN_COST_FLOW};
+    void setSolver(SOLVER_TYPE solver){this->solver = solver;};
+    SOLVER_TYPE getSolver(void){return this->solver;};
+
   private:
     struct TrackVertex
     {
@@ -203,8 +211,13 @@ class MultiFrameCellTracker
     int add_normal_edges(int tmin, int tmax);
     void populate_merge_candidates(int t);
     int add_merge_split_edges(int tmax);
+    void build_centroid_grids(void);
+    void solve(void);
+    void solve_min_cost_flow(void);
+#ifdef USE_CPLEX
     void solve_lip(void);
     void solve_higher_order(void);
+#endif
     void prune(int);
     int compute_normal_utility(FeatureType f1, FeatureType f2);
     int compute_normal_utility(FeatureType f1, FeatureType f2, int counter, int counter1);
@@ -235,7 +248,7 @@ class MultiFrameCellTracker
     void compute_feature_variances();
     void setData(VVF &fv, VVL &l, VVR &r);
     void summarize_tracking(ftk::Image::Pointer rawImg);	
-    void createTrackFeatures(std::vector<FeatureType> summaryfvector[MAX_TIME][MAX_TAGS], std::vector<ftk::TrackFeatures> &tfs, int c,int num_t);
+    void createTrackFeatures(VVF &summaryfvector, std::vector<ftk::TrackFeatures> &tfs, int num_t);
     void changeDataHierarchy(std::vector<ftk::TrackFeatures> vectrackfeatures);
     void convertItkImagesToftkImages(ftk::Image::Pointer labelImage,ftk::Image::Pointer dataImage,std::vector<helpers::LabelImageType::Pointer> &trackImages);
     int my_connected_components2(std::vector<int> &component);
@@ -252,12 +265,14 @@ class MultiFrameCellTracker
     VVR rimages;
     VVV rmap;
     VVM m_cand;
+    std::vector<helpers::CentroidGrid> grids;	// centroids of every time point, for the candidate edges
     std::map<TGraph::edge_descriptor, TGraph::edge_descriptor> coupled_map;
     int UTILITY_MAX;
     FeatureVariances fvar;
     FeatureVariances fvarnew;
     int K;
     int channel_to_track;
+    SOLVER_TYPE solver;
 
     helpers::ColorImageType::Pointer debugimage1,debugimage2,debugimage3;
     bool edge_uniqueness(TGraph::edge_descriptor, TGraph::edge_descriptor);
@@ -270,7 +285,9 @@ class MultiFrameCellTracker
     std::vector<std::map<int, std::vector<int> > > VertexUtilities;  // second order edge utilities through the vertex
     std::vector<std::map<int, float> > vertex_entropies;  // second order edge entropies through the vertex
 
+#ifdef USE_CPLEX
     void writeXGMML_secondorder(char *,std::vector< LREdge >&,std::vector<int>&, IloNumArray& );
+#endif
 
     ftk::Image::Pointer resultImages;
     std::vector<ftk::TrackFeatures> tfs;
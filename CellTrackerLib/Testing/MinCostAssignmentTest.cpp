@@ -0,0 +1,128 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. 
+=========================================================================*/
+
+// Compares MinCostAssignment with an exhaustive search on small graphs. The weights are fractions like k/3, which
+// are not exact in binary and leave the reduced costs of the tight arcs a rounding error away from 0.
+
+#include "MinCostAssignment.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+struct TestArc
+{
+  int left;
+  int right;
+  double weight;
+};
+
+// best total weight of the matchings of the left nodes from x on, with the right nodes in used taken
+static double bestMatching(const std::vector<TestArc> & arcs, int numLeft, int x, std::vector<char> & used)
+{
+  if(x == numLeft)
+    return 0;
+  double best = bestMatching(arcs,numLeft,x+1,used);
+  for(unsigned int a = 0; a < arcs.size(); a++)
+  {
+    if(arcs[a].left != x || used[arcs[a].right] || arcs[a].weight <= 0)
+      continue;
+    used[arcs[a].right] = 1;
+    double w = arcs[a].weight + bestMatching(arcs,numLeft,x+1,used);
+    used[arcs[a].right] = 0;
+    if(w > best)
+      best = w;
+  }
+  return best;
+}
+
+static bool checkInstance(const std::vector<TestArc> & arcs, int numLeft, int numRight, const char * name)
+{
+  MinCostAssignment solver(numLeft,numRight);
+  std::vector<int> ids;
+  for(unsigned int a = 0; a < arcs.size(); a++)
+    ids.push_back(solver.addArc(arcs[a].left,arcs[a].right,arcs[a].weight));
+  double total = solver.solve();
+
+  // the selected arcs must be a matching and add up to the returned total
+  std::vector<char> leftUsed(numLeft,0), rightUsed(numRight,0);
+  double selected = 0;
+  for(unsigned int a = 0; a < arcs.size(); a++)
+  {
+    if(!solver.isSelected(ids[a]))
+      continue;
+    if(leftUsed[arcs[a].left] || rightUsed[arcs[a].right])
+    {
+      printf("%s: node matched twice\n",name);
+      return false;
+    }
+    leftUsed[arcs[a].left] = 1;
+    rightUsed[arcs[a].right] = 1;
+    selected += arcs[a].weight;
+  }
+
+  std::vector<char> used(numRight,0);
+  double best = bestMatching(arcs,numLeft,0,used);
+  if(fabs(total - best) > 1e-9 || fabs(selected - best) > 1e-9)
+  {
+    printf("%s: solver %.12f, selected arcs %.12f, optimum %.12f\n",name,total,selected,best);
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  bool ok = true;
+
+  // used to loop forever in the path flip
+  const int hang[14][3] = { {0,3,6}, {0,4,13}, {1,2,5}, {1,3,14}, {1,4,10}, {2,0,2}, {2,1,11},
+                            {3,0,6}, {3,1,15}, {3,3,13}, {4,0,15}, {4,3,12}, {5,3,12}, {5,4,10} };
+  std::vector<TestArc> arcs;
+  for(int a = 0; a < 14; a++)
+  {
+    TestArc arc = { hang[a][0], hang[a][1], hang[a][2]/3.0 };
+    arcs.push_back(arc);
+  }
+  ok = checkInstance(arcs,6,5,"6x5 thirds") && ok;
+
+  srand(1);
+  for(int t = 0; t < 2000 && ok; t++)
+  {
+    int numLeft = 1 + rand()%7;
+    int numRight = 1 + rand()%7;
+    int denominator = 3 + rand()%5;
+    arcs.clear();
+    for(int x = 0; x < numLeft; x++)
+    {
+      for(int r = 0; r < numRight; r++)
+      {
+        if(rand()%3 == 0)
+          continue;
+        TestArc arc = { x, r, (rand()%16)/double(denominator) };
+        arcs.push_back(arc);
+      }
+    }
+    char name[64];
+    sprintf(name,"random instance %d",t);
+    ok = checkInstance(arcs,numLeft,numRight,name) && ok;
+  }
+
+  if(!ok)
+    return 1;
+  printf("all matchings optimal\n");
+  return 0;
+}
@@ -2863,6 +2863,90 @@ namespace helpers{
 
   }
 
+  //---------------------------------------------------------------------------------------------------------------------
+  CentroidGrid::CentroidGrid()
+  {
+    cellSize = 1;
+    for(int d = 0; d < 3; d++)
+    {
+      spacing[d] = 1;
+      lo[d] = 0;
+      dims[d] = 0;
+    }
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------
+  void CentroidGrid::build(const std::vector<FeatureType> &fvector, const float spacing[3], float cellSize)
+  {
+    for(int d = 0; d < 3; d++)
+      this->spacing[d] = spacing[d];
+    this->cellSize = (cellSize > 0) ? cellSize : 1;
+    cells.clear();
+    if(fvector.empty())
+    {
+      dims[0] = dims[1] = dims[2] = 0;
+      return;
+    }
+
+    std::vector<int> coords(3*fvector.size());
+    int hi[3];
+    for(unsigned int counter = 0; counter < fvector.size(); counter++)
+    {
+      for(int d = 0; d < 3; d++)
+      {
+        int c = (int)floor(fvector[counter].Centroid[d]*this->spacing[d]/this->cellSize);
+        coords[3*counter+d] = c;
+        if(counter == 0 || c < lo[d])
+          lo[d] = c;
+        if(counter == 0 || c > hi[d])
+          hi[d] = c;
+      }
+    }
+    for(int d = 0; d < 3; d++)
+      dims[d] = hi[d]-lo[d]+1;
+
+    cells.resize(fvector.size());
+    for(unsigned int counter = 0; counter < fvector.size(); counter++)
+    {
+      long key = ((long)(coords[3*counter+2]-lo[2])*dims[1] + (coords[3*counter+1]-lo[1]))*dims[0] + (coords[3*counter]-lo[0]);
+      cells[counter] = std::make_pair(key,(int)counter);
+    }
+    std::sort(cells.begin(),cells.end());
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------
+  void CentroidGrid::query(const float x[3], float radius, std::vector<int> &indices) const
+  {
+    indices.clear();
+    if(cells.empty())
+      return;
+
+    // a little slack so that rounding never drops a cell at the radius
+    float r = radius*1.001f + 1e-3f*cellSize;
+    int from[3], to[3];
+    for(int d = 0; d < 3; d++)
+    {
+      float p = x[d]*spacing[d];
+      from[d] = MAX((int)floor((p-r)/cellSize),lo[d]) - lo[d];
+      to[d] = MIN((int)floor((p+r)/cellSize),lo[d]+dims[d]-1) - lo[d];
+      if(from[d] > to[d])
+        return;
+    }
+    for(int z = from[2]; z <= to[2]; z++)
+    {
+      for(int y = from[1]; y <= to[1]; y++)
+      {
+        // the grid cells of a row along x have consecutive keys
+        long row = ((long)z*dims[1] + y)*dims[0];
+        std::vector<std::pair<long,int> >::const_iterator it;
+        it = std::lower_bound(cells.begin(),cells.end(),std::make_pair(row+from[0],-1));
+        for(; it != cells.end() && it->first <= row+to[0]; ++it)
+          indices.push_back(it->second);
+      }
+    }
+    std::sort(indices.begin(),indices.end());
+  }
+
 } // end of namespace helpers
 // 		// Write the output:
 // 		for(int t =0; t<tracked_images.size(); t++)
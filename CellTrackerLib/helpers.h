@@ -192,6 +192,26 @@ namespace helpers{
 
     bool FlagRoi; // ?? FIXME what is this ?
   };
+
+  // Centroids of the cells of one time point binned in a uniform grid in physical units (voxel
+  // coordinates times spacing), to find the cells near a point without visiting all of them.
+  class CentroidGrid
+  {
+    public:
+      CentroidGrid();
+      void build(const std::vector<FeatureType> &fvector, const float spacing[3], float cellSize);
+      // indices of the cells whose centroid may lie closer than radius (physical units) to x
+      // (voxels), in increasing order. Every cell closer than radius is returned.
+      void query(const float x[3], float radius, std::vector<int> &indices) const;
+
+    private:
+      float spacing[3];
+      float cellSize;
+      int lo[3];
+      int dims[3];
+      std::vector<std::pair<long,int> > cells;	// (grid cell key, index) sorted
+  };
+
   // all header declarations
   //
   //
@@ -345,45 +345,44 @@ void ALforNucEd::Perform_Classification()
 {
 	for(int i=0; i<classificationTables.size() ; ++i)
 	{	
-		//test_table contains individual tables 
-		vtkSmartPointer<vtkTable> test_table  = vtkSmartPointer<vtkTable>::New();
-		test_table->Initialize();
-
-		test_table->SetNumberOfRows(classificationTables.at(i)->GetNumberOfRows());
-		for(int col=0; col<pawTable->GetNumberOfColumns(); ++col)
-		{
-			vtkSmartPointer<vtkDoubleArray> column = vtkSmartPointer<vtkDoubleArray>::New();
-			column->SetName(pawTable->GetColumnName(col));
-			test_table->AddColumn(column);	
-		}
-		for(int row = 0; row < (int)classificationTables.at(i)->GetNumberOfRows(); ++row)
-		{		
-			vtkSmartPointer<vtkVariantArray> model_data1 = vtkSmartPointer<vtkVariantArray>::New();
-			for(int c =0;c<(int)test_table->GetNumberOfColumns();++c)
-				model_data1->InsertNextValue(classificationTables.at(i)->GetValueByName(row,test_table->GetColumnName(c)));
-			test_table->InsertNextRow(model_data1);
-		}	
-
 		////// Final Data  to classify after the active training
-		vnl_matrix<double> data_classify;
+		int num_rows = (int)classificationTables.at(i)->GetNumberOfRows();
+		std::vector<double> prediction(num_rows), confidence(num_rows);
 		if(from_model)
 		{
-			data_classify =  mclr->Normalize_Feature_Matrix_w(mclr->tableToMatrix_w(test_table), std_dev_vec, mean_vec);
+			std::vector<std::string> feature_names;
+			for(int col=0; col<pawTable->GetNumberOfColumns(); ++col)
+				feature_names.push_back(pawTable->GetColumnName(col));
+			std::vector<double> data_classify = mclr->Table_To_Column_Block(classificationTables.at(i), feature_names, std_dev_vec, mean_vec);
+			if(num_rows > 0)
+				mclr->Test_Current_Model_Batch(&data_classify[0], num_rows, act_learn_matrix, confidence_thresh, &prediction[0], &confidence[0]);
 		}
 		else
 		{
-			data_classify =  mclr->Normalize_Feature_Matrix(mclr->tableToMatrix(test_table, mclr->id_time_val));
-		}
-		data_classify = data_classify.transpose();
+			//test_table contains individual tables 
+			vtkSmartPointer<vtkTable> test_table  = vtkSmartPointer<vtkTable>::New();
+			test_table->Initialize();
 
-		vnl_matrix<double> currprob;
-		if(from_model)
-		{
-			currprob = mclr->Test_Current_Model_w(data_classify, act_learn_matrix);
-		}
-		else
-		{
-			currprob = mclr->Test_Current_Model(data_classify);
+			test_table->SetNumberOfRows(num_rows);
+			for(int col=0; col<pawTable->GetNumberOfColumns(); ++col)
+			{
+				vtkSmartPointer<vtkDoubleArray> column = vtkSmartPointer<vtkDoubleArray>::New();
+				column->SetName(pawTable->GetColumnName(col));
+				test_table->AddColumn(column);	
+			}
+			for(int row = 0; row < num_rows; ++row)
+			{		
+				vtkSmartPointer<vtkVariantArray> model_data1 = vtkSmartPointer<vtkVariantArray>::New();
+				for(int c =0;c<(int)test_table->GetNumberOfColumns();++c)
+					model_data1->InsertNextValue(classificationTables.at(i)->GetValueByName(row,test_table->GetColumnName(c)));
+				test_table->InsertNextRow(model_data1);
+			}	
+
+			// (features x samples) matrix, whose data block is column-major per sample
+			vnl_matrix<double> data_classify =  mclr->Normalize_Feature_Matrix(mclr->tableToMatrix(test_table, mclr->id_time_val));
+			data_classify = data_classify.transpose();
+			if(num_rows > 0)
+				mclr->Test_Current_Model_Batch(data_classify.data_block(), (int)data_classify.cols(), mclr->m.w, confidence_thresh, &prediction[0], &confidence[0]);
 		}
 
 		if(classification_name != "")
@@ -413,18 +412,10 @@ void ALforNucEd::Perform_Classification()
 			classificationTables.at(i)->AddColumn(column_confidence);
 		}
 
-		for(int row = 0; (int)row < classificationTables.at(i)->GetNumberOfRows(); ++row)  
+		for(int row = 0; row < num_rows; ++row)  
 		{
-			vnl_vector<double> curr_col = currprob.get_column(row);
-			classificationTables.at(i)->SetValueByName(row,confidence_col_name.c_str(), vtkVariant(curr_col(curr_col.arg_max())));
-			if(curr_col(curr_col.arg_max()) > confidence_thresh) 
-			{
-				classificationTables.at(i)->SetValueByName(row,prediction_col_name.c_str(), vtkVariant(curr_col.arg_max()+1));						
-			}
-			else
-			{
-				classificationTables.at(i)->SetValueByName(row,prediction_col_name.c_str(), vtkVariant(0));
-			}
+			classificationTables.at(i)->SetValueByName(row,confidence_col_name.c_str(), vtkVariant(confidence[row]));
+			classificationTables.at(i)->SetValueByName(row,prediction_col_name.c_str(), vtkVariant(prediction[row]));
 		}
 		//prediction_names = ftk::GetColumsWithString( prediction_col_name.c_str() , classificationTables.at(i) );
 		//selection->clear();			
@@ -3776,7 +3776,11 @@ void NucleusEditor::computeDistanceMap()
 		
 		diffusion_map = new DiffusionMap();
 		diffusion_map->Initialize(table, true);
-		diffusion_map->ComputeDiffusionMap();		
+		// The dense eigensolver is cubic in the number of objects
+		if(table->GetNumberOfRows() > 2000)
+			diffusion_map->ComputeSparseDiffusionMap(7, 10);
+		else
+			diffusion_map->ComputeDiffusionMap();		
 	}
 }
 
@@ -720,13 +720,87 @@ TiXmlElement * ProjectDefinition::GetPixelLevelParameterElement( ftk::PixelAnaly
 {
 	TiXmlElement * returnElement = new TiXmlElement("PixelLevelRule");
 	returnElement->SetAttribute("RoiImage", PixParameter.regionChannelName.c_str());
-	returnElement->SetAttribute("TargetImage", PixParameter.regionChannelName.c_str());
+	returnElement->SetAttribute("TargetImage", PixParameter.targetChannelName.c_str());
 	returnElement->SetAttribute("Mode", ftk::NumToString(PixParameter.mode).c_str());
 	returnElement->SetAttribute("OutputFilename", PixParameter.outputFilename.c_str());
 	returnElement->SetAttribute("Radius", ftk::NumToString(PixParameter.radius).c_str());
 	returnElement->SetAttribute("ErodeRadius", ftk::NumToString(PixParameter.erodeRadius).c_str());
 	return returnElement;
 }
+
+TiXmlElement * ProjectDefinition::GetTaskElement( TaskType task )
+{
+	TiXmlElement * returnElement = new TiXmlElement("step");
+	returnElement->SetAttribute("name", GetTaskString(task));
+
+	switch(task)
+	{
+	case PREPROCESSING:
+		for(int i=0; i<(int)preprocessingParameters.size(); ++i)
+			returnElement->LinkEndChild( GetPreprocessingElement(preprocessingParameters.at(i)) );
+		break;
+	case NUCLEAR_SEGMENTATION:
+		for(int i=0; i<(int)nuclearParameters.size(); ++i)
+			returnElement->LinkEndChild( GetParameterElement(nuclearParameters.at(i)) );
+		for(int i=0; i<(int)mmSegFiles.size(); ++i)
+		{
+			TiXmlElement * fileElement = new TiXmlElement("file");
+			fileElement->SetAttribute("type", mmSegFiles.at(i).type);
+			fileElement->SetAttribute("path", mmSegFiles.at(i).path);
+			returnElement->LinkEndChild(fileElement);
+		}
+		for(int i=0; i<(int)associationRules.size() && mmSegFiles.size() > 0; ++i)
+			returnElement->LinkEndChild( GetAssocRuleElement(associationRules.at(i)) );	//Read by the multi-model segmentation
+		//Fall through to the features computed along with the segmentation
+	case FEATURE_COMPUTATION:
+		for(int i=0; i<(int)intrinsicFeatures.size(); ++i)
+		{
+			TiXmlElement * featureElement = new TiXmlElement("IntrinsicFeature");
+			featureElement->SetAttribute("name", intrinsicFeatures.at(i));
+			returnElement->LinkEndChild(featureElement);
+		}
+		break;
+	case CYTOPLASM_SEGMENTATION:
+		for(int i=0; i<(int)cytoplasmParameters.size(); ++i)
+			returnElement->LinkEndChild( GetParameterElement(cytoplasmParameters.at(i)) );
+		for(int i=0; i<(int)intrinsicFeatures.size(); ++i)
+		{
+			TiXmlElement * featureElement = new TiXmlElement("IntrinsicFeature");
+			featureElement->SetAttribute("name", intrinsicFeatures.at(i));
+			returnElement->LinkEndChild(featureElement);
+		}
+		break;
+	case RAW_ASSOCIATIONS:
+		for(int i=0; i<(int)associationRules.size(); ++i)
+			returnElement->LinkEndChild( GetAssocRuleElement(associationRules.at(i)) );
+		break;
+	case CLASSIFY:
+		if( !classificationTrainingData.empty() )
+			returnElement->LinkEndChild( GetTrainingFileElement(classificationTrainingData) );
+		for(int i=0; i<(int)classificationParameters.size(); ++i)
+			returnElement->LinkEndChild( GetClassificationElement(classificationParameters.at(i)) );
+		break;
+	case CLASSIFY_MCLR:
+		for(int i=0; i<(int)Classification_Rules.size(); ++i)
+			returnElement->LinkEndChild( GetClassificationMCLRElement(Classification_Rules.at(i)) );
+		break;
+	case CLASS_EXTRACTION:
+		for(int i=0; i<(int)Class_Extraction_Rules.size(); ++i)
+			returnElement->LinkEndChild( GetClassExtractRuleElement(Class_Extraction_Rules.at(i)) );
+		break;
+	case PIXEL_ANALYSIS:
+		for(int i=0; i<(int)pixelLevelRules.size(); ++i)
+			returnElement->LinkEndChild( GetPixelLevelParameterElement(pixelLevelRules.at(i)) );
+		break;
+	case QUERY:
+		for(int i=0; i<(int)queryParameters.size(); ++i)
+			returnElement->LinkEndChild( GetQueryParameterElement(queryParameters.at(i)) );
+		break;
+	default:
+		break;
+	}
+	return returnElement;
+}
 //***************************************************************************************
 //***************************************************************************************
 //***************************************************************************************
@@ -84,6 +84,7 @@ public:
 	TiXmlElement * GetClassExtractRuleElement( ClassExtractionRule ClassExtractRule );
 	TiXmlElement * GetTrainingFileElement( std::string file_name );
 	TiXmlElement * GetPixelLevelParameterElement( ftk::PixelAnalysisDefinitions PixParameter );
+	TiXmlElement * GetTaskElement( TaskType task );		//Step with every setting this task reads (used to key cached results)
 
 	int FindInputChannel(std::string name);				//Search inputs with this name
 	std::string GetTaskString(TaskType task);
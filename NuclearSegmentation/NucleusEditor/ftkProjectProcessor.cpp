@@ -29,6 +29,13 @@
 #include "ftkProjectProcessor.h"
 
 #include <time.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
 
 namespace ftk
 {
@@ -52,6 +59,8 @@ ProjectProcessor::ProjectProcessor()
 	save_path = ".";
 	n_thr = 4;//Temporary number for number of omp threads
 	numThreadsSet = false;	
+	cacheSuspended = false;
+	preprocessPending = 0;
 }
 
 void ProjectProcessor::SetNumThreads( int threads )
@@ -75,6 +84,7 @@ void ProjectProcessor::Initialize(void)
 	{
 		Task t;
 		t.type = definition->pipeline.at(i);
+		t.inputChannel1 = t.inputChannel2 = t.inputChannel3 = -1;
 		switch(t.type)
 		{
 		case ProjectDefinition::PREPROCESSING:
@@ -113,33 +123,145 @@ void ProjectProcessor::Initialize(void)
 	numTasks = (int)tasks.size();
 	std::cout<<"Number of tasks to be done:"<<numTasks<<std::endl;
 	lastTask = -1;
+
+	cacheSuspended = false;
+	preprocessPending = 0;
+	if( !cache_prefix.empty() )
+	{
+		LoadCacheManifest();
+		initialKey = GetInitialKey();
+		stateKey = filesKey = initialKey;
+		labelKey = tableKey = classKey = initialKey;
+	}
 }
 
+//Runs one task of a batch on the task runtime
+class ProjectTaskRunner : public Task
+{
+public:
+	ProjectTaskRunner(ProjectProcessor * processor, int task, char * done) : m_Processor(processor), m_Task(task), m_Done(done) {}
+	void Execute() { *m_Done = m_Processor->RunTask(m_Task); }
+private:
+	ProjectProcessor * m_Processor;
+	int m_Task;
+	char * m_Done;
+};
+
 void ProjectProcessor::ProcessNext(void)
 {
 	if(DoneProcessing()) return;
 
 	int thisTask = lastTask + 1;
+	bool useCache = !cache_prefix.empty() && !cacheSuspended;
+
+	std::string key;
+	if(useCache)
+	{
+		key = GetTaskKey(thisTask, stateKey);
+		CacheEntry entry;
+		if(FindCachedTask(thisTask, key, entry))
+		{
+			SkipCachedTask(thisTask, entry);
+			tasks.at(thisTask).done = true;
+			lastTask++;
+			if(DoneProcessing())
+				RestoreCachedState();
+			return;
+		}
+		if(!RestoreCachedState())
+			return;
+	}
+
+	//The tasks after this one that share no results with it, or with each other, run at the same time. At most one
+	//of them may change the results, so the results after each task are still the ones after the whole batch.
+	std::vector<int> batch(1, thisTask);
+	std::vector<std::string> keys(1, key);
+	int reads = GetTaskReads(tasks.at(thisTask).type);
+	int writes = GetTaskWrites(tasks.at(thisTask).type);
+	std::string nextKey = (useCache && writes) ? key : stateKey;
+	for(int t=thisTask+1; t<numTasks && tasks.at(thisTask).type != ProjectDefinition::ANALYTE_MEASUREMENTS; ++t)
+	{
+		ProjectDefinition::TaskType type = tasks.at(t).type;
+		int r = GetTaskReads(type);
+		int w = GetTaskWrites(type);
+		if(tasks.at(t).done || type == ProjectDefinition::ANALYTE_MEASUREMENTS)
+			break;
+		if((r & writes) || (w & (reads | writes)) || (w && writes))
+			break;
+		std::string k;
+		if(useCache)
+		{
+			k = GetTaskKey(t, nextKey);
+			CacheEntry entry;
+			if(FindCachedTask(t, k, entry))
+				break;
+			if(w)
+				nextKey = k;
+		}
+		batch.push_back(t);
+		keys.push_back(k);
+		reads |= r;
+		writes |= w;
+	}
+
+	std::vector<char> taskDone(batch.size(), 0);
+	if(batch.size() == 1)
+	{
+		taskDone[0] = RunTask(thisTask);
+	}
+	else
+	{
+		TaskGroup group;
+		for(int i=0; i<(int)batch.size(); ++i)
+			group.Run(new ProjectTaskRunner(this, batch.at(i), &taskDone[i]));
+		group.Wait();
+	}
+
+	for(int i=0; i<(int)batch.size(); ++i)
+	{
+		if(!taskDone[i])
+		{
+			//The tasks done after this one are not in the chain of keys
+			for(int j=i+1; j<(int)batch.size(); ++j)
+				if(taskDone[j])
+					cacheSuspended = true;
+			break;
+		}
+		if(useCache)
+			CacheTaskResults(batch.at(i), keys.at(i), GetTaskKey(batch.at(i), stateKey));
+	}
+
+	for(int i=0; i<(int)batch.size(); ++i)
+	{
+		if(taskDone[i])
+			tasks.at(batch.at(i)).done = true;
+	}
+	while(lastTask+1 < numTasks && tasks.at(lastTask+1).done)
+		lastTask++;
+}
+
+bool ProjectProcessor::RunTask(int t)
+{
 	bool taskDone = false;
-	switch(tasks.at(thisTask).type)
+	switch(tasks.at(t).type)
 	{
 	case ProjectDefinition::PREPROCESSING:
 		taskDone = PreprocessImage();
 		break;
 	case ProjectDefinition::NUCLEAR_SEGMENTATION:
-		taskDone = SegmentNuclei(tasks.at(thisTask).inputChannel1);
+		taskDone = SegmentNuclei(tasks.at(t).inputChannel1);
 		break;
 	case ProjectDefinition::FEATURE_COMPUTATION:
-		taskDone = ComputeFeatures(tasks.at(thisTask).inputChannel1);
+		taskDone = ComputeFeatures(tasks.at(t).inputChannel1);
 		break;
 	case ProjectDefinition::CYTOPLASM_SEGMENTATION:
-		taskDone = SegmentCytoplasm(tasks.at(thisTask).inputChannel2, tasks.at(thisTask).inputChannel3);
+		taskDone = SegmentCytoplasm(tasks.at(t).inputChannel2, tasks.at(t).inputChannel3);
 		break;
 	case ProjectDefinition::RAW_ASSOCIATIONS:
 		taskDone = ComputeAssociations();
 		break;
 	//case ProjectDefinition::MULTI_MODEL_SEGMENTATION:
-	//	taskDone = mmSegmentation(tasks.at(thisTask).inputChannel1);
+	//	taskDone = mmSegmentation(tasks.at(t).inputChannel1);
 	//	break;
 	case ProjectDefinition::ANALYTE_MEASUREMENTS:
 		taskDone = false;
@@ -159,12 +281,43 @@ void ProjectProcessor::ProcessNext(void)
 	case ProjectDefinition::QUERY:
 		taskDone = RunQuery();
 		break;
+	default:
+		break;
 	}
+	return taskDone;
+}
 
-	if(taskDone)
+//Results each task reads and changes. Pixel level analysis works on the files named in its rules.
+int ProjectProcessor::GetTaskReads(ProjectDefinition::TaskType type)
+{
+	switch(type)
 	{
-		tasks.at(thisTask).done = true;
-		lastTask++;
+	case ProjectDefinition::PREPROCESSING:			return INPUT_DATA;
+	case ProjectDefinition::NUCLEAR_SEGMENTATION:	return INPUT_DATA;
+	case ProjectDefinition::FEATURE_COMPUTATION:	return INPUT_DATA | LABEL_DATA;
+	case ProjectDefinition::CYTOPLASM_SEGMENTATION:	return INPUT_DATA | LABEL_DATA | TABLE_DATA;
+	case ProjectDefinition::RAW_ASSOCIATIONS:		return INPUT_DATA | LABEL_DATA | TABLE_DATA;
+	case ProjectDefinition::CLASSIFY:				return TABLE_DATA;
+	case ProjectDefinition::CLASSIFY_MCLR:			return TABLE_DATA;
+	case ProjectDefinition::CLASS_EXTRACTION:		return LABEL_DATA | TABLE_DATA;
+	case ProjectDefinition::QUERY:					return TABLE_DATA;
+	default:										return 0;
+	}
+}
+
+int ProjectProcessor::GetTaskWrites(ProjectDefinition::TaskType type)
+{
+	switch(type)
+	{
+	case ProjectDefinition::PREPROCESSING:			return INPUT_DATA;
+	case ProjectDefinition::NUCLEAR_SEGMENTATION:	return INPUT_DATA | LABEL_DATA | TABLE_DATA;
+	case ProjectDefinition::FEATURE_COMPUTATION:	return TABLE_DATA;
+	case ProjectDefinition::CYTOPLASM_SEGMENTATION:	return LABEL_DATA | TABLE_DATA;
+	case ProjectDefinition::RAW_ASSOCIATIONS:		return TABLE_DATA;
+	case ProjectDefinition::CLASSIFY:				return TABLE_DATA;
+	case ProjectDefinition::CLASSIFY_MCLR:			return TABLE_DATA;
+	case ProjectDefinition::CLASS_EXTRACTION:		return CLASS_DATA;
+	default:										return 0;
 	}
 }
 
@@ -294,16 +447,7 @@ bool ProjectProcessor::SegmentNuclei(int nucChannel)
 		mmSegmentation(nucChannel, 0);
 	}
 
-	const ftk::Image::Info * image_info = inputImage->GetImageInfo();
-	int byte_to_cpy = image_info->numZSlices * image_info->numRows * image_info->numColumns * image_info->bytesPerPix;
-	std::map<int, InputImageType::Pointer>::iterator it;
-	for ( it = original_image_map.begin() ; it != original_image_map.end(); ++it )
-	{
-		int chNum = (*it).first;
-		memcpy( inputImage->GetDataPtr(0,chNum), ((*it).second)->GetBufferPointer(), byte_to_cpy );
-	}
-	original_image_map.clear();
-
+	RestoreOriginalImages();
 
 	delete nucSeg;
 	cout << "Total time to segmentation is : " << (clock() - start_time)/(float) CLOCKS_PER_SEC << endl;
@@ -320,6 +464,22 @@ bool ProjectProcessor::SegmentNuclei(int nucChannel)
 	return true;
 }
 
+void ProjectProcessor::RestoreOriginalImages(void)
+{
+	if(original_image_map.empty())
+		return;
+
+	const ftk::Image::Info * image_info = inputImage->GetImageInfo();
+	int byte_to_cpy = image_info->numZSlices * image_info->numRows * image_info->numColumns * image_info->bytesPerPix;
+	std::map<int, InputImageType::Pointer>::iterator it;
+	for ( it = original_image_map.begin() ; it != original_image_map.end(); ++it )
+	{
+		int chNum = (*it).first;
+		memcpy( inputImage->GetDataPtr(0,chNum), ((*it).second)->GetBufferPointer(), byte_to_cpy );
+	}
+	original_image_map.clear();
+}
+
 //***********************************************************************************************************
 //  NUCLEAR SEGMENTATION FOR MONTAGES
 //***********************************************************************************************************
@@ -797,30 +957,16 @@ bool ProjectProcessor::Classify_mclr(void)
 		mclr->Set_Number_Of_Classes((int)active_model_table->GetNumberOfRows());
 		mclr->Set_Number_Of_Features((int)active_model_table->GetNumberOfColumns());
 
-		vtkSmartPointer<vtkTable> test_table  = vtkSmartPointer<vtkTable>::New();
-		test_table->Initialize();
-		test_table->SetNumberOfRows(table->GetNumberOfRows());
-		for(int col=0; col<(int)active_model_table->GetNumberOfColumns(); ++col)
-		{
-			vtkSmartPointer<vtkDoubleArray> column = vtkSmartPointer<vtkDoubleArray>::New();
-			column->SetName(active_model_table->GetColumnName(col));
-			test_table->AddColumn(column);	
-		}
-		for(int row = 0; row < (int)table->GetNumberOfRows(); ++row)
-		{		
-			vtkSmartPointer<vtkVariantArray> model_data1 = vtkSmartPointer<vtkVariantArray>::New();
-			for(int c=0; c<(int)test_table->GetNumberOfColumns();++c)
-				model_data1->InsertNextValue(table->GetValueByName(row,test_table->GetColumnName(c)));
-			test_table->InsertNextRow(model_data1);
-		}	
-		
 		////// Final Data  to classify from the model
-		vnl_matrix<double> data_classify;
-		data_classify =  mclr->Normalize_Feature_Matrix_w(mclr->tableToMatrix_w(test_table), std_dev_vec, mean_vec);
-		data_classify = data_classify.transpose();
+		std::vector<std::string> feature_names;
+		for(int col=0; col<(int)active_model_table->GetNumberOfColumns(); ++col)
+			feature_names.push_back(active_model_table->GetColumnName(col));
+		std::vector<double> data_classify = mclr->Table_To_Column_Block(table, feature_names, std_dev_vec, mean_vec);
 
-		vnl_matrix<double> currprob;
-		currprob = mclr->Test_Current_Model_w(data_classify, act_learn_matrix);
+		int num_rows = (int)table->GetNumberOfRows();
+		std::vector<double> prediction(num_rows), confidence(num_rows);
+		if(num_rows > 0)
+			mclr->Test_Current_Model_Batch(&data_classify[0], num_rows, act_learn_matrix, confidence_thresh, &prediction[0], &confidence[0]);
 
 		std::string prediction_col_name = "prediction_active_" + classification_name;
 		std::string confidence_col_name = "confidence_" + classification_name;
@@ -845,18 +991,10 @@ bool ProjectProcessor::Classify_mclr(void)
 			table->AddColumn(column_confidence);
 		}
 		
-		for(int row = 0; row<(int)table->GetNumberOfRows(); ++row)  
+		for(int row = 0; row<num_rows; ++row)  
 		{
-			vnl_vector<double> curr_col = currprob.get_column(row);
-			table->SetValueByName(row, confidence_col_name.c_str(), vtkVariant(curr_col(curr_col.arg_max())));
-			if(curr_col(curr_col.arg_max()) > confidence_thresh) 
-			{
-				table->SetValueByName(row, prediction_col_name.c_str(), vtkVariant(curr_col.arg_max()+1));						
-			}
-			else
-			{
-				table->SetValueByName(row, prediction_col_name.c_str(), vtkVariant(0));
-			}
+			table->SetValueByName(row, confidence_col_name.c_str(), vtkVariant(confidence[row]));
+			table->SetValueByName(row, prediction_col_name.c_str(), vtkVariant(prediction[row]));
 		}
 	}
 
@@ -1055,6 +1193,596 @@ bool ProjectProcessor::RunQuery(void)
 }
 
 
+//***********************************************************************************************************
+//  CACHE OF THE TASK RESULTS
+//
+//  The key of a task hashes the key of the results it starts from with the task's settings (and the contents
+//  of the files they name), so a change anywhere upstream changes the keys of all the tasks after it. The
+//  manifest <prefix>manifest.txt maps the key of every completed task to the key of the results after it and
+//  of the files holding them; a line is added as soon as a task is done, which is what lets an interrupted
+//  run resume. The label image, the table and the class images are written only by the task that changed
+//  them, the others refer to the files of an earlier task, and nothing is read back until a task has to run.
+//***********************************************************************************************************
+static itk::uint64_t HashBasis(void)
+{
+	return ((itk::uint64_t)0xcbf29ce4 << 32) | 0x84222325;
+}
+
+//64-bit FNV-1a
+static itk::uint64_t HashBytes(itk::uint64_t hash, const void * data, itk::SizeValueType numBytes)
+{
+	const itk::uint64_t prime = ((itk::uint64_t)0x100 << 32) | 0x1b3;
+	const unsigned char * bytes = (const unsigned char *)data;
+	for(itk::SizeValueType i=0; i<numBytes; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= prime;
+	}
+	return hash;
+}
+
+static itk::uint64_t HashString(itk::uint64_t hash, std::string text)
+{
+	return HashBytes(hash, text.c_str(), text.size()+1);
+}
+
+static std::string HashToString(itk::uint64_t hash)
+{
+	char text[17];
+	sprintf(text, "%08lx%08lx", (unsigned long)(hash >> 32), (unsigned long)(hash & 0xffffffff));
+	return std::string(text);
+}
+
+static itk::uint64_t HashFile(itk::uint64_t hash, std::string filename)
+{
+	hash = HashString(hash, filename);
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	std::vector<char> buffer(1 << 20);
+	while(file.good())
+	{
+		file.read(&buffer[0], buffer.size());
+		hash = HashBytes(hash, &buffer[0], (itk::SizeValueType)file.gcount());
+	}
+	return hash;
+}
+
+//The stacks are hashed in pieces of 64MB on all the threads, then the hashes of the pieces in order
+static itk::uint64_t HashImage(itk::uint64_t hash, ftk::Image::Pointer img)
+{
+	const ftk::Image::Info * info = img->GetImageInfo();
+	std::ostringstream size;
+	size << info->dataType << " " << info->numColumns << " " << info->numRows << " " << info->numZSlices << " " << info->numChannels << " " << info->numTSlices;
+	hash = HashString(hash, size.str());
+
+	const itk::SizeValueType pieceSize = 1 << 26;
+	std::vector<const unsigned char *> pieces;
+	std::vector<itk::SizeValueType> pieceBytes;
+	for(itk::SizeValueType t=0; t<info->numTSlices; ++t)
+	{
+		for(itk::SizeValueType ch=0; ch<info->numChannels; ++ch)
+		{
+			const unsigned char * data = (const unsigned char *)img->GetDataPtr(t,ch);
+			itk::SizeValueType bytes = info->numZSlices * info->numRows * info->numColumns * info->bytesPerPix;
+			for(itk::SizeValueType start=0; start<bytes; start+=pieceSize)
+			{
+				pieces.push_back(data + start);
+				pieceBytes.push_back(bytes-start < pieceSize ? bytes-start : pieceSize);
+			}
+		}
+	}
+
+	std::vector<itk::uint64_t> pieceHash(pieces.size());
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int i=0; i<(int)pieces.size(); ++i)
+		pieceHash[i] = HashBytes(HashBasis(), pieces[i], pieceBytes[i]);
+
+	for(int i=0; i<(int)pieces.size(); ++i)
+		hash = HashBytes(hash, &pieceHash[i], sizeof(itk::uint64_t));
+	return hash;
+}
+
+static itk::uint64_t HashTable(itk::uint64_t hash, vtkSmartPointer<vtkTable> tab)
+{
+	for(int c=0; c<(int)tab->GetNumberOfColumns(); ++c)
+	{
+		hash = HashString(hash, tab->GetColumnName(c));
+		vtkDataArray * array = vtkDataArray::SafeDownCast(tab->GetColumn(c));
+		for(int r=0; r<(int)tab->GetNumberOfRows(); ++r)
+		{
+			if(array)
+			{
+				double value = array->GetTuple1(r);
+				hash = HashBytes(hash, &value, sizeof(double));
+			}
+			else
+				hash = HashString(hash, tab->GetValue(r,c).ToString());
+		}
+	}
+	return hash;
+}
+
+//Tables are kept in binary to get back the exact values: the sizes, the column names, then every column.
+//The columns come back as doubles, as from LoadTable.
+static bool WriteCacheTable(std::string filename, vtkSmartPointer<vtkTable> tab)
+{
+	FILE * fp = fopen(filename.c_str(), "wb");
+	if(!fp)
+		return false;
+
+	itk::uint64_t numRows = tab->GetNumberOfRows();
+	itk::uint64_t numColumns = tab->GetNumberOfColumns();
+	bool ok = fwrite(&numRows, sizeof(itk::uint64_t), 1, fp) == 1 && fwrite(&numColumns, sizeof(itk::uint64_t), 1, fp) == 1;
+	for(int c=0; c<(int)numColumns && ok; ++c)
+	{
+		std::string name = tab->GetColumnName(c) ? tab->GetColumnName(c) : "";
+		itk::uint64_t length = name.size();
+		ok = fwrite(&length, sizeof(itk::uint64_t), 1, fp) == 1 && fwrite(name.c_str(), 1, name.size(), fp) == name.size();
+	}
+	std::vector<double> values(numRows);
+	for(int c=0; c<(int)numColumns && ok; ++c)
+	{
+		vtkDataArray * array = vtkDataArray::SafeDownCast(tab->GetColumn(c));
+		if(!array || array->GetNumberOfComponents() != 1)
+		{
+			ok = false;
+			break;
+		}
+		for(int r=0; r<(int)numRows; ++r)
+			values[r] = array->GetTuple1(r);
+		if(numRows > 0)
+			ok = fwrite(&values[0], sizeof(double), numRows, fp) == numRows;
+	}
+	fclose(fp);
+	return ok;
+}
+
+static vtkSmartPointer<vtkTable> ReadCacheTable(std::string filename)
+{
+	FILE * fp = fopen(filename.c_str(), "rb");
+	if(!fp)
+		return NULL;
+
+	itk::uint64_t numRows = 0, numColumns = 0;
+	bool ok = fread(&numRows, sizeof(itk::uint64_t), 1, fp) == 1 && fread(&numColumns, sizeof(itk::uint64_t), 1, fp) == 1;
+	std::vector<std::string> names;
+	for(itk::uint64_t c=0; c<numColumns && ok; ++c)
+	{
+		itk::uint64_t length = 0;
+		ok = fread(&length, sizeof(itk::uint64_t), 1, fp) == 1;
+		std::string name(ok ? (size_t)length : 0, ' ');
+		if(ok && length > 0)
+			ok = fread(&name[0], 1, (size_t)length, fp) == length;
+		names.push_back(name);
+	}
+
+	vtkSmartPointer<vtkTable> tab = vtkSmartPointer<vtkTable>::New();
+	for(int c=0; c<(int)names.size() && ok; ++c)
+	{
+		vtkSmartPointer<vtkDoubleArray> column = vtkSmartPointer<vtkDoubleArray>::New();
+		column->SetName(names.at(c).c_str());
+		column->SetNumberOfValues(numRows);
+		if(numRows > 0)
+			ok = fread(column->GetPointer(0), sizeof(double), numRows, fp) == numRows;
+		tab->AddColumn(column);
+	}
+	fclose(fp);
+	if(!ok)
+		return NULL;
+	return tab;
+}
+
+//Label images are kept raw (stacks ordered x,y,z,ch,t) with their sizes in a text file, and come back
+//memory mapped: pages are read when used, and a task changing the labels gets private copies of them.
+static bool WriteCacheImage(std::string basename, ftk::Image::Pointer img)
+{
+	const ftk::Image::Info * info = img->GetImageInfo();
+	std::ofstream sizeFile((basename + ".txt").c_str());
+	if(!sizeFile.is_open())
+		return false;
+	sizeFile << (int)info->dataType << " " << info->numColumns << " " << info->numRows << " " << info->numZSlices << " "
+		<< info->numChannels << " " << info->numTSlices;
+	for(int d=0; d<(int)info->spacing.size(); ++d)
+		sizeFile << " " << info->spacing.at(d);
+	sizeFile << "\n";
+	sizeFile.close();
+
+	FILE * fp = fopen((basename + ".raw").c_str(), "wb");
+	if(!fp)
+		return false;
+	bool ok = true;
+	itk::SizeValueType bytes = info->numZSlices * info->numRows * info->numColumns * info->bytesPerPix;
+	for(itk::SizeValueType t=0; t<info->numTSlices && ok; ++t)
+		for(itk::SizeValueType ch=0; ch<info->numChannels && ok; ++ch)
+			ok = fwrite(img->GetDataPtr(t,ch), 1, bytes, fp) == bytes;
+	fclose(fp);
+	return ok;
+}
+
+static ftk::Image::Pointer ReadCacheImage(std::string basename)
+{
+	std::ifstream sizeFile((basename + ".txt").c_str());
+	int dataType;
+	itk::SizeValueType cs, rs, zs, chs, ts;
+	if(!(sizeFile >> dataType >> cs >> rs >> zs >> chs >> ts))
+		return NULL;
+	std::vector<float> spacing;
+	float s;
+	while(sizeFile >> s)
+		spacing.push_back(s);
+
+	ftk::Image::Pointer img = ftk::Image::New();
+	if(!img->LoadRawMapped(basename + ".raw", (ftk::Image::DataType)dataType, cs, rs, zs, chs, ts, 0, MappedFile::COPY_ON_WRITE))
+		return NULL;
+	if(spacing.size() == 3)
+		img->SetSpacing(spacing[0], spacing[1], spacing[2]);
+	return img;
+}
+
+bool ProjectProcessor::IsCacheable(ProjectDefinition::TaskType type)
+{
+	//Queries read a database the project does not own
+	return type != ProjectDefinition::QUERY && type != ProjectDefinition::ANALYTE_MEASUREMENTS;
+}
+
+void ProjectProcessor::LoadCacheManifest(void)
+{
+	cacheManifest.clear();
+	std::ifstream manifest((cache_prefix + "manifest.txt").c_str());
+	std::string key;
+	CacheEntry entry;
+	while(manifest >> key >> entry.state >> entry.files)
+		cacheManifest[key] = entry;
+	std::cout << "Found " << cacheManifest.size() << " cached results\n";
+}
+
+//Key of the input image and channels, and of the label image and table given if a task reads them before
+//one makes new ones
+std::string ProjectProcessor::GetInitialKey(void)
+{
+	itk::uint64_t hash = HashBasis();
+	for(int i=0; i<(int)definition->inputs.size(); ++i)
+		hash = HashString(hash, ftk::NumToString(definition->inputs.at(i).number) + " " + definition->inputs.at(i).name + " " + definition->inputs.at(i).type);
+	if(inputImage)
+		hash = HashImage(hash, inputImage);
+
+	int used = 0, made = 0;
+	for(int t=0; t<numTasks; ++t)
+	{
+		used |= GetTaskReads(tasks.at(t).type) & ~made;
+		if(tasks.at(t).type == ProjectDefinition::NUCLEAR_SEGMENTATION)
+		{
+			made |= LABEL_DATA;
+			if(inputImage && inputImage->GetImageInfo()->numTSlices == 1)
+				made |= TABLE_DATA;
+		}
+		if(tasks.at(t).type == ProjectDefinition::FEATURE_COMPUTATION)
+			made |= TABLE_DATA;
+	}
+	if((used & LABEL_DATA) && outputImage)
+		hash = HashImage(HashString(hash, "label"), outputImage);
+	if((used & TABLE_DATA) && table)
+		hash = HashTable(HashString(hash, "table"), table);
+	return HashToString(hash);
+}
+
+std::string ProjectProcessor::GetTaskKey(int t, std::string previousKey)
+{
+	ProjectDefinition::TaskType type = tasks.at(t).type;
+	itk::uint64_t hash = HashString(HashBasis(), previousKey);
+
+	TiXmlElement * taskElement = definition->GetTaskElement(type);
+	TiXmlPrinter printer;
+	taskElement->Accept(&printer);
+	hash = HashString(hash, printer.CStr());
+	delete taskElement;
+
+	hash = HashString(hash, ftk::NumToString(tasks.at(t).inputChannel1) + " " + ftk::NumToString(tasks.at(t).inputChannel2) + " " + ftk::NumToString(tasks.at(t).inputChannel3));
+
+	//Models and training data:
+	if(type == ProjectDefinition::NUCLEAR_SEGMENTATION)
+	{
+		for(int i=0; i<(int)definition->mmSegFiles.size(); ++i)
+			hash = HashFile(hash, definition->mmSegFiles.at(i).path);
+	}
+	else if(type == ProjectDefinition::CLASSIFY)
+	{
+		hash = HashFile(hash, definition->classificationTrainingData);
+	}
+	else if(type == ProjectDefinition::CLASSIFY_MCLR)
+	{
+		for(int i=0; i<(int)definition->Classification_Rules.size(); ++i)
+			hash = HashFile(hash, definition->Classification_Rules.at(i).TrainingFileName);
+	}
+	else if(type == ProjectDefinition::PIXEL_ANALYSIS)
+	{
+		for(int i=0; i<(int)definition->pixelLevelRules.size(); ++i)
+		{
+			hash = HashFile(hash, definition->pixelLevelRules.at(i).regionChannelName);
+			hash = HashFile(hash, definition->pixelLevelRules.at(i).targetChannelName);
+		}
+	}
+	return HashToString(hash);
+}
+
+bool ProjectProcessor::FindCachedTask(int t, std::string key, CacheEntry & entry)
+{
+	std::map< std::string, CacheEntry >::iterator it = cacheManifest.find(key);
+	if(it == cacheManifest.end())
+		return false;
+	if(it->second.files != initialKey && !ftk::FileExists(cache_prefix + it->second.files + ".txt"))
+		return false;
+	//Pixel level analysis writes its results to the files named in its rules, not to the cache
+	if(tasks.at(t).type == ProjectDefinition::PIXEL_ANALYSIS)
+	{
+		for(int i=0; i<(int)definition->pixelLevelRules.size(); ++i)
+			if(!ftk::FileExists(definition->pixelLevelRules.at(i).outputFilename))
+				return false;
+	}
+	entry = it->second;
+	return true;
+}
+
+void ProjectProcessor::SkipCachedTask(int t, CacheEntry entry)
+{
+	ProjectDefinition::TaskType type = tasks.at(t).type;
+	std::cout << "Using the cached results of " << definition->GetTaskString(type) << "\n";
+
+	switch(type)
+	{
+	case ProjectDefinition::PREPROCESSING:
+		++preprocessPending;
+		break;
+	case ProjectDefinition::NUCLEAR_SEGMENTATION:
+		RestoreOriginalImages();
+		preprocessPending = 0;
+		LoadCachedParameters(entry.files, type);
+		resultIsEditable = true;
+		break;
+	case ProjectDefinition::FEATURE_COMPUTATION:
+		resultIsEditable = true;
+		break;
+	case ProjectDefinition::CYTOPLASM_SEGMENTATION:
+		LoadCachedParameters(entry.files, type);
+		resultIsEditable = false;
+		break;
+	case ProjectDefinition::RAW_ASSOCIATIONS:
+		resultIsEditable = false;
+		break;
+	default:
+		break;
+	}
+
+	stateKey = entry.state;
+	filesKey = entry.files;
+}
+
+//Brings the results in memory up to the last completed task, before a task runs
+bool ProjectProcessor::RestoreCachedState(void)
+{
+	if(!LoadCachedState(filesKey))
+	{
+		std::cerr << "ERROR: Could not read the cached results " << filesKey << ", running all the tasks again\n";
+		cacheSuspended = true;
+		for(int t=0; t<numTasks; ++t)
+			tasks.at(t).done = false;
+		lastTask = -1;
+		preprocessPending = 0;
+		return false;
+	}
+	for(; preprocessPending > 0; --preprocessPending)
+		PreprocessImage();
+	return true;
+}
+
+void ProjectProcessor::CacheTaskResults(int t, std::string key, std::string usedKey)
+{
+	ProjectDefinition::TaskType type = tasks.at(t).type;
+	if(cacheSuspended || !IsCacheable(type))
+		return;
+
+	CacheEntry entry;
+	int writes = GetTaskWrites(type) & ~INPUT_DATA;
+	if(type == ProjectDefinition::PREPROCESSING)
+	{
+		entry.state = key;
+		entry.files = filesKey;
+	}
+	else if(!writes)
+	{
+		entry.state = stateKey;
+		entry.files = filesKey;
+	}
+	else
+	{
+		if(!SaveCachedState(key, writes))
+		{
+			std::cerr << "ERROR: Could not cache the results of " << definition->GetTaskString(type) << "\n";
+			cacheSuspended = true;
+			return;
+		}
+		entry.state = key;
+		entry.files = key;
+	}
+
+	//The settings a segmentation ends up using go in the definition, so a rerun of the saved definition
+	//finds the results under the key of those as well
+	std::vector<std::string> keys(1, key);
+	if(usedKey != key)
+		keys.push_back(usedKey);
+	for(int i=0; i<(int)keys.size(); ++i)
+	{
+		cacheManifest[keys.at(i)] = entry;
+		ftk::AppendTextFile(cache_prefix + "manifest.txt", keys.at(i) + " " + entry.state + " " + entry.files);
+	}
+
+	stateKey = entry.state;
+	filesKey = entry.files;
+}
+
+//Writes the results the task changed, and a header naming the files of all the results
+bool ProjectProcessor::SaveCachedState(std::string key, int writes)
+{
+	std::string basename = cache_prefix + key;
+	if(writes & LABEL_DATA)
+	{
+		labelKey = "-";
+		if(outputImage)
+		{
+			if(!WriteCacheImage(basename + "_label", outputImage))
+				return false;
+			labelKey = key;
+		}
+	}
+	if(writes & TABLE_DATA)
+	{
+		tableKey = "-";
+		if(table)
+		{
+			if(!WriteCacheTable(basename + "_table.bin", table))
+				return false;
+			tableKey = key;
+		}
+	}
+	if(writes & CLASS_DATA)
+	{
+		std::ofstream classFile((basename + "_classes.txt").c_str());
+		if(!classFile.is_open())
+			return false;
+		int c = 0;
+		std::map< std::string, LabelImageType::Pointer >::iterator it;
+		for(it = classImageMap.begin(); it != classImageMap.end(); ++it, ++c)
+		{
+			LabelImageType::Pointer classImage = it->second;
+			LabelImageType::SizeType size = classImage->GetBufferedRegion().GetSize();
+			classFile << size[0] << " " << size[1] << " " << size[2] << " " << it->first << "\n";
+
+			std::string classname = basename + "_class" + ftk::NumToString(c);
+			FILE * fp = fopen((classname + ".raw").c_str(), "wb");
+			if(!fp)
+				return false;
+			itk::SizeValueType numPixels = size[0] * size[1] * size[2];
+			bool ok = fwrite(classImage->GetBufferPointer(), sizeof(LPixelT), numPixels, fp) == numPixels;
+			fclose(fp);
+			if(!ok || !classCentroidMap[it->first] || !WriteCacheTable(classname + "_centroids.bin", classCentroidMap[it->first]))
+				return false;
+		}
+		classKey = key;
+	}
+
+	//Written last, a task is cached only once all its files are
+	std::ofstream header((basename + ".txt").c_str());
+	if(!header.is_open())
+		return false;
+	header.precision(17);
+	header << "label " << labelKey << "\n";
+	header << "table " << tableKey << "\n";
+	header << "classes " << classKey << "\n";
+	for(int i=0; i<(int)definition->nuclearParameters.size(); ++i)
+		header << "nuclear_parameter " << definition->nuclearParameters.at(i).name << " " << definition->nuclearParameters.at(i).value << "\n";
+	for(int i=0; i<(int)definition->cytoplasmParameters.size(); ++i)
+		header << "cytoplasm_parameter " << definition->cytoplasmParameters.at(i).name << " " << definition->cytoplasmParameters.at(i).value << "\n";
+	header.close();
+	return !header.fail();
+}
+
+//Reads the results named in a header that differ from those in memory
+bool ProjectProcessor::LoadCachedState(std::string key)
+{
+	if(key == initialKey)
+		return labelKey == initialKey && tableKey == initialKey && classKey == initialKey;
+
+	std::ifstream header((cache_prefix + key + ".txt").c_str());
+	std::string name, label, tab, classes;
+	if(!(header >> name >> label >> name >> tab >> name >> classes))
+		return false;
+
+	if(label != labelKey)
+	{
+		if(label == initialKey)
+			return false;
+		outputImage = NULL;
+		if(label != "-")
+		{
+			outputImage = ReadCacheImage(cache_prefix + label + "_label");
+			if(!outputImage)
+				return false;
+		}
+		labelKey = label;
+	}
+
+	if(tab != tableKey)
+	{
+		if(tab == initialKey)
+			return false;
+		table = NULL;
+		if(tab != "-")
+		{
+			table = ReadCacheTable(cache_prefix + tab + "_table.bin");
+			if(!table)
+				return false;
+		}
+		tableKey = tab;
+	}
+
+	if(classes != classKey)
+	{
+		if(classes == initialKey)
+			return false;
+		classImageMap.clear();
+		classCentroidMap.clear();
+		std::ifstream classFile((cache_prefix + classes + "_classes.txt").c_str());
+		LabelImageType::SizeType size;
+		int c = 0;
+		while(classFile >> size[0] >> size[1] >> size[2])
+		{
+			std::string className;
+			std::getline(classFile, className);
+			className.erase(0, 1);
+
+			std::string classname = cache_prefix + classes + "_class" + ftk::NumToString(c++);
+			LabelImageType::Pointer classImage = LabelImageType::New();
+			LabelImageType::RegionType region;
+			region.SetSize(size);
+			classImage->SetRegions(region);
+			classImage->Allocate();
+			FILE * fp = fopen((classname + ".raw").c_str(), "rb");
+			if(!fp)
+				return false;
+			itk::SizeValueType numPixels = size[0] * size[1] * size[2];
+			bool ok = fread(classImage->GetBufferPointer(), sizeof(LPixelT), numPixels, fp) == numPixels;
+			fclose(fp);
+			vtkSmartPointer<vtkTable> centroid_table = ReadCacheTable(classname + "_centroids.bin");
+			if(!ok || !centroid_table)
+				return false;
+			classImageMap[className] = classImage;
+			classCentroidMap[className] = centroid_table;
+		}
+		classKey = classes;
+	}
+	return true;
+}
+
+//Settings a segmentation ended up using, as it would have left them in the definition
+void ProjectProcessor::LoadCachedParameters(std::string key, ProjectDefinition::TaskType type)
+{
+	std::string wanted = (type == ProjectDefinition::NUCLEAR_SEGMENTATION) ? "nuclear_parameter" : "cytoplasm_parameter";
+	std::vector<ProjectDefinition::Parameter> parameters;
+	std::ifstream header((cache_prefix + key + ".txt").c_str());
+	std::string line;
+	while(std::getline(header, line))
+	{
+		std::istringstream fields(line);
+		std::string kind;
+		ProjectDefinition::Parameter p;
+		if(fields >> kind >> p.name >> p.value && kind == wanted)
+			parameters.push_back(p);
+	}
+	if(type == ProjectDefinition::NUCLEAR_SEGMENTATION)
+		definition->nuclearParameters = parameters;
+	else
+		definition->cytoplasmParameters = parameters;
+}
+
 //************************************************************************
 //************************************************************************
 //************************************************************************
@@ -48,6 +48,7 @@
 #include "itkLabelStatisticsImageFilter.h"
 #include "itkImageDuplicator.h"
 #include "itkMultiThreader.h"
+#include "ftkCommon/ftkTaskRuntime.h"
 
 // MODEL_SEG is defined as a compiler option in the Nucleus Editor's CMakeLists
 #ifdef MODEL_SEG
@@ -83,6 +84,10 @@ public:
 	bool ReadyToEdit(void){ return resultIsEditable; };
 	int NeedInput(void){ return inputTypeNeeded; };	//Return non-zero value indicating type of input needed
 	void SetNumThreads( int threads );
+	//Keep the results of every task in files starting with this prefix (e.g. "<project>_cache_"), keyed by a hash of
+	//the task's inputs and settings. Tasks whose results are there are skipped, so reruns resume after the last
+	//task that completed. Call before Initialize(); an empty prefix (the default) turns the cache off.
+	void SetCacheFilePrefix( std::string prefix ){ cache_prefix = prefix; };
 
 	//Outputs
 	ftk::Image::Pointer GetOutputImage(void){ return outputImage; };
@@ -110,6 +115,28 @@ protected:
 	bool RunQuery(void);									//Run SQL Query
 
 	std::set<int> GetOnIntrinsicFeatures(void);				//Return the list of intrinsic features to calculate
+	void RestoreOriginalImages(void);						//Undo the preprocessing of the input channels
+
+	//Running the tasks:
+	enum { INPUT_DATA = 1, LABEL_DATA = 2, TABLE_DATA = 4, CLASS_DATA = 8 };	//Results a task reads or writes
+	static int GetTaskReads(ProjectDefinition::TaskType type);
+	static int GetTaskWrites(ProjectDefinition::TaskType type);
+	bool RunTask(int t);
+	friend class ProjectTaskRunner;
+
+	//Cache of the task results:
+	typedef struct { std::string state; std::string files; } CacheEntry;	//Key of the results after a task, and of the files holding them
+	bool IsCacheable(ProjectDefinition::TaskType type);
+	std::string GetInitialKey(void);
+	std::string GetTaskKey(int t, std::string previousKey);
+	bool FindCachedTask(int t, std::string key, CacheEntry & entry);
+	void SkipCachedTask(int t, CacheEntry entry);
+	void CacheTaskResults(int t, std::string key, std::string usedKey);
+	bool RestoreCachedState(void);
+	bool SaveCachedState(std::string key, int writes);
+	bool LoadCachedState(std::string key);
+	void LoadCachedParameters(std::string key, ProjectDefinition::TaskType type);
+	void LoadCacheManifest(void);
 
 	ftk::Image::Pointer inputImage;
 	ftk::Image::Pointer outputImage;
@@ -132,6 +159,17 @@ private:
 	int inputTypeNeeded;
 	std::string save_path;
 	std::string executable_path;
+
+	std::string cache_prefix;
+	std::map< std::string, CacheEntry > cacheManifest;
+	bool cacheSuspended;		//Set when the results stop following the chain of keys (a task failed after a later one ran)
+	std::string initialKey;		//Inputs given to the processor
+	std::string stateKey;		//Results after the last completed task
+	std::string filesKey;		//Cached files holding them
+	std::string labelKey;		//Files the label image, the table and the class images in memory come from
+	std::string tableKey;
+	std::string classKey;
+	int preprocessPending;		//Skipped preprocessing steps not applied to the input image yet
 };
 
 }  // end namespace ftk
@@ -106,6 +106,7 @@ int main(int argc, char *argv[])
 	std::cout<<"The executable says my path is: "<<ftk::GetFilePath( MyName )<<std::endl;
 	pProc->SetInputImage(myImg);
 	pProc->SetPath( ftk::GetFilePath(inputFilename) );
+	pProc->SetCacheFilePrefix( ftk::SetExtension(definitionFilename, "") + "_cache_" );	//Reruns skip the tasks already done
 	if(labImg)
 		pProc->SetOutputImage(labImg);
 	if(table)
@@ -187,4 +188,5 @@ void usage(const char *funcName)
 	std::cout << "USAGE:\n";
 	std::cout << " " << funcName << " InputImage LabelImage Table ProcessDefinition (Optional)NumThreads\n";
 	std::cout << "  First four inputs are filenames\n";
+	std::cout << "  Results of every task are cached next to the ProcessDefinition, a rerun resumes after the last task done\n";
 }
@@ -47,6 +47,7 @@ int main(int argc, char* argv[])
 		std::cout<<"SomaExtraction without seeds: SomaExtraction <2> <InputImageFileName> <Options>\n";
 		std::cout<<"Get Statistics of the image: SomaExtraction <3> <InputImageFileName> \n";
 		std::cout<<"Normalize intensity: SomaExtraction <4> <InputImageFileName> <Gaussian Blur Sigma> <Global Median> <ratio threshold, if below, autothresholding to keep background>\n";
+		std::cout<<"Normalize intensity by streaming: SomaExtraction <6> <InputImageFileName> <OutputImageFileName> <Gaussian Blur Sigma> [Slab Depth]\n";
 		return 0;
 	}
 
@@ -188,6 +189,14 @@ int main(int argc, char* argv[])
 		SomaExtractor::UShortImageType::Pointer rescaledImage = Somas->DevideAndScale(image, backgroundImage, atof(argv[4]), atof(argv[5]));
 		Somas->writeImage(imageName.c_str(), rescaledImage);
 	}
+	else if( atoi(argv[1]) == 6 && argc >= 5)  /// normalize the intensity slab by slab, for volumes larger than memory (streaming formats such as .mhd)
+	{
+		unsigned int slabDepth = argc > 5 ? atoi(argv[5]) : 16;
+		if( !Somas->NormalizeByBackgroundStreaming(argv[2], argv[3], atof(argv[4]), slabDepth))
+		{
+			std::cout<< "Normalization failed."<<std::endl;
+		}
+	}
 	else if( atoi( argv[1]) == 5)
 	{
 		SomaExtractor::ProbImageType::Pointer inputImage = Somas->SetInputImage8bit(argv[2]);
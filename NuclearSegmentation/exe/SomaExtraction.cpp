@@ -34,9 +34,12 @@
 #include <itkMinimumMaximumImageCalculator.h>
 #include <itkBinaryMorphologicalOpeningImageFilter.h>
 #include <sstream>
+#include <algorithm>
 #include <itkMultiplyImageFilter.h>
 #include "itkMedianImageFunction.h"
 #include <itkImageDuplicator.h>
+#include "itkImageIOFactory.h"
+#include "itkImageIORegion.h"
 #include <itkGradientAnisotropicDiffusionImageFilter.h>
 
 #ifdef _OPENMP
@@ -51,6 +54,8 @@ std::string SomaInfo[N]={"ID", "centroid_x", "centroid_y", "centroid_z", "soma_v
 
 SomaExtractor::SomaExtractor()
 {
+	roiRadius = 0;
+	numThreads = 0;
 }
 
 SomaExtractor::~SomaExtractor()
@@ -406,6 +411,8 @@ void SomaExtractor::LoadOptions(const char* paramFileName)
 	SetParamValue<int>(opts, "-sampling_ratio_XY_to_Z", sampling_ratio_XY_to_Z, 2);
 	SetParamValue<int>(opts, "-radius", radius, 10);
 	SetParamValue<int>(opts, "-rerun", brerun, 0);
+	SetParamValue<int>(opts, "-roi_radius", roiRadius, 0);
+	SetParamValue<int>(opts, "-num_threads", numThreads, 0);
 }
 
 void SomaExtractor::writeImage(const char* writeFileName, OutputImageType::Pointer image)
@@ -613,6 +620,11 @@ SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentSoma( std::vect
 	//InterpolatorType::Pointer I_Interpolator = InterpolatorType::New();
 	//I_Interpolator->SetInputImage(input);
 
+	if( roiRadius > 0 && somaCentroids.size() > 0)
+	{
+		return SegmentSomaInROIs( somaCentroids, binImagePtr, NULL, false);
+	}
+
 	int SM = binImagePtr->GetLargestPossibleRegion().GetSize()[0];
 	int SN = binImagePtr->GetLargestPossibleRegion().GetSize()[1];
 	int SZ = binImagePtr->GetLargestPossibleRegion().GetSize()[2];
@@ -744,39 +756,8 @@ SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentSoma( std::vect
 	//closeFilter->SetForegroundValue( 255);
 
 	/// Label image
-	LabelFilterType::Pointer label = LabelFilterType::New();
-	label->SetInput(thresholder->GetOutput());
-
-	RelabelFilterType::Pointer relabel = RelabelFilterType::New();
-	relabel->SetInput( label->GetOutput());
-	relabel->SetMinimumObjectSize( minObjSize);  
-
-	relabel->Update();
-	SegmentedImageType::Pointer somas = relabel->GetOutput();
-
-	LabelGeometryImageFilterType::Pointer labelGeometryImageFilter = LabelGeometryImageFilterType::New();
-	labelGeometryImageFilter->SetInput( somas);
-	labelGeometryImageFilter->CalculatePixelIndicesOff();
-	labelGeometryImageFilter->CalculateOrientedBoundingBoxOff();
-	labelGeometryImageFilter->CalculateOrientedLabelRegionsOff();
-	labelGeometryImageFilter->CalculateOrientedIntensityRegionsOff();
-	labelGeometryImageFilter->Update();
-	LabelGeometryImageFilterType::LabelsType allLabels = labelGeometryImageFilter->GetLabels();
-	LabelGeometryImageFilterType::LabelsType::iterator allLabelsIt =  allLabels.begin();
-
-	somaCentroids.clear();
-	for( allLabelsIt++; allLabelsIt != allLabels.end(); allLabelsIt++ )
-	{
-		LabelGeometryImageFilterType::LabelPixelType labelValue = *allLabelsIt;
-		vtkSmartPointer<vtkVariantArray> row = vtkSmartPointer<vtkVariantArray>::New();
-		LabelGeometryImageFilterType::LabelPointType point = labelGeometryImageFilter->GetCentroid(labelValue);
-		itk::Index<3> index;
-		index[0] = point[0];
-		index[1] = point[1];
-		index[2] = point[2];
-		somaCentroids.push_back(index);
-	}
-	return somas;
+	thresholder->Update();
+	return LabelSomas( thresholder->GetOutput(), somaCentroids);
 }
 
 // Shape Detection Active Contour Without GVF:
@@ -1041,12 +1022,12 @@ SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentHeart( const ch
 }
 
 /// Generate Expanded Inital Contours within the boundary of labeled object by Daniel Distance Map
-SomaExtractor::ProbImageType::Pointer SomaExtractor::GetInitalContourByDistanceMap(SegmentedImageType::Pointer labelImage, double outlierExpand)
+/// numberOfThreads: threads of the ITK filters, 0 for the ITK default
+SomaExtractor::ProbImageType::Pointer SomaExtractor::GetInitalContourByDistanceMap(SegmentedImageType::Pointer labelImage, double outlierExpand, int numberOfThreads)
 {
 	int SX = labelImage->GetLargestPossibleRegion().GetSize()[0];
 	int SY = labelImage->GetLargestPossibleRegion().GetSize()[1];
 	int SZ = labelImage->GetLargestPossibleRegion().GetSize()[2];
-	std::cout<< SX<<"\t"<<SY<<"\t"<<SZ<<std::endl;
 
 	SegThresholdingFilterType::Pointer thresholder = SegThresholdingFilterType::New();
 	thresholder->SetInput(labelImage);
@@ -1054,7 +1035,6 @@ SomaExtractor::ProbImageType::Pointer SomaExtractor::GetInitalContourByDistanceM
 	thresholder->SetUpperThreshold(100000); 
 	thresholder->SetOutsideValue( 0);
 	thresholder->SetInsideValue(255);
-	std::cout<< "SegThresholdingFilterType"<<std::endl;
 
 	/////generate bounding box
 	//LabelFilterType::Pointer label = LabelFilterType::New();
@@ -1126,6 +1106,14 @@ SomaExtractor::ProbImageType::Pointer SomaExtractor::GetInitalContourByDistanceM
 	SubtractImageFilterType::Pointer substractImageFilter = SubtractImageFilterType::New();   // expand the contour
 	substractImageFilter->SetInput1( distanceMapFilter->GetOutput());
 	substractImageFilter->SetConstant2( outlierExpand);
+	if( numberOfThreads > 0)
+	{
+		thresholder->SetNumberOfThreads( numberOfThreads);
+		regionFilter->SetNumberOfThreads( numberOfThreads);
+		caster->SetNumberOfThreads( numberOfThreads);
+		distanceMapFilter->SetNumberOfThreads( numberOfThreads);
+		substractImageFilter->SetNumberOfThreads( numberOfThreads);
+	}
 
 	try
 	{
@@ -1187,6 +1175,11 @@ void SomaExtractor::CheckBoundary(SegmentedImageType::IndexType &start, Segmente
 // int minObjSize;
 SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentSomaUsingGradient( ProbImageType::Pointer input, SegmentedImageType::Pointer initialContour, std::vector< itk::Index<3> > &somaCentroids) 																	  
 {
+	if( roiRadius > 0 && ( somaCentroids.size() > 0 || initialContour))
+	{
+		return SegmentSomaInROIs( somaCentroids, input, initialContour, true);
+	}
+
 	int SM = input->GetLargestPossibleRegion().GetSize()[0];
 	int SN = input->GetLargestPossibleRegion().GetSize()[1];
 	int SZ = input->GetLargestPossibleRegion().GetSize()[2];
@@ -1239,11 +1232,17 @@ SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentSomaUsingGradie
 	sigmoid->SetInput( gradientMagnitude->GetOutput());
 	sigmoid->Update();
 	writeImage("sigmoid.nrrd", sigmoid->GetOutput());
-	return NULL;
 
 	std::cout<<"Active Contour: "<<curvatureScaling<<"\t"<<advectScaling<<"\t"<<rmsThres<<std::endl;
 	GeodesicActiveContourFilterType::Pointer GVF_snake = GeodesicActiveContourFilterType::New();
-	GVF_snake->SetInput(fastMarching->GetOutput());
+	if( initialContour)
+	{
+		GVF_snake->SetInput( GetInitalContourByDistanceMap( initialContour, outlierExpandValue));
+	}
+	else
+	{
+		GVF_snake->SetInput(fastMarching->GetOutput());
+	}
 	GVF_snake->SetFeatureImage(sigmoid->GetOutput());
 	GVF_snake->SetPropagationScaling( 1.0);
 	GVF_snake->SetCurvatureScaling( curvatureScaling);
@@ -1273,19 +1272,367 @@ SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentSomaUsingGradie
 	thresholder->SetInput( GVF_snake->GetOutput());
 
 	/// Label image, recaculate centroids
+	thresholder->Update();
+	return LabelSomas( thresholder->GetOutput(), somaCentroids);
+}
+
+/// Group seeds whose padded boxes overlap (union-find over a uniform grid) and
+/// give each group the union of its boxes, clipped to the image.
+void SomaExtractor::GroupSeedsIntoROIs( std::vector< itk::Index<3> > &somaCentroids, ProbImageType::RegionType imageRegion, int pad, std::vector< SomaROI> &rois)
+{
+	int numSeeds = somaCentroids.size();
+	std::vector< int> parent(numSeeds);
+	for( int i = 0; i < numSeeds; i++)
+	{
+		parent[i] = i;
+	}
+
+	// seeds closer than 2*pad on every axis end up in the same or adjacent cells
+	int cellSize = 2 * pad + 1;
+	std::map< long long, std::vector< int> > grid;
+	for( int i = 0; i < numSeeds; i++)
+	{
+		long long cx = somaCentroids[i][0] / cellSize;
+		long long cy = somaCentroids[i][1] / cellSize;
+		long long cz = somaCentroids[i][2] / cellSize;
+		grid[ (cz << 42) | (cy << 21) | cx].push_back(i);
+	}
+
+	for( int i = 0; i < numSeeds; i++)
+	{
+		long long cx = somaCentroids[i][0] / cellSize;
+		long long cy = somaCentroids[i][1] / cellSize;
+		long long cz = somaCentroids[i][2] / cellSize;
+		for( long long dz = -1; dz <= 1; dz++)
+		{
+			for( long long dy = -1; dy <= 1; dy++)
+			{
+				for( long long dx = -1; dx <= 1; dx++)
+				{
+					if( cx + dx < 0 || cy + dy < 0 || cz + dz < 0)
+					{
+						continue;
+					}
+					std::map< long long, std::vector< int> >::iterator cell = grid.find( ((cz + dz) << 42) | ((cy + dy) << 21) | (cx + dx));
+					if( cell == grid.end())
+					{
+						continue;
+					}
+					for( size_t k = 0; k < cell->second.size(); k++)
+					{
+						int j = cell->second[k];
+						if( j <= i || std::abs( somaCentroids[i][0] - somaCentroids[j][0]) > 2 * pad
+							|| std::abs( somaCentroids[i][1] - somaCentroids[j][1]) > 2 * pad
+							|| std::abs( somaCentroids[i][2] - somaCentroids[j][2]) > 2 * pad)
+						{
+							continue;
+						}
+						int ri = i;
+						int rj = j;
+						while( parent[ri] != ri) ri = parent[ri] = parent[parent[ri]];
+						while( parent[rj] != rj) rj = parent[rj] = parent[parent[rj]];
+						if( ri != rj)
+						{
+							parent[ std::max(ri, rj)] = std::min(ri, rj);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	ProbImageType::SizeType imageSize = imageRegion.GetSize();
+	std::map< int, int> rootToROI;
+	rois.clear();
+	for( int i = 0; i < numSeeds; i++)
+	{
+		int root = i;
+		while( parent[root] != root) root = parent[root];
+		std::map< int, int>::iterator it = rootToROI.find(root);
+		int roiId;
+		if( it == rootToROI.end())
+		{
+			roiId = rois.size();
+			rootToROI[root] = roiId;
+			rois.push_back( SomaROI());
+		}
+		else
+		{
+			roiId = it->second;
+		}
+		rois[roiId].seedIds.push_back(i);
+	}
+
+	for( size_t r = 0; r < rois.size(); r++)
+	{
+		SegmentedImageType::IndexType start;
+		SegmentedImageType::IndexType end;
+		start.Fill( itk::NumericTraits< long>::max());
+		end.Fill( itk::NumericTraits< long>::min());
+		for( size_t k = 0; k < rois[r].seedIds.size(); k++)
+		{
+			itk::Index<3> &seed = somaCentroids[ rois[r].seedIds[k]];
+			for( int d = 0; d < Dim; d++)
+			{
+				start[d] = std::min( start[d], seed[d] - pad);
+				end[d] = std::max( end[d], seed[d] + pad + 1);
+			}
+		}
+		CheckBoundary( start, end, imageSize[0], imageSize[1], imageSize[2]);
+		ProbImageType::SizeType size;
+		for( int d = 0; d < Dim; d++)
+		{
+			size[d] = end[d] > start[d] ? end[d] - start[d] : 1;
+		}
+		rois[r].region.SetIndex( start);
+		rois[r].region.SetSize( size);
+	}
+
+	for( size_t r = 0; r < rois.size(); r++)
+	{
+		for( size_t q = r + 1; q < rois.size(); q++)
+		{
+			ProbImageType::RegionType intersection = rois[r].region;
+			if( intersection.Crop( rois[q].region))
+			{
+				rois[r].overlappingROIs.push_back(q);
+				rois[q].overlappingROIs.push_back(r);
+			}
+		}
+	}
+}
+
+/// Copy a region into a new image with zero start index. Only reads the input buffer,
+/// so it is safe to call from several threads on the same image.
+SomaExtractor::ProbImageType::Pointer SomaExtractor::CropImage( ProbImageType::Pointer image, ProbImageType::RegionType region)
+{
+	ProbImageType::RegionType localRegion;
+	ProbImageType::IndexType zero;
+	zero.Fill(0);
+	localRegion.SetIndex( zero);
+	localRegion.SetSize( region.GetSize());
+
+	ProbImageType::Pointer crop = ProbImageType::New();
+	crop->SetRegions( localRegion);
+	crop->Allocate();
+
+	ProbConstIteratorType inputIt( image, region);
+	ProbIteratorType outputIt( crop, localRegion);
+	for( inputIt.GoToBegin(), outputIt.GoToBegin(); !inputIt.IsAtEnd(); ++inputIt, ++outputIt)
+	{
+		outputIt.Set( inputIt.Get());
+	}
+	return crop;
+}
+
+SomaExtractor::SegmentedImageType::Pointer SomaExtractor::CropImage( SegmentedImageType::Pointer image, ProbImageType::RegionType region)
+{
+	SegmentedImageType::RegionType localRegion;
+	SegmentedImageType::IndexType zero;
+	zero.Fill(0);
+	localRegion.SetIndex( zero);
+	localRegion.SetSize( region.GetSize());
+
+	SegmentedImageType::Pointer crop = SegmentedImageType::New();
+	crop->SetRegions( localRegion);
+	crop->Allocate();
+
+	itk::ImageRegionConstIterator< SegmentedImageType> inputIt( image, region);
+	itk::ImageRegionIterator< SegmentedImageType> outputIt( crop, localRegion);
+	for( inputIt.GoToBegin(), outputIt.GoToBegin(); !inputIt.IsAtEnd(); ++inputIt, ++outputIt)
+	{
+		outputIt.Set( inputIt.Get());
+	}
+	return crop;
+}
+
+/// Run the fast marching initialization and the (sparse field) level set on one ROI.
+/// With an initial contour the gradient level set starts from its expanded distance map, as in the whole-image path.
+/// Filters are single threaded here; parallelism comes from running ROIs concurrently.
+SomaExtractor::ProbImageType::Pointer SomaExtractor::EvolveSomaROI( ProbImageType::Pointer featureImage, SegmentedImageType::Pointer initialContour, SomaROI &roi, std::vector< itk::Index<3> > &somaCentroids, bool useGradient)
+{
+	ProbImageType::Pointer roiImage = CropImage( featureImage, roi.region);
+	ProbImageType::IndexType roiStart = roi.region.GetIndex();
+
+	FastMarchingFilterType::Pointer fastMarching = FastMarchingFilterType::New();
+	NodeContainer::Pointer seeds = NodeContainer::New();
+	seeds->Initialize();
+	for( size_t i = 0; i < roi.seedIds.size(); i++)
+	{
+		ProbImageType::IndexType seedPosition;
+		for( int d = 0; d < Dim; d++)
+		{
+			seedPosition[d] = somaCentroids[ roi.seedIds[i]][d] - roiStart[d];
+		}
+		NodeType node;
+		node.SetValue( seedValue);
+		node.SetIndex( seedPosition);
+		seeds->InsertElement( i, node);
+	}
+	fastMarching->SetTrialPoints( seeds);
+	fastMarching->SetOutputSize( roi.region.GetSize());
+	fastMarching->SetStoppingValue( timethreshold);
+	fastMarching->SetSpeedConstant( 1.0);
+	fastMarching->SetNumberOfThreads(1);
+
+	if( !useGradient)
+	{
+		BinaryProbThresholdingFilterType::Pointer binaryFilterPointer = BinaryProbThresholdingFilterType::New();
+		binaryFilterPointer->SetInput( roiImage);
+		binaryFilterPointer->SetLowerThreshold(1);
+		binaryFilterPointer->SetInsideValue(1);
+		binaryFilterPointer->SetOutsideValue(0);
+		binaryFilterPointer->SetNumberOfThreads(1);
+
+		// local copy: the rerun loop must not change the shared parameter
+		double curvature = curvatureScaling;
+		ShapeDetectionFilterType::Pointer shapeDetection = ShapeDetectionFilterType::New();
+		shapeDetection->SetPropagationScaling(1.0);
+		shapeDetection->SetCurvatureScaling( curvature);
+		shapeDetection->SetMaximumRMSError( rmsThres);
+		shapeDetection->SetNumberOfIterations( maxIterations);
+		shapeDetection->SetInput( fastMarching->GetOutput());
+		shapeDetection->SetFeatureImage( binaryFilterPointer->GetOutput());
+		shapeDetection->SetNumberOfThreads(1);
+		shapeDetection->Update();
+
+		while( brerun == 1 && shapeDetection->GetElapsedIterations() >= maxIterations && curvature + 0.05 < 1)
+		{
+			curvature += 0.05;
+			shapeDetection->SetCurvatureScaling( curvature);
+			shapeDetection->Update();
+		}
+		return shapeDetection->GetOutput();
+	}
+
+	typedef itk::CurvatureAnisotropicDiffusionImageFilter<ProbImageType, ProbImageType> SmoothingFilterType;
+	typedef itk::SigmoidImageFilter<ProbImageType, ProbImageType> SigmoidFilterType;
+
+	SmoothingFilterType::Pointer smoothing = SmoothingFilterType::New();
+	smoothing->SetInput( roiImage);
+	smoothing->SetTimeStep( 0.0625);
+	smoothing->SetNumberOfIterations( smoothIteration);
+	smoothing->SetConductanceParameter( conductance);
+	smoothing->SetNumberOfThreads(1);
+
+	GradientFilterType::Pointer gradientMagnitude = GradientFilterType::New();
+	gradientMagnitude->SetInput( smoothing->GetOutput());
+	gradientMagnitude->SetSigma( sigma);
+	gradientMagnitude->SetNumberOfThreads(1);
+
+	SigmoidFilterType::Pointer sigmoid = SigmoidFilterType::New();
+	sigmoid->SetAlpha( alfa);
+	sigmoid->SetBeta( beta);
+	sigmoid->SetOutputMinimum( 0.0);
+	sigmoid->SetOutputMaximum( 1.0);
+	sigmoid->SetInput( gradientMagnitude->GetOutput());
+	sigmoid->SetNumberOfThreads(1);
+
+	GeodesicActiveContourFilterType::Pointer GVF_snake = GeodesicActiveContourFilterType::New();
+	if( initialContour)
+	{
+		GVF_snake->SetInput( GetInitalContourByDistanceMap( CropImage( initialContour, roi.region), outlierExpandValue, 1));
+	}
+	else
+	{
+		GVF_snake->SetInput( fastMarching->GetOutput());
+	}
+	GVF_snake->SetFeatureImage( sigmoid->GetOutput());
+	GVF_snake->SetPropagationScaling( 1.0);
+	GVF_snake->SetCurvatureScaling( curvatureScaling);
+	GVF_snake->SetAdvectionScaling( advectScaling);
+	GVF_snake->SetMaximumRMSError( rmsThres);
+	GVF_snake->SetNumberOfIterations( maxIterations);
+	GVF_snake->SetNumberOfThreads(1);
+	GVF_snake->Update();
+	return GVF_snake->GetOutput();
+}
+
+/// Write the inside (phi <= 0) of one ROI into the full binary image. A voxel covered by
+/// several ROIs belongs to the ROI with the nearest seed (ties go to the lower ROI id), so
+/// concurrent ROIs never write the same voxel.
+void SomaExtractor::PasteSomaROI( ProbImageType::Pointer levelSet, int roiId, std::vector< SomaROI> &rois, std::vector< itk::Index<3> > &somaCentroids, SegmentedImageType::Pointer binaryImage)
+{
+	SomaROI &roi = rois[roiId];
+	ProbImageType::IndexType roiStart = roi.region.GetIndex();
+	ProbConstIteratorType levelSetIt( levelSet, levelSet->GetLargestPossibleRegion());
+
+	for( levelSetIt.GoToBegin(); !levelSetIt.IsAtEnd(); ++levelSetIt)
+	{
+		if( levelSetIt.Get() > 0)
+		{
+			continue;
+		}
+		SegmentedImageType::IndexType index = levelSetIt.GetIndex();
+		for( int d = 0; d < Dim; d++)
+		{
+			index[d] += roiStart[d];
+		}
+
+		bool owner = true;
+		if( roi.overlappingROIs.size() > 0)
+		{
+			long ownDist = itk::NumericTraits< long>::max();
+			for( size_t k = 0; k < roi.seedIds.size(); k++)
+			{
+				itk::Index<3> &seed = somaCentroids[ roi.seedIds[k]];
+				long dist = 0;
+				for( int d = 0; d < Dim; d++)
+				{
+					dist += (index[d] - seed[d]) * (index[d] - seed[d]);
+				}
+				ownDist = std::min( ownDist, dist);
+			}
+			for( size_t q = 0; q < roi.overlappingROIs.size() && owner; q++)
+			{
+				SomaROI &other = rois[ roi.overlappingROIs[q]];
+				if( !other.region.IsInside( index))
+				{
+					continue;
+				}
+				for( size_t k = 0; k < other.seedIds.size(); k++)
+				{
+					itk::Index<3> &seed = somaCentroids[ other.seedIds[k]];
+					long dist = 0;
+					for( int d = 0; d < Dim; d++)
+					{
+						dist += (index[d] - seed[d]) * (index[d] - seed[d]);
+					}
+					if( dist < ownDist || (dist == ownDist && roi.overlappingROIs[q] < roiId))
+					{
+						owner = false;
+						break;
+					}
+				}
+			}
+		}
+		if( owner)
+		{
+			binaryImage->SetPixel( index, 255);
+		}
+	}
+}
 
+/// Label the binary soma image, drop small objects and recompute the centroids
+SomaExtractor::SegmentedImageType::Pointer SomaExtractor::LabelSomas( SegmentedImageType::Pointer binaryImage, std::vector< itk::Index<3> > &somaCentroids)
+{
 	LabelFilterType::Pointer label = LabelFilterType::New();
-	label->SetInput(thresholder->GetOutput());
+	label->SetInput( binaryImage);
 
 	RelabelFilterType::Pointer relabel = RelabelFilterType::New();
 	relabel->SetInput( label->GetOutput());
 	relabel->SetMinimumObjectSize( minObjSize);  
-
 	relabel->Update();
 	SegmentedImageType::Pointer somas = relabel->GetOutput();
 
+	GetLabelCentroids( somas, somaCentroids);
+	return somas;
+}
+
+void SomaExtractor::GetLabelCentroids( SegmentedImageType::Pointer labelImage, std::vector< itk::Index<3> > &centroids)
+{
 	LabelGeometryImageFilterType::Pointer labelGeometryImageFilter = LabelGeometryImageFilterType::New();
-	labelGeometryImageFilter->SetInput( somas);
+	labelGeometryImageFilter->SetInput( labelImage);
 	labelGeometryImageFilter->CalculatePixelIndicesOff();
 	labelGeometryImageFilter->CalculateOrientedBoundingBoxOff();
 	labelGeometryImageFilter->CalculateOrientedLabelRegionsOff();
@@ -1294,19 +1641,74 @@ SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentSomaUsingGradie
 	LabelGeometryImageFilterType::LabelsType allLabels = labelGeometryImageFilter->GetLabels();
 	LabelGeometryImageFilterType::LabelsType::iterator allLabelsIt =  allLabels.begin();
 
-	somaCentroids.clear();
+	centroids.clear();
 	for( allLabelsIt++; allLabelsIt != allLabels.end(); allLabelsIt++ )
 	{
 		LabelGeometryImageFilterType::LabelPixelType labelValue = *allLabelsIt;
-		vtkSmartPointer<vtkVariantArray> row = vtkSmartPointer<vtkVariantArray>::New();
 		LabelGeometryImageFilterType::LabelPointType point = labelGeometryImageFilter->GetCentroid(labelValue);
 		itk::Index<3> index;
 		index[0] = point[0];
 		index[1] = point[1];
 		index[2] = point[2];
-		somaCentroids.push_back(index);
+		centroids.push_back(index);
 	}
-	return somas;
+}
+
+// ROI mode of SegmentSoma / SegmentSomaUsingGradient:
+// int roiRadius, padding around each seed (the centroids of the initial contour objects when there are no seeds)
+// int numThreads, concurrent ROIs (0 = OpenMP default)
+SomaExtractor::SegmentedImageType::Pointer SomaExtractor::SegmentSomaInROIs( std::vector< itk::Index<3> > &somaCentroids, ProbImageType::Pointer featureImage, SegmentedImageType::Pointer initialContour, bool useGradient)
+{
+	ProbImageType::RegionType imageRegion = featureImage->GetLargestPossibleRegion();
+	if( somaCentroids.size() == 0 && initialContour)
+	{
+		// the ROIs are placed around the objects of the initial contour
+		GetLabelCentroids( initialContour, somaCentroids);
+	}
+	std::vector< SomaROI> rois;
+	GroupSeedsIntoROIs( somaCentroids, imageRegion, roiRadius, rois);
+	std::cout<< "Seed Size "<< somaCentroids.size()<< ", ROI groups "<< rois.size()<<std::endl;
+
+	SegmentedImageType::Pointer binaryImage = SegmentedImageType::New();
+	binaryImage->SetRegions( imageRegion);
+	binaryImage->Allocate();
+	binaryImage->FillBuffer(0);
+
+	int threads = numThreads > 0 ? numThreads : 1;
+#ifdef _OPENMP
+	if( numThreads <= 0)
+	{
+		threads = omp_get_max_threads();
+	}
+#endif
+
+	// largest ROIs first so the long ones do not finish last
+	std::vector< std::pair< unsigned long, int> > order;
+	for( size_t r = 0; r < rois.size(); r++)
+	{
+		order.push_back( std::make_pair( rois[r].region.GetNumberOfPixels(), (int)r));
+	}
+	std::sort( order.rbegin(), order.rend());
+
+	int numROIs = order.size();
+	#pragma omp parallel for schedule(dynamic) num_threads(threads)
+	for( int i = 0; i < numROIs; i++)
+	{
+		int r = order[i].second;
+		try
+		{
+			ProbImageType::Pointer levelSet = EvolveSomaROI( featureImage, initialContour, rois[r], somaCentroids, useGradient);
+			PasteSomaROI( levelSet, r, rois, somaCentroids, binaryImage);
+		}
+		catch( itk::ExceptionObject &err)
+		{
+			#pragma omp critical
+			std::cerr << "Error in soma ROI " << r << ": " << err << std::endl;
+		}
+	}
+
+	std::cout<< "Thresholding..."<<endl;
+	return LabelSomas( binaryImage, somaCentroids);
 }
 
 //// write the x component of gvf
@@ -2345,6 +2747,225 @@ void SomaExtractor::ShrinkPixel(ProbImageType2D::Pointer image, int border)
 	}
 }
 
+SomaExtractor::UShortImageType::Pointer SomaExtractor::ReadSlab(const char *fileName, ProbImageType::RegionType region)
+{
+	ushortImageReader::Pointer reader = ushortImageReader::New();
+	reader->SetFileName(fileName);
+	reader->GetOutput()->SetRequestedRegion(region);
+	reader->Update();
+	return reader->GetOutput();
+}
+
+// Flat-field normalization in two slab-wise passes over the file, so only slabDepth
+// slices of the input are resident at a time:
+// pass 1 accumulates the z projection and the global mean, the background is the
+//        Gaussian smoothed average projection (same as GetBackgroundImage);
+// pass 2 divides by the background, rescales to the original mean (same as
+//        DevideAndScaleToOriginalMean) and writes unsigned short slabs.
+// The mean after division is known from the projection alone: sum_z I/B = S/B.
+// The slab is located inside the buffered region of the reader, since an ImageIO
+// that cannot stream (e.g. TIFF) reads the whole volume for every slab; the input
+// is then only bounded by the reader, not by slabDepth.
+// The output is streamed when its ImageIO supports it (e.g. .mhd), otherwise a full
+// unsigned short volume is kept in memory and written once.
+bool SomaExtractor::NormalizeByBackgroundStreaming(const char *inputFileName, const char *outputFileName, double sigma, unsigned int slabDepth)
+{
+	ushortImageReader::Pointer infoReader = ushortImageReader::New();
+	infoReader->SetFileName(inputFileName);
+	try
+	{
+		infoReader->UpdateOutputInformation();
+	}
+	catch( itk::ExceptionObject &err)
+	{
+		std::cout << "Error in reading "<< inputFileName<< ": " << err << std::endl; 
+		return false;
+	}
+	UShortImageType::RegionType imageRegion = infoReader->GetOutput()->GetLargestPossibleRegion();
+	UShortImageType::IndexType imageStart = imageRegion.GetIndex();
+	const long long w = imageRegion.GetSize()[0];
+	const long long h = imageRegion.GetSize()[1];
+	const long long d = imageRegion.GetSize()[2];
+	const long long plane = w * h;
+	if( slabDepth < 1)
+	{
+		slabDepth = 1;
+	}
+
+	std::cout<< "Background projection."<<std::endl;
+	std::vector< double> projection( plane, 0);
+	double totalSum = 0;
+	for( long long z0 = 0; z0 < d; z0 += slabDepth)
+	{
+		long long nz = std::min( (long long)slabDepth, d - z0);
+		ProbImageType::RegionType slabRegion = imageRegion;
+		slabRegion.SetIndex(2, imageStart[2] + z0);
+		slabRegion.SetSize(2, nz);
+		UShortImageType::Pointer slab = ReadSlab(inputFileName, slabRegion);
+		// IOs that cannot stream (e.g. TIFF) buffer more than the slab
+		const unsigned short *buffer = slab->GetBufferPointer() + slab->ComputeOffset(slabRegion.GetIndex());
+
+		double slabSum = 0;
+		#pragma omp parallel for reduction(+:slabSum)
+		for( long long p = 0; p < plane; p++)
+		{
+			double sum = 0;
+			for( long long z = 0; z < nz; z++)
+			{
+				sum += buffer[z * plane + p];
+			}
+			projection[p] += sum;
+			slabSum += sum;
+		}
+		totalSum += slabSum;
+	}
+
+	ProbImageType2D::Pointer averageImage = ProbImageType2D::New();
+	ProbImageType2D::RegionType planeRegion;
+	ProbImageType2D::IndexType planeStart;
+	planeStart[0] = imageStart[0];
+	planeStart[1] = imageStart[1];
+	ProbImageType2D::SizeType planeSize;
+	planeSize[0] = w;
+	planeSize[1] = h;
+	planeRegion.SetIndex(planeStart);
+	planeRegion.SetSize(planeSize);
+	averageImage->SetRegions(planeRegion);
+	averageImage->Allocate();
+	float *average = averageImage->GetBufferPointer();
+	for( long long p = 0; p < plane; p++)
+	{
+		average[p] = projection[p] / d;
+	}
+
+	std::cout<< "DiscreteGaussianImageFilter."<<std::endl;
+	typedef itk::DiscreteGaussianImageFilter< ProbImageType2D, ProbImageType2D >  GaussinafilterType;
+	GaussinafilterType::Pointer gaussianFilter = GaussinafilterType::New();
+	gaussianFilter->SetInput( averageImage);
+	gaussianFilter->SetVariance(sigma);
+	try
+	{
+		gaussianFilter->Update();
+	}
+	catch( itk::ExceptionObject &err)
+	{
+		std::cout << "Error in DiscreteGaussianImageFilter: " << err << std::endl; 
+		return false;
+	}
+	const float *background = gaussianFilter->GetOutput()->GetBufferPointer();
+
+	// out = in * gain[p] + offset[p]; pixels with no background become 1 as in DevideAndScale
+	double dividedSum = 0;
+	for( long long p = 0; p < plane; p++)
+	{
+		dividedSum += background[p] > 0 ? projection[p] / background[p] : d;
+	}
+	double mean1 = totalSum / (plane * d);
+	double mean2 = dividedSum / (plane * d);
+	double scale = mean2 > 0 ? mean1 / mean2 : 1;
+	std::cout<< "Pre Mean: "<< mean1<< "\tMean: "<< mean2<<std::endl;
+	std::cout<< "Multiply by "<< scale<<std::endl;
+
+	std::vector< float> gain( plane);
+	std::vector< float> offset( plane);
+	for( long long p = 0; p < plane; p++)
+	{
+		gain[p] = background[p] > 0 ? scale / background[p] : 0;
+		offset[p] = background[p] > 0 ? 0 : scale;
+	}
+	std::vector< double>().swap(projection);
+
+	ushortImageWriter::Pointer writer = ushortImageWriter::New();
+	writer->SetFileName(outputFileName);
+	itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO( outputFileName, itk::ImageIOFactory::WriteMode);
+	bool streamWrite = imageIO && imageIO->CanStreamWrite();
+	writer->SetImageIO(imageIO);
+
+	UShortImageType::Pointer outputImage;
+	if( !streamWrite)
+	{
+		outputImage = UShortImageType::New();
+		outputImage->SetRegions(imageRegion);
+		outputImage->CopyInformation(infoReader->GetOutput());
+		outputImage->Allocate();
+	}
+
+	std::cout<< "Devide Image."<<std::endl;
+	for( long long z0 = 0; z0 < d; z0 += slabDepth)
+	{
+		long long nz = std::min( (long long)slabDepth, d - z0);
+		ProbImageType::RegionType slabRegion = imageRegion;
+		slabRegion.SetIndex(2, imageStart[2] + z0);
+		slabRegion.SetSize(2, nz);
+		UShortImageType::Pointer slab = ReadSlab(inputFileName, slabRegion);
+		const long long slabOffset = slab->ComputeOffset(slabRegion.GetIndex());
+		const unsigned short *in = slab->GetBufferPointer() + slabOffset;
+
+		UShortImageType::Pointer outSlab = slab;
+		unsigned short *out;
+		if( streamWrite)
+		{
+			// divide in place, the slab buffer is ours
+			out = slab->GetBufferPointer() + slabOffset;
+		}
+		else
+		{
+			out = outputImage->GetBufferPointer() + z0 * plane;
+		}
+
+		const float *g = &gain[0];
+		const float *o = &offset[0];
+		#pragma omp parallel for
+		for( long long z = 0; z < nz; z++)
+		{
+			const unsigned short *inRow = in + z * plane;
+			unsigned short *outRow = out + z * plane;
+			for( long long p = 0; p < plane; p++)
+			{
+				float val = inRow[p] * g[p] + o[p];
+				val = val < 0 ? 0 : val;
+				val = val > 65535 ? 65535 : val;
+				outRow[p] = (unsigned short)val;
+			}
+		}
+
+		if( streamWrite)
+		{
+			// slab buffered inside the full extent, pasted into the output file
+			outSlab->SetLargestPossibleRegion(imageRegion);
+			outSlab->SetRequestedRegion(slabRegion);
+			writer->SetInput(outSlab);
+			itk::ImageIORegion ioRegion(3);
+			itk::ImageIORegionAdaptor<3>::Convert(slabRegion, ioRegion, imageStart);
+			writer->SetIORegion(ioRegion);
+			try
+			{
+				writer->Update();
+			}
+			catch( itk::ExceptionObject &err)
+			{
+				std::cout << "Error in writing "<< outputFileName<< ": " << err << std::endl; 
+				return false;
+			}
+		}
+	}
+
+	if( !streamWrite)
+	{
+		writer->SetInput(outputImage);
+		try
+		{
+			writer->Update();
+		}
+		catch( itk::ExceptionObject &err)
+		{
+			std::cout << "Error in writing "<< outputFileName<< ": " << err << std::endl; 
+			return false;
+		}
+	}
+	return true;
+}
+
 void SomaExtractor::NormalizeUsingBackgroundImage(ProbImageType2D::Pointer image, ProbImageType2D::Pointer backgroundimage, double sigma)
 {
 	StatisticsImageFilterType2D::Pointer statisticsImageFilter = StatisticsImageFilterType2D::New();
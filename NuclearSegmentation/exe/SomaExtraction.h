@@ -152,6 +152,8 @@ public:
 	/// return labeled image for somas
 	SegmentedImageType::Pointer SegmentSoma( std::vector< itk::Index<3> > &somaCentroids, ProbImageType::Pointer binImagePtr);
 	SegmentedImageType::Pointer SegmentSomaUsingGradient( ProbImageType::Pointer input, SegmentedImageType::Pointer initialContour, std::vector< itk::Index<3> > &somaCentroids);
+	/// ROI mode (-roi_radius > 0): level sets evolve only in padded regions around groups of seeds, concurrently
+	SegmentedImageType::Pointer SegmentSomaInROIs( std::vector< itk::Index<3> > &somaCentroids, ProbImageType::Pointer featureImage, SegmentedImageType::Pointer initialContour, bool useGradient);
 	SegmentedImageType::Pointer SegmentHeart(const char *imageName, const char *fileName, ProbImageType::Pointer inputImage, vnl_vector<int> &seperator, vnl_vector<double> &curvature);
 
 	ProbImageType::Pointer OtsuThresholdImage(OutputImageType::Pointer image);
@@ -180,22 +182,39 @@ public:
 	UShortImageType::Pointer RescaleImage(ProbImageType::Pointer image, double globalMax, double intensityMax);
 	ProbImageType2D::Pointer adjustMeanStd(ProbImageType2D::Pointer image, double globalMean, double globalStd);
 	void NormalizeUsingBackgroundImage(ProbImageType2D::Pointer image, ProbImageType2D::Pointer backgroundimage, double sigma);
+	/// streaming flat-field normalization: background = smoothed average projection, output = input / background scaled to the original mean
+	bool NormalizeByBackgroundStreaming(const char *inputFileName, const char *outputFileName, double sigma, unsigned int slabDepth = 16);
 	void writeUnshort2D(const char *fileName, UShortImageType2D::Pointer image);
 	void GetSeedpointsInRegion(std::vector< itk::Index<3> > &seedVec, std::vector< itk::Index<3> > &seedInRegion, int startX, int startY, int width, int height);
 	void CaculateMeanStd(std::string fileName, ProbImageType::Pointer image);
 	ProbImageType::Pointer diffusionsmoothing(ProbImageType::Pointer image);
 
 protected:
+	struct SomaROI
+	{
+		ProbImageType::RegionType region;
+		std::vector< int> seedIds;
+		std::vector< int> overlappingROIs;
+	};
+
 	template <class T> bool SetParamValue(std::map<std::string,std::string> &opts, std::string str, T &value, T defVal);
 	void SomaBoundaryScan(SegmentedImageType::Pointer labelImage, std::map< TLPixel, int> &LtoIMap, std::vector< int> &boundaryPixSize);
 	ProbImageType::Pointer GetEdgePotentialMap(ProbImageType::Pointer inputImage, double sigma);
-	ProbImageType::Pointer GetInitalContourByDistanceMap(SegmentedImageType::Pointer labelImage, double outlierExpand);
+	ProbImageType::Pointer GetInitalContourByDistanceMap(SegmentedImageType::Pointer labelImage, double outlierExpand, int numberOfThreads = 0);
 	void CheckBoundary(SegmentedImageType::IndexType &start, SegmentedImageType::IndexType &end, int SX, int SY, int SZ); 
 	ProbImageType::Pointer EnhanceContrast( ProbImageType::Pointer inputImage, int sliceNum, double alfa, double beta, double &threshold);
 	ProbImageType::Pointer EnhanceContrast( ProbImageType::Pointer inputImage, double alfa, double beta, double radius);
 	void ShrinkPixel(ProbImageType2D::Pointer image, int border);
 	ProbImageType2D::Pointer ExtractSlice(ProbImageType::Pointer image, int sliceId);
 	ProbImageType::Pointer RemoveImageBorderByPixel(ProbImageType::Pointer image, int border);
+	UShortImageType::Pointer ReadSlab(const char *fileName, ProbImageType::RegionType region);
+	void GroupSeedsIntoROIs( std::vector< itk::Index<3> > &somaCentroids, ProbImageType::RegionType imageRegion, int pad, std::vector< SomaROI> &rois);
+	ProbImageType::Pointer CropImage( ProbImageType::Pointer image, ProbImageType::RegionType region);
+	SegmentedImageType::Pointer CropImage( SegmentedImageType::Pointer image, ProbImageType::RegionType region);
+	ProbImageType::Pointer EvolveSomaROI( ProbImageType::Pointer featureImage, SegmentedImageType::Pointer initialContour, SomaROI &roi, std::vector< itk::Index<3> > &somaCentroids, bool useGradient);
+	void PasteSomaROI( ProbImageType::Pointer levelSet, int roiId, std::vector< SomaROI> &rois, std::vector< itk::Index<3> > &somaCentroids, SegmentedImageType::Pointer binaryImage);
+	SegmentedImageType::Pointer LabelSomas( SegmentedImageType::Pointer binaryImage, std::vector< itk::Index<3> > &somaCentroids);
+	void GetLabelCentroids( SegmentedImageType::Pointer labelImage, std::vector< itk::Index<3> > &centroids);
 
 private:
 	//ProbImageType::Pointer inputImage;
@@ -243,6 +262,9 @@ private:
 	int sampling_ratio_XY_to_Z;
 	int radius;
 	int brerun;
+	// ROI mode
+	int roiRadius;
+	int numThreads;
 };
 
 #endif
@@ -37,6 +37,145 @@
 namespace ftk 
 {
 
+namespace
+{
+//*****************************************************************************
+// Label edits on a box of the label image. Each kernel is run through
+// RunOnLabelType with the pixel type of the label image, so the edits work
+// directly on the image memory whatever type the labels were loaded as.
+//*****************************************************************************
+struct LabelBox
+{
+	long x1, y1, z1, x2, y2, z2;	//inclusive
+	LabelBox(long x1, long y1, long z1, long x2, long y2, long z2) : x1(x1), y1(y1), z1(z1), x2(x2), y2(y2), z2(z2) {}
+};
+
+//Every pixel with one of the ids in from becomes to
+struct ReplaceLabelsKernel
+{
+	int t;
+	LabelBox box;
+	std::vector<int> from;
+	int to;
+	ReplaceLabelsKernel(int t, LabelBox box, const std::vector<int> & from, int to) : t(t), box(box), from(from), to(to) {}
+
+	template <typename TLabel> void Run(ftk::Image * image)
+	{
+		ImageRegionView<TLabel> view = image->GetRegionView<TLabel>(t,0,box.x1,box.y1,box.z1,box.x2,box.y2,box.z2);	// Fix for channels
+		if(!view.IsValid())
+			return;
+		std::vector<TLabel> ids;
+		for(int i = 0; i < (int)from.size(); ++i)
+			ids.push_back( (TLabel)from.at(i) );
+		view.Replace(ids, (TLabel)to);
+	}
+};
+
+//Pixels of objID become newID1 where they are farther from the first seed, newID2 otherwise.
+//The distance maps are sizeX x sizeY slices starting at the box origin.
+struct SplitByDistanceKernel
+{
+	LabelBox box;
+	const float * dist1;
+	const float * dist2;
+	int sizeX, sizeY;
+	int objID, newID1, newID2;
+	SplitByDistanceKernel(LabelBox box, const float * dist1, const float * dist2, int sizeX, int sizeY, int objID, int newID1, int newID2)
+		: box(box), dist1(dist1), dist2(dist2), sizeX(sizeX), sizeY(sizeY), objID(objID), newID1(newID1), newID2(newID2) {}
+
+	template <typename TLabel> void Run(ftk::Image * image)
+	{
+		ImageRegionView<TLabel> view = image->GetRegionView<TLabel>(0,0,box.x1,box.y1,box.z1,box.x2,box.y2,box.z2);
+		for(int k=0; k<(int)view.SizeZ(); k++)
+		{
+			for(int i=0; i<(int)view.SizeY(); i++)
+			{
+				TLabel * row = view.GetRow(i,k);
+				int offset = (k*sizeY + i)*sizeX;
+				for(int j=0; j<(int)view.SizeX(); j++)
+				{
+					if(row[j] != (TLabel)objID)
+						continue;
+					int d1 = (int) fabs(dist1[offset+j]);
+					int d2 = (int) fabs(dist2[offset+j]);
+					if(d1>d2)
+						row[j] = (TLabel)newID1;
+					else
+						row[j] = (TLabel)newID2;
+				}
+			}
+		}
+	}
+};
+
+//Copies objID as 255 (and everything else as 0) into mask, a dense image of the box; with paste set,
+//the mask is written back instead: nonzero mask pixels over background become objID
+struct ObjectMaskKernel
+{
+	LabelBox box;
+	int objID;
+	unsigned short * mask;
+	bool paste;
+	ObjectMaskKernel(LabelBox box, int objID, unsigned short * mask, bool paste) : box(box), objID(objID), mask(mask), paste(paste) {}
+
+	template <typename TLabel> void Run(ftk::Image * image)
+	{
+		ImageRegionView<TLabel> view = image->GetRegionView<TLabel>(0,0,box.x1,box.y1,box.z1,box.x2,box.y2,box.z2);
+		unsigned short * m = mask;
+		for(int k=0; k<(int)view.SizeZ(); k++)
+		{
+			for(int i=0; i<(int)view.SizeY(); i++)
+			{
+				TLabel * row = view.GetRow(i,k);
+				for(int j=0; j<(int)view.SizeX(); j++, m++)
+				{
+					if(!paste)
+						*m = (row[j] == (TLabel)objID) ? 255 : 0;
+					else if(row[j] == 0 && *m > 0) //just copy pixels that were zeros
+						row[j] = (TLabel)objID;
+				}
+			}
+		}
+	}
+};
+
+//Runs kernel.Run<T>() with T the pixel type of the label image, false if labels cannot have that type
+template <typename TKernel> bool RunOnLabelType(ftk::Image * image, TKernel & kernel)
+{
+	switch(image->GetImageInfo()->dataType)
+	{
+		case itk::ImageIOBase::CHAR:
+			kernel.template Run<char>(image);
+		break;
+		case itk::ImageIOBase::UCHAR:
+			kernel.template Run<unsigned char>(image);
+		break;
+		case itk::ImageIOBase::SHORT:
+			kernel.template Run<short>(image);
+		break;
+		case itk::ImageIOBase::USHORT:
+			kernel.template Run<unsigned short>(image);
+		break;
+		case itk::ImageIOBase::INT:
+			kernel.template Run<int>(image);
+		break;
+		case itk::ImageIOBase::UINT:
+			kernel.template Run<unsigned int>(image);
+		break;
+		case itk::ImageIOBase::LONG:
+			kernel.template Run<long>(image);
+		break;
+		case itk::ImageIOBase::ULONG:
+			kernel.template Run<unsigned long>(image);
+		break;
+		default:
+			//Floating point labels are not supported
+			return false;
+	}
+	return true;
+}
+}
+
 //Constructor
 NuclearSegmentation::NuclearSegmentation()
 {
@@ -56,6 +195,9 @@ NuclearSegmentation::NuclearSegmentation()
 	paramNames.push_back("refinement_range");
 	paramNames.push_back("min_object_size");
 	currentTime = 0;
+
+	adjacencyIndex.SetKeyColumns(0,1);
+	editDepth = 0;
 }
 
 NuclearSegmentation::~NuclearSegmentation()
@@ -1102,29 +1244,16 @@ void NuclearSegmentation::ReassignLabels(vector<int> fromIds, int toId)
 		region.max.t = 0;
 	}
 
-	for(int z = region.min.z; z <= region.max.z; ++z)
-	{
-		for(int r=region.min.y; r <= region.max.y; ++r)
-		{
-			for(int c=region.min.x; c <= region.max.x; ++c)
-			{
-				int pix = (int)labelImage->GetPixel(region.min.t,0,z,r,c); // Fix for channels
-				for(int i = 0; i < (int)fromIds.size(); ++i)
-				{
-					if( pix == fromIds.at(i) )
-					{
-						labelImage->SetPixel(region.min.t,0,z,r,c,toId);  // Fix for channels
-					}
-				}
-			}
-		}
-	}
+	ReplaceLabelsKernel replace(region.min.t, LabelBox(region.min.x,region.min.y,region.min.z,region.max.x,region.max.y,region.max.z), fromIds, toId);
+	if(!RunOnLabelType(labelImage, replace))
+		errorMessage = "label image data type is not supported";
 }
 void NuclearSegmentation::ReassignLabels(std::vector<int> times, std::vector<int> ids, std::vector<int> new_ids)
 {
 	int C = labelImage->Size()[3];
 	int R = labelImage->Size()[2];
 	int Z = labelImage->Size()[1];
+	std::map<int, TableRowIndex> timeIndex;		//Index each time point's table once for all of its ids
 	for(int i=0 ; i<times.size();++i) // maybe later add check of vector sizes  
 	{
 		int time = times.at(i);
@@ -1138,17 +1267,11 @@ void NuclearSegmentation::ReassignLabels(std::vector<int> times, std::vector<int
 		if(region.max.x >= C) region.max.x = C-1;
 		if(region.max.y >= R) region.max.y = R-1;
 		if(region.max.z >= Z) region.max.z = Z-1;
-		for(int z = region.min.z; z <= region.max.z; ++z)
+		ReplaceLabelsKernel replace(time, LabelBox(region.min.x,region.min.y,region.min.z,region.max.x,region.max.y,region.max.z), std::vector<int>(1,id), new_id);
+		if(!RunOnLabelType(labelImage, replace))
 		{
-			for(int r=region.min.y; r <= region.max.y; ++r)
-			{
-				for(int c=region.min.x; c <= region.max.x; ++c)
-				{
-					int pix = (int)labelImage->GetPixel(time,0,z,r,c); // Fix for channels
-					if( pix == id )
-						labelImage->SetPixel(time,0,z,r,c,new_id);  // Fix for channels
-				}
-			}
+			errorMessage = "label image data type is not supported";
+			return;
 		}
 
 		// Update bBoxMap and cMap ids:
@@ -1158,14 +1281,11 @@ void NuclearSegmentation::ReassignLabels(std::vector<int> times, std::vector<int
 		centerMap4DImage.at(time).erase( id );		
 		centerMap4DImage.at(time)[new_id] = point;
 		// Update Table:
-		for(int row = 0; row<table4DImage.at(time)->GetNumberOfRows(); ++row)
-		{
-			if(table4DImage.at(time)->GetValue(row,0) == id)
-			{
-				table4DImage.at(time)->SetValue(row,0,new_id);
-				break;
-			}
-		}
+		TableRowIndex & index = timeIndex[time];
+		index.Attach(table4DImage.at(time));
+		vtkIdType row = index.FindRow(id);
+		if(row != -1)
+			index.SetKey(row,0,new_id);
 
 	}
 	centerMap = centerMap4DImage.at(currentTime);
@@ -1302,19 +1422,6 @@ std::vector< int > NuclearSegmentation::Split(ftk::Object::Point P1, ftk::Object
 	}
 		
 	int objID = id1;		//The ID of the object I am splitting!!
-
-	//Remove the corresponding rows from the Nuclear Adjacency table
-	if(NucAdjTable)
-	{
-		for(int row=0; row<(int)NucAdjTable->GetNumberOfRows(); ++row)
-		{
-			if((NucAdjTable->GetValue(row,0).ToInt()==objID)||(NucAdjTable->GetValue(row,1).ToInt()==objID))
-			{
-				NucAdjTable->RemoveRow(row);
-				--row;
-			}
-		}
-	}
 	
 	//Update the segmentation image
 	//Now get the bounding box around the object
@@ -1421,28 +1528,20 @@ std::vector< int > NuclearSegmentation::Split(ftk::Object::Point P1, ftk::Object
 	int max_id = maxID();		
 	int newID1 = ++max_id;		
 	int newID2 = ++max_id;
-	IteratorType iterator3(dt_obj1->GetOutput(),dt_obj1->GetOutput()->GetRequestedRegion());
-	IteratorType iterator4(dt_obj2->GetOutput(),dt_obj2->GetOutput()->GetRequestedRegion());	
-	for(int k=region.min.z; k<=region.max.z; k++)
+	//The distance maps have the size of the bounding box, so they are walked in step with the box rows
+	SplitByDistanceKernel split(LabelBox(region.min.x,region.min.y,region.min.z,region.max.x,region.max.y,region.max.z),
+		dt_obj1->GetOutput()->GetBufferPointer(), dt_obj2->GetOutput()->GetBufferPointer(), sz[0], sz[1], objID, newID1, newID2);
+	if(!RunOnLabelType(labelImage, split))
 	{
-		for(int i=region.min.y; i<=region.max.y; i++)
-		{			
-			for(int j=region.min.x; j<=region.max.x; j++)
-			{
-				int d1 = (int) fabs(iterator3.Get());	 
-				int d2 = (int) fabs(iterator4.Get());	
-				++iterator3;
-				++iterator4;
-				int pix = (int)labelImage->GetPixel(0,0,k,i,j);
-				if(pix != objID)
-					continue;
-				if(d1>d2)
-					labelImage->SetPixel(0,0,k,i,j,newID1);
-				else
-					labelImage->SetPixel(0,0,k,i,j,newID2);
-			}
-		}
-	}	
+		errorMessage = "label image data type is not supported";
+		return ret_ids;
+	}
+
+	this->BeginEdit();
+	//Remove the corresponding rows from the Nuclear Adjacency table
+	std::set<int> old_ids;
+	old_ids.insert(objID);
+	this->removeObjectsFromAdjacency(old_ids, NucAdjTable);
 
 	std::set<unsigned short> add_ids;
 	add_ids.insert((unsigned short)newID1);
@@ -1450,6 +1549,7 @@ std::vector< int > NuclearSegmentation::Split(ftk::Object::Point P1, ftk::Object
 	//Add features for the two new objects
 	this->addObjectsToMaps(add_ids, region.min.x, region.min.y, region.min.z, region.max.x, region.max.y, region.max.z, table, NucAdjTable);
 	this->removeObjectFromMaps(objID, table);
+	this->EndEdit();
 	EditsNotSaved = true;
 
 	ret_ids.push_back(objID);
@@ -1467,11 +1567,7 @@ std::vector< std::vector<int> > NuclearSegmentation::BatchSplit(std::vector<int>
 		return std::vector< std::vector<int> >(0);
 	}
 
-	std::map<int,int> idToIndexMap;
-	for(int row=0; row<(int)table->GetNumberOfRows(); ++row)
-	{
-		idToIndexMap[table->GetValue(row,0).ToInt()] = row;
-	}
+	tableIndex.Attach(table);
 
 	itk::Size<3> sz;
 	sz[0] = dataImage->GetImageInfo()->numColumns;
@@ -1493,7 +1589,11 @@ std::vector< std::vector<int> > NuclearSegmentation::BatchSplit(std::vector<int>
 	for(int i=0; i<ids.size(); ++i)
 	{
 		groups[i].push_back(ids[i]);
-		int volume_ID = table->GetValueByName(idToIndexMap[ids[i]], "volume").ToInt();
+		vtkIdType row = tableIndex.FindRow(ids[i]);
+		ftk::IntrinsicFeatures * features = labFilter->GetFeatures(ids[i]);
+		if(row == -1 || !features)
+			continue;			//not in the table or the label image: left as it is
+		int volume_ID = table->GetValueByName(row, "volume").ToInt();
 		double estimatedScale;
 		if(dataImage->GetImageInfo()->numZSlices > 1)
 		{
@@ -1505,7 +1605,6 @@ std::vector< std::vector<int> > NuclearSegmentation::BatchSplit(std::vector<int>
 		}
 
 		int	deltaScale = 5;
-		ftk::IntrinsicFeatures * features = labFilter->GetFeatures(ids[i]);
 		Object::Box b;
 		b.min.x = (int)features->BoundingBox[0];
 		b.max.x = (int)features->BoundingBox[1];
@@ -1844,28 +1943,22 @@ std::vector< int > NuclearSegmentation::SplitAlongZ(int objID, int cutSlice, vtk
 	int max_id = maxID();		
 	int newID1 = ++max_id;		
 	int newID2 = ++max_id;		
-	for(int k=region.min.z; k<=region.max.z; k++)
-	{
-		for(int i=region.min.y; i<=region.max.y; i++)
-		{			
-			for(int j=region.min.x; j<=region.max.x; j++)
-			{				
-				int pix = (int)labelImage->GetPixel(0,0,k,i,j);
-				if(pix != objID) continue;
-				if(k<cutSlice)
-					labelImage->SetPixel(0,0,k,i,j,newID1);
-				else
-					labelImage->SetPixel(0,0,k,i,j,newID2);
-			}
-		}
-	}	
+	ReplaceLabelsKernel below(0, LabelBox(region.min.x,region.min.y,region.min.z,region.max.x,region.max.y,cutSlice-1), std::vector<int>(1,objID), newID1);
+	ReplaceLabelsKernel above(0, LabelBox(region.min.x,region.min.y,cutSlice,region.max.x,region.max.y,region.max.z), std::vector<int>(1,objID), newID2);
+	if(!RunOnLabelType(labelImage, below) || !RunOnLabelType(labelImage, above))
+	{
+		errorMessage = "label image data type is not supported";
+		return ret_ids;
+	}
 
 	std::set<unsigned short> ids;
 	ids.insert((unsigned short)newID1);
 	ids.insert((unsigned short)newID2);
 	//Add features for the two new objects
+	this->BeginEdit();
 	this->addObjectsToMaps(ids, region.min.x, region.min.y, region.min.z, region.max.x, region.max.y, region.max.z, table);
 	this->removeObjectFromMaps(objID, table);
+	this->EndEdit();
 	EditsNotSaved = true;
 
 	//return the ids of the two cells resulting from spliting
@@ -1958,12 +2051,14 @@ std::vector< std::vector<int> > NuclearSegmentation::GroupMerge(std::vector<int>
 		}
 	}
 
-	//Iterate though groups and merge them together
+	//Iterate though groups and merge them together (the tables are compacted once, after the last merge)
+	this->BeginEdit();
 	for(unsigned i=0; i<groups.size(); ++i)
 	{
 		int newID = Merge(groups.at(i), table, NucAdjTable);
 		groups.at(i).push_back(newID);	//Put the new id at the end of the group
 	}
+	this->EndEdit();
 	return groups;
 
 }
@@ -1977,37 +2072,14 @@ int NuclearSegmentation::Merge(vector<int> ids, vtkSmartPointer<vtkTable> table,
 	}
 
 	int newID = maxID() + 1;
-	if(NucAdjTable)
-	{
-		for(unsigned j=0; j<ids.size(); ++j)
-		{
-			int OldID = ids.at(j);
-			for(unsigned row=0; row<NucAdjTable->GetNumberOfRows(); ++row)
-			{
-				for(unsigned col=0; col<NucAdjTable->GetNumberOfRows(); ++col)
-				{
-					if(NucAdjTable->GetValue(row,col).ToInt() == OldID)
-						NucAdjTable->SetValue(row,col,newID);
-				}
-			}
-		}
-		for(unsigned row=0; row<NucAdjTable->GetNumberOfRows(); ++row)
-		{
-			if((NucAdjTable->GetValue(row,0).ToInt()) == (NucAdjTable->GetValue(row,1).ToInt()))
-			{
-				NucAdjTable->RemoveRow(row);
-				--row;
-			}
-		}
-	}
+	this->BeginEdit();
+	this->mergeObjectsInAdjacency(ids, newID, NucAdjTable);
 
 	this->ReassignLabels(ids, newID);					//Assign all old labels to this new label
 	ftk::Object::Box region = ExtremaBox(ids);
 	this->addObjectToMaps(newID, region.min.x, region.min.y, region.min.z, region.max.x, region.max.y, region.max.z, table);
-	for(unsigned i=0; i<ids.size(); ++i)
-	{
-		this->removeObjectFromMaps(ids.at(i),table);
-	}
+	this->removeObjectsFromMaps(ids,table);
+	this->EndEdit();
 	EditsNotSaved = true;
 
 	return newID;
@@ -2086,8 +2158,8 @@ bool NuclearSegmentation::Delete(std::vector<int> ids, vtkSmartPointer<vtkTable>
 	for(int i=0; i<(int)ids.size(); ++i)
 	{
 		ReassignLabel(ids.at(i),0);				//Turn each label in list to zero
-		removeObjectFromMaps(ids.at(i),table);
 	}
+	removeObjectsFromMaps(ids,table);
 	EditsNotSaved = true;
 
 	return true;
@@ -2130,8 +2202,8 @@ bool NuclearSegmentation::Exclude(int l, int r, int t, int b, int z1, int z2, vt
 	for(int i=0; i<(int)ids.size(); ++i)
 	{
 		ReassignLabel(ids.at(i),0);				//Turn each label in list to zero
-		removeObjectFromMaps(ids.at(i),table);			
 	}
+	removeObjectsFromMaps(ids,table);
 	EditsNotSaved = true;
 
 	return true;
@@ -2215,27 +2287,11 @@ bool NuclearSegmentation::FillAnObject(int objID)
 	img->Update();	
 		
 	//Iterate through Image & fill in with the object of interest
-	typedef itk::ImageRegionIteratorWithIndex< ImageType > IteratorType;
-	IteratorType it(img,img->GetRequestedRegion());
-	/*for(int k=region.min.z; k<=region.max.z; k++)
-	{
-		for(int i=region.min.y; i<=region.max.y; i++)
-		{			
-			for(int j=region.min.x; j<=region.max.x; j++)*/
-	for(int k=min_z; k<=max_z; k++)
+	ObjectMaskKernel copyObject(LabelBox(min_x,min_y,min_z,max_x,max_y,max_z), objID, img->GetBufferPointer(), false);
+	if(!RunOnLabelType(labelImage, copyObject))
 	{
-		for(int i=min_y; i<=max_y; i++)
-		{			
-			for(int j=min_x; j<=max_x; j++)
-			{
-				int pix = (int)labelImage->GetPixel(0,0,k,i,j);
-				if(pix != objID)
-					it.Set(0);
-				else
-					it.Set(255);
-				++it;
-			}
-		}
+		errorMessage = "label image data type is not supported";
+		return false;
 	}
 
 	//Fill the itk image
@@ -2254,26 +2310,8 @@ bool NuclearSegmentation::FillAnObject(int objID)
 	filter->Update();
 
 	//Copy the filled itk image back to the label image	
-	IteratorType it2(filter->GetOutput(),filter->GetOutput()->GetRequestedRegion());
-	/*for(int k=region.min.z; k<=region.max.z; k++)
-	{
-		for(int i=region.min.y; i<=region.max.y; i++)
-		{			
-			for(int j=region.min.x; j<=region.max.x; j++)*/
-	for(int k=min_z; k<=max_z; k++)
-	{
-		for(int i=min_y; i<=max_y; i++)
-		{			
-			for(int j=min_x; j<=max_x; j++)
-			{
-				int pix = (int)labelImage->GetPixel(0,0,k,i,j);
-				int pix2 = (int) it2.Get();
-				if(pix ==0 && pix2>0) //just copy pixels that were zeros
-					labelImage->SetPixel(0,0,k,i,j,objID);										
-				++it2;
-			}
-		}
-	}
+	ObjectMaskKernel pasteObject(LabelBox(min_x,min_y,min_z,max_x,max_y,max_z), objID, filter->GetOutput()->GetBufferPointer(), true);
+	RunOnLabelType(labelImage, pasteObject);
 	
 	return true;
 }
@@ -2339,38 +2377,95 @@ ftk::Object::Point NuclearSegmentation::MergeInit(ftk::Object::Point P1, ftk::Ob
 //**********************************************************************************************************
 void NuclearSegmentation::removeObjectFromMaps(int ID, vtkSmartPointer<vtkTable> table)
 {
+	std::vector<int> IDs;
+	IDs.push_back(ID);
+	removeObjectsFromMaps(IDs, table);
+}
+
+//The table rows are only tombstoned here, EndEdit drops all of them in one pass
+void NuclearSegmentation::removeObjectsFromMaps(std::vector<int> IDs, vtkSmartPointer<vtkTable> table)
+{
+	this->BeginEdit();
 	if(table)
+		tableIndex.Attach(table);
+
+	for(int i=0; i<(int)IDs.size(); ++i)
+	{
+		int ID = IDs.at(i);
+		if(table)
+		{
+			vtkIdType row = tableIndex.FindRow(ID);
+			if(row != -1)
+				tableIndex.RemoveRow(row);
+		}
+
+		centerMap.erase( ID );
+		bBoxMap.erase( ID );
+		if((!centerMap4DImage.empty())&& (!bBoxMap4DImage.empty()))
+		{
+			centerMap4DImage.at(currentTime).erase( ID );
+			bBoxMap4DImage.at(currentTime).erase( ID );
+		}
+	}
+	this->EndEdit();
+}
+
+void NuclearSegmentation::removeObjectsFromAdjacency(std::set<int> IDs, vtkSmartPointer<vtkTable> NucAdjTable)
+{
+	if(!NucAdjTable)
+		return;
+
+	this->BeginEdit();
+	adjacencyIndex.Attach(NucAdjTable);
+	adjacencyIndex.RemoveKeys(IDs);
+	this->EndEdit();
+}
+
+void NuclearSegmentation::mergeObjectsInAdjacency(std::vector<int> IDs, int newID, vtkSmartPointer<vtkTable> NucAdjTable)
+{
+	if(!NucAdjTable)
+		return;
+
+	this->BeginEdit();
+	adjacencyIndex.Attach(NucAdjTable);
+	std::vector<vtkIdType> rows;
+	for(int i=0; i<(int)IDs.size(); ++i)
 	{
-		for(int row = 0; row<table->GetNumberOfRows(); ++row)
+		int OldID = IDs.at(i);
+		adjacencyIndex.FindRows(OldID, rows);
+		for(int r=0; r<(int)rows.size(); ++r)
 		{
-			if(table->GetValue(row,0) == ID)
+			for(int col=0; col<2; ++col)
 			{
-				table->RemoveRow( row );
-				break;
+				if(NucAdjTable->GetValue(rows.at(r),col).ToInt() == OldID)
+					adjacencyIndex.SetKey(rows.at(r), col, newID);
 			}
 		}
 	}
 
-	//if(zernikeTable)
-	//{
-	//	for(int row = 0; row<zernikeTable->GetNumberOfRows(); ++row)
-	//	{
-	//		if(zernikeTable->GetValue(row,0) == ID)
-	//		{
-	//			zernikeTable->RemoveRow( row );
-	//			break;
-	//		}
-	//	}
-	//}
-	
-	centerMap.erase( ID );
-	bBoxMap.erase( ID );
-	if((!centerMap4DImage.empty())&& (!bBoxMap4DImage.empty()))
+	//Adjacencies between the merged objects now connect the new object to itself
+	adjacencyIndex.FindRows(newID, rows);
+	for(int r=0; r<(int)rows.size(); ++r)
 	{
-		centerMap4DImage.at(currentTime).erase( ID );
-		bBoxMap4DImage.at(currentTime).erase( ID );
+		if(NucAdjTable->GetValue(rows.at(r),0).ToInt() == NucAdjTable->GetValue(rows.at(r),1).ToInt())
+			adjacencyIndex.RemoveRow(rows.at(r));
 	}
-	
+	this->EndEdit();
+}
+
+void NuclearSegmentation::BeginEdit(void)
+{
+	++editDepth;
+}
+
+void NuclearSegmentation::EndEdit(void)
+{
+	if(--editDepth > 0)
+		return;
+
+	editDepth = 0;
+	tableIndex.Compact();
+	adjacencyIndex.Compact();
 }
 
 //Calculate the features within a specific region of the image for a specific ID, and update the table
@@ -2431,6 +2526,7 @@ bool NuclearSegmentation::addObjectsToMaps(std::set<unsigned short> IDs, int x1,
 		if (bBoxMap.empty())
 			bBoxMap = bBoxMap4DImage.at(currentTime);
 	}
+	calc->SetRowIndex(&tableIndex);
 	calc->Update(table, &centerMap, &bBoxMap, NucAdjTable, currentTime);
 	//calc->UpdateZernike(zernikeTable);
 	delete calc;
@@ -38,6 +38,7 @@
 #include <ftkFeatures/ftkLabelImageToFeatures.h>
 #include <ftkCommon/ftkUtils.h>
 #include <ftkFeatures/ftkObject.h>
+#include <ftkFeatures/ftkTableRowIndex.h>
 #include <yousef_core/yousef_seg.h>
 
 #include <vtkSmartPointer.h>
@@ -160,6 +161,11 @@ protected:
 	std::map<int, ftk::Object::Box>		bBoxMap;			//Bounding boxes
 	std::map<int, ftk::Object::Point>	centerMap;			//Centroids
 
+	//ID to row lookups for the tables passed to the editing functions:
+	ftk::TableRowIndex tableIndex;			//Feature table, keyed by ID
+	ftk::TableRowIndex adjacencyIndex;		//Nuclear adjacency table, keyed by both IDs
+	int editDepth;
+
 
 	bool GetResultImage();									//Gets the result of last module and puts it in labelImage
 	void GetParameters(void);								//Retrieve the Parameters from nuclear segmentation.
@@ -171,6 +177,11 @@ protected:
 	bool addObjectToMaps(int ID, int x1, int y1, int z1, int x2, int y2, int z2, vtkSmartPointer<vtkTable> table = NULL);
 	bool addObjectsToMaps(std::set<unsigned short> IDs, int x1, int y1, int z1, int x2, int y2, int z2, vtkSmartPointer<vtkTable> table = NULL, vtkSmartPointer<vtkTable> NucAdjTable = NULL);
 	void removeObjectFromMaps(int ID, vtkSmartPointer<vtkTable> table);
+	void removeObjectsFromMaps(std::vector<int> IDs, vtkSmartPointer<vtkTable> table);
+	void removeObjectsFromAdjacency(std::set<int> IDs, vtkSmartPointer<vtkTable> NucAdjTable);		//Drop every adjacency of these objects
+	void mergeObjectsInAdjacency(std::vector<int> IDs, int newID, vtkSmartPointer<vtkTable> NucAdjTable);	//Move the adjacencies of IDs to newID
+	void BeginEdit(void);										//Removed rows stay tombstoned until the outermost EndEdit
+	void EndEdit(void);											//Compacts the tables once for the whole batch of edits
 	//FeatureCalcType::Pointer computeGeometries(int x1, int y1, int z1, int x2, int y2, int z2);
 	void ReassignLabels(std::vector<int> fromIds, int toId);
 	void ReassignLabel(int fromId, int toId);
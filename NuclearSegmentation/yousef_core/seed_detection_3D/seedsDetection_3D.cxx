@@ -70,6 +70,8 @@ char* LocalMaximaKernel =
 #include "itkExtractImageFilter.h"
 #include "itkImageFileWriter.h"
 
+#include "ftkCommon/ftkTaskRuntime.h"
+
 typedef    unsigned short     MyInputPixelType;
 typedef itk::Image< MyInputPixelType,  3 >   MyInputImageType;
 typedef itk::Image< MyInputPixelType,  2 >   MyInputImageType2D;
@@ -97,6 +99,88 @@ void Detect_Local_MaximaPoints_3D_ocl(float* im_vals, int r, int c, int z, doubl
 extern "C" void Detect_Local_MaximaPoints_3D_CUDA(float* im_vals, int r, int c, int z, double scale_xy, double scale_z, unsigned short* out1);
 
 
+namespace
+{
+//Serializes the merge of one LoG response into the max response image
+ftk::TaskMutex logMergeMutex;
+
+//One LoG block of Seeds_Detection_3D
+struct LoGBlockBody
+{
+	MyInputImageType::Pointer im;
+	std::vector< std::pair< int, int > > *blockStarts;
+	int block_divisor;
+	int cntr;
+	int *blk;
+	size_t r, c, z;
+	double sigma_min, sigma_max;
+	float *IM;
+	int sampl_ratio;
+	unsigned short *dImg;
+	int *minIMout;
+	int UseDistMap;
+
+	void operator()( int b ) const
+	{
+		int i = (*blockStarts)[b].first;
+		int j = (*blockStarts)[b].second;
+		{
+			ftk::TaskLock lock( logMergeMutex );
+			std::cout<<"LoG block "<<(*blk)++<<" of "<<cntr<<std::endl;
+		}
+		int min_x = j; 
+		int max_x = 40+(int)j+c/block_divisor; //40 is the size of the overlapping between the two tiles along x
+		int min_y = i;
+		int max_y = 40+(int)i+r/block_divisor; //40 is the size of the overlapping between the two tiles along y
+		if(max_x >= (int)c)
+			max_x = c-1;
+		if(max_y >= (int)r)
+			max_y = r-1;
+
+		if( block_divisor == 1 )
+		{
+			multiScaleLoG(im, r, c, z, min_y, max_y, min_x, max_x, 0, z-1, sigma_min, sigma_max, IM, sampl_ratio, dImg, minIMout, UseDistMap);
+		}
+		else
+		{
+			//Create an itk image to hold the sub image (tile) being processing
+			MyInputImageType::Pointer im_Small = extract3DImageRegion(im, max_x-min_x+1, max_y-min_y+1, z, min_x, min_y, 0);
+
+			//By Yousef (8/27/2009): multi-scale LoG is done in one function now
+			multiScaleLoG(im_Small, r, c, z, min_y, max_y, min_x, max_x, 0, z-1, sigma_min, sigma_max, IM, sampl_ratio, dImg, minIMout, UseDistMap);
+		}
+	}
+};
+
+//One scale of multiScaleLoG
+struct LoGScaleBody
+{
+	MyInputImageType::Pointer im;
+	size_t r, c;
+	int rmin, rmax, cmin, cmax, zmin, zmax;
+	double sigma_min, sigma_max;
+	float *IMG;
+	unsigned short *dImg;
+	int *minIMout;
+	int UseDistMap;
+	int num_itk_threads;
+	bool *failed;
+
+	void operator()( int i ) const;
+};
+
+//Rows of Detect_Local_MaximaPoints_3D
+struct LocalMaximaBody
+{
+	float *im_vals;
+	int r, c, z;
+	double scale_xy, scale_z;
+	unsigned short *out1;
+
+	void operator()( int i ) const;
+};
+}
+
 int Seeds_Detection_3D( float* IM, float** IM_out, unsigned short** IM_bin, size_t r, size_t c, size_t z, double *sigma_min_in, double *sigma_max_in, double *scale_xy_in, double *scale_z_in, int sampl_ratio, unsigned short* bImg, int UseDistMap, int* minIMout, bool paramEstimation)
 {	
 	// 	std::cout << std::endl << 
@@ -243,50 +327,29 @@ int Seeds_Detection_3D( float* IM, float** IM_out, unsigned short** IM_bin, size
 		for(int j=0; j<c; j+=c/block_divisor)
 			cntr++;
 
-	int min_x, min_y, max_x, max_y;
-
-
-#ifdef _OPENMP
-	omp_set_nested(1);	//This turns on nesting so the omp parallel inside the multiScaleLog can run in parallel. Without this, OpenMP only generates threads for the outermost omp parallel for construct. 
-						//It may make sense to turn this off if it causes too much thread contention. THINK CAREFULLY ABOUT IT.
-#endif
 	clock_t start_time_multiscale_log = clock();
 
-	#pragma omp parallel for private(min_x, min_y, max_x, max_y)
+	//The blocks and the scales inside multiScaleLoG share the process wide task pool, so nesting does not oversubscribe
+	std::vector< std::pair< int, int > > blockStarts;
 	for(int i=0; i<r; i+=r/block_divisor)
-	{
 		for(int j=0; j<c; j+=c/block_divisor)
-		{
-			std::cout<<"LoG block "<<blk++<<" of "<<cntr<<std::endl;
-			min_x = j; 
-			max_x = 40+(int)j+c/block_divisor; //40 is the size of the overlapping between the two tiles along x
-			min_y = i;
-			max_y = 40+(int)i+r/block_divisor; //40 is the size of the overlapping between the two tiles along y
-			if(max_x >= c)
-				max_x = c-1;
-			if(max_y >= r)
-				max_y = r-1;
-			
-			if( block_divisor == 1 )
-			{
-				multiScaleLoG(im, r, c, z, min_y, max_y, min_x, max_x, 0, z-1, sigma_min, sigma_max, IM, sampl_ratio, dImg, minIMout, UseDistMap);
-			}
-			else
-			{
-
-				//Create an itk image to hold the sub image (tile) being processing
-				MyInputImageType::Pointer im_Small = extract3DImageRegion(im, max_x-min_x+1, max_y-min_y+1, z, min_x, min_y, 0);
-
-				//By Yousef (8/27/2009): multi-scale LoG is done in one function now
-				multiScaleLoG(im_Small, r, c, z, min_y, max_y, min_x, max_x, 0, z-1, sigma_min, sigma_max, IM, sampl_ratio, dImg, minIMout, UseDistMap);
-				//
-			}
-		}
-	}
-
-#ifdef _OPENMP
-	omp_set_nested(0);
-#endif
+			blockStarts.push_back( std::make_pair( i, j ) );
+
+	LoGBlockBody blockBody;
+	blockBody.im = im;
+	blockBody.blockStarts = &blockStarts;
+	blockBody.block_divisor = block_divisor;
+	blockBody.cntr = cntr;
+	blockBody.blk = &blk;
+	blockBody.r = r; blockBody.c = c; blockBody.z = z;
+	blockBody.sigma_min = sigma_min;
+	blockBody.sigma_max = sigma_max;
+	blockBody.IM = IM;
+	blockBody.sampl_ratio = sampl_ratio;
+	blockBody.dImg = dImg;
+	blockBody.minIMout = minIMout;
+	blockBody.UseDistMap = UseDistMap;
+	ftk::ParallelFor( 0, (int)blockStarts.size(), blockBody, 1, "seeds_block" );
 
 	std::cout << "Multiscale Log took " << (clock() - start_time_multiscale_log)/(float)CLOCKS_PER_SEC << " seconds" << std::endl;
 
@@ -391,6 +454,67 @@ int detect_seeds(itk::SmartPointer<MyInputImageType> im, int r, int c, int z,con
 	return EXIT_SUCCESS;
 }
 
+void LoGScaleBody::operator()( int i ) const
+{
+	typedef itk::Image< float, 3 >   OutputImageType;
+
+	int sigma = sigma_min + i;
+	{
+		ftk::TaskLock lock( logMergeMutex );
+		std::cout << "Processing scale " << sigma << std::endl;
+	}
+	//  The filter type is now instantiated using both the input image and the 
+	//  output image types.
+	typedef itk::LaplacianRecursiveGaussianImageFilter<MyInputImageType, OutputImageType >  FilterType;
+	FilterType::Pointer laplacian = FilterType::New();
+	//  The option for normalizing across scale space can also be selected in this filter.
+	laplacian->SetNormalizeAcrossScale( true );
+	laplacian->SetInput(im);
+	laplacian->SetSigma(sigma);
+
+	//Set the number of itk threads based on the number of concurrent scales
+	laplacian->SetNumberOfThreads(num_itk_threads);
+
+	try
+	{
+		laplacian->Update();
+	}
+	catch( itk::ExceptionObject & err ) 
+	{ 
+		ftk::TaskLock lock( logMergeMutex );
+		std::cout << "ExceptionObject caught !" << std::endl; 
+		std::cout << err << std::endl; 
+		*failed = true;
+		return;
+	} 
+
+	//Merge the response into the max response image, one lock per scale instead of one per voxel
+	typedef itk::ImageRegionConstIterator< OutputImageType > IteratorType;
+	IteratorType iterate(laplacian->GetOutput(),laplacian->GetOutput()->GetRequestedRegion());
+	iterate.GoToBegin();
+
+	ftk::TaskLock lock( logMergeMutex );
+	for(size_t k1=zmin; k1<=zmax; k1++)
+	{
+		for(size_t i1=rmin; i1<=rmax; i1++)
+		{
+			for(size_t j1=cmin; j1<=cmax; j1++)
+			{
+				size_t image_index = k1 * r * c + i1 * c + j1;
+				float log_response = iterate.Get();
+				++iterate;
+
+				if (!UseDistMap || sigma == sigma_min || sigma <= dImg[image_index] / 100)
+				{
+					IMG[image_index] = std::max(IMG[image_index], log_response);
+					*minIMout = std::min<float>(*minIMout, IMG[image_index]);
+				}
+			}
+		}
+	}
+	std::cout<<"Scale " << sigma << " done"<<std::endl;
+}
+
 int multiScaleLoG(itk::SmartPointer<MyInputImageType> im, size_t r, size_t c, size_t z, int rmin, int rmax, int cmin, int cmax, int zmin, int zmax,const double sigma_min, double sigma_max, float* IMG, int sampl_ratio, unsigned short* dImg, int* minIMout, int UseDistMap)
 {
 
@@ -414,118 +538,34 @@ int multiScaleLoG(itk::SmartPointer<MyInputImageType> im, size_t r, size_t c, si
         }
     }
     
-	#ifdef _OPENMP
-		int num_procs = omp_get_num_procs();
-	#else
-		int num_procs = 1;
-	#endif
+	int num_procs = ftk::TaskRuntime::GetNumberOfThreads();
 
 	int num_scales = sigma_max - sigma_min + 1;
-	int num_openmp_threads = std::min(num_scales, num_procs);
-	int num_itk_threads = std::ceil((float)num_procs / num_openmp_threads);
+	int num_task_threads = std::min(num_scales, num_procs);
+	//inside an outer parallel stage (tiles, blocks) the pool is already busy, keep ITK serial
+	int num_itk_threads = ftk::TaskRuntime::IsInTask() ? 1 : (int)std::ceil((float)num_procs / num_task_threads);
 
 	std::cout << "Thread settings for multiScaleLog()" << std::endl;
 	std::cout << "Number of scales: "			<< num_scales << std::endl;
-	std::cout << "Number of OpenMP threads: "	<< num_openmp_threads << std::endl; 
+	std::cout << "Number of task threads: "	<< num_task_threads << std::endl; 
 	std::cout << "Number of ITK threads: "		<< num_itk_threads << std::endl;
 
-	#pragma omp parallel for firstprivate(im)
-	for(int i = sigma_max - sigma_min; i >= 0; i--)
-	{
-		int sigma = sigma_max - i;
-		#pragma omp critical (ProcessingScaleCout)
-		{
-			std::cout << "Processing scale " << sigma << std::endl;
-		}
-		//  The filter type is now instantiated using both the input image and the 
-		//  output image types.
-		typedef itk::LaplacianRecursiveGaussianImageFilter<MyInputImageType, OutputImageType >  FilterType;
-		FilterType::Pointer laplacian = FilterType::New();
-		//  The option for normalizing across scale space can also be selected in this filter.
-		laplacian->SetNormalizeAcrossScale( true );
-
-		//  The input image can be obtained from the output of another
-		//  filter. Here the image comming from the calling function is used as the source
-		laplacian->SetInput(im);
-
-		//  It is now time to select the $\sigma$ of the Gaussian used to smooth the
-		//  data.  Note that $\sigma$ must be passed to both filters and that sigma
-		//  is considered to be in millimeters. That is, at the moment of applying
-		//  the smoothing process, the filter will take into account the spacing
-		//  values defined in the image.
-		//
-		laplacian->SetSigma(sigma);
-
-		//Set the number of itk threads based on the number of OpenMP threads
-		laplacian->SetNumberOfThreads(num_itk_threads);
-		
-		//  Finally the pipeline is executed by invoking the \code{Update()} method.
-		//
-		try
-		{
-			laplacian->Update();
-		}
-		catch( itk::ExceptionObject & err ) 
-		{ 
-			std::cout << "ExceptionObject caught !" << std::endl; 
-			std::cout << err << std::endl; 
-			failed = true;
-		} 
-
-		//   Copy the resulting image into the input array
-		typedef itk::ImageRegionConstIterator< OutputImageType > IteratorType;
-		IteratorType iterate(laplacian->GetOutput(),laplacian->GetOutput()->GetRequestedRegion());
-		iterate.GoToBegin();
-        
-        if (UseDistMap)
-        {
-            for(size_t k1=zmin; k1<=zmax; k1++)
-            {
-                for(size_t i1=rmin; i1<=rmax; i1++)
-                {
-                    for(size_t j1=cmin; j1<=cmax; j1++)
-                    {                        
-                        size_t image_index = k1 * r * c + i1 * c + j1;
-                        float log_response = iterate.Get();
-                        
-                        if (sigma == sigma_min || sigma <= dImg[image_index] / 100)
-                        {
-                            #pragma omp critical
-                            {
-                                IMG[image_index] = std::max(IMG[image_index], log_response);
-                                *minIMout = std::min<float>(*minIMout, IMG[image_index]);
-                            }
-                            ++iterate;
-                        }
-                    }
-                }
-            }
-        }
-        else    //not UseDistMap
-        {
-            for(size_t k1=zmin; k1<=zmax; k1++)
-            {
-                for(size_t i1=rmin; i1<=rmax; i1++)
-                {
-                    for(size_t j1=cmin; j1<=cmax; j1++)
-                    {                
-                        size_t image_index = k1 * r * c + i1 * c + j1;
-                        float log_response = iterate.Get();
-                        
-                        #pragma omp critical
-                        {
-                            IMG[image_index] = std::max(IMG[image_index], log_response);
-                            *minIMout = std::min<float>(*minIMout, IMG[image_index]);
-                        }
-                        
-                        ++iterate;
-                    }
-                }
-            }
-        }
+	LoGScaleBody scaleBody;
+	scaleBody.im = im;
+	scaleBody.r = r; scaleBody.c = c;
+	scaleBody.rmin = rmin; scaleBody.rmax = rmax;
+	scaleBody.cmin = cmin; scaleBody.cmax = cmax;
+	scaleBody.zmin = zmin; scaleBody.zmax = zmax;
+	scaleBody.sigma_min = sigma_min;
+	scaleBody.sigma_max = sigma_max;
+	scaleBody.IMG = IMG;
+	scaleBody.dImg = dImg;
+	scaleBody.minIMout = minIMout;
+	scaleBody.UseDistMap = UseDistMap;
+	scaleBody.num_itk_threads = num_itk_threads;
+	scaleBody.failed = &failed;
+	ftk::ParallelFor( 0, num_scales, scaleBody, 1, "seeds_scale" );
 
-		std::cout<<"Scale " << sigma << " done"<<std::endl;
-	}
 	if (failed)
 		return EXIT_FAILURE;
 	else
@@ -576,47 +616,45 @@ unsigned short get_maximum_3D(unsigned short* A, int r1, int r2, int c1, int c2,
 }
 
 
+void LocalMaximaBody::operator()( int i ) const
+{
+	for(int j=0; j<c; j++)
+	{				
+		for(int k=0; k<z; k++)
+		{									
+			//calculate bounds
+			int min_r = (int) std::max(0.0,i-scale_xy);
+			int min_c = (int) std::max(0.0,j-scale_xy);
+			int min_z = (int) std::max(0.0,k-scale_z);
+			int max_r = (int) std::min((double)r-1,i+scale_xy);
+			int max_c = (int) std::min((double)c-1,j+scale_xy);                         
+			int max_z = (int) std::min((double)z-1,k+scale_z);                         
+
+			//get the intensity maximum of the bounded im_vals
+			float mx = get_maximum_3D(im_vals, min_r, max_r, min_c, max_c, min_z, max_z,r,c);
+
+			//if the current pixel is at the maximum intensity, set it to 255 in out1 (seedImagePtr), else set it to 0
+			unsigned long II = ((unsigned long)k*(unsigned long)r*(unsigned long)c)
+				+((unsigned long)i*(unsigned long)c)+(unsigned long)j;
+			if(im_vals[II] == mx)    
+				out1[II]=255;
+			else
+				out1[II]=0;
+		}			
+	}
+}
+
 void Detect_Local_MaximaPoints_3D(float* im_vals, int r, int c, int z, double scale_xy, double scale_z, unsigned short* out1, unsigned short* bImg)
 {  
-	int min_r, min_c, max_r, max_c, min_z, max_z;    
-
 	//start by getting local maxima points
 	//if a point is a local maximam give it a local maximum ID
-
-	//int IND = 0;
-	unsigned long II = 0;
-	//int itr = 0;
-	//std::cout << "In Detect_Local_MaximaPoints_3D, about to plunge in the loop" << std::endl;
-
-	#pragma omp parallel for private(II, min_r, min_c, min_z, max_r, max_c, max_z)
-	for(int i=0; i<r; i++)
-	{
-		for(int j=0; j<c; j++)
-		{				
-			for(int k=0; k<z; k++)
-			{									
-				//calculate bounds
-				min_r = (int) std::max(0.0,i-scale_xy);
-				min_c = (int) std::max(0.0,j-scale_xy);
-				min_z = (int) std::max(0.0,k-scale_z);
-				max_r = (int) std::min((double)r-1,i+scale_xy);
-				max_c = (int) std::min((double)c-1,j+scale_xy);                         
-				max_z = (int) std::min((double)z-1,k+scale_z);                         
-
-				//get the intensity maximum of the bounded im_vals
-				float mx = get_maximum_3D(im_vals, min_r, max_r, min_c, max_c, min_z, max_z,r,c);
-
-				//if the current pixel is at the maximum intensity, set it to 255 in out1 (seedImagePtr), else set it to 0
-				II = ((unsigned long)k*(unsigned long)r*(unsigned long)c)
-					+((unsigned long)i*(unsigned long)c)+(unsigned long)j;
-				if(im_vals[II] == mx)    
-					out1[II]=255;
-				else
-					out1[II]=0;
-			}			
-		}
-	}  
-	//std::cout << std::endl << "made it out of the loop" << std::endl;
+	LocalMaximaBody body;
+	body.im_vals = im_vals;
+	body.r = r; body.c = c; body.z = z;
+	body.scale_xy = scale_xy;
+	body.scale_z = scale_z;
+	body.out1 = out1;
+	ftk::ParallelFor( 0, r, body, 4, "seeds_maxima" );
 }
 
 void Detect_Local_MaximaPoints_3D_ocl(float* im_vals, int r, int c, int z, double scale_xy, double scale_z, unsigned short* out1)
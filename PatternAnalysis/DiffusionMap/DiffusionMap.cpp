@@ -58,7 +58,7 @@ void DiffusionMap::Initialize(vtkSmartPointer< vtkTable > tbl, bool val)
 	vnl_vector<double> std_vec = stats.sd();
 	vnl_vector<double> mean_vec = stats.mean();
 	
-	data_matrix.set_size((int)featureTable->GetNumberOfRows(), (int)featureTable->GetNumberOfColumns()-1);
+	data_matrix.set_size((int)featureTable->GetNumberOfRows(), (int)temp.columns());
 
 	for(int i = 0; i<temp.columns() ; ++i)
 	{
@@ -173,6 +173,264 @@ void DiffusionMap::ComputeDiffusionMap(void)
 	std::cout << " Done\n";
 }
 
+//**********************************************************************
+// Sparse Diffusion Map
+//**********************************************************************
+void DiffusionSparseMatrix::Multiply(const double *x, double *y) const
+{
+	#pragma omp parallel for schedule(static)
+	for(int row=0; row<size; ++row)
+	{
+		double sum = 0;
+		for(int i=row_ptr[row]; i<row_ptr[row+1]; ++i)
+			sum += values[i] * x[col_ind[i]];
+		y[row] = sum;
+	}
+}
+
+static double ParallelDot(const double *x, const double *y, int n)
+{
+	double sum = 0;
+	#pragma omp parallel for reduction(+:sum)
+	for(int i=0; i<n; ++i)
+		sum += x[i] * y[i];
+	return sum;
+}
+
+static void ParallelAxpy(double a, const double *x, double *y, int n)
+{
+	#pragma omp parallel for
+	for(int i=0; i<n; ++i)
+		y[i] += a * x[i];
+}
+
+// Exact k nearest neighbors in feature space (squared distances, self excluded)
+std::vector< std::vector< std::pair<unsigned int, double> > > DiffusionMap::FeatureKNearestNeighbors(unsigned int k)
+{
+	std::vector< std::vector< std::pair<unsigned int, double> > > neighbors;
+	ftk::KNearestNeighbors(data_matrix.data_block(), (int)data_matrix.rows(), (int)data_matrix.cols(), k, neighbors);
+	return neighbors;
+}
+
+// Symmetrizes the k-NN graph (union of edges), applies the same Gaussian kernel as the
+// dense path and forms S = D^-1/2 W D^-1/2, which has the eigenvalues of D^-1 W.
+void DiffusionMap::BuildNormalizedAffinity(const std::vector< std::vector< std::pair<unsigned int, double> > > &neighbors, DiffusionSparseMatrix &affinity, vnl_vector<double> &degree)
+{
+	int n = (int)neighbors.size();
+	double sigma = 2;
+
+	std::vector< std::vector< std::pair<unsigned int, double> > > adjacency(n);
+	for(int row=0; row<n; ++row)
+	{
+		for(int i=0; i<(int)neighbors[row].size(); ++i)
+		{
+			unsigned int col = neighbors[row][i].first;
+			double weight = exp( -neighbors[row][i].second / (2*pow(sigma, 2)) );
+			adjacency[row].push_back(std::make_pair(col, weight));
+			adjacency[col].push_back(std::make_pair((unsigned int)row, weight));
+		}
+	}
+
+	affinity.size = n;
+	affinity.row_ptr.assign(n+1, 0);
+	affinity.col_ind.clear();
+	affinity.values.clear();
+	degree.set_size(n);
+	for(int row=0; row<n; ++row)
+	{
+		std::vector< std::pair<unsigned int, double> > &adj = adjacency[row];
+		std::sort(adj.begin(), adj.end());
+		double sum = 0;
+		for(int i=0; i<(int)adj.size(); ++i)
+		{
+			if(i > 0 && adj[i].first == adj[i-1].first)
+				continue;
+			affinity.col_ind.push_back(adj[i].first);
+			affinity.values.push_back(adj[i].second);
+			sum += adj[i].second;
+		}
+		affinity.row_ptr[row+1] = (int)affinity.col_ind.size();
+		degree(row) = sum > 0 ? sum : 1;
+		std::vector< std::pair<unsigned int, double> >().swap(adj);
+	}
+
+	#pragma omp parallel for
+	for(int row=0; row<n; ++row)
+	{
+		for(int i=affinity.row_ptr[row]; i<affinity.row_ptr[row+1]; ++i)
+			affinity.values[i] /= sqrt(degree(row) * degree(affinity.col_ind[i]));
+	}
+}
+
+// Thick-restart Lanczos with full reorthogonalization for the algebraically largest
+// eigenpairs of a symmetric sparse operator. The basis holds at most m vectors of
+// length n, with m a small multiple of num_eig.
+void DiffusionMap::LanczosLargestEigenpairs(const DiffusionSparseMatrix &op, unsigned int num_eig, vnl_vector<double> &vals, vnl_matrix<double> &vecs)
+{
+	int n = op.size;
+	int nev = std::min((int)num_eig, n);
+	int m = std::min(n, std::max(2*nev + 10, nev + 20));
+	int max_restarts = 300;
+	double tol = 1e-8;
+
+	// basis vectors are stored row-wise so each one is contiguous
+	vnl_matrix<double> V(m+1, n, 0.0);
+	vnl_matrix<double> T(m, m, 0.0);
+	vnl_vector<double> w(n);
+	vnl_random rng(9667566);
+
+	for(int i=0; i<n; ++i)
+		V(0,i) = rng.drand64(-1, 1);
+	V.set_row(0, V.get_row(0).normalize());
+
+	int kept = 0;
+	vnl_vector<double> ritz_vals;
+	vnl_matrix<double> ritz_vecs;
+	for(int restart=0; restart<max_restarts; ++restart)
+	{
+		double beta = 0;
+		for(int j=kept; j<m; ++j)
+		{
+			op.Multiply(V[j], w.data_block());
+
+			// two passes of classical Gram-Schmidt against the whole basis
+			for(int i=0; i<=j; ++i)
+				T(i,j) = T(j,i) = 0;
+			for(int pass=0; pass<2; ++pass)
+			{
+				for(int i=0; i<=j; ++i)
+				{
+					double h = ParallelDot(V[i], w.data_block(), n);
+					ParallelAxpy(-h, V[i], w.data_block(), n);
+					T(i,j) += h;
+					T(j,i) = T(i,j);
+				}
+			}
+			beta = w.magnitude();
+			if(beta < 1e-12)
+			{
+				// invariant subspace: continue with a fresh direction orthogonal to the basis
+				for(int i=0; i<n; ++i)
+					w(i) = rng.drand64(-1, 1);
+				for(int pass=0; pass<2; ++pass)
+					for(int i=0; i<=j; ++i)
+						ParallelAxpy(-ParallelDot(V[i], w.data_block(), n), V[i], w.data_block(), n);
+				V.set_row(j+1, w.normalize());
+				beta = 0;
+			}
+			else
+			{
+				V.set_row(j+1, w / beta);
+			}
+		}
+
+		vnl_symmetric_eigensystem<double> eig(T);
+		ritz_vals.set_size(m);
+		ritz_vecs.set_size(m, m);
+		// descending order
+		for(int i=0; i<m; ++i)
+		{
+			ritz_vals(i) = eig.D(m-1-i, m-1-i);
+			ritz_vecs.set_column(i, eig.V.get_column(m-1-i));
+		}
+
+		int converged = 0;
+		for(int i=0; i<nev; ++i)
+		{
+			double residual = fabs(beta * ritz_vecs(m-1, i));
+			if(residual <= tol * std::max(1.0, fabs(ritz_vals(i))))
+				++converged;
+		}
+		if(converged == nev || m == n || restart == max_restarts-1)
+			break;
+
+		// restart with the leading Ritz vectors and the current residual direction
+		kept = std::min(nev + (m - nev) / 2, m - 1);
+		vnl_matrix<double> restarted(kept, n, 0.0);
+		for(int r=0; r<kept; ++r)
+			for(int i=0; i<m; ++i)
+				ParallelAxpy(ritz_vecs(i, r), V[i], restarted[r], n);
+		vnl_vector<double> residual_dir = V.get_row(m);
+		T.fill(0);
+		for(int r=0; r<kept; ++r)
+		{
+			V.set_row(r, restarted.get_row(r));
+			T(r,r) = ritz_vals(r);
+		}
+		V.set_row(kept, residual_dir);
+	}
+
+	vals.set_size(nev);
+	vecs.set_size(n, nev);
+	for(int r=0; r<nev; ++r)
+	{
+		vals(r) = ritz_vals(r);
+		w.fill(0);
+		for(int i=0; i<m; ++i)
+			ParallelAxpy(ritz_vecs(i, r), V[i], w.data_block(), n);
+		vecs.set_column(r, w);
+	}
+}
+
+void DiffusionMap::ComputeSparseDiffusionMap(unsigned int k, unsigned int num_eig)
+{
+	int n = (int)data_matrix.rows();
+	if(n < 2)
+		return;
+
+	std::cout << "Computing sparse k-NN affinity graph...";
+	std::vector< std::vector< std::pair<unsigned int, double> > > neighbors;
+	if(multi_cell_struct)
+	{
+		// neighbors come from the spatial graph, weights from the features
+		kNearestObjects<3>* KNObj = new kNearestObjects<3>(centroidMap);
+		std::vector<std::vector< std::pair<unsigned int, double> > > kNeighborIDs;
+		kNeighborIDs = KNObj->k_nearest_neighbors_All(k, 0, 0);
+		delete KNObj;
+
+		neighbors.resize(n);
+		for(int i=0; i<(int)kNeighborIDs.size(); ++i)
+		{
+			int row = idRowMap[kNeighborIDs[i][0].first];
+			for(int j=1; j<(int)kNeighborIDs[i].size(); ++j)
+			{
+				int col = idRowMap[kNeighborIDs[i][j].first];
+				if(col == row)
+					continue;
+				double dist = (data_matrix.get_row(row) - data_matrix.get_row(col)).squared_magnitude();
+				neighbors[row].push_back(std::make_pair((unsigned int)col, dist));
+			}
+		}
+	}
+	else
+	{
+		neighbors = FeatureKNearestNeighbors(std::min((int)k, n-1));
+	}
+
+	DiffusionSparseMatrix affinity;
+	vnl_vector<double> degree;
+	BuildNormalizedAffinity(neighbors, affinity, degree);
+	std::vector< std::vector< std::pair<unsigned int, double> > >().swap(neighbors);
+
+	std::cout << " Done\nComputing Diffusion Map (" << num_eig << " eigenpairs)...";
+
+	vnl_matrix<double> phi;
+	LanczosLargestEigenpairs(affinity, num_eig, EigVals, phi);
+
+	// right eigenvectors of the random walk matrix D^-1 W are D^-1/2 phi
+	EigVecs.set_size(n, phi.cols());
+	for(int col=0; col<(int)phi.cols(); ++col)
+	{
+		vnl_vector<double> psi(n);
+		for(int row=0; row<n; ++row)
+			psi(row) = phi(row, col) / sqrt(degree(row));
+		psi.normalize();
+		EigVecs.set_column(col, psi);
+	}
+
+	std::cout << " Done\n";
+}
+
 
 vtkSmartPointer< vtkTable > DiffusionMap::GetKDiffusionNeighbors(std::vector<unsigned int> IDs, unsigned int k)
 {
@@ -180,10 +438,12 @@ vtkSmartPointer< vtkTable > DiffusionMap::GetKDiffusionNeighbors(std::vector<uns
 	for(int row=0; row<(int)EigVecs.rows(); ++row)
 	{
 		unsigned int id = (int)rowIdMap[row];		
-		std::vector<double> c;
-		for ( int i=0; i<10; ++i)
+		// fewer than 10 eigenvectors (small tables, or a sparse map with fewer
+		// eigenpairs) leave the remaining coordinates at 0
+		std::vector<double> c(10, 0.0);
+		for ( int i=0; i<10 && i<(int)EigVecs.cols(); ++i)
 		{		
-			c.push_back(EigVecs(row,i));	
+			c[i] = EigVecs(row,i);	
 		}		
 		eigenMap[id] = c;
 	}
@@ -7,8 +7,11 @@
 #include "vnl/vnl_vector.h"
 #include "vnl/vnl_real.h"
 #include "vnl/algo/vnl_real_eigensystem.h"
+#include "vnl/algo/vnl_symmetric_eigensystem.h"
+#include "vnl/vnl_random.h"
 #include "mbl/mbl_stats_nd.h"
 #include "ftkGraphs/kNearestObjects.h"
+#include "ftkCommon/ftkKNearestNeighbors.h"
 
 #include <vtkSmartPointer.h>
 #include <vtkTable.h>
@@ -26,6 +29,17 @@
     #include "omp.h"
 #endif
 
+// Compressed sparse row matrix used by the sparse diffusion map
+struct DiffusionSparseMatrix
+{
+	int size;
+	std::vector<int> row_ptr;
+	std::vector<int> col_ind;
+	std::vector<double> values;
+
+	void Multiply(const double *x, double *y) const;
+};
+
 class DiffusionMap
 {
 public:
@@ -34,6 +48,9 @@ public:
 
 	void Initialize(vtkSmartPointer< vtkTable > tbl, bool val = false);
 	void ComputeDiffusionMap();
+	// Sparse mode: k-NN affinity graph and the leading num_eig eigenpairs only.
+	// Memory is linear in the number of objects times k.
+	void ComputeSparseDiffusionMap(unsigned int k = 15, unsigned int num_eig = 10);
 	vtkSmartPointer< vtkTable > GetKDiffusionNeighbors(std::vector<unsigned int> IDs, unsigned int k);
 
 private:
@@ -47,6 +64,10 @@ private:
 	std::map<int, int> rowIdMap, idRowMap; 
 	std::map< unsigned int, std::vector<double> > centroidMap;
 
+	std::vector< std::vector< std::pair<unsigned int, double> > > FeatureKNearestNeighbors(unsigned int k);
+	void BuildNormalizedAffinity(const std::vector< std::vector< std::pair<unsigned int, double> > > &neighbors, DiffusionSparseMatrix &affinity, vnl_vector<double> &degree);
+	void LanczosLargestEigenpairs(const DiffusionSparseMatrix &op, unsigned int num_eig, vnl_vector<double> &vals, vnl_matrix<double> &vecs);
+
 };
 
 #endif
@@ -4,6 +4,8 @@
 #include <vtkVariant.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdio.h>
+#include <vxl_config.h>
 #include <mbl/mbl_stats_nd.h>
 #include <boost/graph/prim_minimum_spanning_tree.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
@@ -2614,84 +2616,237 @@ double SPDAnalysisModel::EarthMoverDistance(vnl_vector<unsigned int>& first, vnl
 	return result;
 }
 
+/// The same cost as transportSimplex with the ground distance Dist (or OnedirectDist): along a line the
+/// cheapest transport moves, across every boundary between two bins, exactly the difference of the cumulative
+/// distributions, so the cost is the sum of those differences (only the ones to be moved back for one direction).
+/// Like the simplex, an empty histogram costs nothing.
+double SPDAnalysisModel::EarthMoverDistance(vnl_vector<unsigned int>& first, vnl_vector<unsigned int>& second, bool bOneDirection)
+{
+	unsigned int first_sum = first.sum();
+	unsigned int second_sum = second.sum();
+	if( first_sum == 0 || second_sum == 0)
+	{
+		return 0;
+	}
+
+	unsigned int size = first.size() > second.size() ? first.size() : second.size();
+	double firstCdf = 0;
+	double secondCdf = 0;
+	double result = 0;
+	for( unsigned int i = 0; i + 1 < size; i++)
+	{
+		if( i < first.size())
+		{
+			firstCdf += (double)first[i] / first_sum;
+		}
+		if( i < second.size())
+		{
+			secondCdf += (double)second[i] / second_sum;
+		}
+		double diff = secondCdf - firstCdf;
+		if( bOneDirection)
+		{
+			result += diff > 0 ? diff : 0;
+		}
+		else
+		{
+			result += fabs(diff);
+		}
+	}
+	return result;
+}
+
+/// The key of the EMD matrix: 64-bit FNV-1a of the module data, the modules, their MSTs and the bins
+std::string SPDAnalysisModel::GetEMDMatrixKey(int numBin)
+{
+	const vxl_uint_64 prime = ((vxl_uint_64)0x100 << 32) | 0x1b3;
+	vxl_uint_64 hash = ((vxl_uint_64)0xcbf29ce4 << 32) | 0x84222325;
+	std::vector< const unsigned char *> pieces;
+	std::vector< size_t> pieceBytes;
+
+	unsigned int header[4] = { this->MatrixAfterCellCluster.rows(), this->MatrixAfterCellCluster.cols(), this->ClusterIndex.size(), (unsigned int)numBin};
+	pieces.push_back( (const unsigned char *)header);
+	pieceBytes.push_back( sizeof(header));
+	pieces.push_back( (const unsigned char *)this->MatrixAfterCellCluster.data_block());
+	pieceBytes.push_back( this->MatrixAfterCellCluster.size() * sizeof(double));
+	pieces.push_back( (const unsigned char *)this->ClusterIndex.data_block());
+	pieceBytes.push_back( this->ClusterIndex.size() * sizeof(unsigned int));
+
+	std::vector< unsigned int> mstSize( this->ModuleMST.size());
+	for( unsigned int i = 0; i < this->ModuleMST.size(); i++)
+	{
+		mstSize[i] = this->ModuleMST[i].size();
+		if( mstSize[i] > 0)
+		{
+			pieces.push_back( (const unsigned char *)&this->ModuleMST[i][0]);
+			pieceBytes.push_back( mstSize[i] * sizeof(boost::graph_traits<Graph>::vertex_descriptor));
+		}
+	}
+	if( mstSize.size() > 0)
+	{
+		pieces.push_back( (const unsigned char *)&mstSize[0]);
+		pieceBytes.push_back( mstSize.size() * sizeof(unsigned int));
+	}
+
+	for( unsigned int k = 0; k < pieces.size(); k++)
+	{
+		for( size_t b = 0; b < pieceBytes[k]; b++)
+		{
+			hash ^= pieces[k][b];
+			hash *= prime;
+		}
+	}
+
+	char text[20];
+	sprintf(text, "%08lx%08lx", (unsigned long)(hash >> 32), (unsigned long)(hash & 0xffffffff));
+	return std::string(text);
+}
+
+bool SPDAnalysisModel::ReadEMDMatrixCache(QString cacheName, std::string key)
+{
+	std::ifstream ifs( cacheName.toStdString().c_str(), std::ifstream::in);
+	if( !ifs.is_open())
+	{
+		return false;
+	}
+
+	std::string fileKey;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	ifs>> fileKey>> rows>> cols;
+	if( !ifs.good() || fileKey != key || rows != this->EMDMatrix.rows() || cols != this->EMDMatrix.cols())
+	{
+		return false;
+	}
+
+	vnl_matrix<double> cached( rows, cols);
+	for( unsigned int i = 0; i < rows; i++)
+	{
+		for( unsigned int j = 0; j < cols; j++)
+		{
+			ifs>> cached( i, j);
+		}
+	}
+	if( ifs.fail())
+	{
+		return false;
+	}
+	this->EMDMatrix = cached;
+	return true;
+}
+
+void SPDAnalysisModel::WriteEMDMatrixCache(QString cacheName, std::string key)
+{
+	std::ofstream ofs( cacheName.toStdString().c_str(), std::ofstream::out);
+	ofs.precision(17);
+	ofs<< key<< "\t"<< this->EMDMatrix.rows()<< "\t"<< this->EMDMatrix.cols()<< std::endl;
+	for( unsigned int i = 0; i < this->EMDMatrix.rows(); i++)
+	{
+		for( unsigned int j = 0; j < this->EMDMatrix.cols(); j++)
+		{
+			ofs<< this->EMDMatrix( i, j)<< "\t";
+		}
+		ofs<< std::endl;
+	}
+	ofs.close();
+}
+
+/// The EMD between the distance histogram of every module and the histogram of the same distances along the
+/// MST of every other module. The pairs are matched in one parallel loop with the closed form of the EMD, and
+/// the matrix is kept in "<filename>EMD_cache.txt" to be reused as long as the modules and MSTs do not change.
 void SPDAnalysisModel::RunEMDAnalysis(int numBin)
 {
 	std::ofstream ofs("EMD.txt");
 	ofs.precision(4);
 	vnl_vector<int> moduleSize = GetModuleSize( this->ClusterIndex);
+	int moduleNum = this->ClusterIndex.max_value() + 1;
 
-	/** Generating the distance vector for module data and its MST data */
-	std::vector<vnl_vector<double> > moduleDistance;
-	moduleDistance.resize( this->ModuleMST.size());
+	this->EMDMatrix.set_size( moduleNum, moduleNum);
+	this->EMDMatrix.fill(0);
+	this->DistanceEMDVector.set_size( moduleNum);
+	this->DistanceEMDVector.fill(0);
 
-	#pragma omp parallel for
-	for( int i = 0; i <= this->ClusterIndex.max_value(); i++)
+	QString cacheName = this->filename + "EMD_cache.txt";
+	std::string key = GetEMDMatrixKey( numBin);
+	if( ReadEMDMatrixCache( cacheName, key))
 	{
-		vnl_vector<double> distance;
-		std::cout<< "build module distance "<< i<<endl;
-		vnl_matrix<double> clusterData( this->MatrixAfterCellCluster.rows(), moduleSize[i]);
-		GetCombinedMatrix( this->MatrixAfterCellCluster, this->ClusterIndex, i, i, clusterData);    /// Get the module data for cluster i
-		GetMatrixDistance( clusterData, distance, CITY_BLOCK);
-		moduleDistance[i] = distance;
+		std::cout<< "EMD matrix read from "<< cacheName.toStdString()<<endl;
 	}
+	else
+	{
+		/** Generating the distance vector for module data and its MST data */
+		std::vector<vnl_vector<double> > moduleDistance;
+		moduleDistance.resize( this->ModuleMST.size());
 
-	this->EMDMatrix.set_size( this->ClusterIndex.max_value() + 1, this->ClusterIndex.max_value() + 1);
-	this->EMDMatrix.fill(0);
-	this->DistanceEMDVector.set_size( this->ClusterIndex.max_value() + 1);
-	this->DistanceEMDVector.fill(0);
+		#pragma omp parallel for
+		for( int i = 0; i < moduleNum; i++)
+		{
+			vnl_vector<double> distance;
+			std::cout<< "build module distance "<< i<<endl;
+			vnl_matrix<double> clusterData( this->MatrixAfterCellCluster.rows(), moduleSize[i]);
+			GetCombinedMatrix( this->MatrixAfterCellCluster, this->ClusterIndex, i, i, clusterData);    /// Get the module data for cluster i
+			GetMatrixDistance( clusterData, distance, CITY_BLOCK);
+			moduleDistance[i] = distance;
+		}
 
-	for( int i = 0; i < moduleDistance.size(); i++)
-	{
-		if( i % 100 == 0)
+		/// histogram of every module, and the modules to match
+		std::vector< vnl_vector<double> > histInterval( moduleDistance.size());
+		std::vector< vnl_vector<unsigned int> > moduleHist( moduleDistance.size());
+		std::vector< char> bMatch( moduleDistance.size(), 1);
+
+		#pragma omp parallel for
+		for( int i = 0; i < (int)moduleDistance.size(); i++)
 		{
-			std::cout<< "matching module " << i<<endl;
+			Hist( moduleDistance[i], numBin, histInterval[i], moduleHist[i]);
+			unsigned int sumHist = moduleHist[i].sum();
+			for(unsigned int k = 0; k < moduleHist[i].size(); k++)
+			{
+				if(moduleHist[i][k] >= sumHist * 0.9)
+				{
+					bMatch[i] = 0;
+					break;
+				}
+			}
 		}
-		vnl_vector<double> hist_interval;
-		vnl_vector<unsigned int> moduleHist;
-		Hist( moduleDistance[i], numBin, hist_interval, moduleHist);
-		ofs<< moduleHist<< endl;
 
-		bool bMatch = true;
-		unsigned int sumHist = moduleHist.sum();
-		for(unsigned int k = 0; k < moduleHist.size(); k++)
+		std::vector< int> matchModule;
+		for( int i = 0; i < (int)moduleDistance.size(); i++)
 		{
-			if(moduleHist[k] >= sumHist * 0.9)
+			ofs<< moduleHist[i]<< endl;
+			if( bMatch[i])
+			{
+				matchModule.push_back(i);
+			}
+			else
 			{
-				bMatch = false;
 				std::cout<< "Remove module "<<i<<std::endl;
-				break;
 			}
 		}
 
-		if( bMatch)
+		/// all the pairs in one loop, every thread reusing its own buffers
+		int moduleCount = moduleDistance.size();
+		int pairNum = matchModule.size() * moduleCount;
+		#pragma omp parallel
 		{
-			#pragma omp parallel for
-			for( int j = 0; j < moduleDistance.size(); j++)
-			{	
-				vnl_vector<double> mstDistance; 
-				GetMSTMatrixDistance( moduleDistance[i], this->ModuleMST[j], mstDistance);  // get mst j distance from module i's distance matrix
-				vnl_vector<unsigned int> mstHist;
-				Hist( mstDistance, hist_interval, mstHist); 
+			vnl_vector<double> mstDistance;
+			vnl_vector<unsigned int> mstHist;
 
-				ofs<< mstHist<< endl;
-
-				vnl_matrix<double> flowMatrix( numBin, numBin);
-				double earth = EarthMoverDistance( moduleHist, mstHist, flowMatrix, numBin);
+			#pragma omp for schedule(dynamic, 64)
+			for( int k = 0; k < pairNum; k++)
+			{
+				int i = matchModule[ k / moduleCount];
+				int j = k % moduleCount;
+				if( j == 0 && ( k / moduleCount) % 100 == 0)
+				{
+					std::cout<< "matching module " << i<<endl;
+				}
+				GetMSTMatrixDistance( moduleDistance[i], this->ModuleMST[j], mstDistance);  // get mst j distance from module i's distance matrix
+				Hist( mstDistance, histInterval[i], mstHist);
+				double earth = EarthMoverDistance( moduleHist[i], mstHist);
 				this->EMDMatrix( i, j) = earth > 0 ? earth : 0;
 			}
-
-			///// matching with distance to device
-			//if( disCor != 0)
-			//{
-			//	std::cout<< "matching module " << i<< " with distance MST "<<endl;
-			//	vnl_vector<double> mstDistance; 
-			//	GetMSTMatrixDistance( moduleDistance[i], this->DistanceMST, mstDistance);  // get mst j distance from module i's distance matrix
-			//	vnl_vector<unsigned int> mstHist;    
-			//	Hist( mstDistance, hist_interval, mstHist); 
-			//	vnl_matrix<double> flowMatrix( numBin, numBin);
-			//	this->DistanceEMDVector[ i] = EarthMoverDistance( moduleHist, mstHist, flowMatrix, numBin);
-			//}
 		}
+		WriteEMDMatrixCache( cacheName, key);
 	}
 
 	moduleForSelection.clear();
@@ -3921,8 +4076,7 @@ void SPDAnalysisModel::ModuleCorrelationMatrixMatch(unsigned int kNeighbor, int
 				vnl_vector<unsigned int> histMod, histNear;
 				Hist(modDisti, interval, min, histMod, nbins); 
 				Hist(nearWeights, interval, min, histNear, nbins);
-				vnl_matrix<double> flowMatrix( nbins, nbins);
-				disScale[i] = EarthMoverDistance( histMod, histNear, flowMatrix, nbins, true);
+				disScale[i] = EarthMoverDistance( histMod, histNear, true);
 				disMatrixPtList[i] = modDisti;
 				kNearIndex[i] = nearIndex;
 			}
@@ -3969,8 +4123,7 @@ void SPDAnalysisModel::ModuleCorrelationMatrixMatch(unsigned int kNeighbor, int
 					
 					GetKWeights( disMatrixPtList[i], kNearIndex[j], matchWeights, kNeighbor);
 					Hist( matchWeights, interval, min, histj, nbins);
-					vnl_matrix<double> flowMatrix( nbins, nbins);
-					double earth = EarthMoverDistance( histModi, histj, flowMatrix, nbins, true);
+					double earth = EarthMoverDistance( histModi, histj, true);
 					row[j] = earth > 0 ? earth : 0;
 					row[j] = row[j] / disScale[i];
 				}
@@ -4944,9 +5097,8 @@ void SPDAnalysisModel::ComputeDistributionDistance(vnl_matrix<unsigned int> &mat
 		vnl_vector<unsigned int> dis1 = mat.get_row(i);
 		for( int j = i + 1; j < mat.rows(); j++)
 		{
-			vnl_matrix<double> flowMatrix( nBinNum, nBinNum);
 			vnl_vector<unsigned int> dis2 = mat.get_row(j);
-			dismat( i, j) = EarthMoverDistance( dis1, dis2, flowMatrix);
+			dismat( i, j) = EarthMoverDistance( dis1, dis2);
 		}
 	}
 }
@@ -4962,9 +5114,8 @@ void SPDAnalysisModel::ComputeDistributionDistance(vnl_matrix<unsigned int> &mat
 		vnl_vector<unsigned int> dis1 = mat.get_row(i);
 		for( unsigned int j = i + 1; j < mat.rows(); j++)
 		{
-			vnl_matrix<double> flowMatrix( nBinNum, nBinNum);
 			vnl_vector<unsigned int> dis2 = mat.get_row(j);
-			moduleDistance[ind++] = EarthMoverDistance( dis1, dis2, flowMatrix);
+			moduleDistance[ind++] = EarthMoverDistance( dis1, dis2);
 		}
 	}
 }
@@ -5057,8 +5208,7 @@ void SPDAnalysisModel::RunEMDAnalysis( vnl_vector<double> &moduleDistance, int i
 		vnl_vector<unsigned int> mstHist;
 		Hist( mstDistance, hist_interval, mstHist); 
 
-		vnl_matrix<double> flowMatrix( NUM_BIN, NUM_BIN);
-		this->EMDMatrix( ind, j) = EarthMoverDistance( moduleHist, mstHist, flowMatrix);
+		this->EMDMatrix( ind, j) = EarthMoverDistance( moduleHist, mstHist);
 	}
 
 
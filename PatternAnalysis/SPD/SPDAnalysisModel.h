@@ -183,6 +183,7 @@ protected:
 
 	//double Dist(int *first, int *second);
 	static double EarthMoverDistance(vnl_vector<unsigned int>& first, vnl_vector<unsigned int>& second, vnl_matrix<double> &flowMatrix, int num_bin, bool bOneDirection = false);
+	static double EarthMoverDistance(vnl_vector<unsigned int>& first, vnl_vector<unsigned int>& second, bool bOneDirection = false);   // same cost, without the flow
 	bool IsExist(std::vector<unsigned int> vec, unsigned int value);
 	long int GetSelectedFeatures(vnl_vector< unsigned int> & index, std::vector<unsigned int> moduleID, std::set<long int>& featureSelectedIDs);
 	double VnlVecMultiply(vnl_vector<double> const &vec1, vnl_vector<double> const &vec2);
@@ -207,6 +208,9 @@ protected:
 	bool GenerateMST( vnl_matrix<double> &mat, bool bfirst);
 	void RunEMDAnalysis( vnl_vector<double> &moduleDistance, int ind);
 	void GetDiagnalMinMax(vnl_matrix<double> &mat, double &min, double &max);
+	bool ReadEMDMatrixCache(QString cacheName, std::string key);
+	void WriteEMDMatrixCache(QString cacheName, std::string key);
+	std::string GetEMDMatrixKey(int numBin);
 
 public:
 	std::vector< Tree> PublicTreeData;
@@ -1263,6 +1263,114 @@ vnl_matrix<double> MCLR::Test_Current_Model_w(vnl_matrix<double> testDataLocal,
 }
 
 
+//-----------------------------------------------------------------------------------------------------------------------------
+// Batch Prediction
+//-----------------------------------------------------------------------------------------------------------------------------
+
+// feats is a dense column-major block: feats[c*num_rows + r] is feature c of sample r,
+// which is the data block of the (features x samples) matrix passed to Test_Current_Model.
+// For every sample the most probable class (1-based) is written to prediction, or 0 when
+// its probability does not exceed threshold, and the probability itself to confidence.
+void MCLR::Test_Current_Model_Batch(const double *feats, int num_rows, const vnl_matrix<double> &m_w_matrix, double threshold, double *prediction, double *confidence)
+{
+	const int block_size = 256;
+	int num_feats = (int)m_w_matrix.rows() - 1;
+	int num_classes = (int)m_w_matrix.cols();
+	int num_blocks = (num_rows + block_size - 1) / block_size;
+
+	// class-major copy of w so that each class walks its weights contiguously
+	std::vector<double> w_t((num_feats+1)*num_classes);
+	for(int k=0; k<num_classes; ++k)
+		for(int c=0; c<=num_feats; ++c)
+			w_t[k*(num_feats+1)+c] = m_w_matrix(c,k);
+
+	#pragma omp parallel
+	{
+		std::vector<double> f(num_classes*block_size);
+
+		#pragma omp for schedule(dynamic)
+		for(int b=0; b<num_blocks; ++b)
+		{
+			int r0 = b*block_size;
+			int nr = MIN(block_size, num_rows - r0);
+
+			for(int k=0; k<num_classes; ++k)
+			{
+				const double *wk = &w_t[k*(num_feats+1)];
+				double *fk = &f[k*block_size];
+				for(int r=0; r<nr; ++r)
+					fk[r] = wk[0];
+				for(int c=0; c<num_feats; ++c)
+				{
+					const double *xc = feats + (size_t)c*num_rows + r0;
+					double wc = wk[c+1];
+					for(int r=0; r<nr; ++r)
+						fk[r] += wc * xc[r];
+				}
+			}
+
+			for(int r=0; r<nr; ++r)
+			{
+				// exp(f)/sum(exp(f)) is shift invariant, so subtract the max to avoid overflow
+				double max_f = f[r];
+				for(int k=1; k<num_classes; ++k)
+					max_f = MAX(max_f, f[k*block_size+r]);
+				double sum = 0;
+				int arg_max = 0;
+				for(int k=0; k<num_classes; ++k)
+				{
+					double e = exp(f[k*block_size+r] - max_f);
+					sum += e;
+					if(k == 0 || f[k*block_size+r] > f[arg_max*block_size+r])
+						arg_max = k;
+				}
+				double prob = exp(f[arg_max*block_size+r] - max_f) / sum;
+				confidence[r0+r] = prob;
+				prediction[r0+r] = (prob > threshold) ? arg_max+1 : 0;
+			}
+		}
+	}
+}
+
+
+// Builds the normalized column-major block for Test_Current_Model_Batch straight from the
+// named table columns, without going through a vtkVariant per value.
+std::vector<double> MCLR::Table_To_Column_Block(vtkSmartPointer<vtkTable> table, const std::vector<std::string> &columns, vnl_vector<double> vector_1, vnl_vector<double> vector_2)
+{
+	int num_rows = (int)table->GetNumberOfRows();
+	std::vector<double> block((size_t)num_rows*columns.size(), 0.0);
+
+	for(int c=0; c<(int)columns.size(); ++c)
+	{
+		double *dst = &block[(size_t)c*num_rows];
+		vtkAbstractArray *abstract_column = table->GetColumnByName(columns[c].c_str());
+		if(!abstract_column)
+			continue;
+		vtkDataArray *data_column = vtkDataArray::SafeDownCast(abstract_column);
+		if(data_column)
+		{
+			for(int r=0; r<num_rows; ++r)
+				dst[r] = data_column->GetTuple1(r);
+		}
+		else
+		{
+			for(int r=0; r<num_rows; ++r)
+				dst[r] = abstract_column->GetVariantValue(r).ToDouble();
+		}
+
+		if(c < (int)vector_1.size() && vector_1(c) > 0)
+		{
+			double std_dev = vector_1(c);
+			double mean = vector_2(c);
+			for(int r=0; r<num_rows; ++r)
+				dst[r] = (dst[r] - mean) / std_dev;
+		}
+	}
+
+	return block;
+}
+
+
 vnl_matrix <double> MCLR::tableToMatrix_w(vtkSmartPointer<vtkTable> table)
 {
 
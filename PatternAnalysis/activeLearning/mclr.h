@@ -15,6 +15,7 @@
 #include <vtkTable.h>
 #include <vtkSmartPointer.h>
 #include <vtkVariant.h>
+#include <vtkDataArray.h>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -98,6 +99,8 @@ public:
 	vnl_matrix<double> Normalize_F_Sum(vnl_matrix<double> f);
 	vnl_matrix<double> Test_Current_Model(vnl_matrix<double> testData);
 	vnl_matrix<double> Test_Current_Model_w(vnl_matrix<double> testData, vnl_matrix<double> m_w_matrix);
+	void Test_Current_Model_Batch(const double *feats, int num_rows, const vnl_matrix<double> &m_w_matrix, double threshold, double *prediction, double *confidence);
+	std::vector<double> Table_To_Column_Block(vtkSmartPointer<vtkTable> table, const std::vector<std::string> &columns, vnl_vector<double> vector_1, vnl_vector<double> vector_2);
 	vnl_matrix<double> GetActiveLearningMatrix(){ return m.w;};
 	model Get_Training_Model();
 	MCLR::model Get_Temp_Training_Model(int query,int label);
@@ -4,7 +4,7 @@
 ftkGTClustering::ftkGTClustering(){
 
 	this->repMaxIter = 10000; //5000;
-	this->repStoppingThr = 10^-16;
+	this->repStoppingThr = 1e-16;
 	this->repAlpha = 0.01;
 	this->repSurvivalThr = 0.25;
 }
@@ -105,6 +105,188 @@ void ftkGTClustering::ApplySurvivalThreshold(){
 	}
 }
 
+void ftkGTClustering::ComputeSparseCostMatrix(unsigned int k){
+
+	int num_samples = this->featureMatrix.rows();
+	int num_features = this->featureMatrix.columns();
+	if(k > (unsigned int)num_samples - 1)
+		k = num_samples - 1;
+
+	// k nearest neighbors of every sample, their squared distances turned into payoffs
+	std::vector< std::vector< std::pair<unsigned int, double> > > neighbors;
+	ftk::KNearestNeighbors(this->featureMatrix.data_block(), num_samples, num_features, k, neighbors);
+	for(int i = 0; i < num_samples; i++){
+		for(unsigned int n = 0; n < neighbors[i].size(); n++)
+			neighbors[i][n].second = vcl_exp(-1*this->repAlpha*vcl_sqrt(neighbors[i][n].second));
+	}
+
+	// symmetrize (union of both directions) and pack into CSR, diagonal stays 0
+	std::vector< std::vector< std::pair<unsigned int, double> > > adjacency(num_samples);
+	for(int i = 0; i < num_samples; i++){
+		for(unsigned int n = 0; n < neighbors[i].size(); n++){
+			adjacency[i].push_back(neighbors[i][n]);
+			adjacency[neighbors[i][n].first].push_back(std::make_pair((unsigned int)i, neighbors[i][n].second));
+		}
+		std::vector< std::pair<unsigned int, double> >().swap(neighbors[i]);
+	}
+
+	this->costMatrix.clear();
+	this->sparseRowPtr.assign(num_samples + 1, 0);
+	this->sparseColInd.clear();
+	this->sparseValues.clear();
+	for(int i = 0; i < num_samples; i++){
+		std::sort(adjacency[i].begin(), adjacency[i].end());
+		for(unsigned int n = 0; n < adjacency[i].size(); n++){
+			if(n > 0 && adjacency[i][n].first == adjacency[i][n-1].first)
+				continue;
+			this->sparseColInd.push_back(adjacency[i][n].first);
+			this->sparseValues.push_back(adjacency[i][n].second);
+		}
+		this->sparseRowPtr[i+1] = this->sparseColInd.size();
+		std::vector< std::pair<unsigned int, double> >().swap(adjacency[i]);
+	}
+}
+
+void ftkGTClustering::SparseMultiply(const vnl_vector<double> &x, vnl_vector<double> &y){
+
+	int num_samples = (int)this->sparseRowPtr.size() - 1;
+	y.set_size(num_samples);
+
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < num_samples; i++){
+		double sum = 0;
+		for(unsigned int n = this->sparseRowPtr[i]; n < this->sparseRowPtr[i+1]; n++)
+			sum += this->sparseValues[n]*x[this->sparseColInd[n]];
+		y[i] = sum;
+	}
+}
+
+void ftkGTClustering::RunSparseReplicatorDynamics(){
+
+	int num_strategies = (int)this->sparseRowPtr.size() - 1;
+	vnl_vector<double> initial_strategies(num_strategies, (double)1.0/num_strategies);
+	vnl_random random_gen; 	
+	
+	for(unsigned int i = 0; i < initial_strategies.size(); i++)
+		initial_strategies(i) += random_gen.drand64();
+	initial_strategies.normalize();
+	
+	vnl_vector<double> next_strategies = initial_strategies;
+	vnl_vector<double> current_strategies = initial_strategies;
+	vnl_vector<double> Cx(num_strategies);
+
+	int iter = 0;
+	while(true){
+
+		this->SparseMultiply(current_strategies, Cx);
+
+		double xTCx = dot_product(current_strategies, Cx);
+		if(xTCx <= 0){
+			this->exitMsg = std::string("EXIT: Population has no payoff. ");
+			break;
+		}
+		next_strategies = element_product(current_strategies, Cx);
+		next_strategies /= xTCx;
+		
+		double evolution_metric = (current_strategies - next_strategies).one_norm();
+		if(evolution_metric < this->repStoppingThr){
+			this->exitMsg = std::string("EXIT: Evolution speed is below stoppingThreshold. ");
+			break;
+		}
+
+		current_strategies = next_strategies;
+		iter++;
+
+		if(iter > this->repMaxIter){
+			this->exitMsg = std::string("EXIT: Max iterations reached. ");
+			break;
+		}
+	}
+	this->repFinalPopulation = current_strategies;
+}
+
+// Infection/immunization dynamics (Rota Bulo, Pelillo and Bomze, 2011). Each step moves
+// the population towards the single strategy that best infects it, or away from the
+// weakest strategy in its support, with an exact line search. A step costs one sparse
+// column plus a scan of the payoffs instead of a full mat-vec.
+void ftkGTClustering::RunInfectionImmunizationDynamics(){
+
+	int num_strategies = (int)this->sparseRowPtr.size() - 1;
+	vnl_vector<double> x(num_strategies, (double)1.0/num_strategies);
+	vnl_vector<double> Cx(num_strategies);
+	this->SparseMultiply(x, Cx);
+
+	// a step is O(num_strategies), a replicator iteration O(nnz): give both the same budget
+	int avg_degree = num_strategies > 0 ? (int)(this->sparseValues.size()/num_strategies) + 1 : 1;
+	int max_steps = this->repMaxIter*avg_degree;
+
+	int iter = 0;
+	while(true){
+
+		double xTCx = dot_product(x, Cx);
+
+		// best infective strategy and weakest strategy in the support
+		int best = -1, worst = -1;
+		double best_gain = 0, worst_gain = 0, nash_error = 0;
+		for(int i = 0; i < num_strategies; i++){
+			double gain = Cx[i] - xTCx;
+			double e = vcl_min(x[i], -gain);
+			nash_error += e*e;
+			if(gain > best_gain){
+				best_gain = gain;
+				best = i;
+			}
+			if(x[i] > 0 && -gain > worst_gain){
+				worst_gain = -gain;
+				worst = i;
+			}
+		}
+		if(nash_error < this->repStoppingThr || (best < 0 && worst < 0)){
+			this->exitMsg = std::string("EXIT: Population is at equilibrium. ");
+			break;
+		}
+
+		// y - x = mu*(e_i - x); mu = 1 infects with i, mu < 0 immunizes against i
+		int i;
+		double mu;
+		if(best >= 0 && best_gain >= worst_gain){
+			i = best;
+			mu = 1;
+		}
+		else{
+			i = worst;
+			if(x[i] >= 1){
+				this->exitMsg = std::string("EXIT: Population is at equilibrium. ");
+				break;
+			}
+			mu = -x[i]/(1 - x[i]);
+		}
+
+		// (y-x)'C x = mu*(Cx_i - x'Cx), (y-x)'C(y-x) = mu^2*(x'Cx - 2*Cx_i) since C_ii = 0
+		double num = mu*(Cx[i] - xTCx);
+		double den = mu*mu*(xTCx - 2*Cx[i]);
+		double step = 1;
+		if(den < 0)
+			step = vcl_min(-num/den, 1.0);
+
+		double t = step*mu;
+		x *= (1 - t);
+		x[i] += t;
+		Cx *= (1 - t);
+		for(unsigned int n = this->sparseRowPtr[i]; n < this->sparseRowPtr[i+1]; n++)
+			Cx[this->sparseColInd[n]] += t*this->sparseValues[n];
+		if(x[i] < 0)
+			x[i] = 0;
+
+		iter++;
+		if(iter > max_steps){
+			this->exitMsg = std::string("EXIT: Max iterations reached. ");
+			break;
+		}
+	}
+	this->repFinalPopulation = x;
+}
+
 vnl_vector<double> ftkGTClustering::get_repFinalPopulation(){
 	return this->repFinalPopulation;
 }
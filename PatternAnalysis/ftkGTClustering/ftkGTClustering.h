@@ -6,8 +6,14 @@
 #include <vnl/vnl_random.h>
 #include <vcl_complex.h>
 #include <mbl/mbl_stats_nd.h>
+#include "ftkCommon/ftkKNearestNeighbors.h"
 
 #include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 class ftkGTClustering{
 
@@ -21,6 +27,12 @@ public:
 	void RunReplicatorDynamics();
 	void ApplySurvivalThreshold();
 
+	// Sparse variants: the payoff matrix only keeps the k nearest neighbors of each
+	// sample (symmetrized) in CSR form, so memory is linear in the number of samples.
+	void ComputeSparseCostMatrix(unsigned int k);
+	void RunSparseReplicatorDynamics();
+	void RunInfectionImmunizationDynamics();
+
 	void set_featureMatrix(vnl_matrix<double> feature_matrix);
 	void set_repMaxIter(int max_iter);
 	void set_repStoppingThr(double stopping_thr);
@@ -41,6 +53,12 @@ private:
 	double repAlpha;
 	double repSurvivalThr;
 	std::string exitMsg;
+
+	std::vector<unsigned int> sparseRowPtr;
+	std::vector<unsigned int> sparseColInd;
+	std::vector<double> sparseValues;
+
+	void SparseMultiply(const vnl_vector<double> &x, vnl_vector<double> &y);
 };
 
 #endif 
@@ -24,6 +24,9 @@ limitations under the License.
 #include <string.h>
 #include <stdarg.h>
 #include "svm.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 using std::cerr;
 using std::endl;
 typedef float Qfloat;
@@ -2614,6 +2617,291 @@ double svm_predict_probability(
 		return svm_predict(model, x);
 }
 
+//
+// Batch prediction
+//
+// The support vectors are expanded once into a dense feature-major array so
+// that kernel values for a block of rows against a block of SVs are computed
+// with contiguous inner loops over rows. Row blocks are independent and are
+// distributed over threads when OpenMP is enabled.
+//
+#define BATCH_ROWS 64
+#define BATCH_SV 128
+
+struct svm_batch_sv
+{
+	int dim;		// number of dense features
+	double *sv;		// sv[c*l + s] = feature c+1 of SV s
+	double *sv_tail;	// squared norm of features of SV s beyond dim
+};
+
+static void svm_batch_sv_init(svm_batch_sv *b, const svm_model *model, int dim)
+{
+	int l = model->l;
+	b->dim = dim;
+	b->sv = Malloc(double,(size_t)l*dim);
+	b->sv_tail = Malloc(double,l);
+	memset(b->sv,0,sizeof(double)*(size_t)l*dim);
+	for(int s=0;s<l;s++)
+	{
+		b->sv_tail[s] = 0;
+		for(const svm_node *p=model->SV[s];p->index!=-1;++p)
+		{
+			if(p->index>=1 && p->index<=dim)
+				b->sv[(size_t)(p->index-1)*l+s] = p->value;
+			else
+				b->sv_tail[s] += p->value * p->value;
+		}
+	}
+}
+
+static void svm_batch_sv_free(svm_batch_sv *b)
+{
+	free(b->sv);
+	free(b->sv_tail);
+}
+
+// kvalue[s*nr + i] = K(row r0+i, SV s0+s) for ns SVs and nr rows
+static void svm_batch_kernel(const svm_model *model, const svm_batch_sv *b,
+	const double *x, int l, int r0, int nr, int s0, int ns, double *kvalue)
+{
+	const svm_parameter& param = model->param;
+	int nsv = model->l;
+	int s, i;
+	memset(kvalue,0,sizeof(double)*ns*nr);
+
+	if(param.kernel_type == RBF)
+	{
+		for(int c=0;c<b->dim;c++)
+		{
+			const double *xc = x + (size_t)c*l + r0;
+			const double *svc = b->sv + (size_t)c*nsv + s0;
+			for(s=0;s<ns;s++)
+			{
+				double v = svc[s];
+				double *ks = kvalue + s*nr;
+				for(i=0;i<nr;i++)
+				{
+					double d = xc[i] - v;
+					ks[i] += d*d;
+				}
+			}
+		}
+		for(s=0;s<ns;s++)
+		{
+			double tail = b->sv_tail[s0+s];
+			double *ks = kvalue + s*nr;
+			for(i=0;i<nr;i++)
+				ks[i] = exp(-param.gamma*(ks[i]+tail));
+		}
+		return;
+	}
+
+	for(int c=0;c<b->dim;c++)
+	{
+		const double *xc = x + (size_t)c*l + r0;
+		const double *svc = b->sv + (size_t)c*nsv + s0;
+		for(s=0;s<ns;s++)
+		{
+			double v = svc[s];
+			if(v == 0) continue;
+			double *ks = kvalue + s*nr;
+			for(i=0;i<nr;i++)
+				ks[i] += xc[i] * v;
+		}
+	}
+	if(param.kernel_type == LINEAR)
+		return;
+	for(s=0;s<ns*nr;s++)
+	{
+		if(param.kernel_type == POLY)
+			kvalue[s] = powi(param.gamma*kvalue[s]+param.coef0,param.degree);
+		else
+			kvalue[s] = tanh(param.gamma*kvalue[s]+param.coef0);
+	}
+}
+
+static bool svm_single_decision(const svm_model *model)
+{
+	return model->param.svm_type == ONE_CLASS ||
+	       model->param.svm_type == EPSILON_SVR ||
+	       model->param.svm_type == NU_SVR;
+}
+
+static int svm_get_nr_dec(const svm_model *model)
+{
+	if(svm_single_decision(model))
+		return 1;
+	return model->nr_class*(model->nr_class-1)/2;
+}
+
+// Decision values for rows [r0, r0+nr), written row-major into dec (nr x nr_dec)
+static void svm_batch_decision(const svm_model *model, const svm_batch_sv *b,
+	const double *x, int l, int r0, int nr, const int *sv_class, const int *pair_index,
+	double *kvalue, double *acc, double *dec)
+{
+	int nr_class = model->nr_class;
+	int nr_dec = svm_get_nr_dec(model);
+	bool single = svm_single_decision(model);
+	int i, p;
+
+	// acc[p*nr + i] accumulates decision p for row i in SV order, which is
+	// the same summation order as svm_predict_values
+	memset(acc,0,sizeof(double)*nr_dec*nr);
+	for(int s0=0;s0<model->l;s0+=BATCH_SV)
+	{
+		int ns = min(BATCH_SV,model->l-s0);
+		svm_batch_kernel(model,b,x,l,r0,nr,s0,ns,kvalue);
+		for(int s=0;s<ns;s++)
+		{
+			const double *ks = kvalue + s*nr;
+			if(single)
+			{
+				double coef = model->sv_coef[0][s0+s];
+				for(i=0;i<nr;i++)
+					acc[i] += coef * ks[i];
+				continue;
+			}
+			int a = sv_class[s0+s];
+			for(int o=0;o<nr_class;o++)
+			{
+				if(o == a) continue;
+				// coefficient of an SV of class a in the decision between a and o
+				double coef = model->sv_coef[o<a ? o : o-1][s0+s];
+				double *ap = acc + pair_index[min(a,o)*nr_class+max(a,o)]*nr;
+				for(i=0;i<nr;i++)
+					ap[i] += coef * ks[i];
+			}
+		}
+	}
+	for(p=0;p<nr_dec;p++)
+		for(i=0;i<nr;i++)
+			dec[i*nr_dec+p] = acc[p*nr+i] - model->rho[p];
+}
+
+static void svm_batch_run(const svm_model *model, const double *x, int l, int dim,
+	double *dec_values, double *labels)
+{
+	int nr_class = model->nr_class;
+	int nr_dec = svm_get_nr_dec(model);
+	int i, j, p;
+
+	if(model->param.kernel_type == PRECOMPUTED)
+	{
+		// no dense form for precomputed kernels: column c holds x[c], so
+		// column 0 is the serial number of the row
+		svm_node *node = Malloc(svm_node,dim+1);
+		for(i=0;i<l;i++)
+		{
+			for(int c=0;c<dim;c++)
+			{
+				node[c].index = c;
+				node[c].value = x[(size_t)c*l+i];
+			}
+			node[dim].index = -1;
+			if(dec_values)
+				svm_predict_values(model,node,dec_values+(size_t)i*nr_dec);
+			if(labels)
+				labels[i] = svm_predict(model,node);
+		}
+		free(node);
+		return;
+	}
+
+	svm_batch_sv b;
+	svm_batch_sv_init(&b,model,dim);
+
+	int *sv_class = Malloc(int,model->l);
+	int *pair_index = Malloc(int,nr_class*nr_class);
+	if(model->nSV != NULL)
+	{
+		int s = 0;
+		for(i=0;i<nr_class;i++)
+			for(j=0;j<model->nSV[i];j++)
+				sv_class[s++] = i;
+	}
+	else
+	{
+		for(i=0;i<model->l;i++)
+			sv_class[i] = 0;
+	}
+	p = 0;
+	for(i=0;i<nr_class;i++)
+		for(j=i+1;j<nr_class;j++)
+			pair_index[i*nr_class+j] = p++;
+
+	int nblocks = (l+BATCH_ROWS-1)/BATCH_ROWS;
+
+	#pragma omp parallel
+	{
+		double *kvalue = Malloc(double,BATCH_SV*BATCH_ROWS);
+		double *acc = Malloc(double,nr_dec*BATCH_ROWS);
+		double *dec = Malloc(double,nr_dec*BATCH_ROWS);
+		int *vote = Malloc(int,nr_class);
+
+		#pragma omp for schedule(dynamic)
+		for(int blk=0;blk<nblocks;blk++)
+		{
+			int r0 = blk*BATCH_ROWS;
+			int nr = min(BATCH_ROWS,l-r0);
+			svm_batch_decision(model,&b,x,l,r0,nr,sv_class,pair_index,kvalue,acc,dec);
+
+			if(dec_values)
+				memcpy(dec_values+(size_t)r0*nr_dec,dec,sizeof(double)*nr*nr_dec);
+			if(!labels)
+				continue;
+
+			for(int r=0;r<nr;r++)
+			{
+				const double *d = dec + r*nr_dec;
+				if(model->param.svm_type == ONE_CLASS)
+					labels[r0+r] = (d[0]>0)?1:-1;
+				else if(model->param.svm_type == EPSILON_SVR ||
+					model->param.svm_type == NU_SVR)
+					labels[r0+r] = d[0];
+				else
+				{
+					for(int c=0;c<nr_class;c++)
+						vote[c] = 0;
+					int pos = 0;
+					for(int c=0;c<nr_class;c++)
+						for(int o=c+1;o<nr_class;o++)
+						{
+							if(d[pos++] > 0)
+								++vote[c];
+							else
+								++vote[o];
+						}
+					int vote_max_idx = 0;
+					for(int c=1;c<nr_class;c++)
+						if(vote[c] > vote[vote_max_idx])
+							vote_max_idx = c;
+					labels[r0+r] = model->label[vote_max_idx];
+				}
+			}
+		}
+
+		free(kvalue);
+		free(acc);
+		free(dec);
+		free(vote);
+	}
+
+	free(sv_class);
+	free(pair_index);
+	svm_batch_sv_free(&b);
+}
+
+void svm_predict_values_batch(const svm_model *model, const double *x, int l, int dim, double *dec_values)
+{
+	svm_batch_run(model,x,l,dim,dec_values,NULL);
+}
+
+void svm_predict_batch(const svm_model *model, const double *x, int l, int dim, double *labels)
+{
+	svm_batch_run(model,x,l,dim,NULL,labels);
+}
+
 const char *svm_type_table[] =
 {
 	"c_svc","nu_svc","one_class","epsilon_svr","nu_svr",NULL
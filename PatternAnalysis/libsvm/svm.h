@@ -74,6 +74,10 @@ void svm_predict_values(const struct svm_model *model, const struct svm_node *x,
 double svm_predict(const struct svm_model *model, const struct svm_node *x);
 double svm_predict_probability(const struct svm_model *model, const struct svm_node *x, double* prob_estimates);
 
+/* Batch prediction on a dense column-major block: x[c*l + i] holds feature c+1 of row i. */
+void svm_predict_values_batch(const struct svm_model *model, const double *x, int l, int dim, double *dec_values);
+void svm_predict_batch(const struct svm_model *model, const double *x, int l, int dim, double *labels);
+
 void svm_destroy_model(struct svm_model *model);
 void svm_destroy_param(struct svm_parameter *param);
 
@@ -30,28 +30,23 @@ RollingBallFilter::RollingBallFilter(ImageType::Pointer input_img, float radius)
 
 void RollingBallFilter::RunFilter()
 {
-	//Structuring element
-	typedef itk::BinaryBallStructuringElement<ImageType::PixelType, 2> StructuringElementType;
-	StructuringElementType structuringElement;
-	structuringElement.SetRadius(radius);
-	structuringElement.CreateStructuringElement();
+	//Erode every slice with an octagon approximating the ball, in a time
+	//independent of the radius
+	ImageType::Pointer eroded_img = ImageType::New();
+	eroded_img->SetRegions(input_img->GetBufferedRegion());
+	eroded_img->SetOrigin(input_img->GetOrigin());
+	eroded_img->SetSpacing(input_img->GetSpacing());
+	eroded_img->Allocate();
 
-	//SliceBySliceFilter
-	typedef itk::SliceBySliceImageFilter< ImageType, ImageType > SliceBySliceFilterType;
-	SliceBySliceFilterType::Pointer SliceBySliceFilter = SliceBySliceFilterType::New();
-
-	//Erode Filter
-	typedef itk::GrayscaleErodeImageFilter< SliceBySliceFilterType::InternalInputImageType, SliceBySliceFilterType::InternalOutputImageType, StructuringElementType > GrayscaleErodeImageFilter; //This filter takes the minimum of all the neighboring values and puts it into the pixel location
-	GrayscaleErodeImageFilter::Pointer ErodeFilter = GrayscaleErodeImageFilter::New(); 
-	ErodeFilter->SetKernel(structuringElement);
-	SliceBySliceFilter->SetInput(input_img);
-	SliceBySliceFilter->SetFilter(ErodeFilter);
+	ImageType::SizeType size = input_img->GetBufferedRegion().GetSize();
+	int image_size[3] = { (int)size[0], (int)size[1], (int)size[2] };
+	ftk::DiskErode(input_img->GetBufferPointer(), eroded_img->GetBufferPointer(), image_size, (int)radius);
 
 	//Subtract Filter
 	typedef itk::SubtractImageFilter< ImageType, ImageType, ImageType > SubtractFilterType;
 	SubtractFilterType::Pointer Subtractfilter = SubtractFilterType::New();
 	Subtractfilter->SetInput1(input_img);
-	Subtractfilter->SetInput2(SliceBySliceFilter->GetOutput()); //Note that the SliceBySliceFilter output is a 3D image again
+	Subtractfilter->SetInput2(eroded_img);
 	
 	try
 	{
@@ -2,12 +2,9 @@
 #define __ROLLING_BALL_FILTER_H
 
 #include "itkSubtractImageFilter.h"
-#include "itkGrayscaleErodeImageFilter.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
-#include "itkSliceBySliceImageFilter.h"
-#include "itkBinaryBallStructuringElement.h"
-#include "itkStreamingImageFilter.h"
+#include "ftkCommon/ftkRankFilters.h"
 
 class RollingBallFilter
 {
@@ -19,6 +19,12 @@ limitations under the License.
 #include "mdlMST.h"
 #include "mdlVolumeProcess.h"
 
+#include <algorithm>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
 namespace mdl
 {
 
@@ -35,6 +41,7 @@ MST::MST(ImageType::Pointer inImage)
 
 	debug = false;
 	useVoxelRounding = true;
+	useEuclideanMST = false;
 	edgeRange = 10;		//Some default values:
 	power = 1;
 	PruneThreshold = 4.0;
@@ -215,6 +222,83 @@ void drawLine(itk::Image< itk::Vector<unsigned char, 3> , 3>::Pointer input, itk
 	//printf("\n");
 }
 
+//Nodes binned into a grid of cubes, for finding the nodes close to a node
+//without comparing it to all the others
+class NodeGrid
+{
+public:
+	NodeGrid(const std::vector<fPoint3D> & nodes, int cellSize) : nodes(nodes)
+	{
+		this->cellSize = cellSize > 0 ? cellSize : 1;
+		minX = maxX = minY = maxY = minZ = maxZ = 0;
+		numX = numY = 1;
+		if(!nodes.empty())
+		{
+			minX = maxX = nodes[0].x;
+			minY = maxY = nodes[0].y;
+			minZ = maxZ = nodes[0].z;
+		}
+		for(int i=1; i<(int)nodes.size(); ++i)
+		{
+			minX = std::min(minX, nodes[i].x); maxX = std::max(maxX, nodes[i].x);
+			minY = std::min(minY, nodes[i].y); maxY = std::max(maxY, nodes[i].y);
+			minZ = std::min(minZ, nodes[i].z); maxZ = std::max(maxZ, nodes[i].z);
+		}
+		if(!nodes.empty())
+		{
+			numX = (long)Cell(maxX, minX) + 1;
+			numY = (long)Cell(maxY, minY) + 1;
+		}
+
+		//The nodes sorted by cell, and by index within a cell
+		cells.resize(nodes.size());
+		for(int i=0; i<(int)nodes.size(); ++i)
+			cells[i] = std::pair<long,int>(Key(Cell(nodes[i].x,minX), Cell(nodes[i].y,minY), Cell(nodes[i].z,minZ)), i);
+		std::sort(cells.begin(), cells.end());
+	};
+
+	//Nodes j < i in the cell of node i and the 26 cells around it, in increasing j
+	void GetCandidates(int i, std::vector<int> & candidates) const
+	{
+		candidates.clear();
+		const int cx = Cell(nodes[i].x, minX);
+		const int cy = Cell(nodes[i].y, minY);
+		const int cz = Cell(nodes[i].z, minZ);
+		for(int z=cz-1; z<=cz+1; ++z)
+			for(int y=cy-1; y<=cy+1; ++y)
+				for(int x=cx-1; x<=cx+1; ++x)
+				{
+					if(x < 0 || x >= numX || y < 0 || y >= numY || z < 0)
+						continue;
+					std::vector< std::pair<long,int> >::const_iterator it =
+						std::lower_bound(cells.begin(), cells.end(), std::pair<long,int>(Key(x,y,z), 0));
+					for(; it != cells.end() && it->first == Key(x,y,z) && it->second < i; ++it)
+						candidates.push_back(it->second);
+				}
+		std::sort(candidates.begin(), candidates.end());
+	};
+
+private:
+	int Cell(float v, float minV) const { return (int)floor((v - minV) / cellSize); };
+	long Key(int x, int y, int z) const { return x + numX*(y + numY*(long)z); };
+
+	const std::vector<fPoint3D> & nodes;
+	int cellSize;
+	float minX, maxX, minY, maxY, minZ, maxZ;
+	long numX, numY;
+	std::vector< std::pair<long,int> > cells;
+};
+
+//Orders edge indices by weight
+class LighterEdge
+{
+public:
+	LighterEdge(const std::vector<float> & weights) : weights(weights) {};
+	bool operator()(long a, long b) const { return weights[a] < weights[b]; };
+private:
+	const std::vector<float> & weights;
+};
+
 //I'm going to convert the nodes into edges and edge weights.
 //I only make edges between nodes that are within the edgeRange
 bool MST::nodesToEdges(int type)
@@ -340,51 +424,140 @@ bool MST::nodesToEdges(int type)
 		return true;
 	}
 
-	//Iterate through the nodes and create edges within the specified range.
-	for(int i=0; i<num_nodes; ++i)
+	//Only nodes in the same or in neighbouring cells of a grid of cubes of side
+	//edgeRange+1 can be within the range of each other, so only those are compared.
+	//The edges of node i still go to the nodes j<i in increasing j, so the edges and
+	//their order are those of comparing all the pairs.
+	NodeGrid grid(nodes, edgeRange+1);
+
+	//The nodes are split into chunks processed in parallel, and the edges of the
+	//chunks are appended in order afterwards
+	int numChunks = 1;
+	#ifdef _OPENMP
+	numChunks = 8*omp_get_max_threads();
+	#endif
+	if(numChunks > num_nodes)
+		numChunks = num_nodes;
+	std::vector< std::vector<pairE> > chunkEdges(numChunks);
+	std::vector< std::vector<float> > chunkWeights(numChunks);
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic,1)
+	#endif
+	for(int c=0; c<numChunks; ++c)
 	{
-		
-		//for(int j=1; j<i; ++j)
-		for(int j=0; j<i; ++j)
+		std::vector<int> candidates;
+		const int first = (int)((long)num_nodes*c/numChunks);
+		const int last = (int)((long)num_nodes*(c+1)/numChunks);
+		for(int i=first; i<last; ++i)
 		{
-			fPoint3D n1 = nodes.at(i);
-			fPoint3D n2 = nodes.at(j);
+			grid.GetCandidates(i, candidates);
+			for(int k=0; k<(int)candidates.size(); ++k)
+			{
+				const int j = candidates[k];
+				fPoint3D n1 = nodes.at(i);
+				fPoint3D n2 = nodes.at(j);
 
-			if( abs(n1.x - n2.x) > (float)edgeRange )
-				continue;
-			if( abs(n1.y - n2.y) > (float)edgeRange )
-				continue;
-			if( abs(n1.z - n2.z) > (float)edgeRange )
+				if( abs(n1.x - n2.x) > (float)edgeRange )
+					continue;
+				if( abs(n1.y - n2.y) > (float)edgeRange )
+					continue;
+				if( abs(n1.z - n2.z) > (float)edgeRange )
+					continue;
+
+				//If I'm here, then I've found a close enough node
+				chunkEdges[c].push_back( pairE(i+1,j+1) ); //add an edge (count starts at 1 for nodes)
+
+				float weight = 10000;
+				if(useEuclideanMST)
+				{
+					float dx = n1.x - n2.x;
+					float dy = n1.y - n2.y;
+					float dz = n1.z - n2.z;
+					weight = (float)sqrt(float(dx*dx + dy*dy + dz*dz));
+				}
+				else if(type == 1)
+				{
+					weight = getXiaosongEdgeWeight(n1, n2, power);
+				}
+				else if(type == 2)
+				{
+					weight = getEdgeWeight(n1, n2, dtImage);
+				}
+				else if(type == 3)
+				{
+					weight = getEdgeWeight(n1, n2, m_inputImage); //(doesn't use power parameter)
+				}
+				else if(type == 4)
+				{
+					weight = getGeodesicEdgeWeight(n1, n2, m_inputImage);
+				}
+				chunkWeights[c].push_back(weight);
+			}//end for k
+		}//end for i
+	}//end for c
+
+	long numCandidates = 0;
+	for(int c=0; c<numChunks; ++c)
+		numCandidates += (long)chunkEdges[c].size();
+
+	if(useEuclideanMST)
+	{
+		//Kruskal right here: only the edges of the spanning forest are kept, so the
+		//graph built in minimumSpanningTree() has fewer edges than nodes
+		std::vector<pairE> candidateEdges;
+		std::vector<float> candidateWeights;
+		candidateEdges.reserve(numCandidates);
+		candidateWeights.reserve(numCandidates);
+		for(int c=0; c<numChunks; ++c)
+		{
+			candidateEdges.insert(candidateEdges.end(), chunkEdges[c].begin(), chunkEdges[c].end());
+			candidateWeights.insert(candidateWeights.end(), chunkWeights[c].begin(), chunkWeights[c].end());
+			std::vector<pairE>().swap(chunkEdges[c]);
+			std::vector<float>().swap(chunkWeights[c]);
+		}
+
+		std::vector<long> order(numCandidates);
+		for(long e=0; e<numCandidates; ++e)
+			order[e] = e;
+		std::stable_sort(order.begin(), order.end(), LighterEdge(candidateWeights));
+
+		std::vector<int> parent(num_nodes+1);
+		for(int n=0; n<=num_nodes; ++n)
+			parent[n] = n;
+		int numTreeEdges = 0;
+		for(long e=0; e<numCandidates && numTreeEdges < num_nodes-1; ++e)
+		{
+			const pairE & edge = candidateEdges[order[e]];
+			int r1 = edge.first;
+			while(parent[r1] != r1)
+				r1 = parent[r1] = parent[parent[r1]];
+			int r2 = edge.second;
+			while(parent[r2] != r2)
+				r2 = parent[r2] = parent[parent[r2]];
+			if(r1 == r2)
 				continue;
+			parent[r1] = r2;
+			++numTreeEdges;
+			edgeArray.push_back(edge);
+			edgeWeight.push_back(candidateWeights[order[e]]);
+		}
+	}
+	else
+	{
+		edgeArray.reserve(numCandidates);
+		edgeWeight.reserve(numCandidates);
+		for(int c=0; c<numChunks; ++c)
+		{
+			edgeArray.insert(edgeArray.end(), chunkEdges[c].begin(), chunkEdges[c].end());
+			edgeWeight.insert(edgeWeight.end(), chunkWeights[c].begin(), chunkWeights[c].end());
+			std::vector<pairE>().swap(chunkEdges[c]);
+			std::vector<float>().swap(chunkWeights[c]);
+		}
+	}
 
-			//If I'm here, then I've found a close enough node
-			edgeArray.push_back( pairE(i+1,j+1) ); //add an edge (count starts at 1 for nodes)
-			
-			float weight = 10000;
-			if(type == 1)
-			{
-				weight = getXiaosongEdgeWeight(n1, n2, power);
-			}
-			else if(type == 2)
-			{
-				weight = getEdgeWeight(n1, n2, dtImage);
-			}
-			else if(type == 3)
-			{
-				weight = getEdgeWeight(n1, n2, m_inputImage); //(doesn't use power parameter)
-			}
-			else if(type == 4)
-			{
-				weight = getGeodesicEdgeWeight(n1, n2, m_inputImage);
-			}
-			else if(type == 5)
-			{
-				weight = getFastMarchingEdgeWeight(n1,n2, m_inputImage);
-			}
-			edgeWeight.push_back(weight);
-		}//end for j
-		
-	}//end for i
+	if(debug)
+		std::cerr << "Candidate edges = " << numCandidates << std::endl;
 
 	
 
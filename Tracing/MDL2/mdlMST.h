@@ -52,6 +52,9 @@ public:
 	void SetDebug(bool inp = true){ debug = inp; };
 	void SetUseVoxelRounding(bool inp = true){useVoxelRounding = inp;};
 	void SetEdgeRange(int edge){ edgeRange = edge; };
+	//Weight the edges by their length only and keep only the edges of the minimum
+	//spanning forest. The tree is the same as with type 1 and a power below 0.1.
+	void SetUseEuclideanMST(bool inp = true){ useEuclideanMST = inp; };
 	void SetAlpha(double alpha){Alpha = alpha;}	//For spines
 	void SetPower(int p){ power = p; };
 	void SetPruneThreshold(double p){PruneThreshold = p;}
@@ -82,6 +85,7 @@ private:
 	//Parameters
 	bool   debug;				//If debug is true, process in steps and print stuff
 	bool   useVoxelRounding;  //Round Nodes to nearest integer (or voxel)
+	bool   useEuclideanMST;   //Edge weights are lengths, edges reduced to the MST
 	int    edgeRange;
 	double power;
 	double Alpha;
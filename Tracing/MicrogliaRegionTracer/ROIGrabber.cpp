@@ -34,7 +34,6 @@ ROIGrabber::ImageType::Pointer ROIGrabber::GetROI(const Cell & cell, const Image
 	else 
 		shift_index[2] = 0;
 	
-	this->roi_filter.setROI(roi_origin, roi_size);	//Set the ROI
-
-	return this->roi_filter.getROI();				//Get the ROI and return as itkImage
+	//Get the ROI and return as itkImage, safe to call from several threads
+	return this->roi_filter.getImageManager()->MutexGetRegionOfInterest(roi_origin, roi_size);
 }
\ No newline at end of file
@@ -10,9 +10,16 @@ Curvelet::Curvelet()
 	this->tuning_neighb = .6;
 	this->sigma_ratio = 0.03;
 	this->numt = 16;
+#ifdef _OPENMP
+	this->numt = omp_get_max_threads();
+#endif
 	this->tile_size = 4024;
 	this->border = 100;
 	this->slices = 0;
+	this->ac = 1;
+	this->nshifts = 1;
+	this->compute_orientation = false;
+	this->max_memory = 0;
 
 	//this->InputImage = NULL;
 }
@@ -23,187 +30,193 @@ void Curvelet::SetSigma(float sigma)
 {
 	this->sigma_ratio = sigma;
 }
+void Curvelet::SetNumberOfThreads(int n)
+{
+	this->numt = MAX(n,1);
+}
+void Curvelet::SetTileSize(int size, int border)
+{
+	this->tile_size = size;
+	this->border = border;
+}
+void Curvelet::SetMaxMemory(double megabytes)
+{
+	this->max_memory = megabytes;
+}
+void Curvelet::SetComputeOrientation(bool compute)
+{
+	this->compute_orientation = compute;
+}
+FloatImageType::Pointer Curvelet::GetCosineImage()
+{
+	return this->cosImage;
+}
+FloatImageType::Pointer Curvelet::GetSineImage()
+{
+	return this->sinImage;
+}
+//Tiles of at most tile pixels along an axis of size pixels, each starting step
+//pixels after the previous one, and the part [keep0,keep1) of each tile (in tile
+//coordinates) written to the output. Two neighbouring tiles split their actual
+//overlap in the middle, so the kept parts cover the axis exactly once.
+static void getTileSpans(int size, int tile, int step, vector<int> &start, vector<int> &length, vector<int> &keep0, vector<int> &keep1)
+{
+	start.clear();
+	length.clear();
+	keep0.clear();
+	keep1.clear();
+	step = MAX(MIN(step,tile),1);
+	for(int x0 = 0; ; x0 += step)
+	{
+		start.push_back(x0);
+		length.push_back(MIN(tile,size-x0));
+		if(x0+tile >= size)
+			break;
+	}
+	int n = (int)start.size();
+	int cut = 0;
+	for(int t = 0; t < n; t++)
+	{
+		int next = size;
+		if(t+1 < n)
+			next = (start[t+1] + start[t]+length[t]) / 2;	//middle of the overlap [start[t+1], start[t]+length[t])
+		keep0.push_back(cut - start[t]);
+		keep1.push_back(next - start[t]);
+		cut = next;
+	}
+	assert(cut == size);
+	for(int t = 0; t < n; t++)
+		assert(keep0[t] >= 0 && keep0[t] <= keep1[t] && keep1[t] <= length[t]);
+}
 InputImageType::Pointer Curvelet::RunOnInputImage(InputImageType::Pointer InputImage)
 {
 	//InputImage = NewInputImage;
-	slices = InputImage->GetLargestPossibleRegion().GetSize()[2];
+	InputImageType::SizeType imsize = InputImage->GetLargestPossibleRegion().GetSize();
+	slices = imsize[2];
 	InputImageType::Pointer outputim = InputImageType::New();
 	outputim->SetRegions(InputImage->GetLargestPossibleRegion());
 	outputim->Allocate();
-	FloatImageType::Pointer cosim = FloatImageType::New();
-	cosim->SetRegions(InputImage->GetLargestPossibleRegion());
-	cosim->Allocate();
-	FloatImageType::Pointer sinim = FloatImageType::New();
-	sinim->SetRegions(InputImage->GetLargestPossibleRegion());
-	sinim->Allocate();
-
-	if(outputim->GetBufferPointer() == NULL || cosim->GetBufferPointer() == NULL || sinim->GetBufferPointer() == NULL)
+	if(outputim->GetBufferPointer() == NULL)
 	{
 		printf("Couldnt' allocate memory - 3.. going to crash now\n");
 	}
-	int max_dim = tile_size;
-
-
-	int xsize = InputImage->GetLargestPossibleRegion().GetSize()[0];
-	int ysize = InputImage->GetLargestPossibleRegion().GetSize()[1];
-
-	int kx = 0;int ky = 0;
-
-
-	kx = xsize /(max_dim-this->border);
-	ky = ysize /(max_dim-this->border);
-
-	int remx = xsize % (max_dim-this->border);
-	int remy = ysize % (max_dim-this->border);
-
-	if ( remx > 0 )
-		kx ++;
-	if ( remy > 0 )
-		ky ++;
-
+	outputim->FillBuffer(0);
+	cosImage = NULL;
+	sinImage = NULL;
+	if(compute_orientation)
+	{
+		cosImage = FloatImageType::New();
+		cosImage->SetRegions(InputImage->GetLargestPossibleRegion());
+		cosImage->Allocate();
+		sinImage = FloatImageType::New();
+		sinImage->SetRegions(InputImage->GetLargestPossibleRegion());
+		sinImage->Allocate();
+		if(cosImage->GetBufferPointer() == NULL || sinImage->GetBufferPointer() == NULL)
+		{
+			printf("Couldnt' allocate memory - 3.. going to crash now\n");
+		}
+	}
+	int xsize = imsize[0];
+	int ysize = imsize[1];
+
+	//Every slice of every tile is transformed on its own, in parallel. The tiles
+	//overlap by border pixels, and a tile only keeps its pixels up to the middle
+	//of its overlaps with the tiles next to it, so every output pixel is written
+	//by exactly one tile and the result does not depend on the order of the tiles
+	//or the threads.
+	vector<int> spanx0, spanx, keepx0_1d, keepx1_1d;
+	vector<int> spany0, spany, keepy0_1d, keepy1_1d;
+	getTileSpans(xsize, tile_size, tile_size-this->border, spanx0, spanx, keepx0_1d, keepx1_1d);
+	getTileSpans(ysize, tile_size, tile_size-this->border, spany0, spany, keepy0_1d, keepy1_1d);
+	int kx = (int)spanx0.size();
+	int ky = (int)spany0.size();
+
+	vector<int> tilex0, tiley0, tilesizex, tilesizey;	//tile in the image
+	vector<int> keepx0, keepy0, keepx1, keepy1;			//kept part, in the tile
+	double slice_memory = 0;
 	for(int xco = 0; xco < kx; xco++)
 	{
 		for(int yco = 0; yco < ky; yco++)
 		{
+			tilex0.push_back(spanx0[xco]);
+			tiley0.push_back(spany0[yco]);
+			tilesizex.push_back(spanx[xco]);
+			tilesizey.push_back(spany[yco]);
+			keepx0.push_back(keepx0_1d[xco]);
+			keepy0.push_back(keepy0_1d[yco]);
+			keepx1.push_back(keepx1_1d[xco]);
+			keepy1.push_back(keepy1_1d[yco]);
+			slice_memory = MAX(slice_memory, getSliceMemory(spanx[xco],spany[yco]));
+		}
+	}
+	int ntiles = (int)tilex0.size();
 
-			InputImageType::SizeType imsize = InputImage->GetLargestPossibleRegion().GetSize();
-			InputImageType::IndexType index;
-			InputImageType::SizeType size;
-			InputImageType::RegionType region;
-
-			index.Fill(0);
-			size[0] =  MIN((xco)*(max_dim-this->border)+max_dim-1,imsize[0]-1) -  xco * (max_dim-this->border) +1;
-			size[1] =  MIN((yco)*(max_dim-this->border)+max_dim-1,imsize[1]-1) -  yco * (max_dim-this->border) +1;
-			size[2] = imsize[2];
-
-			InputImageType::Pointer imtile = InputImageType::New();
-			region.SetIndex(index);
-			region.SetSize(size);
-			imtile->SetRegions(region);
-			imtile->Allocate();
-			if(imtile->GetBufferPointer()==NULL)
-				printf("Couldn't allocate memory - 4 .. going to crash now\n");
-			InputImageType::RegionType region1;
-			index[0] = xco *(max_dim-this->border);
-			index[1] = yco *(max_dim-this->border);
-			index[2] = 0;
-			region1.SetIndex(index);
-			region1.SetSize(size);
-
-			typedef itk::ImageRegionIterator<InputImageType> IteratorType;
-			IteratorType iter1(InputImage,region1);
-			IteratorType iter2(imtile,region);
-
-
-			//printf("xco = %d yco = %d :\n",xco,yco);
-			region1.Print(std::cout);
-			region.Print(std::cout);
-
-			iter1.GoToBegin();
-			iter2.GoToBegin();
-			for(;!iter1.IsAtEnd();++iter1,++iter2)
-			{
-				iter2.Set(iter1.Get());
-			}
-
+	//Bound the number of slices in memory at the same time
+	int nthreads = numt;
+	if(max_memory > 0)
+	{
+		nthreads = MIN(nthreads, int(max_memory*1024*1024/slice_memory));
+		nthreads = MAX(nthreads, 1);
+	}
 
-			InputImageType::Pointer outputtile = InputImageType::New();
-			outputtile->SetRegions(imtile->GetLargestPossibleRegion());
-			outputtile->Allocate();
-			FloatImageType::Pointer cosimtile = FloatImageType::New();
-			cosimtile->SetRegions(imtile->GetLargestPossibleRegion());
-			cosimtile->Allocate();
-			FloatImageType::Pointer sinimtile = FloatImageType::New();
-			sinimtile->SetRegions(imtile->GetLargestPossibleRegion());
-			sinimtile->Allocate();
-			if(outputtile->GetBufferPointer() == NULL || cosimtile->GetBufferPointer()==NULL || sinimtile->GetBufferPointer() == NULL )
-			{
-				printf("Couldn't allocate memory - 5 .. going to crash now ..\n");
-			}
+	unsigned char * outbuffer = outputim->GetBufferPointer();
+	float * cosbuffer = compute_orientation ? cosImage->GetBufferPointer() : NULL;
+	float * sinbuffer = compute_orientation ? sinImage->GetBufferPointer() : NULL;
+	int nblocks = ntiles*slices;
+
+	//One workspace per thread, its buffers reserved for the largest tile
+	long maxtile = 0;
+	for(int tile = 0; tile < ntiles; tile++)
+		maxtile = MAX(maxtile, (long)tilesizex[tile]*tilesizey[tile]);
+	vector<SliceWorkspace> workspaces(nthreads);
+	for(int t = 0; t < nthreads; t++)
+	{
+		workspaces[t].tile.reserve(maxtile);
+		workspaces[t].om.reserve(maxtile);
+		if(compute_orientation)
+		{
+			workspaces[t].cosim.reserve(maxtile);
+			workspaces[t].sinim.reserve(maxtile);
+		}
+	}
 
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1) num_threads(nthreads)
+#endif
+	for(int block = 0; block < nblocks; block++)
+	{
+		int tile = block / slices;
+		int slice = block % slices;
+		int thread = 0;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+#endif
+		SliceWorkspace &ws = workspaces[thread];
+		getTile(InputImage,tilex0[tile],tiley0[tile],tilesizex[tile],tilesizey[tile],slice,ws.tile);
+		//call single slice 2-d curvelets function
+		transformSlice(ws,tilesizex[tile],tilesizey[tile]);
+
+		//copy the kept part of the tile
+		for(int y = keepy0[tile]; y < keepy1[tile]; y++)
+		{
+			long in = (long)y*tilesizex[tile];
+			long out = ((long)slice*ysize + tiley0[tile] + y)*xsize + tilex0[tile];
+			for(int x = keepx0[tile]; x < keepx1[tile]; x++)
 			{
-#pragma omp parallel for shared(cosimtile,imtile,sinimtile,outputtile)  num_threads(numt)
-				for(int counter = 0; counter < slices; counter++)
+				outbuffer[out+x] = ws.om[in+x];
+				if(compute_orientation)
 				{
-					//printf("Counter = %d\n",counter);
-					Input2DImageType::Pointer im2d = getSlice(imtile,counter);
-					Input2DImageType::Pointer om2d;
-					Float2DImageType::Pointer cosim2d,sinim2d;
-					//call single slice 2-d curvelets function
-					getCurveletsForOneSlice(im2d,om2d,cosim2d,sinim2d);
-					copyslice<InputPixelType>(om2d,outputtile,counter);
-					copyslice<float>(cosim2d,cosimtile,counter);
-					copyslice<float>(sinim2d,sinimtile,counter);
+					cosbuffer[out+x] = ws.cosim[in+x];
+					sinbuffer[out+x] = ws.sinim[in+x];
 				}
 			}
-			
-			//printf("copying the tile\n");
-			if(xco != 0)
-			{
-				size[0] = size[0] - border/2;
-				index[0] = border/2;
-			}
-			if(xco != kx-1)
-			{
-				size[0] = size[0] - border/2;
-			}
-
-			if(yco != 0)
-			{
-				size[1] = size[1] - border/2;
-				index[1] = border/2;
-			}
-			if(yco != ky-1)
-			{
-				size[1] = size[1] - border/2;
-			}
-			size[2] = slices;
-			index[2] = 0;
-
-
-			region.SetIndex(index);
-			region.SetSize(size);
-			
-			if(xco!=0)
-			{
-				index[0] = xco *(max_dim-border)+border/2;
-			}
-			if(yco!=0)
-			{
-				index[1] = yco *(max_dim-border)+border/2;
-			}
-			
-			
-			index[2] = 0;
-			region1.SetSize(size);
-			region1.SetIndex(index);
-
-			iter1 = IteratorType(outputim,region1);
-			iter2 = IteratorType(outputtile,region);
-			typedef itk::ImageRegionIterator<FloatImageType> FIteratorType;
-			FIteratorType iter3(cosim,region1);
-			FIteratorType iter4(cosimtile,region);
-			FIteratorType iter5(sinim,region1);
-			FIteratorType iter6(sinimtile, region);
-
-			iter1.GoToBegin();iter2.GoToBegin();
-			iter3.GoToBegin();iter4.GoToBegin();
-			iter5.GoToBegin();iter6.GoToBegin();
-
-			for(;!iter1.IsAtEnd();++iter1,++iter2,++iter3,++iter4,++iter5,++iter6)
-			{
-				iter1.Set(iter2.Get());
-				iter3.Set(iter4.Get());
-				iter5.Set(iter6.Get());
-			}
-			//printf("Done with copying the tile to full image\n");
 		}
 	}
 	return outputim;
 }
 
 template<typename T>
-void Curvelet::circshift(T input, int shiftx, int shifty, T &output)
+void Curvelet::circshift(const T &input, int shiftx, int shifty, T &output)
 {
 	int m,n;
 	m = input.m();
@@ -256,14 +269,121 @@ void Curvelet::copyslice(typename itk::Image<PixelType,2>::Pointer im1, typename
 	int copysize = size[0]*size[1];
 	memcpy(outpointer+copysize*slice,inpointer,sizeof(PixelType)*copysize);
 }
+void Curvelet::getTile(InputImageType::Pointer im, int x0, int y0, int sizex, int sizey, int slice, vector<unsigned char> &tile)
+{
+	tile.resize((long)sizex*sizey);
+	InputImageType::SizeType imsize = im->GetLargestPossibleRegion().GetSize();
+	for(int y = 0; y < sizey; y++)
+	{
+		const unsigned char * in = im->GetBufferPointer() + ((long)slice*imsize[1] + y0 + y)*imsize[0] + x0;
+		memcpy(&tile[(long)y*sizex],in,sizex*sizeof(unsigned char));
+	}
+}
+double Curvelet::getSliceMemory(int sizex, int sizey)
+{
+	int m=1,n=1;
+	while(m < sizey)
+		m <<= 1;
+	while(n < sizex)
+		n <<= 1;
+	//Rough count of the m x n complex matrices alive at the same time in
+	//transformSlice: the input, the shifted input, the coefficients
+	//(about 7 times the image with curvelets at the finest scale), the work
+	//matrices of the transform and the restored images
+	int nmatrices = compute_orientation ? 34 : 18;
+	return double(m)*n*sizeof(cpx)*nmatrices;
+}
+const vector< vector<double> > & Curvelet::getCurveletNorms(int m, int n, int nbscales)
+{
+	const vector< vector<double> > * norms = NULL;
+#pragma omp critical(curvelet_norms)
+	{
+		map< pair<int,int>, vector< vector<double> > >::iterator it = curveletNorms.find(pair<int,int>(m,n));
+		if(it == curveletNorms.end())
+		{
+			//compute the fdct wrapping for the F
+			cpx cpxtemp;
+			CpxNumMat F(m,n);
+			cpxtemp = std::complex<double>(sqrt(float(n*m)),0);
+			F(m/2,n/2) = cpxtemp;
+
+			//printf("Computing L^2 norms...");
+			//fdct_wrapping_
+			vector< vector<CpxNumMat> > c;  //vector<int> extra;
+			fdct_wrapping(m, n, nbscales, nbangles_coarse, ac, F, c);
+			F.resize(0,0);
+
+			vector< vector<double> > E;
+			for(int cx = 0; cx< c.size();cx++)
+			{
+				vector<double> row;
+				for(int cy = 0;cy< c[cx].size(); cy++)
+				{
+					double sum = 0;
+					int size1 = c[cx][cy].m();
+					int size2 = c[cx][cy].n();
+					for(int counter = 0; counter < size1; counter++)
+					{
+						for(int counter1 =0; counter1 < size2; counter1++)
+						{
+							sum = sum + abs(c[cx][cy](counter,counter1))*abs(c[cx][cy](counter,counter1));
+						}
+					}
+					row.push_back(sqrt(sum/size1/size2));
+				}
+				E.push_back(row);
+			}
+			it = curveletNorms.insert(make_pair(pair<int,int>(m,n),E)).first;
+		}
+		norms = &it->second;
+	}
+	return *norms;
+}
 void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImageType::Pointer &om,Float2DImageType::Pointer &cosim, Float2DImageType::Pointer &sinim)
 {
 	Input2DImageType::SizeType imsize = im->GetLargestPossibleRegion().GetSize();
+	int sizex = imsize[0];
+	int sizey = imsize[1];
+	SliceWorkspace ws;
+	ws.tile.assign(im->GetBufferPointer(), im->GetBufferPointer()+(long)sizex*sizey);
+	transformSlice(ws,sizex,sizey);
 
+	Input2DImageType::IndexType index;
+	index.Fill(0);
+	Input2DImageType::RegionType region;
+	region.SetIndex(index);
+	region.SetSize(imsize);
+
+	om = Input2DImageType::New();
+	om->SetRegions(region); om->Allocate();
+	if(om->GetBufferPointer()==NULL)
+	{
+		printf("Couldn't allocate memory - 2.. going to crash now...\n");
+	}
+	memcpy(om->GetBufferPointer(),&ws.om[0],ws.om.size()*sizeof(unsigned char));
+
+	cosim = NULL;
+	sinim = NULL;
+	if(!compute_orientation)
+		return;
+
+	cosim = Float2DImageType::New();
+	sinim = Float2DImageType::New();
+	cosim->SetRegions(region); cosim->Allocate();
+	sinim->SetRegions(region); sinim->Allocate();
+	if(cosim->GetBufferPointer() == NULL || sinim->GetBufferPointer()==NULL)
+	{
+		printf("Couldn't allocate memory - 2.. going to crash now...\n");
+	}
+	memcpy(cosim->GetBufferPointer(),&ws.cosim[0],ws.cosim.size()*sizeof(float));
+	memcpy(sinim->GetBufferPointer(),&ws.sinim[0],ws.sinim.size()*sizeof(float));
+}
+void Curvelet::transformSlice(SliceWorkspace &ws, int sizex, int sizey)
+{
 	int m=1,n=1;
-	while(m<imsize[1])
+	while(m < sizey)
 		m <<= 1;
-	while(n < imsize[0])
+	while(n < sizex)
 		n <<= 1;
 	//m = int(pow(2,ceil(log(float(imsize[1]))/log(2.0)))+0.5);
 	//n = int(pow(2,ceil(log(float(imsize[0]))/log(2.0)))+0.5);
@@ -285,36 +405,23 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 
 	float sigma = sigma_ratio*255;
 	int finest = 1;
-	nshifts = 1;
-	ac = 1;
-
-
-
-	//compute the fdct wrapping for the F
-	cpx cpxtemp;
-	CpxNumMat F(m,n);
-	cpxtemp = std::complex<double>(sqrt(float(n*m)),0);
-	F(m/2,n/2) = cpxtemp;
-
-
-	//printf("Computing L^2 norms...");
-	//fdct_wrapping_
-	vector< vector<CpxNumMat> > c;  //vector<int> extra;
-	fdct_wrapping(m, n, nbscales, nbangles_coarse, ac, F, c);
-	F.resize(0,0);
 
-	//printf("Done\n");
-	CpxNumMat input(m,n);
-	typedef itk::ImageRegionIteratorWithIndex<Input2DImageType> IterType1;
+	//The norms only depend on the size, and are computed once for every size
+	const vector< vector<double> > & E = getCurveletNorms(m, n, nbscales);
 
-	IterType1 iter1(im,im->GetLargestPossibleRegion());
-
-	for(iter1.GoToBegin(); !iter1.IsAtEnd(); ++iter1)
+	//The tile, padded with zeros to m x n. The matrix may hold a bigger tile
+	//of the same padded size from before, so the padding is written as well.
+	CpxNumMat &input = ws.input;
+	input.resize(m,n);
+	for(int cy = 0; cy < n; cy++)
 	{
-		Input2DImageType::IndexType index;
-		index = iter1.GetIndex();
-		cpxtemp = cpx(iter1.Get(),0);
-		input(index[1],index[0])=cpxtemp;
+		for(int cx = 0; cx < m; cx++)
+		{
+			if(cx < sizey && cy < sizex)
+				input(cx,cy) = cpx(ws.tile[(long)cx*sizex+cy],0);
+			else
+				input(cx,cy) = cpx(0,0);
+		}
 	}
 
 
@@ -393,34 +500,15 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 	*/
 	//scanf("%*d");
 
-	vector< vector<double> > E;	
-	for(int cx = 0; cx< c.size();cx++)
-	{
-		vector<double> row;
-		for(int cy = 0;cy< c[cx].size(); cy++)
-		{
-			double sum = 0;
-			int size1 = c[cx][cy].m();
-			int size2 = c[cx][cy].n();
-			for(int counter = 0; counter < size1; counter++)
-			{
-				for(int counter1 =0; counter1 < size2; counter1++)
-				{
-					sum = sum + abs(c[cx][cy](counter,counter1))*abs(c[cx][cy](counter,counter1));
-				}
-			}
-			row.push_back(sqrt(sum/size1/size2));
-		}
-		E.push_back(row);
-	}
-
-
 	//printf("Done creating E\n");
 
 	int ndone = 0;
-	CpxNumMat temp_restored(m,n);
-	CpxNumMat temp_restored_cos(m,n);
-	CpxNumMat temp_restored_sin(m,n);
+	CpxNumMat &temp_restored = ws.restored;
+	CpxNumMat &temp_restored_cos = ws.restored_cos;
+	CpxNumMat &temp_restored_sin = ws.restored_sin;
+	vector< vector< CpxNumMat > > &out = ws.out;
+	vector< vector< CpxNumMat > > &outcos = ws.outcos;
+	vector< vector< CpxNumMat > > &outsin = ws.outsin;
 	//printf("about to enter for loop\n");
 	double pi = 2*acos(0.0f);
 	for(int c1 = 0; c1<nshifts; c1++)
@@ -428,7 +516,7 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 		for(int c2 = 0; c2<nshifts; c2++)
 		{
 			//printf("In loop %d\n",c2);
-			CpxNumMat shift_img(m,n);
+			CpxNumMat &shift_img = ws.shifted;
 
 			int xshift = 1;
 			int yshift = 1;
@@ -436,20 +524,23 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 			ndone = ndone + 1;
 
 			//printf("Direct transform, shift nr. %d ...\n",ndone);
-			vector< vector< CpxNumMat > > out;
-			vector< vector< CpxNumMat > > outcos;
-			vector< vector< CpxNumMat > > outsin;
 			fdct_wrapping(m, n, nbscales, nbangles_coarse, ac, shift_img, out);
 
 			//printf("Thresholding...\n");
 
 			double thresh = nsigmas_coarse * sigma;
+			if(compute_orientation)
+			{
+				outcos.resize(nbscales);
+				outsin.resize(nbscales);
+			}
 			for(int j = 0; j < nbscales; j++)
 			{
-				vector<CpxNumMat> temp;
-				temp.resize(out[j].size());
-				outcos.push_back(temp);
-				outsin.push_back(temp);
+				if(compute_orientation)
+				{
+					outcos[j].resize(out[j].size());
+					outsin[j].resize(out[j].size());
+				}
 
 				if(j== nbscales-1)
 				{
@@ -459,16 +550,20 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 				{
 					//printf("In j = %d/%d l = %d/%d\n",j,out.size(),l,out[j].size());
 					double thresh_jl = thresh*E[j][l];
-					outcos[j][l] = CpxNumMat(out[j][l].m(),out[j][l].n());
-					outsin[j][l] = CpxNumMat(out[j][l].m(),out[j][l].n());
-					DblNumMat modcjl(out[j][l].m(),out[j][l].n());
-					CpxNumMat argcjl(out[j][l].m(),out[j][l].n());
-					for(int cx = 0; cx < out[j][l].m(); cx++)
+					int mjl = out[j][l].m();
+					int njl = out[j][l].n();
+					if(compute_orientation)
+					{
+						outcos[j][l].resize(mjl,njl);
+						outsin[j][l].resize(mjl,njl);
+					}
+					DblNumMat &modcjl = ws.modc;
+					modcjl.resize(mjl,njl);
+					for(int cx = 0; cx < mjl; cx++)
 					{
-						for(int cy = 0; cy < out[j][l].n(); cy++)
+						for(int cy = 0; cy < njl; cy++)
 						{
 							modcjl(cx,cy) = abs(out[j][l](cx,cy));
-							argcjl(cx,cy) = out[j][l](cx,cy)/modcjl(cx,cy);
 						}
 					}
 
@@ -480,10 +575,10 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 					int evenquad = 1 - (int(ceil(float((l+1)*4.0/out[j].size()))+0.5)%2);
 					double theta = fmod(pi/4 - pi/out[j].size() - 2*pi/out[j].size()*l + 2*pi,pi);
 
-					DblNumMat shift1(modcjl.m(),modcjl.n());
-					DblNumMat shift2(modcjl.m(),modcjl.n());
-					DblNumMat shift3(modcjl.m(),modcjl.n());
-					DblNumMat shift4(modcjl.m(),modcjl.n());
+					//The four neighbours along and across the direction of the wedge:
+					//neighbour k of (cx,cy) is (cx-shiftx[k],cy-shifty[k]), wrapping
+					//around, the value circshift(modcjl,shiftx[k],shifty[k]) has at (cx,cy)
+					int shiftx[4], shifty[4];
 					if (evenquad)
 					{
 						double fcolsjl;
@@ -496,16 +591,10 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 							fcolsjl = fy[j][l];
 						}
 						int rowshift = - int( fx[j][l]/fcolsjl*rowstep+ 0.5);
-						//if(rowshift>100 || rowshift < -100)
-						//{
-						//	printf("rowshift %d fx[j][l] = %lf fcolsjl = %lf %d %d\n",rowshift,fx[j][l],fcolsjl,j,l);scanf("%*d");
-						//}
-						circshift(modcjl,1,0,shift1);
-						circshift(modcjl,-1,0,shift2);
-						circshift(modcjl,rowshift,1,shift3);
-						circshift(modcjl,-rowshift,-1,shift4);
-
-
+						shiftx[0] = 1;			shifty[0] = 0;
+						shiftx[1] = -1;			shifty[1] = 0;
+						shiftx[2] = rowshift;	shifty[2] = 1;
+						shiftx[3] = -rowshift;	shifty[3] = -1;
 					}
 					else
 					{
@@ -519,37 +608,42 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 							frowsjl = fx[j][l];
 						}
 						int colshift = - int( fy[j][l]/frowsjl*colstep+ 0.5);
-						//if(colshift > 100 || colshift < -100)
-						//{
-						//	printf("colshift %d fy[j][l] = %lf frowsjl = %lf %d %d\n",colshift,fy[j][l],frowsjl,j,l);scanf("%*d");
-						//}
-						circshift(modcjl,0,1,shift1);
-						circshift(modcjl,0,-1,shift2);
-						circshift(modcjl,1,colshift,shift3);
-						circshift(modcjl,-1,-colshift,shift4);
+						shiftx[0] = 0;			shifty[0] = 1;
+						shiftx[1] = 0;			shifty[1] = -1;
+						shiftx[2] = 1;			shifty[2] = colshift;
+						shiftx[3] = -1;			shifty[3] = -colshift;
 					}
+					vector<int> rows(4*mjl), cols(4*njl);
+					for(int k = 0; k < 4; k++)
+					{
+						for(int cx = 0; cx < mjl; cx++)
+							rows[k*mjl+cx] = ((cx-shiftx[k])%mjl + mjl)%mjl;
+						for(int cy = 0; cy < njl; cy++)
+							cols[k*njl+cy] = ((cy-shifty[k])%njl + njl)%njl;
+					}
+					double cos2theta = cos(theta*2);
+					double sin2theta = sin(theta*2);
 					//printf("Finished if else j = %d l = %d\n",j,l);
-					double test;
-					for(int cx = 0; cx < modcjl.m(); cx++)
+					for(int cy = 0; cy < njl; cy++)
 					{
-						for(int cy = 0; cy < modcjl.n(); cy++)
+						for(int cx = 0; cx < mjl; cx++)
 						{
-							//printf("In cx = %d cy = %d\n",cx,cy);
-							test = modcjl(cx,cy)*modcjl(cx,cy);
-							test += neighb_weight*(shift1(cx,cy)*shift1(cx,cy) + shift2(cx,cy)*shift2(cx,cy));
-							test += neighb_weight*(shift3(cx,cy)*shift3(cx,cy) + shift4(cx,cy)*shift4(cx,cy));
+							double n1 = modcjl(rows[cx],cols[cy]);
+							double n2 = modcjl(rows[mjl+cx],cols[njl+cy]);
+							double n3 = modcjl(rows[2*mjl+cx],cols[2*njl+cy]);
+							double n4 = modcjl(rows[3*mjl+cx],cols[3*njl+cy]);
+							double test = modcjl(cx,cy)*modcjl(cx,cy);
+							test += neighb_weight*(n1*n1 + n2*n2);
+							test += neighb_weight*(n3*n3 + n4*n4);
 							test = sqrt(test);
 							test *= factor;
-							modcjl(cx,cy) = modcjl(cx,cy)*(test > thresh_jl);
-							out[j][l](cx,cy) = modcjl(cx,cy)*argcjl(cx,cy);
-							//printf("hi1\n");
-							if(j!=0)
+							if(!(test > thresh_jl))
+								out[j][l](cx,cy) = 0;
+							if(compute_orientation)
 							{
-								//printf("hi2\n");
-								//printf("outcos[j].size() = %d\n",outcos[j].size());
-								//printf("outsin[j].size() = %d\n",outsin[j].size());
-								outcos[j][l](cx,cy) = cos(theta*2)*out[j][l](cx,cy);
-								outsin[j][l](cx,cy) = sin(theta*2)*out[j][l](cx,cy);
+								//no orientation at the coarsest scale
+								outcos[j][l](cx,cy) = j!=0 ? cos2theta*out[j][l](cx,cy) : cpx(0,0);
+								outsin[j][l](cx,cy) = j!=0 ? sin2theta*out[j][l](cx,cy) : cpx(0,0);
 							}
 						}
 					}
@@ -557,93 +651,54 @@ void Curvelet::getCurveletsForOneSlice(Input2DImageType::Pointer im,Input2DImage
 				}
 			}
 
-			CpxNumMat temp_restored_t(m,n);
-			CpxNumMat temp_restored_cos_t(m,n);
-			CpxNumMat temp_restored_sin_t(m,n);
-
-			clear(temp_restored_t);clear(temp_restored_cos_t);clear(temp_restored_sin_t);
+			CpxNumMat &temp_restored_t = ws.restored_t;
 			//printf("About to call ifdct wrapping1\n");
 			ifdct_wrapping(m,n,nbscales,nbangles_coarse, ac,out,temp_restored_t);
-			//printf("About to call ifdct wrapping2\n");
-			ifdct_wrapping(m,n,nbscales,nbangles_coarse, ac,outcos,temp_restored_cos_t);
-			//printf("About to call ifdct wrapping3\n");
-			ifdct_wrapping(m,n,nbscales,nbangles_coarse, ac,outsin,temp_restored_sin_t);
-
 			circshift(temp_restored_t,-xshift,-yshift,temp_restored);
-			circshift(temp_restored_cos_t,-xshift,-yshift,temp_restored_cos);
-			circshift(temp_restored_sin_t,-xshift,-yshift,temp_restored_sin);
-
+			if(compute_orientation)
+			{
+				CpxNumMat &temp_restored_cos_t = ws.restored_cos_t;
+				CpxNumMat &temp_restored_sin_t = ws.restored_sin_t;
+				//printf("About to call ifdct wrapping2\n");
+				ifdct_wrapping(m,n,nbscales,nbangles_coarse, ac,outcos,temp_restored_cos_t);
+				//printf("About to call ifdct wrapping3\n");
+				ifdct_wrapping(m,n,nbscales,nbangles_coarse, ac,outsin,temp_restored_sin_t);
+				circshift(temp_restored_cos_t,-xshift,-yshift,temp_restored_cos);
+				circshift(temp_restored_sin_t,-xshift,-yshift,temp_restored_sin);
+			}
 		}
 	}
 
 
 	//printf("About to copy the output to images\n");
 	//printf("temp_restored size = %d %d\n",temp_restored.m(),temp_restored.n());
-	typedef itk::ImageRegionIteratorWithIndex<Input2DImageType> IterType2;
-	typedef itk::ImageRegionIteratorWithIndex<Float2DImageType> IterType3;
-
-	Input2DImageType::IndexType index;
-	index.Fill(0);
-	Input2DImageType::SizeType size2;
-	size2[0] = imsize[0];
-	size2[1] = imsize[1];
-	Input2DImageType::RegionType region;
-	region.SetIndex(index);
-	region.SetSize(size2);
-
-	om = Input2DImageType::New();
-	cosim = Float2DImageType::New();
-	sinim = Float2DImageType::New();
+	ws.om.resize((long)sizex*sizey);
+	for(int y = 0; y < sizey; y++)
+	{
+		for(int x = 0; x < sizex; x++)
+		{
+			double v = temp_restored(y,x).real();
+			ws.om[(long)y*sizex+x] = v < 0 ? 0 : (v <= 255 ? (unsigned char)v : 255);
+		}
+	}
 
-	om->SetRegions(region); om->Allocate();
-	cosim->SetRegions(region); cosim->Allocate();
-	sinim->SetRegions(region); sinim->Allocate();
+	if(!compute_orientation)
+		return;
 
-	if(om->GetBufferPointer()==NULL || cosim->GetBufferPointer() == NULL || sinim->GetBufferPointer()==NULL)
+	ws.cosim.resize((long)sizex*sizey);
+	ws.sinim.resize((long)sizex*sizey);
+	for(int y = 0; y < sizey; y++)
 	{
-		printf("Couldn't allocate memory - 2.. going to crash now...\n");
-	}
-	om->FillBuffer(0);
-	cosim->FillBuffer(0);
-	sinim->FillBuffer(0);
-	IterType2 iter2(om,region);
-	IterType3 iter3(cosim,region);
-	IterType3 iter4(sinim,region);
-	iter2.GoToBegin();
-	iter3.GoToBegin();
-	iter4.GoToBegin();
-	//region.Print(std::cout);
-	//printf("Beginning loop..\n");
-	for(;!iter2.IsAtEnd();++iter2,++iter3,++iter4)
-	{
-		index = iter2.GetIndex();
-		if(temp_restored(index[1],index[0]).real()>=0)
+		for(int x = 0; x < sizex; x++)
 		{
-			if(temp_restored(index[1],index[0]).real() <= 255)
-				iter2.Set(temp_restored(index[1],index[0]).real());
-			else
-				iter2.Set(255);
+			double oldcos = temp_restored_cos(y,x).real();
+			double oldsin = temp_restored_sin(y,x).real();
+			double sum1 = sqrt(oldcos*oldcos + oldsin*oldsin+0.001);
+			oldcos /= sum1;
+			oldsin /= sum1;
+			double angle = fmod(atan2(oldsin,oldcos)+2*pi,2*pi)/2;
+			ws.cosim[(long)y*sizex+x] = cos(angle);
+			ws.sinim[(long)y*sizex+x] = sin(angle);
 		}
-		double oldcos = temp_restored_cos(index[1],index[0]).real();
-		double oldsin = temp_restored_sin(index[1],index[0]).real();
-		double sum1 = sqrt(oldcos*oldcos + oldsin*oldsin+0.001);
-		oldcos /= sum1;
-		oldsin /= sum1;
-		double angle = fmod(atan2(oldsin,oldcos)+2*pi,2*pi)/2;
-		iter3.Set(cos(angle));
-		iter4.Set(sin(angle));
-	}
-
-
-	//printf("Returning..\n");
-	////ifdct_wrapping_
-	//CpxNumMat y(x); clear(y);
-	//ifdct_wrapping(m, n, nbscales, nbangles_coarse, ac, c, y);
-	//ck1 = clock();  cout<<"IFDCT_WRAPPING_ takes "<<double(ck1-ck0)/CLOCKS_PER_SEC<<" seconds"<<endl;  ck0 = ck1;
-
-	//CpxNumMat e(m,n);
-	//for(int i=0; i<m; i++)
-	//	for(int j=0; j<n; j++)
-	//		e(i,j) = x(i,j) - y(i,j);
-	//cerr<<"accuracy of inversion "<<sqrt(energy(e)/(m*n))<<endl;
-}
\ No newline at end of file
+	}
+}
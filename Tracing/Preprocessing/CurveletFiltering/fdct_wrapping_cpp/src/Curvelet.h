@@ -10,7 +10,9 @@ Written by Lexing Ying
 
 #include <stdlib.h>
 #include <time.h>
+#ifdef _OPENMP
 #include <omp.h>
+#endif
 
 //itk includes
 #include "itkImage.h"
@@ -39,9 +41,19 @@ public:
 	Curvelet(InputImageType::Pointer NewInputImage);
 	InputImageType::Pointer RunOnInputImage(InputImageType::Pointer InputImage);
 	void SetSigma(float sigma);
+	void SetNumberOfThreads(int n);
+	//Tiles are tile_size pixels wide and overlap by border pixels
+	void SetTileSize(int size, int border);
+	//Upper bound in megabytes on the memory of the slices transformed at the same
+	//time (0 for no bound). Fewer threads are used if needed to stay below it.
+	void SetMaxMemory(double megabytes);
+	//The orientation images need two more inverse transforms per slice
+	void SetComputeOrientation(bool compute);
+	FloatImageType::Pointer GetCosineImage();
+	FloatImageType::Pointer GetSineImage();
 
 	template<typename T>
-	void circshift(T input, int shiftx, int shifty, T &output);
+	void circshift(const T &input, int shiftx, int shifty, T &output);
 	Input2DImageType::Pointer getSlice(InputImageType::Pointer im, int slice);
 	template <typename PixelType>
 	void copyslice(typename itk::Image<PixelType,2>::Pointer im1, typename itk::Image<PixelType,3>::Pointer im2, int slice);
@@ -49,6 +61,33 @@ public:
 
 
 private:
+	//Everything one thread needs to transform a slice of a tile. A thread keeps
+	//its workspace for all its tiles, so the matrices are only allocated again
+	//when the padded size of the tile changes.
+	struct SliceWorkspace
+	{
+		std::vector<unsigned char> tile;	//sizex*sizey pixels, row major
+		fdct_wrapping_ns::CpxNumMat input, shifted;
+		std::vector< std::vector<fdct_wrapping_ns::CpxNumMat> > out, outcos, outsin;
+		fdct_wrapping_ns::DblNumMat modc;
+		fdct_wrapping_ns::CpxNumMat restored, restored_t;
+		fdct_wrapping_ns::CpxNumMat restored_cos, restored_cos_t, restored_sin, restored_sin_t;
+		std::vector<unsigned char> om;		//results, laid out like tile
+		std::vector<float> cosim, sinim;
+	};
+	void getTile(InputImageType::Pointer im, int x0, int y0, int sizex, int sizey, int slice, std::vector<unsigned char> &tile);
+	//Transforms ws.tile, a sizex x sizey image, into ws.om (and ws.cosim, ws.sinim)
+	void transformSlice(SliceWorkspace &ws, int sizex, int sizey);
+	double getSliceMemory(int sizex, int sizey);
+	//L2 norms of the curvelets of every scale and wedge, for an m x n transform
+	const std::vector< std::vector<double> > & getCurveletNorms(int m, int n, int nbscales);
+
+	std::map< std::pair<int,int>, std::vector< std::vector<double> > > curveletNorms;
+	FloatImageType::Pointer cosImage;
+	FloatImageType::Pointer sinImage;
+	bool compute_orientation;
+	double max_memory;
+
 	int nbangles_coarse;
 	int ac;
 	int nshifts;
@@ -79,6 +79,8 @@ void CurveletGUI::ProcessFiles()
 			writer->Update();
 		}
 		progress.setValue(this->InputFileList.size());
+		//the FFT plans are kept for the images of the same size, until the whole list is done
+		fdct_wrapping_ns::fdct_wrapping_destroy_plans();
 	}//end file list empty
 }
 void CurveletGUI::closeEvent(QCloseEvent *event)
@@ -164,6 +164,8 @@ int main(int argc, char** argv)
 	Curvelet curvletfilter = Curvelet();
 	curvletfilter.SetSigma(sigma);
 	InputImageType::Pointer outputim = curvletfilter.RunOnInputImage(InputImage);
+	//the FFT plans are shared by the whole process, free them once it is done with the transforms
+	fdct_wrapping_ns::fdct_wrapping_destroy_plans();
 	
 	printf("writing the image to disk...\n");
 	char buffer[1024];
@@ -20,12 +20,8 @@ int fdct_wrapping(int N1, int N2, int nbscales, int nbangles_coarse, int allcurv
   int F1 = N1/2;  int F2 = N2/2;
   // ifft original data
   CpxNumMat T(x);
-  fftwnd_plan p;
-  #pragma omp critical
-  {p = fftw2d_create_plan(N2, N1, FFTW_FORWARD, FFTW_THREADSAFE | FFTW_ESTIMATE | FFTW_IN_PLACE);}
+  fftwnd_plan p = fdct_wrapping_plan(N1, N2, FFTW_FORWARD);
   fftwnd_one(p, (fftw_complex*)T.data(), NULL);
-  #pragma omp critical
-  {fftwnd_destroy_plan(p);}
   double sqrtprod = sqrt(double(N1*N2));
   for(int j=0; j<N2; j++)	 for(int i=0; i<N1; i++)		T(i,j) /= sqrtprod;
   CpxOffMat O(N1, N2);
@@ -127,9 +123,6 @@ int fdct_wrapping(int N1, int N2, int nbscales, int nbangles_coarse, int allcurv
 int fdct_wrapping_sepangle(double XL1, double XL2, int nbangle, CpxOffMat& Xhgh, vector<CpxNumMat>& csc)
 {
   //WEDGE ORDERING: from -45 degree, counter-clockwise
-  typedef pair<int,int> intpair;
-  map<intpair, fftwnd_plan> planmap;
-  
   int nbquadrants = 4;
   int nd = nbangle / 4;
   int wcnt = 0;
@@ -206,17 +199,7 @@ int fdct_wrapping_sepangle(double XL1, double XL2, int nbangle, CpxOffMat& Xhgh,
 		  CpxNumMat tpdata(xn,yn);
 		  fdct_wrapping_ifftshift(rpdata, tpdata);
 		  //ifft
-		  fftwnd_plan p = NULL;
-		  map<intpair,fftwnd_plan>::iterator mit=planmap.find( intpair(xn,yn) );
-		  if(mit!=planmap.end()) {
-			 p = (*mit).second;
-		  } else {
-			#pragma omp critical
-			  {
-				 p = fftw2d_create_plan(yn, xn, FFTW_BACKWARD, FFTW_THREADSAFE|FFTW_ESTIMATE | FFTW_IN_PLACE);
-			  }
-			 planmap[ intpair(xn, yn) ] = p;
-		  }
+		  fftwnd_plan p = fdct_wrapping_plan(xn, yn, FFTW_BACKWARD);
 		  fftwnd_one(p, (fftw_complex*)tpdata.data(), NULL);
 		  double sqrtprod = sqrt(double(xn*yn));
 		  for(int j=0; j<yn; j++)		  for(int i=0; i<xn; i++)			 tpdata(i,j) /= sqrtprod;
@@ -235,13 +218,6 @@ int fdct_wrapping_sepangle(double XL1, double XL2, int nbangle, CpxOffMat& Xhgh,
   Xhgh = Xhghb;
   XL1 = XL1b;  XL2 = XL2b;
   
-  for(map<intpair, fftwnd_plan>::iterator mit=planmap.begin(); mit!=planmap.end(); mit++) {
-	 fftwnd_plan p = (*mit).second;
-	 #pragma omp critical
-	 {
-	 fftwnd_destroy_plan(p);
-	 }
-  }
   return 0;
 }
 //-----------------------------------------------------------------------
@@ -251,16 +227,8 @@ int fdct_wrapping_wavelet(CpxOffMat& Xhgh, vector<CpxNumMat>& csc)
   int F1 = -Xhgh.s();  int F2 = -Xhgh.t();
   CpxNumMat T(N1, N2);
   fdct_wrapping_ifftshift(Xhgh, T);
-    fftwnd_plan p ;
-#pragma omp critical
-  {
-    p = fftw2d_create_plan(N2, N1, FFTW_BACKWARD, FFTW_ESTIMATE | FFTW_IN_PLACE);
-  }
+  fftwnd_plan p = fdct_wrapping_plan(N1, N2, FFTW_BACKWARD);
   fftwnd_one(p, (fftw_complex*)T.data(), NULL);
-  #pragma omp critical
-  {
-  fftwnd_destroy_plan(p);
-  }
   double sqrtprod = sqrt(double(N1*N2));
   for(int j=0; j<N2; j++)
 	 for(int i=0; i<N1; i++)
@@ -66,6 +66,19 @@ int fdct_wrapping_param(int N1, int N2, int nbscales, int nbangles_coarse, int a
 //  the center sampling point at origin (0,0). Therefore, for any scale s, and wedge w, nx[s][w] * sx[s][w] = 1 and
 //  ny[s][w] * sy[s][w] = 1.
 
+fftwnd_plan fdct_wrapping_plan(int N1, int N2, fftw_direction dir);
+//this function returns the plan of the in-place fft of an N1 by N2 matrix in CpxNumMat
+//INPUTS:
+//  N1,N2 -- the size of the matrix
+//  dir -- FFTW_FORWARD or FFTW_BACKWARD
+//COMMENTS:
+//  A plan is created the first time a size and a direction are asked for, and the same
+//  plan is returned afterwards. The plans are created with FFTW_THREADSAFE, so several
+//  threads can transform with the same plan at the same time.
+
+void fdct_wrapping_destroy_plans();
+//this function destroys all the plans returned by fdct_wrapping_plan
+
 
 FDCT_WRAPPING_NS_END_NAMESPACE
 
@@ -0,0 +1,43 @@
+/*
+   Copyright (C) 2004 Caltech
+   Written by Lexing Ying
+*/
+
+#include "fdct_wrapping.hpp"
+
+FDCT_WRAPPING_NS_BEGIN_NAMESPACE
+
+//plans by size and direction, shared by all the transforms of the process
+typedef pair< pair<int,int>, int > plankey;
+static map<plankey, fftwnd_plan> fdct_wrapping_plans;
+
+//-------------------------------------------------------------------
+fftwnd_plan fdct_wrapping_plan(int N1, int N2, fftw_direction dir)
+{
+  fftwnd_plan p = NULL;
+  #pragma omp critical(fdct_wrapping_plans)
+  {
+	 plankey key(pair<int,int>(N1,N2), int(dir));
+	 map<plankey, fftwnd_plan>::iterator mit = fdct_wrapping_plans.find(key);
+	 if(mit!=fdct_wrapping_plans.end()) {
+		p = (*mit).second;
+	 } else {
+		p = fftw2d_create_plan(N2, N1, dir, FFTW_THREADSAFE|FFTW_ESTIMATE | FFTW_IN_PLACE);
+		fdct_wrapping_plans[key] = p;
+	 }
+  }
+  return p;
+}
+
+//-------------------------------------------------------------------
+void fdct_wrapping_destroy_plans()
+{
+  #pragma omp critical(fdct_wrapping_plans)
+  {
+	 for(map<plankey, fftwnd_plan>::iterator mit=fdct_wrapping_plans.begin(); mit!=fdct_wrapping_plans.end(); mit++)
+		fftwnd_destroy_plan((*mit).second);
+	 fdct_wrapping_plans.clear();
+  }
+}
+
+FDCT_WRAPPING_NS_END_NAMESPACE
@@ -110,16 +110,8 @@ int ifdct_wrapping(int N1, int N2, int nbscales, int nbangles_coarse, int allcur
   //------------------------------------------------------------
   CpxNumMat T(N1,N2);
   fdct_wrapping_ifftshift(O, T);
-  fftwnd_plan p;
-#pragma omp critical
-  {
-   p  = fftw2d_create_plan(N2, N1, FFTW_BACKWARD, FFTW_THREADSAFE|FFTW_ESTIMATE | FFTW_IN_PLACE);
-  }
+  fftwnd_plan p = fdct_wrapping_plan(N1, N2, FFTW_BACKWARD);
   fftwnd_one(p, (fftw_complex*)T.data(), NULL);
- #pragma omp critical
-  {
-	fftwnd_destroy_plan(p);
-  }
   double sqrtprod = sqrt(double(N1*N2)); //scale
   for(int i=0; i<N1; i++)	 for(int j=0; j<N2; j++)	 T(i,j) /= sqrtprod;
 
@@ -133,9 +125,6 @@ int ifdct_wrapping(int N1, int N2, int nbscales, int nbangles_coarse, int allcur
 //---------------------
 int fdct_wrapping_invsepangle(double XL1, double XL2, int nbangle, vector<CpxNumMat>& csc, CpxOffMat& Xhgh)
 {
-  typedef pair<int,int> intpair;
-  map<intpair, fftwnd_plan> planmap;
-  
   int XS1, XS2;  int XF1, XF2;  double XR1, XR2;	 fdct_wrapping_rangecompute(XL1, XL2, XS1, XS2, XF1, XF2, XR1, XR2);
   Xhgh.resize(XS1, XS2);
   
@@ -188,17 +177,7 @@ int fdct_wrapping_invsepangle(double XL1, double XL2, int nbangle, vector<CpxNum
 		  int xn = csc[wcnt].m();		  int yn = csc[wcnt].n();
 		  CpxNumMat tpdata(csc[wcnt]);
 		  //fft
-		  fftwnd_plan p = NULL;
-		  map<intpair, fftwnd_plan>::iterator mit=planmap.find( intpair(xn,yn) );
-		  if(mit!=planmap.end()) {
-			 p = (*mit).second;
-		  } else {
-#pragma omp critical
-			  {
-			 p = fftw2d_create_plan(yn, xn, FFTW_FORWARD, FFTW_THREADSAFE|FFTW_ESTIMATE | FFTW_IN_PLACE);
-			  }
-			 planmap[ intpair(xn, yn) ] = p;
-		  }
+		  fftwnd_plan p = fdct_wrapping_plan(xn, yn, FFTW_FORWARD);
 		  fftwnd_one(p, (fftw_complex*)tpdata.data(), NULL);
 		  double sqrtprod = sqrt(double(xn*yn));
 		  for(int i=0; i<xn; i++)		  for(int j=0; j<yn; j++)			 tpdata(i,j) /= sqrtprod;
@@ -240,14 +219,7 @@ int fdct_wrapping_invsepangle(double XL1, double XL2, int nbangle, vector<CpxNum
   XL1 = XL1b;  XL2 = XL2b;
 
   assert(wcnt==nbangle);
-  
-  for(map<intpair, fftwnd_plan>::iterator mit=planmap.begin(); mit!=planmap.end(); mit++) {
-	 fftwnd_plan p = (*mit).second;
-	#pragma omp critical
-	 {
-	 fftwnd_destroy_plan(p);
-	 }
-  }
+
   return 0;
 }
 
@@ -260,16 +232,8 @@ int fdct_wrapping_invwavelet(vector<CpxNumMat>& csc, CpxOffMat& Xhgh)
   
   CpxNumMat T(C);  //CpxNumMat T(N1, N2);  fdct_wrapping_ifftshift(N1, N2, F1, F2, C, T);
 	
-  fftwnd_plan p;
-  #pragma omp critical
-  {
-	p = fftw2d_create_plan(N2, N1, FFTW_FORWARD, FFTW_THREADSAFE|FFTW_ESTIMATE | FFTW_IN_PLACE);
-  }
+  fftwnd_plan p = fdct_wrapping_plan(N1, N2, FFTW_FORWARD);
   fftwnd_one(p, (fftw_complex*)T.data(), NULL);
-	#pragma omp critical
-  {
-  fftwnd_destroy_plan(p);
-  }
   double sqrtprod = sqrt(double(N1*N2));
   for(int j=0; j<N2; j++)
 	 for(int i=0; i<N1; i++)
@@ -30,9 +30,8 @@ public:
 	 if(_m>0 && _n>0) {		delete[] _data; _data = NULL; }
   }
   NumMat& operator=(const NumMat& C) {
-	 if(_m>0 && _n>0) {		delete[] _data; _data = NULL; }
-	 _m = C._m; _n=C._n;
-	 if(_m>0 && _n>0) {		_data = new F[_m*_n]; assert( _data!=NULL );	 memset(_data, 0, _m*_n*sizeof(F));	 } else		_data = NULL;
+	 if(this==&C) return *this;
+	 resize(C._m, C._n); //keeps the buffer when the size does not change
 	 if(_m>0 && _n>0) {		memcpy( _data, C._data, _m*_n*sizeof(F) );	 }
 	 return *this;
   }
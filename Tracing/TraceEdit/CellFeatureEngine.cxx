@@ -0,0 +1,209 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#include "CellFeatureEngine.h"
+#include "ftkCommon/ftkTaskRuntime.h"
+
+const char *CellFeatureEngine::FileNameFeature = "Trace File";
+
+CellFeatureEngine::CellFeatureEngine()
+{
+	this->ComputeConvexHull = false;
+	this->Cells = NULL;
+	this->FileNameColumn = -1;
+	this->FileNames = NULL;
+}
+
+int CellFeatureEngine::InternFeature(const std::string &name)
+{
+	std::map<std::string, int>::iterator find = this->FeatureIndex.find(name);
+	if (find != this->FeatureIndex.end())
+	{
+		return (*find).second;
+	}
+	int index = (int) this->FeatureNames.size();
+	this->FeatureIndex[name] = index;
+	this->FeatureNames.push_back(name);
+	return index;
+}
+
+int CellFeatureEngine::GetFeatureIndex(const std::string &name) const
+{
+	std::map<std::string, int>::const_iterator find = this->FeatureIndex.find(name);
+	if (find != this->FeatureIndex.end())
+	{
+		return (*find).second;
+	}
+	return -1;
+}
+
+const std::vector<std::string> &CellFeatureEngine::GetFeatureNames() const
+{
+	return this->FeatureNames;
+}
+
+void CellFeatureEngine::ClearFeatures()
+{
+	this->FeatureIndex.clear();
+	this->FeatureNames.clear();
+}
+
+void CellFeatureEngine::RequestConvexHull()
+{
+	this->ComputeConvexHull = true;
+}
+
+void CellFeatureEngine::RequestDistanceToVessel(FloatImageType::Pointer distanceMap, ImageType::RegionType region)
+{
+	this->DistanceMap = distanceMap;
+	this->DistanceRegion = region;
+}
+
+void CellFeatureEngine::Compute(const std::vector<CellTrace*> &cells, const std::vector<std::string> &basicNames,
+	const std::vector<std::string> &extendedNames, vtkTable *table)
+{
+	/*!
+	* Interning in header order keeps the column index equal to the
+	* table column, so the rows are written without any name lookup.
+	*/
+	this->ValueColumns.clear();
+	this->FileNameColumn = -1;
+	for (unsigned int i = 0; i < basicNames.size(); i++)
+	{
+		int column = this->InternFeature(basicNames[i]);
+		if (basicNames[i] == FileNameFeature)
+		{
+			this->FileNameColumn = column;
+		}
+		else
+		{
+			this->ValueColumns.push_back(column);
+		}
+	}
+	this->ExtendedColumns.clear();
+	this->ExtendedNames = extendedNames;
+	for (unsigned int i = 0; i < extendedNames.size(); i++)
+	{
+		this->ExtendedColumns.push_back(this->InternFeature(extendedNames[i]));
+	}
+
+	int numRows = (int) cells.size();
+	int numColumns = (int) this->FeatureNames.size();
+	std::vector<bool> extended(numColumns, false);
+	for (unsigned int i = 0; i < this->ExtendedColumns.size(); i++)
+	{
+		extended[this->ExtendedColumns[i]] = true;
+	}
+
+	table->Initialize();
+	this->DoubleColumns.assign(numColumns, (double *) NULL);
+	this->VariantColumns.assign(numColumns, (vtkVariantArray *) NULL);
+	this->FileNames = NULL;
+	for (int c = 0; c < numColumns; c++)
+	{
+		const char *name = this->FeatureNames[c].c_str();
+		if (c == this->FileNameColumn)
+		{
+			vtkSmartPointer<vtkStringArray> column = vtkSmartPointer<vtkStringArray>::New();
+			column->SetName(name);
+			column->SetNumberOfValues(numRows);
+			this->FileNames = column;
+			table->AddColumn(column);
+		}
+		else if (extended[c])
+		{
+			//added features can be anything the user loaded, keep them as variants
+			vtkSmartPointer<vtkVariantArray> column = vtkSmartPointer<vtkVariantArray>::New();
+			column->SetName(name);
+			column->SetNumberOfValues(numRows);
+			this->VariantColumns[c] = column;
+			table->AddColumn(column);
+		}
+		else
+		{
+			vtkSmartPointer<vtkDoubleArray> column = vtkSmartPointer<vtkDoubleArray>::New();
+			column->SetName(name);
+			column->SetNumberOfValues(numRows);
+			column->FillComponent(0, -PI);
+			this->DoubleColumns[c] = numRows > 0 ? column->GetPointer(0) : NULL;
+			table->AddColumn(column);
+		}
+	}
+
+	this->RowFileNames.assign(this->FileNames ? numRows : 0, std::string());
+	this->RowExtendedValues.assign(numRows * this->ExtendedColumns.size(), vtkVariant());
+	this->OutsideVessel.assign(numRows, 0);
+
+	this->Cells = &cells;
+	ftk::ParallelFor(0, numRows, ftk::MemberBody<CellFeatureEngine>(this, &CellFeatureEngine::ComputeRow), 64, "cell_features");
+	this->Cells = NULL;
+
+	unsigned int numExtended = this->ExtendedColumns.size();
+	for (int row = 0; row < numRows; row++)
+	{
+		if (this->FileNames)
+		{
+			this->FileNames->SetValue(row, this->RowFileNames[row]);
+		}
+		for (unsigned int j = 0; j < numExtended; j++)
+		{
+			this->VariantColumns[this->ExtendedColumns[j]]->SetValue(row, this->RowExtendedValues[row * numExtended + j]);
+		}
+		if (this->OutsideVessel[row])
+		{
+			double soma[3];
+			cells[row]->getSomaCoord(soma);
+			std::cout << soma[0] << "," << soma[1] << "," << soma[2] << " Cell is outside of the vessel image... skipped" << std::endl;
+		}
+	}
+	this->RowFileNames.clear();
+	this->RowExtendedValues.clear();
+
+	//requests are one shot, the results are cached on the cells
+	this->ComputeConvexHull = false;
+	this->DistanceMap = NULL;
+}
+
+void CellFeatureEngine::ComputeRow(int row)
+{
+	CellTrace *cell = (*this->Cells)[row];
+	cell->UpdateFeatures();
+	if (this->ComputeConvexHull)
+	{
+		cell->calculateConvexHull();
+	}
+	if (this->DistanceMap)
+	{
+		const FloatImageType *distanceMap = this->DistanceMap.GetPointer();
+		this->OutsideVessel[row] = !cell->calculateDistanceToVessel(distanceMap, this->DistanceRegion);
+	}
+
+	std::vector<double> values;
+	cell->FeatureValues(values);
+	unsigned int count = values.size() < this->ValueColumns.size() ? values.size() : this->ValueColumns.size();
+	for (unsigned int k = 0; k < count; k++)
+	{
+		this->DoubleColumns[this->ValueColumns[k]][row] = values[k];
+	}
+	if (this->FileNames)
+	{
+		this->RowFileNames[row] = cell->GetFileName();
+	}
+	unsigned int numExtended = this->ExtendedColumns.size();
+	for (unsigned int j = 0; j < numExtended; j++)
+	{
+		this->RowExtendedValues[row * numExtended + j] = cell->getFeature(this->ExtendedNames[j]);
+	}
+}
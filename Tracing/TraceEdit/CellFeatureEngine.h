@@ -0,0 +1,95 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#ifndef CELLFEATUREENGINE_H
+#define CELLFEATUREENGINE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vtkSmartPointer.h"
+#include "vtkTable.h"
+#include "vtkDoubleArray.h"
+#include "vtkStringArray.h"
+#include "vtkVariantArray.h"
+
+#include "itkImage.h"
+#include "CellTrace.h"
+
+/**
+ * Builds the cell feature table for a set of CellTraces in one pass that runs
+ * in parallel across cells.
+ *
+ * Feature names are interned once into column indices. Every column is
+ * allocated for all cells before the pass and each cell writes its own row, so
+ * no per-cell vtkVariantArray rows are built or copied. A row walks the cell's
+ * segments (CellTrace::UpdateFeatures) and, when requested, computes its convex
+ * hull and samples the vessel distance map, all without touching VTK objects.
+ * The string and variant columns are filled from the row results after the
+ * pass, since VTK arrays are not safe to write from several threads.
+ */
+class CellFeatureEngine
+{
+public:
+	CellFeatureEngine();
+
+	//! Column of a feature, added at the end if it is new
+	int InternFeature(const std::string &name);
+	//! Column of a feature or -1
+	int GetFeatureIndex(const std::string &name) const;
+	const std::vector<std::string> &GetFeatureNames() const;
+	void ClearFeatures();
+
+	//! The next Compute also runs CellTrace::calculateConvexHull for every cell
+	void RequestConvexHull();
+	//! The next Compute also samples distanceMap at every soma
+	void RequestDistanceToVessel(FloatImageType::Pointer distanceMap, ImageType::RegionType region);
+
+	/**
+	 * Fills table with one row per cell. basicNames are the CellTrace::FeatureValues
+	 * columns with FileNameFeature at its position in the header list; extendedNames
+	 * are read with CellTrace::getFeature.
+	 */
+	void Compute(const std::vector<CellTrace*> &cells, const std::vector<std::string> &basicNames,
+		const std::vector<std::string> &extendedNames, vtkTable *table);
+
+	static const char *FileNameFeature;
+
+private:
+	void ComputeRow(int row);
+
+	std::map<std::string, int> FeatureIndex;
+	std::vector<std::string> FeatureNames;
+
+	bool ComputeConvexHull;
+	FloatImageType::Pointer DistanceMap;
+	ImageType::RegionType DistanceRegion;
+
+	// state of the running Compute, shared read-only by the row tasks
+	const std::vector<CellTrace*> *Cells;
+	std::vector<int> ValueColumns;		//column of each CellTrace::FeatureValues entry
+	std::vector<int> ExtendedColumns;
+	std::vector<std::string> ExtendedNames;
+	int FileNameColumn;
+	std::vector<double *> DoubleColumns;	//raw column buffers, NULL for other column types
+	vtkStringArray *FileNames;
+	std::vector<vtkVariantArray *> VariantColumns;
+
+	// per row results copied into the VTK arrays after the pass
+	std::vector<std::string> RowFileNames;
+	std::vector<vtkVariant> RowExtendedValues;	//row major, one per extended column
+	std::vector<char> OutsideVessel;
+};
+#endif
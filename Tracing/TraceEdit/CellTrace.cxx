@@ -30,7 +30,27 @@ CellTrace::CellTrace(std::vector<TraceLine*> Segments)
 }
 void CellTrace::setTraces(std::vector<TraceLine*> Segments)
 {
+	//the walk is left to UpdateFeatures, which the feature engine runs for
+	//many cells in parallel
 	this->segments = Segments;
+	this->featuresPending = true;
+	this->modified = true;
+}
+void CellTrace::UpdateFeatures()
+{
+	if (!this->featuresPending)
+	{
+		return;
+	}
+	//start from scratch so a retraced cell does not add to its old totals
+	std::vector<TraceLine*> Segments = this->segments;
+	std::string fileName = this->FileName;
+	this->clearAll();
+	this->segments = Segments;
+	this->FileName = fileName;
+	this->IDs.clear();
+	this->tips.clear();
+
 	unsigned int i = 0;
 	this->NumSegments = (int) this->segments.size() - 1; //segments[0] is soma
 	this->stems = (int) this->segments[0]->GetBranchPointer()->size();
@@ -218,12 +238,14 @@ std::string CellTrace::GetFileName()
 }
 void CellTrace::getSomaCoord(double xyz[])
 {
+	this->UpdateFeatures();
 	xyz[0] = this->somaX;
 	xyz[1] = this->somaY;
 	xyz[2] = this->somaZ;
 }
 void CellTrace::getCellBounds(double bounds[])
 {//min then max of x, y, z
+	this->UpdateFeatures();
 	bounds[0] = this->minX;
 	bounds[1] = this->maxX;
 	bounds[2] = this->minY;
@@ -233,6 +255,7 @@ void CellTrace::getCellBounds(double bounds[])
 }
 void CellTrace::setDistanceToROI(double newDistance, double Coord_X , double Coord_Y, double Coord_Z)
 {
+	this->UpdateFeatures();
 	this->segments[0]->SetDistanceToROI(newDistance);
 	this->segments[0]->SetDistanceToROICoord_X(Coord_X);
 	this->segments[0]->SetDistanceToROICoord_Y(Coord_Y);
@@ -468,6 +491,7 @@ void CellTrace::clearAll()
 	this->convexHullVol = -1000;
 
 	this->modified = false;
+	this->featuresPending = false;
 	this->delaunayCreated = false;
 }
 void CellTrace::MaxMin(double NewValue, double &total, double &Min, double &Max)
@@ -542,244 +566,262 @@ void CellTrace::MaxMin(std::vector<double> NewValue, double &total, double &Min,
 		}
 	}
 }
-vtkSmartPointer<vtkVariantArray> CellTrace::DataRow()
+void CellTrace::FeatureValues(std::vector<double> &values)
 {
-	if (this->modified)
+	/*!
+	* numeric cell features in table column order,
+	* the trace file name column is left out
+	*/
+	this->UpdateFeatures();
+	values.clear();
+	values.push_back(this->segments[0]->GetId());
+
+	values.push_back(this->somaX);
+	values.push_back(this->somaY);
+	values.push_back(this->somaZ);
+
+	values.push_back(this->maxX - this->minX);//Width
+	values.push_back(this->maxY - this->minY);//Length
+	values.push_back(this->maxZ - this->minZ);//Height		
+
+	values.push_back(this->somaRadii);
+	values.push_back(this->somaSurface);
+	values.push_back(this->somaVolume);
+
+	values.push_back(this->skewnessX);
+	values.push_back(this->skewnessY);
+	values.push_back(this->skewnessZ);
+	values.push_back(this->euclideanSkewness);
+
+	values.push_back(this->NumSegments);
+	values.push_back(this->stems);
+	values.push_back(this->branchingStem);
+	values.push_back(this->branchPoints);
+	values.push_back(this->actualBifurcations);
+	values.push_back(this->terminalTips);
+
+	//protect from divide by zero
+	int tempNumSegments = 1;
+	if (this->NumSegments != 0)
 	{
-		CellData->Reset();
-		CellData->InsertNextValue(this->segments[0]->GetId());
-
-		CellData->InsertNextValue(this->somaX);
-		CellData->InsertNextValue(this->somaY);
-		CellData->InsertNextValue(this->somaZ);
-
-		CellData->InsertNextValue(this->maxX - this->minX);//Width
-		CellData->InsertNextValue(this->maxY - this->minY);//Length
-		CellData->InsertNextValue(this->maxZ - this->minZ);//Height		
-
-		CellData->InsertNextValue(this->somaRadii);
-		CellData->InsertNextValue(this->somaSurface);
-		CellData->InsertNextValue(this->somaVolume);
-
-		CellData->InsertNextValue(this->skewnessX);
-		CellData->InsertNextValue(this->skewnessY);
-		CellData->InsertNextValue(this->skewnessZ);
-		CellData->InsertNextValue(this->euclideanSkewness);
-
-		CellData->InsertNextValue(this->NumSegments);
-		CellData->InsertNextValue(this->stems);
-		CellData->InsertNextValue(this->branchingStem);
-		CellData->InsertNextValue(this->branchPoints);
-		CellData->InsertNextValue(this->actualBifurcations);
-		CellData->InsertNextValue(this->terminalTips);
-
-		//protect from divide by zero
-		int tempNumSegments = 1;
-		if (this->NumSegments != 0)
-		{
-			tempNumSegments = this->NumSegments;
-		}
-		int tempBranchPoints = 1;
-		if (this->branchPoints != 0)
-		{
-			tempBranchPoints = this->branchPoints;
-		}
-		int tempActualBifurcations = 1;
-		if (this->actualBifurcations != 0)
-		{
-			tempActualBifurcations = this->actualBifurcations;
-		}
+		tempNumSegments = this->NumSegments;
+	}
+	int tempBranchPoints = 1;
+	if (this->branchPoints != 0)
+	{
+		tempBranchPoints = this->branchPoints;
+	}
+	int tempActualBifurcations = 1;
+	if (this->actualBifurcations != 0)
+	{
+		tempActualBifurcations = this->actualBifurcations;
+	}
 
-		CellData->InsertNextValue(this->DiameterMin);
-		CellData->InsertNextValue(this->DiameterTotal / tempNumSegments);
-		CellData->InsertNextValue(this->DiameterMax);
-
-		CellData->InsertNextValue(this->DiameterPowerMin);
-		CellData->InsertNextValue(this->DiameterPowerTotal / tempNumSegments);
-		CellData->InsertNextValue(this->DiameterPowerMax);
-
-		CellData->InsertNextValue(this->TotalVolume);
-		CellData->InsertNextValue(this->SegmentVolumeMin);
-		CellData->InsertNextValue(this->TotalVolume/tempNumSegments);////average segment Volume
-		CellData->InsertNextValue(this->SegmentVolumeMax);
-		CellData->InsertNextValue(this->surfaceAreaTotal);
-		CellData->InsertNextValue(this->SurfaceAreaMin);
-		CellData->InsertNextValue(this->surfaceAreaTotal/tempNumSegments);
-		CellData->InsertNextValue(this->SurfaceAreaMax);
-		//CellData->InsertNextValue(this->sectionAreaTotal);
-		CellData->InsertNextValue(this->SectionAreaMin);
-		CellData->InsertNextValue(this->sectionAreaTotal/tempNumSegments);
-		CellData->InsertNextValue(this->SectionAreaMax);
-
-		//CellData->InsertNextValue(this->BurkTaperTotal);
-		CellData->InsertNextValue(this->BurkTaperMin);
-		CellData->InsertNextValue(this->BurkTaperTotal / (tempActualBifurcations*2));
-		CellData->InsertNextValue(this->BurkTaperMax);
-
-		//CellData->InsertNextValue(this->HillmanTaperTotal);
-		CellData->InsertNextValue(this->HillmanTaperMin);
-		CellData->InsertNextValue(this->HillmanTaperTotal / (tempActualBifurcations*2));
-		CellData->InsertNextValue(this->HillmanTaperMax);
-
-		CellData->InsertNextValue(this->TotalEuclideanPath);
-		CellData->InsertNextValue(this->TotalEuclideanPath/tempNumSegments);//average segment euclidean length
-		CellData->InsertNextValue(this->PathLengthTotal);
-		CellData->InsertNextValue(this->PathLengthMin);
-		CellData->InsertNextValue(this->PathLengthTotal/tempNumSegments);//average segment length
-		CellData->InsertNextValue(this->PathLengthMax);
-
-		CellData->InsertNextValue(this->MinStemDistance);
-		CellData->InsertNextValue(this->EstimatedSomaRadius);
-		CellData->InsertNextValue(this->MaxStemDistance);
-
-		CellData->InsertNextValue(this->ContractionMin);
-		double aveContraction = this->ContractionTotal / tempNumSegments;
-		if (aveContraction != aveContraction)
-		{
-			CellData->InsertNextValue(-PI);
-		}
-		else
-		{
-			CellData->InsertNextValue(aveContraction);
-		}
-		CellData->InsertNextValue(this->ContractionMax);
+	values.push_back(this->DiameterMin);
+	values.push_back(this->DiameterTotal / tempNumSegments);
+	values.push_back(this->DiameterMax);
+
+	values.push_back(this->DiameterPowerMin);
+	values.push_back(this->DiameterPowerTotal / tempNumSegments);
+	values.push_back(this->DiameterPowerMax);
+
+	values.push_back(this->TotalVolume);
+	values.push_back(this->SegmentVolumeMin);
+	values.push_back(this->TotalVolume/tempNumSegments);////average segment Volume
+	values.push_back(this->SegmentVolumeMax);
+	values.push_back(this->surfaceAreaTotal);
+	values.push_back(this->SurfaceAreaMin);
+	values.push_back(this->surfaceAreaTotal/tempNumSegments);
+	values.push_back(this->SurfaceAreaMax);
+	//values.push_back(this->sectionAreaTotal);
+	values.push_back(this->SectionAreaMin);
+	values.push_back(this->sectionAreaTotal/tempNumSegments);
+	values.push_back(this->SectionAreaMax);
+
+	//values.push_back(this->BurkTaperTotal);
+	values.push_back(this->BurkTaperMin);
+	values.push_back(this->BurkTaperTotal / (tempActualBifurcations*2));
+	values.push_back(this->BurkTaperMax);
+
+	//values.push_back(this->HillmanTaperTotal);
+	values.push_back(this->HillmanTaperMin);
+	values.push_back(this->HillmanTaperTotal / (tempActualBifurcations*2));
+	values.push_back(this->HillmanTaperMax);
+
+	values.push_back(this->TotalEuclideanPath);
+	values.push_back(this->TotalEuclideanPath/tempNumSegments);//average segment euclidean length
+	values.push_back(this->PathLengthTotal);
+	values.push_back(this->PathLengthMin);
+	values.push_back(this->PathLengthTotal/tempNumSegments);//average segment length
+	values.push_back(this->PathLengthMax);
+
+	values.push_back(this->MinStemDistance);
+	values.push_back(this->EstimatedSomaRadius);
+	values.push_back(this->MaxStemDistance);
+
+	values.push_back(this->ContractionMin);
+	double aveContraction = this->ContractionTotal / tempNumSegments;
+	if (aveContraction != aveContraction)
+	{
+		values.push_back(-PI);
+	}
+	else
+	{
+		values.push_back(aveContraction);
+	}
+	values.push_back(this->ContractionMax);
 
-		CellData->InsertNextValue(this->FragmentationTotal);
-		CellData->InsertNextValue(this->FragmentationMin);
-		CellData->InsertNextValue((int) floor((double) this->FragmentationTotal / tempNumSegments + 0.5));
-		CellData->InsertNextValue(this->FragmentationMax);
+	values.push_back(this->FragmentationTotal);
+	values.push_back(this->FragmentationMin);
+	values.push_back((int) floor((double) this->FragmentationTotal / tempNumSegments + 0.5));
+	values.push_back(this->FragmentationMax);
 
-		CellData->InsertNextValue(this->daughterRatioMin);
-		CellData->InsertNextValue(this->daughterRatio / tempActualBifurcations);
-		CellData->InsertNextValue(this->daughterRatioMax);
+	values.push_back(this->daughterRatioMin);
+	values.push_back(this->daughterRatio / tempActualBifurcations);
+	values.push_back(this->daughterRatioMax);
 
-		CellData->InsertNextValue(this->parentDaughterRatioMin);
-		CellData->InsertNextValue(this->parentDaughterRatio/ tempActualBifurcations);
-		CellData->InsertNextValue(this->parentDaughterRatioMax);
+	values.push_back(this->parentDaughterRatioMin);
+	values.push_back(this->parentDaughterRatio/ tempActualBifurcations);
+	values.push_back(this->parentDaughterRatioMax);
 
-		CellData->InsertNextValue(this->daughterLengthRatioMin);
-		CellData->InsertNextValue(this->daughterLengthRatio/ tempActualBifurcations);
-		CellData->InsertNextValue(this->daughterLengthRatioMax);
+	values.push_back(this->daughterLengthRatioMin);
+	values.push_back(this->daughterLengthRatio/ tempActualBifurcations);
+	values.push_back(this->daughterLengthRatioMax);
 
-		CellData->InsertNextValue(this->partitionAsymmetryMin);
-		CellData->InsertNextValue(this->partitionAsymmetry / tempActualBifurcations);
-		CellData->InsertNextValue(this->partitionAsymmetryMax);
+	values.push_back(this->partitionAsymmetryMin);
+	values.push_back(this->partitionAsymmetry / tempActualBifurcations);
+	values.push_back(this->partitionAsymmetryMax);
 
-		CellData->InsertNextValue(this->rallPowerMin);
-		CellData->InsertNextValue(this->rallPower / tempActualBifurcations);
-		CellData->InsertNextValue(this->rallPowerMax);
+	values.push_back(this->rallPowerMin);
+	values.push_back(this->rallPower / tempActualBifurcations);
+	values.push_back(this->rallPowerMax);
 
-		CellData->InsertNextValue(this->PkMin);
-		CellData->InsertNextValue(this->Pk / tempActualBifurcations);
-		CellData->InsertNextValue(this->PkMax);
+	values.push_back(this->PkMin);
+	values.push_back(this->Pk / tempActualBifurcations);
+	values.push_back(this->PkMax);
 
-		CellData->InsertNextValue(this->Pk_classicMin);
-		CellData->InsertNextValue(this->Pk_classic / tempActualBifurcations);
-		CellData->InsertNextValue(this->Pk_classicMax);
+	values.push_back(this->Pk_classicMin);
+	values.push_back(this->Pk_classic / tempActualBifurcations);
+	values.push_back(this->Pk_classicMax);
 
-		CellData->InsertNextValue(this->Pk_2Min);
-		CellData->InsertNextValue(this->Pk_2 / tempActualBifurcations);
-		CellData->InsertNextValue(this->Pk_2Max);
+	values.push_back(this->Pk_2Min);
+	values.push_back(this->Pk_2 / tempActualBifurcations);
+	values.push_back(this->Pk_2Max);
 
-		double AveAzimuth = -PI;
-		double AveElevation = -PI;
-		if (this->stems !=0)
-		{
-			AveAzimuth = this->Azimuth / this->stems;
-			AveElevation = this->Elevation / this->stems;
-		}
-		CellData->InsertNextValue(this->AzimuthMin);
-		CellData->InsertNextValue(AveAzimuth);
-		CellData->InsertNextValue(this->AzimuthMax);
-		CellData->InsertNextValue(this->ElevationMin);
-		CellData->InsertNextValue(AveElevation);
-		CellData->InsertNextValue(this->ElevationMax);
-
-		if (this->BifTorqueLocalCount == 0)
-		{
-			this->BifTorqueLocalCount = 1;
-		}
-		if (this->BifTorqueRemoteCount == 0)
-		{
-			this->BifTorqueRemoteCount = 1;
-		}
-		if (this->BifTiltLocalCount == 0)
-		{
-			this->BifTiltLocalCount = 1;
-		}
-		if (this->BifTiltRemoteCount == 0)
-		{
-			this->BifTiltRemoteCount = 1;
-		}
-		CellData->InsertNextValue(this->BifAmplLocalMin);
-		CellData->InsertNextValue(this->BifAmplLocal / tempActualBifurcations);
-		CellData->InsertNextValue(this->BifAmplLocalMax);
-		CellData->InsertNextValue(this->BifTiltLocalMin);
-		CellData->InsertNextValue(this->BifTiltLocal / this->BifTiltLocalCount);
-		CellData->InsertNextValue(this->BifTiltLocalMax);
-		CellData->InsertNextValue(this->BifTorqueLocalMin);
-		CellData->InsertNextValue(this->BifTorqueLocal/ this->BifTorqueLocalCount);
-		CellData->InsertNextValue(this->BifTorqueLocalMax);
-
-		CellData->InsertNextValue(this->BifAmplRemoteMin);
-		CellData->InsertNextValue(this->BifAmplRemote / tempActualBifurcations);
-		CellData->InsertNextValue(this->BifAmplRemoteMax);
-		CellData->InsertNextValue(this->BifTiltRemoteMin);
-		CellData->InsertNextValue(this->BifTiltRemote / this->BifTiltRemoteCount);
-		CellData->InsertNextValue(this->BifTiltRemoteMax);
-		CellData->InsertNextValue(this->BifTorqueRemoteMin);
-		CellData->InsertNextValue(this->BifTorqueRemote/ this->BifTorqueRemoteCount);
-		CellData->InsertNextValue(this->BifTorqueRemoteMax);
-
-		int tempTerminalTips = 1;
-		if (this->terminalTips != 0)
-		{
-			tempTerminalTips = this->terminalTips;
-		}
-		CellData->InsertNextValue(this->MinTerminalLevel);
-		CellData->InsertNextValue(this->TerminalPathLengthMin);
-		CellData->InsertNextValue(this->SumTerminalLevel /tempTerminalTips);//average terminal level
-		CellData->InsertNextValue(this->TerminalPathLength/tempTerminalTips);//now average path to end
-		CellData->InsertNextValue(this->MaxTerminalLevel);
-		CellData->InsertNextValue(this->TerminalPathLengthMax);
-
-		CellData->InsertNextValue(this->TerminalSegmentTotal);
-		CellData->InsertNextValue(this->TerminalSegmentMin);
-		CellData->InsertNextValue(this->TerminalSegmentTotal / tempTerminalTips); //average
-		CellData->InsertNextValue(this->TerminalSegmentMax);
-
-		CellData->InsertNextValue(this->DiamThresholdMin);
-		CellData->InsertNextValue(this->DiamThresholdTotal/tempTerminalTips);
-		CellData->InsertNextValue(this->DiamThresholdMax);
-		CellData->InsertNextValue(this->LastParentDiamMin);
-		CellData->InsertNextValue(this->TotalLastParentDiam/tempTerminalTips);
-		CellData->InsertNextValue(this->LastParentDiamMax);
-
-		CellData->InsertNextValue(this->HillmanThreshMin); 
-		if (this->terminalBifCount != 0)
-		{
-			CellData->InsertNextValue(this->HillmanThreshTotal/ this->terminalBifCount);
-		}else
+	double AveAzimuth = -PI;
+	double AveElevation = -PI;
+	if (this->stems !=0)
+	{
+		AveAzimuth = this->Azimuth / this->stems;
+		AveElevation = this->Elevation / this->stems;
+	}
+	values.push_back(this->AzimuthMin);
+	values.push_back(AveAzimuth);
+	values.push_back(this->AzimuthMax);
+	values.push_back(this->ElevationMin);
+	values.push_back(AveElevation);
+	values.push_back(this->ElevationMax);
+
+	if (this->BifTorqueLocalCount == 0)
+	{
+		this->BifTorqueLocalCount = 1;
+	}
+	if (this->BifTorqueRemoteCount == 0)
+	{
+		this->BifTorqueRemoteCount = 1;
+	}
+	if (this->BifTiltLocalCount == 0)
+	{
+		this->BifTiltLocalCount = 1;
+	}
+	if (this->BifTiltRemoteCount == 0)
+	{
+		this->BifTiltRemoteCount = 1;
+	}
+	values.push_back(this->BifAmplLocalMin);
+	values.push_back(this->BifAmplLocal / tempActualBifurcations);
+	values.push_back(this->BifAmplLocalMax);
+	values.push_back(this->BifTiltLocalMin);
+	values.push_back(this->BifTiltLocal / this->BifTiltLocalCount);
+	values.push_back(this->BifTiltLocalMax);
+	values.push_back(this->BifTorqueLocalMin);
+	values.push_back(this->BifTorqueLocal/ this->BifTorqueLocalCount);
+	values.push_back(this->BifTorqueLocalMax);
+
+	values.push_back(this->BifAmplRemoteMin);
+	values.push_back(this->BifAmplRemote / tempActualBifurcations);
+	values.push_back(this->BifAmplRemoteMax);
+	values.push_back(this->BifTiltRemoteMin);
+	values.push_back(this->BifTiltRemote / this->BifTiltRemoteCount);
+	values.push_back(this->BifTiltRemoteMax);
+	values.push_back(this->BifTorqueRemoteMin);
+	values.push_back(this->BifTorqueRemote/ this->BifTorqueRemoteCount);
+	values.push_back(this->BifTorqueRemoteMax);
+
+	int tempTerminalTips = 1;
+	if (this->terminalTips != 0)
+	{
+		tempTerminalTips = this->terminalTips;
+	}
+	values.push_back(this->MinTerminalLevel);
+	values.push_back(this->TerminalPathLengthMin);
+	values.push_back(this->SumTerminalLevel /tempTerminalTips);//average terminal level
+	values.push_back(this->TerminalPathLength/tempTerminalTips);//now average path to end
+	values.push_back(this->MaxTerminalLevel);
+	values.push_back(this->TerminalPathLengthMax);
+
+	values.push_back(this->TerminalSegmentTotal);
+	values.push_back(this->TerminalSegmentMin);
+	values.push_back(this->TerminalSegmentTotal / tempTerminalTips); //average
+	values.push_back(this->TerminalSegmentMax);
+
+	values.push_back(this->DiamThresholdMin);
+	values.push_back(this->DiamThresholdTotal/tempTerminalTips);
+	values.push_back(this->DiamThresholdMax);
+	values.push_back(this->LastParentDiamMin);
+	values.push_back(this->TotalLastParentDiam/tempTerminalTips);
+	values.push_back(this->LastParentDiamMax);
+
+	values.push_back(this->HillmanThreshMin); 
+	if (this->terminalBifCount != 0)
+	{
+		values.push_back(this->HillmanThreshTotal/ this->terminalBifCount);
+	}else
+	{
+		values.push_back(-PI);
+	}
+	values.push_back(this->HillmanThreshMax);
+
+	values.push_back(this->BranchPtToSomaEucDisMin);
+	values.push_back(this->BranchPtToSomaEucDisTotal/tempBranchPoints);
+	values.push_back(this->BranchPtToSomaEucDisMax);
+	values.push_back(this->TipToSomaEucDisMin);
+	values.push_back(this->TipToSomaEucDisTotal/tempTerminalTips);
+	values.push_back(this->TipToSomaEucDisMax);
+
+	values.push_back(this->tipMagnitude);
+	values.push_back(this->tipAzimuth);
+	values.push_back(this->tipElevation);
+
+	/*values.push_back(this->prediction);
+	values.push_back(this->confidence);*/
+	values.push_back(this->segments[0]->GetDistanceToROI());
+}
+vtkSmartPointer<vtkVariantArray> CellTrace::DataRow()
+{
+	if (this->modified)
+	{
+		std::vector<double> values;
+		this->FeatureValues(values);
+
+		CellData->Reset();
+		for (unsigned int i = 0; i + 1 < values.size(); i++)
 		{
-			CellData->InsertNextValue(-PI);
+			CellData->InsertNextValue(values[i]);
 		}
-		CellData->InsertNextValue(this->HillmanThreshMax);
-
-		CellData->InsertNextValue(this->BranchPtToSomaEucDisMin);
-		CellData->InsertNextValue(this->BranchPtToSomaEucDisTotal/tempBranchPoints);
-		CellData->InsertNextValue(this->BranchPtToSomaEucDisMax);
-		CellData->InsertNextValue(this->TipToSomaEucDisMin);
-		CellData->InsertNextValue(this->TipToSomaEucDisTotal/tempTerminalTips);
-		CellData->InsertNextValue(this->TipToSomaEucDisMax);
-
-		CellData->InsertNextValue(this->tipMagnitude);
-		CellData->InsertNextValue(this->tipAzimuth);
-		CellData->InsertNextValue(this->tipElevation);
-
+		//the trace file goes before the distance to device
 		CellData->InsertNextValue(this->GetFileName().c_str());
-		/*CellData->InsertNextValue(this->prediction);
-		CellData->InsertNextValue(this->confidence);*/
-		CellData->InsertNextValue( this->segments[0]->GetDistanceToROI());
+		CellData->InsertNextValue(values.back());
 		//std::cout << this->FileName << std::endl;
 		this->modified = false;
 	}
@@ -807,6 +849,7 @@ vtkSmartPointer<vtkVariantArray> CellTrace::GetExtendedDataRow(std::vector<std::
 vtkSmartPointer<vtkVariantArray> CellTrace::BoundsRow()
 {
 	// id, somaX somaY somaZ min/max xyz, skewness xyz
+	this->UpdateFeatures();
 	vtkSmartPointer<vtkVariantArray> CellBoundsRow = vtkSmartPointer<vtkVariantArray>::New();
 	CellBoundsRow->InsertNextValue(this->segments[0]->GetId());
 	CellBoundsRow->InsertNextValue(this->somaX);
@@ -822,6 +865,7 @@ vtkSmartPointer<vtkVariantArray> CellTrace::BoundsRow()
 }
 std::string CellTrace::BasicFeatureString()
 {
+	this->UpdateFeatures();
 	std::stringstream features;
 	features << this->GetFileName().c_str() << "\t";
 	features << this->somaX << "\t";
@@ -831,6 +875,7 @@ std::string CellTrace::BasicFeatureString()
 }
 std::set<long int> CellTrace::TraceIDsInCell()
 {
+	this->UpdateFeatures();
 	return this->IDs;
 }
 unsigned int CellTrace::rootID()
@@ -850,6 +895,11 @@ std::vector<TraceLine *> CellTrace::getSegments()
 
 std::vector<std::string> CellTrace::calculateConvexHull()
 {
+	/*!
+	* plain geometry, safe to run for different cells at once;
+	* the actors are made on demand by the getters below
+	*/
+	this->UpdateFeatures();
 	std::vector<std::string> convexHullHeaders;
 	if(!delaunayCreated)
 	{
@@ -858,17 +908,13 @@ std::vector<std::string> CellTrace::calculateConvexHull()
 		point[1] = this->somaY;
 		point[2] = this->somaZ;
 
-		ConvexHull3D * convexHull = new ConvexHull3D();
-		convexHull->setPoints(tips);
-		convexHull->setReferencePt(point);
-		convexHull->calculate();
-		convexHull->calculateEllipsoid();
-
-		delaunayActor = convexHull->getActor();
-		ellipsoidActor = convexHull->get3DEllipseActor();
+		this->convexHull.setPoints(tips);
+		this->convexHull.setReferencePt(point);
+		this->convexHull.calculate();
+		this->convexHull.calculateEllipsoid();
 
-		convexHullHeaders = convexHull->getConvexHullHeaders();
-		double* convexHullValues = convexHull->getConvexHullValues();
+		convexHullHeaders = this->convexHull.getConvexHullHeaders();
+		double* convexHullValues = this->convexHull.getConvexHullValues();
 
 		int convexHullValueIndex = 0;
 		std::vector<std::string>::iterator headerIter;
@@ -888,7 +934,7 @@ vtkSmartPointer<vtkActor> CellTrace::GetDelaunayActor()
 	{
 		this->calculateConvexHull();
 	}
-	return delaunayActor;
+	return this->convexHull.getActor();
 }
 
 vtkSmartPointer<vtkActor> CellTrace::GetEllipsoidActor()
@@ -897,7 +943,7 @@ vtkSmartPointer<vtkActor> CellTrace::GetEllipsoidActor()
 	{
 		this->calculateConvexHull();
 	}
-	return ellipsoidActor;
+	return this->convexHull.get3DEllipseActor();
 }
 
 std::vector<std::string> CellTrace::calculateAnglesToDevice()
@@ -914,8 +960,13 @@ std::vector<std::string> CellTrace::calculateAnglesToDevice()
 	return DeviceAngleHeaders;
 }
 
-std::string CellTrace::calculateDistanceToVessel(FloatImageType::Pointer distanceMap, ImageType::RegionType region)
+bool CellTrace::calculateDistanceToVessel(const FloatImageType *distanceMap, const ImageType::RegionType &region)
 {
+	/*!
+	* only reads the map, so cells can be sampled in parallel;
+	* the caller reports the cells that were skipped
+	*/
+	this->UpdateFeatures();
 	itk::Index<3> somaIndex;
 	somaIndex[0] = this->somaX;
 	somaIndex[1] = this->somaY;
@@ -924,14 +975,9 @@ std::string CellTrace::calculateDistanceToVessel(FloatImageType::Pointer distanc
 	std::string vesselHeader = "Distance to Vessel";
 	if (region.IsInside(somaIndex))
 	{
-		distanceMap->GetPixel(somaIndex);
 		this->addNewFeature(vesselHeader,distanceMap->GetPixel(somaIndex));
+		return true;
 	}
-	else
-	{
-		std::cout << this->somaX << "," << this->somaY << "," << this->somaZ << " Cell is outside of the vessel image... skipped" << std::endl;
-		this->addNewFeature(vesselHeader,-1);
-	}
-
-	return vesselHeader;
-}
\ No newline at end of file
+	this->addNewFeature(vesselHeader,-1);
+	return false;
+}
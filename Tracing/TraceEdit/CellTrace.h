@@ -37,6 +37,9 @@ public:
 	CellTrace();
 	CellTrace(std::vector<TraceLine*> Segments);
 	void setTraces(std::vector<TraceLine*> Segments);
+	//! Walks the segments given to setTraces; the public feature fields are valid after this
+	void UpdateFeatures();
+	void FeatureValues(std::vector<double> &values);
 	vtkSmartPointer<vtkVariantArray> DataRow();
 	vtkSmartPointer<vtkVariantArray> GetExtendedDataRow(std::vector<std::string> FeatureNames);
 	vtkSmartPointer<vtkVariantArray> BoundsRow();
@@ -57,7 +60,8 @@ public:
 	vtkSmartPointer<vtkActor> GetDelaunayActor();
 	vtkSmartPointer<vtkActor> GetEllipsoidActor();
 	std::vector<std::string> calculateAnglesToDevice();
-	std::string calculateDistanceToVessel(FloatImageType::Pointer distanceMap, ImageType::RegionType region);
+	//! false when the soma is outside region, the feature is then -1
+	bool calculateDistanceToVessel(const FloatImageType *distanceMap, const ImageType::RegionType &region);
 
 	bool modified; //check if data needs to update
 
@@ -127,9 +131,9 @@ private:
 	std::string FileName;
 	std::set<long int> IDs;
 
+	bool featuresPending;
 	bool delaunayCreated;
-	vtkSmartPointer<vtkActor> delaunayActor;
-	vtkSmartPointer<vtkActor> ellipsoidActor;
+	ConvexHull3D convexHull;
 
 	std::vector<TraceBit> tips;
 };
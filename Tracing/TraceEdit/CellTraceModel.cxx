@@ -250,42 +250,39 @@ void CellTraceModel::SetupHeaders()
 		this->headers.push_back(QString(this->AdditionalHeaders[k].c_str()));
 	}
 	
-	int numHeaders = (int)this->headers.size();
-	//std::cout<<numHeaders << "\t features computed\n";
-	
-	vtkSmartPointer<vtkVariantArray> column = vtkSmartPointer<vtkVariantArray>::New();
-	for(int i=0; i < numHeaders; ++i)
-    {		
-		column = vtkSmartPointer<vtkVariantArray>::New();
-		column->SetName( this->headers.at(i).toStdString().c_str() );
-		this->DataTable->AddColumn(column);
-    }
+	//the columns are created by the feature engine in SyncModel
 }
 void CellTraceModel::SyncModel()
 {	
-	int size = this->AdditionalHeaders.size();
-	this->DataTable->Initialize();	
 	this->Selection->clear();
 	//this->CellIDLookupMAP.clear();
 	this->SetupHeaders();
+
+	std::vector<std::string> basicHeaders;
+	int numBasic = (int)this->headers.size() - (int)this->AdditionalHeaders.size();
+	for (int i = 0; i < numBasic; i++)
+	{
+		basicHeaders.push_back(this->headers.at(i).toStdString());
+	}
+	std::vector<CellTrace*> cells;
+	cells.reserve(this->Cells.size());
 	for (CellIDLookupIter = this->Cells.begin();  CellIDLookupIter != this->Cells.end(); CellIDLookupIter ++)
 	{
-		if (size == 0)
-		{
-			this->DataTable->InsertNextRow((*CellIDLookupIter).second->DataRow());
-			//this->CellIDLookupMAP[ this->Cells[i]->rootID() ] = this->Cells[i];
-		}
-		else
-		{
-			this->DataTable->InsertNextRow((*CellIDLookupIter).second->GetExtendedDataRow(this->AdditionalHeaders));
-			//this->CellIDLookupMAP[ this->Cells[i]->rootID() ] = this->Cells[i];
-		}
+		cells.push_back((*CellIDLookupIter).second);
 	}
+	//one row per cell, computed in parallel across cells
+	this->FeatureEngine.Compute(cells, basicHeaders, this->AdditionalHeaders, this->DataTable);
+
 	this->CellClusterSelection->SetObjectTable(this->DataTable);
 	//this->CellClusterManager->setVisible(true);
 }
 
 
+CellFeatureEngine * CellTraceModel::GetFeatureEngine()
+{
+	return &this->FeatureEngine;
+}
+
 vtkSmartPointer<vtkTable> CellTraceModel::getDataTable()
 {
 	return this->DataTable;
@@ -537,10 +534,9 @@ void CellTraceModel::createCellToCellGraph()
 	{
 		CellTrace* current = (*CellIDLookupIter).second;
 		unsigned int id = current->rootID();
-		std::vector<double> cellCoord;
-		cellCoord.push_back(current->somaX);
-		cellCoord.push_back(current->somaY);
-		cellCoord.push_back(current->somaZ);
+		double somaCoord[3];
+		current->getSomaCoord(somaCoord);
+		std::vector<double> cellCoord(somaCoord, somaCoord + 3);
 		centroidMap[id] = cellCoord;
 	}//end for cell size
 	kNearestObjects<3>* KNObj = new kNearestObjects<3>(centroidMap);
@@ -57,6 +57,7 @@ limitations under the License.
 #include "SelectiveClustering.h"
 #include "QvtkTableView.h"
 #include "SelectionUtilities.h"
+#include "CellFeatureEngine.h"
 
 // 
 #include <map>
@@ -98,6 +99,7 @@ public:
 	double average(std::vector< std::pair<unsigned int, double> > ID);
 	int AddNewFeatureHeader(std::string NewHeader);
 	void SyncModel();
+	CellFeatureEngine * GetFeatureEngine();
 	void CloseClusterManager();
 	SelectiveClustering *GetCellSelectiveClustering();
 
@@ -109,6 +111,7 @@ private:
 	std::vector<std::string> AdditionalHeaders;
 	void SetupHeaders();
 	vtkSmartPointer<vtkTable> DataTable;
+	CellFeatureEngine FeatureEngine;
 
 	//std::map< int ,CellTrace*> CellIDLookupMAP;
 	std::map< int ,CellTrace*>::iterator CellIDLookupIter;
@@ -1,5 +1,8 @@
 #include "ConvexHull3D.h"
 
+#include <algorithm>
+#include <set>
+
 ConvexHull3D::ConvexHull3D()
 {
 	for (int i = 0; i < 11; i++)
@@ -8,12 +11,15 @@ ConvexHull3D::ConvexHull3D()
 	}
 	this->convexHullArea = -1;
 	this->convexHullVol = -1;
+	this->delaunayActorCurrent = false;
+	this->ellipsoidActorCurrent = false;
 	refPt[0] = -1;
 	refPt[1] = -1;
 	refPt[2] = -1;
 	cellCentroid[0] = -1;
 	cellCentroid[1] = -1;
 	cellCentroid[2] = -1;
+	this->ellipsoidCalculated = false;
 }
 
 void ConvexHull3D::setPoints(std::vector<TraceBit> &pts)
@@ -22,40 +28,273 @@ void ConvexHull3D::setPoints(std::vector<TraceBit> &pts)
 	 * @author Audrey Cheong
 	 * @param pts data points
 	 */
-	vtkSmartPointer<vtkPolyData> polydata = vtkSmartPointer<vtkPolyData>::New();
-
-	vtkSmartPointer<vtkPoints> inputPoints = vtkSmartPointer<vtkPoints>::New();
+	std::vector<double> inputPoints;
+	inputPoints.reserve(3*pts.size());
 	for(unsigned int counter=0; counter<pts.size(); counter++)
 	{
-		inputPoints->InsertNextPoint(pts[counter].x,pts[counter].y,pts[counter].z);
+		inputPoints.push_back(pts[counter].x);
+		inputPoints.push_back(pts[counter].y);
+		inputPoints.push_back(pts[counter].z);
 	}
+	this->buildHull(inputPoints);
 
-	polydata->SetPoints(inputPoints);
+	//a new point set starts the measurements over
+	for (int i = 0; i < 11; i++)
+	{
+		convexHullValues[i] = -1;
+	}
+	this->convexHullArea = -1;
+	this->convexHullVol = -1;
+	this->ellipsoidCalculated = false;
+	this->delaunayActorCurrent = false;
+	this->ellipsoidActorCurrent = false;
+}
 
-	// Generate a tetrahedral mesh from the input points. By
-	// default, the generated volume is the convex hull of the points.
-	delaunay3D = vtkSmartPointer<vtkDelaunay3D>::New();
-	delaunay3D->SetInput(polydata);
-	delaunay3D->SetTolerance(0.01);
-	delaunay3D->Update();
+namespace
+{
+struct HullFace
+{
+	int v[3];
+	double n[3];
+	double d;
+	bool alive;
+};
 
-	//Surface filter is used to get the surfaces outside of the volume
-	vtkSmartPointer<vtkDataSetSurfaceFilter> surfaceFilter = vtkSmartPointer<vtkDataSetSurfaceFilter>::New();
-	surfaceFilter->SetInputConnection(delaunay3D->GetOutputPort());
-	surfaceFilter->Update();
+void SetHullFace(HullFace &face, const std::vector<double> &pts, int a, int b, int c, const double inside[3])
+{
+	/*!
+	 * the plane of a,b,c with the normal pointing away from inside
+	 */
+	const double *pa = &pts[3*a];
+	const double *pb = &pts[3*b];
+	const double *pc = &pts[3*c];
+	double u[3], w[3];
+	for (int i = 0; i < 3; i++)
+	{
+		u[i] = pb[i] - pa[i];
+		w[i] = pc[i] - pa[i];
+	}
+	face.n[0] = u[1]*w[2] - u[2]*w[1];
+	face.n[1] = u[2]*w[0] - u[0]*w[2];
+	face.n[2] = u[0]*w[1] - u[1]*w[0];
+	double length = sqrt(face.n[0]*face.n[0] + face.n[1]*face.n[1] + face.n[2]*face.n[2]);
+	if (length > 0)
+	{
+		face.n[0] /= length;
+		face.n[1] /= length;
+		face.n[2] /= length;
+	}
+	face.d = face.n[0]*pa[0] + face.n[1]*pa[1] + face.n[2]*pa[2];
+	face.v[0] = a;
+	face.v[1] = b;
+	face.v[2] = c;
+	if (face.n[0]*inside[0] + face.n[1]*inside[1] + face.n[2]*inside[2] > face.d)
+	{
+		face.n[0] = -face.n[0];
+		face.n[1] = -face.n[1];
+		face.n[2] = -face.n[2];
+		face.d = -face.d;
+		face.v[1] = c;
+		face.v[2] = b;
+	}
+	face.alive = true;
+}
 
-	vtkSmartPointer<vtkDataSetMapper> delaunayMapper = vtkSmartPointer<vtkDataSetMapper>::New();
-	delaunayMapper->SetInputConnection(surfaceFilter->GetOutputPort());
+double HullDistance(const HullFace &face, const double *p)
+{
+	return face.n[0]*p[0] + face.n[1]*p[1] + face.n[2]*p[2] - face.d;
+}
+}
 
-	delaunayActor = vtkSmartPointer<vtkActor>::New();
-	delaunayActor->SetMapper(delaunayMapper);
-	delaunayActor->GetProperty()->SetColor(1,0.0,0.0);
+void ConvexHull3D::buildHull(const std::vector<double> &pts)
+{
+	/*!
+	 * Incremental convex hull. Points that do not span a volume give no
+	 * triangles and every point is kept as a surface point.
+	 */
+	this->surfacePoints.clear();
+	this->surfaceTriangles.clear();
+	int numPts = (int) pts.size()/3;
+	if (numPts < 4)
+	{
+		this->surfacePoints = pts;
+		return;
+	}
+
+	//tolerance relative to the extent of the points
+	double extent = 0;
+	for (int i = 1; i < numPts; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			extent = std::max(extent, fabs(pts[3*i+k] - pts[k]));
+		}
+	}
+	double eps = 1e-9 * (extent > 0 ? extent : 1);
+
+	//initial tetrahedron from extreme points
+	int i0 = 0;
+	for (int i = 1; i < numPts; i++)
+	{
+		if (pts[3*i] < pts[3*i0])
+		{
+			i0 = i;
+		}
+	}
+	int i1 = -1;
+	double best = eps;
+	for (int i = 0; i < numPts; i++)
+	{
+		double dx = pts[3*i] - pts[3*i0], dy = pts[3*i+1] - pts[3*i0+1], dz = pts[3*i+2] - pts[3*i0+2];
+		double dist = sqrt(dx*dx + dy*dy + dz*dz);
+		if (dist > best)
+		{
+			best = dist;
+			i1 = i;
+		}
+	}
+	if (i1 < 0)
+	{
+		this->surfacePoints = pts;
+		return;
+	}
+	double axis[3];
+	for (int k = 0; k < 3; k++)
+	{
+		axis[k] = (pts[3*i1+k] - pts[3*i0+k]) / best;
+	}
+	int i2 = -1;
+	best = eps;
+	for (int i = 0; i < numPts; i++)
+	{
+		double r[3];
+		for (int k = 0; k < 3; k++)
+		{
+			r[k] = pts[3*i+k] - pts[3*i0+k];
+		}
+		double c0 = r[1]*axis[2] - r[2]*axis[1];
+		double c1 = r[2]*axis[0] - r[0]*axis[2];
+		double c2 = r[0]*axis[1] - r[1]*axis[0];
+		double dist = sqrt(c0*c0 + c1*c1 + c2*c2);
+		if (dist > best)
+		{
+			best = dist;
+			i2 = i;
+		}
+	}
+	if (i2 < 0)
+	{
+		this->surfacePoints = pts;
+		return;
+	}
+	double origin[3] = {0, 0, 0};
+	HullFace base;
+	SetHullFace(base, pts, i0, i1, i2, origin);
+	int i3 = -1;
+	best = eps;
+	for (int i = 0; i < numPts; i++)
+	{
+		double dist = fabs(HullDistance(base, &pts[3*i]));
+		if (dist > best)
+		{
+			best = dist;
+			i3 = i;
+		}
+	}
+	if (i3 < 0)
+	{
+		this->surfacePoints = pts;
+		return;
+	}
 
-/*	vtkSmartPointer<vtkPoints> outputPoints = polyData->GetPoints();
-	std::cout << "Num of output point: " << outputPoints->GetNumberOfPoints() << std::endl;*/
+	double inside[3];
+	for (int k = 0; k < 3; k++)
+	{
+		inside[k] = (pts[3*i0+k] + pts[3*i1+k] + pts[3*i2+k] + pts[3*i3+k]) / 4;
+	}
+	std::vector<HullFace> faces(4);
+	SetHullFace(faces[0], pts, i0, i1, i2, inside);
+	SetHullFace(faces[1], pts, i0, i1, i3, inside);
+	SetHullFace(faces[2], pts, i0, i2, i3, inside);
+	SetHullFace(faces[3], pts, i1, i2, i3, inside);
+
+	std::vector<int> visible;
+	std::set< std::pair<int,int> > edges;
+	for (int p = 0; p < numPts; p++)
+	{
+		if (p == i0 || p == i1 || p == i2 || p == i3)
+		{
+			continue;
+		}
+		const double *point = &pts[3*p];
+		visible.clear();
+		for (unsigned int f = 0; f < faces.size(); f++)
+		{
+			if (faces[f].alive && HullDistance(faces[f], point) > eps)
+			{
+				visible.push_back(f);
+			}
+		}
+		if (visible.empty())
+		{
+			continue;	//inside the current hull
+		}
+		//the horizon is made of the visible edges whose twin is not visible
+		edges.clear();
+		for (unsigned int f = 0; f < visible.size(); f++)
+		{
+			HullFace &face = faces[visible[f]];
+			for (int k = 0; k < 3; k++)
+			{
+				edges.insert(std::make_pair(face.v[k], face.v[(k+1)%3]));
+			}
+			face.alive = false;
+		}
+		std::set< std::pair<int,int> >::iterator edge;
+		for (edge = edges.begin(); edge != edges.end(); edge++)
+		{
+			if (edges.find(std::make_pair((*edge).second, (*edge).first)) == edges.end())
+			{
+				HullFace face;
+				SetHullFace(face, pts, (*edge).first, (*edge).second, p, inside);
+				faces.push_back(face);
+			}
+		}
+	}
 
-	//save output for area and volume calculation
-	this->surfacePolyData = surfaceFilter->GetOutput();
+	//keep only the points on the hull, renumbered in input order
+	std::vector<int> vertexIndex(numPts, -1);
+	for (unsigned int f = 0; f < faces.size(); f++)
+	{
+		if (faces[f].alive)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				vertexIndex[faces[f].v[k]] = 0;
+			}
+		}
+	}
+	int numSurfacePoints = 0;
+	for (int i = 0; i < numPts; i++)
+	{
+		if (vertexIndex[i] == 0)
+		{
+			vertexIndex[i] = numSurfacePoints++;
+			this->surfacePoints.push_back(pts[3*i]);
+			this->surfacePoints.push_back(pts[3*i+1]);
+			this->surfacePoints.push_back(pts[3*i+2]);
+		}
+	}
+	for (unsigned int f = 0; f < faces.size(); f++)
+	{
+		if (faces[f].alive)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				this->surfaceTriangles.push_back(vertexIndex[faces[f].v[k]]);
+			}
+		}
+	}
 }
 
 void ConvexHull3D::setReferencePt(double point[3])
@@ -77,57 +316,46 @@ bool ConvexHull3D::calculate()
 	 * @return check whether calculations are successful
 	 */
 	//area calculation
-	vtkSmartPointer<vtkPoints> boundaryPoints = this->surfacePolyData->GetPoints();
-	vtkSmartPointer<vtkTriangle> triangle = vtkSmartPointer<vtkTriangle>::New();
-	vtkSmartPointer<vtkTetra> tetra = vtkSmartPointer<vtkTetra>::New();
-
-	vtkCellArray * polys = this->surfacePolyData->GetPolys();
-	vtkIdType nPts = 0;
-	vtkIdType * ptIds = polys->GetPointer();
-	for (polys->InitTraversal(); polys->GetNextCell(nPts,ptIds);)
+	for (unsigned int t = 0; t + 2 < this->surfaceTriangles.size(); t += 3)
 	{
-		double vertex[3];
-		double list [3][3]; // 3D triangle
-		for (int j = 0; j < nPts; j++)
-		{
-			boundaryPoints->GetPoint(ptIds[j], vertex);
-			list[j][0] = vertex[0];
-			list[j][1] = vertex[1];
-			list[j][2] = vertex[2];
-			//std::cout << j << ": " << vertex[0] << " " << vertex[1] << " " << vertex[2] << std::endl;
-		}
 		//calculate area
 		double point1[3],point2[3],point3[3];
 		for (int i = 0; i<3; i++)
 		{
-			point1[i] = list[0][i];
-			point2[i] = list[1][i];
-			point3[i] = list[2][i];
+			point1[i] = this->surfacePoints[3*this->surfaceTriangles[t]+i];
+			point2[i] = this->surfacePoints[3*this->surfaceTriangles[t+1]+i];
+			point3[i] = this->surfacePoints[3*this->surfaceTriangles[t+2]+i];
+		}
+		double u[3], v[3], w[3];
+		for (int i = 0; i<3; i++)
+		{
+			u[i] = point2[i] - point1[i];
+			v[i] = point3[i] - point1[i];
+			w[i] = point1[i] - this->refPt[i];
 		}
-		this->convexHullArea += triangle->TriangleArea(point1,point2,point3);
-		this->convexHullVol += abs(tetra->ComputeVolume(refPt,point1,point2,point3));
+		double cross[3];
+		cross[0] = u[1]*v[2] - u[2]*v[1];
+		cross[1] = u[2]*v[0] - u[0]*v[2];
+		cross[2] = u[0]*v[1] - u[1]*v[0];
+		this->convexHullArea += 0.5*sqrt(cross[0]*cross[0] + cross[1]*cross[1] + cross[2]*cross[2]);
+		//tetrahedron from the reference point to the triangle
+		this->convexHullVol += fabs(cross[0]*w[0] + cross[1]*w[1] + cross[2]*w[2])/6;
 	}
 
-	//std::cout << "Number of surface points: " << surfacePolyData->GetNumberOfPoints() << std::endl;
-	
 	//calculate based on surface points only
 	double totalX = 0; double totalY = 0; double totalZ = 0;
-	for (vtkIdType i = 0; i < surfacePolyData->GetNumberOfPoints(); i++)
+	int numOfPts = (int) this->surfacePoints.size()/3;
+	for (int i = 0; i < numOfPts; i++)
 	{
-		double point[3];
-		surfacePolyData->GetPoint(i,point);
-		totalX += point[0]-this->refPt[0];
-		totalY += point[1]-this->refPt[1];
-		totalZ += point[2]-this->refPt[2];
-		//std::cout << "Surface point " << i << " : (" << point[0] << " " << point[1] << " " << point[2] << ")" << std::endl;
+		totalX += this->surfacePoints[3*i]-this->refPt[0];
+		totalY += this->surfacePoints[3*i+1]-this->refPt[1];
+		totalZ += this->surfacePoints[3*i+2]-this->refPt[2];
 	}
 	double magnitude = sqrt(pow(totalX,2)+pow(totalY,2)+pow(totalZ,2));
 	double azimuth = atan2(totalY,totalX)*180/PI;
 	double hypotenuse = sqrt(pow(totalX,2)+pow(totalY,2));
 	double elevation = atan2(totalZ,hypotenuse)*180/PI;
 
-
-	int numOfPts = surfacePolyData->GetNumberOfPoints();
 	this->cellCentroid[0] = totalX/numOfPts + this->refPt[0];
 	this->cellCentroid[1] = totalY/numOfPts + this->refPt[1];
 	this->cellCentroid[2] = totalZ/numOfPts + this->refPt[2];
@@ -140,7 +368,7 @@ bool ConvexHull3D::calculate()
 	convexHullValues[3] = convexHullArea;
 	convexHullValues[4] = convexHullVol;
 
-	return true;
+	return !this->surfaceTriangles.empty();
 }
 
 vtkSmartPointer<vtkActor> ConvexHull3D::getActor()
@@ -149,7 +377,32 @@ vtkSmartPointer<vtkActor> ConvexHull3D::getActor()
 	 * @author Audrey Cheong
 	 * @return convex hull(vtkActor)
 	 */
-	return delaunayActor;
+	if (!this->delaunayActorCurrent)
+	{
+		vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+		for (unsigned int i = 0; i + 2 < this->surfacePoints.size(); i += 3)
+		{
+			points->InsertNextPoint(this->surfacePoints[i],this->surfacePoints[i+1],this->surfacePoints[i+2]);
+		}
+		vtkSmartPointer<vtkCellArray> triangles = vtkSmartPointer<vtkCellArray>::New();
+		for (unsigned int t = 0; t + 2 < this->surfaceTriangles.size(); t += 3)
+		{
+			vtkIdType ids[3] = {this->surfaceTriangles[t], this->surfaceTriangles[t+1], this->surfaceTriangles[t+2]};
+			triangles->InsertNextCell(3, ids);
+		}
+		vtkSmartPointer<vtkPolyData> surface = vtkSmartPointer<vtkPolyData>::New();
+		surface->SetPoints(points);
+		surface->SetPolys(triangles);
+
+		vtkSmartPointer<vtkPolyDataMapper> delaunayMapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+		delaunayMapper->SetInput(surface);
+
+		this->delaunayActor = vtkSmartPointer<vtkActor>::New();
+		this->delaunayActor->SetMapper(delaunayMapper);
+		this->delaunayActor->GetProperty()->SetColor(1,0.0,0.0);
+		this->delaunayActorCurrent = true;
+	}
+	return this->delaunayActor;
 }
 
 void ConvexHull3D::calculateEllipsoid()
@@ -164,14 +417,13 @@ void ConvexHull3D::calculateEllipsoid()
 	vnl_matrix<double> A(3,3, 0.0); //3x3 matrix, fill with zeroes
 
 	double x_norm,y_norm,z_norm;
-	double point[3];
-	for (vtkIdType i = 0; i < surfacePolyData->GetNumberOfPoints(); i++)
+	int num_of_points = (int) this->surfacePoints.size()/3;
+	for (int i = 0; i < num_of_points; i++)
 	{
 		//normalize points
-		surfacePolyData->GetPoint(i,point);
-		x_norm = point[0]-this->cellCentroid[0];
-		y_norm = point[1]-this->cellCentroid[1];
-		z_norm = point[2]-this->cellCentroid[2];
+		x_norm = this->surfacePoints[3*i]-this->cellCentroid[0];
+		y_norm = this->surfacePoints[3*i+1]-this->cellCentroid[1];
+		z_norm = this->surfacePoints[3*i+2]-this->cellCentroid[2];
 
 		//calculate covariance (symmetric matrix)
 		A(0,0) += pow(x_norm,2);	A(0,1) += x_norm * y_norm;	A(0,2) +=  x_norm * z_norm;
@@ -182,18 +434,10 @@ void ConvexHull3D::calculateEllipsoid()
 		A(2,0) = A(0,2);
 		A(2,1) = A(1,2);
 
-		//std::cout << "Matrix: " << std::endl;
-		//std::cout << A(0,0) << " " << A(0,1) <<  " " << A(0,2) << std::endl;
-		//std::cout << A(1,0) << " " << A(1,1) <<  " " << A(1,2) << std::endl;
-		//std::cout << A(2,0) << " " << A(2,1) <<  " " << A(2,2) << std::endl;
-
 	// get eigenvector corresponding to the smallest and largest eigenvalue (normal to plane)
 	vnl_symmetric_eigensystem<double> eig(A);
 	double eigenvalues[3];
 	double eigenvalue_norm[3]; //length
-	int num_of_points = (int) surfacePolyData->GetNumberOfPoints();
-
-	//std::cout << "Number of points: " << num_of_points << std::endl;
 
 	double min = eig.get_eigenvalue(0);
 	double max = eig.get_eigenvalue(0);
@@ -220,18 +464,17 @@ void ConvexHull3D::calculateEllipsoid()
 	vnl_vector<double> eigenVector_minor = eig.get_eigenvector(median_index).normalize();	//minor axis
 	vnl_vector<double> eigenVector_major = eig.get_eigenvector(max_index).normalize();		//major axis
 
-
-	vtkMatrix4x4 * matrix = vtkMatrix4x4::New();
 	for (int i = 0; i < 3; i++)
 	{
-		//rotation
-		matrix->SetElement(i,0,eigenVector_major.get(i));
-		matrix->SetElement(i,1,eigenVector_minor.get(i));
-		matrix->SetElement(i,2,eigenVector_normal.get(i));
-
-		//position
-		matrix->SetElement(i,3,cellCentroid[i]);
+		this->ellipsoidAxes[i][0] = eigenVector_major.get(i);
+		this->ellipsoidAxes[i][1] = eigenVector_minor.get(i);
+		this->ellipsoidAxes[i][2] = eigenVector_normal.get(i);
 	}
+	this->ellipsoidRadii[0] = eigenvalue_norm[max_index]/2;
+	this->ellipsoidRadii[1] = eigenvalue_norm[median_index]/2;
+	this->ellipsoidRadii[2] = eigenvalue_norm[min_index]/2;
+	this->ellipsoidCalculated = true;
+	this->ellipsoidActorCurrent = false;
 
 	if (num_of_points != 0)
 	{
@@ -253,29 +496,6 @@ void ConvexHull3D::calculateEllipsoid()
 		convexHullValues[10] = sqrt(1.0-pow(convexHullValues[6],2.0)/pow(convexHullValues[5],2.0));
 
 	}
-	//std::cout << "Eigenvector (major axis): " << eigenVector_major.get(0) << " " << eigenVector_major.get(1) << " " << eigenVector_major.get(2) << std::endl;
-
-	//std::cout << "Eigenvector (minor axis): " << eigenVector_minor.get(0) << " " << eigenVector_minor.get(1) << " " << eigenVector_minor.get(2) << std::endl;
-
-	//std::cout << "Eigenvector (normal axis): " << eigenVector_normal.get(0) << " " << eigenVector_normal.get(1) << " " << eigenVector_normal.get(2) << std::endl;
-
-
-	//draw ellipsoid
-	vtkSmartPointer<vtkParametricEllipsoid> parametricObject = vtkSmartPointer<vtkParametricEllipsoid>::New();
-	parametricObject->SetXRadius(eigenvalue_norm[max_index]/2);
-	parametricObject->SetYRadius(eigenvalue_norm[median_index]/2);
-	parametricObject->SetZRadius(eigenvalue_norm[min_index]/2);
-	vtkSmartPointer<vtkParametricFunctionSource> parametricFunctionSource = vtkSmartPointer<vtkParametricFunctionSource>::New();
-	parametricFunctionSource->SetParametricFunction(parametricObject);
-	parametricFunctionSource->Update();
-
-	// Setup mapper and actor
-	vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
-	mapper->SetInputConnection(parametricFunctionSource->GetOutputPort());
-
-	ellipsoidActor = vtkSmartPointer<vtkActor>::New();
-	ellipsoidActor->SetMapper(mapper);
-	ellipsoidActor->SetUserMatrix(matrix);
 }
 
 vtkSmartPointer<vtkActor> ConvexHull3D::get3DEllipseActor()
@@ -284,7 +504,39 @@ vtkSmartPointer<vtkActor> ConvexHull3D::get3DEllipseActor()
 	 * @author Audrey Cheong
 	 * @return ellipsoid(vtkActor)
 	 */
-	return ellipsoidActor;
+	if (!this->ellipsoidActorCurrent && this->ellipsoidCalculated)
+	{
+		vtkSmartPointer<vtkMatrix4x4> matrix = vtkSmartPointer<vtkMatrix4x4>::New();
+		for (int i = 0; i < 3; i++)
+		{
+			//rotation
+			matrix->SetElement(i,0,this->ellipsoidAxes[i][0]);
+			matrix->SetElement(i,1,this->ellipsoidAxes[i][1]);
+			matrix->SetElement(i,2,this->ellipsoidAxes[i][2]);
+
+			//position
+			matrix->SetElement(i,3,cellCentroid[i]);
+		}
+
+		//draw ellipsoid
+		vtkSmartPointer<vtkParametricEllipsoid> parametricObject = vtkSmartPointer<vtkParametricEllipsoid>::New();
+		parametricObject->SetXRadius(this->ellipsoidRadii[0]);
+		parametricObject->SetYRadius(this->ellipsoidRadii[1]);
+		parametricObject->SetZRadius(this->ellipsoidRadii[2]);
+		vtkSmartPointer<vtkParametricFunctionSource> parametricFunctionSource = vtkSmartPointer<vtkParametricFunctionSource>::New();
+		parametricFunctionSource->SetParametricFunction(parametricObject);
+		parametricFunctionSource->Update();
+
+		// Setup mapper and actor
+		vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+		mapper->SetInputConnection(parametricFunctionSource->GetOutputPort());
+
+		this->ellipsoidActor = vtkSmartPointer<vtkActor>::New();
+		this->ellipsoidActor->SetMapper(mapper);
+		this->ellipsoidActor->SetUserMatrix(matrix);
+		this->ellipsoidActorCurrent = true;
+	}
+	return this->ellipsoidActor;
 }
 
 std::vector<std::string> ConvexHull3D::getConvexHullHeaders()
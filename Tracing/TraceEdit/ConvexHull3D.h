@@ -3,23 +3,17 @@
 
 #define PI 3.14159265
 #include <cmath>
+#include <vector>
+#include <string>
 
 #include "TraceBit.h"
 
 #include "vtkSmartPointer.h"
 #include "vtkActor.h"
 #include "vtkCellArray.h"
-#include "vtkDataSetMapper.h"
-#include "vtkDataSetSurfaceFilter.h"
-#include "vtkDelaunay3D.h"
-#include "vtkIdList.h"
-#include "vtkMath.h"
 #include "vtkPoints.h"
 #include "vtkPolyData.h"
 #include "vtkProperty.h"
-#include "vtkTetra.h"
-#include "vtkTriangle.h"
-#include "vtkUnstructuredGrid.h"
 
 #include "vtkParametricEllipsoid.h"
 #include "vtkParametricFunctionSource.h"
@@ -32,6 +26,11 @@
 
 // by Audrey Cheong
 
+/**
+ * The hull and the ellipsoid are plain geometry, so setPoints, calculate and
+ * calculateEllipsoid can run for many cells at once. The VTK actors are only
+ * built by getActor and get3DEllipseActor, which belong to the render thread.
+ */
 class ConvexHull3D
 {
 public:
@@ -51,13 +50,22 @@ public:
 	double* getConvexHullValues();
 
 private:
+	void buildHull(const std::vector<double> &pts);
+
 	double convexHullValues[11];
 	double convexHullArea, convexHullVol;
 	double refPt[3];
 	double cellCentroid[3];
 	vtkSmartPointer<vtkActor> delaunayActor;
 	vtkSmartPointer<vtkActor> ellipsoidActor;
-	vtkSmartPointer<vtkDelaunay3D> delaunay3D;
-	vtkPolyData * surfacePolyData;
+	//the actors are rebuilt by the getters, never released from a worker thread
+	bool delaunayActorCurrent, ellipsoidActorCurrent;
+
+	//hull vertices as x,y,z triplets and its outward facing triangles
+	std::vector<double> surfacePoints;
+	std::vector<int> surfaceTriangles;
+	bool ellipsoidCalculated;
+	double ellipsoidRadii[3];
+	double ellipsoidAxes[3][3];	//major, minor and normal axis in the columns
 };
-#endif
\ No newline at end of file
+#endif
@@ -246,9 +246,10 @@ std::vector<TraceLine*> TraceObject::GetTraceLines()
 			}
 			else
 			{
+				//only this iteration touches the cell, the features are computed later
+				(*it).second->setTraces(segments);
 				#pragma omp critical
 				{
-					(*it).second->setTraces(segments);
 					allTLines.insert(allTLines.end(), segments.begin() ,segments.end());
 				}
 			}
@@ -2670,8 +2671,17 @@ void TraceObject::RunClusteringGTRepDyn(){
 	this->GTCluster->set_repAlpha(this->alphaForClustering);
 	this->GTCluster->set_featureMatrix(feature_mat);
 	this->GTCluster->NormalizeFeatures();
-	this->GTCluster->ComputeCostMatrix();
-	this->GTCluster->RunReplicatorDynamics();
+	// the dense payoff matrix is quadratic in the number of candidate gaps
+	if(feature_mat.rows() > 5000)
+	{
+		this->GTCluster->ComputeSparseCostMatrix(30);
+		this->GTCluster->RunInfectionImmunizationDynamics();
+	}
+	else
+	{
+		this->GTCluster->ComputeCostMatrix();
+		this->GTCluster->RunReplicatorDynamics();
+	}
 	this->GTCluster->ApplySurvivalThreshold();
 	std::vector<bool> cluster_flag = this->GTCluster->get_repEvolvedStrategiesFlag();
 
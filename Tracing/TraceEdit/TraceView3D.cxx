@@ -4284,16 +4284,9 @@ void View3D::CalculateDistanceToVessel()
 			this->ShowCellAnalysis();
 		}
 
-		std::map< int ,CellTrace* >::iterator cellCount = CellModel->GetCelliterator();
-		CellTrace* currCell = (*cellCount).second;
-		std::string DistanceToVesselHeader = currCell->calculateDistanceToVessel(this->VOIType->GetVesselMaskDistanceMap(),this->VOIType->GetVesselImageRegion());
-		cellCount++;
-		for (; cellCount != CellModel->GetCelliteratorEnd(); cellCount++)
-		{
-			CellTrace* currCell = (*cellCount).second;
-			currCell->calculateDistanceToVessel(this->VOIType->GetVesselMaskDistanceMap(),this->VOIType->GetVesselImageRegion());
-		}
-		this->CellModel->AddNewFeatureHeader(DistanceToVesselHeader);
+		//sampled for every cell while the feature table is rebuilt
+		this->CellModel->GetFeatureEngine()->RequestDistanceToVessel(this->VOIType->GetVesselMaskDistanceMap(),this->VOIType->GetVesselImageRegion());
+		this->CellModel->AddNewFeatureHeader("Distance to Vessel");
 
 		this->ShowCellAnalysis();
 		std::cout << "Finished" << std::endl;
@@ -5303,15 +5296,10 @@ void View3D::CalculateDelaunay3D()
 		this->ShowCellAnalysis();
 	}
 
-	std::map< int ,CellTrace* >::iterator cellCount = CellModel->GetCelliterator();
-	CellTrace* currCell = (*cellCount).second;
-	std::vector<std::string> convexHullHeaders = currCell->calculateConvexHull();
-	cellCount++;
-	for (; cellCount != CellModel->GetCelliteratorEnd(); cellCount++)
-	{
-		CellTrace* currCell = (*cellCount).second;
-		currCell->calculateConvexHull();
-	}
+	//the hulls are computed in parallel while the feature table is rebuilt
+	this->CellModel->GetFeatureEngine()->RequestConvexHull();
+	ConvexHull3D headerSource;
+	std::vector<std::string> convexHullHeaders = headerSource.getConvexHullHeaders();
 	for (std::vector<std::string>::iterator iter = convexHullHeaders.begin(); iter != convexHullHeaders.end(); iter++)
 	{
 		this->CellModel->AddNewFeatureHeader(*iter);
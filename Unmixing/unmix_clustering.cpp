@@ -31,6 +31,7 @@
 #include <vnl/vnl_matrix.h>
 #include <vnl/vnl_hungarian_algorithm.h>
 #include <vnl/algo/vnl_qr.h>
+#include <ftkUnmixingEngine.h>
 //#include <ilcplex/ilocplex.h>
 //ILOSTLBEGIN
 
@@ -698,7 +699,7 @@ void my_normalize_columns(vnl_matrix<double> &mat)
 	}
 }
 
-void unmix_clustering(InputImageType::Pointer im[],InputImageType::Pointer om[],int n, int m)
+bool unmix_clustering(InputImageType::Pointer im[],InputImageType::Pointer om[],int n, int m)
 {
 
 	
@@ -976,50 +977,24 @@ start.normalize_columns();
 		}
 		iterator[counter].GoToBegin();
 	}
-	int negcount = 0;
-	for(;!iterator[0].IsAtEnd();)
+	// the input and output channels as raw buffers for the batched unmixing engine
+	const InputPixelType * input[MAX_CHANNELS];
+	InputPixelType * output[MAX_CHANNELS];
+	for(int counter = 0; counter < n; counter++)
+		input[counter] = iterator[counter].GetImage()->GetBufferPointer();
+	for(int counter = 0; counter < m; counter++)
+		output[counter] = om[counter]->GetBufferPointer();
+	int imageSize[3] = { (int)size[0], (int)size[1], (int)size[2] };
+	ftk::UnmixingEngine engine;
+	if(!engine.SetEndmembers(start))
 	{
-		
-
-		double max_proj = -123213;
-		int maxpos = -1;
-#if defined(UNMIX_CLUSTERING_PIXEL_CLASSIFICATION) //|| defined(UNMIX_METHOD3)
-		for(int co = 0; co < m; co++)
-		{
-			double proj_sum = 0;
-			for(int co1 = 0; co1 < n; co1++)
-			{
-				proj_sum += start[co1][co]*iterator[co1].Get();
-			}
-			if(max_proj < proj_sum)
-			{
-				max_proj = proj_sum;
-				maxpos = co;
-			}
-		}
-		//printf("loop 1 complete\n");
-		assignment_iter.Set(maxpos);
-		++assignment_iter;
-
-#endif
-		/*
-		for(int co =0; co<n; co++)
-		{
-			inputmixed[co] = iterator[co].Get();
-		}
-		vnl_vector<double> outputmixed = inputmixed*inveigen;
-		for(int co = 0; co < m; co++)
-		{
-			min_values[co] = MIN(min_values[co],outputmixed[co]);
-		}*/
-		for(int counter =0; counter < n; counter++)
-		{
-			++iterator[counter];
-		}
-
-
-
+		printf("Cannot unmix %d channels into %d\n",n,m);
+		return false;
 	}
+	int negcount = 0;
+#if defined(UNMIX_CLUSTERING_PIXEL_CLASSIFICATION)
+	engine.Classify(input,assignment_image->GetBufferPointer(),imageSize);
+#endif
 
 	for(int counter = 0; counter < n; counter++)
 		iterator[counter].GoToBegin();
@@ -1062,6 +1037,15 @@ start.normalize_columns();
 		//inveigen.normalize_rows();
 #endif
 	vnl_vector<int> class_count(m,0);
+#if defined(UNMIX_CLUSTERING_PIXEL_CLASSIFICATION)
+	engine.ProjectOnLabels(input,assignment_image->GetBufferPointer(),output,imageSize);
+#elif defined(UNMIX_METHOD3)
+	engine.SetSolver(ftk::UnmixingEngine::GREEDY);
+	engine.Unmix(input,output,imageSize);
+#elif !defined(UNMIX_METHOD4) && !defined(NORMALIZE_OUTPUT_ROWS)
+	engine.SetSolver(ftk::UnmixingEngine::LEAST_SQUARES);
+	engine.Unmix(input,output,imageSize);
+#else
 	for(;!oiter[0].IsAtEnd();)
 	{
 		/*
@@ -1075,81 +1059,7 @@ start.normalize_columns();
 		if(final_counter%1000000==0)
 			printf("%.2lf\r",final_counter*100.0/total_voxels);
 
-#if defined(UNMIX_CLUSTERING_PIXEL_CLASSIFICATION)
-		double max_proj = -133434;
-		int maxpos = -1;
-		double proj_sum = 0;
-		for(int co1 = 0; co1 < n; co1++)
-		{
-			proj_sum += start[co1][assignment_iter.Get()]*iterator[co1].Get();
-		}
-		;
-		//printf("loop 1 complete\n");
-		maxpos = assignment_iter.Get();
-		//if(maxpos!=0)
-		//	printf("Its not zero %d\n", rand());
-		for(int co = 0; co < m; co++)
-		{
-			if(maxpos != co)
-			{
-				oiter[co].Set(0);
-			}
-			else
-			{
-				//printf("I did come here\n");
-				if(proj_sum<255)
-					oiter[co].Set(proj_sum);
-				else
-					oiter[co].Set(255);
-			}
-		}
-		
-		++assignment_iter;
-#elif defined(UNMIX_METHOD3)
-		
-		vnl_vector<double> b(n);
-		vnl_vector<int> marker(m,0);
-		for(int co_n = 0; co_n < n; co_n++)
-		{
-			b[co_n] = iterator[co_n].Get();
-		}
-		for(int co_n = 0; co_n < n; co_n++)
-		{
-			int max_proj_co = -1;
-			double max_proj_sum = 1;
-			for(int co_m = 0; co_m < m ; co_m++)
-			{
-				double proj_sum = 0;
-
-				for(int co1 = 0; co1 < n; co1++)
-				{
-					proj_sum += start[co1][co_m]*b[co1];
-				}
-				if(proj_sum > max_proj_sum)
-				{
-					max_proj_sum = proj_sum;
-					max_proj_co = co_m;
-				}
-			}
-			if(max_proj_co >=0)
-			{
-				//if(marker[max_proj_co]==0)
-				{
-					oiter[max_proj_co].Set(MAX(MIN(255,max_proj_sum),0));
-					++class_count[max_proj_co];
-					marker[max_proj_co] = 1;
-					b = b - max_proj_sum*start.get_column(max_proj_co);
-				}
-				/*
-				else
-				{
-					printf("Why am I setting it again?\n");
-				}*/
-			}
-			else
-				break;
-		}
-#elif defined(UNMIX_METHOD4)
+#if defined(UNMIX_METHOD4)
 
 		vnl_vector<double> b(n);
 		for(int co =0; co<n; co++)
@@ -1238,6 +1148,7 @@ start.normalize_columns();
 			++oiter[co];
 		}
 	}
+#endif
 
 	for(int count = 0; count < m; count ++)
 	{
@@ -1256,6 +1167,7 @@ start.normalize_columns();
 	printf("negcount = %d\n",negcount);
 	printf(" Done.\n");
 	printf("End of function\n");
+	return true;
 }
 void unmix_median(InputImageType::Pointer im[],InputImageType::Pointer om[],int n)
 {
@@ -1374,7 +1286,8 @@ int main(int argc, char** argv)
 	}
 
 	printf("Initiating unmixing\n");
-	unmix_clustering(im,om,n,m);
+	if(!unmix_clustering(im,om,n,m))
+		return 1;
 	printf("Finished unmix_clustering\n");
 	printf("About to write output files to disk..\n");
 
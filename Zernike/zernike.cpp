@@ -9,6 +9,7 @@ zernike::zernike()
 {
 	M =0;
     N =0;
+	f = NULL;
 
 }
 zernike::zernike(std::string imageFileName,int orderofmoments)
@@ -49,7 +50,12 @@ zernike::zernike(ImageType::Pointer inputImage,int orderofmoments)
 
 zernike::~zernike()
 {
-
+	if(f)
+	{
+		for (int k = 0; k < M; k++)
+			free(f[k]);
+		free(f);
+	}
 }
 
 /* this method is used to set the input image parameters using  Image Region Iterators
@@ -291,63 +297,93 @@ double zernike::B(int p, int q, int k)
 	    
 }
 
-//to get the gernike moments of order p and repetition q
-double* zernike::CalculateZernike(int p, int q )
+//Coefficients B(p,q,k) of the radial polynomials of all the orders up to
+//orderofmoments. They are computed once instead of for every pixel: the
+//polynomial of order p and repetition q is the sum over k of
+//coefficients[coefficientIndex[p*(orderofmoments+1)+q]+k] * rho^(p-2k).
+void zernike::SetupCoefficients()
 {
-	double * V = (double*) malloc (2* sizeof(double ));
-	V[0]=0.0;V[1]=0.0;
-	double** ro = RHO() ;
-	double** theta = THETA();	
-	int s = (p-abs(q))/2;
+	int P = orderofmoments;
+	coefficientIndex.assign((P+1)*(P+1), -1);
+	coefficients.clear();
+	for(int p=0; p<=P; ++p)
+	{
+		for(int q=0; q<=p; ++q)
+		{
+			if((p-q)%2!=0)
+				continue;
+			coefficientIndex[p*(P+1)+q] = (int)coefficients.size();
+			for(int k=0; k<=(p-q)/2; ++k)
+				coefficients.push_back(B(p,q,k));
+		}
+	}
+}
+
+//all the zernike moments up to orderofmoments in one pass over the image
+std::vector< std::vector<double> > zernike::GetZernike()
+{
+	int P = orderofmoments;
+	SetupCoefficients();
+
+	double** ro = RHO();
+	double** theta = THETA();
+	double b = G00();
+
+	std::vector<double> Vre((P+1)*(P+1), 0.0);
+	std::vector<double> Vim((P+1)*(P+1), 0.0);
+	std::vector<double> power(P+1);
+	std::vector<double> cosq(P+1);
+	std::vector<double> sinq(P+1);
 	for(int i =0; i<M;i++)
 	{
 		for(int j=0;j<N;j++)
 		{
-			double temp = 0.0;
-			if(ro[i][j]<=1.0)
+			if(ro[i][j]>1.0 || f[i][j]==0)
+				continue;
+			power[0] = 1.0;
+			for(int e=1; e<=P; ++e)
+				power[e] = power[e-1]*ro[i][j];
+			for(int q=0; q<=P; ++q)
 			{
-				for(int k = 0 ; k<=s;k++)
-				{
-					temp += B(p,q,k)*pow(ro[i][j],p-2*k);
-				}
-				V[0] +=temp*cos(theta[i][j]*q)*f[i][j];
-				V[1] -=temp*sin(theta[i][j]*q)*f[i][j];
+				cosq[q] = cos(theta[i][j]*q)*f[i][j];
+				sinq[q] = sin(theta[i][j]*q)*f[i][j];
 			}
-			else
+			for(int p=0; p<=P; ++p)
 			{
-				V[0] += 0.0;
-				V[0] += 0.0;
+				for(int q=p%2; q<=p; q+=2)
+				{
+					const double * c = &coefficients[coefficientIndex[p*(P+1)+q]];
+					double temp = 0.0;
+					for(int k=0; k<=(p-q)/2; ++k)
+						temp += c[k]*power[p-2*k];
+					Vre[p*(P+1)+q] += temp*cosq[q];
+					Vim[p*(P+1)+q] -= temp*sinq[q];
+				}
 			}
 		}
 	}
-	double  b = G00();
-	V[0] = V[0]*(p+1)/(3.14259265*b);
-	V[1] = V[1]*(p+1)/(3.14259265*b);
+	for(int k=0;k<M;k++)
+	{
+		free(ro[k]);
+		free(theta[k]);
+	}
 	free(ro);
 	free(theta);
-	return V;
-}
-std::vector< std::vector<double> > zernike::GetZernike()
-{
-	int p = orderofmoments;
-	
+
 	std::vector< std::vector<double> > zern_i;
-	for(int i=0; i<=p; ++i)
+	for(int i=0; i<=P; ++i)
 	{
 		std::vector<double> zern_j;
 		for (int j=0; j<=i; ++j)
 		{
 			if((i-j)%2==0)
 			{
-				double* Z = CalculateZernike(i,j);
-				if (sqrt(Z[0]*Z[0]+Z[1]*Z[1])<0.0001)
+				double Z0 = Vre[i*(P+1)+j]*(i+1)/(3.14259265*b);
+				double Z1 = Vim[i*(P+1)+j]*(i+1)/(3.14259265*b);
+				if (sqrt(Z0*Z0+Z1*Z1)<0.0001)
 					zern_j.push_back(0);
-					//cout<<"Zernike of order ("<<i<<"," <<j<<") are "<< 0 << endl;
 				else
-					zern_j.push_back(sqrt(Z[0]*Z[0]+Z[1]*Z[1]));
-					//cout<<"Zernike of order ("<<i<<"," <<j<<") are "<<sqrt(Z[0]*Z[0]+Z[1]*Z[1])<< endl; 
-				free(Z);
-
+					zern_j.push_back(sqrt(Z0*Z0+Z1*Z1));
 			}
 		}
 		zern_i.push_back(zern_j);
@@ -359,7 +395,6 @@ std::vector< std::vector<double> > zernike::GetZernike()
 
 
 
-
 //
 //
 //
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <math.h>
+#include <vector>
 
 #include "itkImage.h"
 #include "itkIndex.h"
@@ -70,7 +71,10 @@ class zernike
 		double  factorial (int a);
 		//to get the gernike moments of order p and repetition q
 		double  B(int p, int q , int k );
-		double* CalculateZernike(int p , int q);
+		//to fill the table of the co-efficients of the radial polynomials
+		void SetupCoefficients();
+		std::vector<double> coefficients;
+		std::vector<int> coefficientIndex;
 
 };
 } //end namespace ftk
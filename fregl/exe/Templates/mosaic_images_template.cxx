@@ -32,6 +32,8 @@ limitations under the License.
 //    -old_str      The old substr in the image names to be replaced
 //    -new_str      The replacement of the old substr
 //    -output       The output image name.
+//    -chunk        Stream the montage in chunks of this x-y size into
+//                  a MetaImage (.mhd/.raw) file, max blending only.
 
 #include "mosaic_images_template.h"
 #include "itkTimeProbe.h"
@@ -58,7 +60,8 @@ int mosaic_images_template(
 	vul_arg< double > arg_median,
 	vul_arg< int > arg_blending,
 	vul_arg< bool > arg_denoise,
-	vul_arg< bool > arg_write_interproj_image)
+	vul_arg< bool > arg_write_interproj_image,
+	vul_arg< int > arg_chunk)
 {
 	typedef TPixel InputPixelType;
 	typedef itk::Image< InputPixelType, 3 > ImageType;
@@ -114,6 +117,35 @@ int mosaic_images_template(
         name_prefix = arg_outfile();
     }
 
+    if (arg_chunk() > 0) {
+        // Walk the montage in chunks and write them out as they are
+        // finished, so the whole montage never has to be in memory.
+        if (arg_blending() != 0 && arg_blending() != 3)
+            std::cout << "Chunked composition blends with maximum intensity values" << std::endl;
+        fregl_mosaic_composer< InputPixelType > composer(space_transformer, arg_img_path());
+        if (arg_channel.set())
+            composer.set_channel(arg_channel());
+        composer.set_denoise(arg_denoise());
+        composer.set_nearest_neighbor(arg_nn());
+        SizeType chunk_size = space_transformer.montage_size();
+        chunk_size[0] = arg_chunk();
+        chunk_size[1] = arg_chunk();
+        composer.set_chunk_size(chunk_size);
+        std::string name_3d = name_prefix + std::string(".mhd");
+        if (!composer.compose(name_3d))
+            return 1;
+
+        typename WriterType2D::Pointer writer2D = WriterType2D::New();
+        std::string name_2d = name_prefix + std::string("_2d_proj.png");
+        writer2D->SetFileName(name_2d);
+        writer2D->SetInput(composer.projection());
+        writer2D->Update();
+
+        std::string xml_name = name_prefix + std::string(".xml");
+        space_transformer.write_xml(xml_name, name_prefix, name_2d, arg_overlap(), arg_in_anchor(), arg_channel(), 0, arg_nn(), arg_denoise());
+        return 0;
+    }
+
     if (arg_blending() == 2) {
         // This option takes into consideration the photobleahcing issue
         // as well. Photobleaching results in much lower intensity value
@@ -598,7 +630,8 @@ template int mosaic_images_template<unsigned char>(
 	vul_arg< double > arg_median,
 	vul_arg< int > arg_blending,
 	vul_arg< bool > arg_denoise,
-	vul_arg< bool > arg_write_interproj_image
+	vul_arg< bool > arg_write_interproj_image,
+	vul_arg< int > arg_chunk
 );
 
 template int mosaic_images_template<unsigned short>(
@@ -619,5 +652,6 @@ template int mosaic_images_template<unsigned short>(
 	vul_arg< double > arg_median,
 	vul_arg< int > arg_blending,
 	vul_arg< bool > arg_denoise,
-	vul_arg< bool > arg_write_interproj_image
+	vul_arg< bool > arg_write_interproj_image,
+	vul_arg< int > arg_chunk
 );
@@ -8,6 +8,7 @@
 
 #include <fregl/fregl_joint_register.h>
 #include <fregl/fregl_space_transformer.h>
+#include <fregl/fregl_mosaic_composer.h>
 #include <fregl/fregl_util.h>
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
@@ -38,7 +39,8 @@ mosaic_images_template(
 	vul_arg< double > arg_median,
 	vul_arg< int > arg_blending,
 	vul_arg< bool > arg_denoise,
-	vul_arg< bool > arg_write_proj2d
+	vul_arg< bool > arg_write_proj2d,
+	vul_arg< int > arg_chunk
 	);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+//: Benchmark of the phase correlation initializer on synthetic tiles
+//
+//  A field of random gaussian blobs (like nuclei in a max projection)
+//  is generated, and pairs of overlapping tiles with known shifts (and
+//  optionally rotations and scales) are cut out of it with added
+//  noise. Every pair is registered with fregl_phase_correlation, and
+//  the time per pair, the number of confident estimates and the
+//  error of the confident ones are reported.
+//
+//   phase_correlation_benchmark
+//
+//  Optional:
+//    -pairs      Number of tile pairs
+//    -size       Size of the square tiles
+//    -max_size   Size the tiles are downsampled to
+//    -rotation   Also rotate and scale the from tiles
+//    -seed       Seed of the random field
+
+#include "fregl/fregl_phase_correlation.h"
+
+#include <vul/vul_arg.h>
+#include <vul/vul_timer.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+
+//: A random field of w by h pixels
+void make_field(int w, int h, std::vector<float>& field)
+{
+	field.assign((size_t)w*h, 10.0f);
+	int num_blobs = w*h/600;
+	for (int k = 0; k < num_blobs; ++k) {
+		int cx = std::rand()%w, cy = std::rand()%h;
+		double r = 2 + std::rand()%6;
+		double value = 50 + std::rand()%150;
+		for (int y = cy-20; y < cy+20; ++y)
+			for (int x = cx-20; x < cx+20; ++x)
+				if (x >= 0 && y >= 0 && x < w && y < h)
+					field[(size_t)y*w+x] += (float)(value*std::exp(-((x-cx)*(x-cx)+(y-cy)*(y-cy))/(r*r)));
+	}
+}
+
+float sample(const std::vector<float>& field, int w, int h, double x, double y)
+{
+	int ix = (int)std::floor(x), iy = (int)std::floor(y);
+	if (ix < 0 || iy < 0 || ix+1 >= w || iy+1 >= h) return 10.0f;
+	double fx = x-ix, fy = y-iy;
+	const float* p = &field[(size_t)iy*w+ix];
+	return (float)((1-fy)*((1-fx)*p[0] + fx*p[1]) + fy*((1-fx)*p[w] + fx*p[w+1]));
+}
+
+double uniform(double lo, double hi)
+{
+	return lo + (hi-lo)*std::rand()/(double)RAND_MAX;
+}
+
+}  // namespace
+
+int
+main( int argc, char* argv[] )
+{
+	vul_arg< int >    pairs_arg    ("-pairs", "Number of tile pairs", 20);
+	vul_arg< int >    size_arg     ("-size", "Size of the square tiles", 1024);
+	vul_arg< int >    max_size_arg ("-max_size", "Size the tiles are downsampled to", 512);
+	vul_arg< bool >   rotation_arg ("-rotation", "Also rotate and scale the from tiles", false);
+	vul_arg< int >    seed_arg     ("-seed", "Seed of the random field", 1);
+
+	vul_arg_parse( argc, argv );
+
+	std::srand( seed_arg() );
+	int size = size_arg();
+	int field_size = 3*size;
+	std::vector<float> field;
+	make_field(field_size, field_size, field);
+
+	fregl_phase_correlation initializer;
+	initializer.set_max_size( max_size_arg() );
+	initializer.set_rotation_scale( rotation_arg() );
+
+	std::vector<float> from((size_t)size*size), to((size_t)size*size);
+	int confident = 0;
+	double total_time = 0, max_error = 0, sum_error = 0;
+	for (int p = 0; p < pairs_arg(); ++p) {
+		// Tiles of a montage overlap by 10 to 50 percent. The log-polar
+		// spectra only agree when most of the tiles overlap, so rotated
+		// tiles overlap by 50 to 90 percent.
+		double lo = rotation_arg() ? 0.1 : 0.5;
+		double tx = uniform(lo, lo+0.4)*size*(std::rand()%2 ? 1 : -1);
+		double ty = uniform(-0.3, 0.3)*size;
+		if (std::rand()%2) std::swap(tx, ty);
+		double angle = rotation_arg() ? uniform(-0.2, 0.2) : 0;
+		double scale = rotation_arg() ? uniform(0.95, 1.05) : 1;
+
+		// from pixel x is at A*x+t in to
+		double c = std::cos(angle)*scale, s = std::sin(angle)*scale;
+		int origin = size;
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				to[(size_t)y*size+x] = sample(field, field_size, field_size, origin+x, origin+y) + std::rand()%20;
+				from[(size_t)y*size+x] = sample(field, field_size, field_size,
+					origin + c*x - s*y + tx, origin + s*x + c*y + ty) + std::rand()%20;
+			}
+		}
+
+		vul_timer timer;
+		bool ok = initializer.estimate(&from[0], size, size, &to[0], size, size);
+		double seconds = timer.real()/1000.0;
+		total_time += seconds;
+
+		// error at the center of the from tile
+		double cx = 0.5*size, cy = 0.5*size;
+		double ex = initializer.A(0,0)*cx + initializer.A(0,1)*cy + initializer.tx() - (c*cx - s*cy + tx);
+		double ey = initializer.A(1,0)*cx + initializer.A(1,1)*cy + initializer.ty() - (s*cx + c*cy + ty);
+		double error = std::sqrt(ex*ex + ey*ey);
+		if (ok) {
+			++confident;
+			sum_error += error;
+			if (error > max_error) max_error = error;
+		}
+		std::cout << "pair " << p << ": t = (" << tx << ", " << ty << ") estimated (" << initializer.tx()
+			<< ", " << initializer.ty() << "), confidence " << initializer.confidence()
+			<< ", error " << error << " pixels, " << seconds << " s" << std::endl;
+	}
+
+	std::cout << std::endl;
+	std::cout << "Pairs: " << pairs_arg() << ", confident: " << confident << std::endl;
+	std::cout << "Time per pair: " << total_time/pairs_arg() << " s" << std::endl;
+	if (confident) {
+		std::cout << "Mean error: " << sum_error/confident << " pixels, max error: " << max_error << " pixels" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+//: Executable program to register all tiles of a montage
+//
+//  Replaces running register_pair on every pair of a pair list
+//  followed by register_joint. The overlapping pairs are predicted
+//  from the stage positions of the tiles and registered concurrently,
+//  and the joint registration is run on the results directly.
+//
+//   register_montage tile_list
+//
+// where
+//  tile_list       Text file with one tile per line: the image file
+//                  name followed by the stage x, y and optionally z
+//                  position
+//
+// optional arguments:
+//  -output         Name of the output xml file of the joint registration
+//  -stage_scale    Pixels per unit of the stage positions
+//  -min_overlap    Minimum predicted overlap of a pair
+//  -threads        Number of pairs registered at the same time
+//  -cache          Number of images kept in memory
+//  -pair_xml       Also write the xml file of every pairwise registration
+//  -global         Solve all transforms in one sparse least-squares
+//                  problem instead of one problem per anchor image
+//  -max_residual   With -global, drop the pairs with a larger residual
+//                  in pixels and solve again
+//  -16bit          The images are 16 bit
+
+#include <fregl/fregl_registration_scheduler.h>
+#include <fregl/fregl_joint_register.h>
+
+#include "itkMultiThreader.h"
+
+#include <vul/vul_arg.h>
+#include <vul/vul_file.h>
+
+template < class TPixel >
+int
+register_montage(
+	vul_arg< vcl_string > & arg_tile_list,
+	vul_arg< vcl_string > & arg_xml_file,
+	vul_arg< int > & channel,
+	vul_arg< float > & background,
+	vul_arg< double > & smooth,
+	vul_arg< vcl_string > & gdbicp,
+	vul_arg< int > & slices,
+	vul_arg< bool > & scaling_arg,
+	vul_arg< double > & stage_scale,
+	vul_arg< double > & min_overlap,
+	vul_arg< int > & cache,
+	vul_arg< bool > & pair_xml,
+	vul_arg< double > & multiplier,
+	vul_arg< double > & error_bound,
+	vul_arg< bool > & global,
+	vul_arg< double > & max_residual
+)
+{
+	fregl_registration_scheduler< TPixel > scheduler;
+	scheduler.set_stage_scale( stage_scale() );
+	scheduler.set_min_overlap( min_overlap() );
+	if (channel.set()) scheduler.set_channel( channel() );
+	scheduler.set_background( background() );
+	scheduler.set_smoothing( smooth() );
+	scheduler.set_gdbicp( gdbicp() );
+	if (slices.set()) scheduler.set_stack_size( slices() );
+	scheduler.set_scaling( scaling_arg() );
+	scheduler.set_cache_size( cache() );
+
+	if ( !scheduler.read_tile_list( arg_tile_list() ) )
+		return 1;
+	if ( !scheduler.predict_pairs() ) {
+		std::cerr<<"No overlapping tiles"<<std::endl;
+		return 1;
+	}
+	if ( !scheduler.run() ) {
+		std::cerr<<"No pair registered"<<std::endl;
+		return 1;
+	}
+
+	std::vector< fregl_reg_record::Pointer > const & reg_records = scheduler.reg_records();
+	if (pair_xml()) {
+		for (unsigned int i = 0; i<reg_records.size(); i++) {
+			std::string xml_file = vul_file::strip_extension( reg_records[i]->from_image() )+std::string("_to_")+
+				vul_file::strip_extension( reg_records[i]->to_image() )+std::string("_transform.xml");
+			reg_records[i]->write_xml( xml_file );
+		}
+	}
+
+	typename fregl_joint_register< TPixel >::Pointer joint_register =
+		new fregl_joint_register< TPixel >( reg_records, multiplier(), error_bound() );
+	if (global()) {
+		joint_register->build_graph_global();
+		if (max_residual() > 0 && joint_register->prune_links( max_residual() ) > 0)
+			joint_register->build_graph_global();
+	}
+	else
+		joint_register->build_graph();
+	std::cout<<"subgraphs built = "<<joint_register->number_of_subgraphs()<<std::endl;
+	joint_register->write_xml( arg_xml_file(), joint_register->number_of_subgraphs(), false );
+
+	return 0;
+}
+
+int
+main(  int argc, char* argv[] )
+{
+	vul_arg< vcl_string > arg_tile_list  ( 0, "Tile list, one image file name and stage x y [z] per line" );
+	vul_arg< vcl_string > arg_xml_file   ("-output", "Output xml filename", "joint_transforms.xml" );
+	vul_arg< int >       channel         ("-channel", "The color channel (0-red, 1-green, 2-blue), or the image channel if the original image is a lsm image.",0);
+	vul_arg< float >     background      ("-bg", "threshold value for the background", 30);
+	vul_arg< double >    smooth          ("-smooth", "If smoothing is performed", 0.5);
+	vul_arg< vcl_string > gdbicp         ("-gdbicp","The path where the gdbicp exe can be found, used when the phase correlation is not confident","");
+	vul_arg< int >       slices          ("-slices","Number of slices to register. Needed when registering large image stacks on PC.",100);
+	vul_arg< bool >      scaling_arg     ("-scaling","Substantial scaling is expected.", false);
+	vul_arg< double >    stage_scale     ("-stage_scale", "Pixels per unit of the stage positions", 1);
+	vul_arg< double >    min_overlap     ("-min_overlap", "Minimum predicted overlap of a pair, as a fraction of the smaller tile", 0.05);
+	vul_arg< int >       threads         ("-threads", "Number of pairs registered at the same time (0 = number of processors)", 0);
+	vul_arg< int >       cache           ("-cache", "Number of images kept in memory (0 = the widest row plus two per thread)", 0);
+	vul_arg< bool >      pair_xml        ("-pair_xml", "Also write the xml file of every pairwise registration", false);
+	vul_arg< double >    multiplier      ("-multiplier", "The multiplier for the error scale. 4 is a good value.",0);
+	vul_arg< double >    error_bound     ("-error_bound", "The upper bound for the accepted error in the range of [0,1]. The default is 1 (all pairs are accepted)",1);
+	vul_arg< bool >      global          ("-global", "Solve all transforms in one sparse least-squares problem, for large montages", false);
+	vul_arg< double >    max_residual    ("-max_residual", "With -global, drop the pairs with a larger residual in pixels and solve again (0 = keep all)", 0);
+	vul_arg< bool >      sixteen_bit     ("-16bit", "The images are 16 bit", false);
+
+	vul_arg_parse( argc, argv );
+
+	ftk::TaskRuntime::SetNumberOfThreads( threads() );
+	ftk::TaskRuntime::SetStageLimit( "register", threads() );
+	// The pairs run concurrently, so the filters inside one pairwise
+	// registration are kept single threaded
+	if (ftk::TaskRuntime::GetNumberOfThreads() > 1)
+		itk::MultiThreader::SetGlobalDefaultNumberOfThreads( 1 );
+
+	if (sixteen_bit())
+		return register_montage< unsigned short >(arg_tile_list, arg_xml_file, channel, background, smooth, gdbicp,
+			slices, scaling_arg, stage_scale, min_overlap, cache, pair_xml, multiplier, error_bound,
+			global, max_residual);
+	return register_montage< unsigned char >(arg_tile_list, arg_xml_file, channel, background, smooth, gdbicp,
+		slices, scaling_arg, stage_scale, min_overlap, cache, pair_xml, multiplier, error_bound,
+		global, max_residual);
+}
@@ -0,0 +1,473 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#include "fregl_global_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+
+// Cauchy weight function constant, 95% efficiency for gaussian residuals
+const double cauchy_c = 2.3849;
+
+// Smallest robust scale, in pixels. Consistent links have residuals
+// well below a pixel and should all keep full weight.
+const double min_scale = 0.5;
+
+// Strength of the prior of the linear part towards the initial
+// transforms, relative to the stiffness of the correspondences. The
+// overlaps are narrow strips, so without it the noise of the links
+// turns into shear and scaling which builds up along the rows.
+const double prior_weight = 0.1;
+
+inline void add_outer(double* block, double w, const double* a, const double* b)
+{
+	for (int r = 0; r<4; r++)
+		for (int c = 0; c<4; c++)
+			block[r*4+c] += w*a[r]*b[c];
+}
+
+}  // namespace
+
+fregl_global_solver::
+fregl_global_solver()
+: anchor_(0), max_iterations_(10), scale_(0)
+{
+}
+
+int
+fregl_global_solver::
+add_image()
+{
+	image_info image;
+	image.A.set_identity();
+	image.t.fill(0);
+	image.center.fill(0);
+	images_.push_back(image);
+	return int(images_.size())-1;
+}
+
+void
+fregl_global_solver::
+set_anchor(int image)
+{
+	anchor_ = image;
+}
+
+void
+fregl_global_solver::
+set_initial(int image, MatrixType const & A, PointType const & t)
+{
+	images_[image].A = A;
+	images_[image].t = t;
+}
+
+int
+fregl_global_solver::
+add_link(int from, int to, std::vector<PointType> const & from_points,
+	std::vector<PointType> const & to_points)
+{
+	link_info link;
+	link.from = from;
+	link.to = to;
+	link.from_points = from_points;
+	link.to_points = to_points;
+	link.residual = 0;
+	link.weight = 1;
+	links_.push_back(link);
+	return int(links_.size())-1;
+}
+
+void
+fregl_global_solver::
+set_max_iterations(int iterations)
+{
+	max_iterations_ = iterations;
+}
+
+bool
+fregl_global_solver::
+solve()
+{
+	unsigned int num_images = images_.size();
+	if (num_images == 0 || anchor_ < 0 || anchor_ >= int(num_images))
+		return false;
+
+	// Number the unknown images
+	variable_.assign(num_images, -1);
+	int num_unknowns = 0;
+	for (unsigned int i = 0; i<num_images; i++)
+		if (int(i) != anchor_) variable_[i] = num_unknowns++;
+
+	// Center every image on its correspondences
+	std::vector<double> counts(num_images, 0.0);
+	for (unsigned int i = 0; i<num_images; i++) images_[i].center.fill(0);
+	for (unsigned int l = 0; l<links_.size(); l++) {
+		link_info const & link = links_[l];
+		for (unsigned int k = 0; k<link.from_points.size(); k++) {
+			images_[link.from].center += link.from_points[k];
+			images_[link.to].center += link.to_points[k];
+		}
+		counts[link.from] += link.from_points.size();
+		counts[link.to] += link.to_points.size();
+	}
+	for (unsigned int i = 0; i<num_images; i++)
+		if (counts[i] > 0) images_[i].center /= counts[i];
+
+	std::vector<double> prior;
+	transforms_to_parameters(prior);
+
+	order_unknowns();
+	for (unsigned int l = 0; l<links_.size(); l++) links_[l].weight = 1;
+
+	std::vector<double> x;
+	for (int iteration = 0; iteration<max_iterations_; iteration++) {
+		build_system(prior);
+		if (!factor()) return false;
+		back_substitute(x);
+
+		std::vector<double> theta(prior);
+		for (unsigned int i = 0; i<num_images; i++)
+			if (variable_[i] >= 0)
+				std::copy(x.begin()+variable_[i]*12, x.begin()+(variable_[i]+1)*12, theta.begin()+i*12);
+		parameters_to_transforms(theta);
+
+		double change = update_weights();
+		std::cout<<"Global solve iteration "<<iteration<<": scale = "<<scale_
+			<<", largest weight change = "<<change<<std::endl;
+		if (change < 0.01) break;
+	}
+	return true;
+}
+
+void
+fregl_global_solver::
+transforms_to_parameters(std::vector<double>& theta) const
+{
+	// x' = A*(x-c) + (A*c+t)
+	theta.assign(images_.size()*12, 0.0);
+	for (unsigned int i = 0; i<images_.size(); i++) {
+		image_info const & image = images_[i];
+		PointType offset = image.A*image.center + image.t;
+		for (int d = 0; d<3; d++) {
+			theta[i*12 + 0*3 + d] = offset[d];
+			for (int k = 0; k<3; k++)
+				theta[i*12 + (k+1)*3 + d] = image.A(d,k);
+		}
+	}
+}
+
+void
+fregl_global_solver::
+parameters_to_transforms(std::vector<double> const & theta)
+{
+	for (unsigned int i = 0; i<images_.size(); i++) {
+		image_info & image = images_[i];
+		for (int d = 0; d<3; d++)
+			for (int k = 0; k<3; k++)
+				image.A(d,k) = theta[i*12 + (k+1)*3 + d];
+		for (int d = 0; d<3; d++)
+			image.t[d] = theta[i*12 + d] - (image.A(d,0)*image.center[0] +
+				image.A(d,1)*image.center[1] + image.A(d,2)*image.center[2]);
+	}
+}
+
+void
+fregl_global_solver::
+build_system(std::vector<double> const & prior)
+{
+	int num_unknowns = 0;
+	for (unsigned int i = 0; i<variable_.size(); i++)
+		if (variable_[i] >= 0) num_unknowns++;
+
+	diagonal_.assign(num_unknowns*16, 0.0);
+	off_diagonal_.assign(links_.size()*16, 0.0);
+	rhs_.assign(num_unknowns*12, 0.0);
+
+	image_info const & anchor = images_[anchor_];
+	double phi[4], psi[4];
+	for (unsigned int l = 0; l<links_.size(); l++) {
+		link_info const & link = links_[l];
+		int vf = variable_[link.from], vt = variable_[link.to];
+		if (vf < 0 && vt < 0) continue;
+		double w = link.weight;
+		PointType const & cf = images_[link.from].center;
+		PointType const & ct = images_[link.to].center;
+
+		for (unsigned int k = 0; k<link.from_points.size(); k++) {
+			PointType const & p = link.from_points[k];
+			PointType const & q = link.to_points[k];
+			phi[0] = 1; phi[1] = p[0]-cf[0]; phi[2] = p[1]-cf[1]; phi[3] = p[2]-cf[2];
+			psi[0] = 1; psi[1] = q[0]-ct[0]; psi[2] = q[1]-ct[1]; psi[3] = q[2]-ct[2];
+
+			// residual = T_from(p) - T_to(q)
+			if (vf >= 0) add_outer(&diagonal_[vf*16], w, phi, phi);
+			if (vt >= 0) add_outer(&diagonal_[vt*16], w, psi, psi);
+			if (vf >= 0 && vt >= 0)
+				add_outer(&off_diagonal_[l*16], -w, phi, psi);
+			else if (vf >= 0) {
+				PointType known = anchor.A*q + anchor.t;
+				for (int r = 0; r<4; r++)
+					for (int d = 0; d<3; d++)
+						rhs_[vf*12 + r*3 + d] += w*phi[r]*known[d];
+			}
+			else {
+				PointType known = anchor.A*p + anchor.t;
+				for (int r = 0; r<4; r++)
+					for (int d = 0; d<3; d++)
+						rhs_[vt*12 + r*3 + d] += w*psi[r]*known[d];
+			}
+		}
+	}
+
+	// Prior of the linear part towards the initial transforms.
+	// The translations are left free: the initial ones may be off by
+	// many pixels, and a prior would bend the long chains of tiles
+	// towards them. Directions without any constraint (the z column of
+	// single-slice images) get the strength of the translation.
+	for (unsigned int i = 0; i<variable_.size(); i++) {
+		int v = variable_[i];
+		if (v < 0) continue;
+		double* block = &diagonal_[v*16];
+		double translation = block[0];
+		for (int r = 0; r<4; r++) {
+			double lambda = (r == 0 ? 0 : prior_weight*(block[r*4+r] + translation)) + 1e-12;
+			block[r*4+r] += lambda;
+			for (int d = 0; d<3; d++)
+				rhs_[v*12 + r*3 + d] += lambda*prior[i*12 + r*3 + d];
+		}
+	}
+}
+
+void
+fregl_global_solver::
+order_unknowns()
+{
+	// Reverse Cuthill-McKee ordering of the images. A montage is close
+	// to a grid, so the envelope of the ordered normal matrix is about
+	// one row of tiles wide.
+	int num_unknowns = 0;
+	for (unsigned int i = 0; i<variable_.size(); i++)
+		if (variable_[i] >= 0) num_unknowns++;
+
+	std::vector< std::vector<int> > neighbors(num_unknowns);
+	for (unsigned int l = 0; l<links_.size(); l++) {
+		int vf = variable_[links_[l].from], vt = variable_[links_[l].to];
+		if (vf < 0 || vt < 0 || vf == vt) continue;
+		neighbors[vf].push_back(vt);
+		neighbors[vt].push_back(vf);
+	}
+	for (int v = 0; v<num_unknowns; v++) {
+		std::sort(neighbors[v].begin(), neighbors[v].end());
+		neighbors[v].erase(std::unique(neighbors[v].begin(), neighbors[v].end()), neighbors[v].end());
+	}
+
+	std::vector<int> sequence;
+	sequence.reserve(num_unknowns);
+	std::vector<bool> visited(num_unknowns, false);
+	for (int seed = 0; seed<num_unknowns; seed++) {
+		if (visited[seed]) continue;
+
+		// Start from a pseudo-peripheral node: the last node reached by
+		// a breadth first search, taken twice
+		int start = seed;
+		for (int pass = 0; pass<2; pass++) {
+			std::vector<bool> reached(visited);
+			std::vector<int> queue(1, start);
+			reached[start] = true;
+			for (unsigned int head = 0; head<queue.size(); head++) {
+				std::vector<int> const & next = neighbors[queue[head]];
+				for (unsigned int k = 0; k<next.size(); k++)
+					if (!reached[next[k]]) {
+						reached[next[k]] = true;
+						queue.push_back(next[k]);
+					}
+			}
+			start = queue.back();
+		}
+
+		unsigned int first = sequence.size();
+		sequence.push_back(start);
+		visited[start] = true;
+		for (unsigned int head = first; head<sequence.size(); head++) {
+			std::vector< std::pair<unsigned int, int> > next;
+			std::vector<int> const & adjacent = neighbors[sequence[head]];
+			for (unsigned int k = 0; k<adjacent.size(); k++)
+				if (!visited[adjacent[k]]) {
+					visited[adjacent[k]] = true;
+					next.push_back(std::make_pair((unsigned int)neighbors[adjacent[k]].size(), adjacent[k]));
+				}
+			std::sort(next.begin(), next.end());
+			for (unsigned int k = 0; k<next.size(); k++)
+				sequence.push_back(next[k].second);
+		}
+	}
+
+	order_.resize(num_unknowns);
+	for (int k = 0; k<num_unknowns; k++)
+		order_[sequence[k]] = num_unknowns-1-k;
+
+	// Envelope: every row starts at the first block of its image or of
+	// an earlier linked image
+	std::vector<int> first_block(num_unknowns);
+	for (int v = 0; v<num_unknowns; v++) {
+		first_block[v] = order_[v];
+		for (unsigned int k = 0; k<neighbors[v].size(); k++)
+			first_block[v] = std::min(first_block[v], order_[neighbors[v][k]]);
+	}
+	int n = num_unknowns*4;
+	first_.resize(n);
+	offset_.resize(n);
+	for (int v = 0; v<num_unknowns; v++)
+		for (int r = 0; r<4; r++)
+			first_[order_[v]*4 + r] = first_block[v]*4;
+	std::size_t size = 0;
+	for (int i = 0; i<n; i++) {
+		offset_[i] = size;
+		size += i - first_[i] + 1;
+	}
+	values_.resize(size);
+}
+
+bool
+fregl_global_solver::
+factor()
+{
+	// Scatter the blocks into the lower triangle of the envelope
+	std::fill(values_.begin(), values_.end(), 0.0);
+	for (unsigned int i = 0; i<variable_.size(); i++) {
+		int v = variable_[i];
+		if (v < 0) continue;
+		const double* block = &diagonal_[v*16];
+		for (int r = 0; r<4; r++)
+			for (int c = 0; c<=r; c++)
+				entry(order_[v]*4 + r, order_[v]*4 + c) += block[r*4+c];
+	}
+	for (unsigned int l = 0; l<links_.size(); l++) {
+		int vf = variable_[links_[l].from], vt = variable_[links_[l].to];
+		if (vf < 0 || vt < 0) continue;
+		const double* block = &off_diagonal_[l*16];
+		for (int r = 0; r<4; r++)
+			for (int c = 0; c<4; c++) {
+				int row = order_[vf]*4 + r, col = order_[vt]*4 + c;
+				if (row > col) entry(row, col) += block[r*4+c];
+				else entry(col, row) += block[r*4+c];
+			}
+	}
+
+	// Cholesky factorization in place, L*L' = H
+	int n = int(first_.size());
+	for (int i = 0; i<n; i++) {
+		double* Li = &values_[offset_[i]] - first_[i];
+		for (int j = first_[i]; j<=i; j++) {
+			const double* Lj = &values_[offset_[j]] - first_[j];
+			double sum = Li[j];
+			for (int k = std::max(first_[i], first_[j]); k<j; k++)
+				sum -= Li[k]*Lj[k];
+			if (j < i)
+				Li[j] = sum/Lj[j];
+			else {
+				if (sum <= 0) {
+					std::cerr<<"fregl_global_solver: normal matrix is not positive definite"<<std::endl;
+					return false;
+				}
+				Li[i] = std::sqrt(sum);
+			}
+		}
+	}
+	return true;
+}
+
+void
+fregl_global_solver::
+back_substitute(std::vector<double>& x) const
+{
+	int n = int(first_.size());
+	std::vector<double> y(n*3);
+	for (unsigned int i = 0; i<variable_.size(); i++) {
+		int v = variable_[i];
+		if (v < 0) continue;
+		for (int r = 0; r<4; r++)
+			for (int d = 0; d<3; d++)
+				y[(order_[v]*4 + r)*3 + d] = rhs_[v*12 + r*3 + d];
+	}
+
+	// L*z = b
+	for (int i = 0; i<n; i++) {
+		const double* Li = &values_[offset_[i]] - first_[i];
+		double sum[3] = {y[i*3], y[i*3+1], y[i*3+2]};
+		for (int k = first_[i]; k<i; k++)
+			for (int d = 0; d<3; d++)
+				sum[d] -= Li[k]*y[k*3+d];
+		for (int d = 0; d<3; d++)
+			y[i*3+d] = sum[d]/Li[i];
+	}
+	// L'*x = z
+	for (int i = n-1; i>=0; i--) {
+		const double* Li = &values_[offset_[i]] - first_[i];
+		for (int d = 0; d<3; d++)
+			y[i*3+d] /= Li[i];
+		for (int k = first_[i]; k<i; k++)
+			for (int d = 0; d<3; d++)
+				y[k*3+d] -= Li[k]*y[i*3+d];
+	}
+
+	x.resize(rhs_.size());
+	for (unsigned int i = 0; i<variable_.size(); i++) {
+		int v = variable_[i];
+		if (v < 0) continue;
+		for (int r = 0; r<4; r++)
+			for (int d = 0; d<3; d++)
+				x[v*12 + r*3 + d] = y[(order_[v]*4 + r)*3 + d];
+	}
+}
+
+double
+fregl_global_solver::
+update_weights()
+{
+	std::vector<double> residuals;
+	residuals.reserve(links_.size());
+	for (unsigned int l = 0; l<links_.size(); l++) {
+		link_info & link = links_[l];
+		image_info const & from = images_[link.from];
+		image_info const & to = images_[link.to];
+		double sum = 0;
+		for (unsigned int k = 0; k<link.from_points.size(); k++) {
+			PointType diff = from.A*link.from_points[k] + from.t - to.A*link.to_points[k] - to.t;
+			sum += diff.squared_magnitude();
+		}
+		link.residual = link.from_points.empty() ? 0 : std::sqrt(sum/link.from_points.size());
+		residuals.push_back(link.residual);
+	}
+	if (residuals.empty()) return 0;
+
+	// MAD scale of the link residuals
+	std::vector<double> sorted(residuals);
+	std::nth_element(sorted.begin(), sorted.begin()+sorted.size()/2, sorted.end());
+	scale_ = std::max(min_scale, 1.4826*sorted[sorted.size()/2]);
+
+	double change = 0;
+	for (unsigned int l = 0; l<links_.size(); l++) {
+		double u = links_[l].residual/(cauchy_c*scale_);
+		double weight = 1/(1+u*u);
+		change = std::max(change, std::fabs(weight-links_[l].weight));
+		links_[l].weight = weight;
+	}
+	return change;
+}
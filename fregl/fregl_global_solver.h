@@ -0,0 +1,151 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+//: Global least-squares solver for the transforms of a montage
+//
+//  Every image has an affine transform into the frame of one anchor
+//  image. Every pairwise link contributes the correspondences of its
+//  pairwise transform, and all transforms are solved together by
+//  minimizing the weighted squared distances of the transformed
+//  correspondences. The three output coordinates share one sparse
+//  normal matrix with a 4x4 block per image and per link. The images
+//  are ordered by reverse Cuthill-McKee, which keeps the envelope of
+//  the matrix about one row of tiles wide, and the matrix is factored
+//  by Cholesky inside its envelope. The links are reweighted with the
+//  Cauchy function of their RMS residuals, so wrong pairwise
+//  transforms lose their influence and can be pruned afterwards by
+//  their residuals.
+//
+//  The unknowns of an image are centered on its correspondences. The
+//  linear part of every transform is held towards its initial value by
+//  a prior, while the translations are free, so the solution follows
+//  the links and not the (often inaccurate) initial positions.
+
+#ifndef _fregl_global_solver_h_
+#define _fregl_global_solver_h_
+
+#include <vnl/vnl_matrix_fixed.h>
+#include <vnl/vnl_vector_fixed.h>
+
+#include <cstddef>
+#include <vector>
+
+class fregl_global_solver
+{
+public:
+	typedef vnl_vector_fixed<double, 3>   PointType;
+	typedef vnl_matrix_fixed<double, 3, 3> MatrixType;
+
+	//: constructor
+	fregl_global_solver();
+
+	//: Add an image with an identity initial transform, returns its index
+	int add_image();
+
+	//: The image whose transform is fixed (the first one by default)
+	void set_anchor(int image);
+
+	//: Initial transform of an image into the anchor frame, x' = A*x + t
+	void set_initial(int image, MatrixType const & A, PointType const & t);
+
+	//: Add a link, to_points[k] in image to corresponds to from_points[k] in image from
+	//
+	//  Returns the index of the link.
+	int add_link(int from, int to, std::vector<PointType> const & from_points,
+		std::vector<PointType> const & to_points);
+
+	//: Maximum number of reweighting iterations
+	void set_max_iterations(int iterations);
+
+	//: Solve for all transforms
+	//
+	//  Returns false if the normal matrix is singular.
+	bool solve();
+
+	//: The transform of an image
+	MatrixType const & A(int image) const { return images_[image].A; }
+	PointType const & t(int image) const { return images_[image].t; }
+
+	//: RMS residual in pixels of the correspondences of a link
+	double residual(int link) const { return links_[link].residual; }
+
+	//: Final robust weight of a link in [0,1]
+	double weight(int link) const { return links_[link].weight; }
+
+	//: Robust scale of the link residuals in the last iteration
+	double scale() const { return scale_; }
+
+	unsigned int number_of_images() const { return images_.size(); }
+	unsigned int number_of_links() const { return links_.size(); }
+
+private:
+	struct image_info
+	{
+		MatrixType A;
+		PointType t;
+		PointType center;
+	};
+
+	struct link_info
+	{
+		int from, to;
+		std::vector<PointType> from_points, to_points;
+		double residual;
+		double weight;
+	};
+
+	//: Parameters theta(image, coordinate) = [offset, A(d,0), A(d,1), A(d,2)]
+	//  of the centered transforms, 12 values per image
+	void transforms_to_parameters(std::vector<double>& theta) const;
+	void parameters_to_transforms(std::vector<double> const & theta);
+
+	//: Order the unknown images to keep the envelope of the normal matrix small
+	void order_unknowns();
+
+	//: Build the normal equations for the current link weights
+	void build_system(std::vector<double> const & prior);
+
+	//: Cholesky factorization of the normal matrix in its envelope
+	bool factor();
+
+	//: Solve for the 3 right hand sides with the factorization
+	void back_substitute(std::vector<double>& x) const;
+
+	//: Element (row, col) of the lower triangle, col inside the envelope
+	double& entry(int row, int col) { return values_[offset_[row] + col - first_[row]]; }
+
+	//: Update the residuals and weights of the links, returns the largest weight change
+	double update_weights();
+
+	std::vector<image_info> images_;
+	std::vector<link_info> links_;
+	int anchor_;
+	int max_iterations_;
+	double scale_;
+
+	// Normal equations: one 4x4 block per image and per link (from,to)
+	std::vector<int> variable_;            // unknown index of an image, -1 for the anchor
+	std::vector<double> diagonal_;         // 16 per unknown image
+	std::vector<double> off_diagonal_;     // 16 per link
+	std::vector<double> rhs_;              // 4x3 per unknown image
+
+	// Envelope (skyline) storage of the lower triangle in the ordering
+	std::vector<int> order_;               // position of an unknown image
+	std::vector<int> first_;               // first column of a row
+	std::vector<std::size_t> offset_;          // start of a row in values_
+	std::vector<double> values_;
+};
+
+#endif
@@ -31,9 +31,33 @@ limitations under the License.
 #include "itkResampleImageFilter.h"
 #include "itkPasteImageFilter.h"
 
+#include <cmath>
+
 
 static std::string ToString(double val);
 
+// Number of shards of the brick cache
+static const int number_of_shards = 16;
+
+// Paste the part [lo,hi) of a block of pixels starting at src_lo with
+// src_size pixels into the montage, keeping the brighter pixel. The
+// ranges are in tile coordinates, offset moves them into the montage.
+template < class TPixel >
+static void
+paste_block(TPixel const * src, long const * src_lo, long const * src_size,
+        long const * lo, long const * hi, long const * offset,
+        TPixel* dst, itk::Size<3> const & dst_size) {
+    long width = hi[0] - lo[0];
+    for (long z = lo[2]; z < hi[2]; z++) {
+        for (long y = lo[1]; y < hi[1]; y++) {
+            TPixel const * in = src + ((z - src_lo[2]) * src_size[1] + (y - src_lo[1])) * src_size[0] + (lo[0] - src_lo[0]);
+            TPixel* out = dst + ((z + offset[2]) * (long) dst_size[1] + (y + offset[1])) * (long) dst_size[0] + (lo[0] + offset[0]);
+            for (long x = 0; x < width; x++)
+                if (in[x] > out[x]) out[x] = in[x];
+        }
+    }
+}
+
 template < class TPixel >
 fregl_image_manager< TPixel >::fregl_image_manager(std::string const & xml_filename, std::string const & image_path, std::string const & anchor_image,
 bool use_NN) {
@@ -49,6 +73,7 @@ bool use_NN) {
     global_space_transformer->set_anchor(global_anchor, false, false);
     //    std::cout << "Anchor Set" << std::endl;
     image_names = global_space_transformer->image_names();
+    image_sizes = global_space_transformer->image_sizes();
     global_origin = global_space_transformer->origin();
     global_size = global_space_transformer->montage_size();
     roi_origin = global_origin;
@@ -62,57 +87,43 @@ bool use_NN) {
     global_channel = 0;
     global_use_channel = false;
     // Set up caching stuff
+    for (unsigned int i = 0; i < image_names.size(); i++)
+        tile_locks_.push_back(new ftk::TaskMutex);
+    is_cached_on_disk.assign(image_names.size(), false);
+    tile_loads_ = 0;
+    prefetches_ = 0;
+    use_prefetch = true;
+    brick_size_[0] = 64;
+    brick_size_[1] = 64;
+    brick_size_[2] = 16;
     set_cache_buffer_count(6);
     use_file_caching = false;
     QString cdir = QDir::tempPath();
     cache_dir = cdir.toStdString();
 }
 
+template < class TPixel >
+fregl_image_manager< TPixel >::~fregl_image_manager() {
+    prefetch_group_.Wait();
+    clear_cache();
+    for (unsigned int i = 0; i < tile_locks_.size(); i++)
+        delete tile_locks_[i];
+}
+
 //: Set the Region of Interest
 //
 //  Index and size are updated accordingly.
 
 template < class TPixel >
 void fregl_image_manager< TPixel >::set_regionofinterest(PointType origin, SizeType size) {
-    //    roi_origin = origin;
-    // Convert the request from normal space(0,0,0) to anchor space
-    //roi_origin is in global space
-
-    roi_origin[0] = origin[0] + global_origin[0];
-    roi_origin[1] = origin[1] + global_origin[1];
-    roi_origin[2] = origin[2] + global_origin[2];
-
-    roi_size = size;
     std::cout << "origin: " << origin[0] << " " << origin[1] << " " << origin[2] << std::endl;
     std::cout << "global_origin: " << global_origin[0] << " " << global_origin[1] << " " << global_origin[2] << std::endl;
-    std::cout << "roi_origin: " << roi_origin[0] << " " << roi_origin[1] << " " << roi_origin[2] << std::endl;
 
-    //if the roi_origin is less than the global_origin in anchor space, then we need to fit it by moving the roi_origin to the global_origin and then lowering the size
-    if (roi_origin[0] < global_origin[0]) {
-        roi_size[0] -= (global_origin[0] - roi_origin[0]);
-        roi_origin[0] = global_origin[0];
-    }
-    if (roi_origin[1] < global_origin[1]) {
-        roi_size[1] -= (global_origin[1] - roi_origin[1]);
-        roi_origin[1] = global_origin[1];
-    }
-
-    if (roi_origin[2] < global_origin[2]) {
-        roi_size[2] -= (global_origin[2] - roi_origin[2]);
-        roi_origin[2] = global_origin[2];
-    }
+    roi_origin = origin;
+    roi_size = size;
+    clamp_region(roi_origin, roi_size);
+    std::cout << "roi_origin: " << roi_origin[0] << " " << roi_origin[1] << " " << roi_origin[2] << std::endl;
 
-    if (roi_origin[0] > global_origin[0] + global_size[0]) roi_origin[0] = global_origin[0] + global_size[0];
-    if (roi_origin[1] > global_origin[1] + global_size[1]) roi_origin[1] = global_origin[1] + global_size[1];
-    if (roi_origin[2] > global_origin[2] + global_size[2]) roi_origin[2] = global_origin[2] + global_size[2];
-
-    // Make sure size is in range or fix
-    if (roi_origin[0] + roi_size[0] > global_origin[0] + global_size[0])
-        roi_size[0] = (global_origin[0] + global_size[0]) - roi_origin[0];
-    if (roi_origin[1] + roi_size[1] > global_origin[1] + global_size[1])
-        roi_size[1] = (global_origin[1] + global_size[1]) - roi_origin[1];
-    if (roi_origin[2] + roi_size[2] > global_origin[2] + global_size[2])
-        roi_size[2] = (global_origin[2] + global_size[2]) - roi_origin[2];
     roi_index[0] = roi_origin[0];
     roi_index[1] = roi_origin[1];
     roi_index[2] = roi_origin[2];
@@ -123,6 +134,29 @@ void fregl_image_manager< TPixel >::set_regionofinterest(PointType origin, SizeT
     global_space_transformer->set_roi(roi_origin, roi_size);
 }
 
+//: Clamp a region given in normalized space and move it to anchor space
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::clamp_region(PointType& origin, SizeType& size) const {
+    // Convert the request from normal space(0,0,0) to anchor space
+    origin[0] += global_origin[0];
+    origin[1] += global_origin[1];
+    origin[2] += global_origin[2];
+
+    //if the origin is less than the global_origin in anchor space, then we need to fit it by moving the origin to the global_origin and then lowering the size
+    for (int d = 0; d < 3; d++) {
+        if (origin[d] < global_origin[d]) {
+            size[d] -= (global_origin[d] - origin[d]);
+            origin[d] = global_origin[d];
+        }
+        if (origin[d] > global_origin[d] + global_size[d]) origin[d] = global_origin[d] + global_size[d];
+
+        // Make sure size is in range or fix
+        if (origin[d] + size[d] > global_origin[d] + global_size[d])
+            size[d] = (global_origin[d] + global_size[d]) - origin[d];
+    }
+}
+
 //: Set the Region of Interest
 //
 //  Index and size are updated accordingly.
@@ -141,14 +175,17 @@ void fregl_image_manager< TPixel >::set_regionofinterest(IndexType origin, SizeT
 
 template < class TPixel >
 void fregl_image_manager< TPixel >::Update() {
+    montage_image = build_region(roi_origin, roi_size);
+}
 
-    std::string image_name = global_image_path + std::string("/") + image_names[0];
-    //    std::cout << "Image names list" << std::endl;
-    //    for (unsigned int i = 0; i < image_names.size(); i++) {
-    //        std::cout << image_names[i] << std::endl;
-    //    }
-    ImageTypePointer image, xformed_image;
-    //    std::cout << "Composing the final image ..." << std::endl;
+//: Build the montage of a region in anchor space
+//
+//  Only reads members which do not change while serving requests, so
+//  it can run from several threads.
+
+template < class TPixel >
+typename fregl_image_manager< TPixel >::ImageTypePointer
+fregl_image_manager< TPixel >::build_region(PointType const & origin, SizeType const & size) {
     //Create a blank ROI then merge in the images that are in the space
     IndexType source_index;
     typename ImageType::RegionType region;
@@ -156,19 +193,19 @@ void fregl_image_manager< TPixel >::Update() {
     source_index[1] = 0;
     source_index[2] = 0.;
     region.SetIndex(source_index);
-    region.SetSize(roi_size);
-    montage_image = ImageType::New();
-    montage_image->SetOrigin(roi_origin);
-    montage_image->SetRegions(region);
-    montage_image->Allocate();
-    montage_image->FillBuffer(0);
+    region.SetSize(size);
+    ImageTypePointer image = ImageType::New();
+    image->SetOrigin(origin);
+    image->SetRegions(region);
+    image->Allocate();
+    image->FillBuffer(0);
     for (unsigned int i = 0; i < image_names.size(); i++) {
-        if (global_space_transformer->image_in_roi(i)) {
-            image_name = global_image_path + std::string("/") + image_names[i];
-            ReadFileRegion(image_name, i, montage_image);
-        } else
-            continue;
+        if (global_space_transformer->image_in_roi(i, origin, size))
+            paste_tile(i, image, origin, size);
     }
+    if (use_caching && use_prefetch)
+        prefetch_neighbours(origin, size);
+    return image;
 }
 
 //: Return an ITK image pointer to the current Montage
@@ -187,192 +224,317 @@ typename fregl_image_manager< TPixel >::ImageTypePointer fregl_image_manager< TP
     ImageTypePointer image = duplicator->GetOutput();
     image->SetOrigin(new_origin);
     return image;
-
-
-
-    /*    typedef itk::TranslationTransform<double, ImageType::ImageDimension> TranslationTransformType;
-    TranslationTransformType::Pointer transform = TranslationTransformType::New();
-    TranslationTransformType::OutputVectorType translation;
-    std::cout << "global_origin: " << global_origin[0] << " " << global_origin[1] << " " << global_origin[2] << std::endl;
-    translation[0] = global_origin[0];
-    translation[1] = global_origin[1];
-    translation[2] = global_origin[2];
-    transform->Translate(translation);
-
-    typedef itk::ResampleImageFilter<ImageType, ImageType, double> ResampleImageFilterType;
-    ResampleImageFilterType::Pointer resampleFilter = ResampleImageFilterType::New();
-    resampleFilter->SetTransform(transform.GetPointer());
-    resampleFilter->SetInput(montage_image);
-
-    ImageType::SizeType size = montage_image->GetLargestPossibleRegion().GetSize();
-    resampleFilter->SetSize(size);
-
-    try {
-    resampleFilter->Update();
-    } catch (itk::ExceptionObject &err) {
-    std::cout << "Error in ResampleFilter" << std::endl;
-    std::cout << err << std::endl;
-    }
-
-
-    return resampleFilter->GetOutput();*/
 }
 
 //: Return an ITK image pointer the the region of interest passed an argument
-// This entry is mutex protected for multi threading operations.  It combines
-// the set region, update and get output methods.
+// The region is built in a new image without touching the current
+// region, so concurrent callers only meet in the cache.
 
 template < class TPixel >
 typename fregl_image_manager< TPixel >::ImageTypePointer fregl_image_manager< TPixel >::MutexGetRegionOfInterest(PointType origin, SizeType size) {
-    ImageTypePointer image;
-    region_mutex.Lock();
-    set_regionofinterest(origin, size);
-    Update();
-    image = GetOutput();
-    region_mutex.Unlock();
+    clamp_region(origin, size);
+    ImageTypePointer image = build_region(origin, size);
+    typename ImageType::PointType new_origin;
+    new_origin[0] = origin[0] - global_origin[0];
+    new_origin[1] = origin[1] - global_origin[1];
+    new_origin[2] = origin[2] - global_origin[2];
+    image->SetOrigin(new_origin);
     return image;
 }
 
 
-//: Return an ITK image pointer to the Region of Interest in the passed
-//  file name.  Return from cache if file is cached otherwise read the file
-//  into cache then get the region.
+//: Paste the Region of Interest of the image with the given index into
+//  montage_image.  The bricks are taken from the cache, the missing ones
+//  are read and transformed.  The file name is given by the index.
 
 template < class TPixel >
 void fregl_image_manager< TPixel >::ReadFileRegion(std::string file_name, int image_index, ImageTypePointer montage_image) {
-    ImageTypePointer image, cached_image, xformed_image;
-    typename ImageType::RegionType region, source_region, destination_region;
-    typename ImageType::IndexType source_index;
-    typename ImageType::SizeType source_size;
-    typename ImageType::IndexType destination_index;
-    typename ImageType::PointType source_origin, save_origin;
-    if (!use_caching) {
-        //If no caching then read in the image
-        image = fregl_util< TPixel >::fregl_util_read_image(file_name, global_use_channel, global_channel, false);
-        xformed_image = global_space_transformer->transform_image_roi(image, image_index, 0, use_NN_interpolator);
-        RegionConstIterator inputIt(xformed_image, xformed_image->GetLargestPossibleRegion());
-        if (!xformed_image) return;
-        RegionIterator outputIt(montage_image, montage_image->GetLargestPossibleRegion());
+    paste_tile(image_index, montage_image, roi_origin, roi_size);
+}
 
-        for (inputIt.GoToBegin(), outputIt.GoToBegin(); !inputIt.IsAtEnd();
-                ++inputIt, ++outputIt) {
-            outputIt.Set(vnl_math_max(outputIt.Get(), inputIt.Get()));
+template < class TPixel >
+void fregl_image_manager< TPixel >::paste_tile(int image_index, ImageTypePointer montage_image,
+        PointType const & origin, SizeType const & size) {
+    // Position of the tile in the montage and the part of the tile
+    // inside it, in tile coordinates
+    PointType const & tile_origin = global_space_transformer->image_origin(image_index);
+    SizeType const & tile_size = image_sizes[image_index];
+    long offset[3], lo[3], hi[3];
+    for (int d = 0; d < 3; d++) {
+        offset[d] = (long) std::floor(tile_origin[d] - origin[d] + 0.5);
+        lo[d] = vnl_math_max(0L, -offset[d]);
+        hi[d] = vnl_math_min((long) tile_size[d], (long) size[d] - offset[d]);
+        if (lo[d] >= hi[d]) return;
+    }
+    TPixel* montage = montage_image->GetBufferPointer();
+
+    if (!use_caching && !use_file_caching) {
+        //If no caching then read in the image and only transform the
+        //part in the region
+        ImageTypePointer image;
+        {
+            ftk::TaskLock lock(stats_lock_);
+            tile_loads_++;
         }
+        {
+            ftk::TaskLock io_lock(io_lock_);
+            std::string file_name = global_image_path + std::string("/") + image_names[image_index];
+            image = fregl_util< TPixel >::fregl_util_read_image(file_name, global_use_channel, global_channel, false);
+        }
+        if (!image) return;
+        ImageTypePointer xformed_image = global_space_transformer->transform_image_roi(image, image_index, origin, size, 0, use_NN_interpolator);
+        if (!xformed_image) return;
+        long zero[3] = {0, 0, 0};
+        long full[3] = {(long) size[0], (long) size[1], (long) size[2]};
+        paste_block(xformed_image->GetBufferPointer(), zero, full, zero, full, zero, montage, size);
         return;
-    } else {
-        //Using caching
-        //        std::cout << "Here 1" << std::endl;
-        cache_time++;
-        if (!is_cached[image_index]) {
-            // If we are file caching and its not already cached lets try to read it from the disk first.  If it is there
-            // then use it otherwise read it in and transform it.
-            if (use_file_caching) {
-                image = cache_read_image(image_index);
-                if (image) {
-                    is_cached[image_index] = true;
-                    is_cached_on_disk[image_index] = true;
-                    cache_slot[image_index] = get_next_slot();
-                    cached_images[cache_slot[image_index]] = image;
-                }
-            }
-            // If we did not get the image from the disk then read and transform
-            if (!is_cached[image_index]) {
-                is_cached[image_index] = true;
-                cache_slot[image_index] = get_next_slot();
-                image = fregl_util< TPixel >::fregl_util_read_image(file_name, global_use_channel, global_channel, false);
-                cached_images[cache_slot[image_index]] = global_space_transformer->transform_image_whole(image, image_index, 0, use_NN_interpolator);
-                //        std::cout << "Here 4" << std::endl;
+    }
+    if (!use_caching) {
+        //The whole tile is transformed to be written to the file cache
+        ImageTypePointer xformed_image = transform_tile(image_index);
+        if (!xformed_image) return;
+        long zero[3] = {0, 0, 0};
+        long full[3] = {(long) tile_size[0], (long) tile_size[1], (long) tile_size[2]};
+        paste_block(xformed_image->GetBufferPointer(), zero, full, lo, hi, offset, montage, size);
+        return;
+    }
+
+    // Paste the cached bricks and collect the missing ones
+    long count[3];
+    number_of_bricks(image_index, count);
+    std::vector<int> missing;
+    for (long bz = lo[2] / (long) brick_size_[2]; bz <= (hi[2] - 1) / (long) brick_size_[2]; bz++)
+        for (long by = lo[1] / (long) brick_size_[1]; by <= (hi[1] - 1) / (long) brick_size_[1]; by++)
+            for (long bx = lo[0] / (long) brick_size_[0]; bx <= (hi[0] - 1) / (long) brick_size_[0]; bx++) {
+                int brick_index = bx + count[0] * (by + count[1] * bz);
+                if (!paste_cached_brick(image_index, brick_index, lo, hi, offset, montage, size))
+                    missing.push_back(brick_index);
             }
+    if (missing.empty()) return;
+
+    // Only one request reads a tile. The others wait for it and then
+    // find its bricks in the cache.
+    ftk::TaskLock tile_lock(*tile_locks_[image_index]);
+    std::vector<int> still_missing;
+    for (unsigned int i = 0; i < missing.size(); i++) {
+        if (!paste_cached_brick(image_index, missing[i], lo, hi, offset, montage, size))
+            still_missing.push_back(missing[i]);
+    }
+    if (still_missing.empty()) return;
+
+    ImageTypePointer xformed_image = transform_tile(image_index);
+    if (!xformed_image) return;
+    insert_tile(image_index, xformed_image);
+
+    // Paste from the transformed tile, its bricks may already be evicted
+    long zero[3] = {0, 0, 0};
+    long full[3] = {(long) tile_size[0], (long) tile_size[1], (long) tile_size[2]};
+    for (unsigned int i = 0; i < still_missing.size(); i++) {
+        long brick_lo[3], brick_hi[3];
+        brick_range(image_index, still_missing[i], brick_lo, brick_hi);
+        for (int d = 0; d < 3; d++) {
+            brick_lo[d] = vnl_math_max(brick_lo[d], lo[d]);
+            brick_hi[d] = vnl_math_min(brick_hi[d], hi[d]);
         }
+        paste_block(xformed_image->GetBufferPointer(), zero, full, brick_lo, brick_hi, offset, montage, size);
     }
-    //If we are using file caching and we did not read the transformed file from
-    //the disk then write it out.
-    if (use_file_caching && !is_cached_on_disk[image_index])
-        is_cached_on_disk[image_index] = cache_write_image(image_index, cached_images[cache_slot[image_index]]);
-    cached_image = cached_images[cache_slot[image_index]];
-    cache_last_used[cache_slot[image_index]] = cache_time;
-
-
-    //Now paste in the part of the cached file that is in the Region of interest
-    //Calculate the region of the cached image that is in the Region of interest
-    source_size = cached_image->GetLargestPossibleRegion().GetSize();
-    source_origin = cached_image->GetOrigin();
-    save_origin = source_origin;
-    //    std::cout << "Starting Source origin: " << source_origin[0] << " " << source_origin[1] << " " << source_origin[2] << std::endl;
-    //    std::cout << "Calculating index and size" << std::endl;
-
-    //If you have to move the origin clamp down the size as well.
-    if (source_origin[0] < roi_origin[0]) {
-        source_size[0] = (source_origin[0] + source_size[0]) - roi_origin[0];
-        source_origin[0] = roi_origin[0];
+}
+
+template < class TPixel >
+bool fregl_image_manager< TPixel >::paste_cached_brick(int image_index, int brick_index, long const * lo, long const * hi,
+        long const * offset, TPixel* montage, SizeType const & montage_size) {
+    long brick_lo[3], brick_hi[3], brick_dims[3], paste_lo[3], paste_hi[3];
+    brick_range(image_index, brick_index, brick_lo, brick_hi);
+    for (int d = 0; d < 3; d++) {
+        brick_dims[d] = brick_hi[d] - brick_lo[d];
+        paste_lo[d] = vnl_math_max(brick_lo[d], lo[d]);
+        paste_hi[d] = vnl_math_min(brick_hi[d], hi[d]);
     }
-    if (source_origin[1] < roi_origin[1]) {
-        source_size[1] = (source_origin[1] + source_size[1]) - roi_origin[1];
-        source_origin[1] = roi_origin[1];
+
+    cache_shard* shard = shard_of(image_index, brick_index);
+    ftk::TaskLock lock(shard->lock);
+    typename std::map< std::pair<int, int>, brick* >::iterator it =
+            shard->bricks.find(std::make_pair(image_index, brick_index));
+    if (it == shard->bricks.end()) {
+        shard->misses++;
+        return false;
     }
-    if (source_origin[2] < roi_origin[2]) {
-        source_size[2] = (source_origin[2] + source_size[2]) - roi_origin[2];
-        source_origin[2] = roi_origin[2];
+    shard->hits++;
+    brick* cached = it->second;
+    shard->lru.splice(shard->lru.begin(), shard->lru, cached->lru);
+    paste_block(&cached->pixels[0], brick_lo, brick_dims, paste_lo, paste_hi, offset, montage, montage_size);
+    return true;
+}
+
+//: Read and transform a tile.  If we are file caching try to read the
+//  transformed tile from the disk first, otherwise read and transform
+//  it and write it out.
+
+template < class TPixel >
+typename fregl_image_manager< TPixel >::ImageTypePointer
+fregl_image_manager< TPixel >::transform_tile(int image_index) {
+    {
+        ftk::TaskLock lock(stats_lock_);
+        tile_loads_++;
     }
-    //This next adjustment should not happen since it would mean that the image
-    // is not in the roi but ...
-    if (source_origin[0] > roi_origin[0] + roi_size[0]) {
-        std::cout << "Should not be here 0 " << cache_slot[image_index] << std::endl;
-        source_size[0] = 0;
-        source_origin[0] = roi_origin[0] + roi_size[0];
+    ImageTypePointer image, xformed_image;
+    if (use_file_caching) {
+        ftk::TaskLock io_lock(io_lock_);
+        xformed_image = cache_read_image(image_index);
+        if (xformed_image) {
+            is_cached_on_disk[image_index] = true;
+            return xformed_image;
+        }
     }
-    if (source_origin[1] > roi_origin[1] + roi_size[1]) {
-        std::cout << "Should not be here 1 " << cache_slot[image_index] << std::endl;
-        source_size[1] = 0;
-        source_origin[1] = roi_origin[1] + roi_size[1];
+    std::string file_name = global_image_path + std::string("/") + image_names[image_index];
+    {
+        // The image readers are not reentrant
+        ftk::TaskLock io_lock(io_lock_);
+        image = fregl_util< TPixel >::fregl_util_read_image(file_name, global_use_channel, global_channel, false);
     }
-    if (source_origin[2] > roi_origin[2] + roi_size[2]) {
-        std::cout << "Should not be here 2 " << cache_slot[image_index] << std::endl;
-        source_size[2] = 0;
-        source_origin[2] = roi_origin[2] + roi_size[2];
+    if (!image) return NULL;
+    xformed_image = global_space_transformer->transform_image_whole(image, image_index, 0, use_NN_interpolator);
+    if (xformed_image && use_file_caching) {
+        // Two tasks can transform the same tile; checking the flag under
+        // the lock makes only one of them write the cache file, and the
+        // image writers are not reentrant either
+        ftk::TaskLock io_lock(io_lock_);
+        if (!is_cached_on_disk[image_index])
+            is_cached_on_disk[image_index] = cache_write_image(image_index, xformed_image);
+    }
+    return xformed_image;
+}
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::insert_tile(int image_index, ImageTypePointer xformed_image) {
+    SizeType const & tile_size = image_sizes[image_index];
+    long zero[3] = {0, 0, 0};
+    long full[3] = {(long) tile_size[0], (long) tile_size[1], (long) tile_size[2]};
+    long count[3];
+    int bricks = number_of_bricks(image_index, count);
+    std::size_t shard_budget = cache_memory / shards_.size();
+
+    for (int brick_index = 0; brick_index < bricks; brick_index++) {
+        cache_shard* shard = shard_of(image_index, brick_index);
+        std::pair<int, int> key(image_index, brick_index);
+        {
+            ftk::TaskLock lock(shard->lock);
+            if (shard->bricks.count(key)) continue;
+        }
+
+        // Copy the brick outside of the lock
+        long lo[3], hi[3], dims[3];
+        brick_range(image_index, brick_index, lo, hi);
+        for (int d = 0; d < 3; d++)
+            dims[d] = hi[d] - lo[d];
+        brick* new_brick = new brick;
+        new_brick->image_index = image_index;
+        new_brick->brick_index = brick_index;
+        new_brick->pixels.assign(dims[0] * dims[1] * dims[2], 0);
+        long brick_offset[3] = {-lo[0], -lo[1], -lo[2]};
+        SizeType brick_dims;
+        for (int d = 0; d < 3; d++)
+            brick_dims[d] = dims[d];
+        paste_block(xformed_image->GetBufferPointer(), zero, full, lo, hi, brick_offset, &new_brick->pixels[0], brick_dims);
+        std::size_t brick_bytes = new_brick->pixels.size() * sizeof (TPixel);
+
+        std::vector<brick*> evicted;
+        {
+            ftk::TaskLock lock(shard->lock);
+            if (shard->bricks.count(key)) {
+                delete new_brick;
+                continue;
+            }
+            shard->lru.push_front(new_brick);
+            new_brick->lru = shard->lru.begin();
+            shard->bricks[key] = new_brick;
+            shard->bytes += brick_bytes;
+
+            // Evict the least recently used bricks over the budget, but
+            // keep the new one
+            while (shard->bytes > shard_budget && shard->lru.size() > 1) {
+                brick* old_brick = shard->lru.back();
+                shard->lru.pop_back();
+                shard->bricks.erase(std::make_pair(old_brick->image_index, old_brick->brick_index));
+                shard->bytes -= old_brick->pixels.size() * sizeof (TPixel);
+                shard->evictions++;
+                evicted.push_back(old_brick);
+            }
+        }
+
+        ftk::TaskLock lock(stats_lock_);
+        resident_bricks_[image_index]++;
+        for (unsigned int i = 0; i < evicted.size(); i++) {
+            resident_bricks_[evicted[i]->image_index]--;
+            delete evicted[i];
+        }
     }
-    // Make sure size is in range or fix
-    //First make sure the size is with in the destination
-    if (source_origin[0] + source_size[0] > roi_origin[0] + roi_size[0]) {
-        //        std::cout << "Here0 " << cache_slot[image_index] << std::endl;
-        source_size[0] = (roi_origin[0] + roi_size[0]) - source_origin[0];
+}
+
+//: Queue the tiles around a region which have nothing in the cache.
+//  The region is grown by half its size in x and y.
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::prefetch_neighbours(PointType const & origin, SizeType const & size) {
+    if (ftk::TaskRuntime::GetNumberOfThreads() < 2) return;
+
+    PointType grown_origin = origin;
+    SizeType grown_size = size;
+    for (int d = 0; d < 2; d++) {
+        grown_origin[d] -= size[d] / 2;
+        grown_size[d] += 2 * (size[d] / 2);
     }
-    if (source_origin[1] + source_size[1] > roi_origin[1] + roi_size[1]) {
-        //        std::cout << "Here1 " << cache_slot[image_index] << std::endl;
-        source_size[1] = (roi_origin[1] + roi_size[1]) - source_origin[1];
+    for (unsigned int i = 0; i < image_names.size(); i++) {
+        if (global_space_transformer->image_in_roi(i, origin, size) ||
+                !global_space_transformer->image_in_roi(i, grown_origin, grown_size))
+            continue;
+        {
+            ftk::TaskLock lock(stats_lock_);
+            if (resident_bricks_[i] > 0 || prefetch_pending_[i]) continue;
+            prefetch_pending_[i] = true;
+        }
+        prefetch_group_.Run(new prefetch_task(this, i));
     }
-    if (source_origin[2] + source_size[2] > roi_origin[2] + roi_size[2]) {
-        //        std::cout << "Here2 " << cache_slot[image_index] << std::endl;
-        source_size[2] = (roi_origin[2] + roi_size[2]) - source_origin[2];
+}
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::prefetch_tile(int image_index) {
+    {
+        ftk::TaskLock tile_lock(*tile_locks_[image_index]);
+        bool resident;
+        {
+            ftk::TaskLock lock(stats_lock_);
+            resident = resident_bricks_[image_index] > 0;
+        }
+        if (!resident) {
+            ImageTypePointer xformed_image = transform_tile(image_index);
+            if (xformed_image) insert_tile(image_index, xformed_image);
+        }
     }
-    source_index[0] = source_origin[0] - save_origin[0];
-    source_index[1] = source_origin[1] - save_origin[1];
-    source_index[2] = source_origin[2] - save_origin[2];
-    //Now make sure that the size is not larger than the image
-    destination_index[0] = (source_origin[0] - roi_origin[0]);
-    destination_index[1] = (source_origin[1] - roi_origin[1]);
-    destination_index[2] = (source_origin[2] - roi_origin[2]);
-    //    std::cout << "Source Index: " << source_index[0] << " " << source_index[1] << " " << source_index[2] << std::endl;
-    //    std::cout << "Source Origin: " << source_origin[0] << " " << source_origin[1] << " " << source_origin[2] << std::endl;
-    //    std::cout << "Destination Index: " << destination_index[0] << " " << destination_index[1] << " " << destination_index[2] << std::endl;
-    //    std::cout << "Source Size: " << source_size[0] << " " << source_size[1] << " " << source_size[2] << std::endl;
-    source_region.SetIndex(source_index);
-    source_region.SetSize(source_size);
-    destination_region.SetIndex(destination_index);
-    destination_region.SetSize(source_size);
-    cached_image->SetRequestedRegion(source_region);
-    montage_image->SetRequestedRegion(destination_region);
-
-    RegionConstIterator inputIt(cached_image, source_region);
-    RegionIterator outputIt(montage_image, destination_region);
-
-    for (inputIt.GoToBegin(), outputIt.GoToBegin(); !inputIt.IsAtEnd();
-            ++inputIt, ++outputIt) {
-        outputIt.Set(vnl_math_max(outputIt.Get(), inputIt.Get()));
+    ftk::TaskLock lock(stats_lock_);
+    prefetch_pending_[image_index] = false;
+    prefetches_++;
+}
+
+template < class TPixel >
+int fregl_image_manager< TPixel >::number_of_bricks(int image_index, long* count) const {
+    for (int d = 0; d < 3; d++)
+        count[d] = (image_sizes[image_index][d] + brick_size_[d] - 1) / brick_size_[d];
+    return count[0] * count[1] * count[2];
+}
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::brick_range(int image_index, int brick_index, long* lo, long* hi) const {
+    long count[3];
+    number_of_bricks(image_index, count);
+    long position[3];
+    position[0] = brick_index % count[0];
+    position[1] = (brick_index / count[0]) % count[1];
+    position[2] = brick_index / (count[0] * count[1]);
+    for (int d = 0; d < 3; d++) {
+        lo[d] = position[d] * brick_size_[d];
+        hi[d] = vnl_math_min(lo[d] + (long) brick_size_[d], (long) image_sizes[image_index][d]);
     }
-    //    return PasteFilter->GetOutput();
-    montage_image->SetRequestedRegion(montage_image->GetLargestPossibleRegion());
-    return;
 }
 
 //: Set the image channel to montage
@@ -435,30 +597,106 @@ typename fregl_space_transformer< TPixel >::Pointer fregl_image_manager< TPixel
     return global_space_transformer;
 }
 
-//: Set up the cache buffer count.  If 0 Turn off caching
+//: Set up the cache to hold about count tiles.  If 0 Turn off caching
 // Will reset all cache buffers when called.
-// Returns the state of caching (off or on)
 
 template < class TPixel >
 void fregl_image_manager< TPixel >::set_cache_buffer_count(int count) {
-    cache_size = count;
-    cache_time = 0;
-    cached_images.clear();
-    cache_last_used.clear();
-    is_cached.clear();
-    cache_slot.clear();
-    if (count > 0) {
-        use_caching = true;
-        for (unsigned int i = 0; i < cache_size; i++) {
-            cached_images.push_back(NULL);
-            cache_last_used.push_back(0);
-        }
-        for (unsigned int i = 0; i < image_names.size(); i++) {
-            is_cached.push_back(false);
-            is_cached_on_disk.push_back(false);
-            cache_slot.push_back(-1);
-        }
-    } else use_caching = false;
+    // Budget of count tiles of the average size
+    double average_bytes = 0;
+    for (unsigned int i = 0; i < image_sizes.size(); i++)
+        average_bytes += double(image_sizes[i][0]) * image_sizes[i][1] * image_sizes[i][2] * sizeof (TPixel);
+    if (!image_sizes.empty())
+        average_bytes /= image_sizes.size();
+    set_cache_memory(count > 0 ? std::size_t(count * average_bytes) : 0);
+}
+
+//: Set the memory budget of the cache in bytes.  If 0 Turn off caching
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::set_cache_memory(std::size_t bytes) {
+    cache_memory = bytes;
+    use_caching = bytes > 0;
+    setup_cache();
+}
+
+//: Set the size of the cached bricks
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::set_brick_size(SizeType size) {
+    for (int d = 0; d < 3; d++)
+        brick_size_[d] = size[d] > 0 ? size[d] : 1;
+    setup_cache();
+}
+
+//: Set prefetching on or off.
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::set_prefetch(bool use) {
+    use_prefetch = use;
+}
+
+template < class TPixel >
+typename fregl_image_manager< TPixel >::cache_statistics
+fregl_image_manager< TPixel >::get_cache_statistics() {
+    cache_statistics statistics;
+    statistics.hits = 0;
+    statistics.misses = 0;
+    statistics.evictions = 0;
+    statistics.bytes = 0;
+    for (unsigned int i = 0; i < shards_.size(); i++) {
+        ftk::TaskLock lock(shards_[i]->lock);
+        statistics.hits += shards_[i]->hits;
+        statistics.misses += shards_[i]->misses;
+        statistics.evictions += shards_[i]->evictions;
+        statistics.bytes += shards_[i]->bytes;
+    }
+    ftk::TaskLock lock(stats_lock_);
+    statistics.tile_loads = tile_loads_;
+    statistics.prefetches = prefetches_;
+    return statistics;
+}
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::reset_cache_statistics() {
+    for (unsigned int i = 0; i < shards_.size(); i++) {
+        ftk::TaskLock lock(shards_[i]->lock);
+        shards_[i]->hits = 0;
+        shards_[i]->misses = 0;
+        shards_[i]->evictions = 0;
+    }
+    ftk::TaskLock lock(stats_lock_);
+    tile_loads_ = 0;
+    prefetches_ = 0;
+}
+
+//: Reset all cache buffers.  Must not run while regions are requested.
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::setup_cache() {
+    prefetch_group_.Wait();
+    clear_cache();
+    for (int i = 0; i < number_of_shards; i++) {
+        cache_shard* shard = new cache_shard;
+        shard->bytes = 0;
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->evictions = 0;
+        shards_.push_back(shard);
+    }
+    resident_bricks_.assign(image_names.size(), 0);
+    prefetch_pending_.assign(image_names.size(), false);
+}
+
+template < class TPixel >
+void fregl_image_manager< TPixel >::clear_cache() {
+    for (unsigned int i = 0; i < shards_.size(); i++) {
+        typename std::list< brick* >::iterator it;
+        for (it = shards_[i]->lru.begin(); it != shards_[i]->lru.end(); ++it)
+            delete *it;
+        delete shards_[i];
+    }
+    shards_.clear();
 }
 
 //: Set disk caching on or off.
@@ -485,32 +723,6 @@ void fregl_image_manager< TPixel >::set_file_cache_dir(std::string use_dir) {
     }
 }
 
-template < class TPixel >
-int fregl_image_manager< TPixel >::get_next_slot() {
-    // First look for unused slots and return it if there.
-    int oldest = 0;
-    //        std::cout << "Here 6" << std::endl;
-    for (unsigned int i = 0; i < cached_images.size(); i++) {
-        //        std::cout << cache_last_used [i] << std::endl;
-        if (cache_last_used[i] == 0) {
-            //            std::cout << "Returning slot " << i << cache_time << std::endl;
-            return i;
-        } else {
-            // Keep track of the slot with the oldest time;
-            if (cache_last_used[oldest] > cache_last_used[i]) oldest = i;
-        }
-    }
-    //Clear old pointer to the cache.
-    for (unsigned int i = 0; i < is_cached.size(); i++) {
-        if (cache_slot[i] == oldest) {
-            is_cached[i] = false;
-            cache_slot[i] = -1;
-        }
-    }
-    //    std::cout << "Returning slot " << oldest << cache_time << std::endl;
-    return oldest;
-}
-
 template < class TPixel >
 bool fregl_image_manager< TPixel >::cache_write_image(int image_index, ImageTypePointer t_image) {
     // Write a transformed image to disk for caching.  The file name is made up of
@@ -19,6 +19,13 @@ limitations under the License.
 //  an itk image reader.
 // \author Jay Koven
 // \date 11/11/2011
+//
+//  The transformed tiles are cached in bricks. The bricks are spread
+//  over shards, each with its own lock, LRU list and share of the
+//  memory budget, so concurrent region requests only contend when they
+//  touch the same shard. A tile is read and transformed by one request
+//  at a time, and the tiles next to a request are prefetched on the
+//  ftk::TaskRuntime workers.
 
 #ifndef _fregl_image_manager_h_
 #define _fregl_image_manager_h_
@@ -26,6 +33,9 @@ limitations under the License.
 #include <vbl/vbl_ref_count.h>
 #include <vbl/vbl_smart_ptr.h>
 #include <vnl/vnl_vector_fixed.h>
+#include <cstddef>
+#include <list>
+#include <map>
 #include <vector>
 #include <string>
 #include <QtGui>
@@ -40,7 +50,7 @@ limitations under the License.
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 
-#include "itkSimpleFastMutexLock.h"
+#include "ftkCommon/ftkTaskRuntime.h"
 
 #include <vul/vul_file.h>
 
@@ -73,8 +83,7 @@ public:
     fregl_image_manager(std::string const & xml_filename, std::string const & image_path, std::string const & anchor_image,
             bool use_NN = false);
 
-    ~fregl_image_manager() {
-    }
+    ~fregl_image_manager();
 
     //: Set the Region of Interest
     //
@@ -111,8 +120,9 @@ public:
     ImageTypePointer GetOutput();
 
     //: Return an ITK image pointer the the region of interest passed an argument
-    // This entry is mutex protected for multi threading operations.  It combines
-    // the set region, update and get output methods.
+    // This entry is safe for multi threading operations.  It combines
+    // the set region, update and get output methods, but does not change
+    // the current region, so concurrent requests only share the cache.
     ImageTypePointer MutexGetRegionOfInterest(PointType origin, SizeType size);
 
     //: Return an ITK image pointer to the Region of Interest in the passed
@@ -143,10 +153,37 @@ public:
     //: Return a pointer the space transformer
     typename fregl_space_transformer< TPixel >::Pointer get_space_transformer();
 
-    //: Set up the cache buffer count.  If 0 Turn off caching
+    //: Set up the cache to hold about count tiles.  If 0 Turn off caching
     // Will reset all cache buffers when called.
     void set_cache_buffer_count(int count);
 
+    //: Set the memory budget of the cache in bytes.  If 0 Turn off caching
+    // Will reset all cache buffers when called.
+    void set_cache_memory(std::size_t bytes);
+
+    //: Set the size of the cached bricks, 64x64x16 by default
+    // Will reset all cache buffers when called.
+    void set_brick_size(SizeType size);
+
+    //: Set prefetching of the tiles next to a request on or off (default on)
+    void set_prefetch(bool use);
+
+    //: Counters of the cache, hits and misses count bricks
+    struct cache_statistics {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+        unsigned long tile_loads;
+        unsigned long prefetches;
+        std::size_t bytes;
+    };
+
+    //: Return the counters of the cache since the last reset
+    cache_statistics get_cache_statistics();
+
+    //: Reset the counters of the cache
+    void reset_cache_statistics();
+
     //: Set disk caching on or off.  
     void set_file_caching(bool use);
 
@@ -157,7 +194,71 @@ public:
 
 
 private:
-    int get_next_slot();
+    //: A brick of a transformed tile
+    struct brick {
+        int image_index;
+        int brick_index;
+        std::vector<TPixel> pixels;
+        typename std::list< brick* >::iterator lru;
+    };
+
+    //: A part of the cache with its own lock, LRU list and budget
+    struct cache_shard {
+        ftk::TaskMutex lock;
+        std::map< std::pair<int, int>, brick* > bricks;
+        std::list< brick* > lru; // most recently used first
+        std::size_t bytes;
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+    };
+
+    //: Prefetches one tile on a worker
+    class prefetch_task : public ftk::Task {
+    public:
+        prefetch_task(fregl_image_manager* manager, int image_index)
+        : manager_(manager), image_index_(image_index) {
+        }
+        void Execute() { manager_->prefetch_tile(image_index_); }
+    private:
+        fregl_image_manager* manager_;
+        int image_index_;
+    };
+
+    //: Clamp a region given in normalized space and move it to anchor space
+    void clamp_region(PointType& origin, SizeType& size) const;
+
+    //: Build the montage of a region in anchor space
+    ImageTypePointer build_region(PointType const & origin, SizeType const & size);
+
+    //: Paste the part of a tile in the region into montage_image
+    void paste_tile(int image_index, ImageTypePointer montage_image,
+            PointType const & origin, SizeType const & size);
+
+    //: Paste a cached brick, returns false if it is not cached
+    bool paste_cached_brick(int image_index, int brick_index, long const * lo, long const * hi,
+            long const * offset, TPixel* montage, SizeType const & montage_size);
+
+    //: Read and transform a tile, from the disk cache if possible
+    ImageTypePointer transform_tile(int image_index);
+
+    //: Add the bricks of a transformed tile which are not cached yet
+    void insert_tile(int image_index, ImageTypePointer xformed_image);
+
+    //: Queue the prefetch of the tiles next to a region
+    void prefetch_neighbours(PointType const & origin, SizeType const & size);
+    void prefetch_tile(int image_index);
+
+    //: Brick geometry of a tile
+    void brick_range(int image_index, int brick_index, long* lo, long* hi) const;
+    int number_of_bricks(int image_index, long* count) const;
+    cache_shard* shard_of(int image_index, int brick_index) {
+        return shards_[(image_index * 7919 + brick_index) % shards_.size()];
+    }
+
+    void setup_cache();
+    void clear_cache();
+
     bool cache_write_image(int image_index, ImageTypePointer t_image);
     ImageTypePointer cache_read_image(int image_index);
 
@@ -178,16 +279,25 @@ private:
     int global_channel;
     bool global_use_channel;
     ImageTypePointer montage_image;
-    std::vector<bool> is_cached;
-    std::vector<bool> is_cached_on_disk;
-    std::vector<ImageTypePointer> cached_images;
-    std::vector<int> cache_slot;
-    std::vector<int> cache_last_used;
-    int cache_time;
-    int cache_size;
+    std::vector<SizeType> image_sizes;
+    std::vector<char> is_cached_on_disk;
+    std::size_t cache_memory;
     bool use_caching;
     bool use_file_caching;
+    bool use_prefetch;
     std::string cache_dir;
-    itk::SimpleFastMutexLock region_mutex;
+
+    SizeType brick_size_;
+    std::vector< cache_shard* > shards_;
+    std::vector< ftk::TaskMutex* > tile_locks_; // held while a tile is read and transformed
+    ftk::TaskMutex io_lock_;
+    ftk::TaskMutex stats_lock_;                 // guards the members below
+    std::vector<int> resident_bricks_;
+    std::vector<char> prefetch_pending_;
+    unsigned long tile_loads_;
+    unsigned long prefetches_;
+
+    // Declared last, so pending prefetches finish before the cache goes
+    ftk::TaskGroup prefetch_group_;
 };
 #endif
@@ -15,12 +15,14 @@ limitations under the License.
 
 #include "fregl_joint_register.h"
 #include "fregl_util.h"
+#include "fregl_global_solver.h"
 
 #include <vnl/vnl_math.h>
 #include <vul/vul_timer.h>
 
 #include <rrel/rrel_muset_obj.h>
 
+#include <algorithm>
 #include <fstream>
 
 static std::string ToString(double val);
@@ -219,6 +221,9 @@ build_graph()
 	vul_timer timer;
 	timer.mark();
 
+	global_transforms_.clear();
+	global_inverses_.clear();
+
 	/* This piece of code is moved initialize(.)
 	// Build the array which contains the sub_graph indices. Images
 	// belonging to the same subgraph should have the same index
@@ -321,11 +326,437 @@ infer_graph()
 	}
 }
 
+// Conversions between the itk transforms and the x' = A*x + t form of
+// fregl_global_solver
+static void
+to_solver(itk::AffineTransform< double, 3>::Pointer xform,
+		  fregl_global_solver::MatrixType& A, fregl_global_solver::PointType& t)
+{
+	A = xform->GetMatrix().GetVnlMatrix();
+	itk::AffineTransform< double, 3>::OffsetType offset = xform->GetOffset();
+	for (int d = 0; d<3; d++)
+		t[d] = offset[d];
+}
+
+static itk::AffineTransform< double, 3>::Pointer
+from_solver(fregl_global_solver::MatrixType const & A, fregl_global_solver::PointType const & t)
+{
+	itk::AffineTransform< double, 3>::Pointer xform = itk::AffineTransform< double, 3>::New();
+	itk::AffineTransform< double, 3>::MatrixType matrix;
+	itk::AffineTransform< double, 3>::OffsetType offset;
+	for (int r = 0; r<3; r++) {
+		for (int c = 0; c<3; c++)
+			matrix(r,c) = A(r,c);
+		offset[r] = t[r];
+	}
+	xform->SetMatrix( matrix );
+	xform->SetOffset( offset );
+	return xform;
+}
+
+// Sample the correspondences of a pairwise transform on a 5x5x3 grid
+// in the part of the from image which maps into the to image. If the
+// transform maps nothing into the to image, the samples of the whole
+// from image are kept so the link still constrains the solution.
+static void
+sample_link(itk::AffineTransform< double, 3>::Pointer xform,
+			itk::Size<3> const & size_from, itk::Size<3> const & size_to,
+			std::vector< fregl_global_solver::PointType >& from_points,
+			std::vector< fregl_global_solver::PointType >& to_points)
+{
+	typedef itk::AffineTransform< double, 3> TransformType;
+	const int samples[3] = {5, 5, size_from[2] > 1 ? 3 : 1};
+
+	// Bounding box of the to image in the from image
+	double lower[3], upper[3];
+	for (int d = 0; d<3; d++) {
+		lower[d] = 0;
+		upper[d] = size_from[d] - 1.0;
+	}
+	TransformType::Pointer inverse = TransformType::New();
+	if (xform->GetInverse( inverse )) {
+		double box_lower[3], box_upper[3];
+		for (int c = 0; c<8; c++) {
+			TransformType::InputPointType corner;
+			for (int d = 0; d<3; d++)
+				corner[d] = (c>>d & 1) ? size_to[d] - 1.0 : 0;
+			TransformType::OutputPointType mapped = inverse->TransformPoint( corner );
+			for (int d = 0; d<3; d++) {
+				if (c == 0 || mapped[d] < box_lower[d]) box_lower[d] = mapped[d];
+				if (c == 0 || mapped[d] > box_upper[d]) box_upper[d] = mapped[d];
+			}
+		}
+		bool empty = false;
+		for (int d = 0; d<3; d++)
+			if (box_lower[d] > upper[d] || box_upper[d] < lower[d])
+				empty = true;
+		if (!empty) {
+			for (int d = 0; d<3; d++) {
+				lower[d] = vnl_math_max(lower[d], box_lower[d]);
+				upper[d] = vnl_math_min(upper[d], box_upper[d]);
+			}
+		}
+	}
+
+	std::vector< fregl_global_solver::PointType > all_from, all_to;
+	for (int ix = 0; ix<samples[0]; ix++)
+		for (int iy = 0; iy<samples[1]; iy++)
+			for (int iz = 0; iz<samples[2]; iz++) {
+				int index[3] = {ix, iy, iz};
+				TransformType::InputPointType point;
+				for (int d = 0; d<3; d++)
+					point[d] = samples[d] > 1 ? lower[d] + (upper[d]-lower[d])*index[d]/(samples[d]-1) : lower[d];
+				TransformType::OutputPointType xformed_pt = xform->TransformPoint( point );
+
+				fregl_global_solver::PointType from_pt, to_pt;
+				bool inside = true;
+				for (int d = 0; d<3; d++) {
+					from_pt[d] = point[d];
+					to_pt[d] = xformed_pt[d];
+					if (xformed_pt[d] < -0.5 || xformed_pt[d] > size_to[d] - 0.5)
+						inside = false;
+				}
+				all_from.push_back( from_pt );
+				all_to.push_back( to_pt );
+				if (inside) {
+					from_points.push_back( from_pt );
+					to_points.push_back( to_pt );
+				}
+			}
+	if (from_points.empty()) {
+		from_points.swap( all_from );
+		to_points.swap( all_to );
+	}
+}
+
+template < class TPixel >
+bool
+fregl_joint_register< TPixel >::
+build_graph_global(int max_iterations)
+{
+	vul_timer timer;
+	timer.mark();
+
+	if (links_.empty())
+		collect_links();
+	global_transforms_.assign(image_ids_.size(), TransformType::Pointer());
+
+	bool success = true;
+	for (int index = 1; index <= num_subgraphs_; index++) {
+		if (!solve_subgraph(index, max_iterations)) {
+			std::cerr<<"ERROR: No global solution for subgraph "<<index<<std::endl;
+			success = false;
+		}
+	}
+
+	global_inverses_.assign(image_ids_.size(), TransformType::Pointer());
+	for (unsigned int i = 0; i<image_ids_.size(); i++) {
+		if (!global_transforms_[i]) continue;
+		global_inverses_[i] = TransformType::New();
+		if (!global_transforms_[i]->GetInverse( global_inverses_[i] ))
+			global_inverses_[i] = NULL;
+	}
+	update_overlaps_global();
+
+	std::cout << "Timing: Global joint registration in  ";
+	timer.print( std::cout );
+	std::cout<<std::endl;
+
+	return success;
+}
+
+template < class TPixel >
+void
+fregl_joint_register< TPixel >::
+update_overlaps_global()
+{
+	// The translation of the pair (from,to) is the origin of from
+	// mapped by the inverse of to, and fregl_util_overlap only keeps
+	// the pairs where it lies in the box of to grown by the size of
+	// from. So the origins are binned on a grid in the anchor space and
+	// every image only visits the cells under its grown box mapped into
+	// the anchor space, instead of composing all n x n pairs.
+	unsigned int n = image_ids_.size();
+	double max_x = 1, max_y = 1;
+	for (unsigned int i = 0; i<n; i++) {
+		max_x = vnl_math_max( max_x, (double)image_sizes_[i][0] );
+		max_y = vnl_math_max( max_y, (double)image_sizes_[i][1] );
+	}
+
+	typedef std::map< std::pair<long,long>, std::vector<int> > GridType;
+	GridType grid;
+	std::vector< TransformType::InputPointType > origins(n);
+	for (unsigned int i = 0; i<n; i++) {
+		if (!global_transforms_[i]) continue;
+		TransformType::OffsetType offset = global_transforms_[i]->GetOffset();
+		for (int d = 0; d<3; d++)
+			origins[i][d] = offset[d];
+		long cx = (long)vcl_floor( origins[i][0]/max_x );
+		long cy = (long)vcl_floor( origins[i][1]/max_y );
+		grid[std::make_pair(cx, cy)].push_back( i );
+	}
+
+	// Pairs that are not visited below do not overlap
+	for (unsigned int from = 0; from<n; from++) {
+		if (!global_transforms_[from]) continue;
+		for (unsigned int to = 0; to<n; to++) {
+			if (from != to && global_inverses_[to] && graph_indices_[from] == graph_indices_[to])
+				overlap_(from, to) = 0;
+		}
+	}
+
+	for (unsigned int to = 0; to<n; to++) {
+		if (!global_inverses_[to]) continue;
+
+		// Bounding box of the grown box of to in the anchor space. The
+		// quick test ignores z, the depth of the image covers the tilt
+		// of montage tiles.
+		double min_ax = vnl_huge_val(1.0), min_ay = vnl_huge_val(1.0);
+		double max_ax = -vnl_huge_val(1.0), max_ay = -vnl_huge_val(1.0);
+		for (int corner = 0; corner<8; corner++) {
+			TransformType::InputPointType pt;
+			pt[0] = (corner & 1) ? (double)image_sizes_[to][0] : -max_x;
+			pt[1] = (corner & 2) ? (double)image_sizes_[to][1] : -max_y;
+			pt[2] = (corner & 4) ? (double)image_sizes_[to][2] : -(double)image_sizes_[to][2];
+			TransformType::OutputPointType apt = global_transforms_[to]->TransformPoint( pt );
+			min_ax = vnl_math_min( min_ax, apt[0] );
+			max_ax = vnl_math_max( max_ax, apt[0] );
+			min_ay = vnl_math_min( min_ay, apt[1] );
+			max_ay = vnl_math_max( max_ay, apt[1] );
+		}
+
+		double cx0 = vcl_floor( min_ax/max_x ), cx1 = vcl_floor( max_ax/max_x );
+		double cy0 = vcl_floor( min_ay/max_y ), cy1 = vcl_floor( max_ay/max_y );
+		std::vector< std::vector<int> const* > cells;
+		if ((cx1-cx0+1)*(cy1-cy0+1) <= (double)grid.size()) {
+			for (long cx = (long)cx0; cx<=(long)cx1; cx++) {
+				for (long cy = (long)cy0; cy<=(long)cy1; cy++) {
+					GridType::const_iterator cell = grid.find( std::make_pair(cx, cy) );
+					if (cell != grid.end())
+						cells.push_back( &cell->second );
+				}
+			}
+		}
+		else {
+			// a box larger than the montage, e.g. a degenerate transform
+			for (GridType::const_iterator cell = grid.begin(); cell != grid.end(); ++cell) {
+				if (cell->first.first >= cx0 && cell->first.first <= cx1 &&
+					cell->first.second >= cy0 && cell->first.second <= cy1)
+					cells.push_back( &cell->second );
+			}
+		}
+
+		for (unsigned int c = 0; c<cells.size(); c++) {
+			for (unsigned int k = 0; k<cells[c]->size(); k++) {
+				int from = (*cells[c])[k];
+				if (from == (int)to || graph_indices_[from] != graph_indices_[to])
+					continue;
+				TransformType::OutputPointType t = global_inverses_[to]->TransformPoint( origins[from] );
+				if (t[0] > image_sizes_[to][0] || t[1] > image_sizes_[to][1] ||
+					-t[0] > image_sizes_[from][0] || -t[1] > image_sizes_[from][1])
+					continue;
+				overlap_(from, to) = fregl_util< TPixel >::fregl_util_overlap(get_transform(from, to), image_sizes_[from], image_sizes_[to]);
+			}
+		}
+	}
+}
+
+template < class TPixel >
+void
+fregl_joint_register< TPixel >::
+collect_links()
+{
+	links_.clear();
+	link_index_.clear();
+	for (unsigned int from = 0; from<transforms_.rows(); from++)
+		for (unsigned int to = from+1; to<transforms_.cols(); to++) {
+			if ( !transforms_(from,to) ) continue;
+			graph_link new_link;
+			new_link.from = from;
+			new_link.to = to;
+			new_link.transform = transforms_(from,to);
+			new_link.residual = -1;
+			link_index_[std::make_pair(int(from), int(to))] = links_.size();
+			links_.push_back( new_link );
+		}
+}
+
+template < class TPixel >
+bool
+fregl_joint_register< TPixel >::
+solve_subgraph(int index, int max_iterations)
+{
+	// The images of the subgraph and their links
+	std::vector<int> images;
+	std::vector<int> solver_index(image_ids_.size(), -1);
+	for (unsigned int i = 0; i<image_ids_.size(); i++) {
+		if (graph_indices_[i] == index) {
+			solver_index[i] = images.size();
+			images.push_back(i);
+		}
+	}
+	if (images.empty())
+		return true;
+
+	std::vector< std::vector<int> > adjacency(images.size());
+	for (unsigned int k = 0; k<links_.size(); k++) {
+		if (graph_indices_[links_[k].from] != index) continue;
+		adjacency[solver_index[links_[k].from]].push_back(k);
+		adjacency[solver_index[links_[k].to]].push_back(k);
+	}
+
+	// The anchor is the image with the most links, which keeps the
+	// initial chains short
+	int anchor = 0;
+	for (unsigned int i = 1; i<images.size(); i++)
+		if (adjacency[i].size() > adjacency[anchor].size())
+			anchor = i;
+
+	// Initial transforms into the anchor, composed along a breadth
+	// first tree of the links
+	std::vector< TransformType::Pointer > initial(images.size());
+	initial[anchor] = TransformType::New();
+	initial[anchor]->SetIdentity();
+	std::vector<int> queue(1, anchor);
+	for (unsigned int q = 0; q<queue.size(); q++) {
+		int current = queue[q];
+		for (unsigned int a = 0; a<adjacency[current].size(); a++) {
+			graph_link const & l = links_[adjacency[current][a]];
+			bool current_is_to = (solver_index[l.to] == current);
+			int other = current_is_to ? solver_index[l.from] : solver_index[l.to];
+			if (initial[other]) continue;
+
+			TransformType::Pointer xform = TransformType::New();
+			if (current_is_to) {
+				xform->SetIdentity();
+				xform->Compose(initial[current]);
+				xform->Compose(l.transform, true);
+			}
+			else {
+				if (!l.transform->GetInverse( xform )) continue;
+				xform->Compose(initial[current]);
+			}
+			initial[other] = xform;
+			queue.push_back(other);
+		}
+	}
+
+	fregl_global_solver solver;
+	fregl_global_solver::MatrixType A;
+	fregl_global_solver::PointType t;
+	for (unsigned int i = 0; i<images.size(); i++) {
+		solver.add_image();
+		if (initial[i]) {
+			to_solver(initial[i], A, t);
+			solver.set_initial(i, A, t);
+		}
+	}
+	solver.set_anchor(anchor);
+	solver.set_max_iterations(max_iterations);
+
+	std::vector<int> solver_links;
+	for (unsigned int i = 0; i<images.size(); i++) {
+		for (unsigned int a = 0; a<adjacency[i].size(); a++) {
+			int k = adjacency[i][a];
+			if (solver_index[links_[k].from] != int(i)) continue;
+			std::vector< fregl_global_solver::PointType > from_points, to_points;
+			sample_link(links_[k].transform, image_sizes_[links_[k].from], image_sizes_[links_[k].to],
+				from_points, to_points);
+			solver.add_link(i, solver_index[links_[k].to], from_points, to_points);
+			solver_links.push_back(k);
+		}
+	}
+
+	std::cout<<"Subgraph "<<index<<": "<<images.size()<<" images, "<<solver_links.size()
+		<<" links, anchor "<<image_ids_[images[anchor]]<<std::endl;
+	if (!solver.solve())
+		return false;
+
+	for (unsigned int i = 0; i<images.size(); i++)
+		global_transforms_[images[i]] = from_solver(solver.A(i), solver.t(i));
+
+	int inconsistent = 0;
+	for (unsigned int s = 0; s<solver_links.size(); s++) {
+		graph_link & l = links_[solver_links[s]];
+		l.residual = solver.residual(s);
+		if (solver.weight(s) < 0.5) {
+			std::cout<<"Inconsistent pair "<<image_ids_[l.from]<<" to "<<image_ids_[l.to]
+				<<" with residual "<<l.residual<<std::endl;
+			inconsistent++;
+		}
+	}
+	std::cout<<"Robust scale = "<<solver.scale()<<", inconsistent pairs = "<<inconsistent<<std::endl;
+
+	return true;
+}
+
+template < class TPixel >
+double
+fregl_joint_register< TPixel >::
+get_residual(int from, int to) const
+{
+	std::map< std::pair<int,int>, int >::const_iterator it =
+		link_index_.find( std::make_pair(vnl_math_min(from, to), vnl_math_max(from, to)) );
+	if (it == link_index_.end())
+		return -1;
+	return links_[it->second].residual;
+}
+
+template < class TPixel >
+int
+fregl_joint_register< TPixel >::
+prune_links(double max_residual)
+{
+	std::vector< graph_link > kept;
+	kept.reserve(links_.size());
+	link_index_.clear();
+	int removed = 0;
+	for (unsigned int k = 0; k<links_.size(); k++) {
+		graph_link const & l = links_[k];
+		if (l.residual > max_residual) {
+			std::cout<<"Pruned pair "<<image_ids_[l.from]<<" to "<<image_ids_[l.to]
+				<<" with residual "<<l.residual<<std::endl;
+			transforms_(l.from, l.to) = NULL;
+			transforms_(l.to, l.from) = NULL;
+			removed++;
+			continue;
+		}
+		link_index_[std::make_pair(l.from, l.to)] = kept.size();
+		kept.push_back( l );
+	}
+	links_.swap( kept );
+
+	if (removed) {
+		// Removing links may split the subgraphs
+		std::fill(graph_indices_.begin(), graph_indices_.end(), 0);
+		num_subgraphs_ = 0;
+		for (unsigned int i = 0; i<transforms_.rows(); i++) {
+			if (!graph_indices_[i])
+				generate_graph_indices(i, ++num_subgraphs_);
+		}
+		global_transforms_.clear();
+		global_inverses_.clear();
+	}
+	return removed;
+}
+
 template < class TPixel >
 fregl_joint_register< TPixel >::TransformType::Pointer 
 fregl_joint_register< TPixel >::
 get_transform(int from, int to) const
 {
+	// After build_graph_global() the transforms are composed from the
+	// transforms into the anchor of the subgraph
+	if (from != to && !global_transforms_.empty() && global_transforms_[from] &&
+		global_transforms_[to] && graph_indices_[from] == graph_indices_[to]) {
+			if (!global_inverses_[to])
+				return NULL;
+			TransformType::Pointer xform = TransformType::New();
+			xform->SetFixedParameters( global_inverses_[to]->GetFixedParameters() );
+			xform->SetParameters( global_inverses_[to]->GetParameters() );
+			xform->Compose(global_transforms_[from], true);
+			return xform;
+	}
 	return transforms_(from, to);
 }
 
@@ -350,7 +781,7 @@ get_transform(std::string from_name, std::string to_name) const
 		std::cerr<<"From_image is not found!!!"<<std::endl; 
 		return NULL;
 	}
-	return transforms_(from_index, to_index);
+	return get_transform(from_index, to_index);
 }
 
 template < class TPixel >
@@ -896,7 +1327,7 @@ get_reg_record(int from, int to) const
 	fregl_reg_record::Pointer reg_rec = new fregl_reg_record();
 	reg_rec->set_from_image_info( image_ids_[from], image_sizes_[from] );
 	reg_rec->set_to_image_info( image_ids_[to], image_sizes_[to]);
-	reg_rec->set_transform( transforms_[from][to] );
+	reg_rec->set_transform( get_transform(from, to) );
 	reg_rec->set_overlap( overlap_(from,to) );
 	reg_rec->set_obj_value( obj_(from,to) );
 	return reg_rec;
@@ -30,6 +30,7 @@ limitations under the License.
 
 #include "itkAffineTransform.h"
 #include "itkPoint.h"
+#include <map>
 #include <vector>
 #include <string>
 
@@ -75,6 +76,29 @@ public:
 	//: Compute the transformation from every image to the chosen anchor
 	bool build_graph(int i);
 
+	//: Compute the transformations of all images with one global solve
+	//
+	//  All pairwise transforms of a subgraph are solved together as
+	//  one sparse least-squares problem by fregl_global_solver, instead
+	//  of one dense problem per anchor image. This is meant for
+	//  montages with thousands of tiles. Pairwise transforms in
+	//  disagreement with the others are down-weighted, and their
+	//  residuals are available from get_residual(). The transform of
+	//  a pair is composed from the solution when it is
+	//  requested. Returns false if a subgraph could not be solved.
+	bool build_graph_global(int max_iterations = 10);
+
+	//: RMS residual in pixels of a pairwise link after build_graph_global()
+	//
+	//  If the pair is not a link or has not been solved, a -1 is returned
+	double get_residual(int from, int to) const;
+
+	//: Remove the links with a residual above max_residual
+	//
+	//  The subgraphs are rebuilt, so build_graph_global() has to be
+	//  run again. Returns the number of removed links.
+	int prune_links(double max_residual);
+
 	//: Construct the graph without mutual consistency
 	//
 	//  exisiting pairwise links are copied over, and
@@ -167,7 +191,26 @@ private:
 	//  distance in the overlapping area to generate correspondences.
 	void generate_correspondences();
 
+	//: Collect the pairwise links for build_graph_global()
+	void collect_links();
+
+	//: Solve the transforms of one subgraph into its anchor image
+	bool solve_subgraph(int index, int max_iterations);
+
+	//: Recompute the overlaps from the global transforms
+	//
+	//  Only the pairs that are close in the anchor space are visited
+	void update_overlaps_global();
+
 private:
+	//: A pairwise link of the global solve, from < to
+	struct graph_link
+	{
+		int from, to;
+		TransformType::Pointer transform; // pairwise, from to to
+		double residual;
+	};
+
 	vbl_array_2d<TransformType::Pointer> transforms_; // (from,to)
 	vbl_array_2d<double> overlap_; //initially pairwise, finally updated by joint
 	vbl_array_2d<double> obj_; //values from the pairwise registration
@@ -179,6 +222,11 @@ private:
 	vbl_array_2d< CorrespondenceList > pairwise_constraints_;
 	std::vector<int> graph_indices_;
 	int num_subgraphs_;
+
+	std::vector< graph_link > links_;
+	std::map< std::pair<int,int>, int > link_index_;
+	std::vector< TransformType::Pointer > global_transforms_; // image to the anchor of its subgraph
+	std::vector< TransformType::Pointer > global_inverses_; // anchor to image, NULL if not invertible
 };
 
 #endif
@@ -0,0 +1,432 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#include <fregl/fregl_mosaic_composer.h>
+#include <fregl/fregl_util.h>
+#include "itkResampleImageFilter.h"
+#include "itkNearestNeighborInterpolateImageFunction.h"
+
+#include <vul/vul_file.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+// Tolerances of the test for a pure translation by whole voxels
+static const double matrix_tolerance = 1e-6;
+static const double shift_tolerance = 1e-3;
+
+template < class TPixel >
+fregl_mosaic_composer< TPixel >::
+fregl_mosaic_composer(SpaceTransformerType const & space_transformer, std::string const & image_path)
+	: space_transformer_(space_transformer),
+	image_path_(image_path),
+	channel_set_(false),
+	channel_(0),
+	denoise_(false),
+	use_NN_(false),
+	chunk_size_set_(false),
+	use_projection_(true),
+	projection_(NULL),
+	reads_(0),
+	copies_(0),
+	resamples_(0)
+{
+	chunk_size_.Fill(0);
+	montage_size_.Fill(0);
+}
+
+template < class TPixel >
+void
+fregl_mosaic_composer< TPixel >::
+set_channel(int channel)
+{
+	channel_set_ = true;
+	channel_ = channel;
+}
+
+template < class TPixel >
+void
+fregl_mosaic_composer< TPixel >::
+set_denoise(bool denoise)
+{
+	denoise_ = denoise;
+}
+
+template < class TPixel >
+void
+fregl_mosaic_composer< TPixel >::
+set_nearest_neighbor(bool use_NN)
+{
+	use_NN_ = use_NN;
+}
+
+template < class TPixel >
+void
+fregl_mosaic_composer< TPixel >::
+set_chunk_size(SizeType size)
+{
+	chunk_size_set_ = true;
+	chunk_size_ = size;
+}
+
+template < class TPixel >
+void
+fregl_mosaic_composer< TPixel >::
+set_projection(bool projection)
+{
+	use_projection_ = projection;
+}
+
+template < class TPixel >
+void
+fregl_mosaic_composer< TPixel >::
+setup_tiles()
+{
+	std::vector<SizeType> sizes = space_transformer_.image_sizes();
+	PointType origin = space_transformer_.origin();
+	typename SpaceTransformerType::SpacingType spacing = space_transformer_.spacing();
+	bool unit_spacing = spacing[0] == 1 && spacing[1] == 1 && spacing[2] == 1;
+
+	tiles_.clear();
+	tiles_.resize(sizes.size());
+	for (unsigned int i = 0; i < sizes.size(); i++) {
+		tile& t = tiles_[i];
+		t.translation = false;
+		t.last_chunk = -1;
+		t.image = NULL;
+		for (int d = 0; d < 3; d++) {
+			t.lo[d] = 0;
+			t.hi[d] = 0;
+			t.shift[d] = 0;
+		}
+
+		TransformTypePointer to_anchor = space_transformer_.image_to_anchor(i);
+		t.anchor_to_tile = space_transformer_.anchor_to_image(i);
+		if (!to_anchor || !t.anchor_to_tile)
+			continue;
+
+		// Bounding box of the 8 corners of the tile in the montage
+		double lo[3], hi[3];
+		for (int c = 0; c < 8; c++) {
+			PointType corner;
+			corner[0] = (c & 1) ? sizes[i][0] - 1 : 0;
+			corner[1] = (c & 2) ? sizes[i][1] - 1 : 0;
+			corner[2] = (c & 4) ? sizes[i][2] - 1 : 0;
+			PointType p = to_anchor->TransformPoint(corner);
+			for (int d = 0; d < 3; d++) {
+				double index = (p[d] - origin[d]) / spacing[d];
+				if (c == 0 || index < lo[d]) lo[d] = index;
+				if (c == 0 || index > hi[d]) hi[d] = index;
+			}
+		}
+		for (int d = 0; d < 3; d++) {
+			t.lo[d] = static_cast<long>(std::floor(lo[d])) - 1;
+			t.hi[d] = static_cast<long>(std::ceil(hi[d])) + 2;
+			if (t.lo[d] < 0) t.lo[d] = 0;
+			if (t.hi[d] > long(montage_size_[d])) t.hi[d] = montage_size_[d];
+			if (t.hi[d] < t.lo[d]) t.hi[d] = t.lo[d];
+		}
+
+		// A tile moved by whole voxels is copied instead of resampled
+		if (!unit_spacing)
+			continue;
+		typename SpaceTransformerType::TransformType::MatrixType const & A = t.anchor_to_tile->GetMatrix();
+		typename SpaceTransformerType::TransformType::OutputVectorType b = t.anchor_to_tile->GetOffset();
+		bool translation = true;
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 3; c++) {
+				double expected = (r == c) ? 1.0 : 0.0;
+				if (std::fabs(A[r][c] - expected) > matrix_tolerance)
+					translation = false;
+			}
+			double s = origin[r] + b[r];
+			double rounded = std::floor(s + 0.5);
+			if (std::fabs(s - rounded) > shift_tolerance)
+				translation = false;
+			t.shift[r] = static_cast<long>(rounded);
+		}
+		t.translation = translation;
+	}
+}
+
+template < class TPixel >
+bool
+fregl_mosaic_composer< TPixel >::
+compose(std::string const & mhd_file)
+{
+	reads_ = 0;
+	copies_ = 0;
+	resamples_ = 0;
+	montage_size_ = space_transformer_.montage_size();
+	std::vector<std::string> names = space_transformer_.image_names();
+
+	SizeType chunk_size = chunk_size_;
+	if (!chunk_size_set_) {
+		chunk_size[0] = 1024;
+		chunk_size[1] = 1024;
+		chunk_size[2] = montage_size_[2];
+	}
+	for (int d = 0; d < 3; d++) {
+		if (chunk_size[d] == 0 || chunk_size[d] > montage_size_[d])
+			chunk_size[d] = montage_size_[d];
+	}
+
+	setup_tiles();
+
+	long chunk_count[3];
+	for (int d = 0; d < 3; d++)
+		chunk_count[d] = montage_size_[d] == 0 ? 0 : (montage_size_[d] + chunk_size[d] - 1) / chunk_size[d];
+	int number_of_chunks = chunk_count[0] * chunk_count[1] * chunk_count[2];
+
+	// The chunks are walked in z, y, x order. A tile is kept from its
+	// first chunk until the last one it overlaps.
+	for (int c = 0; c < number_of_chunks; c++) {
+		long lo[3], hi[3];
+		long cell[3] = { c % chunk_count[0], (c / chunk_count[0]) % chunk_count[1], c / (chunk_count[0] * chunk_count[1]) };
+		for (int d = 0; d < 3; d++) {
+			lo[d] = cell[d] * chunk_size[d];
+			hi[d] = std::min(lo[d] + long(chunk_size[d]), long(montage_size_[d]));
+		}
+		for (unsigned int i = 0; i < tiles_.size(); i++) {
+			tile const & t = tiles_[i];
+			if (t.lo[0] < hi[0] && lo[0] < t.hi[0] && t.lo[1] < hi[1] && lo[1] < t.hi[1] && t.lo[2] < hi[2] && lo[2] < t.hi[2])
+				tiles_[i].last_chunk = c;
+		}
+	}
+
+	// Presize the raw file, so the chunks can be written in any order
+	std::string raw_file = vul_file::strip_extension(mhd_file) + ".raw";
+	std::ofstream out(raw_file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cerr << "Cannot write " << raw_file << std::endl;
+		return false;
+	}
+	std::streamoff total = std::streamoff(montage_size_[0]) * montage_size_[1] * montage_size_[2] * sizeof(TPixel);
+	if (total > 0) {
+		out.seekp(total - 1);
+		out.put(0);
+	}
+
+	if (use_projection_) {
+		typename ImageType2D::IndexType start;
+		start.Fill(0);
+		typename ImageType2D::SizeType size;
+		size[0] = montage_size_[0];
+		size[1] = montage_size_[1];
+		typename ImageType2D::RegionType region;
+		region.SetIndex(start);
+		region.SetSize(size);
+		projection_ = ImageType2D::New();
+		projection_->SetRegions(region);
+		projection_->Allocate();
+		projection_->FillBuffer(0);
+	}
+	else
+		projection_ = NULL;
+
+	std::vector< TPixel > chunk;
+	for (int c = 0; c < number_of_chunks; c++) {
+		long lo[3], hi[3];
+		long cell[3] = { c % chunk_count[0], (c / chunk_count[0]) % chunk_count[1], c / (chunk_count[0] * chunk_count[1]) };
+		for (int d = 0; d < 3; d++) {
+			lo[d] = cell[d] * chunk_size[d];
+			hi[d] = std::min(lo[d] + long(chunk_size[d]), long(montage_size_[d]));
+		}
+		chunk.assign(std::size_t(hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]), 0);
+
+		for (unsigned int i = 0; i < tiles_.size(); i++) {
+			tile& t = tiles_[i];
+			if (t.last_chunk < c)
+				continue;
+			if (!(t.lo[0] < hi[0] && lo[0] < t.hi[0] && t.lo[1] < hi[1] && lo[1] < t.hi[1] && t.lo[2] < hi[2] && lo[2] < t.hi[2]))
+				continue;
+
+			if (!t.image) {
+				std::string image_name = image_path_ + std::string("/") + names[i];
+				std::cout << "Image " << image_name << std::endl;
+				t.image = fregl_util< TPixel >::fregl_util_read_image(image_name, channel_set_, channel_, denoise_);
+				reads_++;
+				if (!t.image) {
+					t.last_chunk = -1;
+					continue;
+				}
+				// The shift assumes tiles at the origin with unit spacing
+				typename ImageType::PointType tile_origin = t.image->GetOrigin();
+				typename ImageType::SpacingType tile_spacing = t.image->GetSpacing();
+				for (int d = 0; d < 3; d++) {
+					if (tile_origin[d] != 0 || tile_spacing[d] != 1)
+						t.translation = false;
+				}
+			}
+			add_tile(t, lo, hi, chunk);
+		}
+
+		if (!write_chunk(out, lo, hi, chunk)) {
+			std::cerr << "Cannot write " << raw_file << std::endl;
+			return false;
+		}
+
+		if (projection_) {
+			long cx = hi[0] - lo[0], cy = hi[1] - lo[1], cz = hi[2] - lo[2];
+			TPixel* proj = projection_->GetBufferPointer();
+			for (long z = 0; z < cz; z++)
+				for (long y = 0; y < cy; y++) {
+					TPixel const * src = &chunk[(z * cy + y) * cx];
+					TPixel* dst = proj + (lo[1] + y) * long(montage_size_[0]) + lo[0];
+					for (long x = 0; x < cx; x++)
+						if (src[x] > dst[x]) dst[x] = src[x];
+				}
+		}
+
+		// Drop the tiles which are not needed anymore
+		for (unsigned int i = 0; i < tiles_.size(); i++) {
+			if (tiles_[i].last_chunk == c)
+				tiles_[i].image = NULL;
+		}
+	}
+	out.close();
+
+	std::ofstream header(mhd_file.c_str());
+	if (!header) {
+		std::cerr << "Cannot write " << mhd_file << std::endl;
+		return false;
+	}
+	typename SpaceTransformerType::SpacingType spacing = space_transformer_.spacing();
+	// The chunks cover the montage from index 0, so the first voxel of
+	// the raw file sits at the montage origin
+	PointType origin = space_transformer_.origin();
+	header << "ObjectType = Image" << std::endl;
+	header << "NDims = 3" << std::endl;
+	header << "BinaryData = True" << std::endl;
+	header << "BinaryDataByteOrderMSB = False" << std::endl;
+	header << "CompressedData = False" << std::endl;
+	header << "Offset = " << origin[0] << " " << origin[1] << " " << origin[2] << std::endl;
+	header << "ElementSpacing = " << spacing[0] << " " << spacing[1] << " " << spacing[2] << std::endl;
+	header << "DimSize = " << montage_size_[0] << " " << montage_size_[1] << " " << montage_size_[2] << std::endl;
+	header << "ElementType = " << (sizeof(TPixel) == 1 ? "MET_UCHAR" : "MET_USHORT") << std::endl;
+	header << "ElementDataFile = " << vul_file::strip_directory(raw_file) << std::endl;
+
+	std::cout << "Composed " << number_of_chunks << " chunks, " << reads_ << " reads, "
+		<< copies_ << " copies, " << resamples_ << " resamples" << std::endl;
+	return true;
+}
+
+template < class TPixel >
+void
+fregl_mosaic_composer< TPixel >::
+add_tile(tile& t, long const * lo, long const * hi, std::vector< TPixel >& chunk)
+{
+	long cx = hi[0] - lo[0], cy = hi[1] - lo[1];
+
+	if (t.translation) {
+		// Montage voxel i is tile voxel i + shift, copy the rows directly
+		typename ImageType::SizeType tile_size = t.image->GetLargestPossibleRegion().GetSize();
+		long from[3], to[3];
+		for (int d = 0; d < 3; d++) {
+			from[d] = std::max(lo[d], -t.shift[d]);
+			to[d] = std::min(hi[d], long(tile_size[d]) - t.shift[d]);
+			if (to[d] <= from[d])
+				return;
+		}
+		TPixel const * src = t.image->GetBufferPointer();
+		long tx = tile_size[0], ty = tile_size[1];
+		long n = to[0] - from[0];
+#ifdef _OPENMP
+		#pragma omp parallel for
+#endif
+		for (long z = from[2]; z < to[2]; z++)
+			for (long y = from[1]; y < to[1]; y++) {
+				TPixel const * s = src + ((z + t.shift[2]) * ty + y + t.shift[1]) * tx + from[0] + t.shift[0];
+				TPixel* d = &chunk[((z - lo[2]) * cy + y - lo[1]) * cx + from[0] - lo[0]];
+				for (long x = 0; x < n; x++)
+					if (s[x] > d[x]) d[x] = s[x];
+			}
+		copies_++;
+		return;
+	}
+
+	// Resample the tile in the overlap of its bounding box and the chunk
+	long from[3], to[3];
+	for (int d = 0; d < 3; d++) {
+		from[d] = std::max(lo[d], t.lo[d]);
+		to[d] = std::min(hi[d], t.hi[d]);
+	}
+	PointType origin = space_transformer_.origin();
+	typename SpaceTransformerType::SpacingType spacing = space_transformer_.spacing();
+	PointType region_origin;
+	SizeType region_size;
+	for (int d = 0; d < 3; d++) {
+		region_origin[d] = origin[d] + from[d] * spacing[d];
+		region_size[d] = to[d] - from[d];
+	}
+
+	typedef itk::ResampleImageFilter< ImageType, ImageType > ResamplerType;
+	typename ResamplerType::Pointer resampler = ResamplerType::New();
+	if (use_NN_) {
+		typedef itk::NearestNeighborInterpolateImageFunction< ImageType, double > NNInterpoType;
+		typename NNInterpoType::Pointer nn_interpolator = NNInterpoType::New();
+		resampler->SetInterpolator(nn_interpolator);
+	}
+	resampler->SetInput(t.image);
+	resampler->SetTransform(t.anchor_to_tile);
+	resampler->SetSize(region_size);
+	resampler->SetOutputOrigin(region_origin);
+	resampler->SetOutputSpacing(spacing);
+	resampler->SetDefaultPixelValue(0);
+	try {
+		resampler->Update();
+	}
+	catch (itk::ExceptionObject& e) {
+		std::cerr << e << std::endl;
+		return;
+	}
+
+	TPixel const * src = resampler->GetOutput()->GetBufferPointer();
+	long rx = region_size[0], ry = region_size[1];
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for (long z = from[2]; z < to[2]; z++)
+		for (long y = from[1]; y < to[1]; y++) {
+			TPixel const * s = src + ((z - from[2]) * ry + y - from[1]) * rx;
+			TPixel* d = &chunk[((z - lo[2]) * cy + y - lo[1]) * cx + from[0] - lo[0]];
+			for (long x = 0; x < rx; x++)
+				if (s[x] > d[x]) d[x] = s[x];
+		}
+	resamples_++;
+}
+
+template < class TPixel >
+bool
+fregl_mosaic_composer< TPixel >::
+write_chunk(std::ofstream& out, long const * lo, long const * hi, std::vector< TPixel > const & chunk)
+{
+	long cx = hi[0] - lo[0], cy = hi[1] - lo[1];
+	for (long z = lo[2]; z < hi[2]; z++)
+		for (long y = lo[1]; y < hi[1]; y++) {
+			std::streamoff pos = ((std::streamoff(z) * montage_size_[1] + y) * montage_size_[0] + lo[0]) * sizeof(TPixel);
+			out.seekp(pos);
+			out.write(reinterpret_cast<char const *>(&chunk[((z - lo[2]) * cy + y - lo[1]) * cx]), cx * sizeof(TPixel));
+		}
+	return bool(out);
+}
+
+//Explicit Instantiation
+template class fregl_mosaic_composer< unsigned char >;
+template class fregl_mosaic_composer< unsigned short >;
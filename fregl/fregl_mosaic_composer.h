@@ -0,0 +1,125 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+//:
+// \file
+// \brief Streaming composition of a montage in chunks
+//
+//  Instead of resampling every tile into an image of the size of the
+//  montage, the output is walked in chunks. For every chunk only the
+//  tiles whose transformed bounding boxes overlap it are resampled,
+//  and only in the overlap. Tiles which are moved by a whole number of
+//  voxels are copied without resampling. Finished chunks are written
+//  into a raw file with a MetaImage header, so the memory is bounded
+//  by one chunk plus the tiles in use instead of by the montage. The
+//  tiles are fused by their maximum, and every tile is read once and
+//  dropped after the last chunk using it.
+//
+#ifndef _fregl_mosaic_composer_h_
+#define _fregl_mosaic_composer_h_
+
+#include <fregl/fregl_space_transformer.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+template < class TPixel >
+class fregl_mosaic_composer
+{
+public:
+	typedef fregl_space_transformer< TPixel >                 SpaceTransformerType;
+	typedef typename SpaceTransformerType::ImageType          ImageType;
+	typedef typename SpaceTransformerType::ImageTypePointer   ImageTypePointer;
+	typedef typename SpaceTransformerType::ImageType2D        ImageType2D;
+	typedef typename SpaceTransformerType::ImageType2DPointer ImageType2DPointer;
+	typedef typename SpaceTransformerType::TransformTypePointer TransformTypePointer;
+	typedef typename SpaceTransformerType::SizeType           SizeType;
+	typedef typename SpaceTransformerType::PointType          PointType;
+
+	//: Constructor, the anchor of the space transformer has to be set
+	fregl_mosaic_composer(SpaceTransformerType const & space_transformer, std::string const & image_path);
+
+	//: The channel to read, all channels are fused if not set
+	void set_channel(int channel);
+
+	//: Denoise the tiles when reading them
+	void set_denoise(bool denoise);
+
+	//: Use nearest neighbour interpolation for the tiles which are resampled
+	void set_nearest_neighbor(bool use_NN);
+
+	//: Size of the chunks in voxels
+	//
+	//  The default is 1024 x 1024 x the depth of the montage.
+	void set_chunk_size(SizeType size);
+
+	//: Also build the 2D maximum projection of the montage (default on)
+	void set_projection(bool projection);
+
+	//: Compose the montage into the MetaImage file mhd_file
+	//
+	//  The voxels go into a raw file next to it with the extension
+	//  .raw. Returns false if the output can not be written.
+	bool compose(std::string const & mhd_file);
+
+	//: The 2D maximum projection of the montage
+	ImageType2DPointer projection() const { return projection_; }
+
+	//: Counters of the last composition
+	unsigned int number_of_reads() const { return reads_; }
+	unsigned int number_of_copies() const { return copies_; }
+	unsigned int number_of_resamples() const { return resamples_; }
+
+private:
+	//: A tile in the montage
+	struct tile
+	{
+		TransformTypePointer anchor_to_tile;
+		long lo[3], hi[3];   // bounding box in the montage, [lo,hi)
+		bool translation;    // moved by a whole number of voxels
+		long shift[3];       // tile voxel = montage voxel + shift
+		int last_chunk;      // the tile is dropped after this chunk
+		ImageTypePointer image;
+	};
+
+	//: Find the bounding boxes and the translations of the tiles
+	void setup_tiles();
+
+	//: Fuse the overlap of a tile and a chunk into the chunk
+	void add_tile(tile& t, long const * lo, long const * hi, std::vector< TPixel >& chunk);
+
+	//: Write a chunk into the raw file
+	bool write_chunk(std::ofstream& out, long const * lo, long const * hi, std::vector< TPixel > const & chunk);
+
+	SpaceTransformerType const & space_transformer_;
+	std::string image_path_;
+	bool channel_set_;
+	int channel_;
+	bool denoise_;
+	bool use_NN_;
+	bool chunk_size_set_;
+	SizeType chunk_size_;
+	bool use_projection_;
+
+	std::vector< tile > tiles_;
+	SizeType montage_size_;
+	ImageType2DPointer projection_;
+	unsigned int reads_;
+	unsigned int copies_;
+	unsigned int resamples_;
+};
+
+#endif
@@ -14,6 +14,7 @@ limitations under the License.
 =========================================================================*/
 
 #include "fregl_pairwise_register.h"
+#include "fregl_phase_correlation.h"
 #include "fregl_util.h"
 
 #include "itkMeanSquaresImageToImageMetric.h"
@@ -55,6 +56,9 @@ fregl_pairwise_register( InputImageTypePointer from_image,
 	exhaustive_ = false;
 	stack_size_set_ = false;
 	smoothing_ = 0;
+	phase_correlation_ = true;
+	phase_correlation_confidence_ = 0.3;
+	phase_correlation_rotation_ = false;
 }
 
 template < class TPixel >
@@ -68,6 +72,7 @@ fregl_pairwise_register< TPixel >::
 set_from_image( InputImageTypePointer from_image )
 {
 	from_image_ = from_image;
+	from_image_2d_ = NULL;
 	transform_ = NULL;
 }
 
@@ -77,6 +82,7 @@ fregl_pairwise_register< TPixel >::
 set_to_image( InputImageTypePointer to_image )
 {
 	to_image_ = to_image;
+	to_image_2d_ = NULL;
 	transform_ = NULL;
 }
 
@@ -132,6 +138,32 @@ set_smoothing(double variance)
 	smoothing_ = variance;
 }
 
+template < class TPixel >
+void
+fregl_pairwise_register< TPixel >::
+set_phase_correlation(bool use, double min_confidence)
+{
+	phase_correlation_ = use;
+	phase_correlation_confidence_ = min_confidence;
+}
+
+template < class TPixel >
+void
+fregl_pairwise_register< TPixel >::
+set_phase_correlation_rotation(bool estimate)
+{
+	phase_correlation_rotation_ = estimate;
+}
+
+template < class TPixel >
+void
+fregl_pairwise_register< TPixel >::
+set_projections(ImageType2DPointer from_image_2d, ImageType2DPointer to_image_2d)
+{
+	from_image_2d_ = from_image_2d;
+	to_image_2d_ = to_image_2d;
+}
+
 #if defined(VCL_WIN32) && !defined(__CYGWIN__)
 //: replace instances of 'from' in 's' with 'to'
 static unsigned replace(char from, char to, vcl_string &s)
@@ -158,70 +190,29 @@ run(double& obj_value, const vcl_string & gdbicp_exe_path, bool scaling)
 	// where the major motion is. The shift in the z-stack is taken care
 	// of later by the coarse-to-fine refinement in 3D
 
-	ImageType2DPointer from_image_2d = fregl_util< TPixel >::fregl_util_max_projection(from_image_);
-	vcl_cout << "Projecting2 the from_image ....\n";
-	ImageType2DPointer to_image_2d = fregl_util< TPixel >::fregl_util_max_projection(to_image_);
-	vcl_cout << "Projecting2 the to_image ....\n";
-
-	// output max projected images to files and read them back as vxl
-	// images. This might not be a very neat approach, but it is much
-	// easier this way, since rrl_gdbicp_info takes image filenames.
-
-	vcl_string from_2dfilename = from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_") + vcl_string("xxx_")+from_image_filename+vcl_string("_proj.tif");
-	vcl_string to_2dfilename = from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_xxx_")+to_image_filename+vcl_string("_proj.tif");
-
-	typedef itk::ImageFileWriter< typename fregl_util< TPixel >::GDBICPImageType >  WriterType2D;
-	//typedef itk::RescaleIntensityImageFilter< ImageType2D , typename fregl_util< TPixel >::GDBICPImageType > RescaleIntensityImageFilterType2D;
-
-	try {
-		//typename RescaleIntensityImageFilterType2D::Pointer rescaleFilter = RescaleIntensityImageFilterType2D::New();
-		typename WriterType2D::Pointer writer2D = WriterType2D::New();
-		//rescaleFilter->SetInput( from_image_2d );
-		writer2D->SetFileName( from_2dfilename );
-		//writer2D->SetInput( rescaleFilter->GetOutput() );
-		writer2D->SetInput( from_image_2d );
-		writer2D->Update();
-
-		writer2D->SetFileName( to_2dfilename );
-		//rescaleFilter->SetInput( to_image_2d );
-		writer2D->SetInput( to_image_2d );
-		writer2D->Update();
+	ImageType2DPointer from_image_2d = from_image_2d_;
+	if (!from_image_2d) {
+		from_image_2d = fregl_util< TPixel >::fregl_util_max_projection(from_image_);
+		vcl_cout << "Projecting2 the from_image ....\n";
 	}
-	catch(itk::ExceptionObject& e) {
-		vcl_cout << e << vcl_endl;
-		return 1;
+	ImageType2DPointer to_image_2d = to_image_2d_;
+	if (!to_image_2d) {
+		to_image_2d = fregl_util< TPixel >::fregl_util_max_projection(to_image_);
+		vcl_cout << "Projecting2 the to_image ....\n";
 	}
 
-	try {
-		vcl_string path = gdbicp_exe_path;
-
-#if defined(VCL_WIN32) && !defined(__CYGWIN__)
-		replace('/', '\\', path);
-		vcl_string exe_command = path+vcl_string("gdbicp.exe ")+from_2dfilename+vcl_string(" ")+to_2dfilename+vcl_string(" -model 0 -no_render -complete");
-#else
-		vcl_string exe_command = path+vcl_string("gdbicp ")+from_2dfilename+vcl_string(" ")+to_2dfilename+vcl_string(" -model 0 -no_render -complete");
-#endif
-		// The xform file generated is
-		// mosaic_xxx_from_image_proj_to_xxx_to_image_proj.xform
-		vcl_cout<<"Run: "<<exe_command<<vcl_endl;
-		int status = 2;
-		status = vcl_system(exe_command.c_str());
-
-		if ( status > 1 ) {
-			vcl_cout << "Registration failed in 2D. Please try a different channel with more intensity variation." << vcl_endl;
-			return false;
-		}
-
-		// Read in the file
-		// mosaic_xxx_from_image_proj_to_xxx_to_image_proj.xform back to
-		// memoyr
-		vcl_string xform_string = vcl_string("mosaic_") + from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_xxx_") + from_image_filename + vcl_string("_proj_to_") + from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_xxx_") + to_image_filename + vcl_string("_proj.xform");
-		std::cout << from_image_filename << std::endl;
-		std::cout << to_image_filename << std::endl;
-		std::cout << "Reading in xform file: " << xform_string << std::endl;
-		vcl_ifstream reg_info(xform_string.c_str());
-		rgrl_transformation_sptr xform_2d = read_2d_xform( reg_info );
+	// Estimate the 2D transformation in process by phase correlation.
+	// gdbicp is only run on the projections when that estimate is not
+	// confident.
+	rgrl_transformation_sptr xform_2d;
+	if (phase_correlation_)
+		xform_2d = phase_correlation_2d_xform(from_image_2d, to_image_2d, scaling);
+	if (!xform_2d)
+		xform_2d = gdbicp_2d_xform(from_image_2d, to_image_2d, gdbicp_exe_path);
+	if (!xform_2d)
+		return false;
 
+	try {
 		if ( !valid_2d_xform(xform_2d, scaling) ) {
 			vcl_cout << "Invalid 2D xform. Please try a different channel with more intensity variation." << vcl_endl;
 			return false;
@@ -334,10 +325,16 @@ run(double init_x, double init_y, double& obj_value)
 	// where the major motion is. The shift in the z-stack is taken care
 	// of later by the coarse-to-fine refinement in 3D
 
-	ImageType2DPointer from_image_2d = fregl_util< TPixel >::fregl_util_max_projection(from_image_);
-	vcl_cout << "Projecting3 the from_image ....\n";
-	ImageType2DPointer to_image_2d = fregl_util< TPixel >::fregl_util_max_projection(to_image_);
-	vcl_cout << "Projecting3 the to_image ....\n";
+	ImageType2DPointer from_image_2d = from_image_2d_;
+	if (!from_image_2d) {
+		from_image_2d = fregl_util< TPixel >::fregl_util_max_projection(from_image_);
+		vcl_cout << "Projecting3 the from_image ....\n";
+	}
+	ImageType2DPointer to_image_2d = to_image_2d_;
+	if (!to_image_2d) {
+		to_image_2d = fregl_util< TPixel >::fregl_util_max_projection(to_image_);
+		vcl_cout << "Projecting3 the to_image ....\n";
+	}
 
 	// output max projected images to files and read them back as vxl
 	// images. This might not be a very neat approach, but it is much
@@ -593,6 +590,128 @@ run(TransformType::Pointer prior_xform, double& obj_value)
 
 /************** Private Functions ************************************/
 
+// Estimate the 2D xform from the max projections by phase
+// correlation. Returns 0 if the estimate is not confident or not a
+// valid 2D xform.
+template < class TPixel >
+rgrl_transformation_sptr
+fregl_pairwise_register< TPixel >::
+phase_correlation_2d_xform( ImageType2DPointer from_image_2d, ImageType2DPointer to_image_2d, bool scaling )
+{
+	typedef itk::ImageRegionConstIterator< ImageType2D > ConstIterator2DType;
+
+	typename ImageType2D::RegionType from_region = from_image_2d->GetLargestPossibleRegion();
+	typename ImageType2D::RegionType to_region = to_image_2d->GetLargestPossibleRegion();
+	std::vector<float> from_pixels, to_pixels;
+	from_pixels.reserve( from_region.GetNumberOfPixels() );
+	to_pixels.reserve( to_region.GetNumberOfPixels() );
+	ConstIterator2DType fromIt( from_image_2d, from_region );
+	for ( fromIt.GoToBegin(); !fromIt.IsAtEnd(); ++fromIt )
+		from_pixels.push_back( fromIt.Get() );
+	ConstIterator2DType toIt( to_image_2d, to_region );
+	for ( toIt.GoToBegin(); !toIt.IsAtEnd(); ++toIt )
+		to_pixels.push_back( toIt.Get() );
+
+	fregl_phase_correlation initializer;
+	initializer.set_rotation_scale( scaling || phase_correlation_rotation_ );
+	initializer.set_min_confidence( phase_correlation_confidence_ );
+	bool confident = initializer.estimate( &from_pixels[0], from_region.GetSize()[0], from_region.GetSize()[1],
+		&to_pixels[0], to_region.GetSize()[0], to_region.GetSize()[1] );
+	vcl_cout << "Phase correlation: t = (" << initializer.tx() << ", " << initializer.ty()
+		<< "), rotation = " << initializer.rotation() << ", scale = " << initializer.scale()
+		<< ", confidence = " << initializer.confidence() << vcl_endl;
+	if ( !confident ) {
+		vcl_cout << "Phase correlation is not confident, running gdbicp." << vcl_endl;
+		return 0;
+	}
+
+	vnl_matrix<double> A(2,2);
+	vnl_vector<double> t(2);
+	for (int r = 0; r<2; r++)
+		for (int c = 0; c<2; c++)
+			A(r,c) = initializer.A(r,c);
+	t(0) = initializer.tx();
+	t(1) = initializer.ty();
+	rgrl_transformation_sptr xform_2d = new rgrl_trans_affine(A, t, vnl_matrix<double>(6,6,0.0));
+	if ( !valid_2d_xform(xform_2d, scaling) ) {
+		vcl_cout << "Phase correlation gave an invalid 2D xform, running gdbicp." << vcl_endl;
+		return 0;
+	}
+	return xform_2d;
+}
+
+// Run gdbicp on the max projections written to disk and read back the
+// 2D xform it dumps. Returns 0 on failure.
+template < class TPixel >
+rgrl_transformation_sptr
+fregl_pairwise_register< TPixel >::
+gdbicp_2d_xform( ImageType2DPointer from_image_2d, ImageType2DPointer to_image_2d, const vcl_string & gdbicp_exe_path )
+{
+	// output max projected images to files and read them back as vxl
+	// images. This might not be a very neat approach, but it is much
+	// easier this way, since rrl_gdbicp_info takes image filenames.
+
+	vcl_string from_2dfilename = from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_") + vcl_string("xxx_")+from_image_filename+vcl_string("_proj.tif");
+	vcl_string to_2dfilename = from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_xxx_")+to_image_filename+vcl_string("_proj.tif");
+
+	typedef itk::ImageFileWriter< typename fregl_util< TPixel >::GDBICPImageType >  WriterType2D;
+	//typedef itk::RescaleIntensityImageFilter< ImageType2D , typename fregl_util< TPixel >::GDBICPImageType > RescaleIntensityImageFilterType2D;
+
+	try {
+		//typename RescaleIntensityImageFilterType2D::Pointer rescaleFilter = RescaleIntensityImageFilterType2D::New();
+		typename WriterType2D::Pointer writer2D = WriterType2D::New();
+		//rescaleFilter->SetInput( from_image_2d );
+		writer2D->SetFileName( from_2dfilename );
+		//writer2D->SetInput( rescaleFilter->GetOutput() );
+		writer2D->SetInput( from_image_2d );
+		writer2D->Update();
+
+		writer2D->SetFileName( to_2dfilename );
+		//rescaleFilter->SetInput( to_image_2d );
+		writer2D->SetInput( to_image_2d );
+		writer2D->Update();
+	}
+	catch(itk::ExceptionObject& e) {
+		vcl_cout << e << vcl_endl;
+		return 0;
+	}
+
+	try {
+		vcl_string path = gdbicp_exe_path;
+
+#if defined(VCL_WIN32) && !defined(__CYGWIN__)
+		replace('/', '\\', path);
+		vcl_string exe_command = path+vcl_string("gdbicp.exe ")+from_2dfilename+vcl_string(" ")+to_2dfilename+vcl_string(" -model 0 -no_render -complete");
+#else
+		vcl_string exe_command = path+vcl_string("gdbicp ")+from_2dfilename+vcl_string(" ")+to_2dfilename+vcl_string(" -model 0 -no_render -complete");
+#endif
+		// The xform file generated is
+		// mosaic_xxx_from_image_proj_to_xxx_to_image_proj.xform
+		vcl_cout<<"Run: "<<exe_command<<vcl_endl;
+		int status = 2;
+		status = vcl_system(exe_command.c_str());
+
+		if ( status > 1 ) {
+			vcl_cout << "Registration failed in 2D. Please try a different channel with more intensity variation." << vcl_endl;
+			return 0;
+		}
+
+		// Read in the file
+		// mosaic_xxx_from_image_proj_to_xxx_to_image_proj.xform back to
+		// memoyr
+		vcl_string xform_string = vcl_string("mosaic_") + from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_xxx_") + from_image_filename + vcl_string("_proj_to_") + from_image_filename + vcl_string("_to_") + to_image_filename + vcl_string("_xxx_") + to_image_filename + vcl_string("_proj.xform");
+		std::cout << from_image_filename << std::endl;
+		std::cout << to_image_filename << std::endl;
+		std::cout << "Reading in xform file: " << xform_string << std::endl;
+		vcl_ifstream reg_info(xform_string.c_str());
+		return read_2d_xform( reg_info );
+	}
+	catch(itk::ExceptionObject& e) {
+		vcl_cout << e << vcl_endl;
+	}
+	return 0;
+}
+
 // Compute the z shift, and set the region of interest to the overlap
 template < class TPixel >
 double
@@ -116,8 +116,36 @@ public:
 	//: Set the variance for smoothing
 	void set_smoothing(double variance);
 
+	//: Use the in-process phase correlation initializer (on by default)
+	//
+	//  The x-y transformation is estimated by phase correlation of the
+	//  max projections, gdbicp is only run when the NCC of the overlap
+	//  it finds is below min_confidence.
+	void set_phase_correlation(bool use, double min_confidence = 0.3);
+
+	//: Also estimate rotation and scale in the initializer
+	//
+	//  Always done when run() is told to expect scaling.
+	void set_phase_correlation_rotation(bool estimate);
+
+	//: Use precomputed max projections of the from and to images
+	//
+	//  The projections are not computed again in run(). They are reset
+	//  when either image is replaced.
+	void set_projections(ImageType2DPointer from_image_2d, ImageType2DPointer to_image_2d);
+
 private: 
 
+	//: Estimate the 2D xform of the projections by phase correlation
+	//
+	//  Returns 0 if the estimate is not confident.
+	rgrl_transformation_sptr phase_correlation_2d_xform( ImageType2DPointer from_image_2d, 
+		ImageType2DPointer to_image_2d, bool scaling );
+
+	//: Estimate the 2D xform of the projections with the gdbicp executable
+	rgrl_transformation_sptr gdbicp_2d_xform( ImageType2DPointer from_image_2d, 
+		ImageType2DPointer to_image_2d, const vcl_string & gdbicp_exe_path );
+
 	//: Compute the z shift 
 	//
 	//  This function also set the region of interest to the overlap
@@ -157,12 +185,17 @@ private:
 	std::string to_image_filename;
 	InputImageTypePointer from_image_; 
 	InputImageTypePointer to_image_;
+	ImageType2DPointer from_image_2d_;
+	ImageType2DPointer to_image_2d_;
 	TransformType::Pointer  transform_;
 	float background_;    //threshold value to be considered as background
 	bool exhaustive_;
 	bool stack_size_set_;
 	int stack_size_;
 	double smoothing_;
+	bool phase_correlation_;
+	double phase_correlation_confidence_;
+	bool phase_correlation_rotation_;
 };
 
 #endif
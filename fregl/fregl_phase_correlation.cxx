@@ -0,0 +1,508 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#include "fregl_phase_correlation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+
+typedef std::complex<double> complex_type;
+
+const double pi = 3.14159265358979323846;
+
+int next_power_of_2(int n)
+{
+	int p = 1;
+	while (p < n) p <<= 1;
+	return p;
+}
+
+//: Radix-2 FFT of one size. The tables are read-only after
+//  construction, so one plan is shared by all threads.
+class fft_plan
+{
+public:
+	fft_plan(int n) : n_(n), twiddle_(n/2), reverse_(n)
+	{
+		for (int i = 0; i < n/2; ++i)
+			twiddle_[i] = std::polar(1.0, -2*pi*i/n);
+		int bits = 0;
+		while ((1<<bits) < n) ++bits;
+		for (int i = 0; i < n; ++i) {
+			int r = 0;
+			for (int b = 0; b < bits; ++b)
+				if (i & (1<<b)) r |= 1<<(bits-1-b);
+			reverse_[i] = r;
+		}
+	}
+
+	//: In-place transform of n contiguous values
+	void transform(complex_type* data, bool inverse) const
+	{
+		for (int i = 0; i < n_; ++i)
+			if (i < reverse_[i]) std::swap(data[i], data[reverse_[i]]);
+		for (int len = 2; len <= n_; len <<= 1) {
+			int step = n_/len;
+			for (int i = 0; i < n_; i += len) {
+				for (int j = 0; j < len/2; ++j) {
+					complex_type w = inverse ? std::conj(twiddle_[j*step]) : twiddle_[j*step];
+					complex_type u = data[i+j];
+					complex_type v = data[i+j+len/2] * w;
+					data[i+j] = u + v;
+					data[i+j+len/2] = u - v;
+				}
+			}
+		}
+	}
+
+private:
+	int n_;
+	std::vector<complex_type> twiddle_;
+	std::vector<int> reverse_;
+};
+
+//: 2D FFT of a nx by ny row-major array, rows and columns in parallel
+void fft_2d(std::vector<complex_type>& data, int nx, int ny, bool inverse)
+{
+	fft_plan plan_x(nx), plan_y(ny);
+
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < ny; ++y)
+		plan_x.transform(&data[(size_t)y*nx], inverse);
+
+#ifdef _OPENMP
+	#pragma omp parallel
+#endif
+	{
+		std::vector<complex_type> column(ny);
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for (int x = 0; x < nx; ++x) {
+			for (int y = 0; y < ny; ++y) column[y] = data[(size_t)y*nx+x];
+			plan_y.transform(&column[0], inverse);
+			for (int y = 0; y < ny; ++y) data[(size_t)y*nx+x] = column[y];
+		}
+	}
+
+	if (inverse) {
+		double norm = 1.0/((double)nx*ny);
+		for (size_t i = 0; i < data.size(); ++i) data[i] *= norm;
+	}
+}
+
+//: Box average by an integer factor
+void downsample(const float* in, int w, int h, int factor, std::vector<float>& out, int& ow, int& oh)
+{
+	ow = w/factor;
+	oh = h/factor;
+	if (ow < 1) ow = 1;
+	if (oh < 1) oh = 1;
+	out.assign((size_t)ow*oh, 0.0f);
+	float norm = 1.0f/(factor*factor);
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < oh; ++y) {
+		for (int x = 0; x < ow; ++x) {
+			float sum = 0;
+			for (int j = 0; j < factor && y*factor+j < h; ++j)
+				for (int i = 0; i < factor && x*factor+i < w; ++i)
+					sum += in[(size_t)(y*factor+j)*w + x*factor+i];
+			out[(size_t)y*ow+x] = sum*norm;
+		}
+	}
+}
+
+double mean_of(const std::vector<float>& image)
+{
+	double sum = 0;
+	for (size_t i = 0; i < image.size(); ++i) sum += image[i];
+	return image.empty() ? 0 : sum/image.size();
+}
+
+//: Copy an image, mean subtracted and optionally Hann windowed, into a zero padded nx by ny array
+void embed(const std::vector<float>& image, int w, int h, int nx, int ny, bool window, std::vector<complex_type>& out)
+{
+	out.assign((size_t)nx*ny, complex_type(0,0));
+	double mean = mean_of(image);
+	for (int y = 0; y < h; ++y) {
+		double wy = window ? 0.5-0.5*std::cos(2*pi*(y+0.5)/h) : 1.0;
+		for (int x = 0; x < w; ++x) {
+			double wx = window ? 0.5-0.5*std::cos(2*pi*(x+0.5)/w) : 1.0;
+			out[(size_t)y*nx+x] = (image[(size_t)y*w+x]-mean)*wx*wy;
+		}
+	}
+}
+
+//: Phase correlation surface of two nx by ny spectra. The peak is at t for b(x) = a(x-t).
+void correlation_surface(const std::vector<complex_type>& fa, const std::vector<complex_type>& fb,
+	int nx, int ny, std::vector<double>& surface)
+{
+	std::vector<complex_type> cross(fa.size());
+	for (size_t i = 0; i < fa.size(); ++i) {
+		complex_type c = fb[i]*std::conj(fa[i]);
+		double mag = std::abs(c);
+		cross[i] = mag > 1e-12 ? c/mag : complex_type(0,0);
+	}
+	fft_2d(cross, nx, ny, true);
+	surface.resize(cross.size());
+	for (size_t i = 0; i < cross.size(); ++i) surface[i] = cross[i].real();
+}
+
+struct peak_type
+{
+	int x, y;
+	double value;
+	bool operator<(const peak_type& other) const { return value > other.value; }
+};
+
+//: The strongest local maxima, at least radius apart (with wrap-around)
+void find_peaks(const std::vector<double>& surface, int nx, int ny, int count, int radius, std::vector<peak_type>& peaks)
+{
+	peaks.clear();
+	std::vector<peak_type> all;
+	for (int y = 0; y < ny; ++y) {
+		for (int x = 0; x < nx; ++x) {
+			double v = surface[(size_t)y*nx+x];
+			bool is_max = true;
+			for (int j = -1; j <= 1 && is_max; ++j)
+				for (int i = -1; i <= 1 && is_max; ++i)
+					if ((i || j) && surface[(size_t)((y+j+ny)%ny)*nx + (x+i+nx)%nx] > v) is_max = false;
+			if (is_max) {
+				peak_type p = { x, y, v };
+				all.push_back(p);
+			}
+		}
+	}
+	std::sort(all.begin(), all.end());
+	for (size_t k = 0; k < all.size() && (int)peaks.size() < count; ++k) {
+		bool close = false;
+		for (size_t m = 0; m < peaks.size() && !close; ++m) {
+			int dx = std::abs(all[k].x-peaks[m].x), dy = std::abs(all[k].y-peaks[m].y);
+			dx = std::min(dx, nx-dx);
+			dy = std::min(dy, ny-dy);
+			close = dx <= radius && dy <= radius;
+		}
+		if (!close) peaks.push_back(all[k]);
+	}
+}
+
+//: Sub-pixel offset of a peak from a parabola through it and its neighbors
+double parabola_offset(double left, double center, double right)
+{
+	double denom = left - 2*center + right;
+	if (std::fabs(denom) < 1e-12) return 0;
+	double offset = 0.5*(left-right)/denom;
+	return std::max(-0.5, std::min(0.5, offset));
+}
+
+//: Normalized cross correlation of the overlap of from and to, to(x) = from(x-t)
+double overlap_ncc(const std::vector<float>& from, int fw, int fh,
+	const std::vector<float>& to, int tw, int th, int dx, int dy, double min_pixels)
+{
+	int x0 = std::max(0, -dx), x1 = std::min(fw, tw-dx);
+	int y0 = std::max(0, -dy), y1 = std::min(fh, th-dy);
+	if (x1 <= x0 || y1 <= y0 || (double)(x1-x0)*(y1-y0) < min_pixels) return -1;
+
+	double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:sa,sb,saa,sbb,sab)
+#endif
+	for (int y = y0; y < y1; ++y) {
+		const float* a = &from[(size_t)y*fw];
+		const float* b = &to[(size_t)(y+dy)*tw];
+		for (int x = x0; x < x1; ++x) {
+			double va = a[x], vb = b[x+dx];
+			sa += va; sb += vb;
+			saa += va*va; sbb += vb*vb; sab += va*vb;
+		}
+	}
+	double n = (double)(x1-x0)*(y1-y0);
+	double cov = sab - sa*sb/n;
+	double var = (saa - sa*sa/n)*(sbb - sb*sb/n);
+	if (var <= 1e-12) return -1;
+	return cov/std::sqrt(var);
+}
+
+//: Resample from under to(x) = from(c + (R^-1 (x-c))/scale), rotation angle about the image center
+void rotate_scale(const std::vector<float>& in, int w, int h, double angle, double scale, std::vector<float>& out)
+{
+	out.resize(in.size());
+	float fill = (float)mean_of(in);
+	double cx = 0.5*(w-1), cy = 0.5*(h-1);
+	double c = std::cos(angle)/scale, s = std::sin(angle)/scale;
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			double u = cx + c*(x-cx) + s*(y-cy);
+			double v = cy - s*(x-cx) + c*(y-cy);
+			int iu = (int)std::floor(u), iv = (int)std::floor(v);
+			float value = fill;
+			if (iu >= 0 && iv >= 0 && iu+1 < w && iv+1 < h) {
+				double fu = u-iu, fv = v-iv;
+				const float* p = &in[(size_t)iv*w+iu];
+				value = (float)((1-fv)*((1-fu)*p[0] + fu*p[1]) + fv*((1-fu)*p[w] + fu*p[w+1]));
+			}
+			out[(size_t)y*w+x] = value;
+		}
+	}
+}
+
+//: High-pass filtered, centered magnitude spectrum of an image padded to n by n
+void magnitude_spectrum(const std::vector<float>& image, int w, int h, int n, std::vector<double>& magnitude)
+{
+	std::vector<complex_type> spectrum;
+	embed(image, w, h, n, n, true, spectrum);
+	fft_2d(spectrum, n, n, false);
+	magnitude.assign((size_t)n*n, 0.0);
+	for (int v = 0; v < n; ++v) {
+		for (int u = 0; u < n; ++u) {
+			int su = (u+n/2)%n, sv = (v+n/2)%n;
+			double X = std::cos(pi*(su-n/2)/n)*std::cos(pi*(sv-n/2)/n);
+			double filter = (1-X)*(2-X);
+			magnitude[(size_t)sv*n+su] = std::abs(spectrum[(size_t)v*n+u])*filter;
+		}
+	}
+}
+
+//: Log-polar resampling of a centered n by n spectrum, angles over [0,pi)
+void log_polar(const std::vector<double>& magnitude, int n, int num_radii, int num_angles, double log_base,
+	std::vector<float>& out)
+{
+	out.assign((size_t)num_radii*num_angles, 0.0f);
+	double c = n/2;
+	for (int a = 0; a < num_angles; ++a) {
+		double theta = pi*a/num_angles;
+		double ct = std::cos(theta), st = std::sin(theta);
+		for (int r = 0; r < num_radii; ++r) {
+			double radius = std::exp(r*log_base);
+			double u = c + radius*ct, v = c + radius*st;
+			int iu = (int)std::floor(u), iv = (int)std::floor(v);
+			if (iu < 0 || iv < 0 || iu+1 >= n || iv+1 >= n) continue;
+			double fu = u-iu, fv = v-iv;
+			const double* p = &magnitude[(size_t)iv*n+iu];
+			out[(size_t)a*num_radii+r] = (float)((1-fv)*((1-fu)*p[0] + fu*p[1]) + fv*((1-fu)*p[n] + fu*p[n+1]));
+		}
+	}
+}
+
+}  // namespace
+
+fregl_phase_correlation::
+fregl_phase_correlation()
+{
+	max_size_ = 512;
+	rotation_scale_ = false;
+	min_confidence_ = 0.3;
+	min_overlap_ = 0.05;
+	A_[0][0] = 1; A_[0][1] = 0;
+	A_[1][0] = 0; A_[1][1] = 1;
+	tx_ = ty_ = 0;
+	rotation_ = 0;
+	scale_ = 1;
+	confidence_ = -1;
+}
+
+void
+fregl_phase_correlation::
+set_max_size(int max_size)
+{
+	max_size_ = max_size > 16 ? max_size : 16;
+}
+
+void
+fregl_phase_correlation::
+set_rotation_scale(bool estimate)
+{
+	rotation_scale_ = estimate;
+}
+
+void
+fregl_phase_correlation::
+set_min_confidence(double confidence)
+{
+	min_confidence_ = confidence;
+}
+
+void
+fregl_phase_correlation::
+set_min_overlap(double fraction)
+{
+	min_overlap_ = fraction;
+}
+
+double
+fregl_phase_correlation::
+estimate_shift(const image_type& from, int fw, int fh,
+	const image_type& to, int tw, int th, double& dx, double& dy) const
+{
+	// Padding to the larger image aliases shifts by the array size,
+	// the candidates below try both aliases of every peak.
+	int nx = next_power_of_2(std::max(fw, tw));
+	int ny = next_power_of_2(std::max(fh, th));
+
+	std::vector<complex_type> fa, fb;
+	embed(from, fw, fh, nx, ny, false, fa);
+	embed(to, tw, th, nx, ny, false, fb);
+	fft_2d(fa, nx, ny, false);
+	fft_2d(fb, nx, ny, false);
+	std::vector<double> surface;
+	correlation_surface(fa, fb, nx, ny, surface);
+
+	std::vector<peak_type> peaks;
+	find_peaks(surface, nx, ny, 4, 3, peaks);
+
+	double min_pixels = min_overlap_ * std::min((double)fw*fh, (double)tw*th);
+	double best = -1;
+	int best_peak = -1, best_x = 0, best_y = 0;
+	for (size_t k = 0; k < peaks.size(); ++k) {
+		for (int ax = 0; ax < 2; ++ax) {
+			for (int ay = 0; ay < 2; ++ay) {
+				int sx = peaks[k].x - ax*nx;
+				int sy = peaks[k].y - ay*ny;
+				double ncc = overlap_ncc(from, fw, fh, to, tw, th, sx, sy, min_pixels);
+				if (ncc > best) {
+					best = ncc;
+					best_peak = (int)k;
+					best_x = sx;
+					best_y = sy;
+				}
+			}
+		}
+	}
+	if (best_peak < 0) {
+		dx = dy = 0;
+		return -1;
+	}
+
+	int px = peaks[best_peak].x, py = peaks[best_peak].y;
+	double center = surface[(size_t)py*nx+px];
+	dx = best_x + parabola_offset(surface[(size_t)py*nx+(px-1+nx)%nx], center, surface[(size_t)py*nx+(px+1)%nx]);
+	dy = best_y + parabola_offset(surface[(size_t)((py-1+ny)%ny)*nx+px], center, surface[(size_t)((py+1)%ny)*nx+px]);
+	return best;
+}
+
+void
+fregl_phase_correlation::
+estimate_rotation_scale(const image_type& from, int fw, int fh,
+	const image_type& to, int tw, int th, double& angle, double& scale) const
+{
+	int n = next_power_of_2(std::max(std::max(fw, fh), std::max(tw, th)));
+	int num_radii = n/2, num_angles = n/2;
+	double log_base = std::log(n/2.0 - 1)/num_radii;
+
+	std::vector<double> magnitude;
+	std::vector<float> lp_from, lp_to;
+	magnitude_spectrum(from, fw, fh, n, magnitude);
+	log_polar(magnitude, n, num_radii, num_angles, log_base, lp_from);
+	magnitude_spectrum(to, tw, th, n, magnitude);
+	log_polar(magnitude, n, num_radii, num_angles, log_base, lp_to);
+
+	// Rows are angles and columns log radii. A rotation of the image
+	// by angle shifts the rows by +angle, a scale shifts the columns
+	// by -log(scale).
+	std::vector<complex_type> fa, fb;
+	embed(lp_from, num_radii, num_angles, num_radii, num_angles, false, fa);
+	embed(lp_to, num_radii, num_angles, num_radii, num_angles, false, fb);
+	fft_2d(fa, num_radii, num_angles, false);
+	fft_2d(fb, num_radii, num_angles, false);
+	std::vector<double> surface;
+	correlation_surface(fa, fb, num_radii, num_angles, surface);
+
+	std::vector<peak_type> peaks;
+	find_peaks(surface, num_radii, num_angles, 1, 1, peaks);
+	int px = peaks[0].x, py = peaks[0].y;
+	double center = surface[(size_t)py*num_radii+px];
+	double dr = px + parabola_offset(surface[(size_t)py*num_radii+(px-1+num_radii)%num_radii], center,
+		surface[(size_t)py*num_radii+(px+1)%num_radii]);
+	double da = py + parabola_offset(surface[(size_t)((py-1+num_angles)%num_angles)*num_radii+px], center,
+		surface[(size_t)((py+1)%num_angles)*num_radii+px]);
+	if (dr >= num_radii/2) dr -= num_radii;
+	if (da >= num_angles/2) da -= num_angles;
+
+	angle = pi*da/num_angles;
+	scale = std::exp(-dr*log_base);
+}
+
+bool
+fregl_phase_correlation::
+estimate(const float* from_image, int from_width, int from_height,
+	const float* to_image, int to_width, int to_height)
+{
+	int largest = std::max(std::max(from_width, from_height), std::max(to_width, to_height));
+	int factor = (largest + max_size_ - 1)/max_size_;
+	if (factor < 1) factor = 1;
+
+	image_type from, to;
+	int fw, fh, tw, th;
+	downsample(from_image, from_width, from_height, factor, from, fw, fh);
+	downsample(to_image, to_width, to_height, factor, to, tw, th);
+
+	double dx = 0, dy = 0;
+	rotation_ = 0;
+	scale_ = 1;
+	if (!rotation_scale_) {
+		confidence_ = estimate_shift(from, fw, fh, to, tw, th, dx, dy);
+	}
+	else {
+		// The magnitude spectrum can't tell angle from angle+pi, so
+		// the shift is estimated for both. The spectra of tiles that
+		// overlap little are dominated by the rest of the tiles, so no
+		// rotation at all is tried as well.
+		double angle, scale;
+		estimate_rotation_scale(from, fw, fh, to, tw, th, angle, scale);
+		confidence_ = -2;
+		for (int k = 0; k < 3; ++k) {
+			double a = k < 2 ? angle + k*pi : 0;
+			double sc = k < 2 ? scale : 1;
+			image_type warped;
+			rotate_scale(from, fw, fh, a, sc, warped);
+			double sx, sy;
+			double ncc = estimate_shift(warped, fw, fh, to, tw, th, sx, sy);
+			if (ncc > confidence_) {
+				confidence_ = ncc;
+				rotation_ = a > pi ? a - 2*pi : a;
+				scale_ = sc;
+				dx = sx;
+				dy = sy;
+			}
+		}
+	}
+
+	// The warp is about the center of the downsampled from image and
+	// pixel x of a downsampled image covers x*factor+(factor-1)/2.
+	double c = std::cos(rotation_)*scale_, s = std::sin(rotation_)*scale_;
+	A_[0][0] = c;  A_[0][1] = -s;
+	A_[1][0] = s;  A_[1][1] = c;
+	double half = 0.5*(factor-1);
+	double cx = factor*0.5*(fw-1) + half, cy = factor*0.5*(fh-1) + half;
+	tx_ = cx - (A_[0][0]*cx + A_[0][1]*cy) + factor*dx;
+	ty_ = cy - (A_[1][0]*cx + A_[1][1]*cy) + factor*dy;
+
+	return confidence_ >= min_confidence_;
+}
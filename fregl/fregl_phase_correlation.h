@@ -0,0 +1,90 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+//: In-process initializer for the 2D pairwise registration
+//
+//  Estimates the x-y transformation between the max projections of
+//  two tiles by phase correlation, as a replacement for running
+//  gdbicp on them. The projections are downsampled so the larger side
+//  is at most max_size pixels, and the FFTs are multithreaded with
+//  OpenMP. The strongest correlation peaks (and their wrap-around
+//  aliases) are verified by the normalized cross correlation of the
+//  overlap they imply, which is also the confidence of the estimate.
+//
+//  Optionally the rotation and scale are estimated first by phase
+//  correlation of the log-polar resampled magnitude spectra.
+
+#ifndef _fregl_phase_correlation_h_
+#define _fregl_phase_correlation_h_
+
+#include <vector>
+
+class fregl_phase_correlation
+{
+public:
+	//: constructor
+	fregl_phase_correlation();
+
+	//: Downsample the images so that the larger side is at most max_size pixels
+	void set_max_size(int max_size);
+
+	//: Also estimate rotation and scale
+	void set_rotation_scale(bool estimate);
+
+	//: Minimum confidence (NCC of the overlap, in [-1,1]) to accept the estimate
+	void set_min_confidence(double confidence);
+
+	//: Minimum overlap, as a fraction of the smaller image, of a valid shift
+	void set_min_overlap(double fraction);
+
+	//: Estimate the transformation from from_image to to_image
+	//
+	//  The images are row major. Returns true if confidence() is at
+	//  least the minimum confidence.
+	bool estimate(const float* from_image, int from_width, int from_height,
+		const float* to_image, int to_width, int to_height);
+
+	//: The estimated transformation, to = A*from + t in pixels (x first)
+	double A(int r, int c) const { return A_[r][c]; }
+	double tx() const { return tx_; }
+	double ty() const { return ty_; }
+
+	double rotation() const { return rotation_; }
+	double scale() const { return scale_; }
+	double confidence() const { return confidence_; }
+
+private:
+	typedef std::vector<float> image_type;
+
+	//: Estimate the shift of the (downsampled) images, to(x) = from(x-t)
+	double estimate_shift(const image_type& from, int fw, int fh,
+		const image_type& to, int tw, int th, double& dx, double& dy) const;
+
+	//: Estimate rotation and scale from the magnitude spectra
+	void estimate_rotation_scale(const image_type& from, int fw, int fh,
+		const image_type& to, int tw, int th, double& angle, double& scale) const;
+
+	int max_size_;
+	bool rotation_scale_;
+	double min_confidence_;
+	double min_overlap_;
+
+	double A_[2][2];
+	double tx_, ty_;
+	double rotation_, scale_;
+	double confidence_;
+};
+
+#endif
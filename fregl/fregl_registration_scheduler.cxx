@@ -0,0 +1,504 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#include "fregl_registration_scheduler.h"
+#include "fregl_pairwise_register.h"
+
+#include "itkImageIOFactory.h"
+
+#include <vul/vul_file.h>
+#include <vul/vul_timer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+
+//: Orders tile indices by their stage x position
+struct x_order
+{
+	const std::vector<double>* x;
+	bool operator()(int a, int b) const { return (*x)[a] < (*x)[b]; }
+};
+
+//: Orders pairs by the row-major rank of their later tile, then the earlier one
+struct schedule_order
+{
+	const std::vector<int>* rank;
+	int later(int a, int b) const { return std::max((*rank)[a], (*rank)[b]); }
+	int earlier(int a, int b) const { return std::min((*rank)[a], (*rank)[b]); }
+	template < class TPair >
+	bool operator()(TPair const & p, TPair const & q) const
+	{
+		int lp = later(p.from_tile, p.to_tile), lq = later(q.from_tile, q.to_tile);
+		if (lp != lq) return lp < lq;
+		return earlier(p.from_tile, p.to_tile) < earlier(q.from_tile, q.to_tile);
+	}
+};
+
+//: Orders tile indices by row, then x
+struct row_major_order
+{
+	const std::vector<int>* row;
+	const std::vector<double>* x;
+	bool operator()(int a, int b) const
+	{
+		if ((*row)[a] != (*row)[b]) return (*row)[a] < (*row)[b];
+		return (*x)[a] < (*x)[b];
+	}
+};
+
+//: Length of the overlap of [a0, a0+la) and [b0, b0+lb)
+double overlap_1d(double a0, double la, double b0, double lb)
+{
+	return std::min(a0+la, b0+lb) - std::max(a0, b0);
+}
+
+}  // namespace
+
+template < class TPixel >
+fregl_registration_scheduler< TPixel >::
+fregl_registration_scheduler()
+: stage_scale_(1), min_overlap_(0.05),
+  channel_set_(false), channel_(0), background_(30), smoothing_(0),
+  stack_size_(0), scaling_(false), cache_size_(0), clock_(0), reads_(0), done_(0)
+{
+}
+
+template < class TPixel >
+fregl_registration_scheduler< TPixel >::
+~fregl_registration_scheduler()
+{
+	typename std::map< int, cache_entry* >::iterator it;
+	for (it = cache_.begin(); it != cache_.end(); ++it)
+		delete it->second;
+}
+
+template < class TPixel >
+bool
+fregl_registration_scheduler< TPixel >::
+read_tile_list(std::string const & filename)
+{
+	std::ifstream in_file( filename.c_str() );
+	if ( !in_file ) {
+		std::cerr<<"Couldn't open "<<filename<<std::endl;
+		return false;
+	}
+
+	std::string line;
+	while ( std::getline(in_file, line) ) {
+		if (line.empty() || line[0] == '#') continue;
+
+		std::istringstream line_str( line );
+		std::string file_name;
+		double x, y, z = 0;
+		if ( !(line_str >> file_name >> x >> y) ) {
+			std::cerr<<"Skipped the line without a stage position: "<<line<<std::endl;
+			continue;
+		}
+		line_str >> z;
+		add_tile(file_name, x, y, z);
+	}
+	return true;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+add_tile(std::string const & file_name, double x, double y, double z)
+{
+	tile t;
+	t.file_name = file_name;
+	t.image_id = vul_file::strip_directory( file_name );
+	t.x = x*stage_scale_;
+	t.y = y*stage_scale_;
+	t.z = z*stage_scale_;
+	t.size.Fill(0);
+	tiles_.push_back( t );
+
+	int index = int(tiles_.size())-1;
+	if ( !read_size(file_name, tiles_[index].size) ) {
+		// No reader for the header alone (e.g. lsm), so read the image
+		// now. It stays in the cache for the registrations.
+		cache_entry* entry = acquire(index);
+		if (entry->image)
+			tiles_[index].size = entry->image->GetLargestPossibleRegion().GetSize();
+		release(entry);
+	}
+	std::cout<<"Tile "<<t.image_id<<" at ("<<t.x<<", "<<t.y<<", "<<t.z<<"), size "
+		<<tiles_[index].size<<std::endl;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_stage_scale(double pixels_per_unit)
+{
+	stage_scale_ = pixels_per_unit;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_min_overlap(double fraction)
+{
+	min_overlap_ = fraction;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_channel(int channel)
+{
+	channel_set_ = true;
+	channel_ = channel;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_background(float background)
+{
+	background_ = background;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_smoothing(double variance)
+{
+	smoothing_ = variance;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_stack_size(int size)
+{
+	stack_size_ = size;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_gdbicp(std::string const & gdbicp_exe_path)
+{
+	gdbicp_ = gdbicp_exe_path;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_scaling(bool scaling)
+{
+	scaling_ = scaling;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+set_cache_size(unsigned int images)
+{
+	cache_size_ = images;
+}
+
+template < class TPixel >
+unsigned int
+fregl_registration_scheduler< TPixel >::
+predict_pairs()
+{
+	pairs_.clear();
+	int num_tiles = int(tiles_.size());
+	if (num_tiles < 2) return 0;
+
+	std::vector<double> x(num_tiles);
+	for (int i = 0; i<num_tiles; i++) x[i] = tiles_[i].x;
+
+	// Sweep the tiles in the order of x. A tile can only overlap the
+	// following ones up to its right edge.
+	std::vector<int> by_x(num_tiles);
+	for (int i = 0; i<num_tiles; i++) by_x[i] = i;
+	x_order xo;
+	xo.x = &x;
+	std::sort(by_x.begin(), by_x.end(), xo);
+
+	for (int m = 0; m<num_tiles; m++) {
+		tile const & a = tiles_[by_x[m]];
+		for (int n = m+1; n<num_tiles; n++) {
+			tile const & b = tiles_[by_x[n]];
+			if (b.x - a.x >= a.size[0]) break;
+
+			double ox = overlap_1d(a.x, a.size[0], b.x, b.size[0]);
+			double oy = overlap_1d(a.y, a.size[1], b.y, b.size[1]);
+			double oz = overlap_1d(a.z, a.size[2], b.z, b.size[2]);
+			if (ox <= 0 || oy <= 0 || oz <= 0) continue;
+
+			double smaller = std::min(double(a.size[0])*a.size[1], double(b.size[0])*b.size[1]);
+			double fraction = ox*oy/smaller;
+			if (fraction < min_overlap_) continue;
+
+			// Register in the order of the tile list, as image_pair_list.py does
+			tile_pair pair;
+			pair.from_tile = std::min(by_x[m], by_x[n]);
+			pair.to_tile = std::max(by_x[m], by_x[n]);
+			pair.predicted_overlap = fraction;
+			pairs_.push_back( pair );
+		}
+	}
+
+	// Bin the tiles into rows of half the median tile height and rank
+	// them row-major. Pairs are run in the order of their later tile,
+	// so the images of a tile are used by consecutive pairs and the
+	// working set of the cache stays around one row of tiles.
+	std::vector<double> heights(num_tiles);
+	double min_y = tiles_[0].y;
+	for (int i = 0; i<num_tiles; i++) {
+		heights[i] = double(tiles_[i].size[1]);
+		min_y = std::min(min_y, tiles_[i].y);
+	}
+	std::nth_element(heights.begin(), heights.begin()+num_tiles/2, heights.end());
+	double row_height = std::max(1.0, heights[num_tiles/2]/2);
+
+	std::vector<int> row(num_tiles), by_row(num_tiles), rank(num_tiles);
+	for (int i = 0; i<num_tiles; i++) {
+		row[i] = int((tiles_[i].y-min_y)/row_height);
+		by_row[i] = i;
+	}
+	row_major_order ro;
+	ro.row = &row;
+	ro.x = &x;
+	std::sort(by_row.begin(), by_row.end(), ro);
+	for (int i = 0; i<num_tiles; i++) rank[by_row[i]] = i;
+
+	schedule_order so;
+	so.rank = &rank;
+	std::sort(pairs_.begin(), pairs_.end(), so);
+
+	std::cout<<pairs_.size()<<" overlapping pairs predicted for "<<num_tiles<<" tiles"<<std::endl;
+	return (unsigned int)pairs_.size();
+}
+
+template < class TPixel >
+unsigned int
+fregl_registration_scheduler< TPixel >::
+run()
+{
+	if (pairs_.empty()) predict_pairs();
+
+	// By default hold the widest row of tiles plus the images of the
+	// running registrations
+	if (cache_size_ == 0) {
+		std::map<int, unsigned int> row_count;
+		double row_height = 1;
+		for (unsigned int i = 0; i<tiles_.size(); i++)
+			row_height = std::max(row_height, double(tiles_[i].size[1]));
+		unsigned int widest = 0;
+		for (unsigned int i = 0; i<tiles_.size(); i++)
+			widest = std::max(widest, ++row_count[int(std::floor(tiles_[i].y/row_height))]);
+		cache_size_ = widest + 2*ftk::TaskRuntime::GetNumberOfThreads();
+	}
+
+	vul_timer timer;
+	timer.mark();
+	pair_records_.assign(pairs_.size(), fregl_reg_record::Pointer());
+	done_ = 0;
+	ftk::ParallelFor(0, int(pairs_.size()),
+		ftk::MemberBody< fregl_registration_scheduler >(this, &fregl_registration_scheduler::register_pair),
+		1, "register");
+
+	reg_records_.clear();
+	for (unsigned int i = 0; i<pair_records_.size(); i++)
+		if (pair_records_[i]) reg_records_.push_back( pair_records_[i] );
+	pair_records_.clear();
+
+	std::cout<<reg_records_.size()<<" of "<<pairs_.size()<<" pairs registered, "
+		<<reads_<<" image reads for "<<tiles_.size()<<" tiles in ";
+	timer.print( std::cout );
+	std::cout<<std::endl;
+
+	return (unsigned int)reg_records_.size();
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+register_pair(int pair_index)
+{
+	tile_pair const & pair = pairs_[pair_index];
+	tile const & from = tiles_[pair.from_tile];
+	tile const & to = tiles_[pair.to_tile];
+
+	cache_entry* from_entry = acquire(pair.from_tile);
+	cache_entry* to_entry = acquire(pair.to_tile);
+
+	fregl_reg_record::Pointer record;
+	if (from_entry->image && to_entry->image) {
+		std::string from_image_id_wo_ext = vul_file::strip_extension( from.image_id );
+		std::string to_image_id_wo_ext = vul_file::strip_extension( to.image_id );
+
+		fregl_pairwise_register< TPixel > registor(shallow_copy(from_entry->image),
+			shallow_copy(to_entry->image), from_image_id_wo_ext, to_image_id_wo_ext, background_);
+		if (stack_size_ > 0) registor.set_stack_size( stack_size_ );
+		registor.set_smoothing( smoothing_ );
+		registor.set_projections( shallow_copy(from_entry->projection), shallow_copy(to_entry->projection) );
+
+		double obj_value;
+		if (registor.run(obj_value, gdbicp_, scaling_)) {
+			SizeType from_image_size = from_entry->image->GetLargestPossibleRegion().GetSize();
+			SizeType to_image_size = to_entry->image->GetLargestPossibleRegion().GetSize();
+
+			// Invert the transform, since itk produces xform going from
+			// to->from image
+			typedef typename fregl_pairwise_register< TPixel >::TransformType TransformType;
+			typename TransformType::Pointer xform = registor.transform();
+			typename TransformType::Pointer inv_xform = TransformType::New();
+			xform->GetInverse(inv_xform);
+
+			record = new fregl_reg_record();
+			record->set_from_image_info(from.image_id, from_image_size);
+			record->set_to_image_info(to.image_id, to_image_size);
+			record->set_transform( inv_xform );
+			record->set_obj_value( obj_value );
+			record->set_overlap( fregl_util< TPixel >::fregl_util_overlap(inv_xform, from_image_size, to_image_size) );
+		}
+	}
+
+	release(from_entry);
+	release(to_entry);
+	pair_records_[pair_index] = record;
+
+	ftk::TaskLock lock(progress_lock_);
+	++done_;
+	std::cout<<"Pair "<<done_<<" of "<<pairs_.size()<<": "<<from.image_id<<" to "<<to.image_id
+		<<(record ? " registered" : " failed")<<std::endl;
+}
+
+template < class TPixel >
+typename fregl_registration_scheduler< TPixel >::cache_entry*
+fregl_registration_scheduler< TPixel >::
+acquire(int tile_index)
+{
+	cache_entry* entry;
+	{
+		ftk::TaskLock lock(cache_lock_);
+		typename std::map< int, cache_entry* >::iterator it = cache_.find(tile_index);
+		if (it == cache_.end()) {
+			entry = new cache_entry();
+			entry->loaded = false;
+			entry->pins = 0;
+			cache_[tile_index] = entry;
+		}
+		else entry = it->second;
+		++entry->pins;
+		entry->last_use = ++clock_;
+	}
+
+	// Other workers wanting the same image wait here until it is read
+	ftk::TaskLock lock(entry->load_lock);
+	if (!entry->loaded) {
+		std::string const & file_name = tiles_[tile_index].file_name;
+		try {
+			// Reads are serialized, the disk is the bottleneck and not
+			// every reader is reentrant. The projection is computed
+			// outside, while the next image is read.
+			ftk::TaskLock read_lock(read_lock_);
+			if (vul_file::exists(file_name)) {
+				entry->image = fregl_util< TPixel >::fregl_util_read_image(file_name, channel_set_, channel_);
+				++reads_;
+			}
+			else std::cerr<<"Image "<<file_name<<" does not exist"<<std::endl;
+		}
+		catch (std::exception& e) {
+			std::cerr<<"Failed to read "<<file_name<<": "<<e.what()<<std::endl;
+			entry->image = NULL;
+		}
+		if (entry->image)
+			entry->projection = fregl_util< TPixel >::fregl_util_max_projection(entry->image);
+		entry->loaded = true;
+	}
+	return entry;
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+release(cache_entry* entry)
+{
+	ftk::TaskLock lock(cache_lock_);
+	--entry->pins;
+	evict();
+}
+
+template < class TPixel >
+void
+fregl_registration_scheduler< TPixel >::
+evict()
+{
+	// Before run() has sized the cache, keep the images of the workers
+	unsigned int capacity = cache_size_ > 0 ? cache_size_ : 2*ftk::TaskRuntime::GetNumberOfThreads();
+	while (cache_.size() > capacity) {
+		typename std::map< int, cache_entry* >::iterator it, oldest = cache_.end();
+		for (it = cache_.begin(); it != cache_.end(); ++it) {
+			if (it->second->pins > 0) continue;
+			if (oldest == cache_.end() || it->second->last_use < oldest->second->last_use)
+				oldest = it;
+		}
+		if (oldest == cache_.end()) return;
+		delete oldest->second;
+		cache_.erase(oldest);
+	}
+}
+
+template < class TPixel >
+template < class TImage >
+itk::SmartPointer< TImage >
+fregl_registration_scheduler< TPixel >::
+shallow_copy(itk::SmartPointer< TImage > image)
+{
+	itk::SmartPointer< TImage > copy = TImage::New();
+	copy->CopyInformation( image );
+	copy->SetRegions( image->GetLargestPossibleRegion() );
+	copy->SetPixelContainer( image->GetPixelContainer() );
+	return copy;
+}
+
+template < class TPixel >
+bool
+fregl_registration_scheduler< TPixel >::
+read_size(std::string const & file_name, SizeType& size)
+{
+	itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO( file_name.c_str(), itk::ImageIOFactory::ReadMode );
+	if (!imageIO) return false;
+	try {
+		imageIO->SetFileName( file_name.c_str() );
+		imageIO->ReadImageInformation();
+	}
+	catch (itk::ExceptionObject& e) {
+		std::cerr<<e<<std::endl;
+		return false;
+	}
+	unsigned int dims = imageIO->GetNumberOfDimensions();
+	for (unsigned int d = 0; d<3; d++)
+		size[d] = d < dims ? imageIO->GetDimensions(d) : 1;
+	return true;
+}
+
+//Explicit Template Instantiation
+template class fregl_registration_scheduler< unsigned char >;
+template class fregl_registration_scheduler< unsigned short >;
@@ -0,0 +1,189 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+//:
+// \file
+// \brief Driver running all pairwise registrations of a montage
+//
+//  The tiles of a montage are given with their stage positions. The
+//  pairs of tiles which overlap are predicted from the positions and
+//  the image sizes, and the pairwise registrations are run
+//  concurrently on the ftk::TaskRuntime workers. Every image and its
+//  max projection are read once into an LRU cache shared by the
+//  workers, and pairs are scheduled in row-major order of the tiles so
+//  the cache only needs to hold a few rows. The registration records
+//  are collected in one set which is given to fregl_joint_register
+//  directly, instead of going through one xml file per pair.
+//
+#ifndef _fregl_registration_scheduler_
+#define _fregl_registration_scheduler_
+
+#include <fregl/fregl_util.h>
+#include <fregl/fregl_reg_record.h>
+
+#include "ftkCommon/ftkTaskRuntime.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+template < class TPixel >
+class fregl_registration_scheduler
+{
+public:
+	typedef typename fregl_util< TPixel >::ImageType        ImageType;
+	typedef typename fregl_util< TPixel >::ImageTypePointer ImageTypePointer;
+	typedef typename fregl_util< TPixel >::ImageType2D      ImageType2D;
+	typedef typename fregl_util< TPixel >::ImageType2DPointer ImageType2DPointer;
+	typedef itk::Size<3>                                    SizeType;
+
+	//: One tile of the montage
+	struct tile
+	{
+		std::string file_name;
+		std::string image_id;  // file name without the directory
+		double x, y, z;        // stage position in pixels
+		SizeType size;
+	};
+
+	//: A predicted pair, from_tile is registered to to_tile
+	struct tile_pair
+	{
+		int from_tile;
+		int to_tile;
+		double predicted_overlap;
+	};
+
+	//: Constructor
+	fregl_registration_scheduler();
+
+	//: Destructor
+	~fregl_registration_scheduler();
+
+	//: Read the tiles from a text file
+	//
+	//  Every line has the image file name followed by the stage x and
+	//  y position and optionally z. Lines starting with # are
+	//  skipped. Returns false if the file can not be read.
+	bool read_tile_list(std::string const & filename);
+
+	//: Add one tile. The size is read from the image header.
+	void add_tile(std::string const & file_name, double x, double y, double z = 0);
+
+	//: Number of pixels per unit of the stage positions (default 1)
+	void set_stage_scale(double pixels_per_unit);
+
+	//: Minimum predicted overlap, as a fraction of the smaller tile
+	//
+	//  The default of 0.05 leaves out the corner neighbours of a grid.
+	void set_min_overlap(double fraction);
+
+	//: Channel to register, all channels of lsm images are fused if not set
+	void set_channel(int channel);
+
+	//: Parameters passed on to fregl_pairwise_register
+	void set_background(float background);
+	void set_smoothing(double variance);
+	void set_stack_size(int size);
+	void set_gdbicp(std::string const & gdbicp_exe_path);
+	void set_scaling(bool scaling);
+
+	//: Maximum number of images in the cache
+	//
+	//  0 (the default) holds the widest row of tiles plus two images
+	//  per worker. Images in use by a running registration are never
+	//  evicted, so the cache may briefly hold more.
+	void set_cache_size(unsigned int images);
+
+	//: Predict the overlapping pairs from the stage positions
+	//
+	//  Returns the number of pairs.
+	unsigned int predict_pairs();
+
+	//: Run the registration of all predicted pairs
+	//
+	//  Returns the number of successful pairs.
+	unsigned int run();
+
+	//: The tiles and predicted pairs
+	std::vector< tile > const & tiles() const { return tiles_; }
+	std::vector< tile_pair > const & pairs() const { return pairs_; }
+
+	//: Records of the successful pairs, in the order of pairs()
+	std::vector< fregl_reg_record::Pointer > const & reg_records() const { return reg_records_; }
+
+	//: Number of image reads, equal to the number of tiles if nothing was evicted too early
+	unsigned int number_of_reads() const { return reads_; }
+
+private:
+	//: An image in the cache
+	struct cache_entry
+	{
+		ftk::TaskMutex load_lock;   // held while the image is read
+		bool loaded;
+		ImageTypePointer image;
+		ImageType2DPointer projection;
+		int pins;                   // running registrations using the image
+		unsigned long last_use;
+	};
+
+	//: Get the image of a tile from the cache, reading it if needed
+	//
+	//  The entry is pinned until it is released.
+	cache_entry* acquire(int tile_index);
+	void release(cache_entry* entry);
+
+	//: Evict the least recently used unpinned entries over capacity
+	void evict();
+
+	//: An image sharing the pixels of a cached one
+	//
+	//  fregl_pairwise_register sets the requested region of its
+	//  images, so every registration gets its own image object.
+	template < class TImage >
+	static itk::SmartPointer< TImage > shallow_copy(itk::SmartPointer< TImage > image);
+
+	//: Read the size of an image from its header
+	bool read_size(std::string const & file_name, SizeType& size);
+
+	//: Register the pair with the given index, the ParallelFor body
+	void register_pair(int pair_index);
+
+	std::vector< tile > tiles_;
+	std::vector< tile_pair > pairs_;
+	std::vector< fregl_reg_record::Pointer > pair_records_;
+	std::vector< fregl_reg_record::Pointer > reg_records_;
+
+	double stage_scale_;
+	double min_overlap_;
+	bool channel_set_;
+	int channel_;
+	float background_;
+	double smoothing_;
+	int stack_size_;
+	std::string gdbicp_;
+	bool scaling_;
+
+	unsigned int cache_size_;
+	std::map< int, cache_entry* > cache_;
+	ftk::TaskMutex cache_lock_;
+	ftk::TaskMutex read_lock_;
+	ftk::TaskMutex progress_lock_;
+	unsigned long clock_;
+	unsigned int reads_;
+	unsigned int done_;
+};
+
+#endif
@@ -275,10 +275,33 @@ in_image(vnl_vector_fixed< float, 3 > loc, int image_index,
 	return in_range;
 }
 
+template <class TPixel>
+typename fregl_space_transformer< TPixel >::TransformTypePointer
+fregl_space_transformer< TPixel >::
+image_to_anchor(int image_index) const
+{
+	return joint_register_->get_transform(image_id_indices_[image_index], anchor_);
+}
+
+template <class TPixel>
+typename fregl_space_transformer< TPixel >::TransformTypePointer
+fregl_space_transformer< TPixel >::
+anchor_to_image(int image_index) const
+{
+	return joint_register_->get_transform(anchor_, image_id_indices_[image_index]);
+}
+
 template <class TPixel>
 bool 
 fregl_space_transformer< TPixel >::
 image_in_roi(int image_index) const {
+	return image_in_roi(image_index, roi_origin_, roi_size_);
+}
+
+template <class TPixel>
+bool 
+fregl_space_transformer< TPixel >::
+image_in_roi(int image_index, PointType roi_origin, SizeType roi_size) const {
 
 	int index = image_id_indices_[image_index];
 	TransformTypePointer xform = joint_register_->get_transform(index, anchor_);
@@ -297,13 +320,13 @@ image_in_roi(int image_index) const {
 	i_end[2] += i_size[2];
 
 	// Set the far corner of the roi
-	PointType roi_end = roi_origin_;
-	roi_end[0] += roi_size_[0];
-	roi_end[1] += roi_size_[1];
-	roi_end[2] += roi_size_[2];
+	PointType roi_end = roi_origin;
+	roi_end[0] += roi_size[0];
+	roi_end[1] += roi_size[1];
+	roi_end[2] += roi_size[2];
 
 	// Little complicated test to see if any piece of the image is in the anchor space.
-	if ((i_end[0] >= roi_origin_[0] && i_end[1] >= roi_origin_[1] && i_end[2] >= roi_origin_[2]) && 
+	if ((i_end[0] >= roi_origin[0] && i_end[1] >= roi_origin[1] && i_end[2] >= roi_origin[2]) && 
 			(i_origin[0] <= roi_end[0] && i_origin[1] <= roi_end[1] && i_origin[2] <= roi_end[2])) return true;
 	else return false;
 
@@ -877,6 +900,14 @@ template <class TPixel>
 typename fregl_space_transformer< TPixel >::ImageTypePointer 
 fregl_space_transformer< TPixel >::
 transform_image_roi(ImageTypePointer in_image, int image_index, int background, bool use_NN_interpolator ) const
+{
+	return transform_image_roi(in_image, image_index, roi_origin_, roi_size_, background, use_NN_interpolator);
+}
+
+template <class TPixel>
+typename fregl_space_transformer< TPixel >::ImageTypePointer 
+fregl_space_transformer< TPixel >::
+transform_image_roi(ImageTypePointer in_image, int image_index, PointType roi_origin, SizeType roi_size, int background, bool use_NN_interpolator ) const
 {
 	if (!anchor_set_) {
 		std::cerr<<"Set anchor first"<<std::endl;
@@ -909,8 +940,8 @@ transform_image_roi(ImageTypePointer in_image, int image_index, int background,
 	}
 	resampler->SetInput(in_image);
 	resampler->SetTransform( inverse_xform );
-	resampler->SetSize( roi_size_ );
-	resampler->SetOutputOrigin( roi_origin_ );
+	resampler->SetSize( roi_size );
+	resampler->SetOutputOrigin( roi_origin );
 	resampler->SetOutputSpacing(spacing_);
 	resampler->SetDefaultPixelValue( background );
 	try {
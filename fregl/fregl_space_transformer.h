@@ -107,6 +107,28 @@ public:
 
 	bool image_in_roi(int image_index) const;
 
+	//: Determine if an image is in the given roi
+	//
+	//  Same as above for a roi other than the one set, so concurrent
+	//  callers do not need to change the roi.
+	bool image_in_roi(int image_index, PointType roi_origin, SizeType roi_size) const;
+
+	//: Return the origin of image i in the global space
+	PointType const & image_origin(int image_index) const { return image_origins_[image_index]; }
+
+	//: Return the transform from image i to the anchor space
+	//
+	//  NULL is returned if the image is not connected to the anchor.
+	TransformTypePointer image_to_anchor(int image_index) const;
+
+	//: Return the transform from the anchor space to image i
+	//
+	//  NULL is returned if the image is not connected to the anchor.
+	TransformTypePointer anchor_to_image(int image_index) const;
+
+	//: Return the spacing of the global space
+	SpacingType spacing() const { return spacing_; }
+
 	//: Determine if a point is in the 2D projected image of given index
 	//
 	//  "loc" is the location of the point in the anchor image, and the
@@ -173,6 +195,12 @@ public:
 	//  space defined by the anchor image and the roi.
 	ImageTypePointer transform_image_roi(ImageTypePointer in_image, int image_index, int background = 0, bool use_NN_interpolator = false) const;
 
+	//: Generate the transformed image in the given roi
+	//
+	//  Same as above, but the roi is given instead of the one set by
+	//  set_roi, so it can be called from several threads.
+	ImageTypePointer transform_image_roi(ImageTypePointer in_image, int image_index, PointType roi_origin, SizeType roi_size, int background = 0, bool use_NN_interpolator = false) const;
+
         //: Generate the transformed image using the given transformation
 	//
 	//  The given image is transformed to the image space of the global
@@ -0,0 +1,54 @@
+#ifndef FTK_K_NEAREST_NEIGHBORS_H
+#define FTK_K_NEAREST_NEIGHBORS_H
+
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace ftk
+{
+
+/** \brief Exact k nearest neighbours of every sample of a feature matrix.
+ *
+ * The samples are the n rows of a row-major matrix of d values per row
+ * (the layout of vnl_matrix::data_block()).  They are put in a kd-tree
+ * split at the median of the dimension of largest spread, with up to 16
+ * samples per leaf, and every sample then searches the tree on its own
+ * OpenMP thread.  A subtree is skipped when its splitting plane is farther
+ * than the k-th neighbour found so far, and the distance to a sample is
+ * abandoned as soon as it gets larger than that.  In low dimensions the
+ * search costs O(log n) per sample; in high dimensions fewer subtrees can
+ * be skipped, but the result is always the same as a brute force search
+ * (ties between equal distances may be broken differently).
+ */
+
+//: The k smallest (squared distance, index) pairs pushed so far
+template< class TValue >
+class KNearestHeap
+{
+public:
+	KNearestHeap( unsigned int k ) : k( k ) {}
+
+	bool IsFull() const { return heap.size() >= k; }
+	//: Largest distance kept, only meaningful when the heap is full
+	TValue Worst() const { return heap.top().first; }
+	void Push( TValue distance, unsigned int index );
+	//: Empties the heap into (index, squared distance) pairs of increasing distance
+	void Extract( std::vector< std::pair< unsigned int, TValue > > & neighbors );
+
+private:
+	unsigned int k;
+	std::priority_queue< std::pair< TValue, unsigned int > > heap;
+};
+
+//: neighbors[i] gets the min(k, n-1) nearest other rows of row i as
+// (row, squared Euclidean distance), nearest first
+template< class TValue >
+void KNearestNeighbors( const TValue * data, int n, int d, unsigned int k,
+	std::vector< std::vector< std::pair< unsigned int, TValue > > > & neighbors );
+
+} // end namespace ftk
+
+#include "ftkKNearestNeighbors.hxx"
+
+#endif
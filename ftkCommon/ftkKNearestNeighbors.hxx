@@ -0,0 +1,235 @@
+#ifndef FTK_K_NEAREST_NEIGHBORS_HXX
+#define FTK_K_NEAREST_NEIGHBORS_HXX
+
+#include "ftkKNearestNeighbors.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+namespace ftk
+{
+
+template< class TValue >
+void KNearestHeap< TValue >::Push( TValue distance, unsigned int index )
+{
+	if( heap.size() < k )
+		heap.push( std::make_pair( distance, index ) );
+	else if( k > 0 && distance < heap.top().first )
+	{
+		heap.pop();
+		heap.push( std::make_pair( distance, index ) );
+	}
+}
+
+template< class TValue >
+void KNearestHeap< TValue >::Extract( std::vector< std::pair< unsigned int, TValue > > & neighbors )
+{
+	neighbors.resize( heap.size() );
+	for(std::size_t i=heap.size(); i>0; --i)
+	{
+		neighbors[i-1] = std::make_pair( heap.top().second, heap.top().first );
+		heap.pop();
+	}
+}
+
+namespace KNearestNeighborsDetail
+{
+	const int LeafSize = 16;
+
+	template< class TValue >
+	struct Node
+	{
+		int begin, end;     //samples perm[begin..end)
+		int dim;            //-1 for a leaf
+		TValue split;
+		int left, right;
+	};
+
+	//Orders sample indices by one of their values
+	template< class TValue >
+	struct ValueLess
+	{
+		const TValue * data;
+		int d, dim;
+		bool operator()( int a, int b ) const { return data[(std::size_t)a*d+dim] < data[(std::size_t)b*d+dim]; }
+	};
+
+	template< class TValue >
+	struct Tree
+	{
+		const TValue * data;
+		int d;
+		std::vector< int > perm;
+		std::vector< TValue > sorted;       //the samples in the order of perm
+		std::vector< Node< TValue > > nodes;
+
+		void Build( const TValue * data, int n, int d );
+		//offset[f] is the distance along f from the query to the cell of the node,
+		//cellDistance the squared distance to the cell
+		void Search( int node, const TValue * query, unsigned int self, TValue * offset, TValue cellDistance, KNearestHeap< TValue > & heap ) const;
+	};
+
+	template< class TValue >
+	void Tree< TValue >::Build( const TValue * data, int n, int d )
+	{
+		this->data = data;
+		this->d = d;
+		perm.resize( n );
+		for(int i=0; i<n; ++i)
+			perm[i] = i;
+
+		Node< TValue > root;
+		root.begin = 0;
+		root.end = n;
+		root.dim = -1;
+		root.split = 0;
+		root.left = root.right = -1;
+		nodes.push_back( root );
+
+		std::vector< int > pending( 1, 0 );
+		while( !pending.empty() )
+		{
+			const int current = pending.back();
+			pending.pop_back();
+			const int begin = nodes[current].begin, end = nodes[current].end;
+			if( end - begin <= LeafSize )
+				continue;
+
+			//Dimension of largest spread
+			int bestDim = -1;
+			TValue bestSpread = 0;
+			for(int f=0; f<d; ++f)
+			{
+				TValue lo = data[(std::size_t)perm[begin]*d+f], hi = lo;
+				for(int i=begin+1; i<end; ++i)
+				{
+					const TValue v = data[(std::size_t)perm[i]*d+f];
+					if( v < lo ) lo = v;
+					if( v > hi ) hi = v;
+				}
+				if( hi - lo > bestSpread )
+				{
+					bestSpread = hi - lo;
+					bestDim = f;
+				}
+			}
+			if( bestDim < 0 )
+				continue;       //all the samples are equal
+
+			//Left samples <= split <= right samples
+			const int mid = begin + ( end - begin ) / 2;
+			ValueLess< TValue > less;
+			less.data = data;
+			less.d = d;
+			less.dim = bestDim;
+			std::nth_element( perm.begin() + begin, perm.begin() + mid, perm.begin() + end, less );
+
+			Node< TValue > child;
+			child.dim = -1;
+			child.split = 0;
+			child.left = child.right = -1;
+			child.begin = begin;
+			child.end = mid;
+			nodes[current].left = (int)nodes.size();
+			nodes.push_back( child );
+			child.begin = mid;
+			child.end = end;
+			nodes[current].right = (int)nodes.size();
+			nodes.push_back( child );
+			nodes[current].dim = bestDim;
+			nodes[current].split = data[(std::size_t)perm[mid]*d+bestDim];
+			pending.push_back( nodes[current].left );
+			pending.push_back( nodes[current].right );
+		}
+
+		//The samples of a leaf are read one after the other
+		sorted.resize( (std::size_t)n*d );
+		for(int i=0; i<n; ++i)
+			std::copy( data + (std::size_t)perm[i]*d, data + (std::size_t)(perm[i]+1)*d, sorted.begin() + (std::size_t)i*d );
+	}
+
+	template< class TValue >
+	void Tree< TValue >::Search( int node, const TValue * query, unsigned int self, TValue * offset, TValue cellDistance, KNearestHeap< TValue > & heap ) const
+	{
+		const Node< TValue > & current = nodes[node];
+		if( current.dim < 0 )
+		{
+			for(int i=current.begin; i<current.end; ++i)
+			{
+				const unsigned int index = (unsigned int)perm[i];
+				if( index == self )
+					continue;
+				const TValue * x = &sorted[(std::size_t)i*d];
+				const bool full = heap.IsFull();
+				const TValue worst = full ? heap.Worst() : 0;
+				//Blocks of 8 values between the checks against the k-th distance
+				TValue distance = 0;
+				int f = 0;
+				while( f < d )
+				{
+					const int blockEnd = std::min( f + 8, d );
+					for(; f<blockEnd; ++f)
+					{
+						const TValue diff = query[f] - x[f];
+						distance += diff * diff;
+					}
+					if( full && distance >= worst )
+						break;
+				}
+				if( !full || distance < worst )
+					heap.Push( distance, index );
+			}
+			return;
+		}
+
+		//The near child keeps the offsets of the node, the far one is at least
+		//diff away along the splitting dimension
+		const int dim = current.dim;
+		const TValue diff = query[dim] - current.split;
+		Search( diff < 0 ? current.left : current.right, query, self, offset, cellDistance, heap );
+		const TValue saved = offset[dim];
+		const TValue farDistance = cellDistance - saved * saved + diff * diff;
+		if( !heap.IsFull() || farDistance < heap.Worst() )
+		{
+			offset[dim] = diff;
+			Search( diff < 0 ? current.right : current.left, query, self, offset, farDistance, heap );
+			offset[dim] = saved;
+		}
+	}
+}
+
+template< class TValue >
+void KNearestNeighbors( const TValue * data, int n, int d, unsigned int k,
+	std::vector< std::vector< std::pair< unsigned int, TValue > > > & neighbors )
+{
+	neighbors.clear();
+	neighbors.resize( n );
+	if( n < 2 || k == 0 )
+		return;
+	if( k > (unsigned int)n - 1 )
+		k = n - 1;
+
+	KNearestNeighborsDetail::Tree< TValue > tree;
+	tree.Build( data, n, d );
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic, 64)
+	#endif
+	for(int i=0; i<n; ++i)
+	{
+		//Queries in the order of the leaves, so consecutive ones visit the same part of the tree
+		const unsigned int self = (unsigned int)tree.perm[i];
+		KNearestHeap< TValue > heap( k );
+		std::vector< TValue > offset( d, 0 );
+		tree.Search( 0, &tree.sorted[(std::size_t)i*d], self, &offset[0], 0, heap );
+		heap.Extract( neighbors[self] );
+	}
+}
+
+} // end namespace ftk
+
+#endif
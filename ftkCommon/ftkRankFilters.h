@@ -0,0 +1,69 @@
+#ifndef FTK_RANK_FILTERS_H
+#define FTK_RANK_FILTERS_H
+
+namespace ftk
+{
+
+/** \brief Median and grey-scale morphology kernels for 8-bit and 16-bit
+ * volumes whose cost per voxel grows far slower than the volume of the kernel.
+ *
+ * The kernels work on the raw buffers of volumes stored x fastest, then y,
+ * then z (the layout of itk::Image::GetBufferPointer()), with size[0..2]
+ * voxels along x, y and z.  They are defined for unsigned char and
+ * unsigned short pixels, and are parallelized with OpenMP when it is on.
+ *
+ * The median keeps a histogram of every column of the window and slides the
+ * window histogram along x by adding and removing whole columns (Perreault
+ * and Hebert).  The histograms have two levels, so the window histogram only
+ * touches the fine bins of the one coarse bin holding the median.  The output
+ * is computed in strips of 64 columns: every row of a strip updates the
+ * histograms of its 64+2*rx columns, 2*(2*rz+1) voxels each, and rebuilds
+ * the coarse window histogram from 2*rx+1 of them.  Per voxel this costs
+ * about 2*(2*rz+1)*(64+2*rx)/64 column updates and (2*rx+1)*C/64 coarse bin
+ * additions (C = 16 coarse bins for 8-bit, 256 for 16-bit), on top of a
+ * constant number of bin updates for sliding the window.  So the cost grows
+ * linearly with the z radius and slowly with the x radius, while the y radius
+ * only matters when the columns are filled at the first row of a slice.
+ * Outside the volume the border voxels are repeated, and the result is the
+ * same as itk::MedianImageFilter.
+ *
+ * Erosion and dilation along a digital line use the van Herk / Gil-Werman
+ * algorithm, with 3 comparisons per voxel for any length.  Voxels outside
+ * the volume are ignored, as in itk::GrayscaleErodeImageFilter and
+ * itk::GrayscaleDilateImageFilter.  A box is decomposed into lines along x,
+ * y and z and is exact.  A disk in the x-y plane is approximated by an
+ * octagon, decomposed into lines along x, y and the two diagonals.
+ *
+ * input and output may be the same buffer for the morphology kernels, but
+ * not for the median.
+ */
+
+//: Median over a box of (2*radius[d]+1) voxels along each axis
+template< class TPixel >
+void RankMedian( const TPixel * input, TPixel * output, const int size[3], const int radius[3] );
+
+//: Minimum / maximum over the line p + t*direction, -radius <= t <= radius
+// The components of direction are -1, 0 or 1.
+template< class TPixel >
+void LineErode( const TPixel * input, TPixel * output, const int size[3], const int direction[3], int radius );
+template< class TPixel >
+void LineDilate( const TPixel * input, TPixel * output, const int size[3], const int direction[3], int radius );
+
+//: Minimum / maximum over a box of (2*radius[d]+1) voxels along each axis
+template< class TPixel >
+void BoxErode( const TPixel * input, TPixel * output, const int size[3], const int radius[3] );
+template< class TPixel >
+void BoxDilate( const TPixel * input, TPixel * output, const int size[3], const int radius[3] );
+
+//: Minimum / maximum over an octagon approximating a disk of the given
+// radius in every x-y slice
+template< class TPixel >
+void DiskErode( const TPixel * input, TPixel * output, const int size[3], int radius );
+template< class TPixel >
+void DiskDilate( const TPixel * input, TPixel * output, const int size[3], int radius );
+
+} // end namespace ftk
+
+#include "ftkRankFilters.hxx"
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef FTK_RANK_FILTERS_HXX
+#define FTK_RANK_FILTERS_HXX
+
+#include "ftkRankFilters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+namespace ftk
+{
+namespace RankFiltersDetail
+{
+	//Split of the pixel values into coarse and fine histogram bins
+	template< class TPixel > struct HistogramTraits;
+	template<> struct HistogramTraits< unsigned char > { enum { FineBits = 4, Coarse = 16, Fine = 16 }; };
+	template<> struct HistogramTraits< unsigned short > { enum { FineBits = 8, Coarse = 256, Fine = 256 }; };
+
+	inline int Clamp( int i, int n )
+	{
+		return i < 0 ? 0 : ( i >= n ? n - 1 : i );
+	}
+
+	//Output columns handled by one thread at a time
+	const int MedianStripWidth = 64;
+
+	//Median of one strip [x0,x1) of output columns
+	template< class TPixel, class TCount >
+	void MedianStrip( const TPixel * input, TPixel * output, const int size[3], const int radius[3], int x0, int x1 )
+	{
+		typedef HistogramTraits< TPixel > Traits;
+		const int C = Traits::Coarse, F = Traits::Fine, B = Traits::FineBits;
+		const int nx = size[0], ny = size[1], nz = size[2];
+		const int rx = radius[0], ry = radius[1], rz = radius[2];
+		const std::size_t sliceSize = (std::size_t)nx * ny;
+		const long n = (long)(2*rx+1) * (2*ry+1) * (2*rz+1);
+		const long k = n / 2;
+
+		//Histograms of the columns the strip reaches, coarse bins first
+		const int c0 = std::max( x0 - rx, 0 ), c1 = std::min( x1 - 1 + rx, nx - 1 );
+		const int stride = C + C*F;
+		std::vector< TCount > columns( (std::size_t)(c1 - c0 + 1) * stride, 0 );
+		std::vector< long > coarse( C );
+		std::vector< long > fine( C*F );
+		std::vector< int > stamp( C );
+
+		for(int z=0; z<nz; ++z)
+		{
+			for(int y=0; y<ny; ++y)
+			{
+				//Slide the column histograms to the rows of y
+				for(int xc=c0; xc<=c1; ++xc)
+				{
+					TCount * col = &columns[(std::size_t)(xc - c0) * stride];
+					for(int tz=-rz; tz<=rz; ++tz)
+					{
+						const TPixel * plane = input + Clamp( z + tz, nz ) * sliceSize + xc;
+						if( y == 0 )
+						{
+							for(int ty=-ry; ty<=ry; ++ty)
+							{
+								TPixel v = plane[(std::size_t)Clamp( ty, ny ) * nx];
+								++col[v >> B];
+								++col[C + v];
+							}
+						}
+						else
+						{
+							TPixel v = plane[(std::size_t)Clamp( y - 1 - ry, ny ) * nx];
+							--col[v >> B];
+							--col[C + v];
+							v = plane[(std::size_t)Clamp( y + ry, ny ) * nx];
+							++col[v >> B];
+							++col[C + v];
+						}
+					}
+				}
+
+				//The fine bins of the window are brought up to date lazily
+				std::fill( coarse.begin(), coarse.end(), 0 );
+				std::fill( stamp.begin(), stamp.end(), -1 );
+				for(int t=-rx; t<=rx; ++t)
+				{
+					const TCount * col = &columns[(std::size_t)(Clamp( x0 + t, nx ) - c0) * stride];
+					for(int b=0; b<C; ++b)
+						coarse[b] += col[b];
+				}
+
+				TPixel * out = output + z * sliceSize + (std::size_t)y * nx;
+				for(int x=x0; x<x1; ++x)
+				{
+					if( x > x0 )
+					{
+						const TCount * add = &columns[(std::size_t)(Clamp( x + rx, nx ) - c0) * stride];
+						const TCount * sub = &columns[(std::size_t)(Clamp( x - rx - 1, nx ) - c0) * stride];
+						for(int b=0; b<C; ++b)
+							coarse[b] += (long)add[b] - (long)sub[b];
+					}
+
+					int b = 0;
+					long below = 0;
+					while( below + coarse[b] <= k )
+						below += coarse[b++];
+
+					long * segment = &fine[(std::size_t)b * F];
+					if( stamp[b] < 0 || x - stamp[b] > 2*rx + 1 )
+					{
+						std::fill( segment, segment + F, 0 );
+						for(int t=-rx; t<=rx; ++t)
+						{
+							const TCount * col = &columns[(std::size_t)(Clamp( x + t, nx ) - c0) * stride + C + b*F];
+							for(int i=0; i<F; ++i)
+								segment[i] += col[i];
+						}
+					}
+					else
+					{
+						for(int s=stamp[b]+1; s<=x; ++s)
+						{
+							const TCount * add = &columns[(std::size_t)(Clamp( s + rx, nx ) - c0) * stride + C + b*F];
+							const TCount * sub = &columns[(std::size_t)(Clamp( s - rx - 1, nx ) - c0) * stride + C + b*F];
+							for(int i=0; i<F; ++i)
+								segment[i] += (long)add[i] - (long)sub[i];
+						}
+					}
+					stamp[b] = x;
+
+					int i = 0;
+					while( below + segment[i] <= k )
+						below += segment[i++];
+					out[x] = (TPixel)( (b << B) | i );
+				}
+			}
+
+			//Empty the column histograms for the next slice
+			for(int xc=c0; xc<=c1; ++xc)
+			{
+				TCount * col = &columns[(std::size_t)(xc - c0) * stride];
+				for(int tz=-rz; tz<=rz; ++tz)
+				{
+					const TPixel * plane = input + Clamp( z + tz, nz ) * sliceSize + xc;
+					for(int ty=-ry; ty<=ry; ++ty)
+					{
+						TPixel v = plane[(std::size_t)Clamp( ny - 1 + ty, ny ) * nx];
+						--col[v >> B];
+						--col[C + v];
+					}
+				}
+			}
+		}
+	}
+
+	template< class TPixel, class TCount >
+	void Median( const TPixel * input, TPixel * output, const int size[3], const int radius[3] )
+	{
+		int numStrips = (size[0] + MedianStripWidth - 1) / MedianStripWidth;
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic)
+#endif
+		for(int s=0; s<numStrips; ++s)
+		{
+			int x0 = s * MedianStripWidth;
+			int x1 = std::min( x0 + MedianStripWidth, size[0] );
+			MedianStrip< TPixel, TCount >( input, output, size, radius, x0, x1 );
+		}
+	}
+
+	struct Less
+	{
+		template< class T > bool operator()( T a, T b ) const { return a < b; }
+	};
+	struct Greater
+	{
+		template< class T > bool operator()( T a, T b ) const { return a > b; }
+	};
+
+	//van Herk / Gil-Werman: with w = 2*radius+1, the padded line is cut into
+	//blocks of w, g holds the running extremum from the start of each block
+	//and h the one from its end. Every window of w values spans at most two
+	//blocks, so its extremum is better(h[first], g[last]).
+	template< class TPixel, class TBetter >
+	void VanHerkLine( TPixel * line, int length, int radius, TPixel identity,
+		std::vector< TPixel > & g, std::vector< TPixel > & h, TBetter better )
+	{
+		const int w = 2*radius + 1;
+		const int padded = ( (length + 2*radius + w - 1) / w ) * w;
+		g.resize( padded );
+		h.resize( padded );
+		for(int i=0; i<padded; ++i)
+		{
+			int j = i - radius;
+			TPixel v = ( j >= 0 && j < length ) ? line[j] : identity;
+			g[i] = ( i % w == 0 || better( v, g[i-1] ) ) ? v : g[i-1];
+			h[i] = v;
+		}
+		for(int i=padded-2; i>=0; --i)
+		{
+			if( (i+1) % w != 0 && better( h[i+1], h[i] ) )
+				h[i] = h[i+1];
+		}
+		for(int j=0; j<length; ++j)
+			line[j] = better( g[j + 2*radius], h[j] ) ? g[j + 2*radius] : h[j];
+	}
+
+	template< class TPixel, class TBetter >
+	void Line( const TPixel * input, TPixel * output, const int size[3], const int direction[3],
+		int radius, TPixel identity, TBetter better )
+	{
+		const int nx = size[0], ny = size[1], nz = size[2];
+		const std::size_t total = (std::size_t)nx * ny * nz;
+		if( radius <= 0 || (direction[0] == 0 && direction[1] == 0 && direction[2] == 0) )
+		{
+			if( output != input )
+				std::copy( input, input + total, output );
+			return;
+		}
+
+		//A line starts at every voxel whose predecessor is outside
+		std::vector< long > starts;
+		for(int z=0; z<nz; ++z)
+			for(int y=0; y<ny; ++y)
+				for(int x=0; x<nx; ++x)
+				{
+					int px = x - direction[0], py = y - direction[1], pz = z - direction[2];
+					if( px < 0 || px >= nx || py < 0 || py >= ny || pz < 0 || pz >= nz )
+						starts.push_back( ((long)z * ny + y) * nx + x );
+				}
+		const long step = ((long)direction[2] * ny + direction[1]) * nx + direction[0];
+		const long numStarts = (long)starts.size();
+
+#ifdef _OPENMP
+		#pragma omp parallel
+#endif
+		{
+			std::vector< TPixel > line, g, h;
+#ifdef _OPENMP
+			#pragma omp for schedule(dynamic, 64)
+#endif
+			for(long s=0; s<numStarts; ++s)
+			{
+				long p = starts[s];
+				int x = (int)(p % nx), y = (int)((p / nx) % ny), z = (int)(p / ((long)nx * ny));
+				line.clear();
+				while( x >= 0 && x < nx && y >= 0 && y < ny && z >= 0 && z < nz )
+				{
+					line.push_back( input[p] );
+					p += step;
+					x += direction[0];
+					y += direction[1];
+					z += direction[2];
+				}
+				VanHerkLine( &line[0], (int)line.size(), radius, identity, g, h, better );
+				p = starts[s];
+				for(std::size_t i=0; i<line.size(); ++i, p += step)
+					output[p] = line[i];
+			}
+		}
+	}
+
+	//Octagon of the lines along x and y with radius a and along the
+	//diagonals with radius b. It reaches a+2*b along the axes and
+	//sqrt(2)*(a+b) along the diagonals, both close to the radius.
+	inline void OctagonRadii( int radius, int & a, int & b )
+	{
+		b = (int)std::floor( radius * (1.0 - std::sqrt(0.5)) + 0.5 );
+		a = std::max( radius - 2*b, 0 );
+	}
+
+	template< class TPixel, class TBetter >
+	void Disk( const TPixel * input, TPixel * output, const int size[3], int radius, TPixel identity, TBetter better )
+	{
+		int a, b;
+		OctagonRadii( radius, a, b );
+		const int xAxis[3] = {1, 0, 0}, yAxis[3] = {0, 1, 0}, diagonal[3] = {1, 1, 0}, antiDiagonal[3] = {1, -1, 0};
+		Line( input, output, size, xAxis, a, identity, better );
+		Line( output, output, size, yAxis, a, identity, better );
+		Line( output, output, size, diagonal, b, identity, better );
+		Line( output, output, size, antiDiagonal, b, identity, better );
+	}
+} // end namespace RankFiltersDetail
+
+template< class TPixel >
+void RankMedian( const TPixel * input, TPixel * output, const int size[3], const int radius[3] )
+{
+	long n = (long)(2*radius[0]+1) * (2*radius[1]+1) * (2*radius[2]+1);
+	if( n <= std::numeric_limits< unsigned short >::max() )
+		RankFiltersDetail::Median< TPixel, unsigned short >( input, output, size, radius );
+	else
+		RankFiltersDetail::Median< TPixel, unsigned int >( input, output, size, radius );
+}
+
+template< class TPixel >
+void LineErode( const TPixel * input, TPixel * output, const int size[3], const int direction[3], int radius )
+{
+	RankFiltersDetail::Line( input, output, size, direction, radius,
+		std::numeric_limits< TPixel >::max(), RankFiltersDetail::Less() );
+}
+
+template< class TPixel >
+void LineDilate( const TPixel * input, TPixel * output, const int size[3], const int direction[3], int radius )
+{
+	RankFiltersDetail::Line( input, output, size, direction, radius,
+		std::numeric_limits< TPixel >::min(), RankFiltersDetail::Greater() );
+}
+
+template< class TPixel >
+void BoxErode( const TPixel * input, TPixel * output, const int size[3], const int radius[3] )
+{
+	const int axes[3][3] = { {1, 0, 0}, {0, 1, 0}, {0, 0, 1} };
+	LineErode( input, output, size, axes[0], radius[0] );
+	LineErode( output, output, size, axes[1], radius[1] );
+	LineErode( output, output, size, axes[2], radius[2] );
+}
+
+template< class TPixel >
+void BoxDilate( const TPixel * input, TPixel * output, const int size[3], const int radius[3] )
+{
+	const int axes[3][3] = { {1, 0, 0}, {0, 1, 0}, {0, 0, 1} };
+	LineDilate( input, output, size, axes[0], radius[0] );
+	LineDilate( output, output, size, axes[1], radius[1] );
+	LineDilate( output, output, size, axes[2], radius[2] );
+}
+
+template< class TPixel >
+void DiskErode( const TPixel * input, TPixel * output, const int size[3], int radius )
+{
+	RankFiltersDetail::Disk( input, output, size, radius,
+		std::numeric_limits< TPixel >::max(), RankFiltersDetail::Less() );
+}
+
+template< class TPixel >
+void DiskDilate( const TPixel * input, TPixel * output, const int size[3], int radius )
+{
+	RankFiltersDetail::Disk( input, output, size, radius,
+		std::numeric_limits< TPixel >::min(), RankFiltersDetail::Greater() );
+}
+
+} // end namespace ftk
+
+#endif
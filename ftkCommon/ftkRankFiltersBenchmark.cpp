@@ -0,0 +1,176 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#include "itkImage.h"
+#include "itkImageRegionIterator.h"
+#include "itkMedianImageFilter.h"
+#include "itkGrayscaleErodeImageFilter.h"
+#include "itkBinaryBallStructuringElement.h"
+#include "itkNeighborhood.h"
+#include "itkTimeProbe.h"
+
+#include "ftkRankFilters.h"
+
+// Benchmark of the kernels in ftkRankFilters.h against the ITK filters
+// they replace, on random 8-bit and 16-bit volumes. For every radius the
+// times of both are printed, with the number of voxels that differ (the
+// median and the box are exact, the octagon approximates the disk).
+
+template< class TPixel >
+typename itk::Image< TPixel, 3 >::Pointer MakeImage( const int size[3], bool random )
+{
+	typedef itk::Image< TPixel, 3 > ImageType;
+	typename ImageType::SizeType imageSize;
+	for(int d=0; d<3; ++d)
+		imageSize[d] = size[d];
+	typename ImageType::RegionType region;
+	region.SetSize( imageSize );
+	typename ImageType::Pointer image = ImageType::New();
+	image->SetRegions( region );
+	image->Allocate();
+	image->FillBuffer( 0 );
+	if( random )
+	{
+		//Smooth blobs plus noise, so the values are not uniform
+		itk::ImageRegionIterator< ImageType > itr( image, region );
+		for(itr.GoToBegin(); !itr.IsAtEnd(); ++itr)
+		{
+			typename ImageType::IndexType idx = itr.GetIndex();
+			double v = 0.5 + 0.25 * std::sin( idx[0] * 0.05 ) * std::cos( idx[1] * 0.07 ) + 0.2 * ( rand() / (double)RAND_MAX );
+			itr.Set( (TPixel)( v * itk::NumericTraits< TPixel >::max() ) );
+		}
+	}
+	return image;
+}
+
+template< class TPixel >
+unsigned long CountDifferences( typename itk::Image< TPixel, 3 >::Pointer a, typename itk::Image< TPixel, 3 >::Pointer b )
+{
+	unsigned long n = a->GetBufferedRegion().GetNumberOfPixels();
+	const TPixel * pa = a->GetBufferPointer();
+	const TPixel * pb = b->GetBufferPointer();
+	unsigned long count = 0;
+	for(unsigned long i=0; i<n; ++i)
+		if( pa[i] != pb[i] )
+			++count;
+	return count;
+}
+
+template< class TPixel >
+void Benchmark( const int size[3], int radius )
+{
+	typedef itk::Image< TPixel, 3 > ImageType;
+	typename ImageType::Pointer input = MakeImage< TPixel >( size, true );
+	typename ImageType::Pointer output = MakeImage< TPixel >( size, false );
+	typename ImageType::SizeType itkRadius;
+	itkRadius[0] = radius;
+	itkRadius[1] = radius;
+	itkRadius[2] = size[2] > 1 ? 1 : 0;
+	int rankRadius[3] = { radius, radius, (int)itkRadius[2] };
+
+	std::cout << sizeof(TPixel) * 8 << "-bit " << size[0] << "x" << size[1] << "x" << size[2]
+		<< ", radius " << radius << "," << radius << "," << itkRadius[2] << std::endl;
+
+	//Median
+	{
+		itk::TimeProbe itkTime, rankTime;
+		typedef itk::MedianImageFilter< ImageType, ImageType > FilterType;
+		typename FilterType::Pointer filter = FilterType::New();
+		filter->SetInput( input );
+		filter->SetRadius( itkRadius );
+		itkTime.Start();
+		filter->Update();
+		itkTime.Stop();
+
+		rankTime.Start();
+		ftk::RankMedian( input->GetBufferPointer(), output->GetBufferPointer(), size, rankRadius );
+		rankTime.Stop();
+
+		std::cout << "  median   itk " << itkTime.GetMeanTime() << "s  ftk " << rankTime.GetMeanTime()
+			<< "s  differences " << CountDifferences< TPixel >( filter->GetOutput(), output ) << std::endl;
+	}
+
+	//Box erosion
+	{
+		itk::TimeProbe itkTime, rankTime;
+		typedef itk::Neighborhood< TPixel, 3 > KernelType;
+		KernelType box;
+		box.SetRadius( itkRadius );
+		for(unsigned int i=0; i<box.Size(); ++i)
+			box[i] = 1;
+		typedef itk::GrayscaleErodeImageFilter< ImageType, ImageType, KernelType > FilterType;
+		typename FilterType::Pointer filter = FilterType::New();
+		filter->SetInput( input );
+		filter->SetKernel( box );
+		itkTime.Start();
+		filter->Update();
+		itkTime.Stop();
+
+		rankTime.Start();
+		ftk::BoxErode( input->GetBufferPointer(), output->GetBufferPointer(), size, rankRadius );
+		rankTime.Stop();
+
+		std::cout << "  box      itk " << itkTime.GetMeanTime() << "s  ftk " << rankTime.GetMeanTime()
+			<< "s  differences " << CountDifferences< TPixel >( filter->GetOutput(), output ) << std::endl;
+	}
+
+	//Disk erosion in every slice, as in the rolling ball filter
+	{
+		itk::TimeProbe itkTime, rankTime;
+		typedef itk::BinaryBallStructuringElement< TPixel, 3 > KernelType;
+		KernelType ball;
+		typename KernelType::SizeType ballRadius;
+		ballRadius[0] = radius;
+		ballRadius[1] = radius;
+		ballRadius[2] = 0;
+		ball.SetRadius( ballRadius );
+		ball.CreateStructuringElement();
+		typedef itk::GrayscaleErodeImageFilter< ImageType, ImageType, KernelType > FilterType;
+		typename FilterType::Pointer filter = FilterType::New();
+		filter->SetInput( input );
+		filter->SetKernel( ball );
+		itkTime.Start();
+		filter->Update();
+		itkTime.Stop();
+
+		rankTime.Start();
+		ftk::DiskErode( input->GetBufferPointer(), output->GetBufferPointer(), size, radius );
+		rankTime.Stop();
+
+		std::cout << "  disk     itk " << itkTime.GetMeanTime() << "s  ftk " << rankTime.GetMeanTime()
+			<< "s  differences " << CountDifferences< TPixel >( filter->GetOutput(), output ) << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if( argc > 1 && argc < 4 )
+	{
+		std::cerr << "Usage: " << argv[0] << " [size_x size_y size_z [radius ...]]" << std::endl;
+		return 1;
+	}
+
+	int size[3] = { 512, 512, 16 };
+	if( argc >= 4 )
+		for(int d=0; d<3; ++d)
+			size[d] = atoi( argv[d+1] );
+
+	std::vector< int > radii;
+	for(int i=4; i<argc; ++i)
+		radii.push_back( atoi( argv[i] ) );
+	if( radii.empty() )
+	{
+		radii.push_back( 2 );
+		radii.push_back( 5 );
+		radii.push_back( 10 );
+	}
+
+	for(unsigned int i=0; i<radii.size(); ++i)
+	{
+		Benchmark< unsigned char >( size, radii[i] );
+		Benchmark< unsigned short >( size, radii[i] );
+	}
+	return 0;
+}
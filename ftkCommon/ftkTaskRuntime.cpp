@@ -0,0 +1,380 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#include "ftkTaskRuntime.h"
+
+#include <iostream>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+#if defined(_MSC_VER)
+#define FTK_THREAD_LOCAL __declspec(thread)
+#else
+#define FTK_THREAD_LOCAL __thread
+#endif
+
+namespace ftk
+{
+
+namespace
+{
+FTK_THREAD_LOCAL int workerId = -1;
+FTK_THREAD_LOCAL int taskDepth = 0;   // tasks running on this thread, nested ones included
+
+struct WorkerArgs
+{
+	TaskRuntime *runtime;
+	int id;
+};
+
+// Marks the thread as running a task for the life of the scope. A thread not
+// owned by the pool also runs with one OpenMP thread meanwhile, and gets its
+// own setting back afterwards (workers keep one thread all the time).
+class InlineTaskScope
+{
+public:
+	InlineTaskScope()
+	{
+		++taskDepth;
+#ifdef _OPENMP
+		m_OmpThreads = 0;
+		if( workerId < 0 )
+		{
+			m_OmpThreads = omp_get_max_threads();
+			omp_set_num_threads( 1 );
+		}
+#endif
+	}
+	~InlineTaskScope()
+	{
+#ifdef _OPENMP
+		if( workerId < 0 )
+			omp_set_num_threads( m_OmpThreads );
+#endif
+		--taskDepth;
+	}
+#ifdef _OPENMP
+private:
+	int m_OmpThreads;
+#endif
+};
+
+int DefaultNumberOfThreads()
+{
+#ifdef _OPENMP
+	return omp_get_num_procs();
+#else
+	return itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+#endif
+}
+}
+
+//*****************************************************************************************
+// TaskGroup
+//*****************************************************************************************
+class TaskGroup::GroupTask : public Task
+{
+public:
+	GroupTask( TaskGroup *group, Task *task ) : m_Group( group ), m_Task( task ) {}
+
+	void Execute()
+	{
+		try
+		{
+			m_Task->Execute();
+		}
+		catch( std::exception &err )
+		{
+			std::cerr << "Exception in task: " << err.what() << std::endl;
+		}
+		catch( ... )
+		{
+			std::cerr << "Unknown exception in task" << std::endl;
+		}
+		delete m_Task;
+
+		TaskRuntime *runtime = TaskRuntime::Instance();
+		runtime->m_SleepLock.Lock();
+		--m_Group->m_Pending;
+		runtime->m_WorkAvailable->Broadcast();
+		runtime->m_SleepLock.Unlock();
+	}
+
+private:
+	TaskGroup *m_Group;
+	Task *m_Task;
+};
+
+TaskGroup::TaskGroup()
+{
+	m_Pending = 0;
+}
+
+TaskGroup::~TaskGroup()
+{
+	this->Wait();
+}
+
+void TaskGroup::Run( Task *task )
+{
+	TaskRuntime *runtime = TaskRuntime::Instance();
+	runtime->m_SleepLock.Lock();
+	++m_Pending;
+	runtime->m_SleepLock.Unlock();
+	runtime->Submit( new GroupTask( this, task ) );
+}
+
+void TaskGroup::Wait()
+{
+	TaskRuntime *runtime = TaskRuntime::Instance();
+	while( true )
+	{
+		runtime->m_SleepLock.Lock();
+		long pending = m_Pending;
+		runtime->m_SleepLock.Unlock();
+		if( pending == 0 )
+			break;
+		// help instead of blocking: this is what makes nested loops safe
+		if( !runtime->RunOneTask() )
+			runtime->WaitForWork( this );
+	}
+}
+
+//*****************************************************************************************
+// TaskRuntime
+//*****************************************************************************************
+TaskRuntime *TaskRuntime::Instance()
+{
+	// never destroyed: workers may still sleep on it while the process exits
+	static TaskRuntime *instance = new TaskRuntime();
+	return instance;
+}
+
+TaskRuntime::TaskRuntime()
+{
+	m_NumberOfThreads = DefaultNumberOfThreads();
+	m_Running = false;
+	m_Stop = false;
+	m_QueuedTasks = 0;
+	m_WorkAvailable = itk::ConditionVariable::New();
+}
+
+TaskRuntime::~TaskRuntime()
+{
+	this->Shutdown();
+}
+
+void TaskRuntime::SetNumberOfThreads( int numThreads )
+{
+	TaskRuntime *runtime = Instance();
+	if( numThreads <= 0 )
+		numThreads = DefaultNumberOfThreads();
+	if( numThreads == runtime->m_NumberOfThreads )
+		return;
+	runtime->Shutdown();
+	runtime->m_NumberOfThreads = numThreads;
+}
+
+int TaskRuntime::GetNumberOfThreads()
+{
+	return Instance()->m_NumberOfThreads;
+}
+
+void TaskRuntime::SetStageLimit( const std::string &stage, int limit )
+{
+	TaskRuntime *runtime = Instance();
+	runtime->m_StageLock.Lock();
+	runtime->m_StageLimits[stage] = limit;
+	runtime->m_StageLock.Unlock();
+}
+
+int TaskRuntime::GetStageLimit( const std::string &stage )
+{
+	TaskRuntime *runtime = Instance();
+	runtime->m_StageLock.Lock();
+	std::map< std::string, int >::const_iterator it = runtime->m_StageLimits.find( stage );
+	int limit = it == runtime->m_StageLimits.end() ? 0 : it->second;
+	runtime->m_StageLock.Unlock();
+	return limit;
+}
+
+int TaskRuntime::GetWorkerId()
+{
+	return workerId;
+}
+
+bool TaskRuntime::IsInTask()
+{
+	return taskDepth > 0;
+}
+
+void TaskRuntime::RunInline( Task *task )
+{
+	InlineTaskScope scope;
+	task->Execute();
+}
+
+void TaskRuntime::Start( int numThreads )
+{
+	// the thread that waits on a group is a worker too, so spawn one less
+	int numWorkers = numThreads - 1;
+	if( numWorkers > ITK_MAX_THREADS - 1 )
+		numWorkers = ITK_MAX_THREADS - 1;
+	if( numWorkers < 0 )
+		numWorkers = 0;
+
+	m_Stop = false;
+	m_Queues.resize( numWorkers + 1 );
+	for( unsigned int q = 0; q < m_Queues.size(); ++q )
+		m_Queues[q] = new WorkQueue;
+
+	m_Threader = itk::MultiThreader::New();
+	m_ThreadIds.resize( numWorkers );
+	for( int w = 0; w < numWorkers; ++w )
+	{
+		WorkerArgs *args = new WorkerArgs;
+		args->runtime = this;
+		args->id = w;
+		m_ThreadIds[w] = m_Threader->SpawnThread( WorkerThread, args );
+	}
+	m_Running = true;
+}
+
+void TaskRuntime::Shutdown()
+{
+	if( !m_Running )
+		return;
+
+	m_SleepLock.Lock();
+	m_Stop = true;
+	m_WorkAvailable->Broadcast();
+	m_SleepLock.Unlock();
+
+	for( unsigned int w = 0; w < m_ThreadIds.size(); ++w )
+		m_Threader->TerminateThread( m_ThreadIds[w] );
+	m_ThreadIds.clear();
+
+	for( unsigned int q = 0; q < m_Queues.size(); ++q )
+	{
+		// nothing should be left, but do not leak if it is
+		for( unsigned int t = 0; t < m_Queues[q]->tasks.size(); ++t )
+			delete m_Queues[q]->tasks[t];
+		delete m_Queues[q];
+	}
+	m_Queues.clear();
+	m_QueuedTasks = 0;
+	m_Running = false;
+}
+
+void TaskRuntime::Submit( Task *task )
+{
+	m_SleepLock.Lock();
+	if( !m_Running )
+		this->Start( m_NumberOfThreads );
+	m_SleepLock.Unlock();
+
+	// workers push on their own deque, outside threads on the shared one
+	WorkQueue *queue = workerId >= 0 ? m_Queues[workerId] : m_Queues.back();
+	queue->lock.Lock();
+	queue->tasks.push_back( task );
+	queue->lock.Unlock();
+
+	m_SleepLock.Lock();
+	++m_QueuedTasks;
+	m_WorkAvailable->Broadcast();
+	m_SleepLock.Unlock();
+}
+
+bool TaskRuntime::RunOneTask()
+{
+	Task *task = NULL;
+	int numQueues = m_Queues.size();
+	if( numQueues == 0 )
+		return false;
+
+	// own deque first (LIFO, cache friendly), then steal the oldest work (FIFO)
+	if( workerId >= 0 )
+	{
+		WorkQueue *own = m_Queues[workerId];
+		own->lock.Lock();
+		if( !own->tasks.empty() )
+		{
+			task = own->tasks.back();
+			own->tasks.pop_back();
+		}
+		own->lock.Unlock();
+	}
+	int start = workerId >= 0 ? workerId + 1 : 0;
+	for( int q = 0; q < numQueues && !task; ++q )
+	{
+		WorkQueue *victim = m_Queues[( start + q ) % numQueues];
+		victim->lock.Lock();
+		if( !victim->tasks.empty() )
+		{
+			task = victim->tasks.front();
+			victim->tasks.pop_front();
+		}
+		victim->lock.Unlock();
+	}
+	if( !task )
+		return false;
+
+	m_SleepLock.Lock();
+	--m_QueuedTasks;
+	m_SleepLock.Unlock();
+
+	// a thread helping from TaskGroup::Wait runs the task like the workers do
+	this->RunInline( task );
+	delete task;
+	return true;
+}
+
+void TaskRuntime::WaitForWork( TaskGroup *group )
+{
+	m_SleepLock.Lock();
+	while( m_QueuedTasks == 0 && !m_Stop && ( !group || group->m_Pending > 0 ) )
+		m_WorkAvailable->Wait( &m_SleepLock );
+	m_SleepLock.Unlock();
+}
+
+ITK_THREAD_RETURN_TYPE TaskRuntime::WorkerThread( void *arg )
+{
+	itk::MultiThreader::ThreadInfoStruct *info = static_cast< itk::MultiThreader::ThreadInfoStruct * >( arg );
+	WorkerArgs *args = static_cast< WorkerArgs * >( info->UserData );
+	TaskRuntime *runtime = args->runtime;
+	workerId = args->id;
+	delete args;
+#ifdef _OPENMP
+	// the pool already has one thread per core: OpenMP loops inside the tasks
+	// (binarization, local maxima, tracing) run serially on the worker
+	omp_set_num_threads( 1 );
+#endif
+
+	while( true )
+	{
+		runtime->m_SleepLock.Lock();
+		bool stop = runtime->m_Stop;
+		runtime->m_SleepLock.Unlock();
+		if( stop )
+			break;
+		if( !runtime->RunOneTask() )
+			runtime->WaitForWork( NULL );
+	}
+	workerId = -1;
+	return ITK_THREAD_RETURN_VALUE;
+}
+
+}  // end namespace ftk
@@ -0,0 +1,242 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#ifndef __ftkTaskRuntime_h
+#define __ftkTaskRuntime_h
+
+// One work-stealing thread pool shared by the whole process.
+//
+// Every worker owns a deque: it pushes and pops its own tasks at the back and
+// steals from the front of the other deques when it runs dry. Threads that wait
+// on a TaskGroup execute pending tasks instead of blocking, so nested
+// ParallelFor calls (tiles -> scales -> blocks) reuse the same workers and the
+// process never runs more than GetNumberOfThreads() threads of pipeline work.
+//
+// Stages are named ("segment", "trace", ...). A stage limit caps how many
+// iterations of that stage's ParallelFor run at the same time, e.g. to bound
+// the memory of concurrently processed tiles; the remaining workers are free
+// to steal the inner loops of the running ones.
+//
+// Tasks, and the share of a ParallelFor run by the calling thread, run with
+// omp_set_num_threads(1), so OpenMP loops inside them do not start a team per
+// worker on top of the pool. IsInTask() tells code inside them (e.g. how many
+// ITK threads to give a filter) that the other workers are busy too.
+
+#include <itkMultiThreader.h>
+#include <itkMutexLock.h>
+#include <itkConditionVariable.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ftk
+{
+
+class Task
+{
+public:
+	virtual ~Task() {}
+	virtual void Execute() = 0;
+};
+
+class TaskGroup;
+
+class TaskRuntime
+{
+public:
+	static TaskRuntime *Instance();
+
+	// 0 uses the number of processors. Takes effect when no task is running.
+	static void SetNumberOfThreads( int numThreads );
+	static int GetNumberOfThreads();
+
+	// Maximum number of iterations of a stage running concurrently (0 = no limit)
+	static void SetStageLimit( const std::string &stage, int limit );
+	static int GetStageLimit( const std::string &stage );
+
+	// Index of the calling worker, -1 for threads not owned by the pool
+	static int GetWorkerId();
+	// True while the calling thread runs a task or its share of a ParallelFor
+	static bool IsInTask();
+
+	// Runs the task on the calling thread the way the workers run theirs.
+	// The caller keeps ownership of the task.
+	void RunInline( Task *task );
+
+	void Submit( Task *task );
+	void Shutdown();
+
+protected:
+	friend class TaskGroup;
+
+	TaskRuntime();
+	~TaskRuntime();
+
+	void Start( int numThreads );
+	bool RunOneTask();
+	void WaitForWork( TaskGroup *group );
+
+	static ITK_THREAD_RETURN_TYPE WorkerThread( void *arg );
+
+	struct WorkQueue
+	{
+		itk::SimpleMutexLock lock;
+		std::deque< Task * > tasks;
+	};
+
+	int m_NumberOfThreads;
+	bool m_Running;
+	bool m_Stop;
+	std::vector< WorkQueue * > m_Queues;   // one per worker, the last one is shared by outside threads
+	std::vector< int > m_ThreadIds;
+	itk::MultiThreader::Pointer m_Threader;
+
+	// sleeping workers and waiting groups
+	itk::SimpleMutexLock m_SleepLock;
+	itk::ConditionVariable::Pointer m_WorkAvailable;
+	long m_QueuedTasks;
+
+	itk::SimpleMutexLock m_StageLock;
+	std::map< std::string, int > m_StageLimits;
+};
+
+// Runs tasks and waits for all of them; Wait() helps execute queued work.
+class TaskGroup
+{
+public:
+	TaskGroup();
+	~TaskGroup();
+
+	// The group takes ownership of the task
+	void Run( Task *task );
+	void Wait();
+
+protected:
+	friend class TaskRuntime;
+	class GroupTask;
+
+	long m_Pending;
+};
+
+// Serializes short critical sections inside tasks (file IO, shared counters)
+class TaskMutex
+{
+public:
+	void Lock() { m_Lock.Lock(); }
+	void Unlock() { m_Lock.Unlock(); }
+private:
+	itk::SimpleMutexLock m_Lock;
+};
+
+class TaskLock
+{
+public:
+	TaskLock( TaskMutex &mutex ) : m_Mutex( mutex ) { m_Mutex.Lock(); }
+	~TaskLock() { m_Mutex.Unlock(); }
+private:
+	TaskMutex &m_Mutex;
+};
+
+// ParallelFor helpers: a fixed number of runners claim chunks of `grain`
+// iterations from a shared counter, which load-balances irregular iterations.
+template< class TBody >
+class ParallelForRunner : public Task
+{
+public:
+	ParallelForRunner( const TBody &body, int end, int grain, int *next, TaskMutex *mutex )
+		: m_Body( body ), m_End( end ), m_Grain( grain ), m_Next( next ), m_Mutex( mutex ) {}
+
+	void Execute()
+	{
+		while( true )
+		{
+			int first;
+			{
+				TaskLock lock( *m_Mutex );
+				first = *m_Next;
+				*m_Next += m_Grain;
+			}
+			if( first >= m_End )
+				break;
+			int last = first + m_Grain < m_End ? first + m_Grain : m_End;
+			for( int i = first; i < last; ++i )
+				m_Body( i );
+		}
+	}
+
+private:
+	const TBody &m_Body;
+	int m_End;
+	int m_Grain;
+	int *m_Next;
+	TaskMutex *m_Mutex;
+};
+
+// Adapts a member function void T::method(int) to a ParallelFor body, so the
+// drivers can keep a tile body next to the rest of their members.
+template< class TObject >
+class MemberBody
+{
+public:
+	typedef void (TObject::*MethodType)( int );
+
+	MemberBody( TObject *object, MethodType method ) : m_Object( object ), m_Method( method ) {}
+	void operator()( int i ) const { ( m_Object->*m_Method )( i ); }
+
+private:
+	TObject *m_Object;
+	MethodType m_Method;
+};
+
+// Calls body(i) for i in [begin, end). The body must be callable as a const
+// functor and is shared by all runners. Blocks until all iterations are done.
+template< class TBody >
+void ParallelFor( int begin, int end, const TBody &body, int grain = 1, const std::string &stage = "" )
+{
+	if( end <= begin )
+		return;
+	if( grain < 1 )
+		grain = 1;
+
+	int chunks = ( end - begin + grain - 1 ) / grain;
+	int runners = TaskRuntime::GetNumberOfThreads();
+	int limit = stage.empty() ? 0 : TaskRuntime::GetStageLimit( stage );
+	if( limit > 0 && limit < runners )
+		runners = limit;
+	if( chunks < runners )
+		runners = chunks;
+
+	int next = begin;
+	TaskMutex mutex;
+	if( runners <= 1 )
+	{
+		ParallelForRunner< TBody > runner( body, end, grain, &next, &mutex );
+		runner.Execute();
+		return;
+	}
+
+	TaskGroup group;
+	for( int r = 1; r < runners; ++r )
+		group.Run( new ParallelForRunner< TBody >( body, end, grain, &next, &mutex ) );
+	// the calling thread is one of the runners, and runs its share like a task
+	ParallelForRunner< TBody > runner( body, end, grain, &next, &mutex );
+	TaskRuntime::Instance()->RunInline( &runner );
+	group.Wait();
+}
+
+}  // end namespace ftk
+
+#endif
@@ -32,6 +32,7 @@ IntrinsicFeatureCalculator::IntrinsicFeatureCalculator()
 	useRegion = false;
 	useIDs = false;
 	IDs.clear();
+	rowIndex = NULL;
 }
 
 bool IntrinsicFeatureCalculator::SetInputImages(ftk::Image::Pointer intImg, ftk::Image::Pointer labImg, int intChannel, int labChannel, bool CytoImage)
@@ -402,6 +403,12 @@ void IntrinsicFeatureCalculator::Update(vtkSmartPointer<vtkTable> table, std::ma
 		}
 	}
 	//Now update the table:
+	//Look the ids up through an index instead of scanning the table for every label
+	TableRowIndex localIndex;
+	TableRowIndex * index = rowIndex ? rowIndex : &localIndex;
+	if(table)
+		index->Attach(table);
+
 	std::vector< FeatureCalcType::LabelPixelType > labels = labFilter->GetLabels();
 	for (int i=0; i<(int)labels.size(); ++i)
 	{
@@ -414,15 +421,7 @@ void IntrinsicFeatureCalculator::Update(vtkSmartPointer<vtkTable> table, std::ma
 
 		if(table)
 		{
-			int row = -1;
-			for(int r=0; r<table->GetNumberOfRows(); ++r)
-			{
-				if( table->GetValue(r,0) == id )
-				{
-					row = r;
-					break;
-				}
-			}
+			vtkIdType row = index->FindRow(id);
 
 			//Must Create a new row:
 			if(row == -1)
@@ -430,9 +429,8 @@ void IntrinsicFeatureCalculator::Update(vtkSmartPointer<vtkTable> table, std::ma
 				vtkSmartPointer<vtkVariantArray> nrow = vtkSmartPointer<vtkVariantArray>::New();
 				for( unsigned ii=0; ii<table->GetNumberOfColumns(); ++ii )
 					nrow->InsertNextValue( vtkVariant(0.0) );
-				table->InsertNextRow(nrow);
-				row = table->GetNumberOfRows() - 1;
-				table->SetValue(row, 0, vtkVariant(id));
+				nrow->SetValue(0, vtkVariant(id));
+				row = index->AppendRow(nrow);
 			}
 
 			//Update table:
@@ -540,6 +538,10 @@ void IntrinsicFeatureCalculator::Append(vtkSmartPointer<vtkTable> table)
 	}
 
 	//Now update the table:
+	TableRowIndex localIndex;
+	TableRowIndex * index = rowIndex ? rowIndex : &localIndex;
+	index->Attach(table);
+
 	std::vector< FeatureCalcType::LabelPixelType > labels = labFilter->GetLabels();
 	for (int i=0; i<(int)labels.size(); ++i)
 	{
@@ -548,15 +550,7 @@ void IntrinsicFeatureCalculator::Append(vtkSmartPointer<vtkTable> table)
 		if(useIDs)
 			if(IDs.find(id) == IDs.end()) continue;	//Don't care about this id, so skip it
 
-		int row = -1;
-		for(int r=0; r<table->GetNumberOfRows(); ++r)
-		{
-			if( table->GetValue(r,0) == id )
-			{
-				row = r;
-				break;
-			}
-		}
+		vtkIdType row = index->FindRow(id);
 
 		ftk::IntrinsicFeatures * features = labFilter->GetFeatures(id);
 
@@ -566,9 +560,8 @@ void IntrinsicFeatureCalculator::Append(vtkSmartPointer<vtkTable> table)
 			vtkSmartPointer<vtkVariantArray> nrow = vtkSmartPointer<vtkVariantArray>::New();
 			for( unsigned ii=0; ii<table->GetNumberOfColumns(); ++ii )
 				nrow->InsertNextValue( vtkVariant(0.0) );
-			table->InsertNextRow(nrow);
-			row = table->GetNumberOfRows() - 1;
-			table->SetValue(row, 0, vtkVariant(id));
+			nrow->SetValue(0, vtkVariant(id));
+			row = index->AppendRow(nrow);
 		}
 
 		for (int f=0; f<IntrinsicFeatures::N; ++f)
@@ -32,7 +32,6 @@ limitations under the License.
 
 #include <itkLabelGeometryImageFilter.h>
 #include <itkLabelStatisticsImageFilter.h>
-#include <itkScalarImageToTextureFeaturesFilter.h>
 #include <itkGradientMagnitudeImageFilter.h>
 #include <itkSignedDanielssonDistanceMapImageFilter.h>
 #include <itkLineIterator.h>
@@ -60,6 +59,8 @@ limitations under the License.
 
 #include "ftkIntrinsicFeatures.h"
 #include "ftkObject.h"
+#include "ftkTableRowIndex.h"
+#include "ftkTextureFeatures.h"
 #include "ftkImage/ftkImage.h"
 
 #ifdef ZERNIKE
@@ -91,6 +92,7 @@ public:
 	void SetIDs(std::set<LPixelT> ids);					//Only update these ids
 	void ClearRegion(void){ useRegion = false; };		//Clear the Region;
 	void ClearIDs(void){ useIDs = false; IDs.clear(); };//Clear the IDs;
+	void SetRowIndex(TableRowIndex * index){ rowIndex = index; };	//Find and add rows of the table passed to Update through this index
 
 	vtkSmartPointer<vtkTable> Compute(void);			//Compute features that are ON and return table with values (for all objects)
 	//void Update(vtkSmartPointer<vtkTable> table);		//Update the features in this table whose names match (sets doFeat)
@@ -114,6 +116,7 @@ private:
 	LPixelT regionSize[3];
 	bool useIDs;
 	std::set<LPixelT> IDs;
+	TableRowIndex * rowIndex;
 
 
 	int getMaxFeatureTurnedOn(void);
@@ -192,7 +195,6 @@ private:
 	bool RunLabelGeometryFilter();
 	bool RunLabelStatisticsFilter();
 	bool RunTextureFilter();
-	bool RunTextureFilter2D();
 	void RunZernikeFilter();
 	void LabelImageScan();
 	void CalculateScanFeatures();
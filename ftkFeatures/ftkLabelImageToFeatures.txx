@@ -1137,7 +1137,12 @@ void LabelImageToFeatures< TIPixel, TLPixel, VImageDimension>
 }
 
 //**************************************************************************
-// RUN THE ITK TEXTURE FILTER
+// RUN THE TEXTURE FILTER
+// All objects are done together by TextureFeatures, with the same values as
+// itk::ScalarImageToTextureFeaturesFilter run on every object's bounding box
+// (fast calculations, intensity rescaled to 0..255, the object as mask).
+// 2D images need no special case: the offsets along an axis of size 1 are
+// left out, which gives the 2D offsets.
 //**************************************************************************
 template< typename TIPixel, typename TLPixel, unsigned int VImageDimension >
 bool LabelImageToFeatures< TIPixel, TLPixel, VImageDimension >
@@ -1145,228 +1150,48 @@ bool LabelImageToFeatures< TIPixel, TLPixel, VImageDimension >
 {
 	if(!intensityImage || !labelImage) return false;
 	if(!labels.size()) return false;
-	if(	labelImage->GetLargestPossibleRegion().GetSize()[0]==1 ||
-		labelImage->GetLargestPossibleRegion().GetSize()[1]==1 ||
-		labelImage->GetLargestPossibleRegion().GetSize()[2]==1	)
-  {
-    return this->RunTextureFilter2D(); 
-  }
-    
-	LabelImagePointer tempIntensityImage;
 
-	typedef itk::RescaleIntensityImageFilter< IntensityImageType, LabelImageType > RescaleFilterType;
+	typedef itk::Image< unsigned char, VImageDimension > GrayImageType;
+	typedef itk::RescaleIntensityImageFilter< IntensityImageType, GrayImageType > RescaleFilterType;
 	typedef typename RescaleFilterType::Pointer RescaleFilterPointer;
 	RescaleFilterPointer rescaleFilter = RescaleFilterType::New();
 	rescaleFilter->SetOutputMinimum(0);
 	rescaleFilter->SetOutputMaximum(255);
 	rescaleFilter->SetInput(intensityImage);
-	rescaleFilter->Update();
-	tempIntensityImage = rescaleFilter->GetOutput();
-	
-	typedef itk::Statistics::ScalarImageToTextureFeaturesFilter< LabelImageType > TextureCalcType;
-	typedef typename TextureCalcType::Pointer TextureCalcPointer;
-	TextureCalcPointer textureCalculator = TextureCalcType::New();
-	textureCalculator->SetInput(tempIntensityImage);
-	textureCalculator->SetMaskImage(labelImage);
-	textureCalculator->SetPixelValueMinMax(0,255);
-	textureCalculator->SetFastCalculations(true);
-	
-	/*typedef itk::ImageFileWriter<LabelImageType> LabelImageFileWriterType;
-	typedef LabelImageFileWriterType::Pointer LabelImageFileWriter;
-	LabelImageFileWriter label_image_file_writer = LabelImageFileWriterType::New();
-	
-	label_image_file_writer->SetFileName("labelImage.tif");
-	label_image_file_writer->SetInput(labelImage);
-
 	try
 	{
-		label_image_file_writer->Update();
+		rescaleFilter->Update();
 	}
 	catch (itk::ExceptionObject &err)
 	{
-		std::cerr << "label_image_file_writer error: " << err << std::endl;
-		//throw std::exception;
+		std::cerr << "Exception in Rescale Intensity Filter for the texture features: " << err << std::endl;
+		return false;
 	}
 
-	label_image_file_writer->SetFileName("tempIntensityImage.tif");
-	label_image_file_writer->SetInput(tempIntensityImage);
+	int size[3] = { 1, 1, 1 };
+	typename LabelImageType::SizeType labelSize = labelImage->GetLargestPossibleRegion().GetSize();
+	for (unsigned int dim=0; dim<VImageDimension && dim<3; dim++)
+		size[dim] = (int)labelSize[dim];
 
-	try
-	{
-		label_image_file_writer->Update();
-	}
-	catch (itk::ExceptionObject &err)
-	{
-		std::cerr << "label_image_file_writer error: " << err << std::endl;
-		//throw std::exception;
-	}*/
-	
-	TLPixel currentLabel;
-	for (int lab=0; lab<(int)labels.size(); ++lab)
-	{
-		currentLabel = labels.at(lab);
-		if ((int)currentLabel <= 0) continue;
-		
-		typename LabelImageType::RegionType region;
-		typename LabelImageType::SizeType size;
-		typename LabelImageType::IndexType index;
-
-		int loc = 0;
-		for (unsigned int dim=0; dim<VImageDimension; dim++)
-		{
-			index[dim] = (long int)this->featureVals[currentLabel].BoundingBox[loc];	//bbox min
-			size[dim] = (long unsigned int)this->featureVals[currentLabel].BoundingBox[loc+1]- index[dim] + 1;	//bbox max - min + 1
-			loc += 2;
-		}
-
-        region.SetSize(size);
-        region.SetIndex(index);
-        labelImage->SetRequestedRegion(region);
-        tempIntensityImage->SetRequestedRegion(region);
-		textureCalculator->SetInsidePixelValue( currentLabel );
-		
-		try
-		{
-			textureCalculator->Update();
-		}
-		catch (itk::ExceptionObject &err)
-		{
-			std::cerr << "textureCalculator error: " << err << std::endl;
-		}
-		/*
-		FeatureValueVector * 	GetFeatureMeans ()
-		FeatureValueVector * 	GetFeatureStandardDeviations ()
-		const FeatureNameVector * 	GetRequestedFeatures ()
-		SetRequestedFeatures (const FeatureNameVector *_arg)
-		*/
-		
-		typename TextureCalcType::FeatureValueVector *tex = textureCalculator->GetFeatureMeans();
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::T_ENERGY] = float( tex->ElementAt(0) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::T_ENTROPY] = float( tex->ElementAt(1) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::INVERSE_DIFFERENCE_MOMENT] = float( tex->ElementAt(2) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::INERTIA] = float( tex->ElementAt(3) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::CLUSTER_SHADE] = float( tex->ElementAt(4) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::CLUSTER_PROMINENCE] = float( tex->ElementAt(5) );
-	}
-	
-	tempIntensityImage = 0;
-	return true;
-}
+	TextureFeatures< TLPixel > textureCalculator;
+	textureCalculator.SetInput(rescaleFilter->GetOutput()->GetBufferPointer(), labelImage->GetBufferPointer(), size);
+	textureCalculator.SetLabels(labels);
+	textureCalculator.Update();
 
-//**************************************************************************
-// RUN THE ITK TEXTURE FILTER FOR A 2D IMAGE
-//**************************************************************************
-template< typename TIPixel, typename TLPixel, unsigned int VImageDimension >
-bool LabelImageToFeatures< TIPixel, TLPixel, VImageDimension >
-::RunTextureFilter2D()
-{
-	
-  //define our 2D image types
-  typedef itk::Image< IntensityPixelType, 2 > IntensityImageType2D;
-	typedef typename IntensityImageType2D::Pointer IntensityImagePointer2D;
-	typedef itk::Image< LabelPixelType, 2 > LabelImageType2D;
-	typedef typename LabelImageType2D::Pointer LabelImagePointer2D;
-	
-  //recast labelImage into two dimensions
-  typename LabelImageType::IndexType labelStart;
-  labelStart.Fill(0);
-  typename LabelImageType::SizeType labelSize; 
-  labelSize = labelImage->GetLargestPossibleRegion().GetSize();
-  labelSize[2] = 0;  //this tells the filter to collapse the Z-dimension
-  
-  typename LabelImageType::RegionType labelRegion;
-  labelRegion.SetSize(labelSize);
-  labelRegion.SetIndex(labelStart);
-
-  typedef itk::ExtractImageFilter< LabelImageType, LabelImageType2D >
-    ExtractLabelFilterType;
-  typename ExtractLabelFilterType::Pointer extractLabel = ExtractLabelFilterType::New();
-  extractLabel->SetExtractionRegion(labelRegion);
-  extractLabel->SetInput(labelImage);
-  extractLabel->SetDirectionCollapseToIdentity(); // This is required.
-  extractLabel->Update();
-  LabelImagePointer2D labelImage2D = extractLabel->GetOutput();
-
-  //do the same for intensityImage
-  typename IntensityImageType::IndexType intensityStart;
-  intensityStart.Fill(0);
-  typename IntensityImageType::SizeType intensitySize;
-  intensitySize = intensityImage->GetLargestPossibleRegion().GetSize();
-  intensitySize[2] = 0;  //this tells the filter to collapse the Z-dimension
-  
-  typename IntensityImageType::RegionType intensityRegion;
-  intensityRegion.SetSize(intensitySize);
-  intensityRegion.SetIndex(intensityStart);
-
-  typedef itk::ExtractImageFilter< IntensityImageType, IntensityImageType2D >
-    ExtractIntensityFilterType;
-  typename ExtractIntensityFilterType::Pointer extractIntensity = ExtractIntensityFilterType::New();
-  extractIntensity->SetExtractionRegion(intensityRegion);
-  extractIntensity->SetInput(intensityImage);
-  extractIntensity->SetDirectionCollapseToIdentity(); // This is required.
-  extractIntensity->Update();
-  IntensityImagePointer2D intensityImage2D = extractIntensity->GetOutput();
-
-	typedef itk::RescaleIntensityImageFilter< IntensityImageType2D, LabelImageType2D > RescaleFilterType;
-	typedef typename RescaleFilterType::Pointer RescaleFilterPointer;
-	RescaleFilterPointer rescaleFilter = RescaleFilterType::New();
-	rescaleFilter->SetOutputMinimum(0);
-	rescaleFilter->SetOutputMaximum(255);
-	rescaleFilter->SetInput(intensityImage2D);
-	rescaleFilter->Update();
-	LabelImagePointer2D tempIntensityImage2D = rescaleFilter->GetOutput();
-	
-	typedef itk::Statistics::ScalarImageToTextureFeaturesFilter< LabelImageType2D > TextureCalcType;
-	typedef typename TextureCalcType::Pointer TextureCalcPointer;
-	TextureCalcPointer textureCalculator = TextureCalcType::New();
-	textureCalculator->SetInput(tempIntensityImage2D);
-	textureCalculator->SetMaskImage(labelImage2D);
-	textureCalculator->SetPixelValueMinMax(0,255);
-	textureCalculator->SetFastCalculations(true);
-	
-	TLPixel currentLabel;
+	typedef TextureFeatures< TLPixel > TextureType;
 	for (int lab=0; lab<(int)labels.size(); ++lab)
 	{
-		currentLabel = labels.at(lab);
+		TLPixel currentLabel = labels.at(lab);
 		if ((int)currentLabel <= 0) continue;
-		
-		typename LabelImageType2D::RegionType region;
-		typename LabelImageType2D::SizeType size;
-		typename LabelImageType2D::IndexType index;
-
-		int loc = 0;
-		for (unsigned int dim=0; dim<2; dim++)
-		{
-			index[dim] = (long int)this->featureVals[currentLabel].BoundingBox[loc];	//bbox min
-			size[dim] = (long unsigned int)this->featureVals[currentLabel].BoundingBox[loc+1]- index[dim] + 1;	//bbox max - min + 1
-			loc += 2;
-		}
 
-        region.SetSize(size);
-        region.SetIndex(index);
-        labelImage2D->SetRequestedRegion(region);
-        tempIntensityImage2D->SetRequestedRegion(region);
-		textureCalculator->SetInsidePixelValue( currentLabel );
-		
-		try
-		{
-			textureCalculator->Update();
-		}
-		catch (itk::ExceptionObject &err)
-		{
-			std::cerr << "textureCalculator error: " << err << std::endl;
-		}
-		
-		typename TextureCalcType::FeatureValueVector *tex = textureCalculator->GetFeatureMeans();
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::T_ENERGY] = float( tex->ElementAt(0) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::T_ENTROPY] = float( tex->ElementAt(1) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::INVERSE_DIFFERENCE_MOMENT] = float( tex->ElementAt(2) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::INERTIA] = float( tex->ElementAt(3) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::CLUSTER_SHADE] = float( tex->ElementAt(4) );
-		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::CLUSTER_PROMINENCE] = float( tex->ElementAt(5) );
+		const double *tex = textureCalculator.GetFeatures(lab);
+		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::T_ENERGY] = float( tex[TextureType::ENERGY] );
+		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::T_ENTROPY] = float( tex[TextureType::ENTROPY] );
+		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::INVERSE_DIFFERENCE_MOMENT] = float( tex[TextureType::INVERSE_DIFFERENCE_MOMENT] );
+		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::INERTIA] = float( tex[TextureType::INERTIA] );
+		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::CLUSTER_SHADE] = float( tex[TextureType::CLUSTER_SHADE] );
+		featureVals[currentLabel].ScalarFeatures[IntrinsicFeatures::CLUSTER_PROMINENCE] = float( tex[TextureType::CLUSTER_PROMINENCE] );
 	}
-	
-	tempIntensityImage2D = 0;
 	return true;
 }
 
@@ -1449,8 +1274,8 @@ void LabelImageToFeatures< TIPixel, TLPixel, VImageDimension >
 				}
 			}
 			
-			zernike* myzernike = new zernike( zerImg, zernikeOrder);
-			IDtoZernikeMap[label] = myzernike->GetZernike();		
+			zernike myzernike( zerImg, zernikeOrder);
+			IDtoZernikeMap[label] = myzernike.GetZernike();
 	
 		}
 	}
@@ -0,0 +1,244 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#include "ftkTableRowIndex.h"
+
+#include <vtkAbstractArray.h>
+
+#include <algorithm>
+
+namespace ftk
+{
+
+TableRowIndex::TableRowIndex()
+{
+	table = NULL;
+	keyColumns[0] = 0;
+	keyColumns[1] = -1;
+	numDead = 0;
+}
+
+void TableRowIndex::SetKeyColumns(int first, int second)
+{
+	keyColumns[0] = first;
+	keyColumns[1] = second;
+	if(table)
+		this->Rebuild();
+}
+
+void TableRowIndex::Attach(vtkTable * t)
+{
+	if(t != table.GetPointer())
+	{
+		table = t;
+		dead.clear();
+		numDead = 0;
+		this->Rebuild();
+	}
+	else
+	{
+		this->Sync();
+	}
+}
+
+//Dead rows stay dead while the table keeps its number of rows; a table of
+//another length was edited behind our back and every row is live again
+void TableRowIndex::Rebuild(void)
+{
+	rows.clear();
+	if(!table || table->GetNumberOfRows() != (vtkIdType)dead.size())
+	{
+		dead.clear();
+		numDead = 0;
+	}
+	if(table)
+		this->IndexRows(0);
+}
+
+//Rows appended by others are indexed, a shorter table means it was edited behind our back
+void TableRowIndex::Sync(void)
+{
+	if(!table)
+		return;
+	vtkIdType numRows = table->GetNumberOfRows();
+	if(numRows < (vtkIdType)dead.size())
+		this->Rebuild();
+	else if(numRows > (vtkIdType)dead.size())
+		this->IndexRows((vtkIdType)dead.size());
+}
+
+void TableRowIndex::IndexRows(vtkIdType first)
+{
+	vtkIdType numRows = table->GetNumberOfRows();
+	int numColumns = (int)table->GetNumberOfColumns();
+	dead.resize(numRows, 0);
+	for(vtkIdType row=first; row<numRows; ++row)
+	{
+		if(dead[row]) continue;
+		for(int k=0; k<2; ++k)
+		{
+			if(keyColumns[k] < 0 || keyColumns[k] >= numColumns) continue;
+			if(k == 1 && keyColumns[1] == keyColumns[0]) continue;
+			rows.insert( std::make_pair(table->GetValue(row,keyColumns[k]).ToInt(), row) );
+		}
+	}
+}
+
+bool TableRowIndex::IsKeyColumn(int column)
+{
+	return column >= 0 && (column == keyColumns[0] || column == keyColumns[1]);
+}
+
+void TableRowIndex::FindRows(int id, std::vector<vtkIdType> & found)
+{
+	found.clear();
+	this->Sync();
+	for(int attempt=0; attempt<2; ++attempt)
+	{
+		bool stale = false;
+		std::pair< std::multimap<int, vtkIdType>::iterator, std::multimap<int, vtkIdType>::iterator > range = rows.equal_range(id);
+		for(std::multimap<int, vtkIdType>::iterator it=range.first; it!=range.second; ++it)
+		{
+			vtkIdType row = (*it).second;
+			//A row with the same id in both key columns is indexed twice
+			if(std::find(found.begin(), found.end(), row) != found.end()) continue;
+			bool match = false;
+			for(int k=0; k<2; ++k)
+			{
+				if(keyColumns[k] < 0 || keyColumns[k] >= (int)table->GetNumberOfColumns()) continue;
+				if(table->GetValue(row,keyColumns[k]).ToInt() == id)
+					match = true;
+			}
+			if(!match)
+			{
+				stale = true;
+				break;
+			}
+			found.push_back(row);
+		}
+		if(!stale)
+			break;
+
+		//Someone rewrote the table with the same number of rows:
+		found.clear();
+		this->Rebuild();
+	}
+	std::sort(found.begin(), found.end());
+}
+
+vtkIdType TableRowIndex::FindRow(int id)
+{
+	std::vector<vtkIdType> found;
+	this->FindRows(id, found);
+	if(found.empty())
+		return -1;
+	return found.at(0);
+}
+
+vtkIdType TableRowIndex::AppendRow(vtkVariantArray * row)
+{
+	this->Sync();
+	table->InsertNextRow(row);
+	this->IndexRows((vtkIdType)dead.size());
+	return table->GetNumberOfRows() - 1;
+}
+
+void TableRowIndex::Unindex(vtkIdType row, int id)
+{
+	std::pair< std::multimap<int, vtkIdType>::iterator, std::multimap<int, vtkIdType>::iterator > range = rows.equal_range(id);
+	for(std::multimap<int, vtkIdType>::iterator it=range.first; it!=range.second; ++it)
+	{
+		if((*it).second == row)
+		{
+			rows.erase(it);
+			return;
+		}
+	}
+}
+
+void TableRowIndex::SetKey(vtkIdType row, int column, int id)
+{
+	this->Sync();
+	if(this->IsKeyColumn(column) && !dead.at(row))
+	{
+		this->Unindex(row, table->GetValue(row,column).ToInt());
+		rows.insert( std::make_pair(id, row) );
+	}
+	table->SetValue(row, column, vtkVariant(id));
+}
+
+void TableRowIndex::RemoveRow(vtkIdType row)
+{
+	this->Sync();
+	if(dead.at(row))
+		return;
+	for(int k=0; k<2; ++k)
+	{
+		if(keyColumns[k] < 0 || keyColumns[k] >= (int)table->GetNumberOfColumns()) continue;
+		if(k == 1 && keyColumns[1] == keyColumns[0]) continue;
+		this->Unindex(row, table->GetValue(row,keyColumns[k]).ToInt());
+	}
+	dead.at(row) = 1;
+	++numDead;
+}
+
+void TableRowIndex::RemoveKey(int id)
+{
+	std::vector<vtkIdType> found;
+	this->FindRows(id, found);
+	for(int i=0; i<(int)found.size(); ++i)
+		this->RemoveRow(found.at(i));
+}
+
+void TableRowIndex::RemoveKeys(const std::set<int> & ids)
+{
+	for(std::set<int>::const_iterator it=ids.begin(); it!=ids.end(); ++it)
+		this->RemoveKey(*it);
+}
+
+//Moves every live row up over the dead ones, column by column, then truncates
+void TableRowIndex::Compact()
+{
+	this->Sync();
+	if(!table || numDead == 0)
+		return;
+
+	vtkIdType numRows = (vtkIdType)dead.size();
+	std::vector<vtkIdType> newRow(numRows, -1);
+	vtkIdType numLive = 0;
+	for(vtkIdType row=0; row<numRows; ++row)
+	{
+		if(!dead[row])
+			newRow[row] = numLive++;
+	}
+
+	for(int c=0; c<(int)table->GetNumberOfColumns(); ++c)
+	{
+		vtkAbstractArray * column = table->GetColumn(c);
+		for(vtkIdType row=0; row<numRows; ++row)
+		{
+			if(newRow[row] >= 0 && newRow[row] != row)
+				column->SetTuple(newRow[row], row, column);
+		}
+		column->SetNumberOfTuples(numLive);
+	}
+	table->Modified();
+
+	for(std::multimap<int, vtkIdType>::iterator it=rows.begin(); it!=rows.end(); ++it)
+		(*it).second = newRow[(*it).second];
+	dead.assign(numLive, 0);
+	numDead = 0;
+}
+
+}  // end namespace ftk
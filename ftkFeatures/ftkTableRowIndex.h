@@ -0,0 +1,77 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#ifndef __ftkTableRowIndex_h
+#define __ftkTableRowIndex_h
+
+#include <vtkSmartPointer.h>
+#include <vtkTable.h>
+#include <vtkVariantArray.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace ftk
+{
+/** \class TableRowIndex
+ *  \brief Maps object IDs to the rows of a vtkTable
+ *
+ *  A feature table is keyed by its ID column (column 0), an adjacency table
+ *  by both of its ID columns. Removed rows are only marked dead and stay in
+ *  the table until Compact() drops all of them in one pass, so a batch of
+ *  edits does not shift the table once per removed row.
+ *
+ *  Rows appended to the table by other code are picked up on the next call,
+ *  and the index is rebuilt if the table was shrunk or rewritten behind it.
+ */
+class TableRowIndex
+{
+public:
+	TableRowIndex();
+
+	void SetKeyColumns(int first, int second = -1);
+	void Attach(vtkTable * table);					//Index this table (cheap if already attached)
+	vtkTable * GetTable(){ return table; };
+
+	vtkIdType FindRow(int id);						//First live row with this id, -1 if none
+	void FindRows(int id, std::vector<vtkIdType> & rows);	//All live rows with this id in a key column
+	vtkIdType AppendRow(vtkVariantArray * row);		//Insert at the end and index it
+	void SetKey(vtkIdType row, int column, int id);	//Change an id in place
+
+	void RemoveRow(vtkIdType row);					//Mark dead
+	void RemoveKey(int id);							//Mark dead every row with this id
+	void RemoveKeys(const std::set<int> & ids);
+
+	bool IsDead(vtkIdType row){ return dead.at(row) != 0; };
+	vtkIdType GetNumberOfDeadRows(){ return numDead; };
+	void Compact();									//Drop the dead rows from the table
+
+private:
+	void Rebuild(void);
+	void Sync(void);
+	void IndexRows(vtkIdType first);
+	void Unindex(vtkIdType row, int id);
+	bool IsKeyColumn(int column);
+
+	vtkSmartPointer<vtkTable> table;
+	int keyColumns[2];
+	std::multimap<int, vtkIdType> rows;
+	std::vector<char> dead;
+	vtkIdType numDead;
+};
+
+}  // end namespace ftk
+
+#endif	// end __ftkTableRowIndex_h
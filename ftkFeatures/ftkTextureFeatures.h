@@ -0,0 +1,61 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+//
+// FOR CLASS DETAILS SEE ftkTextureFeatures.txx
+//
+#ifndef __ftkTextureFeatures_h
+#define __ftkTextureFeatures_h
+
+#include <vector>
+
+namespace ftk
+{
+
+// Haralick texture features of every object of a label image, from one
+// co-occurrence matrix per object pooling all the offsets one voxel away.
+// The values are the same as itk::Statistics::ScalarImageToTextureFeaturesFilter
+// with FastCalculations on, 256 gray levels and the object as mask.
+template< typename TLPixel >
+class TextureFeatures
+{
+public:
+	typedef enum { ENERGY, ENTROPY, INVERSE_DIFFERENCE_MOMENT, INERTIA, CLUSTER_SHADE, CLUSTER_PROMINENCE, N } FeatureType;
+
+	TextureFeatures();
+
+	// Both buffers are stored x fastest, then y, then z, with size[0..2] voxels
+	// along x, y and z. The gray levels are 0..255.
+	void SetInput(const unsigned char * gray, const TLPixel * labels, const int size[3]);
+	// Objects to compute the features of (labels <= 0 are skipped)
+	void SetLabels(const std::vector< TLPixel > & labels);
+	void Update(void);
+
+	// N features of the i-th label given to SetLabels, all 0 for an object
+	// with no pair of neighbours
+	const double * GetFeatures(int i) const { return &features[i*N]; };
+
+private:
+	const unsigned char * gray;
+	const TLPixel * labelImage;
+	int size[3];
+	std::vector< TLPixel > labels;
+	std::vector< double > features;
+};
+
+}  // end namespace ftk
+
+#include "ftkTextureFeatures.txx"
+
+#endif	// end __ftkTextureFeatures_h
@@ -0,0 +1,297 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#ifndef __ftkTextureFeatures_txx
+#define __ftkTextureFeatures_txx
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+//*******************************************************************************************
+// TextureFeatures:
+//
+// Replaces running itk::ScalarImageToTextureFeaturesFilter once per object, in two steps:
+//
+// 1. The label image is scanned once, every slab of rows by its own thread, to find the
+//    bounding box of every object.
+// 2. The objects are done in parallel. A thread scans the bounding box of an object and,
+//    for every voxel of the object and every offset one voxel away (13 in 3D, the other
+//    half follows by symmetry) whose voxel has the same label, counts the pair of gray
+//    levels in a 256 x 256 matrix owned by the thread. Since the matrix is symmetric only
+//    its upper half is counted. Only the entries touched are read to compute the
+//    statistics, and only those are cleared afterwards.
+//
+// Besides the features, the memory used is the bounding boxes and one matrix per thread.
+//*******************************************************************************************
+
+namespace ftk
+{
+
+//Index in labels of label value v, -1 if it is not one of them. table is used if
+//it is not empty, else the (value, index) pairs in sorted are searched.
+inline int TextureLabelIndex(long v, const std::vector< int > & table, const std::vector< std::pair< long, int > > & sorted)
+{
+	if(!table.empty())
+		return table[v];
+	std::vector< std::pair< long, int > >::const_iterator it = std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(v, -1));
+	return (it != sorted.end() && it->first == v) ? it->second : -1;
+}
+
+template< typename TLPixel >
+TextureFeatures< TLPixel >::TextureFeatures()
+{
+	gray = NULL;
+	labelImage = NULL;
+	size[0] = size[1] = size[2] = 0;
+}
+
+template< typename TLPixel >
+void TextureFeatures< TLPixel >::SetInput(const unsigned char * gray, const TLPixel * labels, const int size[3])
+{
+	this->gray = gray;
+	this->labelImage = labels;
+	for(int d=0; d<3; ++d)
+		this->size[d] = size[d];
+}
+
+template< typename TLPixel >
+void TextureFeatures< TLPixel >::SetLabels(const std::vector< TLPixel > & labels)
+{
+	this->labels = labels;
+}
+
+template< typename TLPixel >
+void TextureFeatures< TLPixel >::Update(void)
+{
+	const int numLabels = (int)labels.size();
+	features.assign((long)numLabels*N, 0.0);
+	if(!gray || !labelImage || numLabels == 0)
+		return;
+
+	//Map from label value to the index in labels: a table when the values are dense,
+	//a sorted list when they are sparse (a few objects with large ids)
+	long maxLabel = 0;
+	for(int l=0; l<numLabels; ++l)
+		if((long)labels[l] > maxLabel)
+			maxLabel = (long)labels[l];
+	const bool denseLabels = maxLabel < 4L*numLabels + 65536;
+	std::vector< int > labelIndex(denseLabels ? maxLabel+1 : 0, -1);
+	std::vector< std::pair< long, int > > sortedLabels;
+	for(int l=0; l<numLabels; ++l)
+	{
+		if((long)labels[l] <= 0)
+			continue;
+		if(denseLabels)
+			labelIndex[(long)labels[l]] = l;
+		else
+			sortedLabels.push_back(std::make_pair((long)labels[l], l));
+	}
+	std::sort(sortedLabels.begin(), sortedLabels.end());
+
+	//Half of the offsets one voxel away, leaving out those along an axis of size 1
+	int offsets[13][3];
+	long offsetStep[13];
+	int numOffsets = 0;
+	for(int dz=-1; dz<=1; ++dz)
+		for(int dy=-1; dy<=1; ++dy)
+			for(int dx=-1; dx<=1; ++dx)
+			{
+				if(dz > 0 || (dz == 0 && dy > 0) || (dz == 0 && dy == 0 && dx >= 0))
+					continue;
+				if((dx && size[0] == 1) || (dy && size[1] == 1) || (dz && size[2] == 1))
+					continue;
+				offsets[numOffsets][0] = dx;
+				offsets[numOffsets][1] = dy;
+				offsets[numOffsets][2] = dz;
+				offsetStep[numOffsets] = dx + (long)size[0]*(dy + (long)size[1]*dz);
+				++numOffsets;
+			}
+
+	const long numRows = (long)size[1]*size[2];
+	int numSlabs = 1;
+	#ifdef _OPENMP
+	numSlabs = omp_get_max_threads();
+	#endif
+	if(numSlabs > numRows)
+		numSlabs = (int)numRows;
+
+	//Step 1: bounding box of every object in every slab, merged into one per object
+	std::vector< int > slabBoxes((long)numLabels*numSlabs*6);
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static,1)
+	#endif
+	for(int s=0; s<numSlabs; ++s)
+	{
+		int * boxes = &slabBoxes[(long)numLabels*s*6];
+		for(int l=0; l<numLabels; ++l)
+		{
+			boxes[l*6] = boxes[l*6+2] = boxes[l*6+4] = 0x7FFFFFFF;
+			boxes[l*6+1] = boxes[l*6+3] = boxes[l*6+5] = -1;
+		}
+		const long firstRow = numRows*s/numSlabs;
+		const long lastRow = numRows*(s+1)/numSlabs;
+		//Runs of voxels share a label, so the index of the last one is kept
+		long lastValue = 0;
+		int lastIndex = -1;
+		for(long row=firstRow; row<lastRow; ++row)
+		{
+			const int y = (int)(row % size[1]);
+			const int z = (int)(row / size[1]);
+			const TLPixel * rowLabels = labelImage + row*size[0];
+			for(int x=0; x<size[0]; ++x)
+			{
+				const long v = (long)rowLabels[x];
+				if(v <= 0 || v > maxLabel)
+					continue;
+				if(v != lastValue)
+				{
+					lastValue = v;
+					lastIndex = TextureLabelIndex(v, labelIndex, sortedLabels);
+				}
+				if(lastIndex < 0)
+					continue;
+				int * box = boxes + lastIndex*6;
+				if(x < box[0]) box[0] = x;
+				if(x > box[1]) box[1] = x;
+				if(y < box[2]) box[2] = y;
+				if(y > box[3]) box[3] = y;
+				if(z < box[4]) box[4] = z;
+				if(z > box[5]) box[5] = z;
+			}
+		}
+	}
+	std::vector< int > boundingBoxes(slabBoxes.begin(), slabBoxes.begin() + (long)numLabels*6);
+	for(int s=1; s<numSlabs; ++s)
+	{
+		const int * boxes = &slabBoxes[(long)numLabels*s*6];
+		for(long k=0; k<(long)numLabels*6; k+=2)
+		{
+			if(boxes[k] < boundingBoxes[k]) boundingBoxes[k] = boxes[k];
+			if(boxes[k+1] > boundingBoxes[k+1]) boundingBoxes[k+1] = boxes[k+1];
+		}
+	}
+	std::vector< int >().swap(slabBoxes);
+
+	//Step 2: the co-occurrence matrix and the statistics of every object
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		std::vector< unsigned int > counts(256*256, 0);
+		std::vector< unsigned short > touched;
+
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic,16)
+		#endif
+		for(int l=0; l<numLabels; ++l)
+		{
+			const int * box = &boundingBoxes[l*6];
+			if(box[1] < 0)
+				continue;
+			const TLPixel label = labels[l];
+			unsigned long numPairs = 0;
+			double sum = 0;
+			touched.clear();
+			for(int z=box[4]; z<=box[5]; ++z)
+			{
+				for(int y=box[2]; y<=box[3]; ++y)
+				{
+					//Neighbours with the same label are inside the bounding box, so only the
+					//offsets staying inside it are kept. steps[1][1] are those of the voxels
+					//inside along x, the others leave out the offsets going past x0 or x1.
+					long steps[2][2][13];
+					int numSteps[2][2] = { { 0, 0 }, { 0, 0 } };
+					for(int o=0; o<numOffsets; ++o)
+					{
+						const int ny = y + offsets[o][1];
+						const int nz = z + offsets[o][2];
+						if(ny < box[2] || ny > box[3] || nz < box[4] || nz > box[5])
+							continue;
+						for(int neg=0; neg<2; ++neg)
+							for(int pos=0; pos<2; ++pos)
+								if((neg || offsets[o][0] >= 0) && (pos || offsets[o][0] <= 0))
+									steps[neg][pos][numSteps[neg][pos]++] = offsetStep[o];
+					}
+					const long rowStart = ((long)z*size[1] + y)*size[0];
+					for(int x=box[0]; x<=box[1]; ++x)
+					{
+						const long i = rowStart + x;
+						if(labelImage[i] != label)
+							continue;
+						const int neg = (x > box[0]), pos = (x < box[1]);
+						const long * step = steps[neg][pos];
+						const int n = numSteps[neg][pos];
+						const unsigned char a = gray[i];
+						for(int o=0; o<n; ++o)
+						{
+							const long j = i + step[o];
+							if(labelImage[j] != label)
+								continue;
+							const unsigned char b = gray[j];
+							const unsigned short ij = (unsigned short)(a < b ? (a << 8) | b : (b << 8) | a);
+							if(counts[ij]++ == 0)
+								touched.push_back(ij);
+							sum += a + b;
+							++numPairs;
+						}
+					}
+				}
+			}
+			if(numPairs == 0)
+				continue;
+
+			//Each pair counts as (i,j) and (j,i), so an entry off the diagonal stands
+			//for two entries of the full matrix with the same contributions
+			const double totalFrequency = 2.0*numPairs;
+			const double pixelMean = sum / totalFrequency;
+			const double log2 = std::log(2.0);
+			double energy = 0, entropy = 0, idm = 0, inertia = 0, shade = 0, prominence = 0;
+			for(unsigned int t=0; t<touched.size(); ++t)
+			{
+				const unsigned short ij = touched[t];
+				const double i = ij >> 8;
+				const double j = ij & 0xFF;
+				const double weight = (i == j) ? 1.0 : 2.0;
+				const double f = (i == j ? 2.0 : 1.0) * counts[ij] / totalFrequency;
+				const double d = i - j;
+				const double m = (i - pixelMean) + (j - pixelMean);
+				energy += weight*f*f;
+				//Same cut-off as itk::HistogramToTextureFeaturesFilter
+				if(f > 0.0001)
+					entropy -= weight * f * std::log(f) / log2;
+				idm += weight * f / (1.0 + d*d);
+				inertia += weight * d*d*f;
+				shade += weight * m*m*m*f;
+				prominence += weight * m*m*m*m*f;
+				counts[ij] = 0;
+			}
+			double * out = &features[(long)l*N];
+			out[ENERGY] = energy;
+			out[ENTROPY] = entropy;
+			out[INVERSE_DIFFERENCE_MOMENT] = idm;
+			out[INERTIA] = inertia;
+			out[CLUSTER_SHADE] = shade;
+			out[CLUSTER_PROMINENCE] = prominence;
+		}
+	}
+}
+
+}  // end namespace ftk
+
+#endif
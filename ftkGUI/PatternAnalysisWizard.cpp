@@ -573,23 +573,26 @@ void PatternAnalysisWizard::runSVM()
 	free(prob.y);
 	free(prob.x);
 
-	//Predict:
+	//Predict all objects at once from a column-major block:
 	std::vector<int> outliers;
 
+	int num_feats = (int)columnsToUse.size();
+	std::vector<double> block( (size_t)prob.l * num_feats );
 	for(int r=0; r<prob.l; r++)
 	{
-		struct svm_node *x = Malloc(struct svm_node,columnsToUse.size()+1);			//Individual node
-		for(int c=0; c<(int)columnsToUse.size(); ++c)
+		for(int c=0; c<num_feats; ++c)
 		{
-			x[c].index = c+1;
-			x[c].value = features.at(r).at(c);
+			block[ (size_t)c*prob.l + r ] = features.at(r).at(c);
 		}
-		x[ columnsToUse.size() ].index = -1;
+	}
 
-		double v = svm_predict(m_svm_model,x);
-		free(x);
+	std::vector<double> predictions( prob.l );
+	if( prob.l > 0 )
+		svm_predict_batch(m_svm_model, &block[0], prob.l, num_feats, &predictions[0]);
 
-		if( v == -1 )
+	for(int r=0; r<prob.l; r++)
+	{
+		if( predictions[r] == -1 )
 		{
 			outliers.push_back( r );
 		}
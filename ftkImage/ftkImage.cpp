@@ -33,6 +33,10 @@ limitations under the License.
 #include <vtkDoubleArray.h>
 #include "vtkPointData.h"
 
+//std includes:
+#include <fstream>
+#include <sstream>
+
 //Local includes:
 #if VTK_MAJOR_VERSION <= 5
 #include "vtkLSMReader.h"
@@ -78,9 +82,56 @@ void Image::DeleteData()
 				//delete[] mem;
 				free( imageDataPtrs[i][j].mem );
 			}
+			else if(imageDataPtrs[i][j].manager == MAPPED)
+			{
+				UnmapBlock(imageDataPtrs[i][j]);
+			}
 		}
 	}
 	imageDataPtrs.clear();
+
+	for(int i=0; i<(int)mappedFiles.size(); ++i)
+		delete mappedFiles[i];
+	mappedFiles.clear();
+}
+
+//Mapped blocks are mapped the first time their memory is asked for
+void * Image::GetBlockMemory(itk::SizeValueType T, itk::SizeValueType CH)
+{
+	ImageMemoryBlock & block = imageDataPtrs[T][CH];
+	if(block.manager != MAPPED || block.mem != NULL)
+		return block.mem;
+
+	mapLock.Lock();
+	if(block.mem == NULL)
+		block.mem = mappedFiles.at(block.mapFile)->Map(block.mapOffset, m_Info.BytesPerChunk(), &block.mapView, &block.mapLength);
+	void * mem = block.mem;
+	mapLock.Unlock();
+	return mem;
+}
+
+void Image::UnmapBlock(ImageMemoryBlock & block)
+{
+	if(block.manager == MAPPED && block.mapView != NULL)
+		mappedFiles.at(block.mapFile)->Unmap(block.mapView, block.mapLength);
+	block.mem = NULL;
+	block.mapView = NULL;
+	block.mapLength = 0;
+}
+
+bool Image::IsReadOnlyBlock(itk::SizeValueType T, itk::SizeValueType CH)
+{
+	const ImageMemoryBlock & block = imageDataPtrs[T][CH];
+	return block.manager == MAPPED && mappedFiles.at(block.mapFile)->GetMode() == MappedFile::READ_ONLY;
+}
+
+void Image::Prefetch(itk::SizeValueType T, itk::SizeValueType CH)
+{
+	if( T >= m_Info.numTSlices || CH >= m_Info.numChannels )
+		return;
+	if(imageDataPtrs[T][CH].manager != MAPPED)
+		return;
+	MappedFile::Prefetch(this->GetBlockMemory(T,CH), m_Info.BytesPerChunk());
 }
 
 void Image::SetSpacing(float x, float y, float z)
@@ -206,6 +257,351 @@ bool Image::LoadFileAsTimeSeries( std::string fName)
 	return true;
 }
 
+//**********************************************************************************************************
+// Memory mapped loading.  Nothing is read here: every (T,CH) block only records where its data is in the
+// file and is mapped in by GetBlockMemory() the first time it is used.
+//**********************************************************************************************************
+static int BytesPerComponent(Image::DataType dataType)
+{
+	switch(dataType)
+	{
+	case itk::ImageIOBase::CHAR:
+	case itk::ImageIOBase::UCHAR:
+		return 1;
+	case itk::ImageIOBase::SHORT:
+	case itk::ImageIOBase::USHORT:
+		return 2;
+	case itk::ImageIOBase::INT:
+	case itk::ImageIOBase::UINT:
+	case itk::ImageIOBase::FLOAT:
+		return 4;
+	case itk::ImageIOBase::LONG:
+	case itk::ImageIOBase::ULONG:
+		return (int)sizeof(long);
+	case itk::ImageIOBase::DOUBLE:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+static Image::DataType NrrdComponentType(std::string type)
+{
+	if(type == "signed char" || type == "int8" || type == "int8_t")
+		return itk::ImageIOBase::CHAR;
+	if(type == "uchar" || type == "unsigned char" || type == "uint8" || type == "uint8_t")
+		return itk::ImageIOBase::UCHAR;
+	if(type == "short" || type == "short int" || type == "signed short" || type == "signed short int" || type == "int16" || type == "int16_t")
+		return itk::ImageIOBase::SHORT;
+	if(type == "ushort" || type == "unsigned short" || type == "unsigned short int" || type == "uint16" || type == "uint16_t")
+		return itk::ImageIOBase::USHORT;
+	if(type == "int" || type == "signed int" || type == "int32" || type == "int32_t")
+		return itk::ImageIOBase::INT;
+	if(type == "uint" || type == "unsigned int" || type == "uint32" || type == "uint32_t")
+		return itk::ImageIOBase::UINT;
+	if(type == "float")
+		return itk::ImageIOBase::FLOAT;
+	if(type == "double")
+		return itk::ImageIOBase::DOUBLE;
+	return itk::ImageIOBase::UNKNOWNCOMPONENTTYPE;
+}
+
+bool Image::MapRawFile(std::string dataFile, Info nInfo, MappedFile::OffsetType offset, MappedFile::MapMode mode)
+{
+	DeleteData();
+
+	MappedFile::OffsetType chunkBytes = nInfo.BytesPerChunk();
+	MappedFile::OffsetType numChunks = (MappedFile::OffsetType)nInfo.numTSlices * nInfo.numChannels;
+	if(chunkBytes == 0 || numChunks == 0)
+		return false;
+
+	MappedFile * file = new MappedFile();
+	if( !file->Open(dataFile, mode) || offset + chunkBytes*numChunks > file->GetFileSize() )
+	{
+		delete file;
+		return false;
+	}
+	mappedFiles.push_back(file);
+	m_Info = nInfo;
+
+	ImageMemoryBlock block;
+	block.mem = NULL;
+	block.manager = MAPPED;
+	block.mapFile = (int)mappedFiles.size() - 1;
+	block.mapView = NULL;
+	block.mapLength = 0;
+	imageDataPtrs.resize(m_Info.numTSlices);
+	for(itk::SizeValueType t=0; t<m_Info.numTSlices; ++t)
+	{
+		for(itk::SizeValueType ch=0; ch<m_Info.numChannels; ++ch)
+		{
+			block.mapOffset = offset + ((MappedFile::OffsetType)t*m_Info.numChannels + ch)*chunkBytes;
+			imageDataPtrs[t].push_back(block);
+		}
+	}
+
+	this->SetDefaultColors();
+	return true;
+}
+
+//The raw file holds the stacks one after the other: x fastest, then y, z, channel and time
+bool Image::LoadRawMapped( std::string fName, DataType dataType, itk::SizeValueType cs, itk::SizeValueType rs, itk::SizeValueType zs,
+	itk::SizeValueType chs, itk::SizeValueType ts, MappedFile::OffsetType headerBytes, MappedFile::MapMode mode )
+{
+	Info nInfo;
+	nInfo.numColumns = cs;
+	nInfo.numRows = rs;
+	nInfo.numZSlices = zs;
+	nInfo.numChannels = chs;
+	nInfo.numTSlices = ts;
+	nInfo.dataType = dataType;
+	nInfo.bytesPerPix = BytesPerComponent(dataType);
+	nInfo.spacing.assign(3,1);
+
+	if( !this->MapRawFile(fName, nInfo, headerBytes, mode) )
+		return false;
+
+	path = this->GetPath(fName);
+	filenames.push_back( this->GetFilename(fName) );
+	return true;
+}
+
+//**********************************************************************************************************
+// Maps the detached data file of a NRRD header.  The first two axes are x and y; the others are z, channel
+// and time in that order, told apart by their kinds (a non-spatial kind such as "list" or "vector" is the
+// channel axis, "time" the time axis).  Compressed, interleaved or byte swapped data can't be mapped, use
+// LoadFile() for those.
+//**********************************************************************************************************
+bool Image::LoadFileMapped( std::string fName, MappedFile::MapMode mode )
+{
+	std::ifstream header(fName.c_str());
+	if(!header.is_open())
+		return false;
+
+	std::string line;
+	std::getline(header, line);
+	if(line.compare(0, 4, "NRRD") != 0)
+		return false;
+
+	int dimension = 0;
+	std::string type, encoding, endian, dataFile;
+	std::vector<itk::SizeValueType> sizes;
+	std::vector<std::string> kinds;
+	std::vector<float> spacings;
+	long long byteSkip = 0;
+	long lineSkip = 0;
+	while( std::getline(header, line) )
+	{
+		if(!line.empty() && line[line.size()-1] == '\r')
+			line.erase(line.size()-1);
+		if(line.empty())		//End of the header
+			break;
+		size_t colon = line.find(": ");
+		if(line[0] == '#' || colon == std::string::npos)
+			continue;
+
+		std::string key = line.substr(0, colon);
+		std::string value = line.substr(colon + 2);
+		std::istringstream in(value);
+		if(key == "type")
+			type = value;
+		else if(key == "dimension")
+			in >> dimension;
+		else if(key == "sizes")
+		{
+			itk::SizeValueType v;
+			while(in >> v)
+				sizes.push_back(v);
+		}
+		else if(key == "kinds")
+		{
+			std::string k;
+			while(in >> k)
+				kinds.push_back(k);
+		}
+		else if(key == "spacings")
+		{
+			float v;
+			while(in >> v)
+				spacings.push_back(v);
+		}
+		else if(key == "encoding")
+			encoding = value;
+		else if(key == "endian")
+			endian = value;
+		else if(key == "byte skip")
+			in >> byteSkip;
+		else if(key == "line skip")
+			in >> lineSkip;
+		else if(key == "data file" || key == "datafile")
+			dataFile = value;
+	}
+	header.close();
+
+	//Only one uncompressed data file:
+	if(encoding != "raw" || dataFile.empty() || dataFile == "LIST" || dataFile.find('%') != std::string::npos || lineSkip != 0)
+		return false;
+	if(dimension < 2 || dimension > 5 || (int)sizes.size() != dimension)
+		return false;
+
+	Info nInfo;
+	nInfo.dataType = NrrdComponentType(type);
+	nInfo.bytesPerPix = BytesPerComponent(nInfo.dataType);
+	if(nInfo.bytesPerPix == 0)
+		return false;
+
+	int one = 1;
+	bool littleEndian = *(char *)&one == 1;
+	if(nInfo.bytesPerPix > 1 && !endian.empty() && (endian == "little") != littleEndian)
+		return false;
+
+	kinds.resize(dimension, "domain");
+	for(int i=0; i<2; ++i)
+	{
+		if(kinds[i] != "domain" && kinds[i] != "space" && kinds[i] != "???" && kinds[i] != "none" && sizes[i] > 1)
+			return false;		//Interleaved channels
+	}
+
+	nInfo.numColumns = sizes[0];
+	nInfo.numRows = sizes[1];
+	nInfo.numZSlices = 1;
+	nInfo.numChannels = 1;
+	nInfo.numTSlices = 1;
+	nInfo.spacing.assign(3,1);
+	int next = 0;		//0 = z, 1 = channel, 2 = time
+	for(int i=2; i<dimension; ++i)
+	{
+		int role;
+		if(kinds[i] == "time")
+			role = 2;
+		else if(kinds[i] == "domain" || kinds[i] == "space" || kinds[i] == "???" || kinds[i] == "none")
+			role = (next == 0) ? 0 : 2;
+		else
+			role = 1;
+		if(role < next)
+			return false;		//Not stored as x,y,z,ch,t
+
+		if(role == 0)
+		{
+			nInfo.numZSlices = sizes[i];
+			if(i < (int)spacings.size())
+				nInfo.spacing[2] = spacings[i];
+		}
+		else if(role == 1)
+			nInfo.numChannels = sizes[i];
+		else
+			nInfo.numTSlices = sizes[i];
+		next = role + 1;
+	}
+	for(int i=0; i<2 && i<(int)spacings.size(); ++i)
+		nInfo.spacing[i] = spacings[i];
+
+	//The data file is relative to the header
+	if( dataFile[0] != '/' && dataFile[0] != '\\' && !(dataFile.size() > 1 && dataFile[1] == ':') )
+	{
+		size_t found = fName.find_last_of("/\\");
+		if(found != std::string::npos)
+			dataFile = fName.substr(0, found + 1) + dataFile;
+	}
+
+	//A byte skip of -1 means the data is at the end of the file
+	MappedFile::OffsetType offset = 0;
+	if(byteSkip == -1)
+	{
+		std::ifstream data(dataFile.c_str(), std::ios::binary | std::ios::ate);
+		MappedFile::OffsetType dataBytes = (MappedFile::OffsetType)nInfo.BytesPerChunk() * nInfo.numChannels * nInfo.numTSlices;
+		MappedFile::OffsetType fileBytes = data.is_open() ? (MappedFile::OffsetType)data.tellg() : 0;
+		if(fileBytes < dataBytes)
+			return false;
+		offset = fileBytes - dataBytes;
+	}
+	else if(byteSkip > 0)
+		offset = (MappedFile::OffsetType)byteSkip;
+
+	if( !this->MapRawFile(dataFile, nInfo, offset, mode) )
+		return false;
+
+	path = this->GetPath(fName);
+	filenames.push_back( this->GetFilename(fName) );
+	return true;
+}
+
+//**********************************************************************************************************
+// Checks that an image with info nInfo (Z and T already switched if stacksAreForTime) can be added to the
+// data I already have, updates m_Info and allocates a block for each new time slice and channel.
+// startingCH and startingT are the first new channel and time slice.
+//**********************************************************************************************************
+bool Image::AllocateLoadBlocks(Info nInfo, bool stacksAreForTime, bool appendChannels, itk::SizeValueType & startingCH, itk::SizeValueType & startingT)
+{
+	startingCH = 0;
+	startingT = 0;
+
+	//If data is already loaded we must make sure that this new image will be appended correctly:
+	if(imageDataPtrs.size() > 0)		//Already have data
+	{
+		//Check Size to be sure match:
+		if(m_Info.BytesPerChunk() != nInfo.BytesPerChunk())
+		{
+			itk::ExceptionObject excp;
+			excp.SetDescription("Image Sizes do not match");
+			throw excp;
+			return false;
+		}
+
+		if(appendChannels)		//T must also match!!!
+		{
+			if(m_Info.numTSlices != nInfo.numTSlices)
+			{
+				itk::ExceptionObject excp;
+				excp.SetDescription("Image T Slices does not match");
+				throw excp;
+				return false;
+			}
+			startingCH = m_Info.numChannels;	//Number of channels changes
+		}
+
+		if(stacksAreForTime)	//Channels must also match!!!
+		{
+			if(m_Info.numChannels != nInfo.numChannels)		//Make sure number of components matches:
+			{
+				itk::ExceptionObject excp;
+				excp.SetDescription("Number of Channels does not match");
+				throw excp;
+				return false;
+			}
+			startingT = m_Info.numTSlices;		//Number of existing T slices changes
+		}
+	}
+	else	//Don't already have data
+	{
+		m_Info = nInfo;		//Set the Image Info
+	}
+	
+	//Change the number of Time slices if I'm adding some, and resize the vector:
+	m_Info.numTSlices = startingT + nInfo.numTSlices;
+	imageDataPtrs.resize(m_Info.numTSlices);
+
+	m_Info.numChannels = startingCH + nInfo.numChannels;
+
+	itk::SizeValueType numBytesPerChunk = m_Info.BytesPerChunk();
+
+	//Create a pointer for each channel and time slice (allocate memory)
+	ImageMemoryBlock block;
+	block.manager = FTK;
+	for(itk::SizeValueType t=startingT; t<m_Info.numTSlices; ++t)
+	{
+		for(itk::SizeValueType c=startingCH; c<m_Info.numChannels; ++c)
+		{
+			void * mem = malloc(numBytesPerChunk);
+			if(mem == NULL)
+				return false;
+			block.mem = mem;
+			imageDataPtrs[t].push_back(block);
+		}
+	}
+	return true;
+}
+
 //**********************************************************************************************************
 // IF IMAGE HAS MULTIPLE PAGES IT IS ASSUMED THAT THEY REPRESENT A 3D IMAGE, BUT THEY CAN BE FORCED TO BE T
 //
@@ -285,34 +681,34 @@ bool Image::LoadStandardImage( std::string fileName, bool stacksAreForTime, bool
 	switch( m_Info.dataType )
     {
 		case itk::ImageIOBase::UCHAR:
-			LoadImageITK<unsigned char>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<unsigned char>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::CHAR:
-			LoadImageITK<char>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<char>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::USHORT:
-			LoadImageITK<unsigned short>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<unsigned short>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::SHORT:
-			LoadImageITK<short>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<short>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::UINT:
-			LoadImageITK<unsigned int>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<unsigned int>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::INT:
-			LoadImageITK<int>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<int>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::ULONG:
-			LoadImageITK<unsigned long>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<unsigned long>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::LONG:
-			LoadImageITK<long>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<long>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::FLOAT:
-			LoadImageITK<float>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<float>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		case itk::ImageIOBase::DOUBLE:
-			LoadImageITK<double>(fileName, numComponents, pixelType, stacksAreForTime, appendChannels);
+			LoadImageITK<double>(fileName, imageIO, numComponents, pixelType, stacksAreForTime, appendChannels);
 		break;
 		default:
 			itk::ExceptionObject excp;
@@ -434,7 +830,7 @@ void * Image::GetDataPtr(itk::SizeValueType T, itk::SizeValueType CH, PtrMode mo
 	void * mem = NULL;	//This will point to the data I want to pass back;
 	if(mode == DEFAULT)
 	{
-		mem = imageDataPtrs[T][CH].mem;
+		mem = this->GetBlockMemory(T,CH);
 	}
 	else if(mode == RELEASE_CONTROL)
 	{
@@ -451,7 +847,7 @@ void * Image::GetDataPtr(itk::SizeValueType T, itk::SizeValueType CH, PtrMode mo
 		mem = malloc( numBytes );
 		if(mem == NULL)
 			return (void *)NULL;
-		memcpy(mem,imageDataPtrs[T][CH].mem,numBytes);
+		memcpy(mem,this->GetBlockMemory(T,CH),numBytes);
 	}
 	return mem;
 }
@@ -830,12 +1226,12 @@ vtkSmartPointer<vtkDataArray> Image::GetVtkDataArray(itk::SizeValueType T, itk::
 		mem = malloc(numBytes);
 		if(mem == NULL)
 			return NULL;
-		memcpy(mem,imageDataPtrs[T][CH].mem,numBytes);
+		memcpy(mem,this->GetBlockMemory(T,CH),numBytes);
 		vtkManageMemory = true;
 	}
 	else
 	{
-		mem = imageDataPtrs[T][CH].mem;
+		mem = this->GetBlockMemory(T,CH);
 	}
 
 	int save = 1;				//vtk DOES NOT manage the memory (default)
@@ -974,68 +1370,72 @@ void Image::SetPixel(itk::SizeValueType T, itk::SizeValueType CH, itk::SizeValue
 	if( T >= m_Info.numTSlices || CH >= m_Info.numChannels || Z >= m_Info.numZSlices \
 		|| R >= m_Info.numRows || C >= m_Info.numColumns )
 		return;
+
+	if( this->IsReadOnlyBlock(T,CH) )
+		return;
 		
 	unsigned int x = m_Info.numColumns;
 	unsigned int y = m_Info.numRows;
+	void * mem = this->GetBlockMemory(T,CH);
 
 	if (m_Info.dataType == itk::ImageIOBase::CHAR)
 	{
 			char value = static_cast<char>(newValue);
-			char * p = static_cast<char *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			char * p = static_cast<char *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::UCHAR)
 	{
 			unsigned char value = static_cast<unsigned char>(newValue);
-			unsigned char * p = static_cast<unsigned char *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			unsigned char * p = static_cast<unsigned char *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::SHORT)
 	{
 			short value = static_cast<short>(newValue);
-			short * p = static_cast<short *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			short * p = static_cast<short *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::USHORT)
 	{
 			unsigned short value = static_cast<unsigned short>(newValue);
-			unsigned short * p = static_cast<unsigned short *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			unsigned short * p = static_cast<unsigned short *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::INT)
 	{
 			int value = static_cast<int>(newValue);
-			int * p = static_cast<int *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			int * p = static_cast<int *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::UINT)
 	{
 			unsigned int value = static_cast<unsigned int>(newValue);
-			unsigned int * p = static_cast<unsigned int *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			unsigned int * p = static_cast<unsigned int *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::LONG)
 	{
 			long value = static_cast<long>(newValue);
-			long * p = static_cast<long *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			long * p = static_cast<long *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::ULONG)
 	{
 			unsigned long value = static_cast<unsigned long>(newValue);
-			unsigned long * p = static_cast<unsigned long *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			unsigned long * p = static_cast<unsigned long *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::FLOAT)
 	{
 			float value = static_cast<float>(newValue);
-			float * p = static_cast<float *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			float * p = static_cast<float *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 	else if (m_Info.dataType == itk::ImageIOBase::DOUBLE)
 	{
 			double value = static_cast<double>(newValue);
-			double * p = static_cast<double *>(imageDataPtrs[T][CH].mem) + Z*y*x + R*x + C;
+			double * p = static_cast<double *>(mem) + Z*y*x + R*x + C;
 			(*p) = value;
 	}
 }
@@ -29,6 +29,7 @@ limitations under the License.
 #include <itkImage.h>
 #include <itkImageIOBase.h>
 #include <itkLightObject.h>
+#include <itkMutexLock.h>
 #include <itkObjectFactory.h>
 #include <itkSmartPointer.h>
 
@@ -39,10 +40,52 @@ limitations under the License.
 
 //Std includes:
 #include <string>
+#include <vector>
+
+#include "ftkMappedFile.h"
 
 namespace ftk
 {
 
+//**************************************************************************************************************
+//Typed view of a box inside one 3D stack of an ftk::Image (see Image::GetRegionView).  Rows of the box are
+//contiguous in memory, consecutive rows are RowStride() pixels apart and slices SliceStride() pixels apart.
+//The view does not own the memory, it is only valid while the image data exists.
+//**************************************************************************************************************
+template <typename TPixel>
+class ImageRegionView
+{
+public:
+	ImageRegionView();
+	ImageRegionView(TPixel * origin, itk::SizeValueType sizeX, itk::SizeValueType sizeY, itk::SizeValueType sizeZ,
+		itk::SizeValueType rowStride, itk::SizeValueType sliceStride);
+
+	bool IsValid(void){ return origin != NULL; };
+	itk::SizeValueType SizeX(void){ return sizeX; };
+	itk::SizeValueType SizeY(void){ return sizeY; };
+	itk::SizeValueType SizeZ(void){ return sizeZ; };
+	itk::SizeValueType RowStride(void){ return rowStride; };
+	itk::SizeValueType SliceStride(void){ return sliceStride; };
+
+	TPixel * GetRow(itk::SizeValueType y, itk::SizeValueType z){ return origin + z*sliceStride + y*rowStride; };	//y,z relative to the box
+	TPixel & At(itk::SizeValueType x, itk::SizeValueType y, itk::SizeValueType z){ return GetRow(y,z)[x]; };
+
+	//Kernels over the whole box, run in parallel over the rows:
+	void Fill(TPixel value);
+	itk::SizeValueType Count(TPixel value);						//Number of pixels equal to value
+	itk::SizeValueType Replace(TPixel from, TPixel to);			//Returns the number of pixels changed
+	itk::SizeValueType Replace(std::vector<TPixel> from, TPixel to);
+	itk::SizeValueType Relabel(const std::vector<TPixel> & lut);	//pixel = lut[pixel] for pixels inside the table
+
+private:
+	TPixel * origin;
+	itk::SizeValueType sizeX;
+	itk::SizeValueType sizeY;
+	itk::SizeValueType sizeZ;
+	itk::SizeValueType rowStride;
+	itk::SizeValueType sliceStride;
+};
+
 //**************************************************************************************************************
 //This Image class can load a single image file as an image or multiple image files that should be associated 
 //as a single image in memory.
@@ -67,7 +110,7 @@ public:
 	typedef vtkSmartPointer<vtkImageData> VtkImagePtr;
 	typedef itk::ImageIOBase::IOComponentType DataType;
 	typedef itk::ImageIOBase::IOPixelType itkPixelType;
-	typedef enum { FTK, VTK, ITK, OTHER } WhoManageMemory;
+	typedef enum { FTK, VTK, ITK, OTHER, MAPPED } WhoManageMemory;
 	typedef enum { DEFAULT, RELEASE_CONTROL, DEEP_COPY } PtrMode;
 
 	//Each of these LoadFile commands will clear any previous image data
@@ -76,6 +119,13 @@ public:
 	bool LoadFileSeries( std::string arg, int start, int end, int step ); //Always assume each file contains a new Z
 	bool LoadFilesAsMultipleChannels(std::vector<std::string> fnames, std::vector<std::string> channelnames, std::vector<unsigned char> colors);
 
+	//Memory mapped loading: the data stays in the file and each 3D stack is mapped the first time it is accessed
+	bool LoadFileMapped( std::string fName, MappedFile::MapMode mode = MappedFile::COPY_ON_WRITE );	//NRRD header (.nhdr) with a detached raw data file
+	bool LoadRawMapped( std::string fName, DataType dataType, itk::SizeValueType cs, itk::SizeValueType rs, itk::SizeValueType zs,
+		itk::SizeValueType chs, itk::SizeValueType ts, MappedFile::OffsetType headerBytes = 0, MappedFile::MapMode mode = MappedFile::COPY_ON_WRITE );	//Raw file ordered x,y,z,ch,t
+	void Prefetch(itk::SizeValueType T, itk::SizeValueType CH);	//Hint that this stack will be used soon (starts reading it in the background)
+	bool IsMapped(void){ return !mappedFiles.empty(); };
+
 	bool SaveChannelAs( int channel, std::string baseName, std::string ext );
 
 	bool AppendChannelFromData3D(void *dptr, DataType dataType, int bpPix, itk::SizeValueType cs, itk::SizeValueType rs, itk::SizeValueType zs, std::string name, std::vector<unsigned char> color, bool copy);
@@ -101,6 +151,8 @@ public:
 	template <typename pixelType> typename itk::Image<pixelType, 3>::Pointer GetItkPtr(itk::SizeValueType T, itk::SizeValueType CH, PtrMode mode = DEFAULT);	//IF pixelType agrees with image pixel type, PtrMode defaults to DEFAULT
 	template <typename pixelType> pixelType * GetSlicePtr(itk::SizeValueType T, itk::SizeValueType CH, itk::SizeValueType Z,PtrMode mode = DEFAULT);	// IF pixelType agrees with image pixel type (NOTE MEMORY MANAGER DOES NOT CHANGE)
 	template<typename TPixel> bool WriteImageITK(std::string fullFilename, itk::SizeValueType T, itk::SizeValueType CH);
+	//IF pixelType agrees with image pixel type, a view of the box [x1,x2]x[y1,y2]x[z1,z2] (inclusive, clipped to the image) at this T and CH
+	template <typename pixelType> ImageRegionView<pixelType> GetRegionView(itk::SizeValueType T, itk::SizeValueType CH, long x1, long y1, long z1, long x2, long y2, long z2);
 
 	typedef struct 
 	{
@@ -135,6 +187,11 @@ private:
 	typedef struct
 	{	void * mem;						//A Memory Block Ptr
 		WhoManageMemory manager;		//Who Manages this memory block?
+		//Only used by MAPPED blocks (mem stays NULL until the block is first accessed):
+		int mapFile;					//Index into mappedFiles
+		MappedFile::OffsetType mapOffset;	//Byte offset of this block in the file
+		void * mapView;					//The mapped view and its length
+		size_t mapLength;
 	} ImageMemoryBlock;
 
 	//Private Variables:
@@ -143,9 +200,15 @@ private:
 	std::vector< std::string > filenames;			//Filenames of this image
 	std::vector< std::vector< ImageMemoryBlock > > imageDataPtrs;		//Pointers to all of the data
 	std::vector< std::vector< std::string > > FileNames; // Filenames of this 5D image (including both time and channel names)
+	std::vector< MappedFile * > mappedFiles;		//Files that MAPPED blocks point into
+	itk::SimpleMutexLock mapLock;					//Serializes mapping blocks on first access
 
 	//Private Functions:
 	void DeleteData();
+	void * GetBlockMemory(itk::SizeValueType T, itk::SizeValueType CH);	//Memory of this block, mapped in if needed
+	void UnmapBlock(ImageMemoryBlock & block);
+	bool IsReadOnlyBlock(itk::SizeValueType T, itk::SizeValueType CH);
+	bool MapRawFile(std::string dataFile, Info nInfo, MappedFile::OffsetType offset, MappedFile::MapMode mode);
 	std::string GetFileExtension(std::string);
 	std::string GetFilename(std::string);
 	std::string GetPath(std::string);
@@ -167,9 +230,12 @@ private:
 
 	template<typename TPixel> bool WriteImageITK(itk::SizeValueType channel, std::string baseName, std::string ext);
 	
-	template<typename TComp> void LoadImageITK(std::string fileName, itk::SizeValueType numChannels, itkPixelType pixType, bool stacksAreForTime, bool appendChannels);
+	template<typename TComp> void LoadImageITK(std::string fileName, itk::ImageIOBase * imageIO, itk::SizeValueType numChannels, itkPixelType pixType, bool stacksAreForTime, bool appendChannels);
 	template<typename TComp> void LoadImageITK(std::string filename, itk::SizeValueType numChannels, bool stacksAreForTime, bool appendChannels);
 	template<typename TComp, itk::SizeValueType channels> void LoadImageITK(std::string fileName, bool stacksAreForTime, bool appendChannels);
+	template<typename TComp> bool LoadImageITKStreamed(itk::ImageIOBase * imageIO, bool stacksAreForTime, bool appendChannels);	//Reads slab by slab straight into the channel blocks, false if the IO cannot
+	template<typename TComp> void DeinterleavePixels(const TComp * src, itk::SizeValueType numPixels, itk::SizeValueType channels, TComp ** dest);
+	bool AllocateLoadBlocks(Info nInfo, bool stacksAreForTime, bool appendChannels, itk::SizeValueType & startingCH, itk::SizeValueType & startingT);
 
 };
 
@@ -202,6 +268,24 @@ This method assumes each file contains all spatial dimensions and separate files
 These three methods for loading from file use one of two imageIO techniques.  The first is a special class for 
 loading Ziess images (.lsm), the second is the standard ITK file reader.  ftk::Image should be able to handle all
 image types the itk can load.
+When every component of the file becomes a channel, the file is read through its ITK imageIO slab by slab
+and each slab is split into the channel buffers, so loading needs about one pass over the file.  With an imageIO
+that streams (e.g. MetaImage, NRRD) it needs the image plus one slab of about 64MB.  Other imageIOs (e.g. TIFF)
+read the whole file as a single slab, so a multi-channel file briefly needs twice the image.  Single channel
+files with one time slice are always read directly into their buffer.
+
+-Memory Mapped Images
+
+LoadFileMapped() (NRRD header with a detached, uncompressed data file) and LoadRawMapped() leave the data in the
+file.  Each 3D stack is mapped into memory the first time GetSlicePtr(), GetItkPtr(), GetRegionView() or any
+other accessor needs it, and the OS reads its pages from disk only when they are touched, so images larger than
+memory can be opened and only the parts that are looked at are loaded.  Prefetch() starts reading a stack in the
+background before it is needed.
+In COPY_ON_WRITE mode (the default) the image can be edited like any other image; edited pages are private
+copies and the file never changes.  READ_ONLY shares the pages with the file cache and is only for code that
+never writes: SetPixel() is ignored, but the pointers of GetSlicePtr(), GetItkPtr(), GetDataPtr() and
+GetRegionView() are still handed out and writing through them crashes.  Mapped stacks can't be released (RELEASE_CONTROL), use DEEP_COPY instead.
+The channels must be stored one after the other (not interleaved) for the stacks to be mapped.
 
 -Dynamically Creating Images
 
@@ -237,6 +321,9 @@ For speed, it is recommended that one uses itk iterators for changing the data b
 1. GetItkPtr() in DEFAULT memory mode
 2. Use itk iterators to manipulate the data through the itk pointer
 
+For editing a box of the image (e.g. relabeling objects), GetRegionView() returns a typed view
+with direct row access and Fill/Count/Replace/Relabel kernels that work on the memory in place.
+
 GetSlicePtr() is also provided to get a pointer to the beginning of a 2D slice. This method only works in DEFAULT memory
 management mode.
 
@@ -24,6 +24,8 @@ limitations under the License.
 #include <itkImageRegionIterator.h>
 #include <itkImportImageContainer.h>
 
+#include <algorithm>
+
 namespace ftk
 {
 
@@ -40,7 +42,7 @@ template <typename pixelType> pixelType * Image::GetSlicePtr(itk::SizeValueType
 		return NULL;
 
 	itk::SizeValueType numPix = (m_Info.numColumns)*(m_Info.numRows);
-	pixelType * stack = static_cast<pixelType *>(imageDataPtrs[T][CH].mem);
+	pixelType * stack = static_cast<pixelType *>(this->GetBlockMemory(T,CH));
 	pixelType * slice = stack + Z*numPix;
 	pixelType * mem;
 	if( mode == DEEP_COPY)
@@ -110,11 +112,11 @@ template <typename pixelType> typename itk::Image<pixelType, 3>::Pointer Image::
 					}
 		}
 		else											//Datatypes are the same; use compiler optimizations to memcpy 
-			memcpy(mem,imageDataPtrs[T][CH].mem,numBytes);
+			memcpy(mem,this->GetBlockMemory(T,CH),numBytes);
 	}
 	else
 	{
-		mem = imageDataPtrs[T][CH].mem;
+		mem = this->GetBlockMemory(T,CH);
 	}
 
 	bool letItkManageMemory = false;			//itk DOES NOT manage the memory (default)
@@ -203,7 +205,13 @@ template <typename newType> void Image::Cast()
 				}
 			}
 			//delete[] imageDataPtrs[t][ch].mem;
-			free( imageDataPtrs[t][ch].mem );
+			if(imageDataPtrs[t][ch].manager == MAPPED)
+			{
+				UnmapBlock(imageDataPtrs[t][ch]);
+				imageDataPtrs[t][ch].manager = FTK;		//The cast copy is mine
+			}
+			else
+				free( imageDataPtrs[t][ch].mem );
 			imageDataPtrs[t][ch].mem = (void *)newArray;
 			
 		}	//end channels loop
@@ -356,7 +364,7 @@ template <typename rType> rType Image::GetPixelT(itk::SizeValueType T, itk::Size
 	itk::SizeValueType x = m_Info.numColumns;
 	itk::SizeValueType y = m_Info.numRows;
 	unsigned int n = m_Info.bytesPerPix;
-	char *p = static_cast<char *>(imageDataPtrs[T][CH].mem) + Z*y*x*n + R*x*n + C*n;	//any 8-bit type works here
+	char *p = static_cast<char *>(this->GetBlockMemory(T,CH)) + Z*y*x*n + R*x*n + C*n;	//any 8-bit type works here
 
 	double value = 0; 
 	switch(m_Info.dataType)
@@ -398,7 +406,7 @@ template <typename rType> rType Image::GetPixelT(itk::SizeValueType T, itk::Size
 	return value;
 }
 
-template<typename TComp> void Image::LoadImageITK(std::string fileName, itk::SizeValueType numChannels, itkPixelType pixType, bool stacksAreForTime, bool appendChannels)
+template<typename TComp> void Image::LoadImageITK(std::string fileName, itk::ImageIOBase * imageIO, itk::SizeValueType numChannels, itkPixelType pixType, bool stacksAreForTime, bool appendChannels)
 {
 	if(imageDataPtrs.size() > 0)
 	{
@@ -422,7 +430,12 @@ template<typename TComp> void Image::LoadImageITK(std::string fileName, itk::Siz
 		case itk::ImageIOBase::COVARIANTVECTOR:
 		case itk::ImageIOBase::SYMMETRICSECONDRANKTENSOR:
 		case itk::ImageIOBase::DIFFUSIONTENSOR3D:
-			LoadImageITK<TComp>( fileName, numChannels, stacksAreForTime, appendChannels );
+			//The file components are the channels, so the raw buffer can be split without the ITK reader.
+			//Otherwise (e.g. RGB read as one channel) the reader has to convert the pixels.
+			if( !(imageIO && imageIO->GetNumberOfComponents() == numChannels 
+				&& imageIO->GetNumberOfDimensions() >= 2 && imageIO->GetNumberOfDimensions() <= 4
+				&& LoadImageITKStreamed<TComp>( imageIO, stacksAreForTime, appendChannels )) )
+				LoadImageITK<TComp>( fileName, numChannels, stacksAreForTime, appendChannels );
 		break;
 
 		case itk::ImageIOBase::OFFSET:
@@ -500,99 +513,410 @@ template< typename TComp, itk::SizeValueType channels > void Image::LoadImageITK
 		nInfo.numZSlices  = tmp;
 	}
 
-	unsigned short startingCH = 0;
-	unsigned short startingT = 0;
+	itk::SizeValueType startingCH;
+	itk::SizeValueType startingT;
+	if( !this->AllocateLoadBlocks(nInfo, stacksAreForTime, appendChannels, startingCH, startingT) )
+		return;
+	itk::SizeValueType numPixelsPerChunk = nInfo.numColumns * nInfo.numRows * nInfo.numZSlices;
 
-	//If data is already loaded we must make sure that this new image will be appended correctly:
-	if(imageDataPtrs.size() > 0)		//Already have data
+	//Iterate through the input image and extract time and channel images:
+	typedef itk::ImageRegionConstIterator< ImageType > IteratorType;
+	IteratorType it( img, img->GetRequestedRegion() );
+	itk::SizeValueType b = 0;
+	itk::SizeValueType t = startingT;
+	for ( it.GoToBegin(); !it.IsAtEnd(); ++it) 
 	{
-		//Check Size to be sure match:
-		if(m_Info.BytesPerChunk() != nInfo.BytesPerChunk())
+		//create a pixel object & Get each channel value
+		typename ImageType::PixelType pixelValue = it.Get();
+		itk::SizeValueType ch = startingCH;
+		for(int c=0; c<nInfo.numChannels; ++c)
 		{
-			itk::ExceptionObject excp;
-			excp.SetDescription("Image Sizes do not match");
-			throw excp;
-			return;
+			TComp *toLoc = ((TComp*)(imageDataPtrs[t][ch++].mem));
+			toLoc[b] = (TComp)pixelValue[c];
 		}
 
-		if(appendChannels)		//T must also match!!!
+		//Update pointers
+		b++;
+		if(b>=numPixelsPerChunk)	//I've finished this time slice
 		{
-			if(m_Info.numTSlices != nInfo.numTSlices)
-			{
-				itk::ExceptionObject excp;
-				excp.SetDescription("Image T Slices does not match");
-				throw excp;
-				return;
-			}
-			startingCH = m_Info.numChannels;	//Number of channels changes
+			b=0;
+			t++;
 		}
+	}
+	img = 0;		//itk smartpointer cleans itself	
+}
 
-		if(stacksAreForTime)	//Channels must also match!!!
+//Reads the file through its ImageIO in slabs along the slowest file dimension and splits each slab into the
+//channel blocks, so only the channel blocks and one slab are in memory. Single channel slabs are read
+//straight into their block without any copy. An IO that cannot stream only reads whole files: a single block
+//file is still read straight into its block, any other file is left to the ITK reader (false is returned and
+//nothing is loaded).
+template<typename TComp> bool Image::LoadImageITKStreamed(itk::ImageIOBase * imageIO, bool stacksAreForTime, bool appendChannels)
+{
+	unsigned int numDims = imageIO->GetNumberOfDimensions();
+	itk::SizeValueType channels = imageIO->GetNumberOfComponents();
+
+	Info nInfo;											//Info of this new image!!
+	nInfo.numColumns = imageIO->GetDimensions(0);		//x-dimension
+	nInfo.numRows = imageIO->GetDimensions(1);			//y-dimension
+	nInfo.numZSlices = numDims > 2 ? imageIO->GetDimensions(2) : 1;	//z-dimension
+	nInfo.numTSlices = numDims > 3 ? imageIO->GetDimensions(3) : 1;	//t-dimension
+	nInfo.bytesPerPix = sizeof(TComp);					//Already know bytes per pixel by component type
+	nInfo.dataType = m_Info.dataType;					//Preserve (set earlier)
+	nInfo.numChannels = channels;
+	nInfo.spacing = m_Info.spacing;						//Preserve (set earlier)
+
+	if(stacksAreForTime)	//Switch the Z and T numbers:
+	{
+		itk::SizeValueType tmp = nInfo.numTSlices;
+		nInfo.numTSlices = nInfo.numZSlices;
+		nInfo.numZSlices  = tmp;
+	}
+
+	itk::SizeValueType numPixelsPerChunk = nInfo.numColumns * nInfo.numRows * nInfo.numZSlices;
+
+	//A page is one index of the slowest dimension (a row of a 2D file, a slice of a 3D file):
+	unsigned int slabDim = numDims - 1;
+	itk::SizeValueType numPages = imageIO->GetDimensions(slabDim);
+	itk::SizeValueType pixelsPerPage = 1;
+	for(unsigned int d=0; d<slabDim; ++d)
+		pixelsPerPage *= imageIO->GetDimensions(d);
+
+	//Around 64MB of file data per read:
+	itk::SizeValueType pagesPerSlab = (64*1024*1024) / (pixelsPerPage * channels * sizeof(TComp));
+	if(pagesPerSlab < 1)
+		pagesPerSlab = 1;
+	//Keep slabs inside one time slice when time slices are made of whole pages:
+	itk::SizeValueType pagesPerChunk = 0;
+	if(numPixelsPerChunk % pixelsPerPage == 0)
+	{
+		pagesPerChunk = numPixelsPerChunk / pixelsPerPage;
+		if(pagesPerSlab > pagesPerChunk)
+			pagesPerSlab = pagesPerChunk;
+	}
+
+	itk::ImageIORegion slabRegion(numDims);
+	for(unsigned int d=0; d<numDims; ++d)
+	{
+		slabRegion.SetIndex(d, 0);
+		slabRegion.SetSize(d, imageIO->GetDimensions(d));
+	}
+
+	//Only stream if the IO reads exactly the slab I ask for, otherwise read the file in one go:
+	bool stream = imageIO->CanStreamRead() && pagesPerSlab < numPages;
+	if(stream)
+	{
+		imageIO->SetUseStreamedReading(true);
+		slabRegion.SetSize(slabDim, pagesPerSlab);
+		if( !(imageIO->GenerateStreamableReadRegionFromRequestedRegion(slabRegion) == slabRegion) )
+			stream = false;
+	}
+	if(!stream)
+	{
+		//The reader's own conversion is limited to 6 channels, beyond that the file is split here
+		if( (channels > 1 || nInfo.numTSlices > 1) && channels <= 6 )
+			return false;
+		imageIO->SetUseStreamedReading(false);
+		pagesPerSlab = numPages;
+	}
+
+	itk::SizeValueType startingCH;
+	itk::SizeValueType startingT;
+	if( !this->AllocateLoadBlocks(nInfo, stacksAreForTime, appendChannels, startingCH, startingT) )
+		return true;
+
+	std::vector<TComp> slab;
+	std::vector<TComp *> dest(channels);
+	for(itk::SizeValueType page=0; page<numPages; page+=pagesPerSlab)
+	{
+		itk::SizeValueType n = pagesPerSlab;
+		if(page + n > numPages)
+			n = numPages - page;
+		slabRegion.SetIndex(slabDim, page);
+		slabRegion.SetSize(slabDim, n);
+		imageIO->SetIORegion(slabRegion);
+
+		itk::SizeValueType first = page * pixelsPerPage;		//first pixel of the slab in the file
+		itk::SizeValueType count = n * pixelsPerPage;
+		itk::SizeValueType t = startingT + first / numPixelsPerChunk;
+		itk::SizeValueType b = first % numPixelsPerChunk;
+
+		if(channels == 1 && b + count <= numPixelsPerChunk)
 		{
-			if(m_Info.numChannels != nInfo.numChannels)		//Make sure number of components matches:
+			imageIO->Read( static_cast<TComp *>(imageDataPtrs[t][startingCH].mem) + b );
+			continue;
+		}
+
+		slab.resize(count * channels);
+		imageIO->Read( &slab[0] );
+
+		//Split the slab at the time slice boundaries:
+		const TComp * src = &slab[0];
+		while(count > 0)
+		{
+			itk::SizeValueType len = numPixelsPerChunk - b;
+			if(len > count)
+				len = count;
+			for(itk::SizeValueType c=0; c<channels; ++c)
+				dest[c] = static_cast<TComp *>(imageDataPtrs[t][startingCH+c].mem) + b;
+			this->DeinterleavePixels<TComp>(src, len, channels, &dest[0]);
+			src += len * channels;
+			count -= len;
+			b = 0;
+			t++;
+		}
+	}
+	return true;
+}
+
+//dest[c][i] = src[i*channels + c], in parallel over blocks of pixels. The fixed channel counts get their own
+//loops so the compiler can vectorize the shuffle.
+template<typename TComp> void Image::DeinterleavePixels(const TComp * src, itk::SizeValueType numPixels, itk::SizeValueType channels, TComp ** dest)
+{
+	const long blockSize = 16384;
+	long numBlocks = ((long)numPixels + blockSize - 1) / blockSize;
+	int nc = (int)channels;
+
+#ifdef _OPENMP
+	#pragma omp parallel for if(numBlocks > 1)
+#endif
+	for(long blk=0; blk<numBlocks; ++blk)
+	{
+		long begin = blk * blockSize;
+		long end = begin + blockSize;
+		if(end > (long)numPixels)
+			end = (long)numPixels;
+
+		const TComp * s = src + begin * nc;
+		switch(nc)
+		{
+		case 1:
+			memcpy(dest[0] + begin, s, (end - begin) * sizeof(TComp));
+		break;
+		case 2:
 			{
-				itk::ExceptionObject excp;
-				excp.SetDescription("Number of Channels does not match");
-				throw excp;
-				return;
+				TComp * d0 = dest[0];
+				TComp * d1 = dest[1];
+				for(long i=begin; i<end; ++i, s+=2)
+				{
+					d0[i] = s[0];
+					d1[i] = s[1];
+				}
 			}
-			startingT = m_Info.numTSlices;		//Number of existing T slices changes
+		break;
+		case 3:
+			{
+				TComp * d0 = dest[0];
+				TComp * d1 = dest[1];
+				TComp * d2 = dest[2];
+				for(long i=begin; i<end; ++i, s+=3)
+				{
+					d0[i] = s[0];
+					d1[i] = s[1];
+					d2[i] = s[2];
+				}
+			}
+		break;
+		case 4:
+			{
+				TComp * d0 = dest[0];
+				TComp * d1 = dest[1];
+				TComp * d2 = dest[2];
+				TComp * d3 = dest[3];
+				for(long i=begin; i<end; ++i, s+=4)
+				{
+					d0[i] = s[0];
+					d1[i] = s[1];
+					d2[i] = s[2];
+					d3[i] = s[3];
+				}
+			}
+		break;
+		default:
+			for(long i=begin; i<end; ++i)
+			{
+				for(int c=0; c<nc; ++c)
+					dest[c][i] = *s++;
+			}
+		break;
 		}
 	}
-	else	//Don't already have data
+}
+
+template <typename pixelType> ImageRegionView<pixelType> Image::GetRegionView(itk::SizeValueType T, itk::SizeValueType CH, long x1, long y1, long z1, long x2, long y2, long z2)
+{
+	if( T >= m_Info.numTSlices || CH >= m_Info.numChannels )
+		return ImageRegionView<pixelType>();
+
+	if( !IsMatch<pixelType>(m_Info.dataType) )
+		return ImageRegionView<pixelType>();
+
+	if(x1 < 0) x1 = 0;
+	if(y1 < 0) y1 = 0;
+	if(z1 < 0) z1 = 0;
+	if(x2 >= (long)m_Info.numColumns) x2 = (long)m_Info.numColumns - 1;
+	if(y2 >= (long)m_Info.numRows) y2 = (long)m_Info.numRows - 1;
+	if(z2 >= (long)m_Info.numZSlices) z2 = (long)m_Info.numZSlices - 1;
+	if(x2 < x1 || y2 < y1 || z2 < z1)
+		return ImageRegionView<pixelType>();
+
+	pixelType * stack = static_cast<pixelType *>(this->GetBlockMemory(T,CH));
+	if(stack == NULL)
+		return ImageRegionView<pixelType>();
+
+	itk::SizeValueType rowStride = m_Info.numColumns;
+	itk::SizeValueType sliceStride = m_Info.numColumns * m_Info.numRows;
+	pixelType * origin = stack + z1*sliceStride + y1*rowStride + x1;
+	return ImageRegionView<pixelType>(origin, x2-x1+1, y2-y1+1, z2-z1+1, rowStride, sliceStride);
+}
+
+//**************************************************************************************************************
+// ImageRegionView
+//**************************************************************************************************************
+//Boxes smaller than this are not worth starting threads for
+#define FTK_REGION_VIEW_PARALLEL_PIXELS 65536
+
+template <typename TPixel> ImageRegionView<TPixel>::ImageRegionView()
+{
+	origin = NULL;
+	sizeX = sizeY = sizeZ = 0;
+	rowStride = sliceStride = 0;
+}
+
+template <typename TPixel> ImageRegionView<TPixel>::ImageRegionView(TPixel * o, itk::SizeValueType sx, itk::SizeValueType sy, itk::SizeValueType sz,
+	itk::SizeValueType rStride, itk::SizeValueType sStride)
+{
+	origin = o;
+	sizeX = sx;
+	sizeY = sy;
+	sizeZ = sz;
+	rowStride = rStride;
+	sliceStride = sStride;
+}
+
+template <typename TPixel> void ImageRegionView<TPixel>::Fill(TPixel value)
+{
+	int numRows = (int)(sizeY*sizeZ);
+	int nx = (int)sizeX;
+#ifdef _OPENMP
+	#pragma omp parallel for if(sizeX*sizeY*sizeZ > FTK_REGION_VIEW_PARALLEL_PIXELS)
+#endif
+	for(int r=0; r<numRows; ++r)
 	{
-		m_Info = nInfo;		//Set the Image Info
+		TPixel * row = GetRow(r%sizeY, r/sizeY);
+		for(int x=0; x<nx; ++x)
+			row[x] = value;
 	}
-	
-	//Change the number of Time slices if I'm adding some, and resize the vector:
-	m_Info.numTSlices = startingT + nInfo.numTSlices;
-	imageDataPtrs.resize(m_Info.numTSlices);
-
-	m_Info.numChannels = startingCH + nInfo.numChannels;
+}
 
-	itk::SizeValueType numBytesPerChunk = m_Info.BytesPerChunk();
+template <typename TPixel> itk::SizeValueType ImageRegionView<TPixel>::Count(TPixel value)
+{
+	int numRows = (int)(sizeY*sizeZ);
+	int nx = (int)sizeX;
+	long count = 0;
+#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) if(sizeX*sizeY*sizeZ > FTK_REGION_VIEW_PARALLEL_PIXELS)
+#endif
+	for(int r=0; r<numRows; ++r)
+	{
+		TPixel * row = GetRow(r%sizeY, r/sizeY);
+		for(int x=0; x<nx; ++x)
+		{
+			if(row[x] == value)
+				++count;
+		}
+	}
+	return (itk::SizeValueType)count;
+}
 
-	//Create a pointer for each channel and time slice (allocate memory)
-	ImageMemoryBlock block;
-	block.manager = FTK;
-	for(itk::SizeValueType t=startingT; t<m_Info.numTSlices; ++t)
+template <typename TPixel> itk::SizeValueType ImageRegionView<TPixel>::Replace(TPixel from, TPixel to)
+{
+	int numRows = (int)(sizeY*sizeZ);
+	int nx = (int)sizeX;
+	long changed = 0;
+#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:changed) if(sizeX*sizeY*sizeZ > FTK_REGION_VIEW_PARALLEL_PIXELS)
+#endif
+	for(int r=0; r<numRows; ++r)
 	{
-		for(itk::SizeValueType c=startingCH; c<m_Info.numChannels; ++c)
+		TPixel * row = GetRow(r%sizeY, r/sizeY);
+		for(int x=0; x<nx; ++x)
 		{
-			//block.mem = (void *)(new TComp[numBytesPerChunk]);
-			void * mem = malloc(numBytesPerChunk);
-			if(mem == NULL)
-				return;
-			block.mem = mem;
-			imageDataPtrs[t].push_back(block);
+			if(row[x] == from)
+			{
+				row[x] = to;
+				++changed;
+			}
 		}
 	}
+	return (itk::SizeValueType)changed;
+}
 
-	//Iterate through the input image and extract time and channel images:
-	typedef itk::ImageRegionConstIterator< ImageType > IteratorType;
-	IteratorType it( img, img->GetRequestedRegion() );
-	itk::SizeValueType b = 0;
-	itk::SizeValueType t = startingT;
-	for ( it.GoToBegin(); !it.IsAtEnd(); ++it) 
+template <typename TPixel> itk::SizeValueType ImageRegionView<TPixel>::Replace(std::vector<TPixel> from, TPixel to)
+{
+	if(from.size() == 1)
+		return this->Replace(from.at(0), to);
+
+	std::sort(from.begin(), from.end());
+	from.erase( std::unique(from.begin(), from.end()), from.end() );
+	if(from.empty())
+		return 0;
+
+	const TPixel * first = &from[0];
+	const TPixel * last = first + from.size();
+	TPixel lo = from.front();
+	TPixel hi = from.back();
+	int numRows = (int)(sizeY*sizeZ);
+	int nx = (int)sizeX;
+	long changed = 0;
+#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:changed) if(sizeX*sizeY*sizeZ > FTK_REGION_VIEW_PARALLEL_PIXELS)
+#endif
+	for(int r=0; r<numRows; ++r)
 	{
-		//create a pixel object & Get each channel value
-		typename ImageType::PixelType pixelValue = it.Get();
-		unsigned short ch = startingCH;
-		for(int c=0; c<nInfo.numChannels; ++c)
+		TPixel * row = GetRow(r%sizeY, r/sizeY);
+		for(int x=0; x<nx; ++x)
 		{
-			TComp *toLoc = ((TComp*)(imageDataPtrs[t][ch++].mem));
-			toLoc[b] = (TComp)pixelValue[c];
+			TPixel pix = row[x];
+			if(pix < lo || pix > hi) continue;		//most pixels of a box are background or other objects
+			if(std::binary_search(first, last, pix))
+			{
+				row[x] = to;
+				++changed;
+			}
 		}
+	}
+	return (itk::SizeValueType)changed;
+}
 
-		//Update pointers
-		b++;
-		if(b>=numBytesPerChunk)	//I've finished this time slice
+template <typename TPixel> itk::SizeValueType ImageRegionView<TPixel>::Relabel(const std::vector<TPixel> & lut)
+{
+	if(lut.empty())
+		return 0;
+
+	const TPixel * table = &lut[0];
+	long tableSize = (long)lut.size();
+	int numRows = (int)(sizeY*sizeZ);
+	int nx = (int)sizeX;
+	long changed = 0;
+#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:changed) if(sizeX*sizeY*sizeZ > FTK_REGION_VIEW_PARALLEL_PIXELS)
+#endif
+	for(int r=0; r<numRows; ++r)
+	{
+		TPixel * row = GetRow(r%sizeY, r/sizeY);
+		for(int x=0; x<nx; ++x)
 		{
-			b=0;
-			t++;
+			long pix = (long)row[x];
+			if(pix < 0 || pix >= tableSize) continue;
+			if(table[pix] != row[x])
+			{
+				row[x] = table[pix];
+				++changed;
+			}
 		}
 	}
-	img = 0;		//itk smartpointer cleans itself	
+	return (itk::SizeValueType)changed;
 }
 
 }  // end namespace ftk
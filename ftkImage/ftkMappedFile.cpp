@@ -0,0 +1,196 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#include "ftkMappedFile.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ftk
+{
+
+MappedFile::MappedFile()
+{
+	mode = READ_ONLY;
+	fileSize = 0;
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	file = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	this->Close();
+}
+
+bool MappedFile::Open(std::string fileName, MapMode m)
+{
+	this->Close();
+	mode = m;
+
+#ifdef _WIN32
+	file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		this->Close();
+		return false;
+	}
+	fileSize = (OffsetType)size.QuadPart;
+	//A read-only mapping object also allows copy-on-write views
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mapping == NULL)
+	{
+		this->Close();
+		return false;
+	}
+#else
+	//Private mappings are writable even though the file is opened read-only
+	file = open(fileName.c_str(), O_RDONLY);
+	if(file < 0)
+		return false;
+	struct stat st;
+	if(fstat(file, &st) != 0 || st.st_size == 0)
+	{
+		this->Close();
+		return false;
+	}
+	fileSize = (OffsetType)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close(void)
+{
+#ifdef _WIN32
+	if(mapping != NULL)
+		CloseHandle(mapping);
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if(file >= 0)
+		close(file);
+	file = -1;
+#endif
+	fileSize = 0;
+}
+
+bool MappedFile::IsOpen(void)
+{
+#ifdef _WIN32
+	return mapping != NULL;
+#else
+	return file >= 0;
+#endif
+}
+
+size_t MappedFile::GetGranularity(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (size_t)info.dwAllocationGranularity;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void * MappedFile::Map(OffsetType offset, size_t length, void ** view, size_t * viewLength)
+{
+	*view = NULL;
+	*viewLength = 0;
+	if(!this->IsOpen() || length == 0 || offset > fileSize || length > fileSize - offset)
+		return NULL;
+
+	//Views have to start on a granularity boundary
+	OffsetType start = offset - offset % GetGranularity();
+	size_t len = (size_t)(offset - start) + length;
+
+#ifdef _WIN32
+	DWORD access = (mode == COPY_ON_WRITE) ? FILE_MAP_COPY : FILE_MAP_READ;
+	void * p = MapViewOfFile(mapping, access, (DWORD)(start >> 32), (DWORD)(start & 0xFFFFFFFF), (SIZE_T)len);
+	if(p == NULL)
+		return NULL;
+#else
+	int prot = (mode == COPY_ON_WRITE) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	int flags = (mode == COPY_ON_WRITE) ? MAP_PRIVATE : MAP_SHARED;
+	void * p = mmap(NULL, (size_t)len, prot, flags, file, (off_t)start);
+	if(p == MAP_FAILED)
+		return NULL;
+#endif
+
+	*view = p;
+	*viewLength = len;
+	return static_cast<char *>(p) + (offset - start);
+}
+
+void MappedFile::Unmap(void * view, size_t viewLength)
+{
+	if(view == NULL)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(view);
+#else
+	munmap(view, (size_t)viewLength);
+#endif
+}
+
+#ifdef _WIN32
+//PrefetchVirtualMemory only exists from Windows 8 on, so it is looked up at run time
+//(the range struct is the WIN32_MEMORY_RANGE_ENTRY of newer SDKs)
+typedef struct { PVOID VirtualAddress; SIZE_T NumberOfBytes; } PrefetchRange;
+typedef BOOL (WINAPI * PrefetchVirtualMemoryFunction)(HANDLE, ULONG_PTR, PrefetchRange *, ULONG);
+
+static PrefetchVirtualMemoryFunction GetPrefetchVirtualMemory(void)
+{
+	static PrefetchVirtualMemoryFunction function = (PrefetchVirtualMemoryFunction)
+		GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+	return function;
+}
+#endif
+
+void MappedFile::Prefetch(void * p, size_t length)
+{
+	if(p == NULL || length == 0)
+		return;
+#ifdef _WIN32
+	//Queues the reads and returns; without it (before Windows 8) the pages are read on first use
+	PrefetchVirtualMemoryFunction prefetch = GetPrefetchVirtualMemory();
+	if(prefetch == NULL)
+		return;
+	PrefetchRange range;
+	range.VirtualAddress = p;
+	range.NumberOfBytes = (SIZE_T)length;
+	prefetch(GetCurrentProcess(), 1, &range, 0);
+#else
+	//madvise wants a page aligned address
+	size_t address = (size_t)p;
+	size_t start = address - address % GetGranularity();
+	madvise((void *)start, address - start + length, MADV_WILLNEED);
+#endif
+}
+
+}  // end namespace ftk
@@ -0,0 +1,78 @@
+/*=========================================================================
+Copyright 2009 Rensselaer Polytechnic Institute
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#ifndef __ftkMappedFile_h
+#define __ftkMappedFile_h
+
+#include <itkIntTypes.h>
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace ftk
+{
+
+//**************************************************************************************************************
+//An open file whose byte ranges can be mapped into memory.  Pages of a view are only read from disk when they
+//are first touched, so mapping a large file costs nothing until the data is used.
+//READ_ONLY views share the pages of the OS file cache and must not be written.  COPY_ON_WRITE views can be
+//written; a page is copied the first time it is written and the changes never reach the file.
+//Offsets and sizes in the file are 64-bit on every platform (itk::SizeValueType is 32-bit on Win64).
+//**************************************************************************************************************
+class MappedFile
+{
+public:
+	typedef enum { READ_ONLY, COPY_ON_WRITE } MapMode;
+	typedef unsigned long long OffsetType;
+
+	MappedFile();
+	~MappedFile();
+
+	bool Open(std::string fileName, MapMode mode);
+	void Close(void);
+	bool IsOpen(void);
+	MapMode GetMode(void){ return mode; };
+	OffsetType GetFileSize(void){ return fileSize; };
+
+	//Maps [offset, offset+length) and returns a pointer to offset, NULL on failure.
+	//view and viewLength receive the (aligned) mapped range that must be given back to Unmap.
+	void * Map(OffsetType offset, size_t length, void ** view, size_t * viewLength);
+	void Unmap(void * view, size_t viewLength);
+
+	//Asks the OS to start reading these bytes of a view in the background, returns at once
+	static void Prefetch(void * p, size_t length);
+
+private:
+	MappedFile(const MappedFile&);		//purposely not implemented
+	void operator=(const MappedFile&);	//purposely not implemented
+
+	static size_t GetGranularity(void);
+
+	MapMode mode;
+	OffsetType fileSize;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+};
+
+}  // end namespace ftk
+
+#endif	//end __ftkMappedFile_h
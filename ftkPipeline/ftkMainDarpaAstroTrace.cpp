@@ -82,6 +82,15 @@ void ftkMainDarpaAstroTrace::readParameters( std::string astroTraceParams )
 	{ std::istringstream ss((*iter).second); ss >> _num_threads;}
 	else
 	{ _num_threads = 80; printf("Choose _num_threads = 80 as default\n");}
+	ftk::TaskRuntime::SetNumberOfThreads(_num_threads);
+
+	// Number of tiles processed at the same time, to bound their memory (0 = one per thread)
+	iter = options.find("-max_tiles");
+	if(iter!=options.end())
+	{ std::istringstream ss((*iter).second); ss >> _max_tiles;}
+	else
+	{ _max_tiles = 0; printf("Choose _max_tiles = 0 (no limit) as default\n");}
+	ftk::TaskRuntime::SetStageLimit("astro_tile", _max_tiles);
 	
 	iter = options.find("-Cy5_Image"); 
 	if(iter!=options.end())
@@ -207,6 +216,7 @@ void ftkMainDarpaAstroTrace::readParameters( std::string astroTraceParams )
 	std::cout << std::endl << "_yTileBor: " << _yTileBor;
 	std::cout << std::endl << "_zTileBor: " << _zTileBor;
 	std::cout << std::endl << "_num_threads: " << _num_threads;
+	std::cout << std::endl << "_max_tiles: " << _max_tiles;
 	std::cout << std::endl << "_Cy5_Image: " << _Cy5_Image;
 	std::cout << std::endl << "_TRI_Image: " << _TRI_Image;
 	std::cout << std::endl << "_GFP_Image: " << _GFP_Image;
@@ -346,10 +356,14 @@ void ftkMainDarpaAstroTrace::runInterestPoints(  )
 		computeSplitConst( ImageMontage_DAP );
 	}
 	
-	if( _kx*_ky*_kz < _num_threads )
+	// ITK threads of the tiles running at the same time
+	int concurrentTiles = _kx*_ky*_kz;
+	if( _max_tiles > 0 && _max_tiles < concurrentTiles )
+		concurrentTiles = _max_tiles;
+	if( concurrentTiles < _num_threads )
 	{
-		itk::MultiThreader::SetGlobalDefaultNumberOfThreads(int(_num_threads/_kx*_ky*_kz)); // This one can not be changed
-		itk::MultiThreader::SetGlobalMaximumNumberOfThreads(int(_num_threads/_kx*_ky*_kz)); // This one can chenga
+		itk::MultiThreader::SetGlobalDefaultNumberOfThreads(int(_num_threads/concurrentTiles)); // This one can not be changed
+		itk::MultiThreader::SetGlobalMaximumNumberOfThreads(int(_num_threads/concurrentTiles)); // This one can chenga
 	}
 	else
 	{
@@ -357,233 +371,217 @@ void ftkMainDarpaAstroTrace::runInterestPoints(  )
 		itk::MultiThreader::SetGlobalMaximumNumberOfThreads(1); // This one can chenga
 	}
     
-    int num_threads = 1;
-#ifdef _OPENMP
-	omp_set_nested(1);
-#if _OPENMP >= 200805L
-	omp_set_max_active_levels(2);
-#endif
-	omp_set_num_threads(num_threads);
-#endif
 	std::cout << std::endl << "fir MAX NUMBER OF CORES: " << itk::MultiThreader::GetGlobalMaximumNumberOfThreads() << ", fir DEFAULT NUMBER OF CORES: " << itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
 	
 	vtkSmartPointer< vtkTable > AllNucleiTable = ftk::LoadTable( _Nuclei_Table );
 
-	int contadorSegment = 0;
-	int contadorImageDoneSegment = 0;
-	int contadorStich = 0;
-	unsigned int maxValue = 0;
-	unsigned int maxValueOld = 0;
-	int flagFirstStich = 1;
-	
-#if _OPENMP < 200805L
-	#pragma omp parallel
-#else
-	#pragma omp parallel for collapse(3) num_threads(_num_threads) schedule(dynamic, 1)
-#endif
-	for(int xco = 0; xco < _kx; xco++)
+	_tileMontageSize = ImageMontageSize;
+	_tileTable = AllNucleiTable;
+	_tileCounter = 0;
+	_tileDoneCounter = 0;
+	ftk::ParallelFor( 0, _kx*_ky*_kz, ftk::MemberBody< ftkMainDarpaAstroTrace >( this, &ftkMainDarpaAstroTrace::InterestPointsTile ), 1, "astro_tile" );
+}
+
+void ftkMainDarpaAstroTrace::InterestPointsTile( int tile )
+{
+	int xco = tile / (_ky*_kz);
+	int yco = (tile / _kz) % _ky;
+	int zco = tile % _kz;
+
 	{
-		for(int yco = 0; yco < _ky; yco++)
-		{
-			for(int zco = 0; zco < _kz; zco++)
-			{
-				#pragma omp critical
-				{
-					++contadorSegment;
-					std::cout<<std::endl<< "\t\t--->>> ImageSegment " << contadorSegment << " of " << _kx*_ky*_kz;
-				}
-				
-				rawImageType_8bit::RegionType regionLocal_inside = ComputeLocalRegionSegment( ImageMontageSize, xco, yco, zco ); // The inside
-				rawImageType_uint::RegionType regionMontage_inside = ComputeGlobalRegionSegment( ImageMontageSize, xco, yco, zco ); // The inside
-				
-				rawImageType_8bit::RegionType regionLocal_all = ComputeLocalRegionSplit( ImageMontageSize, xco, yco, zco );
-				rawImageType_8bit::RegionType regionMontage_all = ComputeGlobalRegionSplit( ImageMontageSize, xco, yco, zco );
+		ftk::TaskLock lock( _tileMutex );
+		++_tileCounter;
+		std::cout<<std::endl<< "\t\t--->>> ImageSegment " << _tileCounter << " of " << _kx*_ky*_kz;
+	}
+	
+	rawImageType_8bit::RegionType regionLocal_inside = ComputeLocalRegionSegment( _tileMontageSize, xco, yco, zco ); // The inside
+	rawImageType_uint::RegionType regionMontage_inside = ComputeGlobalRegionSegment( _tileMontageSize, xco, yco, zco ); // The inside
+	
+	rawImageType_8bit::RegionType regionLocal_all = ComputeLocalRegionSplit( _tileMontageSize, xco, yco, zco );
+	rawImageType_8bit::RegionType regionMontage_all = ComputeGlobalRegionSplit( _tileMontageSize, xco, yco, zco );
 
-				// Store local image
-				std::stringstream out_x;
-				std::stringstream out_y;
-				std::stringstream out_z;
-				out_x<<xco;
-				out_y<<yco;
-				out_z<<zco;
-				std::string xStr = out_x.str();
-				std::string yStr = out_y.str();
-				std::string zStr = out_z.str();
-				
+	// Store local image
+	std::stringstream out_x;
+	std::stringstream out_y;
+	std::stringstream out_z;
+	out_x<<xco;
+	out_y<<yco;
+	out_z<<zco;
+	std::string xStr = out_x.str();
+	std::string yStr = out_y.str();
+	std::string zStr = out_z.str();
+	
 // 				std::cout << std::endl << "REGION_LOC: " << regionLocal_inside;
 // 				std::cout << std::endl << "REGION_MON: " << regionMontage_inside;
-				
-				//rawImageType_8bit::Pointer imageLocalCy5;
-				//rawImageType_8bit::Pointer imageLocalTRI;
-				//rawImageType_8bit::Pointer imageLocalGFP;
-				//rawImageType_8bit::Pointer imageLocalDAP;
-				rawImageType_uint::Pointer imageLocalLabel;
-				rawImageType_flo::Pointer imageLocalTRI;
-				rawImageType_flo::Pointer imageLocalDist_Map;
-				vtkSmartPointer< vtkTable > nucleiTable;
-
-				std::vector< rawImageType_flo::Pointer > Images_Tiles;
-				Images_Tiles.resize(1);
-
-				std::vector< rawImageType_flo::Pointer > Dist_Map_Tiles;
-				Dist_Map_Tiles.resize(1);
-
-				std::vector< rawImageType_uint::Pointer > Label_Tiles;
-				Label_Tiles.resize(1);
-				
-				std::vector< vtkSmartPointer< vtkTable > > Table_Tiles;
-				Table_Tiles.resize(1);
+	
+	//rawImageType_8bit::Pointer imageLocalCy5;
+	//rawImageType_8bit::Pointer imageLocalTRI;
+	//rawImageType_8bit::Pointer imageLocalGFP;
+	//rawImageType_8bit::Pointer imageLocalDAP;
+	rawImageType_uint::Pointer imageLocalLabel;
+	rawImageType_flo::Pointer imageLocalTRI;
+	rawImageType_flo::Pointer imageLocalDist_Map;
+	vtkSmartPointer< vtkTable > nucleiTable;
 
-				std::vector< vtkSmartPointer< vtkTable > > feature_Vector_Tables, root_Vector_Tables;
-				feature_Vector_Tables.resize(1);
-				root_Vector_Tables.resize(1);
-				
-				std::vector< rawImageType_16bit::Pointer > ID_Images, root_Images;
-				ID_Images.resize(1);
-				root_Images.resize(1);
+	std::vector< rawImageType_flo::Pointer > Images_Tiles;
+	Images_Tiles.resize(1);
 
-				std::vector< std::map< unsigned int, itk::Index<3> > > Centroids_Tiles;
-				Centroids_Tiles.resize(1);
-				
-				// Reading part
-				#pragma omp critical
-				{
-				if( !_TRI_Image.empty( ) /*&& !_DAP_Image.empty()*/ )
-				{
-					int foundTRI = _TRI_Image.find_last_of("/\\");
-					std::string _TRI_ImageNoPath = _TRI_Image.substr(foundTRI+1);
-					// !!! this has to be nrrd is just to test
-					std::string tempTRI = _outPathTemp+"/"+_TRI_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					imageLocalTRI = readImage< rawImageType_flo >(tempTRI.c_str());
-					
-					//int foundDAP = _DAP_Image.find_last_of("/\\");
-					//std::string _DAP_ImageNoPath = _DAP_Image.substr(foundDAP+1);
-					//// !!! this has to be nrrd is just to test
-					//std::string tempDAP = _outPathTemp+"/"+_DAP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					//imageLocalDAP = readImage< rawImageType_8bit >(tempDAP.c_str());
-				}
-				if( !_Dist_Map_Image.empty( ) )
-				{
-					int foundDist_Map = _Dist_Map_Image.find_last_of("/\\");
-					std::string _Dist_Map_ImageNoPath = _Dist_Map_Image.substr(foundDist_Map+1);
-					// !!! this has to be nrrd is just to test
-					std::string tempDist_Map = _outPathTemp+"/"+_Dist_Map_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					imageLocalDist_Map = readImage< rawImageType_flo >(tempDist_Map.c_str());
-				}
-				if( !_Label_Image.empty( ) )
-				{
-					int foundLabel = _Label_Image.find_last_of("/\\");
-					std::string _Label_ImageNoPath = _Label_Image.substr(foundLabel+1);
-					// !!! this has to be nrrd is just to test
-					std::string tempLabel = _outPathTemp+"/"+_Label_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					imageLocalLabel = readImage< rawImageType_uint >(tempLabel.c_str());
-				}	
-				nucleiTable = vtkSmartPointer< vtkTable >::New(); 
-				nucleiTable->Initialize();
-				for(int col=0; col<(int)AllNucleiTable->GetNumberOfColumns(); col++)
-				{
-					vtkSmartPointer< vtkDoubleArray > column = vtkSmartPointer< vtkDoubleArray >::New();
-					column->SetName(AllNucleiTable->GetColumnName(col));
-					nucleiTable->AddColumn(column);
-				}
-				for(int row=0; row<(int)AllNucleiTable->GetNumberOfRows(); row++)
-				{
-					itk::Index<3> global_centroid;
-					global_centroid[0] = AllNucleiTable->GetValue(row,1).ToUnsignedInt();
-					global_centroid[1] = AllNucleiTable->GetValue(row,2).ToUnsignedInt();
-					global_centroid[2] = AllNucleiTable->GetValue(row,3).ToUnsignedInt();
-					if(regionMontage_inside.IsInside(global_centroid))
-					{
-						AllNucleiTable->SetValue(row, 1, global_centroid[0] - regionMontage_all.GetIndex()[0]);
-						AllNucleiTable->SetValue(row, 2, global_centroid[1] - regionMontage_all.GetIndex()[1]);
-						AllNucleiTable->SetValue(row, 3, global_centroid[2] - regionMontage_all.GetIndex()[2]);
-						nucleiTable->InsertNextRow(AllNucleiTable->GetRow(row));
-						AllNucleiTable->RemoveRow(row);
-						row--;
-					}
-				}
-				std::string nucleiTableFileName = _outPathTemp+"/InsideNucleiTable_"+xStr+"_"+yStr+"_"+zStr+".txt";
-				ftk::SaveTable(nucleiTableFileName, nucleiTable);
-				}
+	std::vector< rawImageType_flo::Pointer > Dist_Map_Tiles;
+	Dist_Map_Tiles.resize(1);
+
+	std::vector< rawImageType_uint::Pointer > Label_Tiles;
+	Label_Tiles.resize(1);
+	
+	std::vector< vtkSmartPointer< vtkTable > > Table_Tiles;
+	Table_Tiles.resize(1);
+
+	std::vector< vtkSmartPointer< vtkTable > > feature_Vector_Tables, root_Vector_Tables;
+	feature_Vector_Tables.resize(1);
+	root_Vector_Tables.resize(1);
+	
+	std::vector< rawImageType_16bit::Pointer > ID_Images, root_Images;
+	ID_Images.resize(1);
+	root_Images.resize(1);
+
+	std::vector< std::map< unsigned int, itk::Index<3> > > Centroids_Tiles;
+	Centroids_Tiles.resize(1);
+	
+	// Reading part
+	{
+		ftk::TaskLock lock( _tileMutex );
+	if( !_TRI_Image.empty( ) /*&& !_DAP_Image.empty()*/ )
+	{
+		int foundTRI = _TRI_Image.find_last_of("/\\");
+		std::string _TRI_ImageNoPath = _TRI_Image.substr(foundTRI+1);
+		// !!! this has to be nrrd is just to test
+		std::string tempTRI = _outPathTemp+"/"+_TRI_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		imageLocalTRI = readImage< rawImageType_flo >(tempTRI.c_str());
+		
+		//int foundDAP = _DAP_Image.find_last_of("/\\");
+		//std::string _DAP_ImageNoPath = _DAP_Image.substr(foundDAP+1);
+		//// !!! this has to be nrrd is just to test
+		//std::string tempDAP = _outPathTemp+"/"+_DAP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		//imageLocalDAP = readImage< rawImageType_8bit >(tempDAP.c_str());
+	}
+	if( !_Dist_Map_Image.empty( ) )
+	{
+		int foundDist_Map = _Dist_Map_Image.find_last_of("/\\");
+		std::string _Dist_Map_ImageNoPath = _Dist_Map_Image.substr(foundDist_Map+1);
+		// !!! this has to be nrrd is just to test
+		std::string tempDist_Map = _outPathTemp+"/"+_Dist_Map_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		imageLocalDist_Map = readImage< rawImageType_flo >(tempDist_Map.c_str());
+	}
+	if( !_Label_Image.empty( ) )
+	{
+		int foundLabel = _Label_Image.find_last_of("/\\");
+		std::string _Label_ImageNoPath = _Label_Image.substr(foundLabel+1);
+		// !!! this has to be nrrd is just to test
+		std::string tempLabel = _outPathTemp+"/"+_Label_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		imageLocalLabel = readImage< rawImageType_uint >(tempLabel.c_str());
+	}	
+	nucleiTable = vtkSmartPointer< vtkTable >::New(); 
+	nucleiTable->Initialize();
+	for(int col=0; col<(int)_tileTable->GetNumberOfColumns(); col++)
+	{
+		vtkSmartPointer< vtkDoubleArray > column = vtkSmartPointer< vtkDoubleArray >::New();
+		column->SetName(_tileTable->GetColumnName(col));
+		nucleiTable->AddColumn(column);
+	}
+	for(int row=0; row<(int)_tileTable->GetNumberOfRows(); row++)
+	{
+		itk::Index<3> global_centroid;
+		global_centroid[0] = _tileTable->GetValue(row,1).ToUnsignedInt();
+		global_centroid[1] = _tileTable->GetValue(row,2).ToUnsignedInt();
+		global_centroid[2] = _tileTable->GetValue(row,3).ToUnsignedInt();
+		if(regionMontage_inside.IsInside(global_centroid))
+		{
+			_tileTable->SetValue(row, 1, global_centroid[0] - regionMontage_all.GetIndex()[0]);
+			_tileTable->SetValue(row, 2, global_centroid[1] - regionMontage_all.GetIndex()[1]);
+			_tileTable->SetValue(row, 3, global_centroid[2] - regionMontage_all.GetIndex()[2]);
+			nucleiTable->InsertNextRow(_tileTable->GetRow(row));
+			_tileTable->RemoveRow(row);
+			row--;
+		}
+	}
+	std::string nucleiTableFileName = _outPathTemp+"/InsideNucleiTable_"+xStr+"_"+yStr+"_"+zStr+".txt";
+	ftk::SaveTable(nucleiTableFileName, nucleiTable);
+	}
 
 
-				//Images_Tiles[0] = imageLocalCy5;
-				//Images_Tiles[1] = imageLocalTRI;
-				//Images_Tiles[2] = imageLocalGFP;
-				//Images_Tiles[3] = imageLocalDAP;
-				Images_Tiles[0] = imageLocalTRI;
-				Label_Tiles[0] = imageLocalLabel;
-				Table_Tiles[0] = nucleiTable;
-				Dist_Map_Tiles[0] = imageLocalDist_Map;
-								
+	//Images_Tiles[0] = imageLocalCy5;
+	//Images_Tiles[1] = imageLocalTRI;
+	//Images_Tiles[2] = imageLocalGFP;
+	//Images_Tiles[3] = imageLocalDAP;
+	Images_Tiles[0] = imageLocalTRI;
+	Label_Tiles[0] = imageLocalLabel;
+	Table_Tiles[0] = nucleiTable;
+	Dist_Map_Tiles[0] = imageLocalDist_Map;
+					
 // 				RunSegmentation(regionLocal_inside, Images_Tiles, Label_Tiles, Table_Tiles, Centroids_Tiles);
-				
-				//Label_Tiles[0] = RunNuclearSegmentation( Images_Tiles[3] );
-				//Table_Tiles[0] = ComputeFeaturesAndAssociations( Images_Tiles, Label_Tiles );
-				//Centroids_Tiles[0] = GetLabelToCentroidMap(Table_Tiles[0]);
-
-				AstroTracer * AT = new AstroTracer();
-				AT->LoadCurvImage(Images_Tiles[0], 0);
-				//AT->LoadSomaImage(std::string(argv[2]));
-				std::string coverageFileName = _outPathTemp+"/coverage_"+xStr+"_"+yStr+"_"+zStr+".txt";
-				AT->OptimizeCoverage(coverageFileName, true);
-				AT->LoadParameters(_astroTraceParams.c_str());	
-				AT->SetScaleRange(4, 4); //(2, 5); //(2, 2)
-				AT->CallFeatureMainExternal();
-				AT->Set_DistanceMapImage(imageLocalDist_Map);
-				std::string featureVectorFileName = _outPathTemp+"/featureVector_"+xStr+"_"+yStr+"_"+zStr+".txt";
-				std::string IDImageFileName = _outPathTemp+"/IDImage_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-				AT->ComputeAstroFeaturesPipeline(featureVectorFileName, IDImageFileName, 0, regionLocal_inside, feature_Vector_Tables, ID_Images, true);
-				std::string rootVectorFileName = _outPathTemp+"/rootVector_"+xStr+"_"+yStr+"_"+zStr+".txt";
-				std::string rootsImageFileName = _outPathTemp+"/rootsImage_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-				AT->Classification_Roots(root_Vector_Tables, root_Images, _roots_model_AL, rootVectorFileName, rootsImageFileName, true);
-				//Centroids_Tiles[0] = GetLabelToCentroidMap(root_Vector_Tables[0]);
-				delete AT;
-				//RemoveLabelNearBorder(regionLocal_inside, root_Images, root_Vector_Tables, Centroids_Tiles );
-
-				//typedef itk::LabelGeometryImageFilter< rawImageType_uint, rawImageType_flo > LabelGeometryType;
-				//LabelGeometryType::Pointer labelGeometryFilter = LabelGeometryType::New();		//Dirk's Filter;
-				//labelGeometryFilter->SetInput( imageLocalLabel );
-				//labelGeometryFilter->SetIntensityInput( imageLocalTRI );
-				////SET ADVANCED (OPTIONAL) ITEMS FOR THIS FILTER:
-				//labelGeometryFilter->CalculatePixelIndicesOff();
-				//labelGeometryFilter->CalculateOrientedBoundingBoxOff();
-				//labelGeometryFilter->CalculateOrientedLabelRegionsOff();
-				//labelGeometryFilter->CalculateOrientedIntensityRegionsOff();
-				////UPDATE THE FILTER	
-				//try
-				//{
-				//	labelGeometryFilter->Update();
-				//}
-				//catch (itk::ExceptionObject & e) 
-				//{
-				//	std::cerr << "Exception in Dirk's Label Geometry Filter: " << e << std::endl;
-				//	return false;
-				//}				
-				//std::vector< LabelGeometryType::LabelPixelType > labels = labelGeometryFilter->GetLabels();
-				
-				
-				// TEST SAVE SEGMENTATION WITH LABELS REMOVED
-				if(!root_Vector_Tables[0])
-					continue;
-				#pragma omp critical
-				{
-					std::string tempTABLERE = _outPathTemp+"/rootVector_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.txt";
-					ftk::SaveTable(tempTABLERE, root_Vector_Tables[0]);
-					std::string tempLABELRE = _outPathTemp+"/rootsImage_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.nrrd";
-					writeImage<rawImageType_16bit>(root_Images[0],tempLABELRE.c_str());
+	
+	//Label_Tiles[0] = RunNuclearSegmentation( Images_Tiles[3] );
+	//Table_Tiles[0] = ComputeFeaturesAndAssociations( Images_Tiles, Label_Tiles );
+	//Centroids_Tiles[0] = GetLabelToCentroidMap(Table_Tiles[0]);
+
+	AstroTracer * AT = new AstroTracer();
+	AT->LoadCurvImage(Images_Tiles[0], 0);
+	//AT->LoadSomaImage(std::string(argv[2]));
+	std::string coverageFileName = _outPathTemp+"/coverage_"+xStr+"_"+yStr+"_"+zStr+".txt";
+	AT->OptimizeCoverage(coverageFileName, true);
+	AT->LoadParameters(_astroTraceParams.c_str());	
+	AT->SetScaleRange(4, 4); //(2, 5); //(2, 2)
+	AT->CallFeatureMainExternal();
+	AT->Set_DistanceMapImage(imageLocalDist_Map);
+	std::string featureVectorFileName = _outPathTemp+"/featureVector_"+xStr+"_"+yStr+"_"+zStr+".txt";
+	std::string IDImageFileName = _outPathTemp+"/IDImage_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+	AT->ComputeAstroFeaturesPipeline(featureVectorFileName, IDImageFileName, 0, regionLocal_inside, feature_Vector_Tables, ID_Images, true);
+	std::string rootVectorFileName = _outPathTemp+"/rootVector_"+xStr+"_"+yStr+"_"+zStr+".txt";
+	std::string rootsImageFileName = _outPathTemp+"/rootsImage_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+	AT->Classification_Roots(root_Vector_Tables, root_Images, _roots_model_AL, rootVectorFileName, rootsImageFileName, true);
+	//Centroids_Tiles[0] = GetLabelToCentroidMap(root_Vector_Tables[0]);
+	delete AT;
+	//RemoveLabelNearBorder(regionLocal_inside, root_Images, root_Vector_Tables, Centroids_Tiles );
+
+	//typedef itk::LabelGeometryImageFilter< rawImageType_uint, rawImageType_flo > LabelGeometryType;
+	//LabelGeometryType::Pointer labelGeometryFilter = LabelGeometryType::New();		//Dirk's Filter;
+	//labelGeometryFilter->SetInput( imageLocalLabel );
+	//labelGeometryFilter->SetIntensityInput( imageLocalTRI );
+	////SET ADVANCED (OPTIONAL) ITEMS FOR THIS FILTER:
+	//labelGeometryFilter->CalculatePixelIndicesOff();
+	//labelGeometryFilter->CalculateOrientedBoundingBoxOff();
+	//labelGeometryFilter->CalculateOrientedLabelRegionsOff();
+	//labelGeometryFilter->CalculateOrientedIntensityRegionsOff();
+	////UPDATE THE FILTER	
+	//try
+	//{
+	//	labelGeometryFilter->Update();
+	//}
+	//catch (itk::ExceptionObject & e) 
+	//{
+	//	std::cerr << "Exception in Dirk's Label Geometry Filter: " << e << std::endl;
+	//	return false;
+	//}				
+	//std::vector< LabelGeometryType::LabelPixelType > labels = labelGeometryFilter->GetLabels();
+	
+	
+	// TEST SAVE SEGMENTATION WITH LABELS REMOVED
+	if(!root_Vector_Tables[0])
+		return;
+	{
+		ftk::TaskLock lock( _tileMutex );
+		std::string tempTABLERE = _outPathTemp+"/rootVector_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.txt";
+		ftk::SaveTable(tempTABLERE, root_Vector_Tables[0]);
+		std::string tempLABELRE = _outPathTemp+"/rootsImage_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.nrrd";
+		writeImage<rawImageType_16bit>(root_Images[0],tempLABELRE.c_str());
 
 	// 				std::string tempLABELRE = _outPathDebugLevel2+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.tif";
-					ftkMainDarpa objftkMainDarpa;
-					objftkMainDarpa.projectImage<rawImageType_16bit, rawImageType_16bit>( root_Images[0], tempLABELRE, _outPathDebugLevel2, "ORG_BIN", "TIFF" );
-				}
-				#pragma omp critical
-				{
-					contadorImageDoneSegment++;
-					std::cout<<std::endl<< "\t\t--->>> ImageDoneSegment " << contadorImageDoneSegment << " of " << _kx*_ky*_kz;
-				}
-			}
-		}
+		ftkMainDarpa objftkMainDarpa;
+		objftkMainDarpa.projectImage<rawImageType_16bit, rawImageType_16bit>( root_Images[0], tempLABELRE, _outPathDebugLevel2, "ORG_BIN", "TIFF" );
+	}
+	{
+		ftk::TaskLock lock( _tileMutex );
+		_tileDoneCounter++;
+		std::cout<<std::endl<< "\t\t--->>> ImageDoneSegment " << _tileDoneCounter << " of " << _kx*_ky*_kz;
 	}
 }
 
@@ -599,14 +597,6 @@ void ftkMainDarpaAstroTrace::runStitchRoots(  )
 		itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1); // This one can not be changed
 		itk::MultiThreader::SetGlobalMaximumNumberOfThreads(1); // This one can chenga
 	
-		int num_threads = 1;
-	#ifdef _OPENMP
-		omp_set_nested(1);
-	#if _OPENMP >= 200805L
-		omp_set_max_active_levels(2);
-	#endif
-		omp_set_num_threads(num_threads);
-    	#endif
 	}
 	
 	rawImageType_8bit::RegionType ImageMontageRegion;
@@ -864,14 +854,6 @@ void ftkMainDarpaAstroTrace::computeRootFeaturesForNuclei(  )
 	{
 		itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1); // This one can not be changed
 		itk::MultiThreader::SetGlobalMaximumNumberOfThreads(1); // This one can chenga
-		int num_threads = 1;
-	#ifdef _OPENMP
-		omp_set_nested(1);
-	#if _OPENMP >= 200805L
-		omp_set_max_active_levels(2);
-	#endif
-		omp_set_num_threads(num_threads);
-    	#endif
 	}
 	
 	rawImageType_8bit::RegionType ImageMontageRegion;
@@ -888,162 +870,9 @@ void ftkMainDarpaAstroTrace::computeRootFeaturesForNuclei(  )
 	std::string tempAllRoots_Table = _outPathTemp+"/Roots_Table.txt";
 	vtkSmartPointer< vtkTable > AllRootsTable = ftk::LoadTable( tempAllRoots_Table );
 
-#if _OPENMP < 200805L
-	#pragma omp parallel
-#else
-	#pragma omp parallel for collapse(3) num_threads(_num_threads) schedule(dynamic, 1)
-#endif	
-	for(int xco = 0; xco < _kx; xco++)
-	{
-		for(int yco = 0; yco < _ky; yco++)
-		{
-			for(int zco = 0; zco < _kz; zco++)
-			{
-				//#pragma omp critical
-				//{
-				//	++contadorSegment;
-				//	std::cout<<std::endl<< "\t\t--->>> ImageSegment " << contadorSegment << " of " << _kx*_ky*_kz;
-				//}
-				
-				rawImageType_8bit::RegionType regionLocal_inside = ComputeLocalRegionSegment( ImageMontageSize, xco, yco, zco ); // The inside
-				rawImageType_uint::RegionType regionMontage_inside = ComputeGlobalRegionSegment( ImageMontageSize, xco, yco, zco ); // The inside
-				
-				rawImageType_8bit::RegionType regionLocal_all = ComputeLocalRegionSplit( ImageMontageSize, xco, yco, zco );
-				rawImageType_8bit::RegionType regionMontage_all = ComputeGlobalRegionSplit( ImageMontageSize, xco, yco, zco );
-
-				// Store local image
-				std::stringstream out_x;
-				std::stringstream out_y;
-				std::stringstream out_z;
-				out_x<<xco;
-				out_y<<yco;
-				out_z<<zco;
-				std::string xStr = out_x.str();
-				std::string yStr = out_y.str();
-				std::string zStr = out_z.str();
-
-				rawImageType_uint::Pointer imageLocalLabel;
-				rawImageType_flo::Pointer imageLocalTRI;
-				rawImageType_flo::Pointer imageLocalDist_Map;
-				vtkSmartPointer< vtkTable > nucleiTable, rootsTable;
-
-				std::vector< rawImageType_flo::Pointer > Images_Tiles;
-				Images_Tiles.resize(1);
-
-				std::vector< rawImageType_flo::Pointer > Dist_Map_Tiles;
-				Dist_Map_Tiles.resize(1);
-
-				std::vector< rawImageType_uint::Pointer > Label_Tiles;
-				Label_Tiles.resize(1);
-				
-				std::vector< vtkSmartPointer< vtkTable > > Table_Tiles;
-				Table_Tiles.resize(1);
-
-				std::vector< vtkSmartPointer< vtkTable > > feature_Vector_Tables, root_Vector_Tables;
-				feature_Vector_Tables.resize(1);
-				root_Vector_Tables.resize(1);
-				
-				std::vector< rawImageType_16bit::Pointer > ID_Images, root_Images;
-				ID_Images.resize(1);
-				root_Images.resize(1);
-
-				std::vector< std::map< unsigned int, itk::Index<3> > > Centroids_Tiles;
-				Centroids_Tiles.resize(1);
-				
-				// Reading part
-				#pragma omp critical
-				{
-				if( !_TRI_Image.empty( ) /*&& !_DAP_Image.empty()*/ )
-				{
-					int foundTRI = _TRI_Image.find_last_of("/\\");
-					std::string _TRI_ImageNoPath = _TRI_Image.substr(foundTRI+1);
-					// !!! this has to be nrrd is just to test
-					std::string tempTRI = _outPathTemp+"/"+_TRI_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					imageLocalTRI = readImage< rawImageType_flo >(tempTRI.c_str());
-					
-					//int foundDAP = _DAP_Image.find_last_of("/\\");
-					//std::string _DAP_ImageNoPath = _DAP_Image.substr(foundDAP+1);
-					//// !!! this has to be nrrd is just to test
-					//std::string tempDAP = _outPathTemp+"/"+_DAP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					//imageLocalDAP = readImage< rawImageType_8bit >(tempDAP.c_str());
-				}
-				if( !_Dist_Map_Image.empty( ) )
-				{
-					int foundDist_Map = _Dist_Map_Image.find_last_of("/\\");
-					std::string _Dist_Map_ImageNoPath = _Dist_Map_Image.substr(foundDist_Map+1);
-					// !!! this has to be nrrd is just to test
-					std::string tempDist_Map = _outPathTemp+"/"+_Dist_Map_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					imageLocalDist_Map = readImage< rawImageType_flo >(tempDist_Map.c_str());
-				}
-				if( !_Label_Image.empty( ) )
-				{
-					int foundLabel = _Label_Image.find_last_of("/\\");
-					std::string _Label_ImageNoPath = _Label_Image.substr(foundLabel+1);
-					// !!! this has to be nrrd is just to test
-					std::string tempLabel = _outPathTemp+"/"+_Label_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-					imageLocalLabel = readImage< rawImageType_uint >(tempLabel.c_str());
-				}
-				rootsTable = vtkSmartPointer< vtkTable >::New(); 
-				rootsTable->Initialize();
-				for(int col=0; col<(int)AllRootsTable->GetNumberOfColumns(); col++)
-				{
-					vtkSmartPointer< vtkDoubleArray > column = vtkSmartPointer< vtkDoubleArray >::New();
-					column->SetName(AllRootsTable->GetColumnName(col));
-					rootsTable->AddColumn(column);
-				}
-				for(int row=0; row<(int)AllRootsTable->GetNumberOfRows(); row++)
-				{
-					itk::Index<3> global_root;
-					global_root[0] = AllRootsTable->GetValue(row,1).ToUnsignedInt();
-					global_root[1] = AllRootsTable->GetValue(row,2).ToUnsignedInt();
-					global_root[2] = AllRootsTable->GetValue(row,3).ToUnsignedInt();
-					if(regionMontage_all.IsInside(global_root))
-					{
-						AllRootsTable->SetValue(row, 1, global_root[0] - regionMontage_all.GetIndex()[0]);
-						AllRootsTable->SetValue(row, 2, global_root[1] - regionMontage_all.GetIndex()[1]);
-						AllRootsTable->SetValue(row, 3, global_root[2] - regionMontage_all.GetIndex()[2]);
-						rootsTable->InsertNextRow(AllRootsTable->GetRow(row));
-						AllRootsTable->RemoveRow(row);
-						row--;
-					}
-				}
-				std::string testRootsTableFileName = _outPathTemp+"/test_roots_table_"+xStr+"_"+yStr+"_"+zStr+".txt";
-				ftk::SaveTable(testRootsTableFileName, rootsTable);
-				}
-				std::string nucleiTableFileName = _outPathTemp+"/InsideNucleiTable_"+xStr+"_"+yStr+"_"+zStr+".txt";
-				nucleiTable = ftk::LoadTable(nucleiTableFileName);
-				//Images_Tiles[0] = imageLocalCy5;
-				//Images_Tiles[1] = imageLocalTRI;
-				//Images_Tiles[2] = imageLocalGFP;
-				//Images_Tiles[3] = imageLocalDAP;
-				Images_Tiles[0] = imageLocalTRI;
-				Label_Tiles[0] = imageLocalLabel;
-				Table_Tiles[0] = nucleiTable;
-				Dist_Map_Tiles[0] = imageLocalDist_Map;
-				root_Vector_Tables[0] = rootsTable;
-								
-// 				RunSegmentation(regionLocal_inside, Images_Tiles, Label_Tiles, Table_Tiles, Centroids_Tiles);
-				
-				//Label_Tiles[0] = RunNuclearSegmentation( Images_Tiles[3] );
-				//Table_Tiles[0] = ComputeFeaturesAndAssociations( Images_Tiles, Label_Tiles );
-				//Centroids_Tiles[0] = GetLabelToCentroidMap(Table_Tiles[0]);
-
-				AstroTracer * AT = new AstroTracer();
-				AT->LoadCurvImage(Images_Tiles[0], 0);
-				AT->LoadParameters(_astroTraceParams.c_str());	
-				AT->SetScaleRange(4, 4); //(2, 5); //(2, 2)
-				AT->Set_DistanceMapImage(imageLocalDist_Map);
-				AT->ReadRootPointsPipeline(root_Vector_Tables);
-				AT->ReadNucleiFeaturesPipeline(Table_Tiles);
-				std::string AppendedNucleiTableFileName = _outPathTemp+"/AppendedNucleiTable_"+xStr+"_"+yStr+"_"+zStr+".txt";
-				AT->ComputeFeaturesFromCandidateRootsPipeline(regionLocal_inside, Table_Tiles, _final_classification_model, AppendedNucleiTableFileName);
-				//AT->WriteNucleiFeatures(AppendedNucleiTableFileName);
-				delete AT;
-				//RemoveLabelNearBorder(regionLocal_inside, root_Images, root_Vector_Tables, Centroids_Tiles );
-
-			}
-		}
-	}
+	_tileMontageSize = ImageMontageSize;
+	_tileTable = AllRootsTable;
+	ftk::ParallelFor( 0, _kx*_ky*_kz, ftk::MemberBody< ftkMainDarpaAstroTrace >( this, &ftkMainDarpaAstroTrace::RootFeaturesTile ), 1, "astro_tile" );
 
 	vtkSmartPointer< vtkTable > AllNucleiTable = vtkSmartPointer< vtkTable >::New();
 	AllNucleiTable->Initialize();
@@ -1312,6 +1141,156 @@ void ftkMainDarpaAstroTrace::computeRootFeaturesForNuclei(  )
 
 }
 
+void ftkMainDarpaAstroTrace::RootFeaturesTile( int tile )
+{
+	int xco = tile / (_ky*_kz);
+	int yco = (tile / _kz) % _ky;
+	int zco = tile % _kz;
+
+	//#pragma omp critical
+	//{
+	//	++_tileCounter;
+	//	std::cout<<std::endl<< "\t\t--->>> ImageSegment " << _tileCounter << " of " << _kx*_ky*_kz;
+	//}
+	
+	rawImageType_8bit::RegionType regionLocal_inside = ComputeLocalRegionSegment( _tileMontageSize, xco, yco, zco ); // The inside
+	rawImageType_uint::RegionType regionMontage_inside = ComputeGlobalRegionSegment( _tileMontageSize, xco, yco, zco ); // The inside
+	
+	rawImageType_8bit::RegionType regionLocal_all = ComputeLocalRegionSplit( _tileMontageSize, xco, yco, zco );
+	rawImageType_8bit::RegionType regionMontage_all = ComputeGlobalRegionSplit( _tileMontageSize, xco, yco, zco );
+
+	// Store local image
+	std::stringstream out_x;
+	std::stringstream out_y;
+	std::stringstream out_z;
+	out_x<<xco;
+	out_y<<yco;
+	out_z<<zco;
+	std::string xStr = out_x.str();
+	std::string yStr = out_y.str();
+	std::string zStr = out_z.str();
+
+	rawImageType_uint::Pointer imageLocalLabel;
+	rawImageType_flo::Pointer imageLocalTRI;
+	rawImageType_flo::Pointer imageLocalDist_Map;
+	vtkSmartPointer< vtkTable > nucleiTable, rootsTable;
+
+	std::vector< rawImageType_flo::Pointer > Images_Tiles;
+	Images_Tiles.resize(1);
+
+	std::vector< rawImageType_flo::Pointer > Dist_Map_Tiles;
+	Dist_Map_Tiles.resize(1);
+
+	std::vector< rawImageType_uint::Pointer > Label_Tiles;
+	Label_Tiles.resize(1);
+	
+	std::vector< vtkSmartPointer< vtkTable > > Table_Tiles;
+	Table_Tiles.resize(1);
+
+	std::vector< vtkSmartPointer< vtkTable > > feature_Vector_Tables, root_Vector_Tables;
+	feature_Vector_Tables.resize(1);
+	root_Vector_Tables.resize(1);
+	
+	std::vector< rawImageType_16bit::Pointer > ID_Images, root_Images;
+	ID_Images.resize(1);
+	root_Images.resize(1);
+
+	std::vector< std::map< unsigned int, itk::Index<3> > > Centroids_Tiles;
+	Centroids_Tiles.resize(1);
+	
+	// Reading part
+	{
+		ftk::TaskLock lock( _tileMutex );
+	if( !_TRI_Image.empty( ) /*&& !_DAP_Image.empty()*/ )
+	{
+		int foundTRI = _TRI_Image.find_last_of("/\\");
+		std::string _TRI_ImageNoPath = _TRI_Image.substr(foundTRI+1);
+		// !!! this has to be nrrd is just to test
+		std::string tempTRI = _outPathTemp+"/"+_TRI_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		imageLocalTRI = readImage< rawImageType_flo >(tempTRI.c_str());
+		
+		//int foundDAP = _DAP_Image.find_last_of("/\\");
+		//std::string _DAP_ImageNoPath = _DAP_Image.substr(foundDAP+1);
+		//// !!! this has to be nrrd is just to test
+		//std::string tempDAP = _outPathTemp+"/"+_DAP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		//imageLocalDAP = readImage< rawImageType_8bit >(tempDAP.c_str());
+	}
+	if( !_Dist_Map_Image.empty( ) )
+	{
+		int foundDist_Map = _Dist_Map_Image.find_last_of("/\\");
+		std::string _Dist_Map_ImageNoPath = _Dist_Map_Image.substr(foundDist_Map+1);
+		// !!! this has to be nrrd is just to test
+		std::string tempDist_Map = _outPathTemp+"/"+_Dist_Map_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		imageLocalDist_Map = readImage< rawImageType_flo >(tempDist_Map.c_str());
+	}
+	if( !_Label_Image.empty( ) )
+	{
+		int foundLabel = _Label_Image.find_last_of("/\\");
+		std::string _Label_ImageNoPath = _Label_Image.substr(foundLabel+1);
+		// !!! this has to be nrrd is just to test
+		std::string tempLabel = _outPathTemp+"/"+_Label_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+		imageLocalLabel = readImage< rawImageType_uint >(tempLabel.c_str());
+	}
+	rootsTable = vtkSmartPointer< vtkTable >::New(); 
+	rootsTable->Initialize();
+	for(int col=0; col<(int)_tileTable->GetNumberOfColumns(); col++)
+	{
+		vtkSmartPointer< vtkDoubleArray > column = vtkSmartPointer< vtkDoubleArray >::New();
+		column->SetName(_tileTable->GetColumnName(col));
+		rootsTable->AddColumn(column);
+	}
+	for(int row=0; row<(int)_tileTable->GetNumberOfRows(); row++)
+	{
+		itk::Index<3> global_root;
+		global_root[0] = _tileTable->GetValue(row,1).ToUnsignedInt();
+		global_root[1] = _tileTable->GetValue(row,2).ToUnsignedInt();
+		global_root[2] = _tileTable->GetValue(row,3).ToUnsignedInt();
+		if(regionMontage_all.IsInside(global_root))
+		{
+			_tileTable->SetValue(row, 1, global_root[0] - regionMontage_all.GetIndex()[0]);
+			_tileTable->SetValue(row, 2, global_root[1] - regionMontage_all.GetIndex()[1]);
+			_tileTable->SetValue(row, 3, global_root[2] - regionMontage_all.GetIndex()[2]);
+			rootsTable->InsertNextRow(_tileTable->GetRow(row));
+			_tileTable->RemoveRow(row);
+			row--;
+		}
+	}
+	std::string testRootsTableFileName = _outPathTemp+"/test_roots_table_"+xStr+"_"+yStr+"_"+zStr+".txt";
+	ftk::SaveTable(testRootsTableFileName, rootsTable);
+	}
+	std::string nucleiTableFileName = _outPathTemp+"/InsideNucleiTable_"+xStr+"_"+yStr+"_"+zStr+".txt";
+	nucleiTable = ftk::LoadTable(nucleiTableFileName);
+	//Images_Tiles[0] = imageLocalCy5;
+	//Images_Tiles[1] = imageLocalTRI;
+	//Images_Tiles[2] = imageLocalGFP;
+	//Images_Tiles[3] = imageLocalDAP;
+	Images_Tiles[0] = imageLocalTRI;
+	Label_Tiles[0] = imageLocalLabel;
+	Table_Tiles[0] = nucleiTable;
+	Dist_Map_Tiles[0] = imageLocalDist_Map;
+	root_Vector_Tables[0] = rootsTable;
+					
+// 				RunSegmentation(regionLocal_inside, Images_Tiles, Label_Tiles, Table_Tiles, Centroids_Tiles);
+	
+	//Label_Tiles[0] = RunNuclearSegmentation( Images_Tiles[3] );
+	//Table_Tiles[0] = ComputeFeaturesAndAssociations( Images_Tiles, Label_Tiles );
+	//Centroids_Tiles[0] = GetLabelToCentroidMap(Table_Tiles[0]);
+
+	AstroTracer * AT = new AstroTracer();
+	AT->LoadCurvImage(Images_Tiles[0], 0);
+	AT->LoadParameters(_astroTraceParams.c_str());	
+	AT->SetScaleRange(4, 4); //(2, 5); //(2, 2)
+	AT->Set_DistanceMapImage(imageLocalDist_Map);
+	AT->ReadRootPointsPipeline(root_Vector_Tables);
+	AT->ReadNucleiFeaturesPipeline(Table_Tiles);
+	std::string AppendedNucleiTableFileName = _outPathTemp+"/AppendedNucleiTable_"+xStr+"_"+yStr+"_"+zStr+".txt";
+	AT->ComputeFeaturesFromCandidateRootsPipeline(regionLocal_inside, Table_Tiles, _final_classification_model, AppendedNucleiTableFileName);
+	//AT->WriteNucleiFeatures(AppendedNucleiTableFileName);
+	delete AT;
+	//RemoveLabelNearBorder(regionLocal_inside, root_Images, root_Vector_Tables, Centroids_Tiles );
+
+}
+
 	
 	
 
@@ -38,6 +38,8 @@ public:
 	
 protected:
 	void computeSplitConst( rawImageType_8bit::Pointer ImageMontage );
+	void InterestPointsTile( int tile ); // one iteration of runInterestPoints, tile = (xco*_ky + yco)*_kz + zco
+	void RootFeaturesTile( int tile ); // one iteration of computeRootFeaturesForNuclei
 	std::vector< itk::Index<3> > getCentroidList();
 	std::vector< itk::Index<3> > getSomaTable( std::vector< itk::Index<3> > , int , int , int );
 	template< typename TINPUT >
@@ -65,6 +67,7 @@ private:
  	int _yTileBor;
  	int _zTileBor;
 	int _num_threads;
+	int _max_tiles;
 	std::string _Cy5_Image;
 	std::string _TRI_Image;
 	std::string _GFP_Image;
@@ -126,6 +129,13 @@ private:
 	// BIG IMAGES
 	rawImageType_flo::Pointer _img_astroTraceDesiredRegion;
 	rawImageType_uint::Pointer _somaMontageDesiredRegion;
+
+	// Shared by the tile tasks
+	itk::Size<3> _tileMontageSize;
+	vtkSmartPointer< vtkTable > _tileTable;
+	int _tileCounter;
+	int _tileDoneCounter;
+	ftk::TaskMutex _tileMutex;
 };
 
 #include "ftkMainDarpaAstroTrace.hxx"
@@ -61,6 +61,15 @@ void ftkMainDarpaSegment::readParameters( std::string segmentParams )
   { std::istringstream ss((*iter).second); ss >> _num_threads;}
   else
   { _num_threads = 80; printf("Choose _num_threads = 80 as default\n");}
+  ftk::TaskRuntime::SetNumberOfThreads(_num_threads);
+
+  // Number of tiles segmented at the same time, to bound their memory (0 = one per thread)
+  iter = options.find("-max_tiles");
+  if(iter!=options.end())
+  { std::istringstream ss((*iter).second); ss >> _max_tiles;}
+  else
+  { _max_tiles = 0; printf("Choose _max_tiles = 0 (no limit) as default\n");}
+  ftk::TaskRuntime::SetStageLimit("segment", _max_tiles);
 
   iter = options.find("-Cy5_Image");
   if(iter!=options.end())
@@ -157,6 +166,7 @@ void ftkMainDarpaSegment::readParameters( std::string segmentParams )
   std::cout << std::endl << "_yTileBor: " << _yTileBor;
   std::cout << std::endl << "_zTileBor: " << _zTileBor;
   std::cout << std::endl << "_num_threads: " << _num_threads;
+  std::cout << std::endl << "_max_tiles: " << _max_tiles;
   std::cout << std::endl << "_Cy5_Image: " << _Cy5_Image;
   std::cout << std::endl << "_TRI_Image: " << _TRI_Image;
   std::cout << std::endl << "_GFP_Image: " << _GFP_Image;
@@ -318,10 +328,14 @@ void ftkMainDarpaSegment::runSegment(  )
     computeSplitConst( ImageMontage_DAP );
   }
 
-  if( _kx*_ky*_kz < _num_threads )
+  // ITK threads of the tiles running at the same time
+  int concurrentTiles = _kx*_ky*_kz;
+  if( _max_tiles > 0 && _max_tiles < concurrentTiles )
+    concurrentTiles = _max_tiles;
+  if( concurrentTiles < _num_threads )
   {
-    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(int(_num_threads/(_kx*_ky*_kz))); // This one can not be changed
-    itk::MultiThreader::SetGlobalMaximumNumberOfThreads(int(_num_threads/(_kx*_ky*_kz))); // This one can chenga
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(int(_num_threads/concurrentTiles)); // This one can not be changed
+    itk::MultiThreader::SetGlobalMaximumNumberOfThreads(int(_num_threads/concurrentTiles)); // This one can chenga
   }
   else
   {
@@ -329,15 +343,6 @@ void ftkMainDarpaSegment::runSegment(  )
     itk::MultiThreader::SetGlobalMaximumNumberOfThreads(1); // This one can chenga
   }
 
-  int num_threads = 1;
-#ifdef _OPENMP
-  omp_set_nested(1);
-#if _OPENMP >= 200805L
-  omp_set_max_active_levels(2);
-#endif
-  omp_set_num_threads(num_threads);
-#endif
-
   std::cout << std::endl << "fir MAX NUMBER OF CORES: " << itk::MultiThreader::GetGlobalMaximumNumberOfThreads() << ", fir DEFAULT NUMBER OF CORES: " << itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
 
   // 	rawImageType_uint::Pointer imageLabelMontage = rawImageType_uint::New();
@@ -376,224 +381,10 @@ void ftkMainDarpaSegment::runSegment(  )
   // 	}
 
 
-  int contadorSegment = 0;
-  int contadorImageDoneSegment = 0;
-  int contadorStich = 0;
-  unsigned int maxValue = 0;
-  unsigned int maxValueOld = 0;
-  int flagFirstStich = 1;
-#if _OPENMP < 200805L
-#pragma omp parallel
-#else
-#pragma omp parallel for collapse(3) num_threads(_num_threads) schedule(dynamic, 1)
-#endif
-  for(int xco = 0; xco < _kx; xco++)
-  {
-    for(int yco = 0; yco < _ky; yco++)
-    {
-      for(int zco = 0; zco < _kz; zco++)
-      {
-#pragma omp critical
-        {
-          ++contadorSegment;
-          std::cout<<std::endl<< "\t\t--->>> ImageSegment " << contadorSegment << " of " << _kx*_ky*_kz;
-        }
-
-        rawImageType_8bit::RegionType regionLocal_inside = ComputeLocalRegionSegment( ImageMontageSize, xco, yco, zco ); // The inside
-        rawImageType_uint::RegionType regionMontage_inside = ComputeGlobalRegionSegment( ImageMontageSize, xco, yco, zco ); // The inside
-
-        rawImageType_8bit::RegionType regionLocal_all = ComputeLocalRegionSplit( ImageMontageSize, xco, yco, zco );
-        rawImageType_8bit::RegionType regionMontage_all = ComputeGlobalRegionSplit( ImageMontageSize, xco, yco, zco );
-
-        // Store local image
-        std::stringstream out_x;
-        std::stringstream out_y;
-        std::stringstream out_z;
-        out_x<<xco;
-        out_y<<yco;
-        out_z<<zco;
-        std::string xStr = out_x.str();
-        std::string yStr = out_y.str();
-        std::string zStr = out_z.str();
-
-        // 				std::cout << std::endl << "REGION_LOC: " << regionLocal_inside;
-        // 				std::cout << std::endl << "REGION_MON: " << regionMontage_inside;
-
-        rawImageType_8bit::Pointer imageLocalCy5;
-        rawImageType_8bit::Pointer imageLocalTRI;
-        rawImageType_8bit::Pointer imageLocalGFP;
-        rawImageType_8bit::Pointer imageLocalDAP;
-
-        std::vector< rawImageType_8bit::Pointer > Images_Tiles;
-        Images_Tiles.resize(4);
-
-
-        std::vector< rawImageType_16bit::Pointer > Label_Tiles;
-        Label_Tiles.resize(1);
-
-        std::vector< vtkSmartPointer< vtkTable > > Table_Tiles;
-        Table_Tiles.resize(1);
-
-        std::vector< std::map< unsigned int, itk::Index<3> > > Centroids_Tiles;
-        Centroids_Tiles.resize(1);
-
-        // Reading part
-#pragma omp critical
-        {
-          if( !_GFP_Image.empty( ) )
-          {
-            int foundGFP = _GFP_Image.find_last_of("/\\");
-            std::string _GFP_ImageNoPath = _GFP_Image.substr(foundGFP+1);
-            // !!! this has to be nrrd is just to test
-            std::string tempGFP = _outPathTemp+"/"+_GFP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-            imageLocalGFP = readImage< rawImageType_8bit >(tempGFP.c_str());
-          }
-          if( !_DAP_Image.empty() )
-          {
-            int foundDAP = _DAP_Image.find_last_of("/\\");
-            std::string _DAP_ImageNoPath = _DAP_Image.substr(foundDAP+1);
-            // !!! this has to be nrrd is just to test
-            std::string tempDAP = _outPathTemp+"/"+_DAP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-            imageLocalDAP = readImage< rawImageType_8bit >(tempDAP.c_str());
-          }
-          if( !_Cy5_Image.empty() )
-          {
-            int foundCy5 = _Cy5_Image.find_last_of("/\\");
-            std::string _Cy5_ImageNoPath = _Cy5_Image.substr(foundCy5+1);
-            // !!! this has to be nrrd is just to test
-            std::string tempCy5 = _outPathTemp+"/"+_Cy5_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-            imageLocalCy5 = readImage< rawImageType_8bit >(tempCy5.c_str());
-          }
-          if( !_TRI_Image.empty() )
-          {
-            int foundTRI = _TRI_Image.find_last_of("/\\");
-            std::string _TRI_ImageNoPath = _TRI_Image.substr(foundTRI+1);
-            // !!! this has to be nrrd is just to test
-            std::string tempTRI = _outPathTemp+"/"+_TRI_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
-            imageLocalTRI = readImage< rawImageType_8bit >(tempTRI.c_str());
-          }
-
-
-        }
-        Images_Tiles[0] = imageLocalCy5;
-        Images_Tiles[1] = imageLocalTRI;
-        Images_Tiles[2] = imageLocalGFP;
-        Images_Tiles[3] = imageLocalDAP;
-
-        // 				RunSegmentation(regionLocal_inside, Images_Tiles, Label_Tiles, Table_Tiles, Centroids_Tiles);
-
-        Label_Tiles[0] = RunNuclearSegmentation( Images_Tiles[3] );
-        Table_Tiles[0] = ComputeFeaturesAndAssociations( Images_Tiles, Label_Tiles );
-        Centroids_Tiles[0] = GetLabelToCentroidMap(Table_Tiles[0]);
-
-        // 					// TEST PUT A NUMBER IN THE REGION OF INTERES
-        // 					IteratorType_16bit iterLocal16_2 = IteratorType_16bit(Label_Tiles[0],regionLocal_inside); iterLocal16_2.GoToBegin();
-        // 					for(;!iterLocal16_2.IsAtEnd();++iterLocal16_2)
-        // 						iterLocal16_2.Set(50000);
-        // 					// TEST SAVE SEGMENTATION
-        // 					std::string tempLABEL = _outPathDebugLevel2+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+".tif";
-        // 					std::string tempTABLE = _outPathDebugLevel2+"/segTable_"+"_"+xStr+"_"+yStr+"_"+zStr+".txt";
-        // 					writeImage<rawImageType_16bit>(Label_Tiles[0],tempLABEL.c_str());
-        // 					ftk::SaveTable(tempTABLE, Table_Tiles[0]);
-
-        RemoveLabelNearBorder(regionLocal_inside, Label_Tiles, Table_Tiles, Centroids_Tiles );
-
-
-
-        // 					// TEST SAVE SEGMENTATION WITH LABELS REMOVED
-#pragma omp critical
-        {
-          std::string tempTABLERE = _outPathTemp+"/segTable_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.txt";
-          ftk::SaveTable(tempTABLERE, Table_Tiles[0]);
-          std::string tempLABELRE = _outPathTemp+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.nrrd";
-          writeImage<rawImageType_16bit>(Label_Tiles[0],tempLABELRE.c_str());
-
-          // 				std::string tempLABELRE = _outPathDebugLevel2+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.tif";
-          ftkMainDarpa objftkMainDarpa;
-          objftkMainDarpa.projectImage<rawImageType_16bit, rawImageType_16bit>( Label_Tiles[0], tempLABELRE, _outPathDebugLevel2, "ORG_RES_BIN", "TIFF" );
-        }
-        // /*					// TEST PUT A NUMBER IN THE REGION OF INTERES
-        // 					IteratorType_16bit iterLocal16_3 = IteratorType_16bit(Label_Tiles[0],regionLocal_inside); iterLocal16_3.GoToBegin();
-        // 					for(;!iterLocal16_3.IsAtEnd();++iterLocal16_3)
-        // 						iterLocal16_3.Set(50000);
-        // 					std::string tempLABELREGIO = _outPathDebugLevel2+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REGION.nrrd";
-        // 					writeImage<rawImageType_16bit>(Label_Tiles[0],tempLABELREGIO.c_str());*/
-
-        // 				StichResults( imageLabelMontage, Label_Tiles, Table_Tiles, Centroids_Tiles );
-
-        // 				#pragma omp critical
-        // 				{
-        // 					++contadorStich;
-        // 					std::cout<<std::endl<< "\t\t--->>> ImageStich " << contadorStich << " of " << _kx*_ky*_kz;
-        //
-        // 					if( flagFirstStich == 1 )
-        // 					{
-        // 						flagFirstStich = 0;
-        // 						tableLabelMontage = vtkSmartPointer<vtkTable>::New();
-        // 						tableLabelMontage->Initialize();
-        // 						for(int c=0; c<(int)Table_Tiles[0]->GetNumberOfColumns(); ++c)
-        // 						{
-        // 							vtkSmartPointer<vtkDoubleArray> column = vtkSmartPointer<vtkDoubleArray>::New();
-        // 							column->SetName( Table_Tiles[0]->GetColumnName(c) );
-        // 							tableLabelMontage->AddColumn(column);
-        // 						}
-        // 					}
-        //
-        // 					maxValueOld = maxValue;
-        // 					if((unsigned long long)Table_Tiles[0]->GetNumberOfRows() != 0)
-        // 					{
-        // 						std::cout << std::endl << "\t\tpiu11 The number of row: " << (int)Table_Tiles[0]->GetNumberOfRows() << " in " << contadorStich;
-        // 						for(int r=0; r<(int)Table_Tiles[0]->GetNumberOfRows(); ++r)
-        // 						{
-        // 							vtkSmartPointer<vtkVariantArray> model_data1 = vtkSmartPointer<vtkVariantArray>::New();
-        // 							for(int c=0; c<(int)Table_Tiles[0]->GetNumberOfColumns(); ++c)
-        // 							{
-        // 								if(c == 0)
-        // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToUnsignedInt() + maxValue));
-        // 								else if(c == 1)
-        // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToInt() + regionMontage_all.GetIndex()[0]));
-        // 								else if(c == 2)
-        // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToInt() + regionMontage_all.GetIndex()[1]));
-        // 								else if(c == 3)
-        // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToInt() + regionMontage_all.GetIndex()[2]));
-        // 								else
-        // 									model_data1->InsertNextValue(Table_Tiles[0]->GetValue(r,c));
-        // 							}
-        // 							tableLabelMontage->InsertNextRow(model_data1);
-        // 						}
-        // 						std::cout << std::endl << "\t\tpiu11 The maxvaule before: " << maxValue << " ";
-        // 						maxValue = tableLabelMontage->GetValue((int)tableLabelMontage->GetNumberOfRows()-1, 0).ToUnsignedInt();
-        // 						std::cout << "after: " << maxValue << " in " << contadorStich;
-        // 					}
-        //
-        // 					IteratorType_uint iterMontage_1 = IteratorType_uint(imageLabelMontage,regionMontage_all);
-        // 					iterMontage_1.GoToBegin();
-        //
-        // 	// 				IteratorType_8bit iterLocal_1 = IteratorType_8bit(imageLocalDAP,regionLocal_inside);
-        // 	// 				iterLocal_1.GoToBegin();
-        //
-        // 					IteratorType_16bit iterLocal16_1 = IteratorType_16bit(Label_Tiles[0],regionLocal_all);
-        // 					iterLocal16_1.GoToBegin();
-        //
-        // 					for(;!iterMontage_1.IsAtEnd();++iterMontage_1)
-        // 					{
-        // 	// 					iterMontage_1.Set(iterLocal_1.Get());
-        // 	// 					++iterLocal8_1;
-        // 						if( iterLocal16_1.Get() != 0 )
-        // 							iterMontage_1.Set(iterLocal16_1.Get() + maxValueOld);
-        // 						++iterLocal16_1;
-        // 					}
-        //
-        // 					std::cout<<std::endl<< "\t\t--->>> ImageStichDone " << contadorStich << " of " << _kx*_ky*_kz;
-        // 				}
-#pragma omp critical
-        {
-          contadorImageDoneSegment++;
-          std::cout<<std::endl<< "\t\t--->>> ImageDoneSegment " << contadorImageDoneSegment << " of " << _kx*_ky*_kz;
-        }
-      }
-    }
-  }
+  _tileMontageSize = ImageMontageSize;
+  _tileCounter = 0;
+  _tileDoneCounter = 0;
+  ftk::ParallelFor( 0, _kx*_ky*_kz, ftk::MemberBody< ftkMainDarpaSegment >( this, &ftkMainDarpaSegment::SegmentTile ), 1, "segment" );
 
   // 	std::string temp9 = _GFP_Image+"_label.nrrd";
   // // 	std::cout << std::endl << "SOMA STORED " << temp9;
@@ -752,6 +543,212 @@ void ftkMainDarpaSegment::runSegment(  )
 
 }
 
+void ftkMainDarpaSegment::SegmentTile( int tile )
+{
+  int xco = tile / (_ky*_kz);
+  int yco = (tile / _kz) % _ky;
+  int zco = tile % _kz;
+
+  {
+    ftk::TaskLock lock( _tileMutex );
+    ++_tileCounter;
+    std::cout<<std::endl<< "\t\t--->>> ImageSegment " << _tileCounter << " of " << _kx*_ky*_kz;
+  }
+
+  rawImageType_8bit::RegionType regionLocal_inside = ComputeLocalRegionSegment( _tileMontageSize, xco, yco, zco ); // The inside
+  rawImageType_uint::RegionType regionMontage_inside = ComputeGlobalRegionSegment( _tileMontageSize, xco, yco, zco ); // The inside
+
+  rawImageType_8bit::RegionType regionLocal_all = ComputeLocalRegionSplit( _tileMontageSize, xco, yco, zco );
+  rawImageType_8bit::RegionType regionMontage_all = ComputeGlobalRegionSplit( _tileMontageSize, xco, yco, zco );
+
+  // Store local image
+  std::stringstream out_x;
+  std::stringstream out_y;
+  std::stringstream out_z;
+  out_x<<xco;
+  out_y<<yco;
+  out_z<<zco;
+  std::string xStr = out_x.str();
+  std::string yStr = out_y.str();
+  std::string zStr = out_z.str();
+
+  // 				std::cout << std::endl << "REGION_LOC: " << regionLocal_inside;
+  // 				std::cout << std::endl << "REGION_MON: " << regionMontage_inside;
+
+  rawImageType_8bit::Pointer imageLocalCy5;
+  rawImageType_8bit::Pointer imageLocalTRI;
+  rawImageType_8bit::Pointer imageLocalGFP;
+  rawImageType_8bit::Pointer imageLocalDAP;
+
+  std::vector< rawImageType_8bit::Pointer > Images_Tiles;
+  Images_Tiles.resize(4);
+
+
+  std::vector< rawImageType_16bit::Pointer > Label_Tiles;
+  Label_Tiles.resize(1);
+
+  std::vector< vtkSmartPointer< vtkTable > > Table_Tiles;
+  Table_Tiles.resize(1);
+
+  std::vector< std::map< unsigned int, itk::Index<3> > > Centroids_Tiles;
+  Centroids_Tiles.resize(1);
+
+  // Reading part
+  {
+    ftk::TaskLock lock( _tileMutex );
+    if( !_GFP_Image.empty( ) )
+    {
+      int foundGFP = _GFP_Image.find_last_of("/\\");
+      std::string _GFP_ImageNoPath = _GFP_Image.substr(foundGFP+1);
+      // !!! this has to be nrrd is just to test
+      std::string tempGFP = _outPathTemp+"/"+_GFP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+      imageLocalGFP = readImage< rawImageType_8bit >(tempGFP.c_str());
+    }
+    if( !_DAP_Image.empty() )
+    {
+      int foundDAP = _DAP_Image.find_last_of("/\\");
+      std::string _DAP_ImageNoPath = _DAP_Image.substr(foundDAP+1);
+      // !!! this has to be nrrd is just to test
+      std::string tempDAP = _outPathTemp+"/"+_DAP_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+      imageLocalDAP = readImage< rawImageType_8bit >(tempDAP.c_str());
+    }
+    if( !_Cy5_Image.empty() )
+    {
+      int foundCy5 = _Cy5_Image.find_last_of("/\\");
+      std::string _Cy5_ImageNoPath = _Cy5_Image.substr(foundCy5+1);
+      // !!! this has to be nrrd is just to test
+      std::string tempCy5 = _outPathTemp+"/"+_Cy5_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+      imageLocalCy5 = readImage< rawImageType_8bit >(tempCy5.c_str());
+    }
+    if( !_TRI_Image.empty() )
+    {
+      int foundTRI = _TRI_Image.find_last_of("/\\");
+      std::string _TRI_ImageNoPath = _TRI_Image.substr(foundTRI+1);
+      // !!! this has to be nrrd is just to test
+      std::string tempTRI = _outPathTemp+"/"+_TRI_ImageNoPath+"_"+xStr+"_"+yStr+"_"+zStr+".nrrd";
+      imageLocalTRI = readImage< rawImageType_8bit >(tempTRI.c_str());
+    }
+
+
+  }
+  Images_Tiles[0] = imageLocalCy5;
+  Images_Tiles[1] = imageLocalTRI;
+  Images_Tiles[2] = imageLocalGFP;
+  Images_Tiles[3] = imageLocalDAP;
+
+  // 				RunSegmentation(regionLocal_inside, Images_Tiles, Label_Tiles, Table_Tiles, Centroids_Tiles);
+
+  Label_Tiles[0] = RunNuclearSegmentation( Images_Tiles[3] );
+  Table_Tiles[0] = ComputeFeaturesAndAssociations( Images_Tiles, Label_Tiles );
+  Centroids_Tiles[0] = GetLabelToCentroidMap(Table_Tiles[0]);
+
+  // 					// TEST PUT A NUMBER IN THE REGION OF INTERES
+  // 					IteratorType_16bit iterLocal16_2 = IteratorType_16bit(Label_Tiles[0],regionLocal_inside); iterLocal16_2.GoToBegin();
+  // 					for(;!iterLocal16_2.IsAtEnd();++iterLocal16_2)
+  // 						iterLocal16_2.Set(50000);
+  // 					// TEST SAVE SEGMENTATION
+  // 					std::string tempLABEL = _outPathDebugLevel2+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+".tif";
+  // 					std::string tempTABLE = _outPathDebugLevel2+"/segTable_"+"_"+xStr+"_"+yStr+"_"+zStr+".txt";
+  // 					writeImage<rawImageType_16bit>(Label_Tiles[0],tempLABEL.c_str());
+  // 					ftk::SaveTable(tempTABLE, Table_Tiles[0]);
+
+  RemoveLabelNearBorder(regionLocal_inside, Label_Tiles, Table_Tiles, Centroids_Tiles );
+
+
+
+  // 					// TEST SAVE SEGMENTATION WITH LABELS REMOVED
+  {
+    ftk::TaskLock lock( _tileMutex );
+    std::string tempTABLERE = _outPathTemp+"/segTable_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.txt";
+    ftk::SaveTable(tempTABLERE, Table_Tiles[0]);
+    std::string tempLABELRE = _outPathTemp+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.nrrd";
+    writeImage<rawImageType_16bit>(Label_Tiles[0],tempLABELRE.c_str());
+
+    // 				std::string tempLABELRE = _outPathDebugLevel2+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REMO.tif";
+    ftkMainDarpa objftkMainDarpa;
+    objftkMainDarpa.projectImage<rawImageType_16bit, rawImageType_16bit>( Label_Tiles[0], tempLABELRE, _outPathDebugLevel2, "ORG_RES_BIN", "TIFF" );
+  }
+  // /*					// TEST PUT A NUMBER IN THE REGION OF INTERES
+  // 					IteratorType_16bit iterLocal16_3 = IteratorType_16bit(Label_Tiles[0],regionLocal_inside); iterLocal16_3.GoToBegin();
+  // 					for(;!iterLocal16_3.IsAtEnd();++iterLocal16_3)
+  // 						iterLocal16_3.Set(50000);
+  // 					std::string tempLABELREGIO = _outPathDebugLevel2+"/segLabel_"+"_"+xStr+"_"+yStr+"_"+zStr+"_REGION.nrrd";
+  // 					writeImage<rawImageType_16bit>(Label_Tiles[0],tempLABELREGIO.c_str());*/
+
+  // 				StichResults( imageLabelMontage, Label_Tiles, Table_Tiles, Centroids_Tiles );
+
+  // 				#pragma omp critical
+  // 				{
+  // 					++contadorStich;
+  // 					std::cout<<std::endl<< "\t\t--->>> ImageStich " << contadorStich << " of " << _kx*_ky*_kz;
+  //
+  // 					if( flagFirstStich == 1 )
+  // 					{
+  // 						flagFirstStich = 0;
+  // 						tableLabelMontage = vtkSmartPointer<vtkTable>::New();
+  // 						tableLabelMontage->Initialize();
+  // 						for(int c=0; c<(int)Table_Tiles[0]->GetNumberOfColumns(); ++c)
+  // 						{
+  // 							vtkSmartPointer<vtkDoubleArray> column = vtkSmartPointer<vtkDoubleArray>::New();
+  // 							column->SetName( Table_Tiles[0]->GetColumnName(c) );
+  // 							tableLabelMontage->AddColumn(column);
+  // 						}
+  // 					}
+  //
+  // 					maxValueOld = maxValue;
+  // 					if((unsigned long long)Table_Tiles[0]->GetNumberOfRows() != 0)
+  // 					{
+  // 						std::cout << std::endl << "\t\tpiu11 The number of row: " << (int)Table_Tiles[0]->GetNumberOfRows() << " in " << contadorStich;
+  // 						for(int r=0; r<(int)Table_Tiles[0]->GetNumberOfRows(); ++r)
+  // 						{
+  // 							vtkSmartPointer<vtkVariantArray> model_data1 = vtkSmartPointer<vtkVariantArray>::New();
+  // 							for(int c=0; c<(int)Table_Tiles[0]->GetNumberOfColumns(); ++c)
+  // 							{
+  // 								if(c == 0)
+  // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToUnsignedInt() + maxValue));
+  // 								else if(c == 1)
+  // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToInt() + regionMontage_all.GetIndex()[0]));
+  // 								else if(c == 2)
+  // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToInt() + regionMontage_all.GetIndex()[1]));
+  // 								else if(c == 3)
+  // 									model_data1->InsertNextValue(vtkVariant(Table_Tiles[0]->GetValue(r,c).ToInt() + regionMontage_all.GetIndex()[2]));
+  // 								else
+  // 									model_data1->InsertNextValue(Table_Tiles[0]->GetValue(r,c));
+  // 							}
+  // 							tableLabelMontage->InsertNextRow(model_data1);
+  // 						}
+  // 						std::cout << std::endl << "\t\tpiu11 The maxvaule before: " << maxValue << " ";
+  // 						maxValue = tableLabelMontage->GetValue((int)tableLabelMontage->GetNumberOfRows()-1, 0).ToUnsignedInt();
+  // 						std::cout << "after: " << maxValue << " in " << contadorStich;
+  // 					}
+  //
+  // 					IteratorType_uint iterMontage_1 = IteratorType_uint(imageLabelMontage,regionMontage_all);
+  // 					iterMontage_1.GoToBegin();
+  //
+  // 	// 				IteratorType_8bit iterLocal_1 = IteratorType_8bit(imageLocalDAP,regionLocal_inside);
+  // 	// 				iterLocal_1.GoToBegin();
+  //
+  // 					IteratorType_16bit iterLocal16_1 = IteratorType_16bit(Label_Tiles[0],regionLocal_all);
+  // 					iterLocal16_1.GoToBegin();
+  //
+  // 					for(;!iterMontage_1.IsAtEnd();++iterMontage_1)
+  // 					{
+  // 	// 					iterMontage_1.Set(iterLocal_1.Get());
+  // 	// 					++iterLocal8_1;
+  // 						if( iterLocal16_1.Get() != 0 )
+  // 							iterMontage_1.Set(iterLocal16_1.Get() + maxValueOld);
+  // 						++iterLocal16_1;
+  // 					}
+  //
+  // 					std::cout<<std::endl<< "\t\t--->>> ImageStichDone " << contadorStich << " of " << _kx*_ky*_kz;
+  // 				}
+  {
+    ftk::TaskLock lock( _tileMutex );
+    _tileDoneCounter++;
+    std::cout<<std::endl<< "\t\t--->>> ImageDoneSegment " << _tileDoneCounter << " of " << _kx*_ky*_kz;
+  }
+}
+
 void ftkMainDarpaSegment::runStich(  )
 {
   std::cout << std::endl << "HERE HERE_2";
@@ -36,6 +36,7 @@ class ftkMainDarpaSegment
 
   protected:
     void computeSplitConst( rawImageType_8bit::Pointer ImageMontage );
+    void SegmentTile( int tile ); // one iteration of runSegment, tile = (xco*_ky + yco)*_kz + zco
     void RunSegmentation(rawImageType_8bit::RegionType, std::vector< rawImageType_8bit::Pointer >&, std::vector< rawImageType_16bit::Pointer >&, std::vector< vtkSmartPointer< vtkTable > >&, std::vector< std::map< unsigned int, itk::Index<3> > > &);
 
     rawImageType_16bit::Pointer RunNuclearSegmentation(rawImageType_8bit::Pointer );
@@ -58,6 +59,7 @@ class ftkMainDarpaSegment
     int _yTileBor;
     int _zTileBor;
     int _num_threads;
+    int _max_tiles;
     std::string _Cy5_Image;
     std::string _TRI_Image;
     std::string _GFP_Image;
@@ -92,6 +94,12 @@ class ftkMainDarpaSegment
     int _kx;
     int _ky;
     int _kz;
+
+    // Shared by the SegmentTile tasks
+    itk::Size<3> _tileMontageSize;
+    int _tileCounter;
+    int _tileDoneCounter;
+    ftk::TaskMutex _tileMutex;
 };
 
 // #include "ftkMainDarpaSegment.hxx"
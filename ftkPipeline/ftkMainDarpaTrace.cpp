@@ -63,6 +63,15 @@ void ftkMainDarpaTrace::readParameters( std::string segmentParams )
   { std::istringstream ss((*iter).second); ss >> _num_threads;}
   else
   { _num_threads = 80; printf("Choose _num_threads = 80 as default\n");}
+  ftk::TaskRuntime::SetNumberOfThreads(_num_threads);
+
+  // Number of centroids traced at the same time, to bound their memory (0 = one per thread)
+  iter = options.find("-max_traces");
+  if(iter!=options.end())
+  { std::istringstream ss((*iter).second); ss >> _max_traces;}
+  else
+  { _max_traces = 0; printf("Choose _max_traces = 0 (no limit) as default\n");}
+  ftk::TaskRuntime::SetStageLimit("trace", _max_traces);
 
   iter = options.find("-Cy5_Image");
   if(iter!=options.end())
@@ -164,6 +173,7 @@ void ftkMainDarpaTrace::readParameters( std::string segmentParams )
   std::cout << std::endl << "_yTile: " << _yTile;
   std::cout << std::endl << "_zTile: " << _zTile;
   std::cout << std::endl << "_num_threads: " << _num_threads;
+  std::cout << std::endl << "_max_traces: " << _max_traces;
   std::cout << std::endl << "_Cy5_Image: " << _Cy5_Image;
   std::cout << std::endl << "_TRI_Image: " << _TRI_Image;
   std::cout << std::endl << "_GFP_Image: " << _GFP_Image;
@@ -301,25 +311,18 @@ void ftkMainDarpaTrace::runTracing()
   {
     itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1); // This one can not be changed
     //itk::MultiThreader::SetGlobalMaximumNumberOfThreads(1); // This one can chenga
-    int num_threads = 1;
-#ifdef _OPENMP
-    omp_set_nested(1);
-#if _OPENMP >= 200805L
-    omp_set_max_active_levels(2);
-#endif
-    omp_set_num_threads(num_threads);
-#endif
   }
 
-  int counterCentro = 0;
-  std::vector< itk::Index<3> > centroid_list = getCentroidList();
-  std::cout << "Number of cells to be traced : " << centroid_list.size() << "\n";
+  _centroidCounter = 0;
+  _centroidList = getCentroidList();
+  std::cout << "Number of cells to be traced : " << _centroidList.size() << "\n";
 
   std::string SWCFilename = _outPath + "/OnlySWC.xml";
   std::ofstream outSWCFile;
   outSWCFile.open(SWCFilename.c_str());
   outSWCFile << "<?xml\tversion=\"1.0\"\t?>\n";
   outSWCFile << "<Source>\n\n";
+  _outSWCFile = &outSWCFile;
 
   computeSplitConst();
 
@@ -402,14 +405,6 @@ void ftkMainDarpaTrace::runTracing()
     {
       itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1); // This one can not be changed
       //itk::MultiThreader::SetGlobalMaximumNumberOfThreads(80); // This one can chenga
-      int num_threads = 1;
-#ifdef _OPENMP
-      omp_set_nested(1);
-#if _OPENMP >= 200805L
-      omp_set_max_active_levels(2);
-#endif
-      omp_set_num_threads(num_threads);
-#endif
     }
     _img_traceDesiredRegion = readImageRegion< rawImageType_flo >( _GFP_ImagePREPMNT.c_str(), desiredRegionBigTileLOG );
     _somaMontageDesiredRegion = readImageRegion< rawImageType_uint >( _Soma_MontageNRRD.c_str(), desiredRegionBigTileLOG );
@@ -422,7 +417,7 @@ void ftkMainDarpaTrace::runTracing()
     std::cout << std::endl << "Now the GVF and Vessel will be computed " << std::flush;
     int num_iteration = 15;
     int smoothing_scale = 1;
-    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(80); // This one can chenga
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(_num_threads); // This one can chenga
 
     MultipleNeuronTracer * MNT = new MultipleNeuronTracer();
     MNT->computeGVF_2(_img_traceDesiredRegion,100,num_iteration,smoothing_scale);
@@ -441,201 +436,181 @@ void ftkMainDarpaTrace::runTracing()
     //_img_VesselDesiredRegion = readImage< rawImageType_flo >( vesselPath.c_str() );
 
 
-#pragma omp parallel for num_threads(_num_threads) schedule(dynamic, 1)
-    for(  long long a=0; a<centroid_list.size(); ++a )
-      if( _isSmall == 1 )
-      {
-        itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1); // This one can not be changed
-        //itk::MultiThreader::SetGlobalMaximumNumberOfThreads(1); // This one can chenga
-        int num_threads = 1;
-#ifdef _OPENMP
-        omp_set_nested(1);
-#if _OPENMP >= 200805L
-        omp_set_max_active_levels(2);
-#endif
-        omp_set_num_threads(num_threads);
-#endif
-      }
+    _bigTile = bigTile;
+    ftk::ParallelFor( 0, (int)_centroidList.size(), ftk::MemberBody< ftkMainDarpaTrace >( this, &ftkMainDarpaTrace::TraceCentroid ), 1, "trace" );
+  }
+}
+
+void ftkMainDarpaTrace::TraceCentroid( int a )
+{
+  int x, y, z;
+  std::stringstream ssx, ssy, ssz;
+
+  x = _centroidList[a][0];
+  y = _centroidList[a][1];
+  z = _centroidList[a][2];
+
+  unsigned long long yMin = _initialBigTileCEN[_bigTile][1];
+  unsigned long long yMax = _initialBigTileCEN[_bigTile][1] + _sizeOfBigTilesCEN[_bigTile][1];
+
+  if(!( (yMin <= y) && (y < yMax) ) )
+  {
+    return;
+  }
+
+  ssx << x; ssy << y; ssz << z;
+
+  {
+    ftk::TaskLock lock( _traceMutex );
+    _centroidCounter++;
+    std::cout<<std::endl<<"\t\t\t\t asdfasdf ----->>>>> " << _centroidCounter << ", of " << _centroidList.size();
+    std::cout<<", x: "<<_centroidList[a][0]<<", y: "<<_centroidList[a][1]<<", z: "<<_centroidList[a][2]<<std::endl;
+  }
+
+  // 			std::cout << std::endl << "x: " << x << ", y: " << y << ", z: " << z;
+  // 			std::cout << std::endl << "xTile: " << _xTile << ", yTile: " << _yTile << ", zTile: " << _zTile;
+
+  std::stringstream ssx_off, ssy_off, ssz_off;
+  std::stringstream ssx_offBig, ssy_offBig, ssz_offBig;
+  ssx_offBig << 0;
+  ssy_offBig << 0;
+  ssz_offBig << 0;
+  if(x >= _xTile/2)
+    ssx_off << x - _xTile/2;
+  else
+    ssx_off << 0;
+  if(y >= _yTile/2)
+    ssy_off << y - _yTile/2;
+  else
+    ssy_off << 0;
+  if(z >= _zTile/2)
+    ssz_off << z - _zTile/2;
+  else
+    ssz_off << 0;
+
+  // 			std::cout << std::endl << "_initialBigTileLOG: " << _initialBigTileLOG[_bigTile][1];
+
+  int x_local = x;
+  int y_local = y - _initialBigTileLOG[_bigTile][1];
+  int z_local = z;
+
+  // 			std::cout << std::endl << "x_local: " << x_local << ", y_local: " << y_local << ", z_local: " << z_local;
+  // 			std::cout << std::endl << "x: " << x << ", y: " << y << ", z: " << z;
+
+  if(x_local >= _xTile/2)
+    ssx_offBig << x_local - _xTile/2;
+  else
+    ssx_off << 0;
+  if(y_local >= _yTile/2)
+    ssy_offBig << y_local - _yTile/2;
+  else
+    ssy_off << 0;
+  if(z_local >= _zTile/2)
+    ssz_offBig << z_local - _zTile/2;
+  else
+    ssz_off << 0;
+
+  //########    CROP THE DESIRED DICE FROM THE GFP AND SOMA MONTAGES   ########
 
 
+  //########    FETCH ALL CENTROIDS THAT FALL WITHIN THE DICE    ########
+
+  std::vector< itk::Index<3> > soma_Table = getSomaTable(_centroidList, x, y, z );
+
+  // 			//########    RUN TRACING    ########
+  MultipleNeuronTracer * MNT = new MultipleNeuronTracer();
+
+  //
+  // 			Automatic parameter estimation
+  //
+  //MNT->LoadCurvImage_1(img_trace, 0);
+  //std::cout << std::endl << "LAREGION ES: " << _img_traceDesiredRegion;
+  rawImageType_flo::Pointer img_trace;
+  GradientImageType::Pointer img_gvf;
+  rawImageType_flo::Pointer img_vessel;
+
+  {
+    ftk::TaskLock lock( _traceMutex );
+    img_trace = cropImages< rawImageType_flo >( _img_traceDesiredRegion, x, y, z);
+    img_gvf = cropImages< GradientImageType >( _img_GVFDesiredRegion, x, y, z);;
+    img_vessel = cropImages< rawImageType_flo >( _img_VesselDesiredRegion, x, y, z);;
+    MNT->LoadCurvImage_2(img_trace);
+    MNT->setGVFImage(img_gvf);
+    MNT->setVesselImage(img_vessel);
+  }
+
+  //MNT->RunMask();
+  /*MNT->LoadParameters_1(_traceParams.c_str(),5);*/
+  float calc_intensity_threshold = 0;
+  float calc_contrast_threshold = 0;
+  if(_overridedefaultsTraceParams == "YES")
+  {
+    std::vector<float> features = this->computeFeatures(img_trace);
+    calc_intensity_threshold = getCalcThreshold(features,"intensity");
+    calc_contrast_threshold = getCalcThreshold(features,"contrast");
+    // For some images the threshold goes to negative in that case use the once that is specified in the
+    // option_mnt
+    if(calc_intensity_threshold < 0 || calc_contrast_threshold < 0 )
+    {
+      MNT->LoadParameters(_traceParams.c_str(),5);
+    }
+    else
+    {
+      MNT->LoadParameters_1(_traceParams.c_str(),calc_intensity_threshold,calc_contrast_threshold,350);
+    }
+  }else
+  {
+    if(_optimizeCoverage == 1){
+      std::string coverageFileName = _outPathDebug + "/Coverage_" + ssx.str() + "_" + ssy.str() + "_" + ssz.str() + ".txt";
 
-#pragma omp parallel for num_threads(_num_threads) schedule(dynamic, 1)
-#if _OPENMP >= 200805L
-    for( unsigned long long a=0; a<centroid_list.size(); ++a )
-#else
-      for( long long a=0; a<centroid_list.size(); ++a )	//OpenMP2.5 requires signed intergral type
-#endif
       {
-        int x, y, z;
-        std::stringstream ssx, ssy, ssz;
-
-        x = centroid_list[a][0];
-        y = centroid_list[a][1];
-        z = centroid_list[a][2];
-
-        unsigned long long yMin = initialBigIndexCEN[1];
-        unsigned long long yMax = initialBigIndexCEN[1] + sizeOfTheRegionCEN[1];
-
-        if(!( (yMin <= y) && (y < yMax) ) )
-        {
-          continue;
-        }
-
-        ssx << x; ssy << y; ssz << z;
-
-#pragma omp critical
-        {
-          counterCentro++;
-          std::cout<<std::endl<<"\t\t\t\t asdfasdf ----->>>>> " << counterCentro << ", of " << centroid_list.size();
-          std::cout<<", x: "<<centroid_list[a][0]<<", y: "<<centroid_list[a][1]<<", z: "<<centroid_list[a][2]<<std::endl;
-        }
-
-        // 			std::cout << std::endl << "x: " << x << ", y: " << y << ", z: " << z;
-        // 			std::cout << std::endl << "xTile: " << _xTile << ", yTile: " << _yTile << ", zTile: " << _zTile;
-
-        std::stringstream ssx_off, ssy_off, ssz_off;
-        std::stringstream ssx_offBig, ssy_offBig, ssz_offBig;
-        ssx_offBig << 0;
-        ssy_offBig << 0;
-        ssz_offBig << 0;
-        if(x >= _xTile/2)
-          ssx_off << x - _xTile/2;
-        else
-          ssx_off << 0;
-        if(y >= _yTile/2)
-          ssy_off << y - _yTile/2;
-        else
-          ssy_off << 0;
-        if(z >= _zTile/2)
-          ssz_off << z - _zTile/2;
-        else
-          ssz_off << 0;
-
-        // 			std::cout << std::endl << "_initialBigTileLOG: " << _initialBigTileLOG[bigTile][1];
-
-        int x_local = x;
-        int y_local = y - _initialBigTileLOG[bigTile][1];
-        int z_local = z;
-
-        // 			std::cout << std::endl << "x_local: " << x_local << ", y_local: " << y_local << ", z_local: " << z_local;
-        // 			std::cout << std::endl << "x: " << x << ", y: " << y << ", z: " << z;
-
-        if(x_local >= _xTile/2)
-          ssx_offBig << x_local - _xTile/2;
-        else
-          ssx_off << 0;
-        if(y_local >= _yTile/2)
-          ssy_offBig << y_local - _yTile/2;
-        else
-          ssy_off << 0;
-        if(z_local >= _zTile/2)
-          ssz_offBig << z_local - _zTile/2;
-        else
-          ssz_off << 0;
-
-        //########    CROP THE DESIRED DICE FROM THE GFP AND SOMA MONTAGES   ########
-
-
-        //########    FETCH ALL CENTROIDS THAT FALL WITHIN THE DICE    ########
-
-        std::vector< itk::Index<3> > soma_Table = getSomaTable(centroid_list, x, y, z );
-
-        // 			//########    RUN TRACING    ########
-        MultipleNeuronTracer * MNT = new MultipleNeuronTracer();
-
-        //
-        // 			Automatic parameter estimation
-        //
-        //MNT->LoadCurvImage_1(img_trace, 0);
-        //std::cout << std::endl << "LAREGION ES: " << _img_traceDesiredRegion;
-        rawImageType_flo::Pointer img_trace;
-        GradientImageType::Pointer img_gvf;
-        rawImageType_flo::Pointer img_vessel;
-
-#pragma omp critical
-        {
-          img_trace = cropImages< rawImageType_flo >( _img_traceDesiredRegion, x, y, z);
-          img_gvf = cropImages< GradientImageType >( _img_GVFDesiredRegion, x, y, z);;
-          img_vessel = cropImages< rawImageType_flo >( _img_VesselDesiredRegion, x, y, z);;
-          MNT->LoadCurvImage_2(img_trace);
-          MNT->setGVFImage(img_gvf);
-          MNT->setVesselImage(img_vessel);
-        }
-
-        //MNT->RunMask();
-        /*MNT->LoadParameters_1(_traceParams.c_str(),5);*/
-        float calc_intensity_threshold = 0;
-        float calc_contrast_threshold = 0;
-        if(_overridedefaultsTraceParams == "YES")
-        {
-          std::vector<float> features = this->computeFeatures(img_trace);
-          calc_intensity_threshold = getCalcThreshold(features,"intensity");
-          calc_contrast_threshold = getCalcThreshold(features,"contrast");
-          // For some images the threshold goes to negative in that case use the once that is specified in the
-          // option_mnt
-          if(calc_intensity_threshold < 0 || calc_contrast_threshold < 0 )
-          {
-            MNT->LoadParameters(_traceParams.c_str(),5);
-          }
-          else
-          {
-            MNT->LoadParameters_1(_traceParams.c_str(),calc_intensity_threshold,calc_contrast_threshold,350);
-          }
-        }else
-        {
-          if(_optimizeCoverage == 1){
-            std::string coverageFileName = _outPathDebug + "/Coverage_" + ssx.str() + "_" + ssy.str() + "_" + ssz.str() + ".txt";
-
-#pragma omp critical
-            {
-              MNT->OptimizeCoverage(coverageFileName, true);
-            }
-          }
-
-          MNT->LoadParameters(_traceParams.c_str(), 6);
-        }
-
-
-        MNT->ReadStartPoints_1(soma_Table, 0);
-        // 				MNT->SetCostThreshold(1000);
-        MNT->SetCostThreshold(MNT->cost_threshold);
-
-        // 	// 			MNT->LoadSomaImage_1(img_soma_yan);
-        bool flagLog = false;
-        bool flagPreComputedGVFVessel = true;
-        MNT->setFlagOutLog(flagLog);
-        MNT->RunGVFTracing(flagPreComputedGVFVessel);
-
-#pragma omp critical
-        {
-          rawImageType_uint::Pointer img_soma = cropImages< rawImageType_uint >( _somaMontageDesiredRegion, x, y, z);
-          MNT->RemoveSoma( img_soma );
-        }
-        //
-        x = std::min(_xTile/2, x);
-        y = std::min(_yTile/2, y);
-        z = std::min(_zTile/2, z);
-        //
-        vtkSmartPointer< vtkTable > swcTable = MNT->GetSWCTable(0);
-        delete MNT;
-        std::string swcFilename = _outPath + "/Trace_" + ssx.str() + "_" + ssy.str() + "_" + ssz.str() + "_ANT.swc";
-        WriteCenterTrace(swcTable, x, y, z, swcFilename);
-        //
-#pragma omp critical
-        {
-          outSWCFile << "\t<File\tFileName=\"Trace_" << ssx.str() << "_" << ssy.str() << "_" << ssz.str() << "_ANT.swc\"\tType=\"Trace\"\ttX=\"" << ssx_off.str() << "\"\ttY=\"" << ssy_off.str() << "\"\ttZ=\"" << ssz_off.str() << "\"/>\n";
-        }
-
-        // // 				vtkSmartPointer< vtkTable > swcTable = MNT->GetSWCTable(0);
-        // 				std::string swcFilenameDivided = _outPath + "/TracesAndSomasDivided/Trace_BigTile_" + srr + "_" + ssx.str() + "_" + ssy.str() + "_" + ssz.str() + "_ANT.swc";
-        // 				WriteCenterTrace(swcTable, x, y, z, swcFilenameDivided);
-        // //
-        // 				#pragma omp critical
-        // 				{
-        // 					outfileDivided << "\t<File\tFileName=\"Trace_BigTile_" << srr << "_" << ssx.str() << "_" << ssy.str() << "_" << ssz.str() << "_ANT.swc\"\tType=\"Trace\"\ttX=\"" << ssx_offBig.str() << "\"\ttY=\"" << ssy_offBig.str() << "\"\ttZ=\"" << ssz_offBig.str() << "\"/>\n";
-        // 				}
+        ftk::TaskLock lock( _traceMutex );
+        MNT->OptimizeCoverage(coverageFileName, true);
       }
+    }
+
+    MNT->LoadParameters(_traceParams.c_str(), 6);
   }
+
+
+  MNT->ReadStartPoints_1(soma_Table, 0);
+  // 				MNT->SetCostThreshold(1000);
+  MNT->SetCostThreshold(MNT->cost_threshold);
+
+  // 	// 			MNT->LoadSomaImage_1(img_soma_yan);
+  bool flagLog = false;
+  bool flagPreComputedGVFVessel = true;
+  MNT->setFlagOutLog(flagLog);
+  MNT->RunGVFTracing(flagPreComputedGVFVessel);
+
+  {
+    ftk::TaskLock lock( _traceMutex );
+    rawImageType_uint::Pointer img_soma = cropImages< rawImageType_uint >( _somaMontageDesiredRegion, x, y, z);
+    MNT->RemoveSoma( img_soma );
+  }
+  //
+  x = std::min(_xTile/2, x);
+  y = std::min(_yTile/2, y);
+  z = std::min(_zTile/2, z);
+  //
+  vtkSmartPointer< vtkTable > swcTable = MNT->GetSWCTable(0);
+  delete MNT;
+  std::string swcFilename = _outPath + "/Trace_" + ssx.str() + "_" + ssy.str() + "_" + ssz.str() + "_ANT.swc";
+  WriteCenterTrace(swcTable, x, y, z, swcFilename);
+  //
+  {
+    ftk::TaskLock lock( _traceMutex );
+    (*_outSWCFile) << "\t<File\tFileName=\"Trace_" << ssx.str() << "_" << ssy.str() << "_" << ssz.str() << "_ANT.swc\"\tType=\"Trace\"\ttX=\"" << ssx_off.str() << "\"\ttY=\"" << ssy_off.str() << "\"\ttZ=\"" << ssz_off.str() << "\"/>\n";
+  }
+
+  // // 				vtkSmartPointer< vtkTable > swcTable = MNT->GetSWCTable(0);
+  // 				std::string swcFilenameDivided = _outPath + "/TracesAndSomasDivided/Trace_BigTile_" + srr + "_" + ssx.str() + "_" + ssy.str() + "_" + ssz.str() + "_ANT.swc";
+  // 				WriteCenterTrace(swcTable, x, y, z, swcFilenameDivided);
+  // //
+  // 				#pragma omp critical
+  // 				{
+  // 					outfileDivided << "\t<File\tFileName=\"Trace_BigTile_" << srr << "_" << ssx.str() << "_" << ssy.str() << "_" << ssz.str() << "_ANT.swc\"\tType=\"Trace\"\ttX=\"" << ssx_offBig.str() << "\"\ttY=\"" << ssy_offBig.str() << "\"\ttZ=\"" << ssz_offBig.str() << "\"/>\n";
+  // 				}
 }
 
 
@@ -45,6 +45,7 @@ class ftkMainDarpaTrace
     template<typename TINPUT >
       typename TINPUT::Pointer cropImages( typename TINPUT::Pointer , int , int , int );
     void WriteCenterTrace(vtkSmartPointer< vtkTable > , int , int , int , std::string );
+    void TraceCentroid( int ); // one iteration of runTracing for the current _bigTile
 
   private:
     std::string _segmentParams;
@@ -58,6 +59,7 @@ class ftkMainDarpaTrace
     // 	int _yTileBor;
     // 	int _zTileBor;
     int _num_threads;
+    int _max_traces;
     std::string _Cy5_Image;
     std::string _TRI_Image;
     std::string _GFP_Image;
@@ -116,6 +118,12 @@ class ftkMainDarpaTrace
     rawImageType_flo::Pointer _img_VesselDesiredRegion;
     GradientImageType::Pointer _img_GVFDesiredRegion;
 
+    // Shared by the TraceCentroid tasks
+    std::vector< itk::Index<3> > _centroidList;
+    unsigned int _bigTile;
+    int _centroidCounter;
+    std::ofstream *_outSWCFile;
+    ftk::TaskMutex _traceMutex;
 };
 
 #include "ftkMainDarpaTrace.hxx"
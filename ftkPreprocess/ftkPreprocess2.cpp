@@ -13,6 +13,9 @@ See the License for the specific language governing permissions and
 limitations under the License.
 =========================================================================*/
 #include "ftkPreprocess2.h"
+#ifdef _OPENMP
+#include "omp.h"
+#endif
 
 namespace ftk
 {
@@ -26,11 +29,13 @@ Preprocess::Preprocess(ImageType3D::Pointer img)
 	//myImg = duplicator->GetOutput();
 	myImg=img;
 	SetImage(myImg);
+	SetTileSize();
 }
 
 Preprocess::Preprocess()
 {		
 	//will need SetImage called to function correctly
+	SetTileSize();
 }
 
 Preprocess::Preprocess(RGBImageType3D::Pointer img)
@@ -50,6 +55,7 @@ Preprocess::Preprocess(RGBImageType3D::Pointer img)
 
 	myImg = convert->GetOutput();
 	SetImage(myImg);
+	SetTileSize();
 }
 
 Preprocess::Preprocess(RGBImageType3D::Pointer img, const char color)
@@ -102,6 +108,7 @@ Preprocess::Preprocess(RGBImageType3D::Pointer img, const char color)
 		iteratorIn.Set( p_rgb[component] );
 	}
 	SetImage(myImg);
+	SetTileSize();
 }
 
 void Preprocess::SetImage(ImageType3D::Pointer img){	
@@ -109,6 +116,13 @@ void Preprocess::SetImage(ImageType3D::Pointer img){
 	myImg=img;
 }
 
+void Preprocess::SetTileSize(int x, int y, int z)
+{
+	tileSize[0] = x;
+	tileSize[1] = y;
+	tileSize[2] = z;
+}
+
 std::map<std::string, std::string> Preprocess::filterMap = Preprocess::CreateFilterMap();
 std::map<std::string, std::string> Preprocess::CreateFilterMap()
 {
@@ -148,6 +162,25 @@ void Preprocess::RunPipe(std::string filename)
 	TiXmlElement* parentElement = rootElement->FirstChildElement();
 	while (parentElement)
 	{
+		//Run a chain of neighborhood stages tile by tile, so the
+		//intermediate images are only as large as a tile
+		if( IsTileable(parentElement) && IsTileable(parentElement->NextSiblingElement()) )
+		{
+			std::vector<TiledStage> stages;
+			while( IsTileable(parentElement) )
+			{
+				stages.push_back( ReadTiledStage(parentElement) );
+				parentElement = parentElement->NextSiblingElement();
+			}
+			std::cout << "Starting " << stages.size() << " tiled stages (";
+			for(unsigned int i=0; i<stages.size(); ++i)
+				std::cout << (i ? " " : "") << stages[i].name;
+			std::cout << ")...";
+			this->RunTiledStages(stages);
+			std::cout << "done\n";
+			continue;
+		}
+
 		const char * parent = parentElement->Value();
 		if ( strcmp( parent, "LaplacianOfGaussian" ) == 0 )
 		{
@@ -297,6 +330,179 @@ void Preprocess::RunPipe(std::string filename)
 	//doc.close();
 }
 
+bool Preprocess::IsTileable(TiXmlElement * element)
+{
+	if(!element)
+		return false;
+	const char * name = element->Value();
+	return strcmp( name, "MedianFilter" ) == 0 || strcmp( name, "OpeningFilter" ) == 0
+		|| strcmp( name, "ClosingFilter" ) == 0 || strcmp( name, "InvertIntensity" ) == 0
+		|| strcmp( name, "ManualThreshold" ) == 0;
+}
+
+//Reads the arguments of a stage with the same defaults as RunPipe
+Preprocess::TiledStage Preprocess::ReadTiledStage(TiXmlElement * element)
+{
+	TiledStage stage;
+	stage.name = element->Value();
+	for(int d=0; d<3; ++d)
+	{
+		stage.radius[d] = 0;
+		stage.param[d] = 0;
+	}
+
+	if( stage.name == "MedianFilter" )
+	{
+		stage.param[0] = 2;
+		stage.param[1] = 3;
+		stage.param[2] = 0;
+		element->QueryIntAttribute("radiusX",&stage.param[0]);
+		element->QueryIntAttribute("radiusY",&stage.param[1]);
+		element->QueryIntAttribute("radiusZ",&stage.param[2]);
+		if(myImg->GetLargestPossibleRegion().GetSize()[2] == 1)
+			stage.param[2] = 0;
+		for(int d=0; d<3; ++d)
+			stage.radius[d] = stage.param[d];
+	}
+	else if( stage.name == "OpeningFilter" || stage.name == "ClosingFilter" )
+	{
+		stage.param[0] = 3;
+		element->QueryIntAttribute("radius",&stage.param[0]);
+		//an erosion and a dilation with the ball
+		for(int d=0; d<3; ++d)
+			stage.radius[d] = 2*stage.param[0];
+	}
+	else if( stage.name == "ManualThreshold" )
+	{
+		stage.param[0] = 128;
+		element->QueryIntAttribute("threshold", &stage.param[0]);
+		element->QueryIntAttribute("binary", &stage.param[1]);
+	}
+	return stage;
+}
+
+void Preprocess::RunTiledStage(const TiledStage & stage)
+{
+	if( stage.name == "MedianFilter" )
+		this->MedianFilter(stage.param[0], stage.param[1], stage.param[2]);
+	else if( stage.name == "OpeningFilter" )
+		this->OpeningFilter(stage.param[0]);
+	else if( stage.name == "ClosingFilter" )
+		this->ClosingFilter(stage.param[0]);
+	else if( stage.name == "InvertIntensity" )
+		this->InvertIntensity();
+	else if( stage.name == "ManualThreshold" )
+		this->ManualThreshold(stage.param[0], (bool)stage.param[1]);
+}
+
+//Every tile is copied with a halo of the summed radii of the stages
+//into a scratch image of its thread, and the stages are run on it with
+//the same filters as on the whole image. A pixel of the tile only
+//depends on pixels inside the halo, and the halo ends at the same
+//image borders as the whole image, so the output is identical to
+//running the stages one after the other on the whole image.
+void Preprocess::RunTiledStages(const std::vector<TiledStage> & stages)
+{
+	ImageType3D::RegionType region = myImg->GetLargestPossibleRegion();
+	ImageType3D::IndexType start = region.GetIndex();
+	ImageType3D::SizeType size = region.GetSize();
+
+	int halo[3] = {0, 0, 0};
+	for(unsigned int i=0; i<stages.size(); ++i)
+		for(int d=0; d<3; ++d)
+			halo[d] += stages[i].radius[d];
+
+	int tile[3], numTiles[3];
+	for(int d=0; d<3; ++d)
+	{
+		tile[d] = tileSize[d] > 0 ? std::min<int>(tileSize[d], (int)size[d]) : (int)size[d];
+		numTiles[d] = ((int)size[d] + tile[d] - 1) / tile[d];
+	}
+	int totalTiles = numTiles[0] * numTiles[1] * numTiles[2];
+
+	ImageType3D::Pointer outImg = ImageType3D::New();
+	outImg->SetRegions( region );
+	outImg->SetOrigin( myImg->GetOrigin() );
+	outImg->SetSpacing( myImg->GetSpacing() );
+	outImg->Allocate();
+
+	//One scratch pixel buffer per thread, allocated once for the largest
+	//halo and reused from tile to tile
+	int numThreads = 1;
+#ifdef _OPENMP
+	numThreads = omp_get_max_threads();
+	int itkThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+	itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1);
+#endif
+	ImageType3D::SizeValueType maxHaloPixels = 1;
+	for(int d=0; d<3; ++d)
+		maxHaloPixels *= std::min(tile[d] + 2*halo[d], (int)size[d]);
+	std::vector<ImageType3D::PixelContainerPointer> scratch(numThreads);
+
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int t=0; t<totalTiles; ++t)
+	{
+		int thread = 0;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+#endif
+		int cell[3] = { t % numTiles[0], (t / numTiles[0]) % numTiles[1], t / (numTiles[0] * numTiles[1]) };
+
+		ImageType3D::IndexType tileStart, haloStart;
+		ImageType3D::SizeType tileExtent, haloExtent;
+		for(int d=0; d<3; ++d)
+		{
+			int lo = cell[d] * tile[d];
+			int hi = std::min(lo + tile[d], (int)size[d]);
+			tileStart[d] = start[d] + lo;
+			tileExtent[d] = hi - lo;
+			int haloLo = std::max(lo - halo[d], 0);
+			int haloHi = std::min(hi + halo[d], (int)size[d]);
+			haloStart[d] = start[d] + haloLo;
+			haloExtent[d] = haloHi - haloLo;
+		}
+		ImageType3D::RegionType tileRegion( tileStart, tileExtent );
+		ImageType3D::RegionType haloRegion( haloStart, haloExtent );
+
+		ImageType3D::PixelContainerPointer & pixels = scratch[thread];
+		if( !pixels )
+		{
+			pixels = ImageType3D::PixelContainer::New();
+			pixels->Reserve( maxHaloPixels );
+		}
+		pixels->Reserve( haloRegion.GetNumberOfPixels() );	//never above the capacity, so no allocation
+
+		//In place stages release the buffer of their input, so the image
+		//is new for every tile and only the pixels are kept
+		ImageType3D::Pointer buffer = ImageType3D::New();
+		buffer->SetRegions( haloRegion );
+		buffer->SetOrigin( myImg->GetOrigin() );
+		buffer->SetSpacing( myImg->GetSpacing() );
+		buffer->SetPixelContainer( pixels );
+		itk::ImageRegionConstIterator< ImageType3D > itrIn( myImg, haloRegion );
+		itk::ImageRegionIterator< ImageType3D > itrBuffer( buffer, haloRegion );
+		for(itrIn.GoToBegin(), itrBuffer.GoToBegin(); !itrIn.IsAtEnd(); ++itrIn, ++itrBuffer)
+			itrBuffer.Set( itrIn.Get() );
+
+		Preprocess tilePrep( buffer );
+		for(unsigned int i=0; i<stages.size(); ++i)
+			tilePrep.RunTiledStage( stages[i] );
+
+		ImageType3D::Pointer result = tilePrep.GetImage();
+		itk::ImageRegionConstIterator< ImageType3D > itrResult( result, tileRegion );
+		itk::ImageRegionIterator< ImageType3D > itrOut( outImg, tileRegion );
+		for(itrResult.GoToBegin(), itrOut.GoToBegin(); !itrResult.IsAtEnd(); ++itrResult, ++itrOut)
+			itrOut.Set( itrResult.Get() );
+	}
+
+#ifdef _OPENMP
+	itk::MultiThreader::SetGlobalDefaultNumberOfThreads(itkThreads);
+#endif
+	myImg = outImg;
+}
+
 void Preprocess::RescaleIntensities(int min, int max)
 {
 	//Rescale the pixel values
@@ -563,26 +769,19 @@ void Preprocess::MedianFilter( int radiusX, int radiusY, int radiusZ)
 	if(size3==1)
 		radiusZ = 0;
 
-	ImageType3D::SizeType radius; 
-	radius[0] = radiusX; // radius along x 
-	radius[1] = radiusY; // radius along y 
-	radius[2] = radiusZ; // radius along y 
+	//Same result as itk::MedianImageFilter, in a time independent of the x-y radius
+	ImageType3D::Pointer outImg = ImageType3D::New();
+	outImg->SetRegions( myImg->GetBufferedRegion() );
+	outImg->SetOrigin( myImg->GetOrigin() );
+	outImg->SetSpacing( myImg->GetSpacing() );
+	outImg->Allocate();
 
-	typedef itk::MedianImageFilter<ImageType3D,ImageType3D> FilterType;
-	FilterType::Pointer filter = FilterType::New();
-	filter->SetRadius( radius );  
-	filter->SetInput(myImg);
+	ImageType3D::SizeType size = myImg->GetBufferedRegion().GetSize();
+	int imageSize[3] = { (int)size[0], (int)size[1], (int)size[2] };
+	int radius[3] = { radiusX, radiusY, radiusZ };
+	ftk::RankMedian( myImg->GetBufferPointer(), outImg->GetBufferPointer(), imageSize, radius );
 
-	try
-    {
-		filter->Update();
-    }
-	catch( itk::ExceptionObject & err )
-    {
-		std::cerr << "Exception caught: " << err << std::endl;
-    }
-
-	myImg = filter->GetOutput();
+	myImg = outImg;
 }
 
 void Preprocess::OpeningFilter( int radius )
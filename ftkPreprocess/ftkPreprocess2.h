@@ -22,10 +22,12 @@ limitations under the License.
 
 // NOTE THAT THIS CLASS IS WRITTEN FOR 8-BIT IMAGE PROCESSING
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <string>
 #include <string.h>
 
 #include <tinyxml/tinyxml.h>
@@ -62,6 +64,9 @@ limitations under the License.
 #include "itkCannyEdgeDetectionImageFilter.h"
 #include "itkImageDuplicator.h"
 #include "itkThresholdImageFilter.h"
+#include "itkMultiThreader.h"
+
+#include "ftkCommon/ftkRankFilters.h"
 
 #include "GraphCuts/itkMinErrorThresholdImageFilter.h"
 #include "GraphCuts/new_graph.h"
@@ -92,6 +97,10 @@ public:
 
 	void RunPipe(std::string filename);
 
+	//Consecutive neighborhood stages of the pipe are run tile by tile,
+	//each tile grown by the radii of the stages that follow
+	void SetTileSize(int x=128, int y=128, int z=32);
+
 	ImageType3D::Pointer GetImage(){ return myImg; };
 	void SetImage(ImageType3D::Pointer img);
 
@@ -123,6 +132,19 @@ public:
 	
 protected:
 	ImageType3D::Pointer myImg;
+	int tileSize[3];
+
+	//A stage of the pipe that only needs a neighborhood of each pixel
+	struct TiledStage
+	{
+		std::string name;
+		int radius[3];		//how far the stage reaches in x, y and z
+		int param[3];		//the arguments of the stage
+	};
+	static bool IsTileable(TiXmlElement * element);
+	TiledStage ReadTiledStage(TiXmlElement * element);
+	void RunTiledStage(const TiledStage & stage);
+	void RunTiledStages(const std::vector<TiledStage> & stages);
 
 	ImageType2D::Pointer ExtractSlice(ImageType3D::Pointer img, int slice);
 	ImageType3D::Pointer SliceTo3D(ImageType2D::Pointer img);
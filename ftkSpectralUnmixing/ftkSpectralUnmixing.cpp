@@ -45,10 +45,6 @@ void SpectralUnmixing::Update(void)
 		std::cout<<"Cannot handle more than: "<<MAX_CHANNS<<" channels.\n";
 		return;
 	}
-	// Don't forget to pixel data type
-	ftk::Image::PtrMode mode;
-	mode = static_cast<ftk::Image::PtrMode>(2); //DEEP_COPY mode
-
 	// First Get the FingerPrint Matrix:
 	//InputImageType::Pointer imdata[MAX_CHANNS];
 	//for(int ch = 0; ch< NChannels; ++ch)
@@ -58,6 +54,11 @@ void SpectralUnmixing::Update(void)
 //	vnl_matrix<double> FingerPrintMatrix = GetFingerPrintMatrix(imdata);
 	vnl_matrix<double> FingerPrintMatrix = this->GetFingerPrintMatrix();
 	printf("Finished Estimating from first Image, I am gonna use it to unmix everything else\n");
+	if(!this->Engine.SetEndmembers(FingerPrintMatrix))	// factorize once for all time points
+	{
+		std::cout<<"Cannot unmix "<<NChannels<<" channels into "<<MChannels<<" channels.\n";
+		return;
+	}
 	
 	int numTSlices = (int)Image->GetImageInfo()->numTSlices;
 	for(int T=0; T<numTSlices; ++T)
@@ -67,7 +68,7 @@ void SpectralUnmixing::Update(void)
 
 		for(int ch = 0; ch< NChannels; ++ch)
 		{
-			im[ch] = Image->GetItkPtr<InputPixelType>(T,ch,mode);
+			im[ch] = Image->GetItkPtr<InputPixelType>(T,ch);	// no copy when the channels are 8-bit
 		}
 		printf("Initiating unmixing for T = %d\n",T);
 		UnmixClustering(im,om,FingerPrintMatrix);
@@ -207,6 +208,8 @@ void SpectralUnmixing::UnmixClustering(InputImageType::Pointer im[],InputImageTy
 {
 	if(unmixMode == PIXEL_CLASSIFICATION)
 		this->UnmixPureChannels(im,om,start);
+	else if(unmixMode == NON_NEGATIVE_UNMIX)
+		this->UnmixNonNegative(im,om,start);
 	else if(unmixMode == LINEAR_UNMIX && sysMode == OVER_DETERMINED) 
 		this->UnmixUsingPseudoInverse(im,om,start);
 	else 
@@ -216,349 +219,70 @@ void SpectralUnmixing::UnmixClustering(InputImageType::Pointer im[],InputImageTy
  
 void SpectralUnmixing::UnmixUsingPseudoInverse(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start)
 {
-	InputImageType::SizeType size = im[0]->GetLargestPossibleRegion().GetSize();
-	int total_voxels = size[0]*size[1]*size[2];
-	IteratorType iterator[MAX_CHANNS];
-	IteratorType assigniter[MAX_CHANNS];
-	IteratorType oiter[20];
-	for(int counter=0; counter<MChannels; counter++)	
-	{
-		om[counter]= InputImageType::New();
-		om[counter]->SetRegions(im[0]->GetLargestPossibleRegion());
-		om[counter]->Allocate();
-		oiter[counter] = IteratorType(om[counter],om[counter]->GetLargestPossibleRegion());
-		oiter[counter].GoToBegin();
-	}
-	// allocate memeory for the assignment image
-	InputImageType::Pointer assignment_image = InputImageType::New();
-	assignment_image->SetRegions(om[0]->GetLargestPossibleRegion());
-	assignment_image->Allocate();
-	IteratorType assignment_iter = IteratorType(assignment_image,assignment_image->GetLargestPossibleRegion());
-	assignment_iter.GoToBegin();
-	int num_processed = 0;
 	printf("Performing unmixing...\n");
-	int final_counter=0;
-	vnl_matrix<double> inveigen = vnl_matrix_inverse<double>(start).pinverse(6); //get the pseudo inverse of start (a random matrix)
-	inveigen.print(std::cout);
-	vnl_qr<double> qrdecomp(start);	// get the QR decomposition of start( supposedly the fingerprint matrix)
-	vnl_vector<double> inputmixed(NChannels);
-	double min_values[MAX_CHANNS];
-	for(int counter =0; counter <MChannels; counter++)
-		min_values[counter] = 1000000.0f;
-	for(int counter = 0; counter <NChannels ; counter++)
-	{
-		iterator[counter] = IteratorType(im[counter],im[counter]->GetLargestPossibleRegion());
-		iterator[counter].GoToBegin();
-	}
-	int negcount = 0;
-	for(;!iterator[0].IsAtEnd();) // iterate through voxels
-	{
-		double max_proj = -123213;
-		int maxpos = -1;
-		for(int counter =0; counter < NChannels; counter++)
-		{
-			++iterator[counter];
-		}
-	}
-	for(int counter = 0; counter < NChannels; counter++)
-		iterator[counter].GoToBegin();
-	for(int counter = 0; counter < MChannels; counter++)
-		printf("min_values[%d] = %lf\n",counter, min_values[counter]);
-	vnl_vector<int> class_count(MChannels,0);
-	for(;!oiter[0].IsAtEnd();)
-	{
-		final_counter++;
-		if(final_counter%1000000==0)
-			printf("%.2lf\r",final_counter*100.0/total_voxels);
-		for(int co =0; co<NChannels; co++)
-		{
-		//	inputmixed[co] = iterator[co].Get()-mean_values[co];
-			inputmixed[co] = iterator[co].Get();
-		}
-		vnl_vector<double> outputmixed = inveigen*inputmixed;
-		//vnl_vector<double> outputmixed = qrdecomp.solve(inputmixed);
-		double negflag = false;
-		for(int co = 0; co < MChannels; co++)
-		{	
-			if(outputmixed[co]<0)
-				negflag = true;
-			oiter[co].Set(MAX(MIN((outputmixed[co]),255),0));
-		}
-		if(negflag)
-			negcount++;
-		for(int co = 0; co<NChannels; co++)
-		{
-			++iterator[co];
-		}
-		for(int co = 0; co<MChannels; co++)
-		{
-			++oiter[co];
-		}
-	}
-	// store the pointers to the channels in a vector
-	std::vector<InputImageType::Pointer> tmp;
-	for(int co = 0; co<MChannels; co++)
-		tmp.push_back(om[co]);
-	Unmixed_Images.push_back(tmp);
-	for(int count = 0; count < MChannels; count ++)
-	{
-		printf("class_count[%d] = %d\n", count,class_count[count]);
-	}
+	this->Engine.SetSolver(UnmixingEngine::LEAST_SQUARES);	// pseudo inverse of the fingerprint matrix, computed once in Update
+	this->UnmixWithEngine(im,om,NULL);
+	printf(" Done.\n");
+}
+void SpectralUnmixing::UnmixNonNegative(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start)
+{
+	printf("Performing non-negative unmixing...\n");
+	this->Engine.SetSolver(UnmixingEngine::NON_NEGATIVE);
+	this->UnmixWithEngine(im,om,NULL);
 	printf(" Done.\n");
-	printf("End of function\n");
 }
 void SpectralUnmixing::UnmixUsingIterations(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start)
 {
-	InputImageType::SizeType size = im[0]->GetLargestPossibleRegion().GetSize();
-	int total_voxels = size[0]*size[1]*size[2];
-	IteratorType iterator[MAX_CHANNS];
-	IteratorType assigniter[MAX_CHANNS];
-	IteratorType oiter[20];
-	for(int counter=0; counter<MChannels; counter++)	
-	{
-		om[counter]= InputImageType::New();
-		om[counter]->SetRegions(im[0]->GetLargestPossibleRegion());
-		om[counter]->Allocate();
-		oiter[counter] = IteratorType(om[counter],om[counter]->GetLargestPossibleRegion());
-		oiter[counter].GoToBegin();
-	}
-	// allocate memeory for the assignment image
-	InputImageType::Pointer assignment_image = InputImageType::New();
-	assignment_image->SetRegions(om[0]->GetLargestPossibleRegion());
-	assignment_image->Allocate();
-	IteratorType assignment_iter = IteratorType(assignment_image,assignment_image->GetLargestPossibleRegion());
-	assignment_iter.GoToBegin();
-	int num_processed = 0;
+	// Unmix Using iterative method(Under-determined System): take the largest projection out of the voxel and project the rest again
 	printf("Performing unmixing...\n");
-	int final_counter=0;
-	vnl_vector<double> inputmixed(NChannels);
-	double min_values[MAX_CHANNS];
-	for(int counter =0; counter <MChannels; counter++)
-		min_values[counter] = 1000000.0f;
-	for(int counter = 0; counter <NChannels ; counter++)
-	{
-		iterator[counter] = IteratorType(im[counter],im[counter]->GetLargestPossibleRegion());
-		iterator[counter].GoToBegin();
-	}
-
-	// Unmix Using iterative method(Under-determined System):
-	int negcount = 0;
-	for(;!iterator[0].IsAtEnd();) // iterate through voxels
-	{
-		double max_proj = -123213;
-		int maxpos = -1;
-		for(int counter =0; counter < NChannels; counter++)
-		{
-			++iterator[counter];
-		}
-	}
-	for(int counter = 0; counter < NChannels; counter++)
-		iterator[counter].GoToBegin();
-	for(int counter = 0; counter < MChannels; counter++)
-		printf("min_values[%d] = %lf\n",counter, min_values[counter]);
-	vnl_vector<int> class_count(MChannels,0);
-	for(;!oiter[0].IsAtEnd();)
-	{
-		final_counter++;
-		if(final_counter%1000000==0)
-			printf("%.2lf\r",final_counter*100.0/total_voxels);
-				
-		vnl_vector<double> b(NChannels);
-		vnl_vector<int> marker(MChannels,0);
-		for(int co_n = 0; co_n < NChannels; co_n++)
-		{
-			b[co_n] = iterator[co_n].Get();
-		}
-		for(int co_n = 0; co_n < NChannels; co_n++)
-		{
-			int max_proj_co = -1;
-			double max_proj_sum = 1;
-			for(int co_m = 0; co_m < MChannels ; co_m++)
-			{
-				double proj_sum = 0;
-
-				for(int co1 = 0; co1 < NChannels; co1++)
-				{
-					proj_sum += start[co1][co_m]*b[co1];
-				}
-				if(proj_sum > max_proj_sum)
-				{
-					max_proj_sum = proj_sum;
-					max_proj_co = co_m;
-				}
-			}
-			if(max_proj_co >=0)
-			{
-				//if(marker[max_proj_co]==0)
-				{
-					oiter[max_proj_co].Set(MAX(MIN(255,max_proj_sum),0));
-					++class_count[max_proj_co];
-					marker[max_proj_co] = 1;
-					b = b - max_proj_sum*start.get_column(max_proj_co);
-				}
-				/*
-				else
-				{
-					printf("Why am I setting it again?\n");
-				}*/
-			}
-			else
-				break;
-		}
-		for(int co = 0; co<NChannels; co++)
-		{
-			++iterator[co];
-		}
-		for(int co = 0; co<MChannels; co++)
-		{
-			++oiter[co];
-		}
-	}
-	// store the pointers to the channels in a vector
-	std::vector<InputImageType::Pointer> tmp;
-	for(int co = 0; co<MChannels; co++)
-		tmp.push_back(om[co]);
-	Unmixed_Images.push_back(tmp);
-	for(int count = 0; count < MChannels; count ++)
-	{
-		printf("class_count[%d] = %d\n", count,class_count[count]);
-	}
+	this->Engine.SetSolver(UnmixingEngine::GREEDY);
+	this->UnmixWithEngine(im,om,NULL);
 	printf(" Done.\n");
-	printf("End of function\n");
 }
-
-
-
 void SpectralUnmixing::UnmixPureChannels(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start)
 {
-	InputImageType::SizeType size = im[0]->GetLargestPossibleRegion().GetSize();
-	int total_voxels = size[0]*size[1]*size[2];
-	IteratorType iterator[MAX_CHANNS];
-	IteratorType assigniter[MAX_CHANNS];
-
-	IteratorType oiter[20];
-	for(int counter=0; counter<MChannels; counter++)	
-	{
-		om[counter]= InputImageType::New();
-		om[counter]->SetRegions(im[0]->GetLargestPossibleRegion());
-		om[counter]->Allocate();
-		oiter[counter] = IteratorType(om[counter],om[counter]->GetLargestPossibleRegion());
-		oiter[counter].GoToBegin();
-	}
-	// allocate memeory for the assignment image
-	InputImageType::Pointer assignment_image = InputImageType::New();
-	assignment_image->SetRegions(om[0]->GetLargestPossibleRegion());
-	assignment_image->Allocate();
-	IteratorType assignment_iter = IteratorType(assignment_image,assignment_image->GetLargestPossibleRegion());
-	assignment_iter.GoToBegin();
-	int num_processed = 0;
 	printf("Performing unmixing...\n");
-	int final_counter=0;
-	vnl_vector<double> inputmixed(NChannels);
-	double min_values[MAX_CHANNS];
-	for(int counter =0; counter <MChannels; counter++)
-		min_values[counter] = 1000000.0f;
-	for(int counter = 0; counter <NChannels ; counter++)
-	{
-		iterator[counter] = IteratorType(im[counter],im[counter]->GetLargestPossibleRegion());
-		iterator[counter].GoToBegin();
-	}
-	// Pixel Classification Assignment
-	int negcount = 0;
-	for(;!iterator[0].IsAtEnd();) // iterate through voxels
-	{
-		double max_proj = -123213;
-		int maxpos = -1;
-		for(int co = 0; co < MChannels; co++)	// iterate through the output channels
-		{
-			double proj_sum = 0;
-			for(int co1 = 0; co1 < NChannels; co1++)	// iterate through the input channels
-			{
-				proj_sum += start[co1][co]*iterator[co1].Get();
-			}
-			if(max_proj < proj_sum)
-			{
-				max_proj = proj_sum;
-				maxpos = co;
-			}
-		}
-		//printf("loop 1 complete\n");
-		assignment_iter.Set(maxpos);
-		++assignment_iter;
-		for(int counter =0; counter < NChannels; counter++)
-		{
-			++iterator[counter];
-		}
-	}
-	for(int counter = 0; counter < NChannels; counter++)
-		iterator[counter].GoToBegin();
-	for(int counter = 0; counter < MChannels; counter++)
-		printf("min_values[%d] = %lf\n",counter, min_values[counter]);
-
-	typedef itk::MedianImageFilter<InputImageType,InputImageType> GrayScaleMedianFilterType;
-	GrayScaleMedianFilterType::Pointer binmedfilt = GrayScaleMedianFilterType::New();
-	binmedfilt->SetInput(assignment_image);
-	InputImageType::SizeType radius;
-	radius[0] = 1;
-	radius[1] = 1;
-	radius[2] = 0;
-	binmedfilt->SetRadius(radius);
-	binmedfilt->Update();
-	assignment_image = binmedfilt->GetOutput();
-	assignment_iter = IteratorType(assignment_image,assignment_image->GetLargestPossibleRegion());
-	assignment_iter.GoToBegin();
-
-	vnl_vector<int> class_count(MChannels,0);
-	for(;!oiter[0].IsAtEnd();)
+	InputImageType::SizeType size = im[0]->GetLargestPossibleRegion().GetSize();
+	int imageSize[3] = { (int)size[0], (int)size[1], (int)size[2] };
+	const InputPixelType * input[MAX_CHANNS];
+	for(int co = 0; co < NChannels; co++)
+		input[co] = im[co]->GetBufferPointer();
+
+	// Pixel Classification Assignment: maximum projection onto the cluster centers, then a 3x3 median of the assignments
+	std::vector<unsigned char> assignment((long)imageSize[0]*imageSize[1]*imageSize[2]);
+	std::vector<unsigned char> smoothed(assignment.size());
+	this->Engine.Classify(input, &assignment[0], imageSize);
+	int radius[3] = { 1, 1, 0 };
+	ftk::RankMedian(&assignment[0], &smoothed[0], imageSize, radius);
+
+	this->UnmixWithEngine(im,om,&smoothed[0]);
+	printf(" Done.\n");
+}
+void SpectralUnmixing::UnmixWithEngine(InputImageType::Pointer im[],InputImageType::Pointer om[],const unsigned char * labels)
+{
+	InputImageType::SizeType size = im[0]->GetLargestPossibleRegion().GetSize();
+	int imageSize[3] = { (int)size[0], (int)size[1], (int)size[2] };
+	const InputPixelType * input[MAX_CHANNS];
+	OutputPixelType * output[MAX_CHANNS];
+	for(int co = 0; co < NChannels; co++)
+		input[co] = im[co]->GetBufferPointer();
+	for(int co = 0; co < MChannels; co++)
 	{
-		final_counter++;
-		if(final_counter%1000000==0)
-			printf("%.2lf\r",final_counter*100.0/total_voxels);
-		double max_proj = -133434;
-		int maxpos = -1;
-		double proj_sum = 0;
-		for(int co1 = 0; co1 < NChannels; co1++)
-		{
-			proj_sum += start[co1][assignment_iter.Get()]*iterator[co1].Get();
-		}
-		maxpos = assignment_iter.Get();
-		for(int co = 0; co < MChannels; co++)
-		{
-			if(maxpos != co)
-			{
-				oiter[co].Set(0);
-			}
-			else
-			{
-				if(proj_sum<255)
-					oiter[co].Set(proj_sum);
-				else
-					oiter[co].Set(255);
-			}
-		}
-		
-		++assignment_iter;
-		for(int co = 0; co<NChannels; co++)
-		{
-			++iterator[co];
-		}
-		for(int co = 0; co<MChannels; co++)
-		{
-			++oiter[co];
-		}
+		om[co] = InputImageType::New();
+		om[co]->SetRegions(im[0]->GetLargestPossibleRegion());
+		om[co]->Allocate();
+		output[co] = om[co]->GetBufferPointer();
 	}
+	if(labels)
+		this->Engine.ProjectOnLabels(input, labels, output, imageSize);
+	else
+		this->Engine.Unmix(input, output, imageSize);
+
 	// store the pointers to the channels in a vector
 	std::vector<InputImageType::Pointer> tmp;
 	for(int co = 0; co<MChannels; co++)
 		tmp.push_back(om[co]);
 	Unmixed_Images.push_back(tmp);
-	for(int count = 0; count < MChannels; count ++)
-	{
-		printf("class_count[%d] = %d\n", count,class_count[count]);
-	}
-	printf(" Done.\n");
-	printf("End of function\n");
-
 }
 void SpectralUnmixing::ConvertOutputToftk(void)	
 {
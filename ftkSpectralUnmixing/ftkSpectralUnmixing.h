@@ -36,6 +36,8 @@
 
 #include <ftkImage/ftkImage.h>
 #include <ftkCommon/ftkUtils.h>
+#include <ftkCommon/ftkRankFilters.h>
+#include "ftkUnmixingEngine.h"
 #define MAX(a,b) (((a) > (b))?(a):(b))
 #define MIN(a,b) (((a) < (b))?(a):(b))
 
@@ -69,7 +71,7 @@ class SpectralUnmixing
 		typedef itk::ImageLinearIteratorWithIndex< Input2DImageType > LinearIteratorType;
 		typedef itk::ImageSliceConstIteratorWithIndex< InputImageType > SliceIteratorType;
 		typedef itk::MedianImageFilter<InputImageType,InputImageType> MedianFilterType;
-		typedef enum { PIXEL_CLASSIFICATION, LINEAR_UNMIX } UnmixMode;
+		typedef enum { PIXEL_CLASSIFICATION, LINEAR_UNMIX, NON_NEGATIVE_UNMIX } UnmixMode;
 
 		void SetInputImage(ftk::Image::Pointer image);
 		void SetNumberOfChannels(int m);
@@ -87,11 +89,14 @@ class SpectralUnmixing
 		int MChannels;							// number of output channels
 		int NChannels;							// number of input channels
 		std::vector<std::vector<InputImageType::Pointer> >Unmixed_Images;
+		UnmixingEngine Engine;					// fingerprint matrix factorized for the batched unmixing
 
 		// Functions:
 		//vnl_matrix<double> GetFingerPrintMatrix(InputImageType::Pointer im[]);
 		vnl_matrix<double> GetFingerPrintMatrix(void);
 		void EstimateFingerPrintMatrix(vnl_matrix<double> mixed, vnl_matrix<double> &start, vnl_vector<unsigned char> &indices);
+		void UnmixNonNegative(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start);// least squares with non-negative abundances, for any MChannels and NChannels
+		void UnmixWithEngine(InputImageType::Pointer im[],InputImageType::Pointer om[],const unsigned char * labels);
 		void UnmixPureChannels(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start);	// this unmixing method uses voxel classification based on maximum projection onto cluster centers
 		void UnmixUsingIterations(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start);// this method is for over-determined/full ranked systems MChannels<=NChannels
 		void UnmixUsingPseudoInverse(InputImageType::Pointer im[],InputImageType::Pointer om[],vnl_matrix<double> &start);// this method is for over-determined/full ranked systems MChannels<=NChannels
@@ -0,0 +1,428 @@
+#include "ftkUnmixingEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <vnl/algo/vnl_matrix_inverse.h>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+namespace ftk
+{
+
+namespace
+{
+//Tolerance on the gradient and on the abundances of the active set solver,
+//in units of intensity
+const double NNLS_TOLERANCE = 1e-6;
+
+inline UnmixingEngine::OutputSet Bit(int output)
+{
+	return (UnmixingEngine::OutputSet)1 << output;
+}
+
+//out (rows x count) = matrix (rows x cols) * batch (cols x count)
+void MultiplyBatch(const float * matrix, int rows, int cols, const float * batch, int count, float * out)
+{
+	for(int r=0; r<rows; ++r)
+	{
+		float * o = out + (long)r*count;
+		for(int i=0; i<count; ++i)
+			o[i] = 0.0f;
+		for(int c=0; c<cols; ++c)
+		{
+			const float a = matrix[r*cols+c];
+			const float * b = batch + (long)c*count;
+			for(int i=0; i<count; ++i)
+				o[i] += a * b[i];
+		}
+	}
+}
+
+template< class TPixel >
+inline TPixel Clamp(double value)
+{
+	const double top = (double)std::numeric_limits<TPixel>::max();
+	if(value <= 0)
+		return 0;
+	if(value >= top)
+		return std::numeric_limits<TPixel>::max();
+	return (TPixel)value;
+}
+
+} // end anonymous namespace
+
+UnmixingEngine::UnmixingEngine()
+{
+	this->solver = LEAST_SQUARES;
+	this->nInputs = 0;
+	this->nOutputs = 0;
+}
+
+bool UnmixingEngine::SetEndmembers(const vnl_matrix<double> & endmembers)
+{
+	const int N = (int)endmembers.rows();
+	const int M = (int)endmembers.cols();
+	if(N == 0 || M == 0 || M > MAX_OUTPUTS)
+		return false;
+	this->nInputs = N;
+	this->nOutputs = M;
+
+	vnl_matrix<double> inveigen = vnl_matrix_inverse<double>(endmembers).pinverse(6);
+	this->pseudoInverse.resize(M*N);
+	this->transposed.resize(M*N);
+	for(int j=0; j<M; ++j)
+	{
+		for(int i=0; i<N; ++i)
+		{
+			this->pseudoInverse[j*N+i] = (float)inveigen[j][i];
+			this->transposed[j*N+i] = (float)endmembers[i][j];
+		}
+	}
+
+	this->gram.assign(M*M, 0.0);
+	for(int j=0; j<M; ++j)
+		for(int k=0; k<M; ++k)
+			for(int i=0; i<N; ++i)
+				this->gram[j*M+k] += endmembers[i][j] * endmembers[i][k];
+
+	//The non-negative solver works on subsets of the outputs, factor them all
+	//now so the threads only read them
+	this->factors.clear();
+	this->factorValid.clear();
+	if(M <= MAX_CACHED_OUTPUTS)
+	{
+		const unsigned int subsets = 1u << M;
+		this->factors.assign((long)subsets*M*M, 0.0);
+		this->factorValid.assign(subsets, 0);
+		for(unsigned int s=1; s<subsets; ++s)
+			this->factorValid[s] = this->Factorize(s, &this->factors[(long)s*M*M]) ? 1 : 0;
+	}
+	return true;
+}
+
+//Cholesky factor of the Gram matrix restricted to the outputs in subset,
+//stored k x k row major for a subset of k outputs
+bool UnmixingEngine::Factorize(OutputSet subset, double * factor) const
+{
+	const int M = this->nOutputs;
+	int index[MAX_OUTPUTS];
+	int k = 0;
+	for(int j=0; j<M; ++j)
+		if(subset & Bit(j))
+			index[k++] = j;
+
+	double largest = 0;
+	for(int a=0; a<k; ++a)
+		largest = std::max(largest, this->gram[index[a]*M+index[a]]);
+	for(int a=0; a<k; ++a)
+	{
+		for(int b=0; b<=a; ++b)
+		{
+			double sum = this->gram[index[a]*M+index[b]];
+			for(int c=0; c<b; ++c)
+				sum -= factor[a*k+c] * factor[b*k+c];
+			if(a == b)
+			{
+				//Endmembers which are (nearly) dependent can not be active together
+				if(sum <= 1e-10 * largest)
+					return false;
+				factor[a*k+a] = std::sqrt(sum);
+			}
+			else
+				factor[a*k+b] = sum / factor[b*k+b];
+		}
+	}
+	return true;
+}
+
+//x = least squares solution using only the outputs in subset, 0 elsewhere
+bool UnmixingEngine::SolveSubset(OutputSet subset, const double * rhs, double * x, double * work) const
+{
+	const int M = this->nOutputs;
+	const double * factor;
+	if(!this->factorValid.empty())
+	{
+		if(!this->factorValid[subset])
+			return false;
+		factor = &this->factors[(long)subset*M*M];
+	}
+	else
+	{
+		if(!this->Factorize(subset, work))
+			return false;
+		factor = work;
+	}
+
+	int index[MAX_OUTPUTS];
+	int k = 0;
+	for(int j=0; j<M; ++j)
+	{
+		x[j] = 0;
+		if(subset & Bit(j))
+			index[k++] = j;
+	}
+	double * y = work + M*M;
+	for(int a=0; a<k; ++a)
+	{
+		double sum = rhs[index[a]];
+		for(int c=0; c<a; ++c)
+			sum -= factor[a*k+c] * y[c];
+		y[a] = sum / factor[a*k+a];
+	}
+	for(int a=k-1; a>=0; --a)
+	{
+		double sum = y[a];
+		for(int c=a+1; c<k; ++c)
+			sum -= factor[c*k+a] * y[c];
+		y[a] = sum / factor[a*k+a];
+	}
+	for(int a=0; a<k; ++a)
+		x[index[a]] = y[a];
+	return true;
+}
+
+//Lawson-Hanson active set method for min |Ax-b| with x >= 0, given c = A'b.
+//passive holds the outputs which were positive for the previous voxel on
+//entry, and those of this voxel on exit.
+void UnmixingEngine::SolveNonNegative(const double * c, double * x, OutputSet & passive, double * work) const
+{
+	const int M = this->nOutputs;
+	double s[MAX_OUTPUTS];
+
+	//Warm start: shrink the previous passive set until its least squares
+	//solution is positive, which is a feasible starting point
+	OutputSet P = passive;
+	while(P)
+	{
+		if(!this->SolveSubset(P, c, s, work))
+		{
+			P = 0;
+			break;
+		}
+		int worst = -1;
+		double lowest = NNLS_TOLERANCE;
+		for(int j=0; j<M; ++j)
+		{
+			if((P & Bit(j)) && s[j] < lowest)
+			{
+				lowest = s[j];
+				worst = j;
+			}
+		}
+		if(worst < 0)
+			break;
+		P &= ~Bit(worst);
+	}
+	for(int j=0; j<M; ++j)
+		x[j] = (P & Bit(j)) ? s[j] : 0.0;
+
+	OutputSet excluded = 0;
+	for(int iteration=0; iteration<3*M; ++iteration)
+	{
+		//Output with the largest gradient outside the passive set
+		int best = -1;
+		double largest = NNLS_TOLERANCE;
+		for(int j=0; j<M; ++j)
+		{
+			if((P | excluded) & Bit(j))
+				continue;
+			double w = c[j];
+			for(int k=0; k<M; ++k)
+				w -= this->gram[j*M+k] * x[k];
+			if(w > largest)
+			{
+				largest = w;
+				best = j;
+			}
+		}
+		if(best < 0)
+			break;
+
+		P |= Bit(best);
+		if(!this->SolveSubset(P, c, s, work))
+		{
+			P &= ~Bit(best);
+			excluded |= Bit(best);
+			continue;
+		}
+		//Step towards s until an abundance hits zero, and drop it
+		for(;;)
+		{
+			double alpha = 2;
+			for(int j=0; j<M; ++j)
+				if((P & Bit(j)) && s[j] <= NNLS_TOLERANCE)
+					alpha = std::min(alpha, x[j] > s[j] ? x[j] / (x[j] - s[j]) : 0.0);
+			if(alpha > 1)
+				break;
+			for(int j=0; j<M; ++j)
+			{
+				if(!(P & Bit(j)))
+					continue;
+				x[j] += alpha * (s[j] - x[j]);
+				if(x[j] <= NNLS_TOLERANCE)
+				{
+					x[j] = 0;
+					P &= ~Bit(j);
+				}
+			}
+			if(!P || !this->SolveSubset(P, c, s, work))
+				break;
+		}
+		for(int j=0; j<M; ++j)
+			x[j] = (P & Bit(j)) ? s[j] : 0.0;
+	}
+	passive = P;
+}
+
+//Takes the largest projection out of the voxel and projects the remainder
+//again, once per input channel. Since the projections of b - t*a_k are
+//c - t*G[:,k], this needs only the Gram matrix.
+void UnmixingEngine::SolveGreedy(const double * c, double * x) const
+{
+	const int M = this->nOutputs;
+	double proj[MAX_OUTPUTS];
+	for(int j=0; j<M; ++j)
+	{
+		proj[j] = c[j];
+		x[j] = 0;
+	}
+	for(int n=0; n<this->nInputs; ++n)
+	{
+		int best = -1;
+		double largest = 1;
+		for(int j=0; j<M; ++j)
+		{
+			if(proj[j] > largest)
+			{
+				largest = proj[j];
+				best = j;
+			}
+		}
+		if(best < 0)
+			break;
+		x[best] = largest;
+		for(int j=0; j<M; ++j)
+			proj[j] -= largest * this->gram[j*M+best];
+	}
+}
+
+template< class TPixel >
+void UnmixingEngine::Process(const TPixel * const * input, const unsigned char * labelsIn, unsigned char * labelsOut,
+	TPixel * const * output, const int size[3]) const
+{
+	const int N = this->nInputs;
+	const int M = this->nOutputs;
+	const int count = size[0];
+	const long rows = (long)size[1] * size[2];
+
+	//Static schedule: every thread gets one slab of consecutive rows
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		std::vector<float> batch((long)N*count);
+		std::vector<float> proj((long)M*count);
+		std::vector<double> work(M*M + M);
+		double c[MAX_OUTPUTS], x[MAX_OUTPUTS];
+
+		#ifdef _OPENMP
+		#pragma omp for schedule(static)
+		#endif
+		for(long row=0; row<rows; ++row)
+		{
+			const long offset = row * count;
+			for(int n=0; n<N; ++n)
+			{
+				const TPixel * in = input[n] + offset;
+				float * b = &batch[(long)n*count];
+				for(int i=0; i<count; ++i)
+					b[i] = (float)in[i];
+			}
+
+			if(!labelsOut && !labelsIn && this->solver == LEAST_SQUARES)
+			{
+				MultiplyBatch(&this->pseudoInverse[0], M, N, &batch[0], count, &proj[0]);
+				for(int j=0; j<M; ++j)
+				{
+					const float * p = &proj[(long)j*count];
+					TPixel * out = output[j] + offset;
+					for(int i=0; i<count; ++i)
+						out[i] = Clamp<TPixel>(p[i]);
+				}
+				continue;
+			}
+
+			MultiplyBatch(&this->transposed[0], M, N, &batch[0], count, &proj[0]);
+			if(labelsOut || labelsIn || this->solver == CLASSIFY)
+			{
+				for(int i=0; i<count; ++i)
+				{
+					int label;
+					if(labelsIn)
+						label = labelsIn[offset+i];
+					else
+					{
+						label = 0;
+						for(int j=1; j<M; ++j)
+							if(proj[(long)j*count+i] > proj[(long)label*count+i])
+								label = j;
+					}
+					if(labelsOut)
+					{
+						labelsOut[offset+i] = (unsigned char)label;
+						continue;
+					}
+					for(int j=0; j<M; ++j)
+						output[j][offset+i] = 0;
+					if(label < M)
+						output[label][offset+i] = Clamp<TPixel>(proj[(long)label*count+i]);
+				}
+				continue;
+			}
+
+			OutputSet passive = 0;
+			for(int i=0; i<count; ++i)
+			{
+				for(int j=0; j<M; ++j)
+					c[j] = proj[(long)j*count+i];
+				if(this->solver == NON_NEGATIVE)
+					this->SolveNonNegative(c, x, passive, &work[0]);
+				else
+					this->SolveGreedy(c, x);
+				for(int j=0; j<M; ++j)
+					output[j][offset+i] = Clamp<TPixel>(x[j]);
+			}
+		}
+	}
+}
+
+template< class TPixel >
+void UnmixingEngine::Unmix(const TPixel * const * input, TPixel * const * output, const int size[3]) const
+{
+	this->Process<TPixel>(input, NULL, NULL, output, size);
+}
+
+template< class TPixel >
+void UnmixingEngine::Classify(const TPixel * const * input, unsigned char * labels, const int size[3]) const
+{
+	this->Process<TPixel>(input, NULL, labels, NULL, size);
+}
+
+template< class TPixel >
+void UnmixingEngine::ProjectOnLabels(const TPixel * const * input, const unsigned char * labels, TPixel * const * output, const int size[3]) const
+{
+	this->Process<TPixel>(input, labels, NULL, output, size);
+}
+
+template void UnmixingEngine::Unmix<unsigned char>(const unsigned char * const *, unsigned char * const *, const int [3]) const;
+template void UnmixingEngine::Unmix<unsigned short>(const unsigned short * const *, unsigned short * const *, const int [3]) const;
+template void UnmixingEngine::Classify<unsigned char>(const unsigned char * const *, unsigned char *, const int [3]) const;
+template void UnmixingEngine::Classify<unsigned short>(const unsigned short * const *, unsigned char *, const int [3]) const;
+template void UnmixingEngine::ProjectOnLabels<unsigned char>(const unsigned char * const *, const unsigned char *, unsigned char * const *, const int [3]) const;
+template void UnmixingEngine::ProjectOnLabels<unsigned short>(const unsigned short * const *, const unsigned char *, unsigned short * const *, const int [3]) const;
+
+}// end of namespace
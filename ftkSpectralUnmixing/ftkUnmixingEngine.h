@@ -0,0 +1,97 @@
+#ifndef __ftkUnmixingEngine_h
+#define __ftkUnmixingEngine_h
+
+#include <vector>
+
+#include <vnl/vnl_matrix.h>
+#include <vxl_config.h>
+
+namespace ftk
+{
+
+/** \brief Linear unmixing of multi-channel volumes in batches of voxels.
+ *
+ * The endmember (fingerprint) matrix A has one row per input channel and one
+ * column per output channel. Everything that depends only on A is computed
+ * once in SetEndmembers(): the pseudo-inverse, A transposed for the
+ * projections, the Gram matrix A'A and the Cholesky factors of its principal
+ * submatrices, which the non-negative solver needs.
+ *
+ * The volumes are raw buffers stored x fastest, then y, then z, one buffer
+ * per channel (the layout of ftk::Image and itk::Image). A row of voxels is
+ * gathered into one float array per channel, and the projections are
+ * computed for the whole row in loops the compiler vectorizes. With OpenMP
+ * the rows are split into slabs along z, one slab per thread.
+ *
+ * The solvers are:
+ *  CLASSIFY       each voxel goes to the endmember with the largest
+ *                 projection, and gets that projection in that channel
+ *  LEAST_SQUARES  pseudo-inverse of A times the voxel, clamped
+ *  NON_NEGATIVE   least squares with non-negative abundances (Lawson and
+ *                 Hanson active set on the Gram matrix). The active set of
+ *                 the previous voxel of the row is the starting point, so
+ *                 most voxels are solved with one or two factor lookups.
+ *  GREEDY         the largest projection is taken out of the voxel, and
+ *                 the remainder is projected again, once per input channel
+ *
+ * The outputs are clamped to the range of the pixel type. The templates are
+ * defined for unsigned char and unsigned short pixels.
+ */
+class UnmixingEngine
+{
+public:
+	typedef enum { CLASSIFY, LEAST_SQUARES, NON_NEGATIVE, GREEDY } SolverType;
+
+	//The active sets of the non-negative solver are bit masks of the outputs
+	enum { MAX_OUTPUTS = 64 };
+	typedef vxl_uint_64 OutputSet;
+
+	UnmixingEngine();
+
+	//Returns false if the matrix is empty or has more than MAX_OUTPUTS columns
+	bool SetEndmembers(const vnl_matrix<double> & endmembers);
+	void SetSolver(SolverType solver){ this->solver = solver; };
+	SolverType GetSolver(void) const { return this->solver; };
+	int GetNumberOfInputs(void) const { return this->nInputs; };
+	int GetNumberOfOutputs(void) const { return this->nOutputs; };
+
+	//Unmix the input channels into the output channels with the current solver
+	template< class TPixel >
+	void Unmix(const TPixel * const * input, TPixel * const * output, const int size[3]) const;
+
+	//Index of the endmember with the largest projection, for every voxel
+	template< class TPixel >
+	void Classify(const TPixel * const * input, unsigned char * labels, const int size[3]) const;
+
+	//Projection of every voxel onto the endmember of its label in the channel
+	//of the label, 0 in the other channels
+	template< class TPixel >
+	void ProjectOnLabels(const TPixel * const * input, const unsigned char * labels, TPixel * const * output, const int size[3]) const;
+
+private:
+	//Cholesky factors are cached for every subset of up to this many outputs
+	enum { MAX_CACHED_OUTPUTS = 10 };
+
+	//Classifies into labelsOut if given, else projects on labelsIn if given,
+	//else unmixes with the current solver
+	template< class TPixel >
+	void Process(const TPixel * const * input, const unsigned char * labelsIn, unsigned char * labelsOut,
+		TPixel * const * output, const int size[3]) const;
+
+	bool Factorize(OutputSet subset, double * factor) const;
+	bool SolveSubset(OutputSet subset, const double * rhs, double * x, double * work) const;
+	void SolveNonNegative(const double * c, double * x, OutputSet & passive, double * work) const;
+	void SolveGreedy(const double * c, double * x) const;
+
+	SolverType solver;
+	int nInputs;
+	int nOutputs;
+	std::vector<float> pseudoInverse;		//nOutputs x nInputs, row major
+	std::vector<float> transposed;			//nOutputs x nInputs, row major
+	std::vector<double> gram;				//nOutputs x nOutputs
+	std::vector<double> factors;			//nOutputs x nOutputs per subset
+	std::vector<unsigned char> factorValid;
+};
+
+}// end of namespace
+#endif